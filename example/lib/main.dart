@@ -55,6 +55,7 @@ class _MyAppState extends State<MyApp> {
   bool _activeWindowOnly = false;
   int _screenshotInterval = 10;
   Timer? _screenshotTimer;
+  StreamSubscription<ScheduledScreenshotDto>? _scheduledScreenshotSubscription;
   String? _lastSavedPath;
   final List<String> _screenshotLogs = [];
 
@@ -96,6 +97,20 @@ class _MyAppState extends State<MyApp> {
       });
     });
 
+    _scheduledScreenshotSubscription =
+        _windowFocusPlugin.onScheduledScreenshot.listen((shot) {
+      setState(() {
+        _lastSavedPath = shot.path;
+        final timestamp = DateFormat('HH:mm:ss').format(shot.timestamp);
+        _screenshotLogs.insert(
+            0,
+            '[$timestamp] Screenshot saved (${shot.size} bytes, '
+            '${shot.skippedIdle} idle / ${shot.skippedUnchanged} unchanged '
+            'skipped)');
+        if (_screenshotLogs.length > 20) _screenshotLogs.removeLast();
+      });
+    });
+
     _startTimer();
     _checkPermissions();
     _logActivity('Monitoring started with all features enabled');
@@ -282,7 +297,10 @@ class _MyAppState extends State<MyApp> {
     print('[ActivityLog] $message');
   }
 
-  Future<void> _takeScreenshot() async {
+  /// Manual screenshots are lossless PNGs; the periodic ones use JPEG, which
+  /// encodes several times faster.
+  Future<void> _takeScreenshot(
+      {ScreenshotFormat format = ScreenshotFormat.png}) async {
     if (!_hasScreenRecordingPermission) {
       await _windowFocusPlugin.requestScreenRecordingPermission();
       _messangerKey.currentState?.showSnackBar(
@@ -294,7 +312,7 @@ class _MyAppState extends State<MyApp> {
     }
 
     final screenshot = await _windowFocusPlugin.takeScreenshot(
-        activeWindowOnly: _activeWindowOnly);
+        activeWindowOnly: _activeWindowOnly, format: format, quality: 80);
     if (screenshot != null) {
       print('Screenshot captured, size: ${screenshot.length} bytes');
       setState(() {
@@ -304,24 +322,28 @@ class _MyAppState extends State<MyApp> {
             0, '[$timestamp] Screenshot captured (${screenshot.length} bytes)');
         if (_screenshotLogs.length > 20) _screenshotLogs.removeLast();
       });
-      await _saveScreenshot(screenshot);
+      await _saveScreenshot(screenshot, format);
     } else {
       print('Screenshot capture returned null');
     }
   }
 
-  Future<void> _saveScreenshot(Uint8List bytes) async {
+  Future<Directory> _screenshotsDirectory() async {
+    final directory = await getApplicationDocumentsDirectory();
+    return Directory(p.join(directory.path, 'window_focus_screenshots'));
+  }
+
+  Future<void> _saveScreenshot(Uint8List bytes, ScreenshotFormat format) async {
     try {
-      final directory = await getApplicationDocumentsDirectory();
-      final screenshotsDir =
-          Directory(p.join(directory.path, 'window_focus_screenshots'));
+      final screenshotsDir = await _screenshotsDirectory();
       if (!await screenshotsDir.exists()) {
         await screenshotsDir.create(recursive: true);
       }
 
       final timestamp =
           DateFormat('yyyy-MM-dd_HH-mm-ss').format(DateTime.now());
-      final fileName = 'screenshot_$timestamp.png';
+      final extension = format == ScreenshotFormat.jpeg ? 'jpg' : format.name;
+      final fileName = 'screenshot_$timestamp.$extension';
       final filePath = p.join(screenshotsDir.path, fileName);
 
       final file = File(filePath);
@@ -336,15 +358,31 @@ class _MyAppState extends State<MyApp> {
     }
   }
 
-  void _toggleAutoScreenshot(bool value) {
+  /// Windows and Linux save the periodic screenshots natively, skipping
+  /// ticks while the user is idle or the screen is unchanged; macOS falls
+  /// back to a Dart timer.
+  Future<void> _toggleAutoScreenshot(bool value) async {
     setState(() {
       _autoScreenshot = value;
     });
 
-    if (_autoScreenshot) {
+    if (!Platform.isMacOS) {
+      if (_autoScreenshot) {
+        final screenshotsDir = await _screenshotsDirectory();
+        await _windowFocusPlugin.startScreenshotSchedule(
+          interval: Duration(seconds: _screenshotInterval),
+          directory: screenshotsDir.path,
+          format: ScreenshotFormat.jpeg,
+          quality: 80,
+          activeWindowOnly: _activeWindowOnly,
+        );
+      } else {
+        await _windowFocusPlugin.stopScreenshotSchedule();
+      }
+    } else if (_autoScreenshot) {
       _screenshotTimer =
           Timer.periodic(Duration(seconds: _screenshotInterval), (timer) {
-        _takeScreenshot();
+        _takeScreenshot(format: ScreenshotFormat.jpeg);
       });
     } else {
       _screenshotTimer?.cancel();
@@ -1163,6 +1201,10 @@ class _MyAppState extends State<MyApp> {
   void dispose() {
     _timer.cancel();
     _screenshotTimer?.cancel();
+    _scheduledScreenshotSubscription?.cancel();
+    if (_autoScreenshot && !Platform.isMacOS) {
+      _windowFocusPlugin.stopScreenshotSchedule();
+    }
     _windowFocusPlugin.dispose();
     textController.dispose();
     super.dispose();
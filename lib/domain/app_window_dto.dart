@@ -11,6 +11,14 @@
 ///   Note: Accessing window titles on macOS might require Screen Recording permissions.
 ///   If the window title cannot be retrieved, it will fall back to the application name.
 ///
+/// [audioActive] tells whether the focused application was playing audio when
+/// it gained focus. It is only reported on Windows while audio monitoring is
+/// enabled and is null otherwise.
+///
+/// [windowId] identifies the focused window for the `window` argument of
+/// [WindowFocus.takeScreenshot]: an HWND on Windows, a CGWindowID on macOS.
+/// It is null on other platforms.
+///
 /// Example:
 /// ```dart
 /// final activeWindow = AppWindowDto(appName: "chrome.exe", windowTitle: "Google - Chrome");
@@ -21,9 +29,14 @@ class AppWindowDto{
   final String appName;
   /// The title of the active window.
   final String windowTitle;
+  /// Whether the application was playing audio when it gained focus, or
+  /// null if unknown.
+  final bool? audioActive;
+  /// The platform's id of the focused window, or null if unknown.
+  final int? windowId;
 
   /// Constructs an instance of [AppWindowDto].
-  AppWindowDto({required this.appName, required this.windowTitle});
+  AppWindowDto({required this.appName, required this.windowTitle, this.audioActive, this.windowId});
 
   /// Returns a string representation of the active window details.
   @override
@@ -0,0 +1,52 @@
+
+/// A data transfer object describing an application that has an open audio
+/// playback stream.
+///
+/// Returned by [WindowFocus.getAudioApplications]. Compare [pid] or [binary]
+/// with the focused application to tell whether it is the one playing.
+///
+/// Example:
+/// ```dart
+/// final app = AudioAppDto(pid: 4242, name: 'Firefox', binary: 'firefox', peak: 0.4, active: true);
+/// print(app); // Output: Firefox (firefox, pid 4242): active, peak 0.400
+/// ```
+class AudioAppDto {
+  /// Process ID of the application, 0 if it did not report one.
+  final int pid;
+  /// Application name reported by the audio client, may be empty.
+  final String name;
+  /// Executable name of the process, may be empty.
+  final String binary;
+  /// Most recent peak level of the stream, from 0.0 to 1.0.
+  final double peak;
+  /// Whether the stream was above the audio threshold in the last two
+  /// seconds.
+  final bool active;
+
+  /// Constructs an instance of [AudioAppDto].
+  AudioAppDto({
+    required this.pid,
+    required this.name,
+    required this.binary,
+    required this.peak,
+    required this.active,
+  });
+
+  /// Creates an [AudioAppDto] from the map sent by the platform side.
+  factory AudioAppDto.fromMap(Map<dynamic, dynamic> map) {
+    return AudioAppDto(
+      pid: map['pid'] as int? ?? 0,
+      name: map['name']?.toString() ?? '',
+      binary: map['binary']?.toString() ?? '',
+      peak: (map['peak'] as num?)?.toDouble() ?? 0.0,
+      active: map['active'] as bool? ?? false,
+    );
+  }
+
+  /// Returns a string representation of the application.
+  @override
+  String toString() {
+    final state = active ? 'active' : 'silent';
+    return '$name ($binary, pid $pid): $state, peak ${peak.toStringAsFixed(3)}';
+  }
+}
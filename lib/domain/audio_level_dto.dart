@@ -0,0 +1,48 @@
+
+/// A data transfer object describing the level of the system audio output.
+///
+/// Returned by [WindowFocus.getAudioLevel]. Levels are linear, from 0.0 for
+/// silence to 1.0 for full scale, and describe the most recent measurement.
+///
+/// Example:
+/// ```dart
+/// final level = AudioLevelDto(rms: 0.12, peak: 0.5, playing: true);
+/// print(level); // Output: Audio playing, RMS 0.120, peak 0.500
+/// ```
+class AudioLevelDto {
+  /// Root mean square level over the last 50 ms window, or null where the
+  /// platform only reports peaks (Windows).
+  final double? rms;
+  /// Largest sample magnitude of the last measurement.
+  final double peak;
+  /// Whether audio currently counts as media playback and thus as activity.
+  final bool playing;
+
+  /// Constructs an instance of [AudioLevelDto].
+  AudioLevelDto({
+    required this.rms,
+    required this.peak,
+    required this.playing,
+  });
+
+  /// A level with no audio, also used while audio monitoring is disabled.
+  static final AudioLevelDto silent =
+      AudioLevelDto(rms: 0.0, peak: 0.0, playing: false);
+
+  /// Creates an [AudioLevelDto] from the map sent by the platform side.
+  factory AudioLevelDto.fromMap(Map<dynamic, dynamic> map) {
+    return AudioLevelDto(
+      rms: (map['rms'] as num?)?.toDouble(),
+      peak: (map['peak'] as num?)?.toDouble() ?? 0.0,
+      playing: map['playing'] as bool? ?? false,
+    );
+  }
+
+  /// Returns a string representation of the level.
+  @override
+  String toString() {
+    final state = playing ? 'playing' : 'idle';
+    final rmsText = rms == null ? '' : ', RMS ${rms!.toStringAsFixed(3)}';
+    return 'Audio $state$rmsText, peak ${peak.toStringAsFixed(3)}';
+  }
+}
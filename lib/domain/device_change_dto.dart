@@ -0,0 +1,50 @@
+
+/// A data transfer object describing an input device that was plugged in or
+/// removed while monitoring was running.
+///
+/// Sent through [WindowFocus.onDeviceChanged] once device change events are
+/// enabled with [WindowFocus.setDeviceChangeEvents]. Devices that are not
+/// monitored (keyboards, mice and audio controls) are not reported.
+///
+/// Example:
+/// ```dart
+/// final change = DeviceChangeDto(action: 'added', source: 'hid', path: '/dev/hidraw3', vendorId: 0x046d, productId: 0xc262, usagePage: 0x01, usage: 0x04);
+/// print(change); // Output: added hid device 046d:c262 (/dev/hidraw3)
+/// ```
+class DeviceChangeDto {
+  /// Either `added` or `removed`.
+  final String action;
+  /// The backend that reported the device, e.g. `hid`.
+  final String source;
+  /// The platform device path.
+  final String path;
+  /// USB vendor ID.
+  final int vendorId;
+  /// USB product ID.
+  final int productId;
+  /// HID usage page of the device's top-level collection.
+  final int usagePage;
+  /// HID usage of the device's top-level collection.
+  final int usage;
+
+  /// Constructs an instance of [DeviceChangeDto].
+  DeviceChangeDto({
+    required this.action,
+    required this.source,
+    required this.path,
+    required this.vendorId,
+    required this.productId,
+    required this.usagePage,
+    required this.usage,
+  });
+
+  /// Whether the device was plugged in.
+  bool get added => action == 'added';
+
+  /// Returns a string representation of the device change.
+  @override
+  String toString() {
+    String hex(int value) => value.toRadixString(16).padLeft(4, '0');
+    return '$action $source device ${hex(vendorId)}:${hex(productId)} ($path)';
+  }
+}
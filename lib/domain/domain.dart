@@ -1 +1,11 @@
-export 'app_window_dto.dart';
\ No newline at end of file
+export 'app_window_dto.dart';
+export 'audio_app_dto.dart';
+export 'audio_level_dto.dart';
+export 'device_change_dto.dart';
+export 'input_device_dto.dart';
+export 'monitor_dto.dart';
+export 'raw_screenshot_dto.dart';
+export 'recent_frame_dto.dart';
+export 'scheduled_screenshot_dto.dart';
+export 'screenshot_delta_dto.dart';
+export 'screenshot_format.dart';
\ No newline at end of file
@@ -0,0 +1,71 @@
+
+/// A data transfer object describing a monitored input device and how much
+/// activity it has reported.
+///
+/// Returned by [WindowFocus.getInputDevices]. Use [lastActivity] and
+/// [eventCount] to find the device that keeps a session from going idle,
+/// for example a joystick with a drifting axis.
+///
+/// Example:
+/// ```dart
+/// final device = InputDeviceDto(source: 'hid', name: 'Wheel', path: '/dev/hidraw3', vendorId: 0x046d, productId: 0xc262, usagePage: 0x01, usage: 0x04, lastActivity: null, eventCount: 0);
+/// print(device); // Output: hid device 046d:c262 "Wheel": 0 events
+/// ```
+class InputDeviceDto {
+  /// The backend that monitors the device, e.g. `hid` or `xinput`.
+  final String source;
+  /// Product name reported by the device, may be empty.
+  final String name;
+  /// The platform device path, empty for devices without one.
+  final String path;
+  /// USB vendor ID, 0 if unknown.
+  final int vendorId;
+  /// USB product ID, 0 if unknown.
+  final int productId;
+  /// HID usage page of the device's top-level collection.
+  final int usagePage;
+  /// HID usage of the device's top-level collection.
+  final int usage;
+  /// When the device last reported input, or null if it has not yet.
+  final DateTime? lastActivity;
+  /// Number of input events the device reported since it was opened.
+  final int eventCount;
+
+  /// Constructs an instance of [InputDeviceDto].
+  InputDeviceDto({
+    required this.source,
+    required this.name,
+    required this.path,
+    required this.vendorId,
+    required this.productId,
+    required this.usagePage,
+    required this.usage,
+    required this.lastActivity,
+    required this.eventCount,
+  });
+
+  /// Creates an [InputDeviceDto] from the map sent by the platform side.
+  factory InputDeviceDto.fromMap(Map<dynamic, dynamic> map) {
+    final lastActivityMs = map['lastActivity'] as int? ?? 0;
+    return InputDeviceDto(
+      source: map['source']?.toString() ?? '',
+      name: map['name']?.toString() ?? '',
+      path: map['path']?.toString() ?? '',
+      vendorId: map['vendorId'] as int? ?? 0,
+      productId: map['productId'] as int? ?? 0,
+      usagePage: map['usagePage'] as int? ?? 0,
+      usage: map['usage'] as int? ?? 0,
+      lastActivity: lastActivityMs > 0
+          ? DateTime.fromMillisecondsSinceEpoch(lastActivityMs)
+          : null,
+      eventCount: map['eventCount'] as int? ?? 0,
+    );
+  }
+
+  /// Returns a string representation of the device.
+  @override
+  String toString() {
+    String hex(int value) => value.toRadixString(16).padLeft(4, '0');
+    return '$source device ${hex(vendorId)}:${hex(productId)} "$name": $eventCount events';
+  }
+}
@@ -0,0 +1,67 @@
+/// A monitor attached to the desktop, as listed by [WindowFocus.getMonitors].
+///
+/// [id] is what the `monitor` argument of [WindowFocus.takeScreenshot] and
+/// [WindowFocus.takeScreenshotRaw] takes, and the key of the screenshots
+/// returned by [WindowFocus.takeMonitorScreenshots]. Ids are positions in the
+/// list, so they change when monitors are attached or removed.
+///
+/// Geometry is in desktop coordinates: physical pixels on Windows and Linux,
+/// points on macOS.
+///
+/// Example:
+/// ```dart
+/// final monitors = await windowFocus.getMonitors();
+/// print(monitors.first); // Output: Monitor 0 DP-1 2560x1440 at 0,0, scale 1.5 (primary)
+/// ```
+class MonitorDto {
+  /// Index of the monitor in [WindowFocus.getMonitors].
+  final int id;
+  /// Name the platform gives the monitor, such as `\\.\DISPLAY1` on Windows
+  /// or the XRandR output on Linux.
+  final String name;
+  /// Left edge.
+  final int x;
+  /// Top edge.
+  final int y;
+  /// Width.
+  final int width;
+  /// Height.
+  final int height;
+  /// Pixels per logical pixel. On Linux this is the desktop's `Xft.dpi`
+  /// over 96, the same for every monitor.
+  final double scale;
+  /// Whether this is the primary monitor.
+  final bool primary;
+
+  /// Constructs an instance of [MonitorDto].
+  MonitorDto({
+    required this.id,
+    required this.name,
+    required this.x,
+    required this.y,
+    required this.width,
+    required this.height,
+    required this.scale,
+    required this.primary,
+  });
+
+  /// Creates a [MonitorDto] from the map sent by the platform side.
+  factory MonitorDto.fromMap(Map<dynamic, dynamic> map) {
+    return MonitorDto(
+      id: map['id'] as int,
+      name: map['name'] as String,
+      x: map['x'] as int,
+      y: map['y'] as int,
+      width: map['width'] as int,
+      height: map['height'] as int,
+      scale: (map['scale'] as num).toDouble(),
+      primary: map['primary'] as bool,
+    );
+  }
+
+  /// Returns a string representation of the monitor.
+  @override
+  String toString() {
+    return 'Monitor $id $name ${width}x$height at $x,$y, scale $scale${primary ? ' (primary)' : ''}';
+  }
+}
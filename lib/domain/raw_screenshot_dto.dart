@@ -0,0 +1,63 @@
+import 'dart:typed_data';
+
+/// Byte order of the pixels in a [RawScreenshotDto].
+enum ScreenshotPixelFormat {
+  /// Blue, green, red, alpha: how Windows and X11 store pixels, so no
+  /// channels are swapped.
+  bgra,
+
+  /// Red, green, blue, alpha, as expected by e.g. `decodeImageFromPixels`
+  /// with `PixelFormat.rgba8888`.
+  rgba,
+}
+
+/// An uncompressed screenshot.
+///
+/// Returned by [WindowFocus.takeScreenshotRaw]. Rows are stored top-down,
+/// [stride] bytes apart, with four bytes per opaque pixel.
+///
+/// Example:
+/// ```dart
+/// final shot = await windowFocus.takeScreenshotRaw(format: ScreenshotPixelFormat.rgba);
+/// print(shot); // Output: 3840x2160 rgba screenshot, stride 15360
+/// ```
+class RawScreenshotDto {
+  /// Width in pixels.
+  final int width;
+  /// Height in pixels.
+  final int height;
+  /// Bytes from the start of one row to the next.
+  final int stride;
+  /// Byte order of each pixel.
+  final ScreenshotPixelFormat format;
+  /// [height] rows of [stride] bytes.
+  final Uint8List pixels;
+
+  /// Constructs an instance of [RawScreenshotDto].
+  RawScreenshotDto({
+    required this.width,
+    required this.height,
+    required this.stride,
+    required this.format,
+    required this.pixels,
+  });
+
+  /// Creates a [RawScreenshotDto] from the map sent by the platform side.
+  factory RawScreenshotDto.fromMap(Map<dynamic, dynamic> map) {
+    return RawScreenshotDto(
+      width: map['width'] as int,
+      height: map['height'] as int,
+      stride: map['stride'] as int,
+      format: map['format'] == 'rgba'
+          ? ScreenshotPixelFormat.rgba
+          : ScreenshotPixelFormat.bgra,
+      pixels: map['pixels'] as Uint8List,
+    );
+  }
+
+  /// Returns a string representation of the screenshot.
+  @override
+  String toString() {
+    return '${width}x$height ${format.name} screenshot, stride $stride';
+  }
+}
@@ -0,0 +1,62 @@
+import 'dart:typed_data';
+
+import 'screenshot_format.dart';
+
+/// A frame kept by the screenshot ring started with
+/// [WindowFocus.startScreenshotRing].
+///
+/// Returned by [WindowFocus.getRecentFrames]. [data] is an image file in
+/// [format], or, for a raw ring, [height] rows of [stride] bytes of opaque
+/// BGRA pixels.
+///
+/// Example:
+/// ```dart
+/// final frames = await windowFocus.getRecentFrames(5);
+/// print(frames.first); // Output: 1920x1080 qoi frame, 812044 bytes, captured 2026-01-18 09:30:05.123
+/// ```
+class RecentFrameDto {
+  /// When the screen was captured.
+  final DateTime timestamp;
+  /// Width in pixels.
+  final int width;
+  /// Height in pixels.
+  final int height;
+  /// How [data] is encoded, or null for raw BGRA pixels.
+  final ScreenshotFormat? format;
+  /// Bytes from the start of one row to the next, for raw pixels.
+  final int? stride;
+  /// The encoded image or the pixels.
+  final Uint8List data;
+
+  /// Constructs an instance of [RecentFrameDto].
+  RecentFrameDto({
+    required this.timestamp,
+    required this.width,
+    required this.height,
+    required this.format,
+    required this.stride,
+    required this.data,
+  });
+
+  /// Creates a [RecentFrameDto] from the map sent by the platform side.
+  factory RecentFrameDto.fromMap(Map<dynamic, dynamic> map) {
+    final format = map['format'] as String;
+    return RecentFrameDto(
+      timestamp: DateTime.fromMillisecondsSinceEpoch(map['timestamp'] as int),
+      width: map['width'] as int,
+      height: map['height'] as int,
+      format: format == 'bgra' ? null : ScreenshotFormat.values.byName(format),
+      stride: map['stride'] as int?,
+      data: map['data'] as Uint8List,
+    );
+  }
+
+  /// Whether [data] holds raw pixels rather than an image file.
+  bool get raw => format == null;
+
+  /// Returns a string representation of the frame.
+  @override
+  String toString() {
+    return '${width}x$height ${format?.name ?? 'bgra'} frame, ${data.length} bytes, captured $timestamp';
+  }
+}
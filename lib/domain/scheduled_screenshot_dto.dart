@@ -0,0 +1,67 @@
+import 'screenshot_format.dart';
+
+/// A screenshot saved by the schedule started with
+/// [WindowFocus.startScreenshotSchedule].
+///
+/// Sent through [WindowFocus.onScheduledScreenshot] once the file is
+/// complete: it is written under a temporary name and renamed, so [path]
+/// never names a partial file.
+///
+/// Example:
+/// ```dart
+/// windowFocus.onScheduledScreenshot.listen(print);
+/// // Output: 1280x720 png screenshot, 183402 bytes, /tmp/shots/screenshot_20260118_093005_123.png
+/// ```
+class ScheduledScreenshotDto {
+  /// The saved file.
+  final String path;
+  /// How the file is encoded.
+  final ScreenshotFormat format;
+  /// Width in pixels, after [WindowFocus.startScreenshotSchedule]'s maxWidth
+  /// and maxHeight.
+  final int width;
+  /// Height in pixels.
+  final int height;
+  /// File size in bytes.
+  final int size;
+  /// When the screen was captured.
+  final DateTime timestamp;
+  /// Ticks since the previous screenshot skipped because the user was idle.
+  final int skippedIdle;
+  /// Ticks since the previous screenshot skipped because the screen had not
+  /// changed.
+  final int skippedUnchanged;
+
+  /// Constructs an instance of [ScheduledScreenshotDto].
+  ScheduledScreenshotDto({
+    required this.path,
+    required this.format,
+    required this.width,
+    required this.height,
+    required this.size,
+    required this.timestamp,
+    required this.skippedIdle,
+    required this.skippedUnchanged,
+  });
+
+  /// Creates a [ScheduledScreenshotDto] from the map sent by the platform
+  /// side.
+  factory ScheduledScreenshotDto.fromMap(Map<dynamic, dynamic> map) {
+    return ScheduledScreenshotDto(
+      path: map['path'] as String,
+      format: ScreenshotFormat.values.byName(map['format'] as String),
+      width: map['width'] as int,
+      height: map['height'] as int,
+      size: map['size'] as int,
+      timestamp: DateTime.fromMillisecondsSinceEpoch(map['timestamp'] as int),
+      skippedIdle: map['skippedIdle'] as int? ?? 0,
+      skippedUnchanged: map['skippedUnchanged'] as int? ?? 0,
+    );
+  }
+
+  /// Returns a string representation of the screenshot.
+  @override
+  String toString() {
+    return '${width}x$height ${format.name} screenshot, $size bytes, $path';
+  }
+}
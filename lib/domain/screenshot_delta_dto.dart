@@ -0,0 +1,78 @@
+import 'dart:typed_data';
+
+/// The part of the screen that changed since the previous
+/// [WindowFocus.takeScreenshotDelta] (Windows and Linux).
+///
+/// The frame is split into [tileSize] squares numbered row-major; tiles in
+/// the last column and row may be narrower or shorter. [data] holds the
+/// pixels of the listed [tiles] one after another, each as top-down rows of
+/// 24-bit BGR pixels, compressed as one zlib stream unless [compression] is
+/// `none`. A [keyframe] lists every tile. Feed deltas to a
+/// [ScreenshotDeltaDecoder] to rebuild the frames.
+///
+/// Example:
+/// ```dart
+/// final delta = await windowFocus.takeScreenshotDelta();
+/// print(delta); // Output: delta 42 of 1920x1080, 3 of 510 tiles, 2817 bytes
+/// ```
+class ScreenshotDeltaDto {
+  /// Width of the frame in pixels.
+  final int width;
+  /// Height of the frame in pixels.
+  final int height;
+  /// Edge of the square tiles in pixels.
+  final int tileSize;
+  /// Deltas taken before this one in the current series. A decoder can only
+  /// apply a delta that directly follows the last one it applied, or a
+  /// keyframe.
+  final int sequence;
+  /// Whether every tile is included, so the delta stands on its own.
+  final bool keyframe;
+  /// Indices of the included tiles, in increasing order.
+  final Int32List tiles;
+  /// `zlib` or `none`.
+  final String compression;
+  /// The included tiles' pixels.
+  final Uint8List data;
+
+  /// Constructs an instance of [ScreenshotDeltaDto].
+  ScreenshotDeltaDto({
+    required this.width,
+    required this.height,
+    required this.tileSize,
+    required this.sequence,
+    required this.keyframe,
+    required this.tiles,
+    required this.compression,
+    required this.data,
+  });
+
+  /// Creates a [ScreenshotDeltaDto] from the map sent by the platform side.
+  factory ScreenshotDeltaDto.fromMap(Map<dynamic, dynamic> map) {
+    return ScreenshotDeltaDto(
+      width: map['width'] as int,
+      height: map['height'] as int,
+      tileSize: map['tileSize'] as int,
+      sequence: map['sequence'] as int,
+      keyframe: map['keyframe'] as bool,
+      tiles: map['tiles'] as Int32List,
+      compression: map['compression'] as String,
+      data: map['data'] as Uint8List,
+    );
+  }
+
+  /// Number of tiles the frame is split into.
+  int get tileCount =>
+      ((width + tileSize - 1) ~/ tileSize) *
+      ((height + tileSize - 1) ~/ tileSize);
+
+  /// Whether nothing changed since the previous delta.
+  bool get isEmpty => tiles.isEmpty;
+
+  /// Returns a string representation of the delta.
+  @override
+  String toString() {
+    return '${keyframe ? 'keyframe' : 'delta'} $sequence of ${width}x$height, '
+        '${tiles.length} of $tileCount tiles, ${data.length} bytes';
+  }
+}
@@ -0,0 +1,24 @@
+/// Image formats [WindowFocus.takeScreenshot] can return.
+///
+/// Not every platform and build offers every format; see
+/// [WindowFocus.getScreenshotFormats].
+///
+/// Example:
+/// ```dart
+/// final jpeg = await windowFocus.takeScreenshot(format: ScreenshotFormat.jpeg, quality: 80);
+/// ```
+enum ScreenshotFormat {
+  /// Lossless PNG. Available everywhere.
+  png,
+
+  /// Lossy JPEG; the smallest files for a given encode time.
+  jpeg,
+
+  /// Lossy WebP; the smallest files, but the slowest to encode (Windows and
+  /// Linux, when the plugin was built with libwebp).
+  webp,
+
+  /// Lossless [QOI](https://qoiformat.org); several times faster to encode
+  /// than PNG, with larger files (Windows and Linux).
+  qoi,
+}
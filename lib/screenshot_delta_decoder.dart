@@ -0,0 +1,119 @@
+import 'dart:io' show ZLibCodec;
+import 'dart:math' as math;
+import 'dart:typed_data';
+
+import 'domain/domain.dart';
+
+/// Rebuilds frames from the deltas of [WindowFocus.takeScreenshotDelta].
+///
+/// Deltas must be applied in the order they were taken. After a missed or
+/// rejected delta, [apply] returns false until the next keyframe; ask for
+/// one with `takeScreenshotDelta(keyframe: true)`.
+///
+/// Example:
+/// ```dart
+/// final decoder = ScreenshotDeltaDecoder(format: ScreenshotPixelFormat.rgba);
+/// final delta = await windowFocus.takeScreenshotDelta();
+/// if (delta != null && decoder.apply(delta)) {
+///   final frame = decoder.frame!;
+/// }
+/// ```
+class ScreenshotDeltaDecoder {
+  /// Creates a decoder producing opaque pixels in [format].
+  ScreenshotDeltaDecoder({this.format = ScreenshotPixelFormat.bgra});
+
+  /// Byte order of the rebuilt frame.
+  final ScreenshotPixelFormat format;
+
+  final ZLibCodec _zlib = ZLibCodec();
+  int _width = 0;
+  int _height = 0;
+  int _sequence = -1;
+  Uint8List? _pixels;
+
+  /// The current frame, or null before the first keyframe. Updated in place
+  /// by [apply]; copy the pixels to keep a frame.
+  RawScreenshotDto? get frame {
+    final pixels = _pixels;
+    if (pixels == null) {
+      return null;
+    }
+    return RawScreenshotDto(
+      width: _width,
+      height: _height,
+      stride: _width * 4,
+      format: format,
+      pixels: pixels,
+    );
+  }
+
+  /// Applies [delta] to the current frame. Returns false, leaving the frame
+  /// alone, for a delta that does not directly follow the last one applied
+  /// or whose data is damaged.
+  bool apply(ScreenshotDeltaDto delta) {
+    if (!delta.keyframe &&
+        (_sequence < 0 ||
+            delta.sequence != _sequence + 1 ||
+            delta.width != _width ||
+            delta.height != _height)) {
+      return false;
+    }
+    if (delta.tileSize <= 0) {
+      return false;
+    }
+    final columns = (delta.width + delta.tileSize - 1) ~/ delta.tileSize;
+    final count = delta.tileCount;
+    var expected = 0;
+    for (final index in delta.tiles) {
+      if (index < 0 || index >= count) {
+        return false;
+      }
+      final x0 = (index % columns) * delta.tileSize;
+      final y0 = (index ~/ columns) * delta.tileSize;
+      expected += math.min(delta.tileSize, delta.width - x0) *
+          math.min(delta.tileSize, delta.height - y0) *
+          3;
+    }
+    Uint8List bgr;
+    try {
+      bgr = expected == 0
+          ? Uint8List(0)
+          : delta.compression == 'none'
+              ? delta.data
+              : Uint8List.fromList(_zlib.decode(delta.data));
+    } on Exception {
+      return false;
+    }
+    if (bgr.length != expected) {
+      return false;
+    }
+
+    if (delta.keyframe) {
+      _width = delta.width;
+      _height = delta.height;
+      _pixels = Uint8List(_width * _height * 4);
+    }
+    final pixels = _pixels!;
+    // Byte offsets of blue and red in the output.
+    final blue = format == ScreenshotPixelFormat.bgra ? 0 : 2;
+    final red = 2 - blue;
+    var input = 0;
+    for (final index in delta.tiles) {
+      final x0 = (index % columns) * delta.tileSize;
+      final y0 = (index ~/ columns) * delta.tileSize;
+      final tileWidth = math.min(delta.tileSize, _width - x0);
+      final tileHeight = math.min(delta.tileSize, _height - y0);
+      for (var y = y0; y < y0 + tileHeight; y++) {
+        var output = (y * _width + x0) * 4;
+        for (var x = 0; x < tileWidth; x++, output += 4) {
+          pixels[output + blue] = bgr[input++];
+          pixels[output + 1] = bgr[input++];
+          pixels[output + red] = bgr[input++];
+          pixels[output + 3] = 0xFF;
+        }
+      }
+    }
+    _sequence = delta.sequence;
+    return true;
+  }
+}
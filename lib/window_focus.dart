@@ -1,2 +1,3 @@
 export 'window_focus_method_channel.dart';
+export 'screenshot_delta_decoder.dart';
 export 'domain/domain.dart';
\ No newline at end of file
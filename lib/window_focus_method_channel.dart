@@ -1,4 +1,5 @@
 import 'dart:async';
+import 'dart:ui' show Rect;
 import 'package:flutter/services.dart';
 import 'domain/domain.dart';
 
@@ -32,6 +33,8 @@ class WindowFocus {
 
   static const MethodChannel _channel =
       MethodChannel('expert.kotelnikoff/window_focus');
+  // Error code of screenshots answered by cancelScreenshots.
+  static const String _screenshotCancelled = 'SCREENSHOT_CANCELLED';
   bool _debug = false;
   bool _userActive = true;
   bool _isInitialized = false;
@@ -39,6 +42,9 @@ class WindowFocus {
   final _focusChangeController = StreamController<AppWindowDto>.broadcast();
   final _userActiveController = StreamController<bool>.broadcast();
   final _errorController = StreamController<WindowFocusError>.broadcast();
+  final _deviceChangeController = StreamController<DeviceChangeDto>.broadcast();
+  final _scheduledScreenshotController =
+      StreamController<ScheduledScreenshotDto>.broadcast();
 
   /// Stream of errors that occur in the plugin
   Stream<WindowFocusError> get onError => _errorController.stream;
@@ -95,6 +101,12 @@ class WindowFocus {
         case 'onUserInactivity':
           _handleUserInactivity();
           break;
+        case 'onDeviceChange':
+          _handleDeviceChange(call);
+          break;
+        case 'onScheduledScreenshot':
+          _handleScheduledScreenshot(call);
+          break;
         default:
           if (_debug) {
             print('[WindowFocus] Unknown method from native: ${call.method}');
@@ -120,7 +132,10 @@ class WindowFocus {
       if (arguments is Map) {
         final String appName = arguments['appName']?.toString() ?? '';
         final String windowTitle = arguments['windowTitle']?.toString() ?? '';
-        final dto = AppWindowDto(appName: appName, windowTitle: windowTitle);
+        final bool? audioActive = arguments['audioActive'] as bool?;
+        final int? windowId = arguments['windowId'] as int?;
+        final dto = AppWindowDto(
+            appName: appName, windowTitle: windowTitle, audioActive: audioActive, windowId: windowId);
 
         if (!_focusChangeController.isClosed) {
           _focusChangeController.add(dto);
@@ -201,6 +216,77 @@ class WindowFocus {
     }
   }
 
+  void _handleDeviceChange(MethodCall call) {
+    try {
+      final arguments = call.arguments;
+      if (arguments is Map) {
+        final dto = DeviceChangeDto(
+          action: arguments['action']?.toString() ?? '',
+          source: arguments['source']?.toString() ?? '',
+          path: arguments['path']?.toString() ?? '',
+          vendorId: arguments['vendorId'] as int? ?? 0,
+          productId: arguments['productId'] as int? ?? 0,
+          usagePage: arguments['usagePage'] as int? ?? 0,
+          usage: arguments['usage'] as int? ?? 0,
+        );
+
+        if (!_deviceChangeController.isClosed) {
+          _deviceChangeController.add(dto);
+        }
+      } else {
+        if (_debug) {
+          print(
+              '[WindowFocus] Invalid arguments for onDeviceChange: $arguments');
+        }
+      }
+    } catch (e, stackTrace) {
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.methodCall,
+          message: 'Error processing device change: $e',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+    }
+  }
+
+  void _handleScheduledScreenshot(MethodCall call) {
+    try {
+      final arguments = call.arguments;
+      if (arguments is Map) {
+        if (arguments['error'] != null) {
+          _handleError(
+            WindowFocusError(
+              type: WindowFocusErrorType.screenshot,
+              message: 'Failed to save scheduled screenshot: '
+                  '${arguments['error']}',
+            ),
+          );
+          return;
+        }
+        final dto = ScheduledScreenshotDto.fromMap(arguments);
+        if (!_scheduledScreenshotController.isClosed) {
+          _scheduledScreenshotController.add(dto);
+        }
+      } else {
+        if (_debug) {
+          print('[WindowFocus] Invalid arguments for onScheduledScreenshot: '
+              '$arguments');
+        }
+      }
+    } catch (e, stackTrace) {
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.methodCall,
+          message: 'Error processing scheduled screenshot: $e',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+    }
+  }
+
   void _handleError(WindowFocusError error) {
     if (_debug) {
       print('[WindowFocus] Error: ${error.message}');
@@ -220,14 +306,70 @@ class WindowFocus {
   Stream<AppWindowDto> get onFocusChanged => _focusChangeController.stream;
   Stream<bool> get onUserActiveChanged => _userActiveController.stream;
 
-  /// Takes a screenshot.
-  Future<Uint8List?> takeScreenshot({bool activeWindowOnly = false}) async {
+  /// Stream of input devices plugged in or removed while HID monitoring runs.
+  ///
+  /// Only emits after [setDeviceChangeEvents] enabled the events.
+  Stream<DeviceChangeDto> get onDeviceChanged => _deviceChangeController.stream;
+
+  /// Stream of screenshots saved by [startScreenshotSchedule].
+  ///
+  /// Screenshots that could not be saved are reported through [onError].
+  Stream<ScheduledScreenshotDto> get onScheduledScreenshot =>
+      _scheduledScreenshotController.stream;
+
+  /// Takes a screenshot, encoded as [format].
+  ///
+  /// [quality], from 1 to 100, applies to the lossy formats and defaults to
+  /// 90. With [maxWidth] and/or [maxHeight] the capture is shrunk natively to
+  /// fit, keeping its aspect ratio, before it is encoded, which makes
+  /// thumbnails much cheaper than downscaling a full screenshot in Dart.
+  /// Returns null on failure, including a format this platform does not
+  /// offer.
+  ///
+  /// With [monitor], an id from [getMonitors], only that monitor is
+  /// captured, at its own size. Without it Linux captures the whole desktop,
+  /// Windows the primary monitor's area and macOS the main display.
+  ///
+  /// [region] captures a rectangle in desktop coordinates, as [getMonitors]
+  /// reports them, and [window] a window by id: [AppWindowDto.windowId] on
+  /// Windows and macOS, an X11 window id on Linux. Only those pixels are read
+  /// from the screen, so small captures stay cheap on large desktops. With
+  /// [clientAreaOnly], [window] or the active window is captured without its
+  /// frame. At most one of [activeWindowOnly], [window], [region] and
+  /// [monitor] can be given.
+  ///
+  /// On Windows and Linux the screenshot is taken on a native worker thread,
+  /// and calls for the same screen or window made while one is being taken
+  /// share it. Returns null without reporting an error when
+  /// [cancelScreenshots] cancelled the call.
+  Future<Uint8List?> takeScreenshot({
+    bool activeWindowOnly = false,
+    int? window,
+    bool clientAreaOnly = false,
+    Rect? region,
+    int? monitor,
+    ScreenshotFormat format = ScreenshotFormat.png,
+    int? quality,
+    int? maxWidth,
+    int? maxHeight,
+  }) async {
     try {
       final result = await _channel.invokeMethod<Uint8List>('takeScreenshot', {
         'activeWindowOnly': activeWindowOnly,
+        if (window != null) 'window': window,
+        if (clientAreaOnly) 'clientAreaOnly': true,
+        if (region != null) 'region': _regionArgument(region),
+        if (monitor != null) 'monitor': monitor,
+        'format': format.name,
+        if (quality != null) 'quality': quality,
+        if (maxWidth != null) 'maxWidth': maxWidth,
+        if (maxHeight != null) 'maxHeight': maxHeight,
       });
       return result;
     } on PlatformException catch (e, stackTrace) {
+      if (e.code == _screenshotCancelled) {
+        return null;
+      }
       _handleError(
         WindowFocusError(
           type: WindowFocusErrorType.screenshot,
@@ -250,6 +392,477 @@ class WindowFocus {
     }
   }
 
+  // The platforms take whole pixels; a fractional edge grows the region.
+  static Map<String, int> _regionArgument(Rect region) {
+    final left = region.left.floor();
+    final top = region.top.floor();
+    return {
+      'x': left,
+      'y': top,
+      'width': region.right.ceil() - left,
+      'height': region.bottom.ceil() - top,
+    };
+  }
+
+  /// Lists the formats [takeScreenshot] can return on this platform and
+  /// build.
+  Future<List<ScreenshotFormat>> getScreenshotFormats() async {
+    try {
+      final result = await _channel.invokeMethod<List<dynamic>>('getScreenshotFormats');
+      return ScreenshotFormat.values
+          .where((format) => result?.contains(format.name) ?? false)
+          .toList();
+    } on PlatformException catch (e, stackTrace) {
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.screenshot,
+          message: 'Failed to get screenshot formats: ${e.message}',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+      return const [ScreenshotFormat.png];
+    } catch (e, stackTrace) {
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.screenshot,
+          message: 'Unexpected error getting screenshot formats: $e',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+      return const [ScreenshotFormat.png];
+    }
+  }
+
+  /// Takes a screenshot without encoding it, for processing in the same
+  /// process (Windows and Linux).
+  ///
+  /// Skips PNG encoding entirely, which is most of the cost of
+  /// [takeScreenshot] for large screens. [maxWidth] and [maxHeight] shrink
+  /// the pixels, and [window], [region] and [monitor] pick what is captured,
+  /// as in [takeScreenshot]. Returns null on failure, and when cancelled like
+  /// [takeScreenshot].
+  Future<RawScreenshotDto?> takeScreenshotRaw({
+    bool activeWindowOnly = false,
+    int? window,
+    bool clientAreaOnly = false,
+    Rect? region,
+    int? monitor,
+    ScreenshotPixelFormat format = ScreenshotPixelFormat.bgra,
+    int? maxWidth,
+    int? maxHeight,
+  }) async {
+    try {
+      final result = await _channel.invokeMapMethod<dynamic, dynamic>(
+          'takeScreenshotRaw', {
+        'activeWindowOnly': activeWindowOnly,
+        if (window != null) 'window': window,
+        if (clientAreaOnly) 'clientAreaOnly': true,
+        if (region != null) 'region': _regionArgument(region),
+        if (monitor != null) 'monitor': monitor,
+        'format': format.name,
+        if (maxWidth != null) 'maxWidth': maxWidth,
+        if (maxHeight != null) 'maxHeight': maxHeight,
+      });
+      return result == null ? null : RawScreenshotDto.fromMap(result);
+    } on PlatformException catch (e, stackTrace) {
+      if (e.code == _screenshotCancelled) {
+        return null;
+      }
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.screenshot,
+          message: 'Failed to take raw screenshot: ${e.message}',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+      return null;
+    } catch (e, stackTrace) {
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.screenshot,
+          message: 'Unexpected error taking raw screenshot: $e',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+      return null;
+    }
+  }
+
+  /// Lists the monitors attached to the desktop. Returns an empty list on
+  /// failure.
+  Future<List<MonitorDto>> getMonitors() async {
+    try {
+      final result = await _channel.invokeMethod<List<dynamic>>('getMonitors');
+      return (result ?? const [])
+          .map((monitor) => MonitorDto.fromMap(monitor as Map<dynamic, dynamic>))
+          .toList();
+    } on PlatformException catch (e, stackTrace) {
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.screenshot,
+          message: 'Failed to list monitors: ${e.message}',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+      return const [];
+    } catch (e, stackTrace) {
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.screenshot,
+          message: 'Unexpected error listing monitors: $e',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+      return const [];
+    }
+  }
+
+  /// Takes a screenshot of every monitor, each at its own size, keyed by
+  /// the ids [getMonitors] reports.
+  ///
+  /// Monitors are captured and encoded in parallel, on the native screenshot
+  /// workers on Windows and Linux. [format], [quality], [maxWidth] and
+  /// [maxHeight] apply to each screenshot as in [takeScreenshot]. Returns
+  /// null when any monitor fails, and when cancelled like [takeScreenshot].
+  Future<Map<int, Uint8List>?> takeMonitorScreenshots({
+    ScreenshotFormat format = ScreenshotFormat.png,
+    int? quality,
+    int? maxWidth,
+    int? maxHeight,
+  }) async {
+    try {
+      final result = await _channel.invokeMapMethod<int, Uint8List>(
+          'takeMonitorScreenshots', {
+        'format': format.name,
+        if (quality != null) 'quality': quality,
+        if (maxWidth != null) 'maxWidth': maxWidth,
+        if (maxHeight != null) 'maxHeight': maxHeight,
+      });
+      return result;
+    } on PlatformException catch (e, stackTrace) {
+      if (e.code == _screenshotCancelled) {
+        return null;
+      }
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.screenshot,
+          message: 'Failed to take monitor screenshots: ${e.message}',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+      return null;
+    } catch (e, stackTrace) {
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.screenshot,
+          message: 'Unexpected error taking monitor screenshots: $e',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+      return null;
+    }
+  }
+
+  /// Answers the [takeScreenshot] and [takeScreenshotRaw] calls still
+  /// waiting for a native worker with null, and returns how many there were
+  /// (Windows and Linux).
+  ///
+  /// Screenshots already being taken finish, but their callers are not
+  /// kept waiting for them.
+  Future<int> cancelScreenshots() async {
+    try {
+      return await _channel.invokeMethod<int>('cancelScreenshots') ?? 0;
+    } on PlatformException catch (e, stackTrace) {
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.screenshot,
+          message: 'Failed to cancel screenshots: ${e.message}',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+      return 0;
+    } catch (e, stackTrace) {
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.screenshot,
+          message: 'Unexpected error cancelling screenshots: $e',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+      return 0;
+    }
+  }
+
+  /// Returns the tiles of the screen (or the active window) that changed
+  /// since the previous call (Windows and Linux).
+  ///
+  /// The frame is split into [tileSize] squares and each is compared by a
+  /// hash, so an unchanged screen costs little more than the capture and
+  /// returns an empty delta. Every [keyframeInterval]th delta (0 for never)
+  /// and the first after a change of size, [tileSize] or
+  /// [keyframeInterval] is a keyframe holding the whole frame; [keyframe]
+  /// asks for one now, e.g. after a delta was lost. [maxWidth] and
+  /// [maxHeight] shrink the frame as in [takeScreenshot]. Rebuild frames
+  /// with a [ScreenshotDeltaDecoder]. Returns null on failure.
+  Future<ScreenshotDeltaDto?> takeScreenshotDelta({
+    bool activeWindowOnly = false,
+    int tileSize = 64,
+    int keyframeInterval = 300,
+    bool keyframe = false,
+    int? maxWidth,
+    int? maxHeight,
+  }) async {
+    try {
+      final result = await _channel.invokeMapMethod<dynamic, dynamic>(
+          'takeScreenshotDelta', {
+        'activeWindowOnly': activeWindowOnly,
+        'tileSize': tileSize,
+        'keyframeInterval': keyframeInterval,
+        'keyframe': keyframe,
+        if (maxWidth != null) 'maxWidth': maxWidth,
+        if (maxHeight != null) 'maxHeight': maxHeight,
+      });
+      return result == null ? null : ScreenshotDeltaDto.fromMap(result);
+    } on PlatformException catch (e, stackTrace) {
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.screenshot,
+          message: 'Failed to take screenshot delta: ${e.message}',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+      return null;
+    } catch (e, stackTrace) {
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.screenshot,
+          message: 'Unexpected error taking screenshot delta: $e',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+      return null;
+    }
+  }
+
+  /// Saves a screenshot to [directory] every [interval], natively, until
+  /// [stopScreenshotSchedule] is called.
+  ///
+  /// Unlike a Dart timer calling [takeScreenshot], no pixels cross the
+  /// platform channel: the capture is downscaled to [maxWidth] x
+  /// [maxHeight], encoded as [format] and written on a background thread,
+  /// and only [onScheduledScreenshot] events reach Dart. With [skipWhenIdle]
+  /// ticks are skipped without capturing while the user is inactive; with
+  /// [skipUnchanged] a capture that hashes the same as the last saved one is
+  /// dropped before encoding. Ticks that fall behind are skipped rather
+  /// than queued. [directory] is created if needed and files are named
+  /// `screenshot_YYYYMMDD_HHMMSS_mmm.<format>` in local time. Starting a
+  /// new schedule replaces the running one.
+  ///
+  /// [interval] must be at least 100 milliseconds. Supported on Windows and
+  /// Linux.
+  Future<void> startScreenshotSchedule({
+    required Duration interval,
+    required String directory,
+    ScreenshotFormat format = ScreenshotFormat.png,
+    int? quality,
+    bool activeWindowOnly = false,
+    int? maxWidth,
+    int? maxHeight,
+    bool skipWhenIdle = true,
+    bool skipUnchanged = true,
+  }) async {
+    try {
+      await _channel.invokeMethod('startScreenshotSchedule', {
+        'interval': interval.inMilliseconds,
+        'directory': directory,
+        'format': format.name,
+        if (quality != null) 'quality': quality,
+        'activeWindowOnly': activeWindowOnly,
+        if (maxWidth != null) 'maxWidth': maxWidth,
+        if (maxHeight != null) 'maxHeight': maxHeight,
+        'skipWhenIdle': skipWhenIdle,
+        'skipUnchanged': skipUnchanged,
+      });
+    } on PlatformException catch (e, stackTrace) {
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.screenshot,
+          message: 'Failed to start screenshot schedule: ${e.message}',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+    } catch (e, stackTrace) {
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.screenshot,
+          message: 'Unexpected error starting screenshot schedule: $e',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+    }
+  }
+
+  /// Stops the schedule started with [startScreenshotSchedule], waiting for
+  /// a screenshot being saved to finish. Does nothing if none is running.
+  Future<void> stopScreenshotSchedule() async {
+    try {
+      await _channel.invokeMethod('stopScreenshotSchedule');
+    } on PlatformException catch (e, stackTrace) {
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.screenshot,
+          message: 'Failed to stop screenshot schedule: ${e.message}',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+    } catch (e, stackTrace) {
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.screenshot,
+          message: 'Unexpected error stopping screenshot schedule: $e',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+    }
+  }
+
+  /// Starts capturing the screen every [interval] into a ring of at most
+  /// [frames] frames, natively, until [stopScreenshotRing] is called.
+  ///
+  /// While the ring runs, [takeScreenshot] calls with the ring's
+  /// [activeWindowOnly], [maxWidth] and [maxHeight] return its newest frame
+  /// at once instead of capturing when [format] (and, for lossy formats,
+  /// [quality]) match. A [raw] ring answers [takeScreenshotRaw] instead;
+  /// its pixels are not encoded for [takeScreenshot], which then captures
+  /// on a worker. The frame may be up to [interval] old. [getRecentFrames]
+  /// returns the last few.
+  ///
+  /// Frames are stored in one buffer of [maxBytes] bytes allocated up
+  /// front; the oldest frames are dropped to make room, so memory stays
+  /// within [maxBytes] however large the frames are. A raw 1080p frame takes
+  /// about 8 MB, a QOI one typically under 2 MB. Starting a new ring
+  /// replaces the running one and its frames.
+  ///
+  /// Supported on Windows and Linux.
+  Future<void> startScreenshotRing({
+    Duration interval = const Duration(seconds: 1),
+    int frames = 10,
+    int maxBytes = 64 * 1024 * 1024,
+    bool raw = false,
+    ScreenshotFormat format = ScreenshotFormat.qoi,
+    int? quality,
+    bool activeWindowOnly = false,
+    int? maxWidth,
+    int? maxHeight,
+  }) async {
+    try {
+      await _channel.invokeMethod('startScreenshotRing', {
+        'interval': interval.inMilliseconds,
+        'frames': frames,
+        'maxBytes': maxBytes,
+        'raw': raw,
+        'format': format.name,
+        if (quality != null) 'quality': quality,
+        'activeWindowOnly': activeWindowOnly,
+        if (maxWidth != null) 'maxWidth': maxWidth,
+        if (maxHeight != null) 'maxHeight': maxHeight,
+      });
+    } on PlatformException catch (e, stackTrace) {
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.screenshot,
+          message: 'Failed to start screenshot ring: ${e.message}',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+    } catch (e, stackTrace) {
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.screenshot,
+          message: 'Unexpected error starting screenshot ring: $e',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+    }
+  }
+
+  /// Stops the ring started with [startScreenshotRing] and frees its
+  /// frames. Does nothing if none is running.
+  Future<void> stopScreenshotRing() async {
+    try {
+      await _channel.invokeMethod('stopScreenshotRing');
+    } on PlatformException catch (e, stackTrace) {
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.screenshot,
+          message: 'Failed to stop screenshot ring: ${e.message}',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+    } catch (e, stackTrace) {
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.screenshot,
+          message: 'Unexpected error stopping screenshot ring: $e',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+    }
+  }
+
+  /// Returns up to [count] frames of the running screenshot ring, newest
+  /// first, or an empty list when no ring is running.
+  Future<List<RecentFrameDto>> getRecentFrames([int count = 1]) async {
+    try {
+      final result = await _channel
+          .invokeMethod<List<dynamic>>('getRecentFrames', {'count': count});
+      return (result ?? const [])
+          .whereType<Map<dynamic, dynamic>>()
+          .map(RecentFrameDto.fromMap)
+          .toList();
+    } on PlatformException catch (e, stackTrace) {
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.screenshot,
+          message: 'Failed to get recent frames: ${e.message}',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+      return [];
+    } catch (e, stackTrace) {
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.screenshot,
+          message: 'Unexpected error getting recent frames: $e',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+      return [];
+    }
+  }
+
   // ============================================================
   // SCREEN RECORDING PERMISSION
   // ============================================================
@@ -521,6 +1134,112 @@ class WindowFocus {
     }
   }
 
+  /// Returns the input devices that are currently monitored, with the time
+  /// of their last input and how many input events each one reported.
+  ///
+  /// Lists HID devices on Windows and Linux and connected XInput controllers
+  /// on Windows. Returns an empty list while HID monitoring is disabled.
+  Future<List<InputDeviceDto>> getInputDevices() async {
+    try {
+      final result = await _channel.invokeMethod<List<dynamic>>('getInputDevices');
+      return (result ?? const [])
+          .whereType<Map<dynamic, dynamic>>()
+          .map(InputDeviceDto.fromMap)
+          .toList();
+    } on PlatformException catch (e, stackTrace) {
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.configuration,
+          message: 'Failed to get input devices: ${e.message}',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+      return const [];
+    } catch (e, stackTrace) {
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.configuration,
+          message: 'Unexpected error getting input devices: $e',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+      return const [];
+    }
+  }
+
+  /// Returns the current level of the system audio output and whether it
+  /// counts as media playback.
+  ///
+  /// On Linux the level is measured over 50 ms windows of the default
+  /// sink's output, and [AudioLevelDto.playing] only turns on after a second
+  /// of sustained audio above the threshold, so clicks and notification
+  /// sounds do not count. On Windows it reflects the last peak read from the
+  /// default output device. Returns [AudioLevelDto.silent] while audio
+  /// monitoring is disabled.
+  Future<AudioLevelDto> getAudioLevel() async {
+    try {
+      final result = await _channel.invokeMethod<Map>('getAudioLevel');
+      return result == null ? AudioLevelDto.silent : AudioLevelDto.fromMap(result);
+    } on PlatformException catch (e, stackTrace) {
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.configuration,
+          message: 'Failed to get audio level: ${e.message}',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+      return AudioLevelDto.silent;
+    } catch (e, stackTrace) {
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.configuration,
+          message: 'Unexpected error getting audio level: $e',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+      return AudioLevelDto.silent;
+    }
+  }
+
+  /// Returns the applications with an open playback stream, with their
+  /// process ID, current peak and whether they were audible recently.
+  ///
+  /// Linux only, while audio monitoring is enabled. Returns an empty list
+  /// otherwise.
+  Future<List<AudioAppDto>> getAudioApplications() async {
+    try {
+      final result = await _channel.invokeMethod<List<dynamic>>('getAudioApplications');
+      return (result ?? const [])
+          .whereType<Map<dynamic, dynamic>>()
+          .map(AudioAppDto.fromMap)
+          .toList();
+    } on PlatformException catch (e, stackTrace) {
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.configuration,
+          message: 'Failed to get audio applications: ${e.message}',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+      return const [];
+    } catch (e, stackTrace) {
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.configuration,
+          message: 'Unexpected error getting audio applications: $e',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+      return const [];
+    }
+  }
+
   // ============================================================
   // DEBUG AND MONITORING SETTINGS
   // ============================================================
@@ -613,10 +1332,45 @@ class WindowFocus {
     }
   }
 
+  /// Sets the applications whose audio never counts as user activity, for
+  /// example a background music player.
+  ///
+  /// Names are compared case-insensitively with the process binary
+  /// (`spotify`) and the application name (`Spotify`). Pass an empty list to
+  /// count audio from every application again. Linux only.
+  Future<void> setAudioIgnoredApps(List<String> apps) async {
+    try {
+      await _channel.invokeMethod('setAudioIgnoredApps', {
+        'apps': apps,
+      });
+    } on PlatformException catch (e, stackTrace) {
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.configuration,
+          message: 'Failed to set ignored audio apps: ${e.message}',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+    } catch (e, stackTrace) {
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.configuration,
+          message: 'Unexpected error setting ignored audio apps: $e',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+    }
+  }
+
   /// Sets the audio threshold for detecting user activity.
   ///
-  /// The threshold is a float between 0.0 and 1.0. Audio peaks above
-  /// this value are considered as user activity. Default is 0.001.
+  /// The threshold is a float between 0.0 and 1.0. On Windows, audio peaks
+  /// above this value are considered as user activity. On Linux it applies
+  /// to the RMS level, which has to stay above it for a second before audio
+  /// counts and below half of it for two seconds before it stops counting.
+  /// Default is 0.001.
   Future<void> setAudioThreshold(double threshold) async {
     try {
       await _channel.invokeMethod('setAudioThreshold', {
@@ -675,6 +1429,115 @@ class WindowFocus {
     }
   }
 
+  /// Sets the deadzone applied to analog HID axes (wheels, pedals, sticks),
+  /// as a fraction of each axis range in `[0, 1)`.
+  ///
+  /// Axis movement inside the deadzone does not count as activity. The
+  /// plugin also learns a small deadzone per axis from the noise it sees
+  /// during the first seconds after a device is opened; the larger of the two
+  /// applies. Supported on Windows and Linux.
+  ///
+  /// Defaults to 0.
+  Future<void> setHIDAxisDeadzone(double deadzone) async {
+    try {
+      await _channel.invokeMethod('setHIDAxisDeadzone', {
+        'deadzone': deadzone,
+      });
+    } on PlatformException catch (e, stackTrace) {
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.configuration,
+          message: 'Failed to set HID axis deadzone: ${e.message}',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+    } catch (e, stackTrace) {
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.configuration,
+          message: 'Unexpected error setting HID axis deadzone: $e',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+    }
+  }
+
+  /// Overrides the deadzone and hysteresis of one game controller axis.
+  ///
+  /// [axis] is one of `x`, `y`, `z`, `rx`, `ry`, `rz`, `throttle`, `rudder`,
+  /// `wheel`, `gas` or `brake`. [deadzone] is a fraction of the axis range in
+  /// `[0, 1)` and replaces the one set with [setHIDAxisDeadzone] for this
+  /// axis. [hysteresis] is a fraction of the deadzone in `[0, 1)`: how far the
+  /// axis must move again before the movement counts once it has left the
+  /// deadzone (0.5 by default). Pass `null` to go back to the default.
+  /// Supported on Linux.
+  Future<void> setControllerAxisFilter(
+    String axis, {
+    double? deadzone,
+    double? hysteresis,
+  }) async {
+    try {
+      await _channel.invokeMethod('setControllerAxisFilter', {
+        'axis': axis,
+        'deadzone': deadzone,
+        'hysteresis': hysteresis,
+      });
+    } on PlatformException catch (e, stackTrace) {
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.configuration,
+          message: 'Failed to set controller axis filter: ${e.message}',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+    } catch (e, stackTrace) {
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.configuration,
+          message: 'Unexpected error setting controller axis filter: $e',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+    }
+  }
+
+  /// Enables or disables [onDeviceChanged] events.
+  ///
+  /// HID devices are added and removed as they are plugged in regardless of
+  /// this setting; it only controls whether the changes are reported.
+  /// Supported on Windows and Linux.
+  ///
+  /// Disabled by default.
+  Future<void> setDeviceChangeEvents(bool enabled) async {
+    try {
+      await _channel.invokeMethod('setDeviceChangeEvents', {
+        'enabled': enabled,
+      });
+    } on PlatformException catch (e, stackTrace) {
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.configuration,
+          message: 'Failed to set device change events: ${e.message}',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+    } catch (e, stackTrace) {
+      _handleError(
+        WindowFocusError(
+          type: WindowFocusErrorType.configuration,
+          message: 'Unexpected error setting device change events: $e',
+          originalError: e,
+          stackTrace: stackTrace,
+        ),
+      );
+    }
+  }
+
   /// Enables or disables keyboard input monitoring.
   ///
   /// When enabled, the plugin uses a low-level keyboard hook (`WH_KEYBOARD_LL`)
@@ -747,6 +1610,20 @@ class WindowFocus {
     );
   }
 
+  /// Adds a listener for input devices being plugged in or removed.
+  StreamSubscription<DeviceChangeDto> addDeviceChangeListener(
+      void Function(DeviceChangeDto) listener) {
+    return onDeviceChanged.listen(
+      listener,
+      onError: (error) {
+        if (_debug) {
+          print('[WindowFocus] Error in device change listener: $error');
+        }
+      },
+      cancelOnError: false,
+    );
+  }
+
   /// Adds a listener for plugin errors.
   StreamSubscription<WindowFocusError> addErrorListener(
       void Function(WindowFocusError) listener) {
@@ -772,6 +1649,12 @@ class WindowFocus {
       if (!_errorController.isClosed) {
         _errorController.close();
       }
+      if (!_deviceChangeController.isClosed) {
+        _deviceChangeController.close();
+      }
+      if (!_scheduledScreenshotController.isClosed) {
+        _scheduledScreenshotController.close();
+      }
     } catch (e) {
       if (_debug) {
         print('[WindowFocus] Error disposing: $e');
@@ -0,0 +1,122 @@
+#include "activity_tracker.h"
+
+#include <utility>
+
+namespace window_focus {
+
+namespace {
+
+// A GSource that is dispatched once its ready time passes and then disarms
+// itself. g_source_set_ready_time() is safe to call from any thread, which
+// makes this both a cross-thread wakeup and a one-shot timer.
+gboolean ReadyTimeDispatch(GSource* source, GSourceFunc callback,
+                           gpointer user_data) {
+  g_source_set_ready_time(source, -1);
+  return callback ? callback(user_data) : G_SOURCE_CONTINUE;
+}
+
+GSourceFuncs kReadyTimeSourceFuncs = {
+    nullptr, nullptr, ReadyTimeDispatch, nullptr, nullptr, nullptr,
+};
+
+GSource* CreateReadyTimeSource(GSourceFunc callback, gpointer user_data) {
+  GSource* source = g_source_new(&kReadyTimeSourceFuncs, sizeof(GSource));
+  g_source_set_callback(source, callback, user_data, nullptr);
+  g_source_set_ready_time(source, -1);
+  g_source_attach(source, nullptr);
+  return source;
+}
+
+}  // namespace
+
+ActivityTracker::ActivityTracker(StateCallback callback)
+    : callback_(std::move(callback)),
+      wake_source_(CreateReadyTimeSource(OnSourceReady, this)),
+      deadline_source_(CreateReadyTimeSource(OnSourceReady, this)),
+      last_activity_us_(g_get_monotonic_time()) {
+  Evaluate();
+}
+
+ActivityTracker::~ActivityTracker() {
+  g_source_destroy(wake_source_);
+  g_source_unref(wake_source_);
+  g_source_destroy(deadline_source_);
+  g_source_unref(deadline_source_);
+}
+
+void ActivityTracker::RecordActivity() {
+  // Sequentially consistent on purpose: pairs with the re-check in Evaluate()
+  // so activity racing with the transition to inactive is never lost.
+  last_activity_us_.store(g_get_monotonic_time());
+  // While active the pending deadline picks up the new timestamp on its own.
+  if (!user_is_active_.load()) {
+    g_source_set_ready_time(wake_source_, 0);
+  }
+}
+
+void ActivityTracker::SetInactivityThreshold(int milliseconds) {
+  threshold_ms_ = milliseconds;
+  Evaluate();
+}
+
+void ActivityTracker::SetInputIdleSource(bool attached) {
+  input_idle_source_ = attached;
+  input_idle_ = false;
+  Evaluate();
+}
+
+void ActivityTracker::SetInputIdle(bool idle) {
+  input_idle_ = idle;
+  if (!idle) {
+    // A resume is itself an input event.
+    last_activity_us_.store(g_get_monotonic_time(), std::memory_order_relaxed);
+  }
+  Evaluate();
+}
+
+void ActivityTracker::SetMediaActive(bool active) {
+  if (active == media_active_) {
+    return;
+  }
+  media_active_ = active;
+  if (!active) {
+    // The idle timeout runs from the end of playback.
+    last_activity_us_.store(g_get_monotonic_time(), std::memory_order_relaxed);
+  }
+  Evaluate();
+}
+
+// static
+gboolean ActivityTracker::OnSourceReady(gpointer user_data) {
+  static_cast<ActivityTracker*>(user_data)->Evaluate();
+  return G_SOURCE_CONTINUE;
+}
+
+void ActivityTracker::Evaluate() {
+  const gint64 last_activity =
+      last_activity_us_.load(std::memory_order_relaxed);
+  const gint64 threshold_us = static_cast<gint64>(threshold_ms_) * 1000;
+  const bool input_busy =
+      (input_idle_source_ && !input_idle_) || media_active_;
+  const bool active =
+      input_busy || g_get_monotonic_time() - last_activity <= threshold_us;
+
+  if (active != user_is_active_.load()) {
+    user_is_active_.store(active);
+    if (callback_) {
+      callback_(active);
+    }
+    if (!active && last_activity_us_.load() != last_activity) {
+      g_source_set_ready_time(wake_source_, 0);
+    }
+  }
+
+  // Busy input sources and media report their own end, and an inactive
+  // user is woken up by RecordActivity(), so only the clock-driven active
+  // state needs a deadline.
+  const bool clock_driven = active && !input_busy;
+  g_source_set_ready_time(
+      deadline_source_, clock_driven ? last_activity + threshold_us + 1 : -1);
+}
+
+}  // namespace window_focus
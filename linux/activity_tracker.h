@@ -0,0 +1,70 @@
+#ifndef FLUTTER_PLUGIN_WINDOW_FOCUS_ACTIVITY_TRACKER_H_
+#define FLUTTER_PLUGIN_WINDOW_FOCUS_ACTIVITY_TRACKER_H_
+
+#include <glib.h>
+
+#include <atomic>
+#include <functional>
+
+namespace window_focus {
+
+// Linux counterpart of the Windows lastActivityTime/userIsActive_ pair.
+//
+// Input sources report activity with RecordActivity() from any thread. The
+// active/inactive decision is made on the GLib main context, which is where
+// Flutter method channels must be used. Instead of polling once a second the
+// tracker arms a single deadline at "last activity + threshold" and only
+// re-evaluates when it fires or when activity arrives while inactive.
+class ActivityTracker {
+ public:
+  // Called on the main context whenever the user becomes active or inactive.
+  using StateCallback = std::function<void(bool active)>;
+
+  explicit ActivityTracker(StateCallback callback);
+  ~ActivityTracker();
+
+  ActivityTracker(const ActivityTracker&) = delete;
+  ActivityTracker& operator=(const ActivityTracker&) = delete;
+
+  // Records user activity. Safe to call from any thread and cheap enough to
+  // be called for every input event.
+  void RecordActivity();
+
+  // Main context only.
+  void SetInactivityThreshold(int milliseconds);
+  int inactivity_threshold() const { return threshold_ms_; }
+
+  // Compositor-driven idle sources (Wayland) do not report individual input
+  // events, only transitions. While such a source is attached and reports the
+  // seat as busy, the user is considered active regardless of the clock.
+  void SetInputIdleSource(bool attached);
+  void SetInputIdle(bool idle);
+
+  // While media plays (an idle inhibitor is held or a player is playing) the
+  // user is considered active, as with audio on Windows. Main context only.
+  void SetMediaActive(bool active);
+
+  bool user_is_active() const { return user_is_active_.load(); }
+
+ private:
+  static gboolean OnSourceReady(gpointer user_data);
+  void Evaluate();
+
+  StateCallback callback_;
+
+  // |wake_source_| is triggered from input threads; |deadline_source_| is
+  // only touched on the main context.
+  GSource* wake_source_;
+  GSource* deadline_source_;
+
+  std::atomic<gint64> last_activity_us_;
+  std::atomic<bool> user_is_active_{true};
+  int threshold_ms_ = 60000;
+  bool input_idle_source_ = false;
+  bool input_idle_ = false;
+  bool media_active_ = false;
+};
+
+}  // namespace window_focus
+
+#endif  // FLUTTER_PLUGIN_WINDOW_FOCUS_ACTIVITY_TRACKER_H_
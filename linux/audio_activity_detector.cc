@@ -0,0 +1,207 @@
+#include "audio_activity_detector.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+// AVX is not part of the x86-64 baseline; it is picked at run time.
+#define WINDOW_FOCUS_AUDIO_AVX 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace window_focus {
+
+constexpr std::chrono::milliseconds AudioActivityDetector::kWindow;
+constexpr std::chrono::milliseconds AudioActivityDetector::kAttack;
+constexpr std::chrono::milliseconds AudioActivityDetector::kRelease;
+constexpr float AudioActivityDetector::kReleaseRatio;
+
+namespace {
+
+void AccumulateScalar(const float* samples,
+                      size_t count,
+                      float* sum_squares,
+                      float* peak) {
+  float sum = 0.0f;
+  float max = *peak;
+  for (size_t i = 0; i < count; i++) {
+    sum += samples[i] * samples[i];
+    max = std::max(max, std::fabs(samples[i]));
+  }
+  *sum_squares += sum;
+  *peak = max;
+}
+
+#if defined(__SSE2__)
+float HorizontalSum(__m128 v) {
+  v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+  v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+  return _mm_cvtss_f32(v);
+}
+
+float HorizontalMax(__m128 v) {
+  v = _mm_max_ps(v, _mm_movehl_ps(v, v));
+  v = _mm_max_ss(v, _mm_shuffle_ps(v, v, 1));
+  return _mm_cvtss_f32(v);
+}
+
+void AccumulateSse(const float* samples,
+                   size_t count,
+                   float* sum_squares,
+                   float* peak) {
+  const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+  // Two accumulators hide the latency of the dependent adds.
+  __m128 sum0 = _mm_setzero_ps();
+  __m128 sum1 = _mm_setzero_ps();
+  __m128 max = _mm_set1_ps(*peak);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m128 a = _mm_loadu_ps(samples + i);
+    const __m128 b = _mm_loadu_ps(samples + i + 4);
+    sum0 = _mm_add_ps(sum0, _mm_mul_ps(a, a));
+    sum1 = _mm_add_ps(sum1, _mm_mul_ps(b, b));
+    max = _mm_max_ps(max, _mm_and_ps(a, abs_mask));
+    max = _mm_max_ps(max, _mm_and_ps(b, abs_mask));
+  }
+  *sum_squares += HorizontalSum(_mm_add_ps(sum0, sum1));
+  *peak = HorizontalMax(max);
+  AccumulateScalar(samples + i, count - i, sum_squares, peak);
+}
+#endif
+
+#if defined(WINDOW_FOCUS_AUDIO_AVX)
+__attribute__((target("avx"))) void AccumulateAvx(const float* samples,
+                                                  size_t count,
+                                                  float* sum_squares,
+                                                  float* peak) {
+  const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+  __m256 sum0 = _mm256_setzero_ps();
+  __m256 sum1 = _mm256_setzero_ps();
+  __m256 max = _mm256_set1_ps(*peak);
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    const __m256 a = _mm256_loadu_ps(samples + i);
+    const __m256 b = _mm256_loadu_ps(samples + i + 8);
+    sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(a, a));
+    sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(b, b));
+    max = _mm256_max_ps(max, _mm256_and_ps(a, abs_mask));
+    max = _mm256_max_ps(max, _mm256_and_ps(b, abs_mask));
+  }
+  const __m256 sum = _mm256_add_ps(sum0, sum1);
+  __m128 sum4 = _mm_add_ps(_mm256_castps256_ps128(sum),
+                           _mm256_extractf128_ps(sum, 1));
+  __m128 max4 = _mm_max_ps(_mm256_castps256_ps128(max),
+                           _mm256_extractf128_ps(max, 1));
+  *sum_squares += HorizontalSum(sum4);
+  *peak = HorizontalMax(max4);
+  AccumulateSse(samples + i, count - i, sum_squares, peak);
+}
+#endif
+
+#if defined(__ARM_NEON)
+void AccumulateNeon(const float* samples,
+                    size_t count,
+                    float* sum_squares,
+                    float* peak) {
+  float32x4_t sum0 = vdupq_n_f32(0.0f);
+  float32x4_t sum1 = vdupq_n_f32(0.0f);
+  float32x4_t max = vdupq_n_f32(*peak);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const float32x4_t a = vld1q_f32(samples + i);
+    const float32x4_t b = vld1q_f32(samples + i + 4);
+    sum0 = vmlaq_f32(sum0, a, a);
+    sum1 = vmlaq_f32(sum1, b, b);
+    max = vmaxq_f32(max, vabsq_f32(a));
+    max = vmaxq_f32(max, vabsq_f32(b));
+  }
+  const float32x4_t sum = vaddq_f32(sum0, sum1);
+#if defined(__aarch64__)
+  *sum_squares += vaddvq_f32(sum);
+  *peak = vmaxvq_f32(max);
+#else
+  float32x2_t sum2 = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
+  float32x2_t max2 = vmax_f32(vget_low_f32(max), vget_high_f32(max));
+  *sum_squares += vget_lane_f32(vpadd_f32(sum2, sum2), 0);
+  *peak = vget_lane_f32(vpmax_f32(max2, max2), 0);
+#endif
+  AccumulateScalar(samples + i, count - i, sum_squares, peak);
+}
+#endif
+
+using AccumulateFunction = void (*)(const float*, size_t, float*, float*);
+
+AccumulateFunction SelectAccumulate() {
+#if defined(WINDOW_FOCUS_AUDIO_AVX)
+  if (__builtin_cpu_supports("avx")) {
+    return AccumulateAvx;
+  }
+#endif
+#if defined(__SSE2__)
+  return AccumulateSse;
+#elif defined(__ARM_NEON)
+  return AccumulateNeon;
+#else
+  return AccumulateScalar;
+#endif
+}
+
+}  // namespace
+
+void AccumulateSquaresAndPeak(const float* samples,
+                              size_t count,
+                              float* sum_squares,
+                              float* peak) {
+  static const AccumulateFunction accumulate = SelectAccumulate();
+  accumulate(samples, count, sum_squares, peak);
+}
+
+AudioActivityDetector::AudioActivityDetector(uint32_t sample_rate)
+    : window_samples_(std::max<size_t>(
+          1, static_cast<size_t>(sample_rate) * kWindow.count() / 1000)),
+      attack_windows_(static_cast<int>(kAttack / kWindow)),
+      release_windows_(static_cast<int>(kRelease / kWindow)) {}
+
+bool AudioActivityDetector::Process(const float* samples, size_t count) {
+  while (count > 0) {
+    const size_t take = std::min(count, window_samples_ - window_fill_);
+    AccumulateSquaresAndPeak(samples, take, &window_sum_squares_,
+                             &window_peak_);
+    window_fill_ += take;
+    samples += take;
+    count -= take;
+    if (window_fill_ == window_samples_) {
+      FinishWindow();
+    }
+  }
+  return playing_;
+}
+
+void AudioActivityDetector::FinishWindow() {
+  rms_ = std::sqrt(window_sum_squares_ / static_cast<float>(window_fill_));
+  peak_ = window_peak_;
+  window_fill_ = 0;
+  window_sum_squares_ = 0.0f;
+  window_peak_ = 0.0f;
+
+  const bool loud = rms_ > threshold_;
+  const bool quiet = rms_ < threshold_ * kReleaseRatio;
+  if (!playing_) {
+    // A gap restarts the attack, so a series of clicks never adds up.
+    loud_windows_ = loud ? loud_windows_ + 1 : (quiet ? 0 : loud_windows_);
+    if (loud_windows_ >= attack_windows_) {
+      playing_ = true;
+      quiet_windows_ = 0;
+    }
+  } else {
+    quiet_windows_ = quiet ? quiet_windows_ + 1 : 0;
+    if (quiet_windows_ >= release_windows_) {
+      playing_ = false;
+      loud_windows_ = 0;
+    }
+  }
+}
+
+}  // namespace window_focus
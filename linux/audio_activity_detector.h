@@ -0,0 +1,69 @@
+#ifndef FLUTTER_PLUGIN_WINDOW_FOCUS_AUDIO_ACTIVITY_DETECTOR_H_
+#define FLUTTER_PLUGIN_WINDOW_FOCUS_AUDIO_ACTIVITY_DETECTOR_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace window_focus {
+
+// Decides from PCM whether media is playing.
+//
+// Samples are reduced to RMS and peak over fixed windows. Playback starts
+// once the RMS stays above the threshold for kAttack and ends once it stays
+// below kReleaseRatio of it for kRelease, so clicks and notification chimes
+// never count and quiet passages do not end playback. Windows between the
+// two levels keep the current state.
+class AudioActivityDetector {
+ public:
+  static constexpr std::chrono::milliseconds kWindow{50};
+  static constexpr std::chrono::milliseconds kAttack{1000};
+  static constexpr std::chrono::milliseconds kRelease{2000};
+  static constexpr float kReleaseRatio = 0.5f;
+
+  // |sample_rate| of the mono float samples passed to Process().
+  explicit AudioActivityDetector(uint32_t sample_rate);
+
+  // Linear RMS, 0 to 1, above which a window is loud.
+  void set_threshold(float threshold) { threshold_ = threshold; }
+  float threshold() const { return threshold_; }
+
+  // Feeds samples in blocks of any size. Returns whether media is playing
+  // after them.
+  bool Process(const float* samples, size_t count);
+
+  bool playing() const { return playing_; }
+  // Of the last complete window.
+  float rms() const { return rms_; }
+  float peak() const { return peak_; }
+
+ private:
+  void FinishWindow();
+
+  size_t window_samples_;
+  int attack_windows_;
+  int release_windows_;
+  float threshold_ = 0.01f;
+
+  size_t window_fill_ = 0;
+  float window_sum_squares_ = 0.0f;
+  float window_peak_ = 0.0f;
+
+  int loud_windows_ = 0;
+  int quiet_windows_ = 0;
+  bool playing_ = false;
+  float rms_ = 0.0f;
+  float peak_ = 0.0f;
+};
+
+// Adds the sum of squares of |samples| to |sum_squares| and raises |peak| to
+// their largest magnitude. Uses AVX when the CPU has it, otherwise SSE or
+// NEON.
+void AccumulateSquaresAndPeak(const float* samples,
+                              size_t count,
+                              float* sum_squares,
+                              float* peak);
+
+}  // namespace window_focus
+
+#endif  // FLUTTER_PLUGIN_WINDOW_FOCUS_AUDIO_ACTIVITY_DETECTOR_H_
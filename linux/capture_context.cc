@@ -0,0 +1,139 @@
+#include "capture_context.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace window_focus {
+
+CaptureContext::CaptureContext(FrameSourceFactory factory,
+                               size_t max_idle_captures,
+                               size_t max_idle_buffers)
+    : factory_(std::move(factory)),
+      max_idle_captures_(max_idle_captures),
+      max_idle_buffers_(max_idle_buffers) {}
+
+CaptureContext::FrameSource CaptureContext::NewSource() {
+  return [this](const CaptureTarget& target,
+                ScreenshotScheduler::Frame* frame) {
+    std::shared_ptr<Capture> capture = Borrow();
+    if (!capture->source(target, frame)) {
+      return false;
+    }
+    frame->owner = std::move(capture);
+    return true;
+  };
+}
+
+std::shared_ptr<CaptureContext::Capture> CaptureContext::Borrow() {
+  std::unique_ptr<Capture> capture;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!idle_captures_.empty()) {
+      capture = std::move(idle_captures_.back());
+      idle_captures_.pop_back();
+    } else {
+      capture.reset(new Capture());
+      capture->generation = generation_;
+    }
+  }
+  if (!capture->source) {
+    // Opened outside the lock; connecting can take a while.
+    capture->source = factory_();
+  }
+  return std::shared_ptr<Capture>(
+      capture.release(), [this](Capture* returned) { Return(returned); });
+}
+
+void CaptureContext::Return(Capture* capture) {
+  std::unique_ptr<Capture> owned(capture);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (owned->generation == generation_ &&
+        idle_captures_.size() < max_idle_captures_) {
+      idle_captures_.push_back(std::move(owned));
+    }
+  }
+  // Otherwise closed here, outside the lock.
+}
+
+std::vector<uint8_t> CaptureContext::AcquireBuffer(size_t capacity) {
+  std::vector<uint8_t> buffer;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto best = idle_buffers_.end();
+    for (auto it = idle_buffers_.begin(); it != idle_buffers_.end(); ++it) {
+      if (it->capacity() >= capacity &&
+          (best == idle_buffers_.end() || it->capacity() < best->capacity())) {
+        best = it;
+      }
+    }
+    if (best != idle_buffers_.end()) {
+      buffer = std::move(*best);
+      idle_buffers_.erase(best);
+    }
+  }
+  buffer.clear();
+  buffer.reserve(capacity);
+  return buffer;
+}
+
+void CaptureContext::ReleaseBuffer(std::vector<uint8_t> buffer) {
+  if (buffer.capacity() == 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (idle_buffers_.size() >= max_idle_buffers_) {
+    // The smallest is the least likely to fit the next frame.
+    auto smallest = std::min_element(
+        idle_buffers_.begin(), idle_buffers_.end(),
+        [](const std::vector<uint8_t>& a, const std::vector<uint8_t>& b) {
+          return a.capacity() < b.capacity();
+        });
+    if (smallest == idle_buffers_.end() ||
+        smallest->capacity() >= buffer.capacity()) {
+      return;
+    }
+    idle_buffers_.erase(smallest);
+  }
+  idle_buffers_.push_back(std::move(buffer));
+}
+
+void CaptureContext::UpdateScreenSize(int width, int height) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (width == screen_width_ && height == screen_height_) {
+      return;
+    }
+    const bool first = screen_width_ == 0 && screen_height_ == 0;
+    screen_width_ = width;
+    screen_height_ = height;
+    if (first) {
+      return;
+    }
+  }
+  Invalidate();
+}
+
+void CaptureContext::Invalidate() {
+  std::vector<std::unique_ptr<Capture>> captures;
+  std::vector<std::vector<uint8_t>> buffers;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    generation_++;
+    captures.swap(idle_captures_);
+    buffers.swap(idle_buffers_);
+  }
+  // Closed outside the lock.
+}
+
+size_t CaptureContext::idle_captures() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return idle_captures_.size();
+}
+
+size_t CaptureContext::idle_buffers() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return idle_buffers_.size();
+}
+
+}  // namespace window_focus
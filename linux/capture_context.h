@@ -0,0 +1,89 @@
+#ifndef FLUTTER_PLUGIN_WINDOW_FOCUS_CAPTURE_CONTEXT_H_
+#define FLUTTER_PLUGIN_WINDOW_FOCUS_CAPTURE_CONTEXT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "screenshot_scheduler.h"
+
+namespace window_focus {
+
+// Idle frame sources the capture context keeps open.
+constexpr size_t kMaxIdleCaptures = 2;
+// Released buffers the capture context keeps for reuse.
+constexpr size_t kMaxIdleBuffers = 4;
+
+// What screenshots keep between calls, shared by everything that takes
+// them: the frame sources, each an X11 connection with its shared memory
+// segment, and the buffers frames are scaled and encoded into.
+//
+// A source is lent to one capture at a time and comes back once the frame
+// it took is dropped, so the workers, the ring and the schedule share a few
+// segments instead of each holding one the size of the screen. Released
+// buffers are handed out again for requests that fit in them. Both are kept
+// until the screen changes size, which drops every segment and buffer sized
+// for the old screen.
+//
+// Thread-safe. Must outlive the sources it returns and their frames.
+class CaptureContext {
+ public:
+  using FrameSource = ScreenshotScheduler::FrameSource;
+  // Opens a source; called on the thread about to capture with it.
+  using FrameSourceFactory = std::function<FrameSource()>;
+
+  explicit CaptureContext(FrameSourceFactory factory,
+                          size_t max_idle_captures = kMaxIdleCaptures,
+                          size_t max_idle_buffers = kMaxIdleBuffers);
+
+  CaptureContext(const CaptureContext&) = delete;
+  CaptureContext& operator=(const CaptureContext&) = delete;
+
+  // A source that borrows an idle one for each capture, or opens one when
+  // all are lent. The frame holds on to what it borrowed until it is
+  // dropped, rather than until the next call.
+  FrameSource NewSource();
+
+  // An empty buffer with room for at least |capacity| bytes, reusing the
+  // smallest released one that has it.
+  std::vector<uint8_t> AcquireBuffer(size_t capacity);
+  // Keeps |buffer|'s memory for a later AcquireBuffer.
+  void ReleaseBuffer(std::vector<uint8_t> buffer);
+
+  // Reports the size of the screen a source captured from; a change
+  // invalidates the context.
+  void UpdateScreenSize(int width, int height);
+  // Drops the idle sources and buffers. Sources lent out are dropped when
+  // they come back.
+  void Invalidate();
+
+  size_t idle_captures() const;
+  size_t idle_buffers() const;
+
+ private:
+  struct Capture {
+    FrameSource source;
+    // Sources from before the last Invalidate are not reused.
+    uint64_t generation = 0;
+  };
+
+  std::shared_ptr<Capture> Borrow();
+  void Return(Capture* capture);
+
+  const FrameSourceFactory factory_;
+  const size_t max_idle_captures_;
+  const size_t max_idle_buffers_;
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<Capture>> idle_captures_;
+  std::vector<std::vector<uint8_t>> idle_buffers_;
+  uint64_t generation_ = 0;
+  int screen_width_ = 0;
+  int screen_height_ = 0;
+};
+
+}  // namespace window_focus
+
+#endif  // FLUTTER_PLUGIN_WINDOW_FOCUS_CAPTURE_CONTEXT_H_
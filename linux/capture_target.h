@@ -0,0 +1,38 @@
+#ifndef FLUTTER_PLUGIN_WINDOW_FOCUS_CAPTURE_TARGET_H_
+#define FLUTTER_PLUGIN_WINDOW_FOCUS_CAPTURE_TARGET_H_
+
+namespace window_focus {
+
+// What a screenshot captures: the whole screen, unless narrowed down to the
+// active window, a window, a region or one monitor, which take precedence in
+// that order. Only those pixels are read from the X server.
+struct CaptureTarget {
+  bool active_window_only = false;
+  // A window by X11 id, or 0.
+  unsigned long window = 0;
+  // For the active window or |window|: its client area, without the window
+  // manager frame.
+  bool client_area_only = false;
+  // A rectangle in root window coordinates, when |width| and |height| are
+  // positive.
+  int x = 0;
+  int y = 0;
+  int width = 0;
+  int height = 0;
+  // Index in XShmCapture::ListMonitors, as getMonitors reports them, or -1.
+  int monitor = -1;
+
+  bool has_region() const { return width > 0 && height > 0; }
+
+  bool operator==(const CaptureTarget& other) const {
+    return active_window_only == other.active_window_only &&
+           window == other.window &&
+           client_area_only == other.client_area_only && x == other.x &&
+           y == other.y && width == other.width && height == other.height &&
+           monitor == other.monitor;
+  }
+};
+
+}  // namespace window_focus
+
+#endif  // FLUTTER_PLUGIN_WINDOW_FOCUS_CAPTURE_TARGET_H_
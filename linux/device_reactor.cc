@@ -0,0 +1,294 @@
+#include "device_reactor.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#ifdef WINDOW_FOCUS_HAVE_LIBUDEV
+#include <libudev.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+namespace window_focus {
+
+namespace {
+
+bool AddToEpoll(int epoll_fd, int fd) {
+  epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.fd = fd;
+  return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+#ifdef WINDOW_FOCUS_HAVE_LIBUDEV
+// udev only announces nodes below /dev.
+bool IsUdevDirectory(const std::string& dir) {
+  return dir == "/dev" || dir.compare(0, 5, "/dev/") == 0;
+}
+
+// udev_monitor_new_from_netlink() and udev_monitor_enable_receiving() also
+// succeed without a udev daemon, as in most containers, and then nothing
+// ever arrives. The daemon creates its control socket when it starts.
+bool UdevIsRunning() {
+  return access("/run/udev/control", F_OK) == 0;
+}
+#endif
+
+}  // namespace
+
+void DeviceInventory::Add(const InputDeviceInfo& info,
+                          std::shared_ptr<const InputDeviceStats> stats) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_.push_back({info, std::move(stats)});
+}
+
+void DeviceInventory::Remove(const std::string& path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_.erase(std::remove_if(entries_.begin(), entries_.end(),
+                                [&](const Entry& entry) {
+                                  return entry.info.path == path;
+                                }),
+                 entries_.end());
+}
+
+void DeviceInventory::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_.clear();
+}
+
+std::vector<InputDeviceInfo> DeviceInventory::Get() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<InputDeviceInfo> devices;
+  devices.reserve(entries_.size());
+  for (const auto& entry : entries_) {
+    InputDeviceInfo info = entry.info;
+    info.last_activity_ms =
+        entry.stats->last_activity_ms.load(std::memory_order_relaxed);
+    info.event_count = entry.stats->event_count.load(std::memory_order_relaxed);
+    devices.push_back(std::move(info));
+  }
+  return devices;
+}
+
+DeviceReactor::DeviceReactor(const char* name) : name_(name) {}
+
+DeviceReactor::~DeviceReactor() {
+  Stop();
+}
+
+bool DeviceReactor::Start(const std::string& dir,
+                          const char* node_prefix,
+                          const char* subsystem,
+                          Handlers handlers) {
+  Stop();
+  dir_ = dir;
+  node_prefix_ = node_prefix;
+  handlers_ = std::move(handlers);
+
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  wake_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (epoll_fd_ < 0 || wake_fd_ < 0 || !AddToEpoll(epoll_fd_, wake_fd_)) {
+    std::cerr << "[WindowFocus] Failed to set up " << name_
+              << " reactor: " << strerror(errno) << std::endl;
+    Stop();
+    return false;
+  }
+
+  // Subscribed before on_start runs, so a node plugged in between the two
+  // is not missed; the handlers skip paths that are already open. Without
+  // a source, hotplug_source() says so.
+  SetUpHotplug(subsystem);
+
+  thread_ = std::thread(&DeviceReactor::Run, this);
+  return true;
+}
+
+void DeviceReactor::Stop() {
+  if (thread_.joinable()) {
+    uint64_t one = 1;
+    if (write(wake_fd_, &one, sizeof(one)) < 0) {
+      std::cerr << "[WindowFocus] Failed to wake " << name_ << " reactor"
+                << std::endl;
+    }
+    thread_.join();
+  }
+
+#ifdef WINDOW_FOCUS_HAVE_LIBUDEV
+  if (udev_monitor_ != nullptr) {
+    udev_monitor_unref(udev_monitor_);
+    udev_monitor_ = nullptr;
+  }
+  if (udev_ != nullptr) {
+    udev_unref(udev_);
+    udev_ = nullptr;
+  }
+#endif
+  if (inotify_fd_ >= 0) {
+    close(inotify_fd_);
+    inotify_fd_ = -1;
+  }
+  hotplug_fd_ = -1;
+  hotplug_source_ = HotplugSource::kNone;
+  if (wake_fd_ >= 0) {
+    close(wake_fd_);
+    wake_fd_ = -1;
+  }
+  if (epoll_fd_ >= 0) {
+    close(epoll_fd_);
+    epoll_fd_ = -1;
+  }
+}
+
+bool DeviceReactor::Watch(int fd) {
+  return AddToEpoll(epoll_fd_, fd);
+}
+
+void DeviceReactor::Unwatch(int fd) {
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+bool DeviceReactor::IsNodeName(const char* name) const {
+  return strncmp(name, node_prefix_.c_str(), node_prefix_.size()) == 0;
+}
+
+void DeviceReactor::SetUpHotplug(const char* subsystem) {
+#ifdef WINDOW_FOCUS_HAVE_LIBUDEV
+  // udev announces a node only after its rules (permissions included) ran.
+  if (IsUdevDirectory(dir_) && UdevIsRunning()) {
+    udev_ = udev_new();
+  }
+  if (udev_ != nullptr) {
+    udev_monitor_ = udev_monitor_new_from_netlink(udev_, "udev");
+  }
+  if (udev_monitor_ != nullptr &&
+      udev_monitor_filter_add_match_subsystem_devtype(udev_monitor_,
+                                                      subsystem,
+                                                      nullptr) >= 0 &&
+      udev_monitor_enable_receiving(udev_monitor_) >= 0) {
+    hotplug_fd_ = udev_monitor_get_fd(udev_monitor_);
+    if (AddToEpoll(epoll_fd_, hotplug_fd_)) {
+      hotplug_source_ = HotplugSource::kUdev;
+      return;
+    }
+  }
+  if (udev_monitor_ != nullptr) {
+    udev_monitor_unref(udev_monitor_);
+    udev_monitor_ = nullptr;
+  }
+  if (udev_ != nullptr) {
+    udev_unref(udev_);
+    udev_ = nullptr;
+  }
+  hotplug_fd_ = -1;
+#else
+  (void)subsystem;
+#endif
+
+  // IN_ATTRIB catches the permission change udev (or an admin) applies after
+  // the kernel created the node, when open() would still have failed.
+  inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd_ < 0) {
+    return;
+  }
+  if (inotify_add_watch(inotify_fd_, dir_.c_str(),
+                        IN_CREATE | IN_ATTRIB | IN_DELETE) < 0 ||
+      !AddToEpoll(epoll_fd_, inotify_fd_)) {
+    close(inotify_fd_);
+    inotify_fd_ = -1;
+    return;
+  }
+  hotplug_fd_ = inotify_fd_;
+  hotplug_source_ = HotplugSource::kInotify;
+}
+
+void DeviceReactor::HandleHotplug() {
+#ifdef WINDOW_FOCUS_HAVE_LIBUDEV
+  if (udev_monitor_ != nullptr) {
+    while (udev_device* device = udev_monitor_receive_device(udev_monitor_)) {
+      const char* action = udev_device_get_action(device);
+      const char* node = udev_device_get_devnode(device);
+      const char* sysname = udev_device_get_sysname(device);
+      // A subsystem can announce other nodes too, such as the parent inputN
+      // and the legacy jsN nodes next to eventN.
+      if (action != nullptr && node != nullptr && sysname != nullptr &&
+          IsNodeName(sysname) && node == dir_ + "/" + sysname) {
+        if (strcmp(action, "add") == 0) {
+          handlers_.on_node_added(node);
+        } else if (strcmp(action, "remove") == 0) {
+          handlers_.on_node_removed(node);
+        }
+      }
+      udev_device_unref(device);
+    }
+    return;
+  }
+#endif
+
+  alignas(inotify_event) char buffer[4096];
+  while (true) {
+    ssize_t length = read(inotify_fd_, buffer, sizeof(buffer));
+    if (length <= 0) {
+      return;
+    }
+    for (char* ptr = buffer; ptr < buffer + length;) {
+      const inotify_event* event = reinterpret_cast<inotify_event*>(ptr);
+      ptr += sizeof(inotify_event) + event->len;
+      if (event->len == 0 || !IsNodeName(event->name)) {
+        continue;
+      }
+      const std::string path = dir_ + "/" + event->name;
+      if ((event->mask & IN_DELETE) != 0) {
+        handlers_.on_node_removed(path);
+      } else {
+        handlers_.on_node_added(path);
+      }
+    }
+  }
+}
+
+void DeviceReactor::Run() {
+  if (handlers_.on_start) {
+    handlers_.on_start();
+  }
+
+  epoll_event events[16];
+  while (true) {
+    int count = epoll_wait(epoll_fd_, events, 16, -1);
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cerr << "[WindowFocus] The " << name_
+                << " reactor failed: " << strerror(errno) << std::endl;
+      return;
+    }
+
+    bool input_detected = false;
+    for (int i = 0; i < count; i++) {
+      const int fd = events[i].data.fd;
+      if (fd == wake_fd_) {
+        return;  // Stop() was called.
+      }
+      if (fd == hotplug_fd_) {
+        HandleHotplug();
+        continue;
+      }
+      if (handlers_.on_fd_ready(fd, events[i].events)) {
+        input_detected = true;
+      }
+    }
+
+    // One activity update per wakeup, however many reports arrived.
+    if (input_detected) {
+      handlers_.on_activity();
+    }
+  }
+}
+
+}  // namespace window_focus
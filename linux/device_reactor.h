@@ -0,0 +1,119 @@
+#ifndef FLUTTER_PLUGIN_WINDOW_FOCUS_DEVICE_REACTOR_H_
+#define FLUTTER_PLUGIN_WINDOW_FOCUS_DEVICE_REACTOR_H_
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "input_device_stats.h"
+
+struct udev;
+struct udev_monitor;
+
+namespace window_focus {
+
+// What the input backends' GetDevices() report: the devices they monitor,
+// with counters their reactor threads update. Safe to use from any thread.
+class DeviceInventory {
+ public:
+  void Add(const InputDeviceInfo& info,
+           std::shared_ptr<const InputDeviceStats> stats);
+  void Remove(const std::string& path);
+  void Clear();
+
+  // The devices with their counters filled in.
+  std::vector<InputDeviceInfo> Get() const;
+
+ private:
+  struct Entry {
+    InputDeviceInfo info;
+    std::shared_ptr<const InputDeviceStats> stats;
+  };
+
+  mutable std::mutex mutex_;
+  std::vector<Entry> entries_;
+};
+
+// One epoll reactor thread for the device nodes of a directory, shared by
+// the hidraw and evdev backends.
+//
+// Device fds are added with Watch() and sit in one epoll set with a wake
+// eventfd and the hotplug source, so the thread sleeps until something
+// happens. Hotplug comes from udev's netlink monitor when libudev is
+// available and its daemon runs, and from inotify on the directory
+// otherwise; either way it is reported as paths of nodes whose names start
+// with the given prefix.
+class DeviceReactor {
+ public:
+  enum class HotplugSource { kNone, kUdev, kInotify };
+
+  // All invoked on the reactor thread.
+  struct Handlers {
+    // Runs once before the first wait, e.g. to open the nodes present.
+    std::function<void()> on_start;
+    // A node appeared, or its permissions changed.
+    std::function<void(const std::string& path)> on_node_added;
+    std::function<void(const std::string& path)> on_node_removed;
+    // A watched fd has |events| (EPOLLIN, EPOLLHUP, ...). Returns true if
+    // it read user input.
+    std::function<bool(int fd, uint32_t events)> on_fd_ready;
+    // At most once per wakeup, after a handler returned true.
+    std::function<void()> on_activity;
+  };
+
+  // |name| names the reactor in error messages, e.g. "HID".
+  explicit DeviceReactor(const char* name);
+  ~DeviceReactor();
+
+  DeviceReactor(const DeviceReactor&) = delete;
+  DeviceReactor& operator=(const DeviceReactor&) = delete;
+
+  // Subscribes to hotplug of the nodes below |dir| whose names start with
+  // |node_prefix| (udev |subsystem| events) and starts the thread. Returns
+  // false if the reactor cannot be set up; without a hotplug source
+  // (HotplugSource::kNone) nodes are only picked up by on_start.
+  bool Start(const std::string& dir,
+             const char* node_prefix,
+             const char* subsystem,
+             Handlers handlers);
+  // Joins the thread. Watched fds stay open; their owner closes them.
+  void Stop();
+
+  // Adds |fd| to or removes it from the epoll set. Safe from any thread.
+  bool Watch(int fd);
+  void Unwatch(int fd);
+
+  bool is_running() const { return thread_.joinable(); }
+  HotplugSource hotplug_source() const { return hotplug_source_; }
+  const std::string& dir() const { return dir_; }
+
+  bool IsNodeName(const char* name) const;
+
+ private:
+  void SetUpHotplug(const char* subsystem);
+  void HandleHotplug();
+  void Run();
+
+  const char* name_;
+  std::string dir_;
+  std::string node_prefix_;
+  Handlers handlers_;
+
+  int epoll_fd_ = -1;
+  int wake_fd_ = -1;
+  int inotify_fd_ = -1;
+  struct udev* udev_ = nullptr;
+  struct udev_monitor* udev_monitor_ = nullptr;
+  int hotplug_fd_ = -1;
+  HotplugSource hotplug_source_ = HotplugSource::kNone;
+
+  std::thread thread_;
+};
+
+}  // namespace window_focus
+
+#endif  // FLUTTER_PLUGIN_WINDOW_FOCUS_DEVICE_REACTOR_H_
@@ -0,0 +1,225 @@
+#include "evdev_gamepad_filter.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+namespace window_focus {
+
+constexpr double EvdevAxisFilter::kMinDeadzone;
+constexpr double EvdevAxisFilter::kHysteresis;
+
+namespace {
+
+bool AnyBitInRange(const EvdevCapabilities& capabilities, int first,
+                   int last) {
+  for (int code = first; code <= last; code++) {
+    if (capabilities.keys.test(code)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool IsHatAxis(uint16_t code) {
+  return code >= ABS_HAT0X && code <= ABS_HAT3Y;
+}
+
+// Pedals rest released, and so do the analog triggers game pad drivers
+// report as ABS_Z and ABS_RZ. On flight sticks those are twist and throttle
+// axes, which centre like everything else.
+bool RestsAtMinimum(EvdevDeviceKind kind, uint16_t code) {
+  if (code == ABS_GAS || code == ABS_BRAKE) {
+    return true;
+  }
+  return kind == EvdevDeviceKind::kGamepad &&
+         (code == ABS_Z || code == ABS_RZ);
+}
+
+}  // namespace
+
+EvdevDeviceKind ClassifyEvdevDevice(const EvdevCapabilities& capabilities) {
+  // Motion sensors of game pads are exposed as a separate node that streams
+  // while the pad lies still.
+  if (capabilities.properties.test(INPUT_PROP_ACCELEROMETER)) {
+    return EvdevDeviceKind::kOther;
+  }
+  // Mice with side buttons in the joystick range are still mice.
+  if (capabilities.has_relative_axes) {
+    return EvdevDeviceKind::kOther;
+  }
+
+  if (AnyBitInRange(capabilities, BTN_GAMEPAD, BTN_THUMBR)) {
+    return EvdevDeviceKind::kGamepad;
+  }
+
+  const bool has_position_axis =
+      capabilities.axes.test(ABS_X) || capabilities.axes.test(ABS_Y) ||
+      capabilities.axes.test(ABS_Z) || capabilities.axes.test(ABS_RX) ||
+      capabilities.axes.test(ABS_RY) || capabilities.axes.test(ABS_RZ) ||
+      capabilities.axes.test(ABS_THROTTLE) ||
+      capabilities.axes.test(ABS_RUDDER) || capabilities.axes.test(ABS_WHEEL) ||
+      capabilities.axes.test(ABS_GAS) || capabilities.axes.test(ABS_BRAKE) ||
+      capabilities.axes.test(ABS_HAT0X);
+  if (!has_position_axis) {
+    return EvdevDeviceKind::kOther;
+  }
+  if (AnyBitInRange(capabilities, BTN_JOYSTICK, BTN_DEAD) ||
+      AnyBitInRange(capabilities, BTN_TRIGGER_HAPPY, BTN_TRIGGER_HAPPY40)) {
+    return EvdevDeviceKind::kJoystick;
+  }
+  // Standalone pedals and some wheels expose axes only. Tablets and
+  // touchscreens also have ABS_X/ABS_Y but always report BTN_TOUCH or tools.
+  if (!capabilities.keys.test(BTN_TOUCH) &&
+      !AnyBitInRange(capabilities, BTN_TOOL_PEN, BTN_TOOL_QUADTAP) &&
+      !capabilities.properties.test(INPUT_PROP_DIRECT) &&
+      !capabilities.properties.test(INPUT_PROP_POINTER) &&
+      (capabilities.axes.test(ABS_WHEEL) || capabilities.axes.test(ABS_GAS) ||
+       capabilities.axes.test(ABS_BRAKE) ||
+       capabilities.axes.test(ABS_THROTTLE) ||
+       capabilities.axes.test(ABS_RUDDER))) {
+    return EvdevDeviceKind::kJoystick;
+  }
+  return EvdevDeviceKind::kOther;
+}
+
+bool EvdevAxisFromName(const char* name, uint16_t* code) {
+  static const struct {
+    const char* name;
+    uint16_t code;
+  } kAxes[] = {
+      {"x", ABS_X},
+      {"y", ABS_Y},
+      {"z", ABS_Z},
+      {"rx", ABS_RX},
+      {"ry", ABS_RY},
+      {"rz", ABS_RZ},
+      {"throttle", ABS_THROTTLE},
+      {"rudder", ABS_RUDDER},
+      {"wheel", ABS_WHEEL},
+      {"gas", ABS_GAS},
+      {"brake", ABS_BRAKE},
+  };
+  for (const auto& axis : kAxes) {
+    if (strcmp(name, axis.name) == 0) {
+      *code = axis.code;
+      return true;
+    }
+  }
+  return false;
+}
+
+EvdevAxisFilter::EvdevAxisFilter(EvdevDeviceKind kind, double deadzone)
+    : kind_(kind), deadzone_(deadzone) {
+  axis_index_.fill(-1);
+}
+
+void EvdevAxisFilter::AddAxis(uint16_t code, const input_absinfo& info) {
+  // Multitouch slots and ABS_MISC are not stick or pedal positions.
+  if (code >= ABS_MISC || axis_index_[code] >= 0 ||
+      info.maximum <= info.minimum) {
+    return;
+  }
+  AxisState axis;
+  axis.code = code;
+  axis.minimum = info.minimum;
+  axis.maximum = info.maximum;
+  axis.flat = info.flat;
+  axis.rest = RestsAtMinimum(kind_, code)
+                  ? info.minimum
+                  : static_cast<int32_t>(
+                        (static_cast<int64_t>(info.minimum) + info.maximum) /
+                        2);
+  axis.reference = axis.rest;
+  UpdateAxisDeadzone(&axis);
+  axis_index_[code] = static_cast<int8_t>(axes_.size());
+  axes_.push_back(axis);
+}
+
+bool EvdevAxisFilter::UpdateAxis(AxisState* axis, int32_t value) {
+  const int64_t offset =
+      std::llabs(static_cast<int64_t>(value) - axis->rest);
+  if (!axis->engaged) {
+    if (offset <= axis->deadzone) {
+      return false;
+    }
+    axis->engaged = true;
+    axis->reference = value;
+    return true;
+  }
+  // Released back to rest.
+  if (offset < axis->deadzone - axis->hysteresis) {
+    axis->engaged = false;
+    axis->reference = axis->rest;
+    return true;
+  }
+  if (std::llabs(static_cast<int64_t>(value) - axis->reference) >
+      axis->hysteresis) {
+    axis->reference = value;
+    return true;
+  }
+  return false;
+}
+
+void EvdevAxisFilter::SetDeadzone(double deadzone) {
+  deadzone_ = deadzone;
+  for (auto& axis : axes_) {
+    UpdateAxisDeadzone(&axis);
+  }
+}
+
+void EvdevAxisFilter::SetAxisSettings(uint16_t code,
+                                      const AxisSettings& settings) {
+  if (code >= ABS_CNT) {
+    return;
+  }
+  settings_[code] = settings;
+  if (axis_index_[code] >= 0) {
+    UpdateAxisDeadzone(&axes_[axis_index_[code]]);
+  }
+}
+
+const EvdevAxisFilter::AxisState* EvdevAxisFilter::FindAxis(
+    uint16_t code) const {
+  if (code >= ABS_CNT || axis_index_[code] < 0) {
+    return nullptr;
+  }
+  return &axes_[axis_index_[code]];
+}
+
+int32_t EvdevAxisFilter::axis_rest(uint16_t code) const {
+  const AxisState* axis = FindAxis(code);
+  return axis != nullptr ? axis->rest : 0;
+}
+
+int32_t EvdevAxisFilter::axis_deadzone(uint16_t code) const {
+  const AxisState* axis = FindAxis(code);
+  return axis != nullptr ? axis->deadzone : 0;
+}
+
+int32_t EvdevAxisFilter::axis_hysteresis(uint16_t code) const {
+  const AxisState* axis = FindAxis(code);
+  return axis != nullptr ? axis->hysteresis : 0;
+}
+
+void EvdevAxisFilter::UpdateAxisDeadzone(AxisState* axis) const {
+  if (IsHatAxis(axis->code)) {
+    axis->deadzone = 0;
+    axis->hysteresis = 0;
+    return;
+  }
+  const AxisSettings& settings = settings_[axis->code];
+  const double deadzone =
+      settings.deadzone >= 0.0 ? settings.deadzone : deadzone_;
+  const double hysteresis =
+      settings.hysteresis >= 0.0 ? settings.hysteresis : kHysteresis;
+  const double range = static_cast<double>(axis->maximum) -
+                       static_cast<double>(axis->minimum);
+  axis->deadzone =
+      std::max({axis->flat, static_cast<int32_t>(range * kMinDeadzone),
+                static_cast<int32_t>(range * deadzone)});
+  axis->hysteresis =
+      std::max(1, static_cast<int32_t>(axis->deadzone * hysteresis));
+}
+
+}  // namespace window_focus
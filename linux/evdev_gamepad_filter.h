@@ -0,0 +1,126 @@
+#ifndef FLUTTER_PLUGIN_WINDOW_FOCUS_EVDEV_GAMEPAD_FILTER_H_
+#define FLUTTER_PLUGIN_WINDOW_FOCUS_EVDEV_GAMEPAD_FILTER_H_
+
+#include <linux/input.h>
+
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <vector>
+
+namespace window_focus {
+
+// Event types and codes an evdev node advertises (EVIOCGBIT / EVIOCGPROP).
+struct EvdevCapabilities {
+  std::bitset<KEY_CNT> keys;
+  std::bitset<ABS_CNT> axes;
+  std::bitset<INPUT_PROP_CNT> properties;
+  bool has_relative_axes = false;
+};
+
+enum class EvdevDeviceKind {
+  kOther,
+  // BTN_GAMEPAD buttons: pads with the usual face and shoulder buttons.
+  kGamepad,
+  // BTN_JOYSTICK or BTN_TRIGGER_HAPPY buttons, or steering and pedal axes:
+  // flight sticks, wheels, pedals and button boxes.
+  kJoystick,
+};
+
+// Decides from the capability bits whether a node is a game controller.
+// Keyboards, mice, touchpads and the separate motion sensor nodes of pads
+// such as the DualSense (INPUT_PROP_ACCELEROMETER) are kOther.
+EvdevDeviceKind ClassifyEvdevDevice(const EvdevCapabilities& capabilities);
+
+// Looks up an analog axis by the name the Dart API uses: "x", "y", "z",
+// "rx", "ry", "rz", "throttle", "rudder", "wheel", "gas" or "brake".
+// Returns false for other names.
+bool EvdevAxisFromName(const char* name, uint16_t* code);
+
+// Decides whether EV_ABS events of one device are user input.
+//
+// Each axis has a deadzone around its rest position: the middle of the range
+// for sticks, wheels and rudders, the bottom for pedals and the analog
+// triggers of game pads. Its size is the kernel's flat value, kMinDeadzone
+// or the configured fraction of the range, whichever is largest; worn
+// sticks drift within a few percent of their range, which stays inside.
+// Leaving the deadzone counts as input; after that the axis counts again
+// only when it moves by more than a hysteresis band, and it re-enters the
+// deadzone only once it is back well inside it, so noise at the boundary
+// does not keep the user active. Hat switches are digital and always count.
+//
+// The deadzone and the hysteresis can be overridden per axis, e.g. for a
+// single worn stick or a throttle lever that never returns to rest.
+class EvdevAxisFilter {
+ public:
+  // Fraction of the range; drivers often report a flat value of a few units
+  // or none at all.
+  static constexpr double kMinDeadzone = 0.05;
+  // Hysteresis band as a fraction of the deadzone.
+  static constexpr double kHysteresis = 0.5;
+
+  // Overrides for one axis. Negative values keep the defaults.
+  struct AxisSettings {
+    // Fraction of the range, replacing the filter-wide deadzone.
+    double deadzone = -1.0;
+    // Fraction of the deadzone, replacing kHysteresis.
+    double hysteresis = -1.0;
+  };
+
+  // |kind| decides which axes rest at the bottom of their range.
+  EvdevAxisFilter(EvdevDeviceKind kind, double deadzone);
+
+  // Adds an axis from its EVIOCGABS information. The value it has now does
+  // not matter; a stick held while the device is opened is not at rest.
+  void AddAxis(uint16_t code, const input_absinfo& info);
+
+  // Returns true if the new value of axis |code| counts as input. Unknown
+  // axes are ignored.
+  bool Update(uint16_t code, int32_t value) {
+    if (code >= ABS_CNT || axis_index_[code] < 0) {
+      return false;
+    }
+    return UpdateAxis(&axes_[axis_index_[code]], value);
+  }
+
+  double deadzone() const { return deadzone_; }
+  // |deadzone| is a fraction of each axis range.
+  void SetDeadzone(double deadzone);
+
+  // Applies to axis |code| whether it was added already or not.
+  void SetAxisSettings(uint16_t code, const AxisSettings& settings);
+
+  size_t axis_count() const { return axes_.size(); }
+  // In axis units; for tests and diagnostics.
+  int32_t axis_rest(uint16_t code) const;
+  int32_t axis_deadzone(uint16_t code) const;
+  int32_t axis_hysteresis(uint16_t code) const;
+
+ private:
+  struct AxisState {
+    uint16_t code = 0;
+    int32_t minimum = 0;
+    int32_t maximum = 0;
+    int32_t flat = 0;
+    int32_t rest = 0;
+    // Value at the last change that counted as input.
+    int32_t reference = 0;
+    int32_t deadzone = 0;
+    int32_t hysteresis = 0;
+    bool engaged = false;
+  };
+
+  bool UpdateAxis(AxisState* axis, int32_t value);
+  void UpdateAxisDeadzone(AxisState* axis) const;
+  const AxisState* FindAxis(uint16_t code) const;
+
+  EvdevDeviceKind kind_;
+  std::array<int8_t, ABS_CNT> axis_index_;
+  std::vector<AxisState> axes_;
+  double deadzone_;
+  std::array<AxisSettings, ABS_CNT> settings_;
+};
+
+}  // namespace window_focus
+
+#endif  // FLUTTER_PLUGIN_WINDOW_FOCUS_EVDEV_GAMEPAD_FILTER_H_
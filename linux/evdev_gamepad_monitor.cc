@@ -0,0 +1,327 @@
+#include "evdev_gamepad_monitor.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <iostream>
+#include <utility>
+
+namespace window_focus {
+
+namespace {
+
+constexpr char kEventPrefix[] = "event";
+
+// HID Generic Desktop usages, so evdev controllers look like their hidraw
+// and Windows counterparts in getInputDevices and device change events.
+constexpr uint16_t kGenericDesktopPage = 0x01;
+constexpr uint16_t kJoystickUsage = 0x04;
+constexpr uint16_t kGamepadUsage = 0x05;
+
+constexpr size_t kBitsPerLong = sizeof(unsigned long) * 8;
+
+template <size_t N>
+using BitWords = unsigned long[(N + kBitsPerLong - 1) / kBitsPerLong];
+
+template <size_t N>
+void CopyBits(const BitWords<N>& words, std::bitset<N>* bits) {
+  for (size_t i = 0; i < N; i++) {
+    if ((words[i / kBitsPerLong] >> (i % kBitsPerLong)) & 1UL) {
+      bits->set(i);
+    }
+  }
+}
+
+// Reads the EVIOCGBIT bitmap of event |type| (0 for the event types).
+template <size_t N>
+bool ReadEventBits(int fd, int type, std::bitset<N>* bits) {
+  BitWords<N> words = {};
+  if (ioctl(fd, EVIOCGBIT(type, sizeof(words)), words) < 0) {
+    return false;
+  }
+  CopyBits<N>(words, bits);
+  return true;
+}
+
+bool ReadCapabilities(int fd, EvdevCapabilities* capabilities) {
+  std::bitset<EV_CNT> types;
+  if (!ReadEventBits(fd, 0, &types) ||
+      (types.test(EV_KEY) &&
+       !ReadEventBits(fd, EV_KEY, &capabilities->keys)) ||
+      (types.test(EV_ABS) &&
+       !ReadEventBits(fd, EV_ABS, &capabilities->axes))) {
+    return false;
+  }
+  // Kernels before 2.6.38 lack EVIOCGPROP; no properties then.
+  BitWords<INPUT_PROP_CNT> properties = {};
+  if (ioctl(fd, EVIOCGPROP(sizeof(properties)), properties) >= 0) {
+    CopyBits<INPUT_PROP_CNT>(properties, &capabilities->properties);
+  }
+  capabilities->has_relative_axes = types.test(EV_REL);
+  return true;
+}
+
+}  // namespace
+
+EvdevGamepadMonitor::EvdevGamepadMonitor(ActivityCallback on_activity)
+    : on_activity_(std::move(on_activity)) {}
+
+EvdevGamepadMonitor::~EvdevGamepadMonitor() {
+  Stop();
+}
+
+bool EvdevGamepadMonitor::Start(const std::string& input_dir) {
+  Stop();
+  input_dir_ = input_dir;
+
+  DeviceReactor::Handlers handlers;
+  // Hotplug is subscribed to before the reactor enumerates, so a controller
+  // plugged in between the two is not missed; AddDevice() skips paths
+  // already open.
+  handlers.on_start = [this]() { EnumerateDevices(); };
+  handlers.on_node_added = [this](const std::string& path) {
+    AddDevice(path, true);
+  };
+  handlers.on_node_removed = [this](const std::string& path) {
+    RemoveDevice(path);
+  };
+  handlers.on_fd_ready = [this](int fd, uint32_t events) {
+    return HandleFd(fd, events);
+  };
+  handlers.on_activity = [this]() { on_activity_(); };
+  if (!reactor_.Start(input_dir_, kEventPrefix, "input",
+                      std::move(handlers))) {
+    return false;
+  }
+  if (reactor_.hotplug_source() == DeviceReactor::HotplugSource::kNone &&
+      debug_) {
+    std::cerr << "[WindowFocus] No controller hotplug source, controllers "
+              << "are only picked up at start" << std::endl;
+  }
+  return true;
+}
+
+void EvdevGamepadMonitor::Stop() {
+  reactor_.Stop();
+
+  for (auto& entry : devices_) {
+    close(entry.first);
+  }
+  devices_.clear();
+  device_count_ = 0;
+  inventory_.Clear();
+}
+
+void EvdevGamepadMonitor::EnumerateDevices() {
+  DIR* dir = opendir(input_dir_.c_str());
+  if (dir == nullptr) {
+    return;
+  }
+  std::vector<std::string> paths;
+  while (dirent* entry = readdir(dir)) {
+    if (reactor_.IsNodeName(entry->d_name)) {
+      paths.push_back(input_dir_ + "/" + entry->d_name);
+    }
+  }
+  closedir(dir);
+  for (const auto& path : paths) {
+    AddDevice(path, false);
+  }
+  if (debug_) {
+    std::cout << "[WindowFocus] Initialized " << devices_.size()
+              << " evdev controllers" << std::endl;
+  }
+}
+
+bool EvdevGamepadMonitor::AddDevice(const std::string& path, bool hotplug) {
+  for (const auto& entry : devices_) {
+    if (entry.second->info.path == path) {
+      return true;
+    }
+  }
+
+  // Most event nodes are keyboards and mice the user cannot open; udev grants
+  // access to joysticks through uaccess.
+  int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+
+  EvdevCapabilities capabilities;
+  if (!ReadCapabilities(fd, &capabilities)) {
+    close(fd);
+    return false;
+  }
+  const EvdevDeviceKind kind = ClassifyEvdevDevice(capabilities);
+  if (kind == EvdevDeviceKind::kOther) {
+    close(fd);
+    return false;
+  }
+
+  auto device = std::make_unique<Device>();
+  device->fd = fd;
+  device->info.path = path;
+  device->info.usage_page = kGenericDesktopPage;
+  device->info.usage =
+      kind == EvdevDeviceKind::kGamepad ? kGamepadUsage : kJoystickUsage;
+  input_id id = {};
+  if (ioctl(fd, EVIOCGID, &id) == 0) {
+    device->info.vendor_id = id.vendor;
+    device->info.product_id = id.product;
+  }
+  char name[256] = {};
+  if (ioctl(fd, EVIOCGNAME(sizeof(name) - 1), name) > 0) {
+    device->info.name = name;
+  }
+
+  device->axes =
+      std::make_unique<EvdevAxisFilter>(kind, axis_deadzone_.load());
+  for (uint16_t code = 0; code < ABS_CNT; code++) {
+    input_absinfo absinfo = {};
+    if (capabilities.axes.test(code) &&
+        ioctl(fd, EVIOCGABS(code), &absinfo) == 0) {
+      device->axes->AddAxis(code, absinfo);
+    }
+  }
+  ApplyAxisSettings(device.get());
+  device->stats = std::make_shared<InputDeviceStats>();
+
+  if (!reactor_.Watch(fd)) {
+    close(fd);
+    return false;
+  }
+
+  if (debug_) {
+    std::cout << "[WindowFocus] Controller added: " << device->info.name
+              << " VID=" << std::hex << device->info.vendor_id
+              << " PID=" << device->info.product_id << std::dec << " ("
+              << path << ", " << device->axes->axis_count() << " axes)"
+              << std::endl;
+  }
+  inventory_.Add(device->info, device->stats);
+  if (hotplug && on_device_change_) {
+    on_device_change_(true, device->info);
+  }
+  devices_[fd] = std::move(device);
+  device_count_ = devices_.size();
+  return true;
+}
+
+void EvdevGamepadMonitor::RemoveDevice(int fd) {
+  auto it = devices_.find(fd);
+  if (it == devices_.end()) {
+    return;
+  }
+  if (debug_) {
+    std::cout << "[WindowFocus] Removed controller " << it->second->info.path
+              << std::endl;
+  }
+  reactor_.Unwatch(fd);
+  close(fd);
+  inventory_.Remove(it->second->info.path);
+  if (on_device_change_) {
+    on_device_change_(false, it->second->info);
+  }
+  devices_.erase(it);
+  device_count_ = devices_.size();
+}
+
+void EvdevGamepadMonitor::RemoveDevice(const std::string& path) {
+  for (const auto& entry : devices_) {
+    if (entry.second->info.path == path) {
+      RemoveDevice(entry.first);
+      return;
+    }
+  }
+}
+
+std::vector<EvdevGamepadMonitor::DeviceInfo> EvdevGamepadMonitor::GetDevices()
+    const {
+  return inventory_.Get();
+}
+
+bool EvdevGamepadMonitor::ReadDevice(Device* device) {
+  EvdevAxisFilter& axes = *device->axes;
+  const double deadzone = axis_deadzone_.load();
+  if (axes.deadzone() != deadzone) {
+    axes.SetDeadzone(deadzone);
+  }
+  if (device->axis_settings_version != axis_settings_version_.load()) {
+    ApplyAxisSettings(device);
+  }
+
+  input_event events[64];
+  bool input_detected = false;
+  while (true) {
+    ssize_t length = read(device->fd, events, sizeof(events));
+    if (length <= 0) {
+      if (length < 0 && errno != EAGAIN && errno != EINTR) {
+        // ENODEV once the controller is unplugged.
+        RemoveDevice(device->fd);
+        return input_detected;
+      }
+      break;
+    }
+    const size_t count = static_cast<size_t>(length) / sizeof(input_event);
+    for (size_t i = 0; i < count; i++) {
+      const input_event& event = events[i];
+      bool is_input = false;
+      if (event.type == EV_KEY) {
+        // Presses and releases; autorepeat (2) adds nothing.
+        is_input = event.value != 2;
+      } else if (event.type == EV_ABS) {
+        is_input = axes.Update(event.code, event.value);
+      }
+      if (is_input) {
+        input_detected = true;
+        device->stats->RecordInput();
+      }
+    }
+  }
+
+  if (input_detected && debug_) {
+    std::cout << "[WindowFocus] Controller " << device->info.path
+              << " input detected" << std::endl;
+  }
+  return input_detected;
+}
+
+void EvdevGamepadMonitor::set_axis_settings(
+    uint16_t code,
+    const EvdevAxisFilter::AxisSettings& settings) {
+  if (code >= ABS_CNT) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(axis_settings_mutex_);
+  axis_settings_[code] = settings;
+  axis_settings_version_++;
+}
+
+void EvdevGamepadMonitor::ApplyAxisSettings(Device* device) {
+  std::lock_guard<std::mutex> lock(axis_settings_mutex_);
+  for (uint16_t code = 0; code < ABS_CNT; code++) {
+    device->axes->SetAxisSettings(code, axis_settings_[code]);
+  }
+  device->axis_settings_version = axis_settings_version_.load();
+}
+
+bool EvdevGamepadMonitor::HandleFd(int fd, uint32_t events) {
+  auto it = devices_.find(fd);
+  if (it == devices_.end()) {
+    return false;  // Removed earlier in this batch.
+  }
+  bool input_detected = false;
+  if ((events & EPOLLIN) != 0) {
+    input_detected = ReadDevice(it->second.get());
+  }
+  if ((events & (EPOLLHUP | EPOLLERR)) != 0) {
+    RemoveDevice(fd);
+  }
+  return input_detected;
+}
+
+}  // namespace window_focus
@@ -0,0 +1,118 @@
+#ifndef FLUTTER_PLUGIN_WINDOW_FOCUS_EVDEV_GAMEPAD_MONITOR_H_
+#define FLUTTER_PLUGIN_WINDOW_FOCUS_EVDEV_GAMEPAD_MONITOR_H_
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "device_reactor.h"
+#include "evdev_gamepad_filter.h"
+#include "input_device_stats.h"
+
+namespace window_focus {
+
+// Linux counterpart of the Windows XInput polling (CheckControllerInput)
+// built on the evdev nodes below /dev/input.
+//
+// Nodes are classified from their capability bits, so any pad, stick, wheel
+// or pedal set the kernel has a driver for is covered, not only the first
+// four XInput slots. Their fds sit in the epoll set of a DeviceReactor,
+// whose thread sleeps until a device has events; there is no polling and
+// nothing is done for slots without a controller. Button presses always
+// count as input, axis motion only once it leaves its deadzone (see
+// EvdevAxisFilter). The reactor also adds and removes controllers as they
+// are plugged in.
+class EvdevGamepadMonitor {
+ public:
+  using DeviceInfo = InputDeviceInfo;
+  using ActivityCallback = std::function<void()>;
+  using DeviceChangeCallback =
+      std::function<void(bool added, const DeviceInfo& info)>;
+
+  // |on_activity| is invoked on the reactor thread.
+  explicit EvdevGamepadMonitor(ActivityCallback on_activity);
+  ~EvdevGamepadMonitor();
+
+  EvdevGamepadMonitor(const EvdevGamepadMonitor&) = delete;
+  EvdevGamepadMonitor& operator=(const EvdevGamepadMonitor&) = delete;
+
+  // Starts the reactor thread, which opens the controllers below
+  // |input_dir| before waiting for events.
+  bool Start(const std::string& input_dir = "/dev/input");
+  void Stop();
+
+  bool is_running() const { return reactor_.is_running(); }
+  size_t device_count() const { return device_count_.load(); }
+
+  void set_debug(bool enabled) { debug_ = enabled; }
+
+  // The connected controllers with their activity counters. Safe to call
+  // from any thread.
+  std::vector<DeviceInfo> GetDevices() const;
+
+  // Deadzone for analog axes as a fraction of their range. Applies to open
+  // devices from their next event.
+  void set_axis_deadzone(double deadzone) { axis_deadzone_ = deadzone; }
+  // Overrides the deadzone and hysteresis of axis |code| (ABS_*) on every
+  // controller, also from their next event.
+  void set_axis_settings(uint16_t code,
+                         const EvdevAxisFilter::AxisSettings& settings);
+
+  // Invoked on the reactor thread when a controller is plugged in or removed
+  // after Start(). Must be set before Start().
+  void set_device_change_callback(DeviceChangeCallback callback) {
+    on_device_change_ = std::move(callback);
+  }
+
+ private:
+  struct Device {
+    int fd = -1;
+    DeviceInfo info;
+    std::unique_ptr<EvdevAxisFilter> axes;
+    // axis_settings_version_ when |axes| last got the overrides.
+    uint32_t axis_settings_version = 0;
+    std::shared_ptr<InputDeviceStats> stats;
+  };
+
+  void EnumerateDevices();
+  // Returns true if the device behind |fd| read user input.
+  bool HandleFd(int fd, uint32_t events);
+
+  bool AddDevice(const std::string& path, bool hotplug);
+  void RemoveDevice(int fd);
+  void RemoveDevice(const std::string& path);
+  // Reads every queued event; returns true if one of them was user input.
+  bool ReadDevice(Device* device);
+  void ApplyAxisSettings(Device* device);
+
+  ActivityCallback on_activity_;
+  DeviceChangeCallback on_device_change_;
+  std::string input_dir_;
+
+  DeviceReactor reactor_{"controller"};
+
+  // Owned by the reactor thread once it runs.
+  std::map<int, std::unique_ptr<Device>> devices_;
+  std::atomic<size_t> device_count_{0};
+
+  // What GetDevices() reports. The stats are shared with the Device entries.
+  DeviceInventory inventory_;
+
+  std::atomic<bool> debug_{false};
+  std::atomic<double> axis_deadzone_{0.0};
+
+  std::mutex axis_settings_mutex_;
+  std::array<EvdevAxisFilter::AxisSettings, ABS_CNT> axis_settings_;
+  // Bumped by set_axis_settings(), so the reactor only takes the mutex when
+  // something changed.
+  std::atomic<uint32_t> axis_settings_version_{0};
+};
+
+}  // namespace window_focus
+
+#endif  // FLUTTER_PLUGIN_WINDOW_FOCUS_EVDEV_GAMEPAD_MONITOR_H_
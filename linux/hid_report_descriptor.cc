@@ -0,0 +1,251 @@
+#include "hid_report_descriptor.h"
+
+namespace window_focus {
+
+namespace {
+
+// Item types and tags from the HID 1.11 specification, section 6.2.2.
+enum ItemType : uint8_t {
+  kItemMain = 0,
+  kItemGlobal = 1,
+  kItemLocal = 2,
+};
+
+enum MainTag : uint8_t {
+  kMainInput = 0x8,
+  kMainCollection = 0xA,
+  kMainEndCollection = 0xC,
+};
+
+enum GlobalTag : uint8_t {
+  kGlobalUsagePage = 0x0,
+  kGlobalLogicalMinimum = 0x1,
+  kGlobalLogicalMaximum = 0x2,
+  kGlobalReportSize = 0x7,
+  kGlobalReportId = 0x8,
+  kGlobalReportCount = 0x9,
+  kGlobalPush = 0xA,
+  kGlobalPop = 0xB,
+};
+
+enum LocalTag : uint8_t {
+  kLocalUsage = 0x0,
+};
+
+// Input item data bits.
+constexpr uint32_t kInputConstant = 1 << 0;
+constexpr uint32_t kInputVariable = 1 << 1;
+constexpr uint32_t kInputRelative = 1 << 2;
+
+constexpr uint8_t kLongItemPrefix = 0xFE;
+
+struct GlobalState {
+  uint16_t usage_page = 0;
+  int32_t logical_min = 0;
+  int32_t logical_max = 0;
+  uint32_t report_size = 0;
+  uint32_t report_count = 0;
+  uint8_t report_id = 0;
+};
+
+HidInputReport* FindOrAddInputReport(HidReportDescriptor* out,
+                                     uint8_t report_id, size_t collection) {
+  for (auto& report : out->input_reports) {
+    if (report.report_id == report_id) {
+      return &report;
+    }
+  }
+  HidInputReport report;
+  report.report_id = report_id;
+  report.collection = collection;
+  out->input_reports.push_back(report);
+  return &out->input_reports.back();
+}
+
+// Short item data is little endian and, for signed fields, sign extended
+// from its encoded size.
+int32_t SignExtend(uint32_t value, size_t item_size) {
+  if (item_size == 1) {
+    return static_cast<int8_t>(value);
+  }
+  if (item_size == 2) {
+    return static_cast<int16_t>(value);
+  }
+  return static_cast<int32_t>(value);
+}
+
+}  // namespace
+
+const HidInputReport* HidReportDescriptor::FindInputReport(
+    uint8_t report_id) const {
+  for (const auto& report : input_reports) {
+    if (report.report_id == report_id) {
+      return &report;
+    }
+  }
+  return nullptr;
+}
+
+bool ParseHidReportDescriptor(const uint8_t* data, size_t size,
+                              HidReportDescriptor* out) {
+  *out = HidReportDescriptor();
+
+  GlobalState global;
+  std::vector<GlobalState> global_stack;
+  // First usage of the pending main item, with its page if it was extended.
+  bool have_usage = false;
+  uint32_t usage = 0;
+  int depth = 0;
+
+  size_t pos = 0;
+  while (pos < size) {
+    const uint8_t prefix = data[pos++];
+
+    if (prefix == kLongItemPrefix) {
+      if (pos + 2 > size) {
+        return false;
+      }
+      pos += 2 + data[pos];
+      continue;
+    }
+
+    const size_t item_size = (prefix & 0x3) == 3 ? 4 : (prefix & 0x3);
+    const uint8_t type = (prefix >> 2) & 0x3;
+    const uint8_t tag = prefix >> 4;
+    if (pos + item_size > size) {
+      return false;
+    }
+    uint32_t value = 0;
+    for (size_t i = 0; i < item_size; i++) {
+      value |= static_cast<uint32_t>(data[pos + i]) << (8 * i);
+    }
+    pos += item_size;
+
+    if (type == kItemGlobal) {
+      switch (tag) {
+        case kGlobalUsagePage:
+          global.usage_page = static_cast<uint16_t>(value);
+          break;
+        case kGlobalLogicalMinimum:
+          global.logical_min = SignExtend(value, item_size);
+          break;
+        case kGlobalLogicalMaximum:
+          global.logical_max = SignExtend(value, item_size);
+          // Many devices encode 0..255 as a one byte 0xFF.
+          if (global.logical_max < global.logical_min) {
+            global.logical_max = static_cast<int32_t>(value);
+          }
+          break;
+        case kGlobalReportSize:
+          global.report_size = value;
+          break;
+        case kGlobalReportId:
+          if (value == 0 || value > 0xFF) {
+            return false;
+          }
+          global.report_id = static_cast<uint8_t>(value);
+          out->uses_report_ids = true;
+          break;
+        case kGlobalReportCount:
+          global.report_count = value;
+          break;
+        case kGlobalPush:
+          global_stack.push_back(global);
+          break;
+        case kGlobalPop:
+          if (global_stack.empty()) {
+            return false;
+          }
+          global = global_stack.back();
+          global_stack.pop_back();
+          break;
+        default:
+          break;
+      }
+    } else if (type == kItemLocal) {
+      if (tag == kLocalUsage && !have_usage) {
+        // A four byte usage carries its own page in the upper half.
+        usage = item_size == 4
+                    ? value
+                    : (static_cast<uint32_t>(global.usage_page) << 16) | value;
+        have_usage = true;
+      }
+    } else if (type == kItemMain) {
+      switch (tag) {
+        case kMainCollection:
+          if (depth == 0) {
+            // Vendor descriptors sometimes open a non-application collection
+            // at the top; treat any top-level collection as the device's.
+            HidTopLevelCollection collection;
+            collection.usage_page = static_cast<uint16_t>(usage >> 16);
+            collection.usage = static_cast<uint16_t>(usage & 0xFFFF);
+            if (!have_usage) {
+              collection.usage_page = global.usage_page;
+            }
+            out->collections.push_back(collection);
+          }
+          depth++;
+          break;
+        case kMainEndCollection:
+          if (depth == 0) {
+            return false;
+          }
+          depth--;
+          break;
+        case kMainInput: {
+          const size_t collection =
+              out->collections.empty() ? 0 : out->collections.size() - 1;
+          HidInputReport* report =
+              FindOrAddInputReport(out, global.report_id, collection);
+          // Buttons have a one bit range; relative axes (mouse deltas,
+          // wheels) report motion, not a position that can jitter.
+          const bool is_axis = (value & kInputConstant) == 0 &&
+                               (value & kInputVariable) != 0 &&
+                               (value & kInputRelative) == 0 &&
+                               global.report_size > 1 &&
+                               global.logical_max - global.logical_min > 1;
+          if (is_axis) {
+            for (uint32_t i = 0; i < global.report_count; i++) {
+              HidAxisField axis;
+              axis.bit_offset = static_cast<uint32_t>(report->bit_length) +
+                                i * global.report_size;
+              axis.bit_size = global.report_size;
+              axis.logical_min = global.logical_min;
+              axis.logical_max = global.logical_max;
+              report->axes.push_back(axis);
+            }
+          }
+          report->bit_length +=
+              static_cast<size_t>(global.report_size) * global.report_count;
+          break;
+        }
+        default:
+          break;
+      }
+      // Local items only apply to the main item that follows them.
+      have_usage = false;
+      usage = 0;
+    }
+  }
+
+  return depth == 0;
+}
+
+bool IsExcludedHidUsage(uint16_t usage_page, uint16_t usage) {
+  return HidExclusionReason(usage_page, usage) != nullptr;
+}
+
+const char* HidExclusionReason(uint16_t usage_page, uint16_t usage) {
+  if (usage_page == 0x0B || usage_page == 0x0C) {
+    return "audio";
+  }
+  if (usage_page == 0x01 && usage == 0x06) {
+    return "keyboard";
+  }
+  if (usage_page == 0x01 && usage == 0x02) {
+    return "mouse";
+  }
+  return nullptr;
+}
+
+}  // namespace window_focus
@@ -0,0 +1,65 @@
+#ifndef FLUTTER_PLUGIN_WINDOW_FOCUS_HID_REPORT_DESCRIPTOR_H_
+#define FLUTTER_PLUGIN_WINDOW_FOCUS_HID_REPORT_DESCRIPTOR_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace window_focus {
+
+// A top-level application collection, the unit Windows exposes as one HID
+// device interface (HIDP_CAPS::UsagePage / Usage).
+struct HidTopLevelCollection {
+  uint16_t usage_page = 0;
+  uint16_t usage = 0;
+};
+
+// An absolute, multi-valued input field such as a stick, trigger or wheel.
+struct HidAxisField {
+  // Position within the report payload, excluding the report ID byte.
+  uint32_t bit_offset = 0;
+  uint32_t bit_size = 0;
+  int32_t logical_min = 0;
+  int32_t logical_max = 0;
+};
+
+// One input report as it appears on the wire.
+struct HidInputReport {
+  uint8_t report_id = 0;
+  // Payload size, excluding the report ID byte.
+  size_t bit_length = 0;
+  // Index into HidReportDescriptor::collections.
+  size_t collection = 0;
+  std::vector<HidAxisField> axes;
+
+  size_t byte_length() const { return (bit_length + 7) / 8; }
+};
+
+// The parts of a HID report descriptor needed to decide which reports count
+// as user input. hidraw exposes every top-level collection of a device on a
+// single node, so the keyboard/mouse/audio exclusions the Windows code applies
+// per interface are applied per input report here.
+struct HidReportDescriptor {
+  std::vector<HidTopLevelCollection> collections;
+  std::vector<HidInputReport> input_reports;
+  bool uses_report_ids = false;
+
+  const HidInputReport* FindInputReport(uint8_t report_id) const;
+};
+
+// Parses a raw report descriptor as returned by HIDIOCGRDESC. Returns false
+// for malformed descriptors.
+bool ParseHidReportDescriptor(const uint8_t* data, size_t size,
+                              HidReportDescriptor* out);
+
+// Same rules as InitializeHIDDevices on Windows: keyboards and mice are
+// covered by the input backends, telephony and consumer controls are audio
+// devices whose reports do not imply a user at the machine.
+bool IsExcludedHidUsage(uint16_t usage_page, uint16_t usage);
+
+// Human readable reason for an exclusion, matching the Windows debug output.
+const char* HidExclusionReason(uint16_t usage_page, uint16_t usage);
+
+}  // namespace window_focus
+
+#endif  // FLUTTER_PLUGIN_WINDOW_FOCUS_HID_REPORT_DESCRIPTOR_H_
@@ -0,0 +1,263 @@
+#include "hid_report_filter.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace window_focus {
+
+constexpr std::chrono::milliseconds HidReportFilter::kCalibrationPeriod;
+constexpr int HidReportFilter::kMinCalibrationReports;
+
+namespace {
+
+// A bit is noise if it toggled in at least a quarter of the calibration
+// reports. Sensors and counters toggle far more often; a button someone
+// happened to press while the device was plugged in does not.
+constexpr int kJitterToggleDivisor = 4;
+
+// Noise learned on an axis never widens its deadzone beyond this fraction of
+// the range, so a wheel turned during calibration stays usable.
+constexpr double kMaxLearnedDeadzone = 0.1;
+
+bool BitFits(const HidAxisField& field, size_t length) {
+  return field.bit_offset + field.bit_size <= length * 8;
+}
+
+}  // namespace
+
+HidReportFilter::HidReportFilter(size_t report_length,
+                                 const std::vector<HidAxisField>& axes,
+                                 double deadzone)
+    : last_report_(report_length, 0),
+      mask_(report_length, 0xFF),
+      deadzone_(deadzone),
+      toggle_counts_(report_length * 8, 0) {
+  for (const auto& field : axes) {
+    if (field.bit_size == 0 || field.bit_size > 32 ||
+        !BitFits(field, report_length)) {
+      continue;
+    }
+    AxisState axis;
+    axis.field = field;
+    UpdateAxisDeadzone(&axis);
+    axes_.push_back(axis);
+
+    for (uint32_t bit = field.bit_offset;
+         bit < field.bit_offset + field.bit_size; bit++) {
+      mask_[bit / 8] &= static_cast<uint8_t>(~(1u << (bit % 8)));
+    }
+  }
+}
+
+bool HidReportFilter::Update(const uint8_t* report,
+                             size_t length,
+                             Clock::time_point now) {
+  length = std::min(length, last_report_.size());
+
+  if (!has_report_) {
+    // Nothing to compare with yet: centred sticks, sensors and battery
+    // levels of a device that was just opened are not input.
+    has_report_ = true;
+    calibration_start_ = now;
+    for (auto& axis : axes_) {
+      if (BitFits(axis.field, length)) {
+        axis.reference = axis.previous =
+            ExtractHidField(report, axis.field.bit_offset,
+                            axis.field.bit_size, axis.field.logical_min < 0);
+      }
+    }
+    std::copy(report, report + length, last_report_.begin());
+    return false;
+  }
+
+  if (calibrating_) {
+    // Every report after the first is a transition to learn from.
+    calibration_reports_++;
+    for (size_t i = 0; i < length; i++) {
+      uint8_t changed = (report[i] ^ last_report_[i]) & mask_[i];
+      while (changed != 0) {
+        int bit = __builtin_ctz(changed);
+        toggle_counts_[i * 8 + bit]++;
+        changed &= static_cast<uint8_t>(changed - 1);
+      }
+    }
+    for (auto& axis : axes_) {
+      if (!BitFits(axis.field, length)) {
+        continue;
+      }
+      int32_t value =
+          ExtractHidField(report, axis.field.bit_offset,
+                          axis.field.bit_size, axis.field.logical_min < 0);
+      if (value != axis.previous) {
+        axis.noise = std::max<int64_t>(
+            axis.noise, std::llabs(static_cast<int64_t>(value) -
+                                   axis.previous));
+        axis.changes++;
+      }
+    }
+    if (now - calibration_start_ >= kCalibrationPeriod) {
+      FinishCalibration();
+    }
+  }
+
+  bool changed = MaskedBytesDiffer(report, last_report_.data(), mask_.data(),
+                                   length);
+
+  for (auto& axis : axes_) {
+    if (!BitFits(axis.field, length)) {
+      continue;
+    }
+    int32_t value = ExtractHidField(report, axis.field.bit_offset,
+                                    axis.field.bit_size,
+                                    axis.field.logical_min < 0);
+    axis.previous = value;
+    if (std::llabs(static_cast<int64_t>(value) - axis.reference) >
+        axis.deadzone) {
+      axis.reference = value;
+      changed = true;
+    }
+  }
+
+  std::copy(report, report + length, last_report_.begin());
+  return changed;
+}
+
+void HidReportFilter::SetDeadzone(double deadzone) {
+  deadzone_ = deadzone;
+  for (auto& axis : axes_) {
+    UpdateAxisDeadzone(&axis);
+  }
+}
+
+void HidReportFilter::FinishCalibration() {
+  calibrating_ = false;
+
+  // A device that stayed quiet has nothing to mask.
+  if (calibration_reports_ >= kMinCalibrationReports) {
+    const int threshold = calibration_reports_ / kJitterToggleDivisor;
+    for (size_t bit = 0; bit < toggle_counts_.size(); bit++) {
+      if (toggle_counts_[bit] > 0 && toggle_counts_[bit] >= threshold) {
+        mask_[bit / 8] &= static_cast<uint8_t>(~(1u << (bit % 8)));
+        jitter_bits_++;
+      }
+    }
+    for (auto& axis : axes_) {
+      if (axis.changes < threshold) {
+        axis.noise = 0;
+      }
+      UpdateAxisDeadzone(&axis);
+    }
+  } else {
+    for (auto& axis : axes_) {
+      axis.noise = 0;
+      UpdateAxisDeadzone(&axis);
+    }
+  }
+
+  std::vector<uint16_t>().swap(toggle_counts_);
+}
+
+void HidReportFilter::UpdateAxisDeadzone(AxisState* axis) const {
+  const double range = static_cast<double>(axis->field.logical_max) -
+                       static_cast<double>(axis->field.logical_min);
+  const int64_t configured = static_cast<int64_t>(range * deadzone_);
+  // Twice the observed step, so noise that wanders both ways stays inside.
+  const int64_t learned =
+      std::min(static_cast<int64_t>(range * kMaxLearnedDeadzone),
+               calibrating_ ? 0 : axis->noise * 2);
+  axis->deadzone = std::max(configured, learned);
+}
+
+HidDeviceReports::HidDeviceReports(const HidReportDescriptor& descriptor,
+                                   double deadzone)
+    : uses_report_ids_(descriptor.uses_report_ids), deadzone_(deadzone) {
+  filter_index_.fill(-1);
+  size_t max_report_length = 0;
+  for (const auto& report : descriptor.input_reports) {
+    const HidTopLevelCollection& collection =
+        descriptor.collections.empty()
+            ? HidTopLevelCollection()
+            : descriptor.collections[report.collection];
+    if (report.bit_length == 0 ||
+        IsExcludedHidUsage(collection.usage_page, collection.usage) ||
+        filter_index_[report.report_id] >= 0) {
+      continue;
+    }
+    filter_index_[report.report_id] = static_cast<int16_t>(filters_.size());
+    filters_.emplace_back(report.byte_length(), report.axes, deadzone);
+    max_report_length = std::max(max_report_length, report.byte_length());
+  }
+  // Room for the report ID prefix when the device uses numbered reports.
+  buffer_.resize(max_report_length + 1);
+}
+
+void HidDeviceReports::SetDeadzone(double deadzone) {
+  deadzone_ = deadzone;
+  for (auto& filter : filters_) {
+    filter.SetDeadzone(deadzone);
+  }
+}
+
+bool MaskedBytesDiffer(const uint8_t* a,
+                       const uint8_t* b,
+                       const uint8_t* mask,
+                       size_t length) {
+  size_t i = 0;
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= length; i += 16) {
+    __m128i diff = _mm_xor_si128(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+    diff = _mm_and_si128(
+        diff, _mm_loadu_si128(reinterpret_cast<const __m128i*>(mask + i)));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(diff, zero)) != 0xFFFF) {
+      return true;
+    }
+  }
+#elif defined(__ARM_NEON)
+  for (; i + 16 <= length; i += 16) {
+    uint8x16_t diff = vandq_u8(veorq_u8(vld1q_u8(a + i), vld1q_u8(b + i)),
+                               vld1q_u8(mask + i));
+#if defined(__aarch64__)
+    if (vmaxvq_u8(diff) != 0) {
+      return true;
+    }
+#else
+    uint64x2_t wide = vreinterpretq_u64_u8(diff);
+    if ((vgetq_lane_u64(wide, 0) | vgetq_lane_u64(wide, 1)) != 0) {
+      return true;
+    }
+#endif
+  }
+#endif
+  for (; i < length; i++) {
+    if (((a[i] ^ b[i]) & mask[i]) != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int32_t ExtractHidField(const uint8_t* report,
+                        uint32_t bit_offset,
+                        uint32_t bit_size,
+                        bool is_signed) {
+  uint32_t value = 0;
+  for (uint32_t i = 0; i < bit_size; i++) {
+    const uint32_t bit = bit_offset + i;
+    value |= static_cast<uint32_t>((report[bit / 8] >> (bit % 8)) & 1) << i;
+  }
+  if (is_signed && bit_size < 32 && (value & (1u << (bit_size - 1))) != 0) {
+    value |= ~((1u << bit_size) - 1);
+  }
+  return static_cast<int32_t>(value);
+}
+
+}  // namespace window_focus
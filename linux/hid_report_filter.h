@@ -0,0 +1,130 @@
+#ifndef FLUTTER_PLUGIN_WINDOW_FOCUS_HID_REPORT_FILTER_H_
+#define FLUTTER_PLUGIN_WINDOW_FOCUS_HID_REPORT_FILTER_H_
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "hid_report_descriptor.h"
+
+namespace window_focus {
+
+// Decides whether consecutive HID input reports differ because of a person.
+//
+// Controllers such as the DualSense stream reports continuously: gyro,
+// accelerometer, battery level and timestamps change in every report while
+// the device sits on a desk. For a short calibration period after the first
+// report the filter counts which bits toggle on their own; frequent togglers
+// are masked out of the comparison afterwards. Analog axes are excluded from
+// the bitwise comparison and checked against a deadzone instead, which
+// covers the noise seen during calibration and the configured fraction of
+// the axis range.
+class HidReportFilter {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr std::chrono::milliseconds kCalibrationPeriod{2000};
+  // Below this many reports there is not enough data to call a bit noisy.
+  static constexpr int kMinCalibrationReports = 8;
+
+  // |deadzone| is a fraction of each axis range, 0 to disable.
+  HidReportFilter(size_t report_length,
+                  const std::vector<HidAxisField>& axes,
+                  double deadzone);
+
+  // Compares |report| with the previous report. Returns true if it changed
+  // in unmasked bits or moved an axis beyond its deadzone. The first report
+  // only sets the baseline and returns false.
+  bool Update(const uint8_t* report, size_t length, Clock::time_point now);
+
+  void SetDeadzone(double deadzone);
+
+  bool calibrating() const { return calibrating_; }
+  // Bits excluded by calibration, for diagnostics.
+  size_t jitter_bits() const { return jitter_bits_; }
+  // 1 bits take part in the bitwise comparison.
+  const std::vector<uint8_t>& mask() const { return mask_; }
+  // In logical units.
+  int64_t axis_deadzone(size_t index) const { return axes_[index].deadzone; }
+
+ private:
+  struct AxisState {
+    HidAxisField field;
+    // Value at the last change that counted as input.
+    int32_t reference = 0;
+    int32_t previous = 0;
+    int64_t deadzone = 0;
+    // Calibration statistics.
+    int64_t noise = 0;
+    int changes = 0;
+  };
+
+  void FinishCalibration();
+  void UpdateAxisDeadzone(AxisState* axis) const;
+
+  std::vector<uint8_t> last_report_;
+  std::vector<uint8_t> mask_;
+  std::vector<AxisState> axes_;
+  double deadzone_;
+
+  bool has_report_ = false;
+  bool calibrating_ = true;
+  Clock::time_point calibration_start_;
+  int calibration_reports_ = 0;
+  // Per-bit toggle counts; released once calibration ends.
+  std::vector<uint16_t> toggle_counts_;
+  size_t jitter_bits_ = 0;
+};
+
+// The input reports of one device: which ones count, their filters and the
+// buffer read() fills. Everything is sized from the descriptor up front and
+// report IDs map to filters through a fixed table, so handling a report never
+// touches the heap.
+class HidDeviceReports {
+ public:
+  // Reports of keyboard, mouse and audio collections are not monitored.
+  HidDeviceReports(const HidReportDescriptor& descriptor, double deadzone);
+
+  // False if no input report of the device is monitored.
+  bool any_accepted() const { return !filters_.empty(); }
+  bool uses_report_ids() const { return uses_report_ids_; }
+
+  // Large enough for the longest input report plus its report ID.
+  uint8_t* buffer() { return buffer_.data(); }
+  size_t buffer_size() const { return buffer_.size(); }
+
+  // The filter of reports with |report_id|, or null if they are ignored.
+  HidReportFilter* filter_for(uint8_t report_id) {
+    const int16_t index = filter_index_[report_id];
+    return index < 0 ? nullptr : &filters_[index];
+  }
+
+  double deadzone() const { return deadzone_; }
+  void SetDeadzone(double deadzone);
+
+ private:
+  bool uses_report_ids_ = false;
+  std::array<int16_t, 256> filter_index_;
+  std::vector<HidReportFilter> filters_;
+  std::vector<uint8_t> buffer_;
+  double deadzone_;
+};
+
+// Returns whether (a ^ b) & mask has any bit set. Uses SSE2 or NEON when
+// available.
+bool MaskedBytesDiffer(const uint8_t* a,
+                       const uint8_t* b,
+                       const uint8_t* mask,
+                       size_t length);
+
+// Reads a little-endian bit field, sign extended when |is_signed|.
+int32_t ExtractHidField(const uint8_t* report,
+                        uint32_t bit_offset,
+                        uint32_t bit_size,
+                        bool is_signed);
+
+}  // namespace window_focus
+
+#endif  // FLUTTER_PLUGIN_WINDOW_FOCUS_HID_REPORT_FILTER_H_
@@ -0,0 +1,489 @@
+#include "hidraw_monitor.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/hidraw.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+namespace window_focus {
+
+namespace {
+
+constexpr char kHidrawPrefix[] = "hidraw";
+
+// Probing is mostly waiting on the kernel, so a few threads are plenty even
+// with dozens of nodes.
+constexpr size_t kMaxProbeWorkers = 4;
+
+bool SignalEventFd(int fd) {
+  uint64_t one = 1;
+  return write(fd, &one, sizeof(one)) == sizeof(one);
+}
+
+}  // namespace
+
+HidrawMonitor::HidrawMonitor(ActivityCallback on_activity)
+    : on_activity_(std::move(on_activity)) {}
+
+HidrawMonitor::~HidrawMonitor() {
+  Stop();
+}
+
+bool HidrawMonitor::Start(const std::string& dev_dir) {
+  Stop();
+  dev_dir_ = dev_dir;
+  stopping_ = false;
+
+  probe_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  DeviceReactor::Handlers handlers;
+  handlers.on_node_added = [this](const std::string& path) {
+    AddDevice(path, true);
+  };
+  handlers.on_node_removed = [this](const std::string& path) {
+    RemoveDevice(path);
+  };
+  handlers.on_fd_ready = [this](int fd, uint32_t events) {
+    return HandleFd(fd, events);
+  };
+  handlers.on_activity = [this]() { on_activity_(); };
+  // Hotplug is subscribed to before enumerating, so a device plugged in
+  // between the two is not missed; InsertDevice() drops paths that are
+  // already open.
+  if (!reactor_.Start(dev_dir_, kHidrawPrefix, "hidraw",
+                      std::move(handlers))) {
+    Stop();
+    return false;
+  }
+  if (probe_fd_ < 0 || !reactor_.Watch(probe_fd_)) {
+    std::cerr << "[WindowFocus] Failed to set up HID probing: "
+              << strerror(errno) << std::endl;
+    Stop();
+    return false;
+  }
+  if (reactor_.hotplug_source() == HotplugSource::kNone && debug_) {
+    std::cerr << "[WindowFocus] No HID hotplug source, devices are only "
+              << "picked up at start" << std::endl;
+  }
+  StartEnumeration();
+  return true;
+}
+
+void HidrawMonitor::Stop() {
+  // Workers finish the node they are probing and exit.
+  stopping_ = true;
+  for (auto& worker : probe_workers_) {
+    worker.join();
+  }
+  probe_workers_.clear();
+  enumeration_paths_.clear();
+
+  reactor_.Stop();
+
+  for (auto& entry : devices_) {
+    close(entry.first);
+  }
+  devices_.clear();
+  device_count_ = 0;
+  inventory_.Clear();
+  for (const auto& device : probed_devices_) {
+    close(device->fd);
+  }
+  probed_devices_.clear();
+
+  if (probe_fd_ >= 0) {
+    close(probe_fd_);
+    probe_fd_ = -1;
+  }
+}
+
+void HidrawMonitor::StartEnumeration() {
+  enumeration_paths_.clear();
+  DIR* dir = opendir(dev_dir_.c_str());
+  if (dir != nullptr) {
+    while (dirent* entry = readdir(dir)) {
+      if (reactor_.IsNodeName(entry->d_name)) {
+        enumeration_paths_.push_back(dev_dir_ + "/" + entry->d_name);
+      }
+    }
+    closedir(dir);
+  }
+
+  enumeration_start_ = std::chrono::steady_clock::now();
+  enumeration_reported_ = false;
+  next_enumeration_path_ = 0;
+  const size_t worker_count = std::min(
+      {enumeration_paths_.size(), kMaxProbeWorkers,
+       static_cast<size_t>(std::max(1u, std::thread::hardware_concurrency()))});
+  active_probe_workers_ = worker_count;
+  if (worker_count == 0) {
+    // Nothing to probe; let the reactor report the empty enumeration.
+    SignalEventFd(probe_fd_);
+    return;
+  }
+  for (size_t i = 0; i < worker_count; i++) {
+    probe_workers_.emplace_back(&HidrawMonitor::ProbeWorker, this);
+  }
+}
+
+void HidrawMonitor::ProbeWorker() {
+  while (!stopping_) {
+    const size_t index = next_enumeration_path_++;
+    if (index >= enumeration_paths_.size()) {
+      break;
+    }
+    std::unique_ptr<Device> device = ProbeDevice(enumeration_paths_[index]);
+    if (device) {
+      {
+        std::lock_guard<std::mutex> lock(probed_devices_mutex_);
+        probed_devices_.push_back(std::move(device));
+      }
+      SignalEventFd(probe_fd_);
+    }
+  }
+  if (--active_probe_workers_ == 0) {
+    SignalEventFd(probe_fd_);
+  }
+}
+
+void HidrawMonitor::CollectProbedDevices() {
+  uint64_t count = 0;
+  if (read(probe_fd_, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+    return;
+  }
+
+  // Read before taking the queue: once the workers are done, everything they
+  // found is already in it.
+  const bool done = active_probe_workers_ == 0;
+  std::vector<std::unique_ptr<Device>> probed;
+  {
+    std::lock_guard<std::mutex> lock(probed_devices_mutex_);
+    probed.swap(probed_devices_);
+  }
+  for (auto& device : probed) {
+    InsertDevice(std::move(device), false);
+  }
+
+  if (done && !enumeration_reported_) {
+    enumeration_reported_ = true;
+    if (debug_) {
+      const auto elapsed =
+          std::chrono::duration_cast<std::chrono::milliseconds>(
+              std::chrono::steady_clock::now() - enumeration_start_);
+      std::cout << "[WindowFocus] Initialized " << devices_.size()
+                << " HID devices in " << elapsed.count() << " ms"
+                << std::endl;
+    }
+  }
+}
+
+bool HidrawMonitor::AddDevice(const std::string& path, bool hotplug) {
+  const auto arrival = std::chrono::steady_clock::now();
+  for (const auto& entry : devices_) {
+    if (entry.second->path == path) {
+      return true;
+    }
+  }
+
+  std::unique_ptr<Device> device = ProbeDevice(path);
+  if (!device) {
+    return false;
+  }
+  if (hotplug) {
+    device->arrival = arrival;
+  }
+  return InsertDevice(std::move(device), hotplug);
+}
+
+std::unique_ptr<HidrawMonitor::Device> HidrawMonitor::ProbeDevice(
+    const std::string& path) {
+  const auto probe_start = std::chrono::steady_clock::now();
+  int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0) {
+    // Most hidraw nodes are root-only unless a udev rule grants access.
+    if (debug_) {
+      std::cout << "[WindowFocus] Cannot open HID device " << path << ": "
+                << strerror(errno) << std::endl;
+    }
+    return nullptr;
+  }
+
+  auto device = std::make_unique<Device>();
+  device->fd = fd;
+  device->path = path;
+
+  hidraw_devinfo info = {};
+  int descriptor_size = 0;
+  if (ioctl(fd, HIDIOCGRAWINFO, &info) < 0 ||
+      ioctl(fd, HIDIOCGRDESCSIZE, &descriptor_size) < 0 ||
+      descriptor_size <= 0 || descriptor_size > HID_MAX_DESCRIPTOR_SIZE) {
+    close(fd);
+    return nullptr;
+  }
+  device->vendor_id = static_cast<uint16_t>(info.vendor);
+  device->product_id = static_cast<uint16_t>(info.product);
+  device->stats = std::make_shared<InputDeviceStats>();
+  char name[256] = {};
+  if (ioctl(fd, HIDIOCGRAWNAME(sizeof(name) - 1), name) > 0) {
+    device->name = name;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(descriptor_cache_mutex_);
+    auto cached = descriptor_cache_.find(path);
+    device->descriptor_cached =
+        cached != descriptor_cache_.end() &&
+        cached->second.descriptor_size == descriptor_size &&
+        cached->second.bus_type == info.bustype &&
+        cached->second.vendor_id == device->vendor_id &&
+        cached->second.product_id == device->product_id;
+    if (device->descriptor_cached) {
+      device->descriptor = cached->second.descriptor;
+    }
+  }
+  if (!device->descriptor_cached) {
+    hidraw_report_descriptor raw_descriptor = {};
+    raw_descriptor.size = static_cast<uint32_t>(descriptor_size);
+    if (ioctl(fd, HIDIOCGRDESC, &raw_descriptor) < 0 ||
+        !ParseHidReportDescriptor(raw_descriptor.value, raw_descriptor.size,
+                                  &device->descriptor)) {
+      if (debug_) {
+        std::cerr << "[WindowFocus] Unreadable report descriptor: " << path
+                  << std::endl;
+      }
+      std::lock_guard<std::mutex> lock(descriptor_cache_mutex_);
+      descriptor_cache_.erase(path);
+      close(fd);
+      return nullptr;
+    }
+    CachedDescriptor entry;
+    entry.bus_type = info.bustype;
+    entry.vendor_id = device->vendor_id;
+    entry.product_id = device->product_id;
+    entry.descriptor_size = descriptor_size;
+    entry.descriptor = device->descriptor;
+    std::lock_guard<std::mutex> lock(descriptor_cache_mutex_);
+    descriptor_cache_[path] = std::move(entry);
+  }
+
+  const HidReportDescriptor& descriptor = device->descriptor;
+  device->reports = std::make_unique<HidDeviceReports>(
+      descriptor, axis_deadzone_.load());
+
+  if (!device->reports->any_accepted()) {
+    if (debug_) {
+      const HidTopLevelCollection primary =
+          descriptor.collections.empty() ? HidTopLevelCollection()
+                                         : descriptor.collections.front();
+      const char* reason =
+          HidExclusionReason(primary.usage_page, primary.usage);
+      std::cout << "[WindowFocus] Skipping HID device ("
+                << (reason != nullptr ? reason : "no input") << "): VID="
+                << std::hex << device->vendor_id
+                << " PID=" << device->product_id
+                << " UsagePage=0x" << primary.usage_page
+                << " Usage=0x" << primary.usage << std::dec << std::endl;
+    }
+    close(fd);
+    return nullptr;
+  }
+
+  device->probe_time = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - probe_start);
+  return device;
+}
+
+void HidrawMonitor::AdoptDevice(int fd,
+                                const std::string& path,
+                                const HidReportDescriptor& descriptor) {
+  // ReadDevice() drains the fd until it would block.
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  auto device = std::make_unique<Device>();
+  device->fd = fd;
+  device->path = path;
+  device->descriptor = descriptor;
+  device->stats = std::make_shared<InputDeviceStats>();
+  device->reports =
+      std::make_unique<HidDeviceReports>(descriptor, axis_deadzone_.load());
+  // The reactor takes it like a device found by the probe workers.
+  {
+    std::lock_guard<std::mutex> lock(probed_devices_mutex_);
+    probed_devices_.push_back(std::move(device));
+  }
+  SignalEventFd(probe_fd_);
+}
+
+bool HidrawMonitor::InsertDevice(std::unique_ptr<Device> device,
+                                 bool hotplug) {
+  // Hotplug and enumeration can both find a node that appears at Start().
+  for (const auto& entry : devices_) {
+    if (entry.second->path == device->path) {
+      close(device->fd);
+      return true;
+    }
+  }
+
+  const int fd = device->fd;
+  if (!reactor_.Watch(fd)) {
+    close(fd);
+    return false;
+  }
+
+  if (debug_) {
+    const DeviceInfo info = GetDeviceInfo(*device);
+    std::cout << "[WindowFocus] HID device added: VID=" << std::hex
+              << info.vendor_id << " PID=" << info.product_id << std::dec
+              << " UsagePage=0x" << std::hex << info.usage_page
+              << " Usage=0x" << info.usage << std::dec << " (" << info.path
+              << (device->descriptor_cached ? ", cached" : "")
+              << ", probed in " << device->probe_time.count() << " us)"
+              << std::endl;
+  }
+
+  inventory_.Add(GetDeviceInfo(*device), device->stats);
+  if (hotplug && on_device_change_) {
+    on_device_change_(true, GetDeviceInfo(*device));
+  }
+  devices_[fd] = std::move(device);
+  device_count_ = devices_.size();
+  return true;
+}
+
+void HidrawMonitor::RemoveDevice(int fd) {
+  auto it = devices_.find(fd);
+  if (it == devices_.end()) {
+    return;
+  }
+  if (debug_) {
+    std::cout << "[WindowFocus] Removed HID device " << it->second->path
+              << std::endl;
+  }
+  reactor_.Unwatch(fd);
+  close(fd);
+  inventory_.Remove(it->second->path);
+  if (on_device_change_) {
+    on_device_change_(false, GetDeviceInfo(*it->second));
+  }
+  devices_.erase(it);
+  device_count_ = devices_.size();
+}
+
+HidrawMonitor::DeviceInfo HidrawMonitor::GetDeviceInfo(
+    const Device& device) const {
+  DeviceInfo info;
+  info.path = device.path;
+  info.name = device.name;
+  info.vendor_id = device.vendor_id;
+  info.product_id = device.product_id;
+  if (!device.descriptor.collections.empty()) {
+    info.usage_page = device.descriptor.collections.front().usage_page;
+    info.usage = device.descriptor.collections.front().usage;
+  }
+  return info;
+}
+
+std::vector<HidrawMonitor::DeviceInfo> HidrawMonitor::GetDevices() const {
+  return inventory_.Get();
+}
+
+void HidrawMonitor::RemoveDevice(const std::string& path) {
+  for (const auto& entry : devices_) {
+    if (entry.second->path == path) {
+      RemoveDevice(entry.first);
+      return;
+    }
+  }
+}
+
+bool HidrawMonitor::ReadDevice(Device* device) {
+  HidDeviceReports& reports = *device->reports;
+  const auto now = std::chrono::steady_clock::now();
+  const double deadzone = axis_deadzone_.load();
+  bool input_detected = false;
+
+  if (reports.deadzone() != deadzone) {
+    reports.SetDeadzone(deadzone);
+  }
+
+  while (true) {
+    ssize_t length = read(device->fd, reports.buffer(), reports.buffer_size());
+    if (length <= 0) {
+      if (length < 0 && errno != EAGAIN && errno != EINTR) {
+        // ENODEV once the device is unplugged.
+        RemoveDevice(device->fd);
+      }
+      return input_detected;
+    }
+
+    const uint8_t* payload = reports.buffer();
+    size_t payload_length = static_cast<size_t>(length);
+    uint8_t report_id = 0;
+    if (reports.uses_report_ids()) {
+      report_id = payload[0];
+      payload++;
+      payload_length--;
+    }
+
+    HidReportFilter* filter = reports.filter_for(report_id);
+    if (filter == nullptr) {
+      continue;
+    }
+    const bool was_calibrating = filter->calibrating();
+    if (filter->Update(payload, payload_length, now)) {
+      input_detected = true;
+      device->stats->RecordInput();
+      if (debug_) {
+        std::cout << "[WindowFocus] HID device " << device->path
+                  << " input detected" << std::endl;
+      }
+      // Only reached for input, so the latency ends at a person's first
+      // action rather than the device's first report.
+      if (device->arrival != std::chrono::steady_clock::time_point()) {
+        if (debug_) {
+          const auto latency =
+              std::chrono::duration_cast<std::chrono::milliseconds>(
+                  now - device->arrival);
+          std::cout << "[WindowFocus] HID device " << device->path
+                    << " first input detected " << latency.count()
+                    << " ms after arrival" << std::endl;
+        }
+        device->arrival = std::chrono::steady_clock::time_point();
+      }
+    }
+    if (was_calibrating && !filter->calibrating() && debug_) {
+      std::cout << "[WindowFocus] HID device " << device->path
+                << " calibrated: " << filter->jitter_bits()
+                << " jittering bits ignored in report "
+                << static_cast<int>(report_id) << std::endl;
+    }
+  }
+}
+
+bool HidrawMonitor::HandleFd(int fd, uint32_t events) {
+  if (fd == probe_fd_) {
+    CollectProbedDevices();
+    return false;
+  }
+  auto it = devices_.find(fd);
+  if (it == devices_.end()) {
+    return false;  // Removed earlier in this batch.
+  }
+  bool input_detected = false;
+  if ((events & EPOLLIN) != 0) {
+    input_detected = ReadDevice(it->second.get());
+  }
+  if ((events & (EPOLLHUP | EPOLLERR)) != 0) {
+    RemoveDevice(fd);
+  }
+  return input_detected;
+}
+
+}  // namespace window_focus
@@ -0,0 +1,172 @@
+#ifndef FLUTTER_PLUGIN_WINDOW_FOCUS_HIDRAW_MONITOR_H_
+#define FLUTTER_PLUGIN_WINDOW_FOCUS_HIDRAW_MONITOR_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "device_reactor.h"
+#include "hid_report_descriptor.h"
+#include "hid_report_filter.h"
+#include "input_device_stats.h"
+
+namespace window_focus {
+
+// Linux counterpart of the Windows HID polling (InitializeHIDDevices /
+// CheckHIDDevices) built on /dev/hidraw*.
+//
+// Devices are opened once, their report descriptors decide which input
+// reports count (keyboard, mouse and audio collections are excluded as on
+// Windows), and every fd sits in the epoll set of a DeviceReactor, so
+// nothing runs until a device actually sends a report. The devices present
+// at Start() are probed by a few worker threads and join the epoll set as
+// each one is validated, so Start() itself does not wait for them. Hotplug
+// comes from the reactor: udev when its daemon runs, inotify on /dev
+// otherwise.
+class HidrawMonitor {
+ public:
+  using DeviceInfo = InputDeviceInfo;
+  using ActivityCallback = std::function<void()>;
+  using DeviceChangeCallback =
+      std::function<void(bool added, const DeviceInfo& info)>;
+
+  using HotplugSource = DeviceReactor::HotplugSource;
+
+  // |on_activity| is invoked on the reactor thread.
+  explicit HidrawMonitor(ActivityCallback on_activity);
+  ~HidrawMonitor();
+
+  HidrawMonitor(const HidrawMonitor&) = delete;
+  HidrawMonitor& operator=(const HidrawMonitor&) = delete;
+
+  // Starts the reactor thread and begins probing the devices below
+  // |dev_dir| in the background.
+  bool Start(const std::string& dev_dir = "/dev");
+  void Stop();
+
+  bool is_running() const { return reactor_.is_running(); }
+  size_t device_count() const { return device_count_.load(); }
+  // Where hotplug events come from, decided by Start().
+  HotplugSource hotplug_source() const { return reactor_.hotplug_source(); }
+
+  // Monitors |fd| as the device at |path| whose reports |descriptor|
+  // describes, for nodes opened elsewhere, such as a test's socket. Takes
+  // ownership of |fd|. Safe to call from any thread while running.
+  void AdoptDevice(int fd,
+                   const std::string& path,
+                   const HidReportDescriptor& descriptor);
+
+  void set_debug(bool enabled) { debug_ = enabled; }
+
+  // The monitored devices with their activity counters. Safe to call from
+  // any thread.
+  std::vector<DeviceInfo> GetDevices() const;
+
+  // Deadzone for analog axes as a fraction of their range. Applies to open
+  // devices from their next report.
+  void set_axis_deadzone(double deadzone) { axis_deadzone_ = deadzone; }
+
+  // Invoked on the reactor thread when a monitored device is plugged in or
+  // removed after Start(). Must be set before Start().
+  void set_device_change_callback(DeviceChangeCallback callback) {
+    on_device_change_ = std::move(callback);
+  }
+
+ private:
+  // Parsed descriptor of a node, kept after it disappears so a reconnect
+  // under the same path skips HIDIOCGRDESC and parsing. hidraw minors are
+  // reused, so the identity fields are checked before an entry is trusted.
+  struct CachedDescriptor {
+    uint32_t bus_type = 0;
+    uint16_t vendor_id = 0;
+    uint16_t product_id = 0;
+    int descriptor_size = 0;
+    HidReportDescriptor descriptor;
+  };
+
+  struct Device {
+    int fd = -1;
+    std::string path;
+    std::string name;
+    uint16_t vendor_id = 0;
+    uint16_t product_id = 0;
+    HidReportDescriptor descriptor;
+    std::shared_ptr<InputDeviceStats> stats;
+    // Set for hotplugged devices until their first input is detected: a
+    // report the filter counts, not the baseline report every device sends
+    // once it is opened.
+    std::chrono::steady_clock::time_point arrival;
+    // Time spent opening the node and reading its descriptor.
+    std::chrono::microseconds probe_time{0};
+    bool descriptor_cached = false;
+    std::unique_ptr<HidDeviceReports> reports;
+  };
+
+  // Handles a device fd or probe_fd_ being ready; returns true if a device
+  // read user input.
+  bool HandleFd(int fd, uint32_t events);
+  // Lists the nodes below dev_dir_ and starts the probe workers.
+  void StartEnumeration();
+  void ProbeWorker();
+  // Moves devices validated by the probe workers into the epoll set.
+  void CollectProbedDevices();
+
+  // Opens and validates |path|. Returns null if it is not monitored. Safe to
+  // call from the probe workers.
+  std::unique_ptr<Device> ProbeDevice(const std::string& path);
+  // Adds a probed device to the epoll set. |hotplug| marks devices that
+  // arrived after Start().
+  bool InsertDevice(std::unique_ptr<Device> device, bool hotplug);
+  bool AddDevice(const std::string& path, bool hotplug);
+  void RemoveDevice(int fd);
+  void RemoveDevice(const std::string& path);
+  // Reads every queued report; returns true if one of them was user input.
+  bool ReadDevice(Device* device);
+
+  DeviceInfo GetDeviceInfo(const Device& device) const;
+
+  ActivityCallback on_activity_;
+  DeviceChangeCallback on_device_change_;
+  std::string dev_dir_;
+
+  DeviceReactor reactor_{"HID"};
+
+  // Owned by the reactor thread once it runs.
+  std::map<int, std::unique_ptr<Device>> devices_;
+  std::atomic<size_t> device_count_{0};
+
+  // What GetDevices() reports; updated by the reactor as devices come and
+  // go. The stats are shared with the Device entries.
+  DeviceInventory inventory_;
+
+  // Shared with the probe workers.
+  std::mutex descriptor_cache_mutex_;
+  std::map<std::string, CachedDescriptor> descriptor_cache_;
+
+  // Enumeration at Start(). Workers take paths by index and hand validated
+  // devices to the reactor through probed_devices_, signalling probe_fd_.
+  std::vector<std::string> enumeration_paths_;
+  std::atomic<size_t> next_enumeration_path_{0};
+  std::atomic<size_t> active_probe_workers_{0};
+  std::chrono::steady_clock::time_point enumeration_start_;
+  bool enumeration_reported_ = false;
+  std::vector<std::thread> probe_workers_;
+  std::mutex probed_devices_mutex_;
+  std::vector<std::unique_ptr<Device>> probed_devices_;
+  int probe_fd_ = -1;
+  std::atomic<bool> stopping_{false};
+
+  std::atomic<bool> debug_{false};
+  std::atomic<double> axis_deadzone_{0.0};
+};
+
+}  // namespace window_focus
+
+#endif  // FLUTTER_PLUGIN_WINDOW_FOCUS_HIDRAW_MONITOR_H_
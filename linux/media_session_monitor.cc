@@ -0,0 +1,408 @@
+#include "media_session_monitor.h"
+
+#include <iostream>
+#include <memory>
+#include <utility>
+
+namespace window_focus {
+
+constexpr guint32 MediaSessionMonitor::kInhibitIdle;
+
+namespace {
+
+constexpr char kBusName[] = "org.freedesktop.DBus";
+constexpr char kBusPath[] = "/org/freedesktop/DBus";
+constexpr char kPropertiesInterface[] = "org.freedesktop.DBus.Properties";
+
+constexpr char kMprisPrefix[] = "org.mpris.MediaPlayer2";
+constexpr char kMprisPath[] = "/org/mpris/MediaPlayer2";
+constexpr char kMprisPlayerInterface[] = "org.mpris.MediaPlayer2.Player";
+
+constexpr char kSessionManagerName[] = "org.gnome.SessionManager";
+constexpr char kSessionManagerPath[] = "/org/gnome/SessionManager";
+
+constexpr char kPowerManagementName[] = "org.freedesktop.PowerManagement";
+constexpr char kPowerManagementPath[] =
+    "/org/freedesktop/PowerManagement/Inhibit";
+constexpr char kPowerManagementInterface[] =
+    "org.freedesktop.PowerManagement.Inhibit";
+
+constexpr int kCallTimeoutMs = 5000;
+
+// org.mpris.MediaPlayer2.<player>[.<instance>]
+bool IsPlayerName(const gchar* name) {
+  return g_str_has_prefix(name, kMprisPrefix) &&
+         name[sizeof(kMprisPrefix) - 1] == '.';
+}
+
+}  // namespace
+
+// static
+GVariant* MediaSessionMonitor::FinishCall(GObject* source,
+                                          GAsyncResult* result,
+                                          const PendingCall& call) {
+  g_autoptr(GError) error = nullptr;
+  GVariant* reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source),
+                                                  result, &error);
+  if (reply == nullptr &&
+      !g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED) &&
+      call.monitor->debug_) {
+    // Mostly services that this desktop does not run.
+    std::cout << "[WindowFocus] D-Bus query for " << call.key
+              << " failed: " << error->message << std::endl;
+  }
+  return reply;
+}
+
+MediaSessionMonitor::MediaSessionMonitor(ChangeCallback on_change)
+    : on_change_(std::move(on_change)) {}
+
+MediaSessionMonitor::~MediaSessionMonitor() {
+  Stop();
+}
+
+bool MediaSessionMonitor::Start(GDBusConnection* connection) {
+  Stop();
+
+  if (connection != nullptr) {
+    connection_ = G_DBUS_CONNECTION(g_object_ref(connection));
+  } else {
+    g_autoptr(GError) error = nullptr;
+    connection_ = g_bus_get_sync(G_BUS_TYPE_SESSION, nullptr, &error);
+    if (connection_ == nullptr) {
+      std::cerr << "[WindowFocus] No D-Bus session bus: " << error->message
+                << std::endl;
+      return false;
+    }
+  }
+  cancellable_ = g_cancellable_new();
+
+  // Subscribing before the initial queries means no change is missed.
+  Subscribe(kBusName, kBusName, "NameOwnerChanged", kBusPath, kMprisPrefix,
+            G_DBUS_SIGNAL_FLAGS_MATCH_ARG0_NAMESPACE, OnNameOwnerChanged);
+  Subscribe(nullptr, kPropertiesInterface, "PropertiesChanged", kMprisPath,
+            kMprisPlayerInterface, G_DBUS_SIGNAL_FLAGS_NONE,
+            OnPlayerPropertiesChanged);
+  Subscribe(kSessionManagerName, kPropertiesInterface, "PropertiesChanged",
+            kSessionManagerPath, kSessionManagerName, G_DBUS_SIGNAL_FLAGS_NONE,
+            OnSessionPropertiesChanged);
+  Subscribe(kPowerManagementName, kPowerManagementInterface,
+            "HasInhibitChanged", kPowerManagementPath, nullptr,
+            G_DBUS_SIGNAL_FLAGS_NONE, OnHasInhibitChanged);
+
+  Call(kBusName, kBusPath, kBusName, "ListNames", nullptr,
+       G_VARIANT_TYPE("(as)"), OnListNames, kBusName);
+  Call(kSessionManagerName, kSessionManagerPath, kPropertiesInterface, "Get",
+       g_variant_new("(ss)", kSessionManagerName, "InhibitedActions"),
+       G_VARIANT_TYPE("(v)"), OnInhibitedActions, kSessionManagerName);
+  Call(kPowerManagementName, kPowerManagementPath, kPowerManagementInterface,
+       "HasInhibit", nullptr, G_VARIANT_TYPE("(b)"), OnHasInhibit,
+       kPowerManagementName);
+  return true;
+}
+
+void MediaSessionMonitor::Stop() {
+  if (connection_ == nullptr) {
+    return;
+  }
+  // Replies still in flight are delivered as cancelled and dropped.
+  g_cancellable_cancel(cancellable_);
+  g_clear_object(&cancellable_);
+  for (guint id : subscriptions_) {
+    g_dbus_connection_signal_unsubscribe(connection_, id);
+  }
+  subscriptions_.clear();
+  g_clear_object(&connection_);
+
+  players_.clear();
+  session_inhibited_ = false;
+  power_inhibited_ = false;
+  active_ = false;
+}
+
+std::vector<std::string> MediaSessionMonitor::GetPlayingPlayers() const {
+  std::vector<std::string> playing;
+  for (const auto& entry : players_) {
+    if (entry.second.playing) {
+      playing.push_back(entry.second.name);
+    }
+  }
+  return playing;
+}
+
+void MediaSessionMonitor::set_ignored_players(std::vector<std::string> names) {
+  ignored_players_ = std::move(names);
+  Update();
+}
+
+void MediaSessionMonitor::Call(const gchar* bus_name,
+                               const gchar* path,
+                               const gchar* interface,
+                               const gchar* method,
+                               GVariant* parameters,
+                               const GVariantType* reply_type,
+                               GAsyncReadyCallback callback,
+                               const std::string& key) {
+  g_dbus_connection_call(connection_, bus_name, path, interface, method,
+                         parameters, reply_type, G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                         kCallTimeoutMs, cancellable_, callback,
+                         new PendingCall{this, key});
+}
+
+void MediaSessionMonitor::Subscribe(const gchar* sender,
+                                    const gchar* interface,
+                                    const gchar* member,
+                                    const gchar* path,
+                                    const gchar* arg0,
+                                    GDBusSignalFlags flags,
+                                    GDBusSignalCallback callback) {
+  subscriptions_.push_back(g_dbus_connection_signal_subscribe(
+      connection_, sender, interface, member, path, arg0, flags, callback,
+      this, nullptr));
+}
+
+// static
+void MediaSessionMonitor::OnNameOwnerChanged(GDBusConnection* connection,
+                                             const gchar* sender,
+                                             const gchar* path,
+                                             const gchar* interface,
+                                             const gchar* signal,
+                                             GVariant* parameters,
+                                             gpointer user_data) {
+  MediaSessionMonitor* self = static_cast<MediaSessionMonitor*>(user_data);
+  const gchar* name = nullptr;
+  const gchar* old_owner = nullptr;
+  const gchar* new_owner = nullptr;
+  g_variant_get(parameters, "(&s&s&s)", &name, &old_owner, &new_owner);
+  if (!IsPlayerName(name)) {
+    return;
+  }
+
+  auto it = self->players_.find(old_owner);
+  if (old_owner[0] != '\0' && it != self->players_.end() &&
+      it->second.name == name) {
+    if (self->debug_) {
+      std::cout << "[WindowFocus] Media player " << name << " left"
+                << std::endl;
+    }
+    self->players_.erase(it);
+    self->Update();
+  }
+  if (new_owner[0] != '\0') {
+    self->AddPlayer(name, new_owner);
+  }
+}
+
+// static
+void MediaSessionMonitor::OnPlayerPropertiesChanged(GDBusConnection* connection,
+                                                    const gchar* sender,
+                                                    const gchar* path,
+                                                    const gchar* interface,
+                                                    const gchar* signal,
+                                                    GVariant* parameters,
+                                                    gpointer user_data) {
+  MediaSessionMonitor* self = static_cast<MediaSessionMonitor*>(user_data);
+  if (sender == nullptr || self->players_.count(sender) == 0) {
+    return;
+  }
+  g_autoptr(GVariant) changed = nullptr;
+  g_autofree const gchar** invalidated = nullptr;
+  g_variant_get(parameters, "(&s@a{sv}^a&s)", nullptr, &changed,
+                &invalidated);
+
+  const gchar* status = nullptr;
+  if (g_variant_lookup(changed, "PlaybackStatus", "&s", &status)) {
+    self->SetPlaying(sender, status);
+    return;
+  }
+  for (const gchar** name = invalidated; *name != nullptr; name++) {
+    if (g_strcmp0(*name, "PlaybackStatus") == 0) {
+      self->Call(sender, kMprisPath, kPropertiesInterface, "Get",
+                 g_variant_new("(ss)", kMprisPlayerInterface, "PlaybackStatus"),
+                 G_VARIANT_TYPE("(v)"), OnPlaybackStatus, sender);
+    }
+  }
+}
+
+// static
+void MediaSessionMonitor::OnSessionPropertiesChanged(
+    GDBusConnection* connection,
+    const gchar* sender,
+    const gchar* path,
+    const gchar* interface,
+    const gchar* signal,
+    GVariant* parameters,
+    gpointer user_data) {
+  MediaSessionMonitor* self = static_cast<MediaSessionMonitor*>(user_data);
+  g_autoptr(GVariant) changed = nullptr;
+  g_variant_get(parameters, "(&s@a{sv}@as)", nullptr, &changed, nullptr);
+  guint32 actions = 0;
+  if (g_variant_lookup(changed, "InhibitedActions", "u", &actions)) {
+    self->session_inhibited_ = (actions & kInhibitIdle) != 0;
+    self->Update();
+  }
+}
+
+// static
+void MediaSessionMonitor::OnHasInhibitChanged(GDBusConnection* connection,
+                                              const gchar* sender,
+                                              const gchar* path,
+                                              const gchar* interface,
+                                              const gchar* signal,
+                                              GVariant* parameters,
+                                              gpointer user_data) {
+  MediaSessionMonitor* self = static_cast<MediaSessionMonitor*>(user_data);
+  gboolean inhibited = FALSE;
+  g_variant_get(parameters, "(b)", &inhibited);
+  self->power_inhibited_ = inhibited;
+  self->Update();
+}
+
+// static
+void MediaSessionMonitor::OnListNames(GObject* source,
+                                      GAsyncResult* result,
+                                      gpointer user_data) {
+  std::unique_ptr<PendingCall> call(static_cast<PendingCall*>(user_data));
+  g_autoptr(GVariant) reply = FinishCall(source, result, *call);
+  if (reply == nullptr) {
+    return;
+  }
+  MediaSessionMonitor* self = call->monitor;
+  g_autoptr(GVariantIter) names = nullptr;
+  g_variant_get(reply, "(as)", &names);
+  const gchar* name = nullptr;
+  while (g_variant_iter_loop(names, "&s", &name)) {
+    if (IsPlayerName(name)) {
+      self->Call(kBusName, kBusPath, kBusName, "GetNameOwner",
+                 g_variant_new("(s)", name), G_VARIANT_TYPE("(s)"),
+                 OnNameOwner, name);
+    }
+  }
+}
+
+// static
+void MediaSessionMonitor::OnNameOwner(GObject* source,
+                                      GAsyncResult* result,
+                                      gpointer user_data) {
+  std::unique_ptr<PendingCall> call(static_cast<PendingCall*>(user_data));
+  g_autoptr(GVariant) reply = FinishCall(source, result, *call);
+  if (reply == nullptr) {
+    return;
+  }
+  MediaSessionMonitor* self = call->monitor;
+  const gchar* owner = nullptr;
+  g_variant_get(reply, "(&s)", &owner);
+  self->AddPlayer(call->key, owner);
+}
+
+// static
+void MediaSessionMonitor::OnPlaybackStatus(GObject* source,
+                                           GAsyncResult* result,
+                                           gpointer user_data) {
+  std::unique_ptr<PendingCall> call(static_cast<PendingCall*>(user_data));
+  g_autoptr(GVariant) reply = FinishCall(source, result, *call);
+  if (reply == nullptr) {
+    return;
+  }
+  MediaSessionMonitor* self = call->monitor;
+  g_autoptr(GVariant) value = nullptr;
+  g_variant_get(reply, "(v)", &value);
+  if (g_variant_is_of_type(value, G_VARIANT_TYPE_STRING)) {
+    self->SetPlaying(call->key, g_variant_get_string(value, nullptr));
+  }
+}
+
+// static
+void MediaSessionMonitor::OnInhibitedActions(GObject* source,
+                                             GAsyncResult* result,
+                                             gpointer user_data) {
+  std::unique_ptr<PendingCall> call(static_cast<PendingCall*>(user_data));
+  g_autoptr(GVariant) reply = FinishCall(source, result, *call);
+  if (reply == nullptr) {
+    return;
+  }
+  MediaSessionMonitor* self = call->monitor;
+  g_autoptr(GVariant) value = nullptr;
+  g_variant_get(reply, "(v)", &value);
+  if (g_variant_is_of_type(value, G_VARIANT_TYPE_UINT32)) {
+    self->session_inhibited_ =
+        (g_variant_get_uint32(value) & kInhibitIdle) != 0;
+    self->Update();
+  }
+}
+
+// static
+void MediaSessionMonitor::OnHasInhibit(GObject* source,
+                                       GAsyncResult* result,
+                                       gpointer user_data) {
+  std::unique_ptr<PendingCall> call(static_cast<PendingCall*>(user_data));
+  g_autoptr(GVariant) reply = FinishCall(source, result, *call);
+  if (reply == nullptr) {
+    return;
+  }
+  MediaSessionMonitor* self = call->monitor;
+  gboolean inhibited = FALSE;
+  g_variant_get(reply, "(b)", &inhibited);
+  self->power_inhibited_ = inhibited;
+  self->Update();
+}
+
+void MediaSessionMonitor::AddPlayer(const std::string& name,
+                                    const std::string& owner) {
+  Player& player = players_[owner];
+  player.name = name;
+  player.playing = false;
+  if (debug_) {
+    std::cout << "[WindowFocus] Media player " << name << " (" << owner
+              << ")" << std::endl;
+  }
+  Call(owner.c_str(), kMprisPath, kPropertiesInterface, "Get",
+       g_variant_new("(ss)", kMprisPlayerInterface, "PlaybackStatus"),
+       G_VARIANT_TYPE("(v)"), OnPlaybackStatus, owner);
+}
+
+void MediaSessionMonitor::SetPlaying(const std::string& owner,
+                                     const gchar* status) {
+  auto it = players_.find(owner);
+  if (it == players_.end()) {
+    return;
+  }
+  it->second.playing = g_strcmp0(status, "Playing") == 0;
+  Update();
+}
+
+bool MediaSessionMonitor::IsIgnored(const std::string& name) const {
+  if (ignored_players_.empty()) {
+    return false;
+  }
+  // org.mpris.MediaPlayer2.firefox.instance_1_42 -> firefox
+  std::string player = name.substr(sizeof(kMprisPrefix));
+  player = player.substr(0, player.find('.'));
+  for (const std::string& ignored : ignored_players_) {
+    if (g_ascii_strcasecmp(ignored.c_str(), player.c_str()) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void MediaSessionMonitor::Update() {
+  bool active = session_inhibited_ || power_inhibited_;
+  for (const auto& entry : players_) {
+    active = active || (entry.second.playing && !IsIgnored(entry.second.name));
+  }
+  if (active == active_) {
+    return;
+  }
+  active_ = active;
+  if (debug_) {
+    std::cout << "[WindowFocus] Media session "
+              << (active ? "active" : "inactive") << " (inhibited: "
+              << (inhibited() ? "yes" : "no") << ")" << std::endl;
+  }
+  if (on_change_) {
+    on_change_(active);
+  }
+}
+
+}  // namespace window_focus
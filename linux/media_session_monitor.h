@@ -0,0 +1,163 @@
+#ifndef FLUTTER_PLUGIN_WINDOW_FOCUS_MEDIA_SESSION_MONITOR_H_
+#define FLUTTER_PLUGIN_WINDOW_FOCUS_MEDIA_SESSION_MONITOR_H_
+
+#include <gio/gio.h>
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace window_focus {
+
+// Tells from the session bus whether the user is watching or listening to
+// something, which is what audio metering is mostly used for, at no cost
+// while nothing changes:
+//  - Idle inhibitors, which video players and browsers take through
+//    org.freedesktop.ScreenSaver.Inhibit while playing video. That interface
+//    has no change signal, so they are read where the desktop collects them:
+//    GNOME's session manager (InhibitedActions) and the freedesktop
+//    PowerManagement service (HasInhibitChanged, KDE and Xfce).
+//  - MPRIS players whose PlaybackStatus is "Playing". Players are found
+//    once with ListNames and then followed through NameOwnerChanged.
+//
+// Signals and replies are handled on the GLib main context, and after the
+// initial queries nothing is polled.
+class MediaSessionMonitor {
+ public:
+  // Called on the main context when media starts or stops counting as
+  // activity.
+  using ChangeCallback = std::function<void(bool active)>;
+
+  // GNOME session manager inhibit flag for idleness.
+  static constexpr guint32 kInhibitIdle = 8;
+
+  explicit MediaSessionMonitor(ChangeCallback on_change);
+  ~MediaSessionMonitor();
+
+  MediaSessionMonitor(const MediaSessionMonitor&) = delete;
+  MediaSessionMonitor& operator=(const MediaSessionMonitor&) = delete;
+
+  // Subscribes on |connection|, or on the session bus when null. Returns
+  // false if there is no bus to connect to.
+  bool Start(GDBusConnection* connection = nullptr);
+  void Stop();
+
+  bool is_running() const { return connection_ != nullptr; }
+
+  // Whether an inhibitor is held or a player that is not ignored is playing.
+  bool active() const { return active_; }
+  bool inhibited() const { return session_inhibited_ || power_inhibited_; }
+  // Bus names of the players that are playing, ignored ones included.
+  std::vector<std::string> GetPlayingPlayers() const;
+
+  // Players named like one of |names| never count, compared
+  // case-insensitively with the part of the bus name after
+  // "org.mpris.MediaPlayer2." up to any instance suffix.
+  void set_ignored_players(std::vector<std::string> names);
+  void set_debug(bool enabled) { debug_ = enabled; }
+
+ private:
+  struct Player {
+    std::string name;
+    bool playing = false;
+  };
+
+  // What an asynchronous call needs once its reply arrives.
+  struct PendingCall {
+    MediaSessionMonitor* monitor;
+    std::string key;
+  };
+
+  // Returns the reply, or null on error. Calls cancelled by Stop() return
+  // null without touching the monitor, which may be gone by then.
+  static GVariant* FinishCall(GObject* source,
+                              GAsyncResult* result,
+                              const PendingCall& call);
+
+  static void OnNameOwnerChanged(GDBusConnection* connection,
+                                 const gchar* sender,
+                                 const gchar* path,
+                                 const gchar* interface,
+                                 const gchar* signal,
+                                 GVariant* parameters,
+                                 gpointer user_data);
+  static void OnPlayerPropertiesChanged(GDBusConnection* connection,
+                                        const gchar* sender,
+                                        const gchar* path,
+                                        const gchar* interface,
+                                        const gchar* signal,
+                                        GVariant* parameters,
+                                        gpointer user_data);
+  static void OnSessionPropertiesChanged(GDBusConnection* connection,
+                                         const gchar* sender,
+                                         const gchar* path,
+                                         const gchar* interface,
+                                         const gchar* signal,
+                                         GVariant* parameters,
+                                         gpointer user_data);
+  static void OnHasInhibitChanged(GDBusConnection* connection,
+                                  const gchar* sender,
+                                  const gchar* path,
+                                  const gchar* interface,
+                                  const gchar* signal,
+                                  GVariant* parameters,
+                                  gpointer user_data);
+  static void OnListNames(GObject* source,
+                          GAsyncResult* result,
+                          gpointer user_data);
+  static void OnNameOwner(GObject* source,
+                          GAsyncResult* result,
+                          gpointer user_data);
+  static void OnPlaybackStatus(GObject* source,
+                               GAsyncResult* result,
+                               gpointer user_data);
+  static void OnInhibitedActions(GObject* source,
+                                 GAsyncResult* result,
+                                 gpointer user_data);
+  static void OnHasInhibit(GObject* source,
+                           GAsyncResult* result,
+                           gpointer user_data);
+
+  // Issues an asynchronous call whose reply goes to |callback| with a
+  // PendingCall for |key| as user data.
+  void Call(const gchar* bus_name,
+            const gchar* path,
+            const gchar* interface,
+            const gchar* method,
+            GVariant* parameters,
+            const GVariantType* reply_type,
+            GAsyncReadyCallback callback,
+            const std::string& key);
+  void Subscribe(const gchar* sender,
+                 const gchar* interface,
+                 const gchar* member,
+                 const gchar* path,
+                 const gchar* arg0,
+                 GDBusSignalFlags flags,
+                 GDBusSignalCallback callback);
+
+  void AddPlayer(const std::string& name, const std::string& owner);
+  void SetPlaying(const std::string& owner, const gchar* status);
+  bool IsIgnored(const std::string& name) const;
+  void Update();
+
+  ChangeCallback on_change_;
+
+  GDBusConnection* connection_ = nullptr;
+  GCancellable* cancellable_ = nullptr;
+  std::vector<guint> subscriptions_;
+
+  // Keyed by unique name, which is what player signals carry as sender.
+  std::map<std::string, Player> players_;
+  std::vector<std::string> ignored_players_;
+
+  bool session_inhibited_ = false;
+  bool power_inhibited_ = false;
+  bool active_ = false;
+  bool debug_ = false;
+};
+
+}  // namespace window_focus
+
+#endif  // FLUTTER_PLUGIN_WINDOW_FOCUS_MEDIA_SESSION_MONITOR_H_
@@ -0,0 +1,598 @@
+#include "pulse_audio_monitor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+namespace window_focus {
+
+constexpr uint32_t PulseAudioMonitor::kSampleRate;
+constexpr uint32_t PulseAudioMonitor::kFragmentSamples;
+constexpr float PulseAudioMonitor::kSinePeakPerRms;
+constexpr uint32_t PulseAudioMonitor::kApplicationPeakRate;
+constexpr std::chrono::milliseconds PulseAudioMonitor::kApplicationHold;
+constexpr std::chrono::milliseconds PulseAudioMonitor::kReconnectDelay;
+constexpr std::chrono::milliseconds PulseAudioMonitor::kMaxReconnectDelay;
+
+namespace {
+
+void UnrefOperation(pa_operation* operation) {
+  if (operation != nullptr) {
+    pa_operation_unref(operation);
+  }
+}
+
+float ToDecibels(float level) {
+  return 20.0f * std::log10(std::max(level, 1e-6f));
+}
+
+void CloseStream(pa_stream* stream) {
+  pa_stream_set_state_callback(stream, nullptr, nullptr);
+  pa_stream_set_read_callback(stream, nullptr, nullptr);
+  pa_stream_disconnect(stream);
+  pa_stream_unref(stream);
+}
+
+std::string GetProperty(pa_proplist* properties, const char* key) {
+  const char* value = pa_proplist_gets(properties, key);
+  return value != nullptr ? value : "";
+}
+
+}  // namespace
+
+PulseAudioMonitor::PulseAudioMonitor(ActivityCallback on_activity)
+    : on_activity_(std::move(on_activity)) {}
+
+PulseAudioMonitor::~PulseAudioMonitor() {
+  Stop();
+}
+
+bool PulseAudioMonitor::Start(const char* server) {
+  Stop();
+
+  mainloop_ = pa_threaded_mainloop_new();
+  if (mainloop_ == nullptr) {
+    return false;
+  }
+  server_ = server != nullptr ? server : "";
+  reconnect_delay_ = kReconnectDelay;
+  if (!Connect() || pa_threaded_mainloop_start(mainloop_) < 0) {
+    Stop();
+    return false;
+  }
+  return true;
+}
+
+bool PulseAudioMonitor::Connect() {
+  context_ = pa_context_new(pa_threaded_mainloop_get_api(mainloop_),
+                            "window_focus");
+  if (context_ == nullptr) {
+    return false;
+  }
+  pa_context_set_state_callback(context_, OnContextState, this);
+  pa_context_set_subscribe_callback(context_, OnSubscriptionEvent, this);
+
+  // NOFAIL waits for a server that is not up yet, e.g. pipewire-pulse
+  // started after the application at login.
+  if (pa_context_connect(context_, server_.empty() ? nullptr : server_.c_str(),
+                         PA_CONTEXT_NOFAIL, nullptr) < 0) {
+    std::cerr << "[WindowFocus] Failed to connect to PulseAudio: "
+              << pa_strerror(pa_context_errno(context_)) << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void PulseAudioMonitor::Disconnect() {
+  RemoveAllSinkInputs();
+  if (stream_ != nullptr) {
+    CloseStream(stream_);
+    stream_ = nullptr;
+  }
+  if (context_ != nullptr) {
+    pa_context_set_state_callback(context_, nullptr, nullptr);
+    pa_context_set_subscribe_callback(context_, nullptr, nullptr);
+    pa_context_disconnect(context_);
+    pa_context_unref(context_);
+    context_ = nullptr;
+  }
+  default_sink_.clear();
+
+  std::lock_guard<std::mutex> lock(source_mutex_);
+  source_name_.clear();
+}
+
+void PulseAudioMonitor::Stop() {
+  if (mainloop_ == nullptr) {
+    return;
+  }
+
+  pa_threaded_mainloop_lock(mainloop_);
+  if (reconnect_event_ != nullptr) {
+    pa_threaded_mainloop_get_api(mainloop_)->time_free(reconnect_event_);
+    reconnect_event_ = nullptr;
+  }
+  Disconnect();
+  pa_threaded_mainloop_unlock(mainloop_);
+
+  pa_threaded_mainloop_stop(mainloop_);
+  pa_threaded_mainloop_free(mainloop_);
+  mainloop_ = nullptr;
+}
+
+void PulseAudioMonitor::ScheduleReconnect() {
+  if (reconnect_event_ != nullptr) {
+    return;
+  }
+  timeval time;
+  pa_timeval_add(pa_gettimeofday(&time),
+                 static_cast<pa_usec_t>(reconnect_delay_.count()) *
+                     PA_USEC_PER_MSEC);
+  pa_mainloop_api* api = pa_threaded_mainloop_get_api(mainloop_);
+  reconnect_event_ = api->time_new(api, &time, OnReconnectTimer, this);
+  reconnect_delay_ = std::min(reconnect_delay_ * 2, kMaxReconnectDelay);
+}
+
+// static
+void PulseAudioMonitor::OnReconnectTimer(pa_mainloop_api* api,
+                                         pa_time_event* event,
+                                         const struct timeval* /*time*/,
+                                         void* user_data) {
+  PulseAudioMonitor* self = static_cast<PulseAudioMonitor*>(user_data);
+  api->time_free(event);
+  self->reconnect_event_ = nullptr;
+  // The failed context is dropped here rather than in its own state
+  // callback.
+  self->Disconnect();
+  if (!self->Connect()) {
+    self->ScheduleReconnect();
+  }
+}
+
+void PulseAudioMonitor::SetSuspended(bool suspended) {
+  if (mainloop_ == nullptr) {
+    suspended_ = suspended;
+    return;
+  }
+  pa_threaded_mainloop_lock(mainloop_);
+  if (suspended != suspended_) {
+    suspended_ = suspended;
+    // A stream that is not ready yet is corked once it is.
+    if (stream_ != nullptr &&
+        pa_stream_get_state(stream_) == PA_STREAM_READY) {
+      UnrefOperation(pa_stream_cork(stream_, suspended, nullptr, nullptr));
+    }
+    if (suspended) {
+      ResetLevel();
+    }
+    if (debug_) {
+      std::cout << "[WindowFocus] Audio metering "
+                << (suspended ? "suspended" : "resumed") << std::endl;
+    }
+  }
+  pa_threaded_mainloop_unlock(mainloop_);
+}
+
+void PulseAudioMonitor::ResetLevel() {
+  detector_ = AudioActivityDetector(kSampleRate);
+  was_playing_ = false;
+  level_rms_ = 0.0f;
+  level_peak_ = 0.0f;
+  playing_ = false;
+}
+
+PulseAudioMonitor::Level PulseAudioMonitor::level() const {
+  Level level;
+  level.rms = level_rms_.load(std::memory_order_relaxed);
+  level.peak = level_peak_.load(std::memory_order_relaxed);
+  level.playing = playing_.load(std::memory_order_relaxed);
+  return level;
+}
+
+std::vector<PulseAudioMonitor::Application>
+PulseAudioMonitor::GetApplications() const {
+  const auto now = std::chrono::steady_clock::now();
+  std::vector<Application> applications;
+  std::lock_guard<std::mutex> lock(applications_mutex_);
+  applications.reserve(sink_inputs_.size());
+  for (const auto& entry : sink_inputs_) {
+    applications.push_back(entry.second->app);
+    applications.back().active =
+        now - entry.second->last_audible < kApplicationHold;
+  }
+  return applications;
+}
+
+void PulseAudioMonitor::set_application_policy(ApplicationPolicy policy) {
+  std::lock_guard<std::mutex> lock(applications_mutex_);
+  application_policy_ = std::move(policy);
+}
+
+bool PulseAudioMonitor::ApplicationAudioCounts() const {
+  std::lock_guard<std::mutex> lock(applications_mutex_);
+  if (!application_policy_) {
+    return true;
+  }
+  const auto now = std::chrono::steady_clock::now();
+  for (const auto& entry : sink_inputs_) {
+    if (now - entry.second->last_audible >= kApplicationHold) {
+      continue;
+    }
+    Application app = entry.second->app;
+    app.active = true;
+    if (application_policy_(app)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::string PulseAudioMonitor::source_name() const {
+  std::lock_guard<std::mutex> lock(source_mutex_);
+  return source_name_;
+}
+
+// static
+void PulseAudioMonitor::OnContextState(pa_context* context, void* user_data) {
+  PulseAudioMonitor* self = static_cast<PulseAudioMonitor*>(user_data);
+  switch (pa_context_get_state(context)) {
+    case PA_CONTEXT_READY:
+      self->reconnect_delay_ = kReconnectDelay;
+      // Default sink changes are reported as server changes.
+      UnrefOperation(pa_context_subscribe(
+          context,
+          static_cast<pa_subscription_mask_t>(PA_SUBSCRIPTION_MASK_SERVER |
+                                              PA_SUBSCRIPTION_MASK_SINK_INPUT),
+          nullptr, nullptr));
+      self->QueryDefaultSink();
+      UnrefOperation(
+          pa_context_get_sink_input_info_list(context, OnSinkInputInfo, self));
+      break;
+    case PA_CONTEXT_FAILED:
+      // NOFAIL only covers the initial connect; a context that lost its
+      // server stays failed, so a new one is made.
+      std::cerr << "[WindowFocus] PulseAudio connection lost: "
+                << pa_strerror(pa_context_errno(context))
+                << ", reconnecting in " << self->reconnect_delay_.count()
+                << " ms" << std::endl;
+      // No more PCM arrives to end the playback the detector saw.
+      self->ResetLevel();
+      self->ScheduleReconnect();
+      break;
+    default:
+      break;
+  }
+}
+
+// static
+void PulseAudioMonitor::OnSubscriptionEvent(pa_context* context,
+                                            pa_subscription_event_type_t type,
+                                            uint32_t index,
+                                            void* user_data) {
+  PulseAudioMonitor* self = static_cast<PulseAudioMonitor*>(user_data);
+  switch (type & PA_SUBSCRIPTION_EVENT_FACILITY_MASK) {
+    case PA_SUBSCRIPTION_EVENT_SERVER:
+      self->QueryDefaultSink();
+      break;
+    case PA_SUBSCRIPTION_EVENT_SINK_INPUT:
+      if ((type & PA_SUBSCRIPTION_EVENT_TYPE_MASK) ==
+          PA_SUBSCRIPTION_EVENT_REMOVE) {
+        self->RemoveSinkInput(index);
+      } else {
+        UnrefOperation(pa_context_get_sink_input_info(context, index,
+                                                      OnSinkInputInfo, self));
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+void PulseAudioMonitor::QueryDefaultSink() {
+  UnrefOperation(pa_context_get_server_info(context_, OnServerInfo, this));
+}
+
+// static
+void PulseAudioMonitor::OnServerInfo(pa_context* context,
+                                     const pa_server_info* info,
+                                     void* user_data) {
+  PulseAudioMonitor* self = static_cast<PulseAudioMonitor*>(user_data);
+  // Server changes also cover the sample spec, name and default source.
+  if (info == nullptr || info->default_sink_name == nullptr ||
+      self->default_sink_ == info->default_sink_name) {
+    return;
+  }
+  self->default_sink_ = info->default_sink_name;
+  UnrefOperation(pa_context_get_sink_info_by_name(
+      context, info->default_sink_name, OnSinkInfo, self));
+}
+
+// static
+void PulseAudioMonitor::OnSinkInfo(pa_context* context,
+                                   const pa_sink_info* info,
+                                   int eol,
+                                   void* user_data) {
+  if (eol != 0 || info == nullptr || info->monitor_source_name == nullptr) {
+    return;
+  }
+  PulseAudioMonitor* self = static_cast<PulseAudioMonitor*>(user_data);
+  // The default sink may have changed again while this query was in flight.
+  if (self->default_sink_ != info->name) {
+    return;
+  }
+  self->AttachToSource(info->monitor_source_name);
+}
+
+void PulseAudioMonitor::AttachToSource(const std::string& source) {
+  if (debug_) {
+    std::cout << "[WindowFocus] Metering audio on " << source << std::endl;
+  }
+
+  if (stream_ != nullptr &&
+      pa_stream_get_state(stream_) == PA_STREAM_READY) {
+    // Moving keeps the stream and its buffers; if the move fails the stream
+    // is recreated on the next server change.
+    UnrefOperation(pa_context_move_source_output_by_name(
+        context_, pa_stream_get_index(stream_), source.c_str(), nullptr,
+        nullptr));
+    std::lock_guard<std::mutex> lock(source_mutex_);
+    source_name_ = source;
+    return;
+  }
+
+  if (stream_ != nullptr) {
+    CloseStream(stream_);
+    stream_ = nullptr;
+  }
+
+  pa_sample_spec spec = {};
+  spec.format = PA_SAMPLE_FLOAT32NE;
+  spec.rate = kSampleRate;
+  spec.channels = 1;
+  stream_ = pa_stream_new(context_, "Activity audio meter", &spec, nullptr);
+  if (stream_ == nullptr) {
+    return;
+  }
+  pa_stream_set_state_callback(stream_, OnStreamState, this);
+  pa_stream_set_read_callback(stream_, OnStreamRead, this);
+
+  pa_buffer_attr attributes;
+  memset(&attributes, 0xFF, sizeof(attributes));
+  attributes.fragsize = kFragmentSamples * sizeof(float);
+  pa_stream_flags_t flags = static_cast<pa_stream_flags_t>(
+      PA_STREAM_ADJUST_LATENCY | PA_STREAM_DONT_INHIBIT_AUTO_SUSPEND);
+  if (suspended_) {
+    flags = static_cast<pa_stream_flags_t>(flags | PA_STREAM_START_CORKED);
+  }
+  if (pa_stream_connect_record(stream_, source.c_str(), &attributes, flags) <
+      0) {
+    std::cerr << "[WindowFocus] Failed to record " << source << ": "
+              << pa_strerror(pa_context_errno(context_)) << std::endl;
+    pa_stream_unref(stream_);
+    stream_ = nullptr;
+    return;
+  }
+  std::lock_guard<std::mutex> lock(source_mutex_);
+  source_name_ = source;
+}
+
+// static
+void PulseAudioMonitor::OnStreamState(pa_stream* stream, void* user_data) {
+  PulseAudioMonitor* self = static_cast<PulseAudioMonitor*>(user_data);
+  const pa_stream_state_t state = pa_stream_get_state(stream);
+  if (state == PA_STREAM_READY) {
+    // Follows a SetSuspended() that came while the stream was being set up.
+    if (pa_stream_is_corked(stream) != static_cast<int>(self->suspended_)) {
+      UnrefOperation(pa_stream_cork(stream, self->suspended_, nullptr,
+                                    nullptr));
+    }
+    return;
+  }
+  if (state != PA_STREAM_FAILED && state != PA_STREAM_TERMINATED) {
+    return;
+  }
+  // Typically the metered sink disappeared; the server picks a new default
+  // and the change event attaches a new stream.
+  if (self->debug_) {
+    std::cout << "[WindowFocus] Audio peak stream closed" << std::endl;
+  }
+  pa_stream_set_state_callback(stream, nullptr, nullptr);
+  pa_stream_set_read_callback(stream, nullptr, nullptr);
+  pa_stream_unref(stream);
+  self->stream_ = nullptr;
+  self->default_sink_.clear();
+  std::lock_guard<std::mutex> lock(self->source_mutex_);
+  self->source_name_.clear();
+}
+
+// static
+void PulseAudioMonitor::OnStreamRead(pa_stream* stream,
+                                     size_t length,
+                                     void* user_data) {
+  PulseAudioMonitor* self = static_cast<PulseAudioMonitor*>(user_data);
+  AudioActivityDetector& detector = self->detector_;
+  detector.set_threshold(self->threshold_.load(std::memory_order_relaxed));
+
+  while (pa_stream_readable_size(stream) > 0) {
+    const void* data = nullptr;
+    if (pa_stream_peek(stream, &data, &length) < 0 || length == 0) {
+      break;
+    }
+    // data is null for a hole in the stream, which still has to be dropped.
+    if (data != nullptr) {
+      detector.Process(static_cast<const float*>(data),
+                       length / sizeof(float));
+    }
+    pa_stream_drop(stream);
+  }
+
+  self->level_rms_.store(detector.rms(), std::memory_order_relaxed);
+  self->level_peak_.store(detector.peak(), std::memory_order_relaxed);
+  self->playing_.store(detector.playing(), std::memory_order_relaxed);
+
+  if (detector.playing() != self->was_playing_) {
+    self->was_playing_ = detector.playing();
+    if (self->debug_) {
+      std::cout << "[WindowFocus] Audio playback "
+                << (detector.playing() ? "started" : "stopped") << ", RMS "
+                << ToDecibels(detector.rms()) << " dBFS, peak "
+                << ToDecibels(detector.peak()) << " dBFS" << std::endl;
+    }
+  }
+  if (detector.playing() && self->ApplicationAudioCounts()) {
+    self->on_activity_();
+  }
+}
+
+// static
+void PulseAudioMonitor::OnSinkInputInfo(pa_context* context,
+                                        const pa_sink_input_info* info,
+                                        int eol,
+                                        void* user_data) {
+  if (eol != 0 || info == nullptr) {
+    return;
+  }
+  PulseAudioMonitor* self = static_cast<PulseAudioMonitor*>(user_data);
+  const std::string pid =
+      GetProperty(info->proplist, PA_PROP_APPLICATION_PROCESS_ID);
+
+  SinkInput* input = nullptr;
+  bool added = false;
+  {
+    std::lock_guard<std::mutex> lock(self->applications_mutex_);
+    std::unique_ptr<SinkInput>& entry = self->sink_inputs_[info->index];
+    if (!entry) {
+      entry.reset(new SinkInput());
+      entry->monitor = self;
+      entry->app.index = info->index;
+      added = true;
+    }
+    input = entry.get();
+    input->app.pid = pid.empty() ? 0 : std::strtoll(pid.c_str(), nullptr, 10);
+    input->app.name = GetProperty(info->proplist, PA_PROP_APPLICATION_NAME);
+    input->app.binary =
+        GetProperty(info->proplist, PA_PROP_APPLICATION_PROCESS_BINARY);
+    if (info->corked) {
+      // A paused stream sends no more peaks to lower the last one.
+      input->app.peak = 0.0f;
+    }
+  }
+  if (added && self->debug_) {
+    std::cout << "[WindowFocus] Audio stream " << info->index << " from "
+              << input->app.name << " (" << input->app.binary << ", pid "
+              << input->app.pid << ")" << std::endl;
+  }
+
+  // The server closes the peak stream when the sink input moves to another
+  // sink; the change event for the move brings us here to replace it.
+  if (input->peak_stream != nullptr && input->sink != info->sink) {
+    CloseStream(input->peak_stream);
+    input->peak_stream = nullptr;
+  }
+  input->sink = info->sink;
+  if (input->peak_stream == nullptr) {
+    self->AttachPeakStream(input);
+  }
+}
+
+void PulseAudioMonitor::AttachPeakStream(SinkInput* input) {
+  pa_sample_spec spec = {};
+  spec.format = PA_SAMPLE_FLOAT32NE;
+  spec.rate = kApplicationPeakRate;
+  spec.channels = 1;
+  pa_stream* stream =
+      pa_stream_new(context_, "Application peak meter", &spec, nullptr);
+  if (stream == nullptr) {
+    return;
+  }
+  // Records only this sink input's output. Without a device, the server
+  // picks the monitor of the sink it plays on.
+  pa_stream_set_monitor_stream(stream, input->app.index);
+  pa_stream_set_state_callback(stream, OnPeakStreamState, input);
+  pa_stream_set_read_callback(stream, OnPeakStreamRead, input);
+
+  // One peak value per fragment.
+  pa_buffer_attr attributes;
+  memset(&attributes, 0xFF, sizeof(attributes));
+  attributes.fragsize = sizeof(float);
+  const pa_stream_flags_t flags = static_cast<pa_stream_flags_t>(
+      PA_STREAM_PEAK_DETECT | PA_STREAM_ADJUST_LATENCY |
+      PA_STREAM_DONT_INHIBIT_AUTO_SUSPEND | PA_STREAM_DONT_MOVE);
+  if (pa_stream_connect_record(stream, nullptr, &attributes, flags) < 0) {
+    pa_stream_unref(stream);
+    return;
+  }
+  input->peak_stream = stream;
+}
+
+void PulseAudioMonitor::RemoveSinkInput(uint32_t index) {
+  std::lock_guard<std::mutex> lock(applications_mutex_);
+  auto it = sink_inputs_.find(index);
+  if (it == sink_inputs_.end()) {
+    return;
+  }
+  if (it->second->peak_stream != nullptr) {
+    CloseStream(it->second->peak_stream);
+  }
+  sink_inputs_.erase(it);
+}
+
+void PulseAudioMonitor::RemoveAllSinkInputs() {
+  std::lock_guard<std::mutex> lock(applications_mutex_);
+  for (auto& entry : sink_inputs_) {
+    if (entry.second->peak_stream != nullptr) {
+      CloseStream(entry.second->peak_stream);
+    }
+  }
+  sink_inputs_.clear();
+}
+
+// static
+void PulseAudioMonitor::OnPeakStreamState(pa_stream* stream, void* user_data) {
+  const pa_stream_state_t state = pa_stream_get_state(stream);
+  if (state != PA_STREAM_FAILED && state != PA_STREAM_TERMINATED) {
+    return;
+  }
+  SinkInput* input = static_cast<SinkInput*>(user_data);
+  pa_stream_set_state_callback(stream, nullptr, nullptr);
+  pa_stream_set_read_callback(stream, nullptr, nullptr);
+  pa_stream_unref(stream);
+  input->peak_stream = nullptr;
+}
+
+// static
+void PulseAudioMonitor::OnPeakStreamRead(pa_stream* stream,
+                                         size_t length,
+                                         void* user_data) {
+  SinkInput* input = static_cast<SinkInput*>(user_data);
+  PulseAudioMonitor* self = input->monitor;
+
+  float peak = -1.0f;
+  while (pa_stream_readable_size(stream) > 0) {
+    const void* data = nullptr;
+    if (pa_stream_peek(stream, &data, &length) < 0 || length == 0) {
+      break;
+    }
+    if (data != nullptr) {
+      const float* values = static_cast<const float*>(data);
+      for (size_t i = 0; i < length / sizeof(float); i++) {
+        peak = std::max(peak, values[i]);
+      }
+    }
+    pa_stream_drop(stream);
+  }
+  if (peak < 0.0f) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(self->applications_mutex_);
+  input->app.peak = peak;
+  if (peak > self->application_threshold_.load(std::memory_order_relaxed)) {
+    input->last_audible = std::chrono::steady_clock::now();
+  }
+}
+
+}  // namespace window_focus
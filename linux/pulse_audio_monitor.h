@@ -0,0 +1,217 @@
+#ifndef FLUTTER_PLUGIN_WINDOW_FOCUS_PULSE_AUDIO_MONITOR_H_
+#define FLUTTER_PLUGIN_WINDOW_FOCUS_PULSE_AUDIO_MONITOR_H_
+
+#include <pulse/pulseaudio.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "audio_activity_detector.h"
+
+namespace window_focus {
+
+// Linux counterpart of the Windows audio check (CheckSystemAudio) built on
+// the PulseAudio client API, which PipeWire serves through pipewire-pulse.
+//
+// One context and one record stream live for as long as audio monitoring is
+// enabled. The stream records the monitor source of the default sink as
+// mono float PCM at a low rate, which the server mixes down and resamples,
+// and an AudioActivityDetector decides whether media is playing. The stream
+// does not keep an idle sink from suspending. When the default sink changes,
+// a server subscription event moves the existing stream to the new sink's
+// monitor; nothing reconnects. If the server goes away, e.g. when
+// pipewire-pulse restarts, the context is rebuilt after kReconnectDelay,
+// backing off to kMaxReconnectDelay while attempts keep failing.
+//
+// Playback streams (sink inputs) are attributed to their applications. They
+// are listed once on connect and then kept current from sink input
+// subscription events. Each gets a peak-detect stream on its own output, so
+// the per-application level costs the server a few values a second and no
+// PCM.
+class PulseAudioMonitor {
+ public:
+  using ActivityCallback = std::function<void()>;
+
+  // Speech and music are well represented at this rate, and it keeps the
+  // detector's work per second small.
+  static constexpr uint32_t kSampleRate = 16000;
+  // Samples the server sends at once.
+  static constexpr uint32_t kFragmentSamples = kSampleRate / 50;
+
+  // Peak over RMS of a sine wave. Speech and music peak higher still.
+  static constexpr float kSinePeakPerRms = 1.41421356f;
+
+  // Peak values per second requested for each application.
+  static constexpr uint32_t kApplicationPeakRate = 10;
+  // How long an application stays active after its last audible peak.
+  static constexpr std::chrono::milliseconds kApplicationHold{2000};
+
+  // Wait before reconnecting to a server that went away, doubled after each
+  // failed attempt up to kMaxReconnectDelay.
+  static constexpr std::chrono::milliseconds kReconnectDelay{1000};
+  static constexpr std::chrono::milliseconds kMaxReconnectDelay{30000};
+
+  // An application's playback stream.
+  struct Application {
+    uint32_t index = 0;
+    // 0 if the client did not report one, e.g. a sandboxed application.
+    int64_t pid = 0;
+    std::string name;
+    std::string binary;
+    float peak = 0.0f;
+    // Peaked above the application threshold within kApplicationHold.
+    bool active = false;
+  };
+
+  // Decides whether an active application's audio counts as activity.
+  // Called with the monitor's lock held, so it must not call back into it.
+  using ApplicationPolicy = std::function<bool(const Application& app)>;
+
+  // The last detector window's level and state.
+  struct Level {
+    float rms = 0.0f;
+    float peak = 0.0f;
+    bool playing = false;
+  };
+
+  // |on_activity| is invoked on the PulseAudio thread for every block
+  // received while media is playing.
+  explicit PulseAudioMonitor(ActivityCallback on_activity);
+  ~PulseAudioMonitor();
+
+  PulseAudioMonitor(const PulseAudioMonitor&) = delete;
+  PulseAudioMonitor& operator=(const PulseAudioMonitor&) = delete;
+
+  // Connects to |server|, or the session's server when null. Returns once the
+  // PulseAudio thread runs; a server that is not up yet is waited for.
+  bool Start(const char* server = nullptr);
+  void Stop();
+
+  bool is_running() const { return mainloop_ != nullptr; }
+
+  void set_debug(bool enabled) { debug_ = enabled; }
+  // Linear RMS, 0 to 1, above which sustained audio counts as activity.
+  // Applications are metered by peak, so theirs are compared with the peak
+  // of a sine wave at this RMS instead.
+  void set_threshold(float threshold) {
+    threshold_ = threshold;
+    application_threshold_ = threshold * kSinePeakPerRms;
+  }
+
+  // Corks the metering stream, so the server stops sending PCM, while
+  // another source already knows media is playing. The level reads zero
+  // meanwhile. Per-application peaks keep updating.
+  void SetSuspended(bool suspended);
+
+  // Safe to call from any thread.
+  Level level() const;
+
+  // The current playback streams. Safe to call from any thread.
+  std::vector<Application> GetApplications() const;
+
+  // Without a policy, any audio counts. With one, playback only counts while
+  // an active application passes it. Safe to call from any thread.
+  void set_application_policy(ApplicationPolicy policy);
+
+  // The monitor source being recorded, empty until the stream is attached.
+  // Safe to call from any thread.
+  std::string source_name() const;
+
+ private:
+  static void OnContextState(pa_context* context, void* user_data);
+  static void OnReconnectTimer(pa_mainloop_api* api,
+                               pa_time_event* event,
+                               const struct timeval* time,
+                               void* user_data);
+  static void OnSubscriptionEvent(pa_context* context,
+                                  pa_subscription_event_type_t type,
+                                  uint32_t index,
+                                  void* user_data);
+  static void OnServerInfo(pa_context* context,
+                           const pa_server_info* info,
+                           void* user_data);
+  static void OnSinkInfo(pa_context* context,
+                         const pa_sink_info* info,
+                         int eol,
+                         void* user_data);
+  static void OnStreamState(pa_stream* stream, void* user_data);
+  static void OnStreamRead(pa_stream* stream, size_t length, void* user_data);
+  static void OnSinkInputInfo(pa_context* context,
+                              const pa_sink_input_info* info,
+                              int eol,
+                              void* user_data);
+  static void OnPeakStreamState(pa_stream* stream, void* user_data);
+  static void OnPeakStreamRead(pa_stream* stream,
+                               size_t length,
+                               void* user_data);
+
+  struct SinkInput {
+    PulseAudioMonitor* monitor = nullptr;
+    Application app;
+    uint32_t sink = PA_INVALID_INDEX;
+    pa_stream* peak_stream = nullptr;
+    std::chrono::steady_clock::time_point last_audible;
+  };
+
+  // Creates |context_| and connects it to |server_|. PulseAudio thread, or
+  // before it starts.
+  bool Connect();
+  // Closes the streams and the context. With the mainloop locked.
+  void Disconnect();
+
+  // PulseAudio thread only.
+  void ScheduleReconnect();
+  void ResetLevel();
+  void QueryDefaultSink();
+  void AttachToSource(const std::string& source);
+  void AttachPeakStream(SinkInput* input);
+  void RemoveSinkInput(uint32_t index);
+  void RemoveAllSinkInputs();
+
+  // Whether the policy lets the current audio count. Any thread.
+  bool ApplicationAudioCounts() const;
+
+  ActivityCallback on_activity_;
+
+  pa_threaded_mainloop* mainloop_ = nullptr;
+  // Empty for the session's server.
+  std::string server_;
+  // Owned by the PulseAudio thread while it runs.
+  pa_context* context_ = nullptr;
+  pa_time_event* reconnect_event_ = nullptr;
+  std::chrono::milliseconds reconnect_delay_ = kReconnectDelay;
+  pa_stream* stream_ = nullptr;
+  std::string default_sink_;
+
+  mutable std::mutex source_mutex_;
+  std::string source_name_;
+
+  // Entries are added and removed on the PulseAudio thread; the lock covers
+  // them and the policy for readers on other threads.
+  mutable std::mutex applications_mutex_;
+  std::map<uint32_t, std::unique_ptr<SinkInput>> sink_inputs_;
+  ApplicationPolicy application_policy_;
+
+  // PulseAudio thread only, or with the mainloop locked.
+  AudioActivityDetector detector_{kSampleRate};
+  bool was_playing_ = false;
+  bool suspended_ = false;
+
+  std::atomic<float> level_rms_{0.0f};
+  std::atomic<float> level_peak_{0.0f};
+  std::atomic<bool> playing_{false};
+
+  std::atomic<bool> debug_{false};
+  std::atomic<float> threshold_{0.01f};
+  std::atomic<float> application_threshold_{0.01f * kSinePeakPerRms};
+};
+
+}  // namespace window_focus
+
+#endif  // FLUTTER_PLUGIN_WINDOW_FOCUS_PULSE_AUDIO_MONITOR_H_
@@ -0,0 +1,175 @@
+#include "screenshot_ring.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+#include "image_scaler.h"
+#include "pixel_format.h"
+
+namespace window_focus {
+
+ScreenshotRing::ScreenshotRing(FrameSource source)
+    : source_(std::move(source)) {}
+
+ScreenshotRing::~ScreenshotRing() {
+  Stop();
+}
+
+void ScreenshotRing::Start(const Options& options) {
+  Stop();
+  options_ = options;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = false;
+    ring_.reset(new FrameRing(options.frames, options.max_bytes));
+  }
+  thread_ = std::thread(&ScreenshotRing::Run, this);
+}
+
+void ScreenshotRing::Stop() {
+  if (!thread_.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_all();
+  thread_.join();
+  std::lock_guard<std::mutex> lock(mutex_);
+  ring_.reset();
+  scaled_ = std::vector<uint8_t>();
+  encoded_ = std::vector<uint8_t>();
+}
+
+size_t ScreenshotRing::ReadRecent(size_t count,
+                                  const FrameReader& reader) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (ring_ == nullptr) {
+    return 0;
+  }
+  count = std::min(count, ring_->size());
+  for (size_t i = 0; i < count; i++) {
+    reader(ring_->frame(i), ring_->data(i));
+  }
+  return count;
+}
+
+void ScreenshotRing::Run() {
+  const auto interval =
+      std::max(options_.interval, std::chrono::milliseconds(1));
+  auto next = std::chrono::steady_clock::now();
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!wake_.wait_until(lock, next, [this]() { return stopping_; })) {
+    lock.unlock();
+    Capture();
+    lock.lock();
+    next += interval;
+    const auto now = std::chrono::steady_clock::now();
+    if (next < now) {
+      next += (now - next) / interval * interval + interval;
+    }
+  }
+}
+
+void ScreenshotRing::Capture() {
+  const auto start = std::chrono::steady_clock::now();
+  FrameRing::Frame stored;
+  stored.timestamp_ms =
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::system_clock::now().time_since_epoch())
+          .count();
+  ScreenshotScheduler::Frame frame;
+  CaptureTarget target;
+  target.active_window_only = options_.active_window_only;
+  if (!source_(target, &frame)) {
+    if (debug_) {
+      std::cerr << "[WindowFocus] Ring failed to take screenshot" << std::endl;
+    }
+    return;
+  }
+  int width = frame.width;
+  int height = frame.height;
+  const bool scale = FitImageSize(frame.width, frame.height, options_.max_width,
+                                  options_.max_height, &width, &height);
+  stored.width = width;
+  stored.height = height;
+
+  // Only the ring thread reserves and writes, and readers never see a
+  // reserved region, so the pixels are written without holding the lock.
+  uint8_t* destination = nullptr;
+  if (options_.encoder == nullptr) {
+    const size_t size = static_cast<size_t>(width) * height * 4;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      destination = ring_->Reserve(size);
+    }
+    if (destination == nullptr) {
+      if (debug_) {
+        std::cerr << "[WindowFocus] Ring frame of " << size
+                  << " bytes does not fit in " << ring_->max_bytes()
+                  << std::endl;
+      }
+      return;
+    }
+    if (scale) {
+      DownscaleBgrxPixels(frame.data, frame.width, frame.height, frame.stride,
+                          destination, width, height, width * 4,
+                          PixelFormat::kBgra);
+    } else {
+      for (int y = 0; y < height; y++) {
+        ConvertBgrxPixels(frame.data + static_cast<size_t>(y) * frame.stride,
+                          destination + static_cast<size_t>(y) * width * 4,
+                          width, PixelFormat::kBgra);
+      }
+    }
+  } else {
+    if (scale) {
+      scaled_.resize(static_cast<size_t>(width) * height * 4);
+      DownscaleBgrxPixels(frame.data, frame.width, frame.height, frame.stride,
+                          scaled_.data(), width, height, width * 4,
+                          PixelFormat::kBgra);
+      frame.data = scaled_.data();
+      frame.stride = width * 4;
+    }
+    if (!options_.encoder->encode(frame.data, width, height, frame.stride,
+                                  options_.quality, &encoded_)) {
+      if (debug_) {
+        std::cerr << "[WindowFocus] Ring failed to encode screenshot"
+                  << std::endl;
+      }
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      destination = ring_->Reserve(encoded_.size());
+    }
+    if (destination == nullptr) {
+      if (debug_) {
+        std::cerr << "[WindowFocus] Ring frame of " << encoded_.size()
+                  << " bytes does not fit in " << ring_->max_bytes()
+                  << std::endl;
+      }
+      return;
+    }
+    memcpy(destination, encoded_.data(), encoded_.size());
+  }
+
+  size_t frames = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ring_->Commit(stored);
+    frames = ring_->size();
+  }
+  if (debug_) {
+    const std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::cout << "[WindowFocus] Ring frame " << width << "x" << height
+              << " stored in " << elapsed.count() << " ms, " << frames
+              << " frames kept" << std::endl;
+  }
+}
+
+}  // namespace window_focus
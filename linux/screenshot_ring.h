@@ -0,0 +1,91 @@
+#ifndef FLUTTER_PLUGIN_WINDOW_FOCUS_SCREENSHOT_RING_H_
+#define FLUTTER_PLUGIN_WINDOW_FOCUS_SCREENSHOT_RING_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "frame_ring.h"
+#include "screenshot_encoder.h"
+#include "screenshot_scheduler.h"
+
+namespace window_focus {
+
+// Captures the screen at a low rate on a thread of its own into a
+// FrameRing, so that the newest screenshot is available without waiting for
+// a capture and the last few can be looked back on.
+//
+// Frames are stored encoded with |encoder|, or as opaque BGRA pixels
+// (|width| * 4 bytes per row) when it is null. Raw frames are written by the
+// scaler straight into the ring's buffer.
+class ScreenshotRing {
+ public:
+  using FrameSource = ScreenshotScheduler::FrameSource;
+
+  struct Options {
+    std::chrono::milliseconds interval{1000};
+    size_t frames = kDefaultRingFrames;
+    size_t max_bytes = kDefaultRingBytes;
+    // Null stores raw BGRA.
+    const ScreenshotEncoder* encoder = nullptr;
+    int quality = kDefaultScreenshotQuality;
+    bool active_window_only = false;
+    // 0 for no limit.
+    int max_width = 0;
+    int max_height = 0;
+  };
+
+  // Called with a stored frame's bytes, which are only valid during the call.
+  using FrameReader =
+      std::function<void(const FrameRing::Frame& frame, const uint8_t* data)>;
+
+  explicit ScreenshotRing(FrameSource source);
+  ~ScreenshotRing();
+
+  ScreenshotRing(const ScreenshotRing&) = delete;
+  ScreenshotRing& operator=(const ScreenshotRing&) = delete;
+
+  // Allocates the ring and starts capturing, replacing the running ring and
+  // its frames.
+  void Start(const Options& options);
+  // Stops capturing and frees the frames.
+  void Stop();
+  bool is_running() const { return thread_.joinable(); }
+  // What the running ring was started with.
+  const Options& options() const { return options_; }
+
+  // Calls |reader| on up to |count| frames, newest first, while holding the
+  // ring's lock, and returns how many there were.
+  size_t ReadRecent(size_t count, const FrameReader& reader) const;
+
+  void set_debug(bool debug) { debug_ = debug; }
+
+ private:
+  void Run();
+  void Capture();
+
+  const FrameSource source_;
+  Options options_;
+  std::thread thread_;
+  // Guards |ring_|'s frames and |stopping_|. Frames are written into a
+  // reserved region without it.
+  mutable std::mutex mutex_;
+  std::condition_variable wake_;
+  bool stopping_ = false;
+  std::unique_ptr<FrameRing> ring_;
+  std::atomic<bool> debug_{false};
+  // Scratch for encoded frames, kept to avoid reallocating.
+  std::vector<uint8_t> scaled_;
+  std::vector<uint8_t> encoded_;
+};
+
+}  // namespace window_focus
+
+#endif  // FLUTTER_PLUGIN_WINDOW_FOCUS_SCREENSHOT_RING_H_
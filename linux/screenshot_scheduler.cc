@@ -0,0 +1,191 @@
+#include "screenshot_scheduler.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+#include "image_scaler.h"
+#include "screen_delta.h"
+
+namespace window_focus {
+
+namespace {
+
+// "<directory>/screenshot_20260118_093005_123.<format>" in local time.
+std::string ScreenshotPath(const std::string& directory,
+                           const char* format,
+                           int64_t timestamp_ms) {
+  const time_t seconds = static_cast<time_t>(timestamp_ms / 1000);
+  struct tm local = {};
+  localtime_r(&seconds, &local);
+  char name[64];
+  snprintf(name, sizeof(name), "screenshot_%04d%02d%02d_%02d%02d%02d_%03d.",
+           local.tm_year + 1900, local.tm_mon + 1, local.tm_mday,
+           local.tm_hour, local.tm_min, local.tm_sec,
+           static_cast<int>(timestamp_ms % 1000));
+  std::string path = directory;
+  if (!path.empty() && path.back() != '/') {
+    path += '/';
+  }
+  return path + name + format;
+}
+
+}  // namespace
+
+ScreenshotScheduler::ScreenshotScheduler(FrameSource source,
+                                         ResultCallback on_result)
+    : source_(std::move(source)), on_result_(std::move(on_result)) {}
+
+ScreenshotScheduler::~ScreenshotScheduler() {
+  Stop();
+}
+
+void ScreenshotScheduler::Start(const Options& options) {
+  Stop();
+  stopping_ = false;
+  have_hash_ = false;
+  skipped_idle_ = 0;
+  skipped_unchanged_ = 0;
+  thread_ = std::thread(&ScreenshotScheduler::Run, this, options);
+}
+
+void ScreenshotScheduler::Stop() {
+  if (!thread_.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_all();
+  thread_.join();
+}
+
+void ScreenshotScheduler::Run(Options options) {
+  const auto interval =
+      std::max(options.interval, std::chrono::milliseconds(1));
+  auto next = std::chrono::steady_clock::now();
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!wake_.wait_until(lock, next, [this]() { return stopping_; })) {
+    lock.unlock();
+    Tick(options);
+    lock.lock();
+    next += interval;
+    const auto now = std::chrono::steady_clock::now();
+    if (next < now) {
+      next += (now - next) / interval * interval + interval;
+    }
+  }
+}
+
+void ScreenshotScheduler::Tick(const Options& options) {
+  if (options.skip_when_idle && !user_active_) {
+    skipped_idle_++;
+    return;
+  }
+
+  Result result;
+  result.format = options.encoder->name;
+  const auto start = std::chrono::steady_clock::now();
+  result.timestamp_ms =
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::system_clock::now().time_since_epoch())
+          .count();
+  Frame frame;
+  CaptureTarget target;
+  target.active_window_only = options.active_window_only;
+  if (!source_(target, &frame)) {
+    result.error = "Failed to take screenshot";
+  } else {
+    int width = 0;
+    int height = 0;
+    if (FitImageSize(frame.width, frame.height, options.max_width,
+                     options.max_height, &width, &height)) {
+      scaled_.resize(static_cast<size_t>(width) * height * 4);
+      DownscaleBgrxPixels(frame.data, frame.width, frame.height, frame.stride,
+                          scaled_.data(), width, height, width * 4,
+                          PixelFormat::kBgra);
+      frame.data = scaled_.data();
+      frame.width = width;
+      frame.height = height;
+      frame.stride = width * 4;
+    }
+    if (options.skip_unchanged) {
+      const uint64_t hash = HashFramePixels(frame.data, frame.width,
+                                            frame.height, frame.stride);
+      if (have_hash_ && hash == last_hash_) {
+        skipped_unchanged_++;
+        return;
+      }
+      // Remembered before encoding: a frame that fails to save is not
+      // retried every tick.
+      have_hash_ = true;
+      last_hash_ = hash;
+    }
+    result.width = frame.width;
+    result.height = frame.height;
+    if (!options.encoder->encode(frame.data, frame.width, frame.height,
+                                 frame.stride, options.quality, &encoded_)) {
+      result.error = "Failed to encode screenshot";
+    } else {
+      const std::string path = ScreenshotPath(
+          options.directory, options.encoder->name, result.timestamp_ms);
+      if (WriteScreenshot(path, &result.error)) {
+        result.path = path;
+        result.size = encoded_.size();
+      }
+    }
+  }
+
+  result.skipped_idle = skipped_idle_;
+  result.skipped_unchanged = skipped_unchanged_;
+  skipped_idle_ = 0;
+  skipped_unchanged_ = 0;
+  if (debug_) {
+    const std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    if (result.error.empty()) {
+      std::cout << "[WindowFocus] Scheduled screenshot " << result.path
+                << ": " << result.size << " bytes in " << elapsed.count()
+                << " ms, " << result.skipped_idle << " idle and "
+                << result.skipped_unchanged << " unchanged ticks skipped"
+                << std::endl;
+    } else {
+      std::cerr << "[WindowFocus] Scheduled screenshot failed: "
+                << result.error << std::endl;
+    }
+  }
+  on_result_(result);
+}
+
+bool ScreenshotScheduler::WriteScreenshot(const std::string& path,
+                                          std::string* error) {
+  const std::string partial = path + ".part";
+  FILE* file = fopen(partial.c_str(), "wb");
+  if (file == nullptr) {
+    *error = "Cannot create " + partial + ": " + strerror(errno);
+    return false;
+  }
+  const bool written =
+      fwrite(encoded_.data(), 1, encoded_.size(), file) == encoded_.size();
+  const int saved_errno = errno;
+  if (fclose(file) != 0 || !written) {
+    *error = "Cannot write " + partial + ": " +
+             strerror(written ? errno : saved_errno);
+    remove(partial.c_str());
+    return false;
+  }
+  if (rename(partial.c_str(), path.c_str()) != 0) {
+    *error = "Cannot rename " + partial + ": " + strerror(errno);
+    remove(partial.c_str());
+    return false;
+  }
+  return true;
+}
+
+}  // namespace window_focus
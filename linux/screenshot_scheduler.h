@@ -0,0 +1,119 @@
+#ifndef FLUTTER_PLUGIN_WINDOW_FOCUS_SCREENSHOT_SCHEDULER_H_
+#define FLUTTER_PLUGIN_WINDOW_FOCUS_SCREENSHOT_SCHEDULER_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "capture_target.h"
+#include "screenshot_encoder.h"
+
+namespace window_focus {
+
+// Takes screenshots at a fixed interval on a thread of its own and writes
+// them to a directory, so nothing but the resulting paths crosses the
+// method channel.
+//
+// A tick is skipped without capturing while the user is inactive, and after
+// capturing when the frame hashes the same as the last one saved. Files are
+// encoded on the scheduler thread and written under a temporary name, then
+// renamed, so a watcher never sees a partial file. Ticks that fall behind
+// (a slow encode, a suspended machine) are dropped rather than bunched up.
+class ScreenshotScheduler {
+ public:
+  // Pixels from the frame source: BGRX rows, valid until its next call or,
+  // when |owner| is set, until the frame is dropped.
+  struct Frame {
+    uint8_t* data = nullptr;
+    int width = 0;
+    int height = 0;
+    int stride = 0;
+    // Keeps |data| valid while held, for sources that lend it out.
+    std::shared_ptr<void> owner;
+  };
+  using FrameSource = std::function<bool(const CaptureTarget& target, Frame*)>;
+
+  struct Options {
+    std::chrono::milliseconds interval{60000};
+    std::string directory;
+    const ScreenshotEncoder* encoder = nullptr;
+    int quality = kDefaultScreenshotQuality;
+    bool active_window_only = false;
+    // Shrink to fit, as takeScreenshot's maxWidth and maxHeight; 0 for no
+    // limit.
+    int max_width = 0;
+    int max_height = 0;
+    bool skip_when_idle = true;
+    bool skip_unchanged = true;
+  };
+
+  // A screenshot that was written, or why one could not be.
+  struct Result {
+    // Empty when |error| is set.
+    std::string path;
+    std::string error;
+    // The encoder's name, which is also the file extension.
+    const char* format = nullptr;
+    int width = 0;
+    int height = 0;
+    size_t size = 0;
+    // Wall clock time of the capture, in milliseconds since the epoch.
+    int64_t timestamp_ms = 0;
+    // Ticks skipped since the previous result.
+    int skipped_idle = 0;
+    int skipped_unchanged = 0;
+  };
+  using ResultCallback = std::function<void(const Result&)>;
+
+  // |source| and |on_result| are invoked on the scheduler thread.
+  ScreenshotScheduler(FrameSource source, ResultCallback on_result);
+  ~ScreenshotScheduler();
+
+  ScreenshotScheduler(const ScreenshotScheduler&) = delete;
+  ScreenshotScheduler& operator=(const ScreenshotScheduler&) = delete;
+
+  // Starts taking screenshots, the first one right away. Restarts with the
+  // new options when already running.
+  void Start(const Options& options);
+  void Stop();
+
+  bool is_running() const { return thread_.joinable(); }
+
+  // Safe to call from any thread.
+  void set_user_active(bool active) { user_active_ = active; }
+  void set_debug(bool enabled) { debug_ = enabled; }
+
+ private:
+  void Run(Options options);
+  void Tick(const Options& options);
+  bool WriteScreenshot(const std::string& path, std::string* error);
+
+  FrameSource source_;
+  ResultCallback on_result_;
+
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  bool stopping_ = false;
+  std::atomic<bool> user_active_{true};
+  std::atomic<bool> debug_{false};
+
+  // Scheduler thread only.
+  bool have_hash_ = false;
+  uint64_t last_hash_ = 0;
+  int skipped_idle_ = 0;
+  int skipped_unchanged_ = 0;
+  std::vector<uint8_t> scaled_;
+  std::vector<uint8_t> encoded_;
+};
+
+}  // namespace window_focus
+
+#endif  // FLUTTER_PLUGIN_WINDOW_FOCUS_SCREENSHOT_SCHEDULER_H_
@@ -0,0 +1,310 @@
+#include "screenshot_worker_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <iterator>
+#include <utility>
+
+#include "image_scaler.h"
+
+namespace window_focus {
+
+namespace {
+
+// Whether |a| and |b| produce the same bytes from the same frame.
+bool SameOutput(const ScreenshotWorkerPool::Request& a,
+                const ScreenshotWorkerPool::Request& b) {
+  if (a.encoder != b.encoder) {
+    return false;
+  }
+  if (a.encoder == nullptr) {
+    return a.pixel_format == b.pixel_format;
+  }
+  return !a.encoder->lossy || a.quality == b.quality;
+}
+
+}  // namespace
+
+ScreenshotWorkerPool::ScreenshotWorkerPool(FrameSourceFactory factory,
+                                           int threads,
+                                           int max_queued,
+                                           CaptureContext* buffers)
+    : factory_(std::move(factory)),
+      max_queued_(static_cast<size_t>(std::max(max_queued, 1))),
+      buffers_(buffers) {
+  for (int i = 0; i < std::max(threads, 1); i++) {
+    threads_.emplace_back(&ScreenshotWorkerPool::Work, this);
+  }
+}
+
+ScreenshotWorkerPool::~ScreenshotWorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_all();
+  CancelAll();
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+bool ScreenshotWorkerPool::Submit(const Request& request, Callback callback) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (stopping_) {
+    return false;
+  }
+  if (request.delta_stream == nullptr) {
+    for (Job* job : capturing_) {
+      if (job->delta_stream == nullptr && job->target == request.target) {
+        job->waiters.push_back(Waiter{request, std::move(callback)});
+        return true;
+      }
+    }
+    for (const std::unique_ptr<Job>& job : queue_) {
+      if (job->delta_stream == nullptr && job->target == request.target) {
+        job->waiters.push_back(Waiter{request, std::move(callback)});
+        return true;
+      }
+    }
+  }
+  if (queue_.size() >= max_queued_) {
+    return false;
+  }
+  std::unique_ptr<Job> job(new Job());
+  job->target = request.target;
+  job->delta_stream = request.delta_stream;
+  job->waiters.push_back(Waiter{request, std::move(callback)});
+  queue_.push_back(std::move(job));
+  wake_.notify_one();
+  return true;
+}
+
+size_t ScreenshotWorkerPool::CancelAll() {
+  std::vector<Waiter> cancelled;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const std::unique_ptr<Job>& job : queue_) {
+      std::move(job->waiters.begin(), job->waiters.end(),
+                std::back_inserter(cancelled));
+    }
+    queue_.clear();
+    for (Job* job : capturing_) {
+      std::move(job->waiters.begin(), job->waiters.end(),
+                std::back_inserter(cancelled));
+      job->waiters.clear();
+    }
+  }
+  for (Waiter& waiter : cancelled) {
+    Result result;
+    result.cancelled = true;
+    waiter.callback(std::move(result));
+  }
+  if (debug_ && !cancelled.empty()) {
+    std::cout << "[WindowFocus] Cancelled " << cancelled.size()
+              << " screenshot requests" << std::endl;
+  }
+  return cancelled.size();
+}
+
+size_t ScreenshotWorkerPool::queued() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return queue_.size();
+}
+
+void ScreenshotWorkerPool::Work() {
+  // Created here so that a source bound to its thread, such as an X11
+  // connection, is only ever used on it.
+  const FrameSource source = factory_();
+  std::vector<uint8_t> scaled;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    std::deque<std::unique_ptr<Job>>::iterator next;
+    wake_.wait(lock, [this, &next]() {
+      if (stopping_) {
+        return true;
+      }
+      next = NextJob();
+      return next != queue_.end();
+    });
+    if (stopping_) {
+      return;
+    }
+    std::unique_ptr<Job> job = std::move(*next);
+    queue_.erase(next);
+    capturing_.push_back(job.get());
+    if (job->delta_stream != nullptr) {
+      running_streams_.push_back(job->delta_stream);
+    }
+    lock.unlock();
+    Run(job.get(), source, &scaled);
+    lock.lock();
+    if (job->delta_stream != nullptr) {
+      running_streams_.erase(std::find(running_streams_.begin(),
+                                       running_streams_.end(),
+                                       job->delta_stream));
+      // The stream's next request may be waiting for this one.
+      wake_.notify_all();
+    }
+  }
+}
+
+std::deque<std::unique_ptr<ScreenshotWorkerPool::Job>>::iterator
+ScreenshotWorkerPool::NextJob() {
+  return std::find_if(
+      queue_.begin(), queue_.end(), [this](const std::unique_ptr<Job>& job) {
+        return job->delta_stream == nullptr ||
+               std::find(running_streams_.begin(), running_streams_.end(),
+                         job->delta_stream) == running_streams_.end();
+      });
+}
+
+void ScreenshotWorkerPool::Run(Job* job,
+                               const FrameSource& source,
+                               std::vector<uint8_t>* scaled) {
+  const auto start = std::chrono::steady_clock::now();
+  ScreenshotScheduler::Frame frame;
+  const bool captured = source(job->target, &frame);
+
+  // Requests arriving from now on need a capture of their own.
+  std::vector<Waiter> waiters;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    capturing_.erase(
+        std::find(capturing_.begin(), capturing_.end(), job));
+    waiters.swap(job->waiters);
+  }
+  if (waiters.empty()) {
+    return;
+  }
+  if (!captured) {
+    for (Waiter& waiter : waiters) {
+      Result result;
+      result.error = "Failed to take screenshot";
+      waiter.callback(std::move(result));
+    }
+    return;
+  }
+
+  const auto captured_time = std::chrono::steady_clock::now();
+  int width = 0;
+  int height = 0;
+  if (FitImageSize(frame.width, frame.height, job->target.max_width,
+                   job->target.max_height, &width, &height)) {
+    scaled->resize(static_cast<size_t>(width) * height * 4);
+    DownscaleBgrxPixels(frame.data, frame.width, frame.height, frame.stride,
+                        scaled->data(), width, height, width * 4,
+                        PixelFormat::kBgra);
+    frame.data = scaled->data();
+    frame.width = width;
+    frame.height = height;
+    frame.stride = width * 4;
+    // The capture can serve someone else while this one is encoded.
+    frame.owner.reset();
+  }
+
+  if (job->delta_stream != nullptr) {
+    // Answered before the stream's next request can start, so its replies
+    // are queued in order.
+    waiters[0].callback(EncodeDelta(waiters[0].request, frame));
+    return;
+  }
+
+  // Each distinct output is produced once; the others are copies of it.
+  std::vector<Result> results(waiters.size());
+  int produced = 0;
+  for (size_t i = 0; i < waiters.size(); i++) {
+    const Request& request = waiters[i].request;
+    size_t same = 0;
+    while (same < i && !SameOutput(waiters[same].request, request)) {
+      same++;
+    }
+    if (same < i) {
+      const std::vector<uint8_t>& data = results[same].data;
+      results[i].width = results[same].width;
+      results[i].height = results[same].height;
+      results[i].stride = results[same].stride;
+      results[i].error = results[same].error;
+      results[i].data = NewBuffer(data.size());
+      results[i].data.assign(data.begin(), data.end());
+      continue;
+    }
+    produced++;
+    Result& result = results[i];
+    result.width = frame.width;
+    result.height = frame.height;
+    if (request.encoder == nullptr) {
+      result.stride = frame.width * 4;
+      const size_t size = static_cast<size_t>(result.stride) * frame.height;
+      result.data = NewBuffer(size);
+      result.data.resize(size);
+      for (int y = 0; y < frame.height; y++) {
+        ConvertBgrxPixels(frame.data + static_cast<size_t>(y) * frame.stride,
+                          result.data.data() +
+                              static_cast<size_t>(y) * result.stride,
+                          frame.width, request.pixel_format);
+      }
+    } else {
+      result.data = NewBuffer(0);
+      if (!request.encoder->encode(frame.data, frame.width, frame.height,
+                                   frame.stride, request.quality,
+                                   &result.data)) {
+        result.error = "Failed to encode screenshot";
+      }
+    }
+  }
+  if (debug_) {
+    const std::chrono::duration<double, std::milli> capture =
+        captured_time - start;
+    const std::chrono::duration<double, std::milli> encode =
+        std::chrono::steady_clock::now() - captured_time;
+    std::cout << "[WindowFocus] Screenshot " << frame.width << "x"
+              << frame.height << " for " << waiters.size()
+              << " requests: capture " << capture.count() << " ms, "
+              << produced << " encodes " << encode.count() << " ms"
+              << std::endl;
+  }
+  for (size_t i = 0; i < waiters.size(); i++) {
+    waiters[i].callback(std::move(results[i]));
+  }
+}
+
+ScreenshotWorkerPool::Result ScreenshotWorkerPool::EncodeDelta(
+    const Request& request,
+    const ScreenshotScheduler::Frame& frame) {
+  const auto start = std::chrono::steady_clock::now();
+  DeltaStream* stream = request.delta_stream;
+  if (stream->encoder == nullptr ||
+      stream->encoder->tile_size() != request.tile_size ||
+      stream->encoder->keyframe_interval() != request.keyframe_interval) {
+    stream->encoder.reset(
+        new ScreenDeltaEncoder(request.tile_size, request.keyframe_interval));
+  }
+  Result result;
+  result.width = frame.width;
+  result.height = frame.height;
+  if (!stream->encoder->Encode(frame.data, frame.width, frame.height,
+                               frame.stride, request.force_keyframe,
+                               &result.delta)) {
+    result.error = "Failed to encode screenshot delta";
+  } else if (debug_) {
+    const std::chrono::duration<double, std::milli> encode =
+        std::chrono::steady_clock::now() - start;
+    std::cout << "[WindowFocus] Screenshot delta " << result.delta.sequence
+              << ": " << result.delta.tiles.size() << " tiles"
+              << (result.delta.keyframe ? " (keyframe)" : "") << ", encode "
+              << encode.count() << " ms, " << result.delta.data.size()
+              << " bytes" << std::endl;
+  }
+  return result;
+}
+
+std::vector<uint8_t> ScreenshotWorkerPool::NewBuffer(size_t capacity) {
+  if (buffers_ == nullptr) {
+    return std::vector<uint8_t>();
+  }
+  return buffers_->AcquireBuffer(capacity);
+}
+
+}  // namespace window_focus
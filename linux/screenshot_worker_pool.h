@@ -0,0 +1,167 @@
+#ifndef FLUTTER_PLUGIN_WINDOW_FOCUS_SCREENSHOT_WORKER_POOL_H_
+#define FLUTTER_PLUGIN_WINDOW_FOCUS_SCREENSHOT_WORKER_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "capture_context.h"
+#include "capture_target.h"
+#include "pixel_format.h"
+#include "screen_delta.h"
+#include "screenshot_encoder.h"
+#include "screenshot_scheduler.h"
+
+namespace window_focus {
+
+// Workers takeScreenshot runs on.
+constexpr int kScreenshotWorkers = 2;
+// Captures that may wait for a worker before takeScreenshot is refused.
+constexpr int kMaxQueuedScreenshots = 8;
+
+// Takes screenshots on a few threads of its own, so capturing and encoding
+// never block the platform thread.
+//
+// Requests for the same target that are waiting or being captured together
+// share one capture, and each distinct encoding among them is produced
+// once. At most |max_queued| captures wait for a worker; more requests are
+// refused rather than queued without bound.
+//
+// Delta requests, which diff the frame against the previous one of their
+// DeltaStream, get a capture of their own. A stream's requests run one at a
+// time in the order they were submitted, so its sequence numbers follow
+// that order.
+class ScreenshotWorkerPool {
+ public:
+  using FrameSource = ScreenshotScheduler::FrameSource;
+  // Called once on each worker thread, which then owns the source.
+  using FrameSourceFactory = std::function<FrameSource()>;
+
+  // What is captured, shrunk to fit the size limit (0 for none).
+  struct Target : CaptureTarget {
+    int max_width = 0;
+    int max_height = 0;
+
+    bool operator==(const Target& other) const {
+      return CaptureTarget::operator==(other) &&
+             max_width == other.max_width && max_height == other.max_height;
+    }
+  };
+
+  // What takeScreenshotDelta keeps between calls. Only the worker running
+  // one of the stream's requests uses it.
+  struct DeltaStream {
+    // Created by the first request and replaced when its tile size or
+    // keyframe interval changes.
+    std::unique_ptr<ScreenDeltaEncoder> encoder;
+  };
+
+  struct Request {
+    Target target;
+    // Null for raw |pixel_format| pixels.
+    const ScreenshotEncoder* encoder = nullptr;
+    int quality = kDefaultScreenshotQuality;
+    PixelFormat pixel_format = PixelFormat::kBgra;
+    // Set for a delta of this stream instead of an image; it must outlive
+    // the pool.
+    DeltaStream* delta_stream = nullptr;
+    int tile_size = kDefaultDeltaTileSize;
+    int keyframe_interval = kDefaultDeltaKeyframeInterval;
+    bool force_keyframe = false;
+  };
+
+  struct Result {
+    // Set when the capture or the encoding failed.
+    std::string error;
+    // Set when CancelAll completed the request instead.
+    bool cancelled = false;
+    int width = 0;
+    int height = 0;
+    // Bytes per row of raw pixels.
+    int stride = 0;
+    // The encoded image or the pixels.
+    std::vector<uint8_t> data;
+    // The answer to a delta request.
+    ScreenDelta delta;
+  };
+
+  // Called exactly once per accepted request, on a worker thread, or on the
+  // thread calling CancelAll or the destructor.
+  using Callback = std::function<void(Result result)>;
+
+  // Results are written into buffers from |buffers| when given, which
+  // callers may give back once done with them.
+  ScreenshotWorkerPool(FrameSourceFactory factory,
+                       int threads = kScreenshotWorkers,
+                       int max_queued = kMaxQueuedScreenshots,
+                       CaptureContext* buffers = nullptr);
+  // Cancels the requests still waiting and waits for the workers.
+  ~ScreenshotWorkerPool();
+
+  ScreenshotWorkerPool(const ScreenshotWorkerPool&) = delete;
+  ScreenshotWorkerPool& operator=(const ScreenshotWorkerPool&) = delete;
+
+  // Queues |request|, or joins a capture of the same target that has not
+  // been taken yet. Returns false, without calling |callback|, when the
+  // queue is full.
+  bool Submit(const Request& request, Callback callback);
+
+  // Completes every request not answered yet as cancelled. Captures already
+  // running finish, but their results are dropped. Returns how many
+  // requests were cancelled.
+  size_t CancelAll();
+
+  // Captures waiting for a worker.
+  size_t queued() const;
+
+  void set_debug(bool debug) { debug_ = debug; }
+
+ private:
+  struct Waiter {
+    Request request;
+    Callback callback;
+  };
+  struct Job {
+    Target target;
+    // Set for a delta request, the job's only waiter.
+    DeltaStream* delta_stream = nullptr;
+    std::vector<Waiter> waiters;
+  };
+
+  void Work();
+  // The first queued job that can start: any but those of a delta stream
+  // already running. Called with |mutex_| held.
+  std::deque<std::unique_ptr<Job>>::iterator NextJob();
+  // Diffs |frame| against the previous frame of |request|'s stream.
+  Result EncodeDelta(const Request& request,
+                     const ScreenshotScheduler::Frame& frame);
+  // |scaled| is the worker's own, kept across jobs.
+  void Run(Job* job, const FrameSource& source, std::vector<uint8_t>* scaled);
+  std::vector<uint8_t> NewBuffer(size_t capacity);
+
+  const FrameSourceFactory factory_;
+  const size_t max_queued_;
+  CaptureContext* const buffers_;
+  mutable std::mutex mutex_;
+  std::condition_variable wake_;
+  std::deque<std::unique_ptr<Job>> queue_;
+  // Jobs whose capture is running; requests can still join them.
+  std::vector<Job*> capturing_;
+  // Delta streams with a job on a worker.
+  std::vector<DeltaStream*> running_streams_;
+  bool stopping_ = false;
+  std::vector<std::thread> threads_;
+  std::atomic<bool> debug_{false};
+};
+
+}  // namespace window_focus
+
+#endif  // FLUTTER_PLUGIN_WINDOW_FOCUS_SCREENSHOT_WORKER_POOL_H_
@@ -2,9 +2,82 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include <signal.h>
+#include <sys/socket.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "activity_tracker.h"
+#include "audio_activity_detector.h"
+#include "capture_context.h"
+#include "capture_target.h"
+#include "device_reactor.h"
+#include "evdev_gamepad_filter.h"
+#include "evdev_gamepad_monitor.h"
+#include "hid_report_descriptor.h"
+#include "hid_report_filter.h"
+#include "hidraw_monitor.h"
+#include "image_scaler.h"
 #include "include/window_focus/window_focus_plugin.h"
+#include "media_session_monitor.h"
+#include "pixel_format.h"
+#include "png_encoder.h"
+#include "screen_delta.h"
+#include "screenshot_encoder.h"
+#include "screenshot_ring.h"
+#include "screenshot_scheduler.h"
+#include "screenshot_worker_pool.h"
 #include "window_focus_plugin_private.h"
 
+#ifdef WINDOW_FOCUS_HAVE_LIBJPEG
+#include <jpeglib.h>
+#endif
+#ifdef WINDOW_FOCUS_HAVE_PULSEAUDIO_SIMPLE
+#include <pulse/simple.h>
+
+#include "pulse_audio_monitor.h"
+#endif
+#ifdef WINDOW_FOCUS_HAVE_WAYLAND
+#include "wayland_idle_monitor.h"
+#endif
+#ifdef WINDOW_FOCUS_HAVE_XINPUT2
+#include "xinput2_monitor.h"
+#ifdef WINDOW_FOCUS_HAVE_XTEST
+#include <X11/Xlib.h>
+#include <X11/extensions/XTest.h>
+#include <X11/keysym.h>
+#endif
+#endif
+#ifdef WINDOW_FOCUS_HAVE_XSHM
+#include <X11/Xatom.h>
+#include <X11/Xlib.h>
+#ifdef WINDOW_FOCUS_HAVE_XRANDR
+#include <X11/extensions/Xrandr.h>
+#endif
+
+#include "xshm_capture.h"
+#endif
+
 // This demonstrates a simple unit test of the C portion of this plugin's
 // implementation.
 //
@@ -13,9 +86,67 @@
 // built for x64 debug, run:
 // $ build/linux/x64/debug/plugins/my_plugin/my_plugin_test
 
+// Counts heap allocations made by the current thread while enabled, for
+// checking that hot paths stay off the heap. The deletes are kept out of
+// line so GCC does not pair the inlined free() with operator new.
+namespace {
+thread_local bool g_count_allocations = false;
+thread_local size_t g_allocation_count = 0;
+}  // namespace
+
+void* operator new(size_t size) {
+  if (g_count_allocations) {
+    g_allocation_count++;
+  }
+  void* memory = malloc(size == 0 ? 1 : size);
+  if (memory == nullptr) {
+    throw std::bad_alloc();
+  }
+  return memory;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+__attribute__((noinline)) void operator delete(void* memory) noexcept {
+  free(memory);
+}
+
+__attribute__((noinline)) void operator delete[](void* memory) noexcept {
+  free(memory);
+}
+
+__attribute__((noinline)) void operator delete(void* memory, size_t) noexcept {
+  free(memory);
+}
+
+__attribute__((noinline)) void operator delete[](void* memory, size_t) noexcept {
+  free(memory);
+}
+
 namespace window_focus {
 namespace test {
 
+namespace {
+
+// Iterates the default main context until |done| holds or |timeout_ms|
+// elapses. Returns whether |done| was reached.
+bool RunMainContextUntil(const std::function<bool()>& done, int timeout_ms) {
+  const gint64 deadline = g_get_monotonic_time() + timeout_ms * 1000;
+  while (!done()) {
+    if (g_get_monotonic_time() > deadline) {
+      return false;
+    }
+    if (!g_main_context_iteration(nullptr, FALSE)) {
+      g_usleep(1000);
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
 TEST(WindowFocusPlugin, GetPlatformVersion) {
   g_autoptr(FlMethodResponse) response = get_platform_version();
   ASSERT_NE(response, nullptr);
@@ -27,5 +158,3000 @@ TEST(WindowFocusPlugin, GetPlatformVersion) {
   EXPECT_THAT(fl_value_get_string(result), testing::StartsWith("Linux "));
 }
 
+TEST(ActivityTracker, ReportsInactivityAndActivityFromAnyThread) {
+  std::vector<bool> states;
+  ActivityTracker tracker([&states](bool active) { states.push_back(active); });
+  tracker.SetInactivityThreshold(50);
+
+  ASSERT_TRUE(RunMainContextUntil([&] { return states.size() == 1; }, 2000));
+  EXPECT_FALSE(states.back());
+  EXPECT_FALSE(tracker.user_is_active());
+
+  std::thread([&tracker] { tracker.RecordActivity(); }).join();
+  ASSERT_TRUE(RunMainContextUntil([&] { return states.size() == 2; }, 2000));
+  EXPECT_TRUE(states.back());
+}
+
+TEST(ActivityTracker, BusyInputSourceKeepsUserActive) {
+  std::vector<bool> states;
+  ActivityTracker tracker([&states](bool active) { states.push_back(active); });
+  tracker.SetInactivityThreshold(20);
+  tracker.SetInputIdleSource(true);
+
+  RunMainContextUntil([] { return false; }, 100);
+  EXPECT_TRUE(states.empty());
+
+  tracker.SetInputIdle(true);
+  ASSERT_TRUE(RunMainContextUntil([&] { return states.size() == 1; }, 2000));
+  EXPECT_FALSE(states.back());
+
+  tracker.SetInputIdle(false);
+  ASSERT_EQ(states.size(), 2u);
+  EXPECT_TRUE(states.back());
+}
+
+TEST(ActivityTracker, MediaKeepsUserActiveUntilItEnds) {
+  std::vector<bool> states;
+  ActivityTracker tracker([&states](bool active) { states.push_back(active); });
+  tracker.SetInactivityThreshold(50);
+  tracker.SetMediaActive(true);
+
+  RunMainContextUntil([] { return false; }, 150);
+  EXPECT_TRUE(states.empty());
+
+  // The timeout starts when playback ends.
+  tracker.SetMediaActive(false);
+  RunMainContextUntil([] { return false; }, 20);
+  EXPECT_TRUE(states.empty());
+  ASSERT_TRUE(RunMainContextUntil([&] { return states.size() == 1; }, 2000));
+  EXPECT_FALSE(states.back());
+}
+
+#ifdef WINDOW_FOCUS_HAVE_WAYLAND
+// Needs a compositor without input devices, for example:
+// $ weston --backend=headless --socket=window-focus-test &
+// $ WINDOW_FOCUS_TEST_WAYLAND_DISPLAY=window-focus-test window_focus_test
+TEST(WaylandIdleMonitor, HeadlessCompositorReportsIdle) {
+  const gchar* display = g_getenv("WINDOW_FOCUS_TEST_WAYLAND_DISPLAY");
+  if (display == nullptr) {
+    GTEST_SKIP() << "WINDOW_FOCUS_TEST_WAYLAND_DISPLAY is not set";
+  }
+
+  bool idle = false;
+  WaylandIdleMonitor monitor([&idle] { idle = true; },
+                             [&idle] { idle = false; });
+  if (!monitor.Start(display, 100)) {
+    GTEST_SKIP() << "Compositor has no idle notification protocol";
+  }
+  EXPECT_TRUE(RunMainContextUntil([&] { return idle; }, 5000))
+      << "No idle notification via " << monitor.protocol_name();
+}
+#endif
+
+#ifdef WINDOW_FOCUS_HAVE_XINPUT2
+// Runs against any X server, e.g. `Xvfb :99 &` and DISPLAY=:99.
+TEST(XInput2Monitor, StartsAndStopsReactor) {
+  if (g_getenv("DISPLAY") == nullptr) {
+    GTEST_SKIP() << "DISPLAY is not set";
+  }
+
+  XInput2Monitor monitor([] {});
+  ASSERT_TRUE(monitor.Start(nullptr));
+  EXPECT_TRUE(monitor.is_running());
+  monitor.Stop();
+  EXPECT_FALSE(monitor.is_running());
+}
+
+#ifdef WINDOW_FOCUS_HAVE_XTEST
+// XTest input goes through the server's XTEST devices, so it arrives as raw
+// events like real input does.
+TEST(XInput2Monitor, ReportsRawInput) {
+  Display* display = XOpenDisplay(nullptr);
+  if (display == nullptr) {
+    GTEST_SKIP() << "No X server";
+  }
+  int event_base = 0;
+  int error_base = 0;
+  int major = 0;
+  int minor = 0;
+  if (!XTestQueryExtension(display, &event_base, &error_base, &major,
+                           &minor)) {
+    XCloseDisplay(display);
+    GTEST_SKIP() << "No XTEST extension";
+  }
+
+  std::atomic<int> reports{0};
+  XInput2Monitor monitor([&reports] { reports++; });
+  ASSERT_TRUE(monitor.Start(nullptr));
+
+  XTestFakeRelativeMotionEvent(display, 5, 5, CurrentTime);
+  XSync(display, False);
+  for (int i = 0; i < 100 && reports == 0; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(reports, 1);
+
+  // Input within the coalescing window is reported once, after it.
+  XTestFakeButtonEvent(display, 1, True, CurrentTime);
+  XTestFakeButtonEvent(display, 1, False, CurrentTime);
+  XTestFakeKeyEvent(display, XKeysymToKeycode(display, XK_a), True,
+                    CurrentTime);
+  XTestFakeKeyEvent(display, XKeysymToKeycode(display, XK_a), False,
+                    CurrentTime);
+  XSync(display, False);
+  std::this_thread::sleep_for(XInput2Monitor::kCoalesceWindow * 3);
+  EXPECT_EQ(reports, 2);
+
+  monitor.Stop();
+  XCloseDisplay(display);
+}
+#endif
+#endif
+
+#ifdef WINDOW_FOCUS_HAVE_XSHM
+// Runs against any X server; the timing printed is meant for a 4K one:
+// $ Xvfb :99 -screen 0 3840x2160x24 &
+// $ DISPLAY=:99 window_focus_test --gtest_filter='XShmCapture.*'
+TEST(XShmCapture, CapturesScreenAndActiveWindow) {
+  Display* display = XOpenDisplay(nullptr);
+  if (display == nullptr) {
+    GTEST_SKIP() << "No X server";
+  }
+  const Window root = DefaultRootWindow(display);
+  const int screen_width = DisplayWidth(display, DefaultScreen(display));
+  const int screen_height = DisplayHeight(display, DefaultScreen(display));
+
+  // A solid window that is also announced as the active one, as a window
+  // manager would.
+  const Window window = XCreateSimpleWindow(display, root, 100, 50, 320, 200,
+                                            0, 0, 0x336699);
+  XMapRaised(display, window);
+  const Atom active = XInternAtom(display, "_NET_ACTIVE_WINDOW", False);
+  XChangeProperty(display, root, active, XA_WINDOW, 32, PropModeReplace,
+                  reinterpret_cast<const unsigned char*>(&window), 1);
+  XSync(display, False);
+
+  XShmCapture capture;
+  ASSERT_TRUE(capture.Open(nullptr));
+  auto pixel = [](const XShmCapture::Frame& frame, int x, int y) {
+    const uint8_t* p = frame.data + y * frame.stride + x * 4;
+    return static_cast<uint32_t>(p[2] << 16 | p[1] << 8 | p[0]);
+  };
+
+  XShmCapture::Frame frame;
+  ASSERT_TRUE(capture.Capture(false, &frame));
+  EXPECT_EQ(frame.width, screen_width);
+  EXPECT_EQ(frame.height, screen_height);
+  EXPECT_EQ(pixel(frame, 150, 100), 0x336699u);
+
+  ASSERT_TRUE(capture.Capture(true, &frame));
+  EXPECT_EQ(frame.width, 320);
+  EXPECT_EQ(frame.height, 200);
+  EXPECT_EQ(frame.stride, 320 * 4);
+  EXPECT_EQ(pixel(frame, 0, 0), 0x336699u);
+  EXPECT_EQ(pixel(frame, 319, 199), 0x336699u);
+
+  // Half off screen is clipped rather than rejected by the server.
+  XMoveWindow(display, window, screen_width - 120, 10);
+  XSync(display, False);
+  ASSERT_TRUE(capture.Capture(true, &frame));
+  EXPECT_EQ(frame.width, 120);
+  EXPECT_EQ(frame.height, 200);
+
+  // Without an active window the whole screen is captured.
+  XDestroyWindow(display, window);
+  XSync(display, False);
+  ASSERT_TRUE(capture.Capture(true, &frame));
+  EXPECT_EQ(frame.width, screen_width);
+
+  constexpr int kFrames = 30;
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kFrames; i++) {
+    ASSERT_TRUE(capture.Capture(false, &frame));
+  }
+  const std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::cout << "[XShmCapture] " << screen_width << "x" << screen_height
+            << " in " << elapsed.count() / kFrames << " ms per frame ("
+            << (capture.uses_shm() ? "MIT-SHM" : "XGetImage") << ")"
+            << std::endl;
+
+  XDeleteProperty(display, root, active);
+  XCloseDisplay(display);
+}
+
+// With XRandR the screen is split into two monitors, as a dual-head setup
+// reports them; without it the screen is the only monitor:
+// $ Xvfb :99 -screen 0 3840x1080x24 &
+// $ DISPLAY=:99 window_focus_test --gtest_filter='XShmCapture.*'
+TEST(XShmCapture, CapturesOneMonitor) {
+  Display* display = XOpenDisplay(nullptr);
+  if (display == nullptr) {
+    GTEST_SKIP() << "No X server";
+  }
+  const Window root = DefaultRootWindow(display);
+  const int screen_width = DisplayWidth(display, DefaultScreen(display));
+  const int screen_height = DisplayHeight(display, DefaultScreen(display));
+  const int half = screen_width / 2;
+
+  // The right half is solid.
+  const Window window = XCreateSimpleWindow(
+      display, root, half, 0, screen_width - half, screen_height, 0, 0,
+      0x336699);
+  XMapRaised(display, window);
+#ifdef WINDOW_FOCUS_HAVE_XRANDR
+  const Atom names[] = {XInternAtom(display, "WINDOW_FOCUS_LEFT", False),
+                        XInternAtom(display, "WINDOW_FOCUS_RIGHT", False)};
+  XRRMonitorInfo* info = XRRAllocateMonitor(display, 0);
+  for (int i = 0; i < 2; i++) {
+    info->name = names[i];
+    info->primary = i == 0;
+    info->x = i * half;
+    info->y = 0;
+    info->width = half;
+    info->height = screen_height;
+    info->mwidth = half / 4;
+    info->mheight = screen_height / 4;
+    XRRSetMonitor(display, root, info);
+  }
+  XFree(info);
+  const std::string expected_name = "WINDOW_FOCUS_RIGHT";
+  const int expected_x = half;
+#else
+  const std::string expected_name = "default";
+  const int expected_x = 0;
+#endif
+  XSync(display, False);
+
+  XShmCapture capture;
+  ASSERT_TRUE(capture.Open(nullptr));
+  EXPECT_GT(capture.scale(), 0.0);
+  const std::vector<XShmCapture::Monitor> monitors = capture.ListMonitors();
+  CaptureTarget target;
+  for (size_t i = 0; i < monitors.size(); i++) {
+    if (monitors[i].name == expected_name) {
+      target.monitor = static_cast<int>(i);
+    }
+  }
+  ASSERT_GE(target.monitor, 0);
+  const XShmCapture::Monitor& monitor = monitors[target.monitor];
+  EXPECT_EQ(monitor.x, expected_x);
+  EXPECT_EQ(monitor.y, 0);
+  EXPECT_EQ(monitor.height, screen_height);
+
+  XShmCapture::Frame frame;
+  ASSERT_TRUE(capture.Capture(target, &frame));
+  EXPECT_EQ(frame.width, monitor.width);
+  EXPECT_EQ(frame.height, screen_height);
+  const uint8_t* last = frame.data + (frame.height - 1) * frame.stride +
+                        (frame.width - 1) * 4;
+  EXPECT_EQ(static_cast<uint32_t>(last[2] << 16 | last[1] << 8 | last[0]),
+            0x336699u);
+
+  target.monitor = static_cast<int>(monitors.size());
+  EXPECT_FALSE(capture.Capture(target, &frame));
+
+#ifdef WINDOW_FOCUS_HAVE_XRANDR
+  for (const Atom name : names) {
+    XRRDeleteMonitor(display, root, name);
+  }
+#endif
+  XDestroyWindow(display, window);
+  XCloseDisplay(display);
+}
+
+TEST(XShmCapture, CapturesRegionAndWindow) {
+  Display* display = XOpenDisplay(nullptr);
+  if (display == nullptr) {
+    GTEST_SKIP() << "No X server";
+  }
+  const Window root = DefaultRootWindow(display);
+  const int screen_width = DisplayWidth(display, DefaultScreen(display));
+  const int screen_height = DisplayHeight(display, DefaultScreen(display));
+
+  // A solid window with a border of another color.
+  const Window window = XCreateSimpleWindow(display, root, 10, 20, 64, 48, 2,
+                                            0x112233, 0x336699);
+  XMapRaised(display, window);
+  XSync(display, False);
+
+  XShmCapture capture;
+  ASSERT_TRUE(capture.Open(nullptr));
+  XShmCapture::Frame frame;
+  CaptureTarget target;
+  target.x = 20;
+  target.y = 30;
+  target.width = 16;
+  target.height = 8;
+  ASSERT_TRUE(capture.Capture(target, &frame));
+  EXPECT_EQ(frame.width, 16);
+  EXPECT_EQ(frame.height, 8);
+  EXPECT_EQ(static_cast<uint32_t>(frame.data[2] << 16 | frame.data[1] << 8 |
+                                  frame.data[0]),
+            0x336699u);
+
+  // Clipped to the screen, and nothing left of it fails.
+  target.x = screen_width - 4;
+  ASSERT_TRUE(capture.Capture(target, &frame));
+  EXPECT_EQ(frame.width, 4);
+  target.x = screen_width;
+  EXPECT_FALSE(capture.Capture(target, &frame));
+  target.y = screen_height;
+  EXPECT_FALSE(capture.Capture(target, &frame));
+
+  target = CaptureTarget();
+  target.window = window;
+  ASSERT_TRUE(capture.Capture(target, &frame));
+  EXPECT_EQ(frame.width, 68);
+  EXPECT_EQ(frame.height, 52);
+  EXPECT_EQ(static_cast<uint32_t>(frame.data[2] << 16 | frame.data[1] << 8 |
+                                  frame.data[0]),
+            0x112233u);
+  target.client_area_only = true;
+  ASSERT_TRUE(capture.Capture(target, &frame));
+  EXPECT_EQ(frame.width, 64);
+  EXPECT_EQ(frame.height, 48);
+  EXPECT_EQ(static_cast<uint32_t>(frame.data[2] << 16 | frame.data[1] << 8 |
+                                  frame.data[0]),
+            0x336699u);
+
+  XDestroyWindow(display, window);
+  XSync(display, False);
+  EXPECT_FALSE(capture.Capture(target, &frame));
+  XCloseDisplay(display);
+}
+
+// Captures on several threads trap their errors at the same time, each on
+// its own connection.
+TEST(XShmCapture, TrapsErrorsOnSeveralThreads) {
+  Display* display = XOpenDisplay(nullptr);
+  if (display == nullptr) {
+    GTEST_SKIP() << "No X server";
+  }
+  const Window window = XCreateSimpleWindow(
+      display, DefaultRootWindow(display), 0, 0, 8, 8, 0, 0, 0);
+  XDestroyWindow(display, window);
+  XSync(display, False);
+
+  std::atomic<int> failures{0};
+  std::atomic<int> captures{0};
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; i++) {
+    threads.emplace_back([&]() {
+      XShmCapture capture;
+      if (!capture.Open(nullptr)) {
+        return;
+      }
+      XShmCapture::Frame frame;
+      CaptureTarget gone;
+      gone.window = window;
+      CaptureTarget region;
+      region.width = 8;
+      region.height = 8;
+      for (int j = 0; j < 20; j++) {
+        if (!capture.Capture(gone, &frame)) {
+          failures++;
+        }
+        if (capture.Capture(region, &frame)) {
+          captures++;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(failures.load(), 80);
+  EXPECT_EQ(captures.load(), 80);
+
+  XCloseDisplay(display);
+}
+#endif
+
+TEST(HidReportDescriptor, AcceptsGamepad) {
+  const uint8_t descriptor[] = {
+      0x05, 0x01, 0x09, 0x05, 0xA1, 0x01,  // Generic Desktop / Game Pad
+      0x05, 0x09, 0x19, 0x01, 0x29, 0x10, 0x15, 0x00, 0x25, 0x01,
+      0x75, 0x01, 0x95, 0x10, 0x81, 0x02,  // 16 buttons
+      0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x15, 0x81, 0x25, 0x7F,
+      0x75, 0x08, 0x95, 0x02, 0x81, 0x02,  // X, Y
+      0xC0,
+  };
+  HidReportDescriptor parsed;
+  ASSERT_TRUE(
+      ParseHidReportDescriptor(descriptor, sizeof(descriptor), &parsed));
+
+  ASSERT_EQ(parsed.collections.size(), 1u);
+  EXPECT_EQ(parsed.collections[0].usage_page, 0x01);
+  EXPECT_EQ(parsed.collections[0].usage, 0x05);
+  EXPECT_FALSE(parsed.uses_report_ids);
+  ASSERT_EQ(parsed.input_reports.size(), 1u);
+  EXPECT_EQ(parsed.input_reports[0].byte_length(), 4u);
+  EXPECT_FALSE(IsExcludedHidUsage(0x01, 0x05));
+
+  // Buttons are not axes; X and Y follow them.
+  const std::vector<HidAxisField>& axes = parsed.input_reports[0].axes;
+  ASSERT_EQ(axes.size(), 2u);
+  EXPECT_EQ(axes[0].bit_offset, 16u);
+  EXPECT_EQ(axes[1].bit_offset, 24u);
+  EXPECT_EQ(axes[0].bit_size, 8u);
+  EXPECT_EQ(axes[0].logical_min, -127);
+  EXPECT_EQ(axes[0].logical_max, 127);
+}
+
+TEST(HidReportDescriptor, ExcludesKeyboardAndConsumerReports) {
+  const uint8_t descriptor[] = {
+      0x05, 0x01, 0x09, 0x06, 0xA1, 0x01, 0x85, 0x01,  // Keyboard, ID 1
+      0x05, 0x07, 0x19, 0xE0, 0x29, 0xE7, 0x15, 0x00, 0x25, 0x01,
+      0x75, 0x01, 0x95, 0x08, 0x81, 0x02,  // Modifiers
+      0x95, 0x06, 0x75, 0x08, 0x26, 0xFF, 0x00, 0x19, 0x00, 0x29, 0xFF,
+      0x81, 0x00,  // Key array
+      0xC0,
+      0x05, 0x0C, 0x09, 0x01, 0xA1, 0x01, 0x85, 0x02,  // Consumer, ID 2
+      0x15, 0x00, 0x26, 0xFF, 0x03, 0x75, 0x10, 0x95, 0x01,
+      0x19, 0x00, 0x2A, 0xFF, 0x03, 0x81, 0x00,
+      0xC0,
+  };
+  HidReportDescriptor parsed;
+  ASSERT_TRUE(
+      ParseHidReportDescriptor(descriptor, sizeof(descriptor), &parsed));
+
+  ASSERT_EQ(parsed.collections.size(), 2u);
+  EXPECT_TRUE(parsed.uses_report_ids);
+
+  const HidInputReport* keyboard = parsed.FindInputReport(1);
+  ASSERT_NE(keyboard, nullptr);
+  EXPECT_EQ(keyboard->byte_length(), 7u);
+  const HidTopLevelCollection& keyboard_collection =
+      parsed.collections[keyboard->collection];
+  EXPECT_STREQ(HidExclusionReason(keyboard_collection.usage_page,
+                                  keyboard_collection.usage),
+               "keyboard");
+
+  const HidInputReport* consumer = parsed.FindInputReport(2);
+  ASSERT_NE(consumer, nullptr);
+  EXPECT_EQ(consumer->byte_length(), 2u);
+  const HidTopLevelCollection& consumer_collection =
+      parsed.collections[consumer->collection];
+  EXPECT_STREQ(HidExclusionReason(consumer_collection.usage_page,
+                                  consumer_collection.usage),
+               "audio");
+}
+
+TEST(DeviceInventory, ReportsTheCountersOfEachDevice) {
+  InputDeviceInfo pad;
+  pad.path = "/dev/input/event7";
+  pad.name = "Pad";
+  InputDeviceInfo wheel;
+  wheel.path = "/dev/input/event9";
+  auto pad_stats = std::make_shared<InputDeviceStats>();
+  auto wheel_stats = std::make_shared<InputDeviceStats>();
+
+  DeviceInventory inventory;
+  inventory.Add(pad, pad_stats);
+  inventory.Add(wheel, wheel_stats);
+  std::vector<InputDeviceInfo> devices = inventory.Get();
+  ASSERT_EQ(devices.size(), 2u);
+  EXPECT_EQ(devices[0].event_count, 0u);
+  EXPECT_EQ(devices[0].last_activity_ms, 0);
+
+  const int64_t before_ms =
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::system_clock::now().time_since_epoch())
+          .count();
+  pad_stats->RecordInput();
+  pad_stats->RecordInput();
+  devices = inventory.Get();
+  ASSERT_EQ(devices.size(), 2u);
+  EXPECT_EQ(devices[0].name, "Pad");
+  EXPECT_EQ(devices[0].event_count, 2u);
+  EXPECT_GE(devices[0].last_activity_ms, before_ms);
+  EXPECT_EQ(devices[1].event_count, 0u);
+
+  inventory.Remove(pad.path);
+  devices = inventory.Get();
+  ASSERT_EQ(devices.size(), 1u);
+  EXPECT_EQ(devices[0].path, wheel.path);
+}
+
+TEST(HidrawMonitor, StartsOnEmptyDeviceDirectory) {
+  char dev_dir[] = "/tmp/window_focus_hidrawXXXXXX";
+  ASSERT_NE(mkdtemp(dev_dir), nullptr);
+
+  HidrawMonitor monitor([]() {});
+  ASSERT_TRUE(monitor.Start(dev_dir));
+  EXPECT_TRUE(monitor.is_running());
+  EXPECT_EQ(monitor.device_count(), 0u);
+  EXPECT_TRUE(monitor.GetDevices().empty());
+  monitor.Stop();
+  EXPECT_FALSE(monitor.is_running());
+
+  rmdir(dev_dir);
+}
+
+TEST(HidrawMonitor, ProbesNodesInBackground) {
+  char dev_dir[] = "/tmp/window_focus_hidrawXXXXXX";
+  ASSERT_NE(mkdtemp(dev_dir), nullptr);
+  // Regular files open fine but fail the hidraw ioctls, so every node is
+  // probed and rejected by the workers.
+  std::vector<std::string> nodes;
+  for (int i = 0; i < 16; i++) {
+    nodes.push_back(std::string(dev_dir) + "/hidraw" + std::to_string(i));
+    FILE* node = fopen(nodes.back().c_str(), "w");
+    ASSERT_NE(node, nullptr);
+    fclose(node);
+  }
+
+  HidrawMonitor monitor([]() {});
+  ASSERT_TRUE(monitor.Start(dev_dir));
+  EXPECT_TRUE(monitor.is_running());
+  monitor.Stop();
+  EXPECT_FALSE(monitor.is_running());
+  EXPECT_EQ(monitor.device_count(), 0u);
+
+  for (const auto& node : nodes) {
+    unlink(node.c_str());
+  }
+  rmdir(dev_dir);
+}
+
+// The gamepad of HidReportDescriptor.AcceptsGamepad: 16 buttons, X and Y.
+HidReportDescriptor GamepadDescriptor() {
+  const uint8_t descriptor[] = {
+      0x05, 0x01, 0x09, 0x05, 0xA1, 0x01,  // Generic Desktop / Game Pad
+      0x05, 0x09, 0x19, 0x01, 0x29, 0x10, 0x15, 0x00, 0x25, 0x01,
+      0x75, 0x01, 0x95, 0x10, 0x81, 0x02,  // 16 buttons
+      0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x15, 0x81, 0x25, 0x7F,
+      0x75, 0x08, 0x95, 0x02, 0x81, 0x02,  // X, Y
+      0xC0,
+  };
+  HidReportDescriptor parsed;
+  ParseHidReportDescriptor(descriptor, sizeof(descriptor), &parsed);
+  return parsed;
+}
+
+// Waits up to a second for |condition|.
+bool WaitFor(const std::function<bool()>& condition) {
+  for (int i = 0; i < 100 && !condition(); i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return condition();
+}
+
+TEST(HidrawMonitor, WatchesOtherDirectoriesWithInotify) {
+  char dev_dir[] = "/tmp/window_focus_hidrawXXXXXX";
+  ASSERT_NE(mkdtemp(dev_dir), nullptr);
+  const std::string node = std::string(dev_dir) + "/hidraw0";
+  FILE* file = fopen(node.c_str(), "w");
+  ASSERT_NE(file, nullptr);
+  fclose(file);
+
+  std::mutex mutex;
+  std::vector<std::pair<bool, std::string>> changes;
+  HidrawMonitor monitor([]() {});
+  monitor.set_device_change_callback(
+      [&](bool added, const HidrawMonitor::DeviceInfo& info) {
+        std::lock_guard<std::mutex> lock(mutex);
+        changes.emplace_back(added, info.path);
+      });
+  // udev only knows /dev, so even with its daemon running a directory of
+  // its own is watched with inotify.
+  ASSERT_TRUE(monitor.Start(dev_dir));
+  EXPECT_EQ(monitor.hotplug_source(), HidrawMonitor::HotplugSource::kInotify);
+
+  // The regular file fails the hidraw ioctls, so it is adopted as the node
+  // instead. Deleting it goes through inotify.
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds), 0);
+  monitor.AdoptDevice(fds[0], node, GamepadDescriptor());
+  EXPECT_TRUE(WaitFor([&] { return monitor.device_count() == 1; }));
+  unlink(node.c_str());
+  EXPECT_TRUE(WaitFor([&] { return monitor.device_count() == 0; }));
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    ASSERT_EQ(changes.size(), 1u);
+    EXPECT_FALSE(changes[0].first);
+    EXPECT_EQ(changes[0].second, node);
+  }
+
+  monitor.Stop();
+  close(fds[1]);
+  rmdir(dev_dir);
+}
+
+TEST(HidrawMonitor, ReadsReportsThroughTheJitterFilter) {
+  char dev_dir[] = "/tmp/window_focus_hidrawXXXXXX";
+  ASSERT_NE(mkdtemp(dev_dir), nullptr);
+
+  std::atomic<int> activity{0};
+  HidrawMonitor monitor([&activity]() { activity++; });
+  ASSERT_TRUE(monitor.Start(dev_dir));
+  // A datagram socket keeps report boundaries, like a hidraw node.
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds), 0);
+  const std::string path = std::string(dev_dir) + "/hidraw0";
+  monitor.AdoptDevice(fds[0], path, GamepadDescriptor());
+  ASSERT_TRUE(WaitFor([&] { return monitor.device_count() == 1; }));
+
+  // Button 9 toggles in every report while nobody touches the pad, as a
+  // status bit would. The first report is only the baseline.
+  uint8_t report[4] = {0x00, 0x00, 0x00, 0x00};
+  ASSERT_EQ(write(fds[1], report, sizeof(report)), 4);
+  const auto calibration_end = std::chrono::steady_clock::now() +
+                               HidReportFilter::kCalibrationPeriod +
+                               std::chrono::milliseconds(100);
+  for (int i = 1; std::chrono::steady_clock::now() < calibration_end; i++) {
+    report[1] = static_cast<uint8_t>(i & 1);
+    ASSERT_EQ(write(fds[1], report, sizeof(report)), 4);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  // One report past the calibration period ends it.
+  report[1] ^= 1;
+  ASSERT_EQ(write(fds[1], report, sizeof(report)), 4);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+  // The masked bit alone is not input any more.
+  const int calibrated = activity;
+  for (int i = 0; i < 5; i++) {
+    report[1] ^= 1;
+    ASSERT_EQ(write(fds[1], report, sizeof(report)), 4);
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  EXPECT_EQ(activity, calibrated);
+
+  // A press of button 1 is, and it is counted for the device.
+  const uint64_t events = monitor.GetDevices()[0].event_count;
+  report[0] = 0x01;
+  ASSERT_EQ(write(fds[1], report, sizeof(report)), 4);
+  EXPECT_TRUE(WaitFor([&] { return activity > calibrated; }));
+  const std::vector<HidrawMonitor::DeviceInfo> devices = monitor.GetDevices();
+  ASSERT_EQ(devices.size(), 1u);
+  EXPECT_EQ(devices[0].path, path);
+  EXPECT_EQ(devices[0].event_count, events + 1);
+  EXPECT_GT(devices[0].last_activity_ms, 0);
+
+  monitor.Stop();
+  close(fds[1]);
+  rmdir(dev_dir);
+}
+
+TEST(HidReportFilter, MasksBitsThatChangeWithoutInput) {
+  // Byte 0 holds buttons, byte 1 a free-running counter, byte 2 an axis.
+  HidAxisField axis;
+  axis.bit_offset = 16;
+  axis.bit_size = 8;
+  axis.logical_min = 0;
+  axis.logical_max = 255;
+  HidReportFilter filter(3, {axis}, 0.0);
+
+  auto now = HidReportFilter::Clock::now();
+  uint8_t report[3] = {0x00, 0x00, 0x80};
+  EXPECT_FALSE(filter.Update(report, sizeof(report), now));
+  for (int i = 1; i <= 20; i++) {
+    report[1] = static_cast<uint8_t>(i);
+    // The axis wobbles by one around its centre.
+    report[2] = static_cast<uint8_t>(0x80 + (i % 2));
+    now += std::chrono::milliseconds(150);
+    filter.Update(report, sizeof(report), now);
+  }
+  ASSERT_FALSE(filter.calibrating());
+  EXPECT_GT(filter.jitter_bits(), 0u);
+  EXPECT_EQ(filter.axis_deadzone(0), 2);
+
+  // Counter and axis noise alone are no longer input.
+  report[1]++;
+  report[2] = 0x81;
+  EXPECT_FALSE(filter.Update(report, sizeof(report), now));
+
+  // A button press and a real axis movement are.
+  report[0] = 0x01;
+  EXPECT_TRUE(filter.Update(report, sizeof(report), now));
+  report[2] = 0xC0;
+  EXPECT_TRUE(filter.Update(report, sizeof(report), now));
+}
+
+TEST(HidReportFilter, ConfiguredDeadzoneHidesSmallAxisMotion) {
+  HidAxisField axis;
+  axis.bit_offset = 0;
+  axis.bit_size = 16;
+  axis.logical_min = -32768;
+  axis.logical_max = 32767;
+  HidReportFilter filter(2, {axis}, 0.05);
+
+  const auto now = HidReportFilter::Clock::now();
+  const uint8_t rest[2] = {0x00, 0x00};
+  EXPECT_FALSE(filter.Update(rest, sizeof(rest), now));
+  const uint8_t nudge[2] = {0xE8, 0x03};  // 1000
+  EXPECT_FALSE(filter.Update(nudge, sizeof(nudge), now));
+  const uint8_t push[2] = {0x00, 0xE0};  // -8192
+  EXPECT_TRUE(filter.Update(push, sizeof(push), now));
+}
+
+TEST(HidReportFilter, FirstReportIsTheBaseline) {
+  HidAxisField axis;
+  axis.bit_offset = 8;
+  axis.bit_size = 8;
+  axis.logical_min = 0;
+  axis.logical_max = 255;
+  HidReportFilter filter(4, {axis}, 0.05);
+
+  // A centred stick, a battery level and a sensor reading, untouched.
+  const auto now = HidReportFilter::Clock::now();
+  uint8_t report[4] = {0x00, 0x80, 0x5C, 0x17};
+  EXPECT_FALSE(filter.Update(report, sizeof(report), now));
+  EXPECT_FALSE(filter.Update(report, sizeof(report), now));
+
+  // Compared with the first report from then on.
+  report[0] = 0x01;
+  EXPECT_TRUE(filter.Update(report, sizeof(report), now));
+  report[1] = 0xF0;
+  EXPECT_TRUE(filter.Update(report, sizeof(report), now));
+}
+
+TEST(HidReportFilter, MaskedCompareCoversVectorAndTailBytes) {
+  std::vector<uint8_t> a(37, 0x5A);
+  std::vector<uint8_t> b = a;
+  std::vector<uint8_t> mask(a.size(), 0xFF);
+  EXPECT_FALSE(MaskedBytesDiffer(a.data(), b.data(), mask.data(), a.size()));
+
+  for (size_t i : {3u, 20u, 36u}) {
+    b[i] ^= 0x10;
+    EXPECT_TRUE(MaskedBytesDiffer(a.data(), b.data(), mask.data(), a.size()));
+    mask[i] = 0xEF;
+    EXPECT_FALSE(
+        MaskedBytesDiffer(a.data(), b.data(), mask.data(), a.size()));
+  }
+}
+
+TEST(HidDeviceReports, SteadyStateReportsDoNotAllocate) {
+  const uint8_t descriptor[] = {
+      0x05, 0x01, 0x09, 0x05, 0xA1, 0x01,  // Generic Desktop / Game Pad
+      0x05, 0x09, 0x19, 0x01, 0x29, 0x10, 0x15, 0x00, 0x25, 0x01,
+      0x75, 0x01, 0x95, 0x10, 0x81, 0x02,  // 16 buttons
+      0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x15, 0x81, 0x25, 0x7F,
+      0x75, 0x08, 0x95, 0x02, 0x81, 0x02,  // X, Y
+      0xC0,
+  };
+  HidReportDescriptor parsed;
+  ASSERT_TRUE(
+      ParseHidReportDescriptor(descriptor, sizeof(descriptor), &parsed));
+  HidDeviceReports reports(parsed, 0.02);
+  ASSERT_TRUE(reports.any_accepted());
+  ASSERT_GE(reports.buffer_size(), 4u);
+  EXPECT_EQ(reports.filter_for(1), nullptr);
+
+  // Five simulated seconds of a 1 kHz device, calibration included: a
+  // jittering bit, a noisy stick and the occasional button press.
+  auto now = HidReportFilter::Clock::now();
+  size_t inputs = 0;
+  g_allocation_count = 0;
+  g_count_allocations = true;
+  for (int i = 0; i < 5000; i++) {
+    uint8_t* report = reports.buffer();
+    report[0] = static_cast<uint8_t>(i & 1);
+    report[1] = (i % 500 == 250) ? 0x01 : 0x00;
+    report[2] = static_cast<uint8_t>(i % 3);
+    report[3] = 0;
+    HidReportFilter* filter = reports.filter_for(0);
+    ASSERT_NE(filter, nullptr);
+    const bool calibrated = !filter->calibrating();
+    if (filter->Update(report, 4, now) && calibrated) {
+      inputs++;
+    }
+    now += std::chrono::milliseconds(1);
+  }
+  g_count_allocations = false;
+
+  EXPECT_EQ(g_allocation_count, 0u);
+  EXPECT_FALSE(reports.filter_for(0)->calibrating());
+  // Six presses and releases after calibration; jitter and stick noise are
+  // filtered out.
+  EXPECT_EQ(inputs, 12u);
+}
+
+TEST(EvdevGamepad, ClassifiesByCapabilityBits) {
+  EvdevCapabilities pad;
+  pad.keys.set(BTN_SOUTH);
+  pad.keys.set(BTN_EAST);
+  pad.axes.set(ABS_X);
+  pad.axes.set(ABS_Y);
+  EXPECT_EQ(ClassifyEvdevDevice(pad), EvdevDeviceKind::kGamepad);
+
+  // The pad's motion sensors live on their own node.
+  EvdevCapabilities motion;
+  motion.axes.set(ABS_X);
+  motion.axes.set(ABS_RX);
+  motion.properties.set(INPUT_PROP_ACCELEROMETER);
+  EXPECT_EQ(ClassifyEvdevDevice(motion), EvdevDeviceKind::kOther);
+
+  EvdevCapabilities stick;
+  stick.keys.set(BTN_TRIGGER);
+  stick.axes.set(ABS_X);
+  stick.axes.set(ABS_THROTTLE);
+  EXPECT_EQ(ClassifyEvdevDevice(stick), EvdevDeviceKind::kJoystick);
+
+  EvdevCapabilities pedals;
+  pedals.axes.set(ABS_GAS);
+  pedals.axes.set(ABS_BRAKE);
+  EXPECT_EQ(ClassifyEvdevDevice(pedals), EvdevDeviceKind::kJoystick);
+
+  EvdevCapabilities mouse;
+  mouse.keys.set(BTN_LEFT);
+  mouse.keys.set(BTN_JOYSTICK);
+  mouse.has_relative_axes = true;
+  EXPECT_EQ(ClassifyEvdevDevice(mouse), EvdevDeviceKind::kOther);
+
+  EvdevCapabilities tablet;
+  tablet.keys.set(BTN_TOOL_PEN);
+  tablet.keys.set(BTN_TOUCH);
+  tablet.axes.set(ABS_X);
+  tablet.axes.set(ABS_Y);
+  tablet.axes.set(ABS_WHEEL);
+  EXPECT_EQ(ClassifyEvdevDevice(tablet), EvdevDeviceKind::kOther);
+
+  EvdevCapabilities keyboard;
+  keyboard.keys.set(KEY_A);
+  EXPECT_EQ(ClassifyEvdevDevice(keyboard), EvdevDeviceKind::kOther);
+}
+
+TEST(EvdevAxisFilter, IgnoresDriftAndAppliesHysteresis) {
+  input_absinfo stick = {};
+  stick.minimum = -32768;
+  stick.maximum = 32767;
+  stick.flat = 128;
+  input_absinfo hat = {};
+  hat.minimum = -1;
+  hat.maximum = 1;
+
+  EvdevAxisFilter filter(EvdevDeviceKind::kGamepad, 0.0);
+  filter.AddAxis(ABS_X, stick);
+  filter.AddAxis(ABS_HAT0X, hat);
+  ASSERT_EQ(filter.axis_count(), 2u);
+  // kMinDeadzone wins over the driver's flat value.
+  EXPECT_EQ(filter.axis_deadzone(ABS_X), 3276);
+  EXPECT_EQ(filter.axis_deadzone(ABS_HAT0X), 0);
+
+  // Drift inside the deadzone.
+  EXPECT_FALSE(filter.Update(ABS_X, 900));
+  EXPECT_FALSE(filter.Update(ABS_X, -2500));
+  EXPECT_FALSE(filter.Update(ABS_X, 3000));
+
+  // Leaving it counts, then only steps beyond the hysteresis band.
+  EXPECT_TRUE(filter.Update(ABS_X, 3400));
+  EXPECT_FALSE(filter.Update(ABS_X, 3100));
+  EXPECT_FALSE(filter.Update(ABS_X, 4900));
+  EXPECT_TRUE(filter.Update(ABS_X, 8000));
+  // Back at rest once well inside the deadzone.
+  EXPECT_TRUE(filter.Update(ABS_X, 200));
+  EXPECT_FALSE(filter.Update(ABS_X, 1500));
+
+  EXPECT_TRUE(filter.Update(ABS_HAT0X, 1));
+  EXPECT_TRUE(filter.Update(ABS_HAT0X, 0));
+  EXPECT_FALSE(filter.Update(ABS_Y, 30000));
+
+  filter.SetDeadzone(0.25);
+  EXPECT_EQ(filter.axis_deadzone(ABS_X), 16383);
+  EXPECT_FALSE(filter.Update(ABS_X, 12000));
+}
+
+TEST(EvdevAxisFilter, RestsAtTheMiddleOrBottomOfTheRange) {
+  // Held to one side while the device was opened.
+  input_absinfo stick = {};
+  stick.minimum = 0;
+  stick.maximum = 255;
+  stick.value = 250;
+  input_absinfo trigger = {};
+  trigger.minimum = 0;
+  trigger.maximum = 1023;
+  trigger.value = 0;
+
+  EvdevAxisFilter pad(EvdevDeviceKind::kGamepad, 0.0);
+  pad.AddAxis(ABS_X, stick);
+  pad.AddAxis(ABS_RZ, trigger);
+  pad.AddAxis(ABS_GAS, trigger);
+  EXPECT_EQ(pad.axis_rest(ABS_X), 127);
+  EXPECT_EQ(pad.axis_rest(ABS_RZ), 0);
+  EXPECT_EQ(pad.axis_rest(ABS_GAS), 0);
+  // The stick still counts when it is let go and moved again.
+  EXPECT_TRUE(pad.Update(ABS_X, 250));
+  EXPECT_TRUE(pad.Update(ABS_X, 128));
+  EXPECT_FALSE(pad.Update(ABS_RZ, 20));
+  EXPECT_TRUE(pad.Update(ABS_RZ, 600));
+
+  // The twist axis of a flight stick centres.
+  EvdevAxisFilter joystick(EvdevDeviceKind::kJoystick, 0.0);
+  joystick.AddAxis(ABS_RZ, trigger);
+  EXPECT_EQ(joystick.axis_rest(ABS_RZ), 511);
+}
+
+TEST(EvdevAxisFilter, AppliesPerAxisSettings) {
+  input_absinfo stick = {};
+  stick.minimum = -32768;
+  stick.maximum = 32767;
+
+  EvdevAxisFilter filter(EvdevDeviceKind::kGamepad, 0.0);
+  EvdevAxisFilter::AxisSettings worn;
+  worn.deadzone = 0.2;
+  worn.hysteresis = 0.1;
+  // Set before the axis is added.
+  filter.SetAxisSettings(ABS_RX, worn);
+  filter.AddAxis(ABS_X, stick);
+  filter.AddAxis(ABS_RX, stick);
+  EXPECT_EQ(filter.axis_deadzone(ABS_X), 3276);
+  EXPECT_EQ(filter.axis_hysteresis(ABS_X), 1638);
+  EXPECT_EQ(filter.axis_deadzone(ABS_RX), 13107);
+  EXPECT_EQ(filter.axis_hysteresis(ABS_RX), 1310);
+
+  EXPECT_TRUE(filter.Update(ABS_X, 5000));
+  EXPECT_FALSE(filter.Update(ABS_RX, 5000));
+  EXPECT_TRUE(filter.Update(ABS_RX, 14000));
+  EXPECT_TRUE(filter.Update(ABS_RX, 15500));
+
+  // The filter-wide deadzone no longer applies to the overridden axis, and
+  // resetting the override restores it.
+  filter.SetDeadzone(0.3);
+  EXPECT_EQ(filter.axis_deadzone(ABS_X), 19660);
+  EXPECT_EQ(filter.axis_deadzone(ABS_RX), 13107);
+  filter.SetAxisSettings(ABS_RX, EvdevAxisFilter::AxisSettings());
+  EXPECT_EQ(filter.axis_deadzone(ABS_RX), 19660);
+  EXPECT_EQ(filter.axis_hysteresis(ABS_RX), 9830);
+
+  uint16_t code = 0;
+  EXPECT_TRUE(EvdevAxisFromName("rz", &code));
+  EXPECT_EQ(code, ABS_RZ);
+  EXPECT_FALSE(EvdevAxisFromName("hat0x", &code));
+}
+
+TEST(EvdevGamepadMonitor, SkipsNodesThatAreNotControllers) {
+  char input_dir[] = "/tmp/window_focus_evdevXXXXXX";
+  ASSERT_NE(mkdtemp(input_dir), nullptr);
+  // Regular files fail the evdev ioctls.
+  const std::string node = std::string(input_dir) + "/event0";
+  FILE* file = fopen(node.c_str(), "w");
+  ASSERT_NE(file, nullptr);
+  fclose(file);
+
+  EvdevGamepadMonitor monitor([]() {});
+  ASSERT_TRUE(monitor.Start(input_dir));
+  EXPECT_TRUE(monitor.is_running());
+  monitor.Stop();
+  EXPECT_FALSE(monitor.is_running());
+  EXPECT_EQ(monitor.device_count(), 0u);
+  EXPECT_TRUE(monitor.GetDevices().empty());
+
+  unlink(node.c_str());
+  rmdir(input_dir);
+}
+
+// A 440 Hz sine at 16 kHz, continuing from |offset| samples.
+std::vector<float> Tone(float amplitude, size_t count, size_t offset = 0) {
+  std::vector<float> samples(count);
+  for (size_t i = 0; i < count; i++) {
+    samples[i] = amplitude * static_cast<float>(std::sin(
+                                 2 * M_PI * 440 * (offset + i) / 16000.0));
+  }
+  return samples;
+}
+
+TEST(AudioActivityDetector, KernelMatchesScalarForAllTailLengths) {
+  std::vector<float> samples(101);
+  for (size_t i = 0; i < samples.size(); i++) {
+    samples[i] = std::sin(static_cast<float>(i) * 0.37f) *
+                 (static_cast<int>(i % 7) - 3) / 3.0f;
+  }
+  samples[53] = -0.999f;
+
+  for (size_t count = 0; count <= samples.size(); count++) {
+    double expected_sum = 0.0;
+    float expected_peak = 0.0f;
+    for (size_t i = 0; i < count; i++) {
+      expected_sum += samples[i] * samples[i];
+      expected_peak = std::max(expected_peak, std::fabs(samples[i]));
+    }
+    float sum = 0.0f;
+    float peak = 0.0f;
+    AccumulateSquaresAndPeak(samples.data(), count, &sum, &peak);
+    EXPECT_NEAR(sum, expected_sum, 1e-4) << count << " samples";
+    EXPECT_EQ(peak, expected_peak) << count << " samples";
+  }
+}
+
+TEST(AudioActivityDetector, IgnoresClicksAndChimes) {
+  AudioActivityDetector detector(16000);
+  detector.set_threshold(0.05f);
+  const std::vector<float> silence(16000, 0.0f);
+
+  // A full-scale click.
+  std::vector<float> click(16000, 0.0f);
+  click[8000] = 1.0f;
+  EXPECT_FALSE(detector.Process(click.data(), click.size()));
+
+  // Three 300 ms chimes a quarter second apart.
+  const std::vector<float> chime = Tone(0.5f, 4800);
+  for (int i = 0; i < 3; i++) {
+    EXPECT_FALSE(detector.Process(chime.data(), chime.size()));
+    EXPECT_FALSE(detector.Process(silence.data(), 4000));
+  }
+}
+
+TEST(AudioActivityDetector, SustainedToneStartsAndSilenceEndsPlayback) {
+  AudioActivityDetector detector(16000);
+  detector.set_threshold(0.05f);
+
+  // Playback starts after a second of tone, in blocks as the server sends
+  // them.
+  const std::vector<float> tone = Tone(0.2f, 24000);
+  size_t fed = 0;
+  for (; fed < tone.size() && !detector.playing(); fed += 320) {
+    detector.Process(tone.data() + fed, 320);
+  }
+  EXPECT_TRUE(detector.playing());
+  EXPECT_EQ(fed, 16000u);
+  EXPECT_NEAR(detector.rms(), 0.2f / std::sqrt(2.0f), 0.005f);
+  EXPECT_NEAR(detector.peak(), 0.2f, 0.005f);
+
+  // A quiet passage above half the threshold keeps it playing.
+  const std::vector<float> quiet = Tone(0.06f, 48000);
+  EXPECT_TRUE(detector.Process(quiet.data(), quiet.size()));
+
+  // Two seconds of silence end it.
+  const std::vector<float> silence(16000, 0.0f);
+  EXPECT_TRUE(detector.Process(silence.data(), silence.size()));
+  EXPECT_FALSE(detector.Process(silence.data(), silence.size()));
+}
+
+// Reports the detector throughput on one core. The bound only catches a
+// kernel that became far slower than plain scalar code. Disabled like the
+// other benchmarks, since timings depend on the machine and its load. To
+// run them:
+// $ window_focus_test --gtest_also_run_disabled_tests
+//   --gtest_filter='*Throughput*:*Benchmark*'
+TEST(AudioActivityDetector, DISABLED_Throughput) {
+  AudioActivityDetector detector(16000);
+  detector.set_threshold(0.05f);
+  const std::vector<float> block = Tone(0.3f, 4000);
+  constexpr int kBlocks = 20000;
+
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kBlocks; i++) {
+    detector.Process(block.data(), block.size());
+  }
+  const double seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+  const double samples_per_second = kBlocks * block.size() / seconds;
+  std::cout << "[AudioActivityDetector] " << samples_per_second / 1e6
+            << " M samples/s per core" << std::endl;
+  EXPECT_TRUE(detector.playing());
+  EXPECT_GT(samples_per_second, 50e6);
+}
+
+TEST(PixelFormat, ConvertsBgrxForAllTailLengths) {
+  // Distinct bytes, and padding that must not survive.
+  std::vector<uint8_t> bgrx(4 * 67);
+  for (size_t i = 0; i < bgrx.size(); i++) {
+    bgrx[i] = static_cast<uint8_t>(i % 4 == 3 ? i / 4 : i * 7 + 1);
+  }
+  for (size_t count = 0; count <= 67; count++) {
+    std::vector<uint8_t> rgba(bgrx.size());
+    std::vector<uint8_t> bgra(bgrx.begin(), bgrx.end());
+    ConvertBgrxPixels(bgrx.data(), rgba.data(), count, PixelFormat::kRgba);
+    // In place, as the plugin converts the capture buffer.
+    ConvertBgrxPixels(bgra.data(), bgra.data(), count, PixelFormat::kBgra);
+    for (size_t i = 0; i < count; i++) {
+      const uint8_t* in = &bgrx[4 * i];
+      ASSERT_EQ(rgba[4 * i], in[2]) << count << " pixels, pixel " << i;
+      ASSERT_EQ(rgba[4 * i + 1], in[1]);
+      ASSERT_EQ(rgba[4 * i + 2], in[0]);
+      ASSERT_EQ(rgba[4 * i + 3], 0xFF);
+      ASSERT_EQ(bgra[4 * i], in[0]);
+      ASSERT_EQ(bgra[4 * i + 1], in[1]);
+      ASSERT_EQ(bgra[4 * i + 2], in[2]);
+      ASSERT_EQ(bgra[4 * i + 3], 0xFF);
+    }
+    // Nothing past |count| is written.
+    EXPECT_TRUE(std::all_of(rgba.begin() + 4 * count, rgba.end(),
+                            [](uint8_t byte) { return byte == 0; }));
+  }
+}
+
+// A benchmark; see AudioActivityDetector.DISABLED_Throughput.
+TEST(PixelFormat, DISABLED_Throughput) {
+  // One 4K frame.
+  std::vector<uint8_t> frame(3840 * 2160 * 4, 0x40);
+  constexpr int kRuns = 20;
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kRuns; i++) {
+    ConvertBgrxPixels(frame.data(), frame.data(), 3840 * 2160,
+                      PixelFormat::kRgba);
+  }
+  const std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::cout << "[PixelFormat] BGRX to RGBA, 3840x2160 in place: "
+            << elapsed.count() / kRuns << " ms" << std::endl;
+  EXPECT_EQ(frame[3], 0xFF);
+}
+
+// A fixed corpus of desktop-like 1080p frames in BGRX with garbage padding:
+// a document, a dark-themed editor and a photo wallpaper with a window on
+// it. Generated from fixed seeds so sizes are comparable between runs.
+struct DesktopCapture {
+  const char* name;
+  int width;
+  int height;
+  std::vector<uint8_t> pixels;
+};
+
+std::vector<DesktopCapture> MakeDesktopCorpus() {
+  constexpr int kWidth = 1920;
+  constexpr int kHeight = 1080;
+  uint32_t seed = 12345;
+  auto random = [&seed]() {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) & 0x7FFF;
+  };
+  auto fill = [](DesktopCapture* capture, int x0, int y0, int x1, int y1,
+                 uint32_t bgr) {
+    for (int y = y0; y < y1; y++) {
+      for (int x = x0; x < x1; x++) {
+        uint8_t* p = &capture->pixels[(static_cast<size_t>(y) * kWidth + x) *
+                                      4];
+        p[0] = bgr & 0xFF;
+        p[1] = (bgr >> 8) & 0xFF;
+        p[2] = (bgr >> 16) & 0xFF;
+      }
+    }
+  };
+  // Lines of word-sized blocks of "glyphs": thin vertical strokes.
+  auto text = [&](DesktopCapture* capture, int x0, int y0, int x1, int y1,
+                  int line_height, const std::vector<uint32_t>& colors) {
+    for (int y = y0; y + line_height <= y1; y += line_height) {
+      int x = x0 + static_cast<int>(random() % 40);
+      while (x < x1 - 80) {
+        const uint32_t color = colors[random() % colors.size()];
+        const int word = 3 + random() % 9;
+        for (int c = 0; c < word; c++, x += 9) {
+          const int glyph = random();
+          for (int stroke = 0; stroke < 3; stroke++) {
+            if (glyph & (1 << stroke)) {
+              fill(capture, x + 2 * stroke, y + 3 + glyph % 4,
+                   x + 2 * stroke + 1, y + line_height - 5, color);
+            }
+          }
+          fill(capture, x, y + line_height - 6, x + 7, y + line_height - 5,
+               color);
+        }
+        x += 9;
+      }
+    }
+  };
+
+  std::vector<DesktopCapture> corpus;
+  for (const char* name : {"document", "editor", "wallpaper"}) {
+    DesktopCapture capture{name, kWidth, kHeight,
+                           std::vector<uint8_t>(kWidth * kHeight * 4)};
+    for (size_t i = 3; i < capture.pixels.size(); i += 4) {
+      capture.pixels[i] = static_cast<uint8_t>(random());
+    }
+    corpus.push_back(std::move(capture));
+  }
+
+  DesktopCapture* document = &corpus[0];
+  fill(document, 0, 0, kWidth, kHeight, 0xF3F3F3);
+  fill(document, 0, 0, kWidth, 40, 0x2B579A);
+  fill(document, 320, 80, 1600, kHeight, 0xFFFFFF);
+  text(document, 400, 120, 1520, kHeight, 22, {0x202020, 0x202020, 0x0563C1});
+
+  DesktopCapture* editor = &corpus[1];
+  fill(editor, 0, 0, kWidth, kHeight, 0x1E1E1E);
+  fill(editor, 0, 0, 300, kHeight, 0x252526);
+  fill(editor, 0, kHeight - 24, kWidth, kHeight, 0x007ACC);
+  text(editor, 16, 40, 290, kHeight - 30, 22, {0xCCCCCC});
+  text(editor, 360, 40, kWidth, kHeight - 30, 19,
+       {0x9CDCFE, 0xCE9178, 0x569CD6, 0xD4D4D4, 0x6A9955});
+
+  DesktopCapture* wallpaper = &corpus[2];
+  for (int y = 0; y < kHeight; y++) {
+    for (int x = 0; x < kWidth; x++) {
+      uint8_t* p = &wallpaper->pixels[(static_cast<size_t>(y) * kWidth + x) *
+                                      4];
+      const int grain = static_cast<int>(random() % 9) - 4;
+      p[0] = static_cast<uint8_t>(std::min(255, std::max(0, 200 - y / 6 + grain)));
+      p[1] = static_cast<uint8_t>(std::min(255, std::max(0, 120 + x / 20 + grain)));
+      p[2] = static_cast<uint8_t>(std::min(255, std::max(0, 60 + (x + y) / 30 + grain)));
+    }
+  }
+  fill(wallpaper, 480, 200, 1440, 880, 0xFAFAFA);
+  fill(wallpaper, 480, 200, 1440, 232, 0xDDDDDD);
+  text(wallpaper, 500, 250, 1420, 860, 20, {0x333333});
+  return corpus;
+}
+
+// Reference decoder for the QOI subset the encoder writes: three channels,
+// no QOI_OP_RGBA. Returns BGRX rows with zero padding.
+bool DecodeQoi(const std::vector<uint8_t>& qoi,
+               int* width,
+               int* height,
+               std::vector<uint8_t>* bgrx) {
+  auto read32 = [&qoi](size_t at) {
+    return static_cast<uint32_t>(qoi[at]) << 24 | qoi[at + 1] << 16 |
+           qoi[at + 2] << 8 | qoi[at + 3];
+  };
+  if (qoi.size() < 22 || memcmp(qoi.data(), "qoif", 4) != 0 ||
+      qoi[12] != 3) {
+    return false;
+  }
+  *width = static_cast<int>(read32(4));
+  *height = static_cast<int>(read32(8));
+  const size_t count = static_cast<size_t>(*width) * *height;
+  bgrx->assign(count * 4, 0);
+  uint8_t index[64][3] = {};
+  bool used[64] = {};
+  uint8_t rgb[3] = {0, 0, 0};
+  size_t at = 14;
+  const size_t end = qoi.size() - 8;
+  for (size_t i = 0; i < count;) {
+    if (at >= end) {
+      return false;
+    }
+    const uint8_t op = qoi[at++];
+    int run = 1;
+    if (op == 0xFE) {
+      rgb[0] = qoi[at];
+      rgb[1] = qoi[at + 1];
+      rgb[2] = qoi[at + 2];
+      at += 3;
+    } else if ((op & 0xC0) == 0x00) {
+      if (!used[op]) {
+        return false;
+      }
+      memcpy(rgb, index[op], 3);
+    } else if ((op & 0xC0) == 0x40) {
+      rgb[0] += ((op >> 4) & 3) - 2;
+      rgb[1] += ((op >> 2) & 3) - 2;
+      rgb[2] += (op & 3) - 2;
+    } else if ((op & 0xC0) == 0x80) {
+      const int dg = (op & 0x3F) - 32;
+      const uint8_t next = qoi[at++];
+      rgb[0] += dg + (next >> 4) - 8;
+      rgb[1] += dg;
+      rgb[2] += dg + (next & 0x0F) - 8;
+    } else if (op == 0xFF) {
+      return false;
+    } else {
+      run = (op & 0x3F) + 1;
+    }
+    const int hash = (rgb[0] * 3 + rgb[1] * 5 + rgb[2] * 7 + 255 * 11) % 64;
+    memcpy(index[hash], rgb, 3);
+    used[hash] = true;
+    for (; run > 0 && i < count; run--, i++) {
+      (*bgrx)[4 * i] = rgb[2];
+      (*bgrx)[4 * i + 1] = rgb[1];
+      (*bgrx)[4 * i + 2] = rgb[0];
+    }
+  }
+  return at == end && qoi[end + 7] == 1;
+}
+
+// Reference decoder for the PNGs the encoder writes: 8-bit RGB, not
+// interlaced. Returns BGRX rows with zero padding, and counts the rows each
+// filter was used for in |filter_counts| when given.
+bool DecodePng(const std::vector<uint8_t>& png,
+               int* width,
+               int* height,
+               std::vector<uint8_t>* bgrx,
+               int* filter_counts = nullptr) {
+  auto read32 = [&png](size_t at) {
+    return static_cast<uint32_t>(png[at]) << 24 | png[at + 1] << 16 |
+           png[at + 2] << 8 | png[at + 3];
+  };
+  std::vector<uint8_t> compressed;
+  for (size_t at = 8; at + 12 <= png.size();) {
+    const uint32_t length = read32(at);
+    const std::string type(png.begin() + at + 4, png.begin() + at + 8);
+    if (at + 12 + length > png.size() ||
+        crc32(0, png.data() + at + 4, length + 4) != read32(at + 8 + length)) {
+      return false;
+    }
+    if (type == "IHDR") {
+      *width = static_cast<int>(read32(at + 8));
+      *height = static_cast<int>(read32(at + 12));
+      if (png[at + 16] != 8 || png[at + 17] != 2) {
+        return false;
+      }
+    } else if (type == "IDAT") {
+      compressed.insert(compressed.end(), png.begin() + at + 8,
+                        png.begin() + at + 8 + length);
+    }
+    at += 12 + length;
+  }
+  const size_t row_bytes = static_cast<size_t>(*width) * 3;
+  std::vector<uint8_t> raw((row_bytes + 1) * *height);
+  uLongf raw_size = raw.size();
+  if (uncompress(raw.data(), &raw_size, compressed.data(),
+                 compressed.size()) != Z_OK ||
+      raw_size != raw.size()) {
+    return false;
+  }
+  bgrx->assign(static_cast<size_t>(*width) * *height * 4, 0);
+  std::vector<uint8_t> previous(row_bytes, 0);
+  for (int y = 0; y < *height; y++) {
+    uint8_t* row = &raw[y * (row_bytes + 1)];
+    const uint8_t filter = row[0];
+    uint8_t* rgb = row + 1;
+    if (filter > 4) {
+      return false;
+    }
+    if (filter_counts != nullptr) {
+      filter_counts[filter]++;
+    }
+    for (size_t i = 0; i < row_bytes; i++) {
+      const int a = i >= 3 ? rgb[i - 3] : 0;
+      const int b = previous[i];
+      const int c = i >= 3 ? previous[i - 3] : 0;
+      if (filter == 1) {
+        rgb[i] += a;
+      } else if (filter == 2) {
+        rgb[i] += b;
+      } else if (filter == 3) {
+        rgb[i] += (a + b) / 2;
+      } else if (filter == 4) {
+        const int pa = std::abs(b - c);
+        const int pb = std::abs(a - c);
+        const int pc = std::abs(a + b - 2 * c);
+        rgb[i] += pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+      }
+    }
+    for (int x = 0; x < *width; x++) {
+      uint8_t* p = &(*bgrx)[(static_cast<size_t>(y) * *width + x) * 4];
+      p[0] = rgb[3 * x + 2];
+      p[1] = rgb[3 * x + 1];
+      p[2] = rgb[3 * x];
+    }
+    previous.assign(rgb, rgb + row_bytes);
+  }
+  return true;
+}
+
+// The encoders' input with the padding bytes zeroed, for comparing with
+// decoded images.
+std::vector<uint8_t> WithoutPadding(const uint8_t* pixels,
+                                    int width,
+                                    int height,
+                                    int stride) {
+  std::vector<uint8_t> packed(static_cast<size_t>(width) * height * 4);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      const uint8_t* src = pixels + static_cast<size_t>(y) * stride + 4 * x;
+      uint8_t* dst = &packed[(static_cast<size_t>(y) * width + x) * 4];
+      dst[0] = src[0];
+      dst[1] = src[1];
+      dst[2] = src[2];
+    }
+  }
+  return packed;
+}
+
+TEST(ScreenshotEncoder, ListsBuiltInFormats) {
+  ASSERT_GE(ScreenshotEncoders().size(), 2u);
+  EXPECT_STREQ(ScreenshotEncoders().front().name, "png");
+  EXPECT_NE(FindScreenshotEncoder("qoi"), nullptr);
+  EXPECT_EQ(FindScreenshotEncoder("bmp"), nullptr);
+#ifdef WINDOW_FOCUS_HAVE_LIBJPEG
+  EXPECT_TRUE(FindScreenshotEncoder("jpeg")->lossy);
+#else
+  EXPECT_EQ(FindScreenshotEncoder("jpeg"), nullptr);
+#endif
+#ifdef WINDOW_FOCUS_HAVE_LIBWEBP
+  EXPECT_TRUE(FindScreenshotEncoder("webp")->lossy);
+#else
+  EXPECT_EQ(FindScreenshotEncoder("webp"), nullptr);
+#endif
+}
+
+TEST(ScreenshotEncoder, LosslessFormatsRoundTrip) {
+  std::vector<DesktopCapture> corpus = MakeDesktopCorpus();
+  // Near-black noise, where no PNG filter beats None.
+  DesktopCapture noise{"noise", corpus[0].width, corpus[0].height,
+                       std::vector<uint8_t>(corpus[0].pixels.size())};
+  uint32_t seed = 1;
+  for (uint8_t& byte : noise.pixels) {
+    seed = seed * 1103515245 + 12345;
+    byte = static_cast<uint8_t>((seed >> 16) % 5 - 2);
+  }
+  corpus.push_back(std::move(noise));
+  int filter_counts[5] = {};
+  for (const char* format : {"png", "qoi"}) {
+    const ScreenshotEncoder* encoder = FindScreenshotEncoder(format);
+    ASSERT_NE(encoder, nullptr);
+    for (const DesktopCapture& capture : corpus) {
+      // An odd-sized region with a stride wider than its rows, as a window
+      // capture would be.
+      const int stride = capture.width * 4;
+      const uint8_t* region = capture.pixels.data() + 37 * stride + 4 * 61;
+      const int width = 1001;
+      const int height = 333;
+      std::vector<uint8_t> encoded;
+      ASSERT_TRUE(encoder->encode(region, width, height, stride,
+                                  kDefaultScreenshotQuality, &encoded));
+      int decoded_width = 0;
+      int decoded_height = 0;
+      std::vector<uint8_t> decoded;
+      ASSERT_TRUE(strcmp(format, "png") == 0
+                      ? DecodePng(encoded, &decoded_width, &decoded_height,
+                                  &decoded, filter_counts)
+                      : DecodeQoi(encoded, &decoded_width, &decoded_height,
+                                  &decoded))
+          << format << " " << capture.name;
+      EXPECT_EQ(decoded_width, width);
+      EXPECT_EQ(decoded_height, height);
+      EXPECT_TRUE(decoded == WithoutPadding(region, width, height, stride))
+          << format << " " << capture.name << " does not round trip";
+    }
+  }
+  // Every filter kernel was exercised, or the round trip proves little.
+  for (int filter = 0; filter < 5; filter++) {
+    EXPECT_GT(filter_counts[filter], 0) << "PNG filter " << filter;
+  }
+}
+
+// A desktop spanning |columns| x |rows| 1080p corpus frames, for multi-monitor
+// sized captures.
+DesktopCapture TileDesktopCorpus(const std::vector<DesktopCapture>& corpus,
+                                 int columns,
+                                 int rows) {
+  const int tile_width = corpus[0].width;
+  const int tile_height = corpus[0].height;
+  DesktopCapture desktop{"tiled", tile_width * columns, tile_height * rows,
+                         {}};
+  desktop.pixels.resize(static_cast<size_t>(desktop.width) * desktop.height *
+                        4);
+  for (int y = 0; y < desktop.height; y++) {
+    for (int column = 0; column < columns; column++) {
+      const DesktopCapture& tile =
+          corpus[(y / tile_height * columns + column) % corpus.size()];
+      memcpy(&desktop.pixels[(static_cast<size_t>(y) * desktop.width +
+                              column * tile_width) *
+                             4],
+             &tile.pixels[static_cast<size_t>(y % tile_height) * tile_width *
+                          4],
+             tile_width * 4);
+    }
+  }
+  return desktop;
+}
+
+TEST(ScreenshotEncoder, ParallelPngDoesNotDependOnThreadCount) {
+  const DesktopCapture desktop = TileDesktopCorpus(MakeDesktopCorpus(), 2, 2);
+  const int stride = desktop.width * 4;
+  std::vector<uint8_t> single;
+  ASSERT_TRUE(EncodePng(desktop.pixels.data(), desktop.width, desktop.height,
+                        stride, 1, &single));
+  for (int threads : {2, 3, 8}) {
+    std::vector<uint8_t> parallel;
+    ASSERT_TRUE(EncodePng(desktop.pixels.data(), desktop.width,
+                          desktop.height, stride, threads, &parallel));
+    EXPECT_TRUE(parallel == single) << threads << " threads";
+  }
+  int width = 0;
+  int height = 0;
+  std::vector<uint8_t> decoded;
+  ASSERT_TRUE(DecodePng(single, &width, &height, &decoded));
+  EXPECT_TRUE(decoded == WithoutPadding(desktop.pixels.data(), desktop.width,
+                                        desktop.height, stride));
+}
+
+// Encodes running at the same time share the pool's helpers.
+TEST(ScreenshotEncoder, ConcurrentPngEncodesShareThePool) {
+  const DesktopCapture desktop = TileDesktopCorpus(MakeDesktopCorpus(), 2, 1);
+  const int stride = desktop.width * 4;
+  std::vector<uint8_t> single;
+  ASSERT_TRUE(EncodePng(desktop.pixels.data(), desktop.width, desktop.height,
+                        stride, 1, &single));
+
+  std::atomic<int> matches{0};
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; i++) {
+    threads.emplace_back([&]() {
+      for (int j = 0; j < 3; j++) {
+        std::vector<uint8_t> png;
+        if (EncodePng(desktop.pixels.data(), desktop.width, desktop.height,
+                      stride, 0, &png) &&
+            png == single) {
+          matches++;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(matches.load(), 12);
+}
+
+// A benchmark; see AudioActivityDetector.DISABLED_Throughput.
+TEST(ScreenshotEncoder, DISABLED_ParallelPngBenchmark) {
+  const std::vector<DesktopCapture> corpus = MakeDesktopCorpus();
+  const int cores = static_cast<int>(std::thread::hardware_concurrency());
+  // 4K, and three 4K monitors side by side.
+  for (const DesktopCapture& desktop :
+       {TileDesktopCorpus(corpus, 2, 2), TileDesktopCorpus(corpus, 6, 2)}) {
+    double milliseconds[2] = {};
+    size_t size = 0;
+    for (int pass = 0; pass < 2; pass++) {
+      std::vector<uint8_t> png;
+      const auto start = std::chrono::steady_clock::now();
+      ASSERT_TRUE(EncodePng(desktop.pixels.data(), desktop.width,
+                            desktop.height, desktop.width * 4,
+                            pass == 0 ? 1 : cores, &png));
+      const std::chrono::duration<double, std::milli> elapsed =
+          std::chrono::steady_clock::now() - start;
+      milliseconds[pass] = elapsed.count();
+      size = png.size();
+    }
+    std::cout << "[ScreenshotEncoder] png " << desktop.width << "x"
+              << desktop.height << ": " << milliseconds[0]
+              << " ms on 1 thread, " << milliseconds[1] << " ms on " << cores
+              << " (" << milliseconds[0] / milliseconds[1] << "x), "
+              << size / 1024 << " KiB" << std::endl;
+  }
+}
+
+#ifdef WINDOW_FOCUS_HAVE_LIBJPEG
+TEST(ScreenshotEncoder, JpegQualityTradesSizeForError) {
+  const DesktopCapture capture = std::move(MakeDesktopCorpus()[1]);
+  const ScreenshotEncoder* encoder = FindScreenshotEncoder("jpeg");
+  ASSERT_NE(encoder, nullptr);
+  size_t previous_size = 0;
+  double previous_error = 1e9;
+  for (int quality : {30, 70, 95}) {
+    std::vector<uint8_t> jpeg;
+    ASSERT_TRUE(encoder->encode(capture.pixels.data(), capture.width,
+                                capture.height, capture.width * 4, quality,
+                                &jpeg));
+    jpeg_decompress_struct info;
+    jpeg_error_mgr error;
+    info.err = jpeg_std_error(&error);
+    jpeg_create_decompress(&info);
+    jpeg_mem_src(&info, jpeg.data(), jpeg.size());
+    ASSERT_EQ(jpeg_read_header(&info, TRUE), JPEG_HEADER_OK);
+    info.out_color_space = JCS_RGB;
+    jpeg_start_decompress(&info);
+    ASSERT_EQ(static_cast<int>(info.output_width), capture.width);
+    ASSERT_EQ(static_cast<int>(info.output_height), capture.height);
+    std::vector<uint8_t> rgb(capture.width * 3);
+    uint64_t total_error = 0;
+    while (info.output_scanline < info.output_height) {
+      const size_t y = info.output_scanline;
+      JSAMPROW row = rgb.data();
+      jpeg_read_scanlines(&info, &row, 1);
+      for (int x = 0; x < capture.width; x++) {
+        const uint8_t* src = &capture.pixels[(y * capture.width + x) * 4];
+        total_error += std::abs(rgb[3 * x] - src[2]) +
+                       std::abs(rgb[3 * x + 1] - src[1]) +
+                       std::abs(rgb[3 * x + 2] - src[0]);
+      }
+    }
+    jpeg_finish_decompress(&info);
+    jpeg_destroy_decompress(&info);
+    const double mean_error =
+        static_cast<double>(total_error) / (capture.width * capture.height * 3);
+    EXPECT_GT(jpeg.size(), previous_size) << "quality " << quality;
+    EXPECT_LT(mean_error, previous_error) << "quality " << quality;
+    previous_size = jpeg.size();
+    previous_error = mean_error;
+  }
+  EXPECT_LT(previous_error, 3.0);
+}
+#endif
+
+// A benchmark; see AudioActivityDetector.DISABLED_Throughput.
+TEST(ScreenshotEncoder, DISABLED_Benchmark) {
+  const std::vector<DesktopCapture> corpus = MakeDesktopCorpus();
+  for (const ScreenshotEncoder& encoder : ScreenshotEncoders()) {
+    for (int quality : encoder.lossy ? std::vector<int>{50, 90}
+                                     : std::vector<int>{0}) {
+      double milliseconds = 0;
+      size_t bytes = 0;
+      size_t raw_bytes = 0;
+      std::vector<uint8_t> encoded;
+      for (const DesktopCapture& capture : corpus) {
+        const auto start = std::chrono::steady_clock::now();
+        ASSERT_TRUE(encoder.encode(capture.pixels.data(), capture.width,
+                                   capture.height, capture.width * 4, quality,
+                                   &encoded));
+        const std::chrono::duration<double, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+        milliseconds += elapsed.count();
+        bytes += encoded.size();
+        raw_bytes += static_cast<size_t>(capture.width) * capture.height * 3;
+      }
+      std::cout << "[ScreenshotEncoder] " << encoder.name;
+      if (encoder.lossy) {
+        std::cout << " q" << quality;
+      }
+      std::cout << ": " << milliseconds / corpus.size() << " ms per 1080p frame, "
+                << raw_bytes / 1e6 / (milliseconds / 1000) << " MB/s, "
+                << bytes / corpus.size() / 1024 << " KiB per frame ("
+                << 100.0 * bytes / raw_bytes << "% of RGB)" << std::endl;
+    }
+  }
+}
+
+TEST(ImageScaler, FitsWithinLimitsKeepingAspectRatio) {
+  int width = 0;
+  int height = 0;
+  EXPECT_FALSE(FitImageSize(1920, 1080, 0, 0, &width, &height));
+  EXPECT_FALSE(FitImageSize(1920, 1080, 1920, 1080, &width, &height));
+  EXPECT_EQ(width, 1920);
+  EXPECT_EQ(height, 1080);
+  EXPECT_TRUE(FitImageSize(1920, 1080, 640, 0, &width, &height));
+  EXPECT_EQ(width, 640);
+  EXPECT_EQ(height, 360);
+  EXPECT_TRUE(FitImageSize(1920, 1080, 0, 100, &width, &height));
+  EXPECT_EQ(width, 178);
+  EXPECT_EQ(height, 100);
+  // The tighter limit wins.
+  EXPECT_TRUE(FitImageSize(2560, 1440, 640, 640, &width, &height));
+  EXPECT_EQ(width, 640);
+  EXPECT_EQ(height, 360);
+  EXPECT_TRUE(FitImageSize(1080, 1920, 640, 640, &width, &height));
+  EXPECT_EQ(width, 360);
+  EXPECT_EQ(height, 640);
+  // Never below one pixel, and never enlarged.
+  EXPECT_TRUE(FitImageSize(5000, 2, 10, 0, &width, &height));
+  EXPECT_EQ(width, 10);
+  EXPECT_EQ(height, 1);
+  EXPECT_FALSE(FitImageSize(320, 200, 640, 480, &width, &height));
+}
+
+TEST(ImageScaler, MatchesAreaAverage) {
+  struct Case {
+    int src_width;
+    int src_height;
+    int dst_width;
+    int dst_height;
+  };
+  // Integer and fractional factors, sizes that leave vector tails, and
+  // single rows and columns.
+  const Case cases[] = {{1920, 1080, 640, 360}, {67, 41, 23, 17},
+                        {101, 7, 3, 2},         {64, 64, 64, 64},
+                        {37, 1, 5, 1},          {1, 50, 1, 9},
+                        {1000, 3, 7, 1}};
+  uint32_t seed = 99;
+  for (const Case& c : cases) {
+    const int src_stride = c.src_width * 4 + 12;
+    std::vector<uint8_t> src(static_cast<size_t>(src_stride) * c.src_height);
+    for (uint8_t& byte : src) {
+      seed = seed * 1103515245 + 12345;
+      byte = static_cast<uint8_t>(seed >> 16);
+    }
+    for (PixelFormat format : {PixelFormat::kBgra, PixelFormat::kRgba}) {
+      const int dst_stride = c.dst_width * 4 + 4;
+      std::vector<uint8_t> dst(static_cast<size_t>(dst_stride) * c.dst_height,
+                               0);
+      DownscaleBgrxPixels(src.data(), c.src_width, c.src_height, src_stride,
+                          dst.data(), c.dst_width, c.dst_height, dst_stride,
+                          format);
+      const double scale_x = static_cast<double>(c.src_width) / c.dst_width;
+      const double scale_y = static_cast<double>(c.src_height) / c.dst_height;
+      for (int y = 0; y < c.dst_height; y++) {
+        for (int x = 0; x < c.dst_width; x++) {
+          double sums[3] = {0, 0, 0};
+          const int sy_end = std::min(
+              c.src_height, static_cast<int>(std::ceil((y + 1) * scale_y)));
+          const int sx_end = std::min(
+              c.src_width, static_cast<int>(std::ceil((x + 1) * scale_x)));
+          for (int sy = static_cast<int>(y * scale_y); sy < sy_end; sy++) {
+            const double cover_y =
+                std::min(sy + 1.0, (y + 1) * scale_y) - std::max(sy * 1.0, y * scale_y);
+            if (cover_y <= 0) {
+              continue;
+            }
+            for (int sx = static_cast<int>(x * scale_x); sx < sx_end; sx++) {
+              const double cover_x = std::min(sx + 1.0, (x + 1) * scale_x) -
+                                     std::max(sx * 1.0, x * scale_x);
+              if (cover_x <= 0) {
+                continue;
+              }
+              const uint8_t* p = &src[static_cast<size_t>(sy) * src_stride + 4 * sx];
+              for (int k = 0; k < 3; k++) {
+                sums[k] += p[k] * cover_x * cover_y;
+              }
+            }
+          }
+          const uint8_t* out = &dst[static_cast<size_t>(y) * dst_stride + 4 * x];
+          for (int k = 0; k < 3; k++) {
+            const int channel = format == PixelFormat::kRgba ? 2 - k : k;
+            ASSERT_NEAR(out[channel], sums[k] / (scale_x * scale_y), 1.0)
+                << c.src_width << "x" << c.src_height << " to " << c.dst_width
+                << "x" << c.dst_height << " at " << x << "," << y;
+          }
+          ASSERT_EQ(out[3], 0xFF);
+        }
+        // Row padding is left alone.
+        ASSERT_EQ(dst[static_cast<size_t>(y) * dst_stride + c.dst_width * 4], 0);
+      }
+    }
+  }
+
+  // Flat areas keep their exact colour.
+  std::vector<uint8_t> flat(97 * 53 * 4);
+  for (size_t i = 0; i < flat.size(); i += 4) {
+    flat[i] = 10;
+    flat[i + 1] = 200;
+    flat[i + 2] = 255;
+  }
+  std::vector<uint8_t> small(13 * 7 * 4);
+  DownscaleBgrxPixels(flat.data(), 97, 53, 97 * 4, small.data(), 13, 7, 13 * 4,
+                      PixelFormat::kBgra);
+  for (size_t i = 0; i < small.size(); i += 4) {
+    ASSERT_EQ(small[i], 10);
+    ASSERT_EQ(small[i + 1], 200);
+    ASSERT_EQ(small[i + 2], 255);
+  }
+}
+
+// Measured in work rather than time: a 640 pixel wide thumbnail gives the
+// encoder a ninth of the pixels of a 1080p frame, and comes out smaller.
+// Scaling blurs text, so PNG and QOI shrink less than that.
+TEST(ImageScaler, ThumbnailsCostAFractionOfFullFrames) {
+  const std::vector<DesktopCapture> corpus = MakeDesktopCorpus();
+  for (const char* format : {"png", "jpeg", "qoi"}) {
+    const ScreenshotEncoder* encoder = FindScreenshotEncoder(format);
+    if (encoder == nullptr) {
+      continue;
+    }
+    for (const DesktopCapture& capture : corpus) {
+      std::vector<uint8_t> full;
+      ASSERT_TRUE(encoder->encode(capture.pixels.data(), capture.width,
+                                  capture.height, capture.width * 4,
+                                  kDefaultScreenshotQuality, &full));
+
+      int width = 0;
+      int height = 0;
+      ASSERT_TRUE(FitImageSize(capture.width, capture.height, 640, 0, &width,
+                               &height));
+      EXPECT_LE(9 * width * height, capture.width * capture.height);
+      std::vector<uint8_t> thumbnail(static_cast<size_t>(width) * height * 4);
+      DownscaleBgrxPixels(capture.pixels.data(), capture.width, capture.height,
+                          capture.width * 4, thumbnail.data(), width, height,
+                          width * 4, PixelFormat::kBgra);
+      std::vector<uint8_t> encoded;
+      ASSERT_TRUE(encoder->encode(thumbnail.data(), width, height, width * 4,
+                                  kDefaultScreenshotQuality, &encoded));
+      EXPECT_LT(encoded.size(), full.size())
+          << format << " " << capture.name;
+    }
+  }
+}
+
+// What ScreenDeltaDecoder should hold after decoding |pixels|.
+std::vector<uint8_t> OpaqueFrame(const uint8_t* pixels,
+                                 int width,
+                                 int height,
+                                 int stride) {
+  std::vector<uint8_t> frame = WithoutPadding(pixels, width, height, stride);
+  for (size_t i = 3; i < frame.size(); i += 4) {
+    frame[i] = 0xFF;
+  }
+  return frame;
+}
+
+TEST(ScreenDelta, SendsOnlyChangedTiles) {
+  DesktopCapture capture = MakeDesktopCorpus()[1];
+  // An odd-sized region with partial tiles at its right and bottom edges.
+  const int stride = capture.width * 4;
+  uint8_t* region = capture.pixels.data() + 37 * stride + 4 * 61;
+  const int width = 1001;
+  const int height = 333;
+  const int columns = (width + 63) / 64;
+  const int rows = (height + 63) / 64;
+
+  ScreenDeltaEncoder encoder(64, 0);
+  ScreenDeltaDecoder decoder;
+  ScreenDelta delta;
+  ASSERT_TRUE(encoder.Encode(region, width, height, stride, false, &delta));
+  EXPECT_TRUE(delta.keyframe);
+  EXPECT_EQ(delta.sequence, 0);
+  EXPECT_EQ(delta.tiles.size(), static_cast<size_t>(columns * rows));
+  ASSERT_TRUE(decoder.Apply(delta));
+  EXPECT_TRUE(decoder.pixels() == OpaqueFrame(region, width, height, stride));
+
+  // Padding bytes are not part of the picture.
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      region[static_cast<size_t>(y) * stride + 4 * x + 3] ^= 0x5A;
+    }
+  }
+  ASSERT_TRUE(encoder.Encode(region, width, height, stride, false, &delta));
+  EXPECT_FALSE(delta.keyframe);
+  EXPECT_TRUE(delta.tiles.empty());
+  EXPECT_TRUE(delta.data.empty());
+  ASSERT_TRUE(decoder.Apply(delta));
+
+  // One channel of one pixel, in the bottom-right partial tile, and a
+  // rectangle across the corners of four tiles.
+  region[static_cast<size_t>(height - 1) * stride + 4 * (width - 1) + 1] ^= 1;
+  for (int y = 120; y < 136; y++) {
+    for (int x = 250; x < 260; x++) {
+      region[static_cast<size_t>(y) * stride + 4 * x + 2] ^= 0x80;
+    }
+  }
+  ASSERT_TRUE(encoder.Encode(region, width, height, stride, false, &delta));
+  EXPECT_THAT(delta.tiles,
+              testing::ElementsAre(columns + 3, columns + 4, 2 * columns + 3,
+                                   2 * columns + 4, columns * rows - 1));
+  ASSERT_TRUE(decoder.Apply(delta));
+  EXPECT_TRUE(decoder.pixels() == OpaqueFrame(region, width, height, stride));
+
+  // A new size starts over with a keyframe.
+  ASSERT_TRUE(encoder.Encode(region, width - 1, height, stride, false, &delta));
+  EXPECT_TRUE(delta.keyframe);
+  ASSERT_TRUE(decoder.Apply(delta));
+  EXPECT_EQ(decoder.width(), width - 1);
+  EXPECT_TRUE(decoder.pixels() ==
+              OpaqueFrame(region, width - 1, height, stride));
+}
+
+TEST(ScreenDelta, KeyframesAndSequence) {
+  std::vector<uint8_t> frame(100 * 70 * 4, 0x40);
+  std::vector<std::vector<uint8_t>> frames;
+  ScreenDeltaEncoder encoder(32, 3);
+  std::vector<ScreenDelta> deltas(8);
+  for (size_t i = 0; i < deltas.size(); i++) {
+    frame[4 * i] = static_cast<uint8_t>(i);
+    frames.push_back(OpaqueFrame(frame.data(), 100, 70, 400));
+    ASSERT_TRUE(encoder.Encode(frame.data(), 100, 70, 400, i == 4,
+                               &deltas[i]));
+    EXPECT_EQ(deltas[i].sequence, static_cast<int64_t>(i));
+  }
+  // Every third frame, counting again from the forced one.
+  for (size_t i = 0; i < deltas.size(); i++) {
+    EXPECT_EQ(deltas[i].keyframe, i == 0 || i == 3 || i == 4 || i == 7) << i;
+    EXPECT_EQ(deltas[i].tiles.size(), deltas[i].keyframe ? 12u : 1u) << i;
+  }
+
+  // A decoder that missed a delta waits for the next keyframe.
+  ScreenDeltaDecoder decoder;
+  EXPECT_FALSE(decoder.Apply(deltas[1]));
+  ASSERT_TRUE(decoder.Apply(deltas[0]));
+  EXPECT_FALSE(decoder.Apply(deltas[2]));
+  EXPECT_TRUE(decoder.pixels() == frames[0]);
+  for (size_t i = 3; i < 7; i++) {
+    ASSERT_TRUE(decoder.Apply(deltas[i])) << i;
+    EXPECT_TRUE(decoder.pixels() == frames[i]) << i;
+  }
+
+  // Damaged deltas are rejected without touching the frame.
+  ScreenDelta damaged = deltas[7];
+  damaged.tiles.push_back(12);
+  EXPECT_FALSE(decoder.Apply(damaged));
+  damaged = deltas[7];
+  damaged.data.resize(damaged.data.size() / 2);
+  EXPECT_FALSE(decoder.Apply(damaged));
+  EXPECT_TRUE(decoder.pixels() == frames[6]);
+  ASSERT_TRUE(decoder.Apply(deltas[7]));
+  EXPECT_TRUE(decoder.pixels() == frames[7]);
+}
+
+// What the Windows plugin sends when it is built without zlib.
+TEST(ScreenDelta, DecodesUncompressedTiles) {
+  const uint8_t pixels[] = {1, 2, 3, 0, 4, 5, 6, 0, 7, 8, 9, 0};
+  ScreenDelta delta;
+  delta.width = 3;
+  delta.height = 1;
+  delta.tile_size = 8;
+  delta.keyframe = true;
+  delta.tiles = {0};
+  delta.compression = "none";
+  delta.data = {1, 2, 3, 4, 5, 6, 7, 8, 9};
+
+  ScreenDeltaDecoder decoder;
+  ASSERT_TRUE(decoder.Apply(delta));
+  EXPECT_TRUE(decoder.pixels() == OpaqueFrame(pixels, 3, 1, 12));
+  delta.data.pop_back();
+  EXPECT_FALSE(decoder.Apply(delta));
+}
+
+// Ten minutes of a word processor sampled once a second, the way an
+// activity log would: typing with pauses, a blinking caret, a clock in the
+// title bar and a scroll every two minutes. Reported per hour against
+// sending every frame as PNG or JPEG. A benchmark; see
+// AudioActivityDetector.DISABLED_Throughput.
+TEST(ScreenDelta, DISABLED_OfficeWorkloadBenchmark) {
+  DesktopCapture document = MakeDesktopCorpus()[0];
+  const int width = document.width;
+  const int height = document.height;
+  const int stride = width * 4;
+  auto fill = [&](int x0, int y0, int x1, int y1, uint8_t value) {
+    for (int y = y0; y < y1; y++) {
+      for (int x = x0; x < x1; x++) {
+        uint8_t* p = &document.pixels[static_cast<size_t>(y) * stride + 4 * x];
+        p[0] = p[1] = p[2] = value;
+      }
+    }
+  };
+  constexpr int kFrames = 600;
+  constexpr int kLineHeight = 22;
+  uint32_t seed = 7;
+  int caret_x = 400;
+  int caret_y = 560;
+
+  ScreenDeltaEncoder encoder(kDefaultDeltaTileSize,
+                             kDefaultDeltaKeyframeInterval);
+  ScreenDeltaDecoder decoder;
+  ScreenDelta delta;
+  size_t delta_bytes = 0;
+  size_t full_bytes[2] = {};
+  int sampled_frames = 0;
+  int empty_frames = 0;
+  double encode_ms = 0;
+  for (int frame = 0; frame < kFrames; frame++) {
+    seed = seed * 1103515245 + 12345;
+    // Typing for three minutes out of every four.
+    if ((frame / 60) % 4 != 3 && (seed >> 16) % 3 != 0) {
+      for (int word = 0; word < 4; word++, caret_x += 9) {
+        fill(caret_x, caret_y + 4, caret_x + 2, caret_y + kLineHeight - 5,
+             0x20);
+        fill(caret_x, caret_y + kLineHeight - 6, caret_x + 7,
+             caret_y + kLineHeight - 5, 0x20);
+      }
+      if (caret_x > 1480) {
+        caret_x = 400;
+        caret_y += kLineHeight;
+      }
+    }
+    // The caret is caught in either phase of its blink.
+    fill(caret_x - 1, caret_y + 2, caret_x, caret_y + kLineHeight - 2,
+         (seed >> 20) & 1 ? 0x00 : 0xFF);
+    if (frame % 60 == 0) {
+      fill(1800, 12, 1800 + 8 * (frame / 60 % 5 + 1), 28, 0xE0);
+    }
+    if (frame % 120 == 119 && caret_y > 560) {
+      const int lines = caret_y - 560;
+      for (int y = 120; y + lines < height; y++) {
+        memmove(&document.pixels[static_cast<size_t>(y) * stride + 4 * 320],
+                &document.pixels[static_cast<size_t>(y + lines) * stride +
+                                 4 * 320],
+                4 * (1600 - 320));
+      }
+      fill(320, height - lines, 1600, height, 0xFF);
+      caret_y -= lines;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    ASSERT_TRUE(encoder.Encode(document.pixels.data(), width, height, stride,
+                               false, &delta));
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    encode_ms += elapsed.count();
+    delta_bytes += delta.data.size() + delta.tiles.size() * 4;
+    empty_frames += delta.tiles.empty() ? 1 : 0;
+    ASSERT_TRUE(decoder.Apply(delta)) << frame;
+
+    // Full frames are expensive to encode, so a sample stands in for them.
+    if (frame % 30 == 0) {
+      sampled_frames++;
+      const char* formats[] = {"png", "jpeg"};
+      for (int f = 0; f < 2; f++) {
+        const ScreenshotEncoder* full = FindScreenshotEncoder(formats[f]);
+        std::vector<uint8_t> encoded;
+        if (full != nullptr &&
+            full->encode(document.pixels.data(), width, height, stride,
+                         kDefaultScreenshotQuality, &encoded)) {
+          full_bytes[f] += encoded.size();
+        }
+      }
+    }
+  }
+  EXPECT_TRUE(decoder.pixels() ==
+              OpaqueFrame(document.pixels.data(), width, height, stride));
+
+  // An unchanged screen costs one pass over the frame.
+  ScreenDeltaEncoder idle(kDefaultDeltaTileSize, 0);
+  ASSERT_TRUE(idle.Encode(document.pixels.data(), width, height, stride,
+                          false, &delta));
+  double unchanged_ms = 0;
+  for (int i = 0; i < 10; i++) {
+    auto start = std::chrono::steady_clock::now();
+    ASSERT_TRUE(idle.Encode(document.pixels.data(), width, height, stride,
+                            false, &delta));
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    unchanged_ms += elapsed.count();
+    EXPECT_TRUE(delta.tiles.empty());
+  }
+
+  const double per_hour = 3600.0 / kFrames;
+  const double megabyte = 1024.0 * 1024.0;
+  const double delta_mb = delta_bytes * per_hour / megabyte;
+  const double png_mb =
+      full_bytes[0] * per_hour * kFrames / sampled_frames / megabyte;
+  std::cout << "[ScreenDelta] 1080p office workload at 1 fps: " << delta_mb
+            << " MB/hour as deltas (" << empty_frames << "/" << kFrames
+            << " frames empty, " << encode_ms / kFrames
+            << " ms/frame), PNG " << png_mb << " MB/hour";
+  if (full_bytes[1] > 0) {
+    std::cout << ", JPEG "
+              << full_bytes[1] * per_hour * kFrames / sampled_frames / megabyte
+              << " MB/hour";
+  }
+  std::cout << "; unchanged frame " << unchanged_ms / 10 << " ms"
+            << std::endl;
+  EXPECT_LT(delta_mb, png_mb / 10);
+}
+
+// Feeds a ScreenshotScheduler with a frame the test controls and collects
+// what it reports.
+class FakeScreen {
+ public:
+  FakeScreen() : pixels_(kWidth * kHeight * 4, 0x80) {}
+
+  ScreenshotScheduler::FrameSource Source() {
+    return [this](const CaptureTarget&, ScreenshotScheduler::Frame* frame) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      captures_++;
+      frame_ = pixels_;
+      frame->data = frame_.data();
+      frame->width = kWidth;
+      frame->height = kHeight;
+      frame->stride = kWidth * 4;
+      return true;
+    };
+  }
+
+  ScreenshotScheduler::ResultCallback Sink() {
+    return [this](const ScreenshotScheduler::Result& result) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      results_.push_back(result);
+      changed_.notify_all();
+    };
+  }
+
+  void Draw(int x, uint8_t value) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pixels_[4 * x] = value;
+  }
+
+  int captures() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return captures_;
+  }
+
+  // Waits for the |count|th result.
+  bool WaitForResults(size_t count) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return changed_.wait_for(lock, std::chrono::seconds(5), [&]() {
+      return results_.size() >= count;
+    });
+  }
+
+  std::vector<ScreenshotScheduler::Result> results() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return results_;
+  }
+
+  static constexpr int kWidth = 320;
+  static constexpr int kHeight = 200;
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::vector<uint8_t> pixels_;
+  // What the scheduler is reading, as a capture buffer would be.
+  std::vector<uint8_t> frame_;
+  int captures_ = 0;
+  std::vector<ScreenshotScheduler::Result> results_;
+};
+
+TEST(ScreenshotScheduler, SkipsIdleAndUnchangedScreens) {
+  char dir[] = "/tmp/window_focus_screenshotsXXXXXX";
+  ASSERT_NE(mkdtemp(dir), nullptr);
+  FakeScreen screen;
+  ScreenshotScheduler scheduler(screen.Source(), screen.Sink());
+  ScreenshotScheduler::Options options;
+  options.interval = std::chrono::milliseconds(10);
+  options.directory = dir;
+  options.encoder = FindScreenshotEncoder("png");
+  options.max_width = FakeScreen::kWidth / 2;
+  scheduler.Start(options);
+  ASSERT_TRUE(scheduler.is_running());
+  ASSERT_TRUE(screen.WaitForResults(1));
+
+  // The same screen is captured again but not saved.
+  const int captures = screen.captures();
+  while (screen.captures() < captures + 3) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  EXPECT_EQ(screen.results().size(), 1u);
+  screen.Draw(0, 0x10);
+  ASSERT_TRUE(screen.WaitForResults(2));
+
+  // Nothing is captured while the user is away.
+  scheduler.set_user_active(false);
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  const int idle_captures = screen.captures();
+  screen.Draw(0, 0x20);
+  std::this_thread::sleep_for(std::chrono::milliseconds(60));
+  EXPECT_EQ(screen.captures(), idle_captures);
+  EXPECT_EQ(screen.results().size(), 2u);
+  scheduler.set_user_active(true);
+  ASSERT_TRUE(screen.WaitForResults(3));
+  scheduler.Stop();
+  EXPECT_FALSE(scheduler.is_running());
+
+  const std::vector<ScreenshotScheduler::Result> results = screen.results();
+  ASSERT_EQ(results.size(), 3u);
+  EXPECT_GE(results[1].skipped_unchanged, 3);
+  EXPECT_GE(results[2].skipped_idle, 3);
+  std::set<std::string> paths;
+  for (const ScreenshotScheduler::Result& result : results) {
+    ASSERT_TRUE(result.error.empty()) << result.error;
+    EXPECT_STREQ(result.format, "png");
+    EXPECT_EQ(result.path.rfind(std::string(dir) + "/screenshot_", 0), 0u);
+    EXPECT_EQ(result.path.substr(result.path.size() - 4), ".png");
+    paths.insert(result.path);
+
+    FILE* file = fopen(result.path.c_str(), "rb");
+    ASSERT_NE(file, nullptr) << result.path;
+    std::vector<uint8_t> png(result.size + 1);
+    png.resize(fread(png.data(), 1, png.size(), file));
+    fclose(file);
+    EXPECT_EQ(png.size(), result.size);
+    int width = 0;
+    int height = 0;
+    std::vector<uint8_t> decoded;
+    ASSERT_TRUE(DecodePng(png, &width, &height, &decoded));
+    EXPECT_EQ(width, FakeScreen::kWidth / 2);
+    EXPECT_EQ(height, FakeScreen::kHeight / 2);
+    EXPECT_EQ(result.width, width);
+    EXPECT_EQ(result.height, height);
+  }
+  EXPECT_EQ(paths.size(), results.size());
+  // Only the finished files are left.
+  for (const std::string& path : paths) {
+    unlink(path.c_str());
+  }
+  EXPECT_EQ(rmdir(dir), 0);
+}
+
+TEST(ScreenshotScheduler, ReportsWriteErrors) {
+  FakeScreen screen;
+  ScreenshotScheduler scheduler(screen.Source(), screen.Sink());
+  ScreenshotScheduler::Options options;
+  options.interval = std::chrono::milliseconds(10);
+  options.directory = "/nonexistent/window_focus";
+  options.encoder = FindScreenshotEncoder("qoi");
+  options.skip_when_idle = false;
+  scheduler.Start(options);
+  ASSERT_TRUE(screen.WaitForResults(1));
+  scheduler.Stop();
+  const ScreenshotScheduler::Result result = screen.results()[0];
+  EXPECT_TRUE(result.path.empty());
+  EXPECT_NE(result.error.find("/nonexistent/window_focus/screenshot_"),
+            std::string::npos)
+      << result.error;
+  EXPECT_GT(result.timestamp_ms, 0);
+}
+
+TEST(FrameRing, EvictsOldestFramesToStayWithinItsBuffer) {
+  FrameRing ring(4, 100);
+  int next_id = 1;
+  auto push = [&ring, &next_id](size_t size) {
+    uint8_t* data = ring.Reserve(size);
+    if (data == nullptr) {
+      return false;
+    }
+    memset(data, next_id, size);
+    FrameRing::Frame frame;
+    frame.timestamp_ms = next_id++;
+    ring.Commit(frame);
+    return true;
+  };
+  // Frames still stored are intact and listed newest first.
+  auto ids = [&ring]() {
+    std::vector<int> ids;
+    for (size_t i = 0; i < ring.size(); i++) {
+      const FrameRing::Frame& frame = ring.frame(i);
+      const uint8_t* data = ring.data(i);
+      for (size_t j = 0; j < frame.size; j++) {
+        EXPECT_EQ(data[j], frame.timestamp_ms) << "frame " << i;
+      }
+      ids.push_back(static_cast<int>(frame.timestamp_ms));
+    }
+    return ids;
+  };
+
+  EXPECT_TRUE(push(30));
+  EXPECT_TRUE(push(30));
+  EXPECT_TRUE(push(30));
+  EXPECT_EQ(ids(), std::vector<int>({3, 2, 1}));
+  // Does not fit before the end: wraps and evicts the first frame only.
+  EXPECT_TRUE(push(20));
+  EXPECT_EQ(ids(), std::vector<int>({4, 3, 2}));
+  EXPECT_TRUE(push(5));
+  EXPECT_TRUE(push(5));
+  // No more than four frames.
+  EXPECT_EQ(ids(), std::vector<int>({6, 5, 4, 3}));
+  // Overlaps the third frame, the oldest left.
+  EXPECT_TRUE(push(40));
+  EXPECT_EQ(ids(), std::vector<int>({7, 6, 5, 4}));
+  // Wrapping again drops what is left past the newest frame first.
+  EXPECT_TRUE(push(50));
+  EXPECT_EQ(ids(), std::vector<int>({8}));
+  EXPECT_FALSE(push(101));
+  EXPECT_TRUE(push(50));
+  EXPECT_EQ(ids(), std::vector<int>({9, 8}));
+  EXPECT_TRUE(push(100));
+  EXPECT_EQ(ids(), std::vector<int>({10}));
+}
+
+TEST(ScreenshotRing, KeepsTheNewestFrames) {
+  FakeScreen screen;
+  ScreenshotRing ring(screen.Source());
+  std::vector<FrameRing::Frame> frames;
+  auto collect = [&frames](const FrameRing::Frame& frame, const uint8_t*) {
+    frames.push_back(frame);
+  };
+  EXPECT_EQ(ring.ReadRecent(1, collect), 0u);
+
+  ScreenshotRing::Options options;
+  options.interval = std::chrono::milliseconds(10);
+  options.frames = 3;
+  options.max_width = FakeScreen::kWidth / 2;
+  ring.Start(options);
+  ASSERT_TRUE(ring.is_running());
+  while (screen.captures() < 5) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  screen.Draw(0, 0x10);
+  const int drawn = screen.captures();
+  while (screen.captures() < drawn + 2) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+
+  // Raw frames are opaque BGRA at the reduced size.
+  std::vector<uint8_t> newest;
+  EXPECT_EQ(ring.ReadRecent(10,
+                            [&](const FrameRing::Frame& frame,
+                                const uint8_t* data) {
+                              if (frames.empty()) {
+                                newest.assign(data, data + frame.size);
+                              }
+                              frames.push_back(frame);
+                            }),
+            3u);
+  ASSERT_EQ(frames.size(), 3u);
+  for (size_t i = 0; i < frames.size(); i++) {
+    EXPECT_EQ(frames[i].width, FakeScreen::kWidth / 2);
+    EXPECT_EQ(frames[i].height, FakeScreen::kHeight / 2);
+    EXPECT_EQ(frames[i].size,
+              static_cast<size_t>(FakeScreen::kWidth / 2) *
+                  (FakeScreen::kHeight / 2) * 4);
+    if (i > 0) {
+      EXPECT_GE(frames[i - 1].timestamp_ms, frames[i].timestamp_ms);
+    }
+  }
+  EXPECT_EQ(newest[0], (0x10 + 3 * 0x80) / 4);
+  EXPECT_EQ(newest[3], 0xff);
+  EXPECT_EQ(newest[4], 0x80);
+
+  // Encoded frames, here QOI, are stored as they would be returned.
+  options.encoder = FindScreenshotEncoder("qoi");
+  options.max_width = 0;
+  ring.Start(options);
+  while (ring.ReadRecent(1, [](const FrameRing::Frame&, const uint8_t*) {}) ==
+         0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  std::vector<uint8_t> qoi;
+  const auto start = std::chrono::steady_clock::now();
+  ring.ReadRecent(1, [&qoi](const FrameRing::Frame& frame,
+                            const uint8_t* data) {
+    qoi.assign(data, data + frame.size);
+  });
+  const std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::cout << "[Ring] newest " << qoi.size() << " byte QOI frame in "
+            << elapsed.count() << " ms" << std::endl;
+  int width = 0;
+  int height = 0;
+  std::vector<uint8_t> decoded;
+  ASSERT_TRUE(DecodeQoi(qoi, &width, &height, &decoded));
+  EXPECT_EQ(width, FakeScreen::kWidth * 1);
+  EXPECT_EQ(height, FakeScreen::kHeight * 1);
+  EXPECT_EQ(decoded[0], 0x10);
+
+  ring.Stop();
+  EXPECT_FALSE(ring.is_running());
+  EXPECT_EQ(ring.ReadRecent(1, collect), 0u);
+}
+
+// A screen whose captures wait until it is opened, so that requests can be
+// made while one is running, and what a worker pool answers with.
+class GatedScreen {
+ public:
+  ScreenshotWorkerPool::FrameSourceFactory Factory() {
+    return [this]() -> ScreenshotScheduler::FrameSource {
+      // A buffer per worker, as each would have a capture of its own.
+      std::shared_ptr<std::vector<uint8_t>> pixels =
+          std::make_shared<std::vector<uint8_t>>();
+      return [this, pixels](const CaptureTarget&,
+                            ScreenshotScheduler::Frame* frame) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        captures_++;
+        changed_.notify_all();
+        changed_.wait(lock, [this]() { return open_; });
+        pixels->assign(kWidth * kHeight * 4, 0x80);
+        frame->data = pixels->data();
+        frame->width = kWidth;
+        frame->height = kHeight;
+        frame->stride = kWidth * 4;
+        return true;
+      };
+    };
+  }
+
+  ScreenshotWorkerPool::Callback Collect(int id) {
+    return [this, id](ScreenshotWorkerPool::Result result) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      results_.emplace_back(id, std::move(result));
+      changed_.notify_all();
+    };
+  }
+
+  void Open() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    open_ = true;
+    changed_.notify_all();
+  }
+
+  // Waits for the |count|th capture to start.
+  bool WaitForCaptures(int count) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return changed_.wait_for(lock, std::chrono::seconds(5),
+                             [&]() { return captures_ >= count; });
+  }
+
+  // Waits for the |count|th result and returns them by request.
+  std::map<int, ScreenshotWorkerPool::Result> WaitForResults(size_t count) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait_for(lock, std::chrono::seconds(5),
+                      [&]() { return results_.size() >= count; });
+    std::map<int, ScreenshotWorkerPool::Result> results;
+    for (const auto& result : results_) {
+      EXPECT_TRUE(results.emplace(result.first, result.second).second)
+          << "request " << result.first << " answered twice";
+    }
+    return results;
+  }
+
+  int captures() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return captures_;
+  }
+
+  static constexpr int kWidth = 320;
+  static constexpr int kHeight = 200;
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  bool open_ = false;
+  int captures_ = 0;
+  std::vector<std::pair<int, ScreenshotWorkerPool::Result>> results_;
+};
+
+TEST(ScreenshotWorkerPool, SharesCapturesAndBoundsTheQueue) {
+  GatedScreen screen;
+  ScreenshotWorkerPool pool(screen.Factory(), 1, 2);
+  ScreenshotWorkerPool::Request qoi;
+  qoi.encoder = FindScreenshotEncoder("qoi");
+  ScreenshotWorkerPool::Request rgba;
+  rgba.pixel_format = PixelFormat::kRgba;
+  ScreenshotWorkerPool::Request half = qoi;
+  half.target.max_width = GatedScreen::kWidth / 2;
+  ScreenshotWorkerPool::Request window = qoi;
+  window.target.active_window_only = true;
+  ScreenshotWorkerPool::Request quarter = qoi;
+  quarter.target.max_width = GatedScreen::kWidth / 4;
+
+  ASSERT_TRUE(pool.Submit(qoi, screen.Collect(0)));
+  ASSERT_TRUE(screen.WaitForCaptures(1));
+  // The same target joins the running capture, whatever the encoding.
+  EXPECT_TRUE(pool.Submit(rgba, screen.Collect(1)));
+  EXPECT_TRUE(pool.Submit(qoi, screen.Collect(2)));
+  // Other targets queue, up to the limit, unless they can join one there.
+  EXPECT_TRUE(pool.Submit(half, screen.Collect(3)));
+  EXPECT_TRUE(pool.Submit(window, screen.Collect(4)));
+  EXPECT_FALSE(pool.Submit(quarter, screen.Collect(5)));
+  EXPECT_TRUE(pool.Submit(half, screen.Collect(6)));
+  EXPECT_EQ(pool.queued(), 2u);
+
+  screen.Open();
+  std::map<int, ScreenshotWorkerPool::Result> results =
+      screen.WaitForResults(6);
+  ASSERT_EQ(results.size(), 6u);
+  EXPECT_EQ(results.count(5), 0u);
+  EXPECT_EQ(screen.captures(), 3);
+  for (const auto& result : results) {
+    EXPECT_TRUE(result.second.error.empty()) << result.first;
+    EXPECT_FALSE(result.second.cancelled) << result.first;
+  }
+
+  int width = 0;
+  int height = 0;
+  std::vector<uint8_t> decoded;
+  ASSERT_TRUE(DecodeQoi(results[0].data, &width, &height, &decoded));
+  EXPECT_EQ(width, GatedScreen::kWidth * 1);
+  EXPECT_EQ(height, GatedScreen::kHeight * 1);
+  EXPECT_EQ(results[2].data, results[0].data);
+  EXPECT_EQ(results[1].width, GatedScreen::kWidth * 1);
+  EXPECT_EQ(results[1].stride, GatedScreen::kWidth * 4);
+  EXPECT_EQ(results[1].data.size(),
+            static_cast<size_t>(GatedScreen::kWidth) * GatedScreen::kHeight *
+                4);
+  EXPECT_EQ(results[1].data[0], 0x80);
+  EXPECT_EQ(results[1].data[3], 0xff);
+  EXPECT_EQ(results[3].width, GatedScreen::kWidth / 2);
+  EXPECT_EQ(results[6].data, results[3].data);
+}
+
+TEST(ScreenshotWorkerPool, CancelsRequestsNotAnsweredYet) {
+  GatedScreen screen;
+  ScreenshotWorkerPool pool(screen.Factory(), 1, 2);
+  ScreenshotWorkerPool::Request screenshot;
+  screenshot.encoder = FindScreenshotEncoder("qoi");
+  ScreenshotWorkerPool::Request window = screenshot;
+  window.target.active_window_only = true;
+
+  ASSERT_TRUE(pool.Submit(screenshot, screen.Collect(0)));
+  ASSERT_TRUE(screen.WaitForCaptures(1));
+  ASSERT_TRUE(pool.Submit(window, screen.Collect(1)));
+  EXPECT_EQ(pool.CancelAll(), 2u);
+  std::map<int, ScreenshotWorkerPool::Result> results =
+      screen.WaitForResults(2);
+  ASSERT_EQ(results.size(), 2u);
+  EXPECT_TRUE(results[0].cancelled);
+  EXPECT_TRUE(results[1].cancelled);
+  EXPECT_EQ(pool.queued(), 0u);
+
+  // The running capture finishes without answering the cancelled requests
+  // again, and later requests are answered as usual.
+  screen.Open();
+  ASSERT_TRUE(pool.Submit(screenshot, screen.Collect(2)));
+  results = screen.WaitForResults(3);
+  ASSERT_EQ(results.size(), 3u);
+  EXPECT_FALSE(results[2].cancelled);
+  EXPECT_FALSE(results[2].data.empty());
+  EXPECT_EQ(pool.CancelAll(), 0u);
+}
+
+TEST(ScreenshotWorkerPool, RunsDeltaStreamsInOrder) {
+  GatedScreen screen;
+  ScreenshotWorkerPool pool(screen.Factory(), 3, 4);
+  ScreenshotWorkerPool::Request qoi;
+  qoi.encoder = FindScreenshotEncoder("qoi");
+  ScreenshotWorkerPool::DeltaStream stream;
+  ScreenshotWorkerPool::Request delta;
+  delta.delta_stream = &stream;
+  delta.tile_size = 32;
+
+  ASSERT_TRUE(pool.Submit(qoi, screen.Collect(0)));
+  ASSERT_TRUE(screen.WaitForCaptures(1));
+  // Deltas never join another capture, and a stream's requests wait for
+  // each other even while a worker is free.
+  for (int i = 1; i <= 3; i++) {
+    ASSERT_TRUE(pool.Submit(delta, screen.Collect(i)));
+  }
+  ASSERT_TRUE(screen.WaitForCaptures(2));
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(screen.captures(), 2);
+  EXPECT_EQ(pool.queued(), 2u);
+
+  screen.Open();
+  std::map<int, ScreenshotWorkerPool::Result> results =
+      screen.WaitForResults(4);
+  ASSERT_EQ(results.size(), 4u);
+  EXPECT_EQ(screen.captures(), 4);
+  for (int i = 1; i <= 3; i++) {
+    const ScreenshotWorkerPool::Result& result = results[i];
+    EXPECT_TRUE(result.error.empty()) << i;
+    EXPECT_EQ(result.delta.sequence, i - 1);
+    EXPECT_EQ(result.delta.width, GatedScreen::kWidth * 1);
+    EXPECT_EQ(result.delta.tile_size, 32);
+  }
+  EXPECT_TRUE(results[1].delta.keyframe);
+  // The screen did not change after the keyframe.
+  EXPECT_TRUE(results[2].delta.tiles.empty());
+  EXPECT_TRUE(results[3].delta.tiles.empty());
+}
+
+TEST(CaptureContext, LendsSourcesUntilTheFrameIsDropped) {
+  int opened = 0;
+  std::vector<uint8_t> pixels(16, 0x80);
+  CaptureContext context([&]() -> ScreenshotScheduler::FrameSource {
+    opened++;
+    return [&](const CaptureTarget&, ScreenshotScheduler::Frame* frame) {
+      frame->data = pixels.data();
+      frame->width = 2;
+      frame->height = 2;
+      frame->stride = 8;
+      return true;
+    };
+  });
+  ScreenshotScheduler::FrameSource source = context.NewSource();
+  context.UpdateScreenSize(2, 2);
+  {
+    ScreenshotScheduler::Frame first;
+    ScreenshotScheduler::Frame second;
+    ASSERT_TRUE(source(CaptureTarget(), &first));
+    ASSERT_TRUE(source(CaptureTarget(), &second));
+    // The first frame still holds its source.
+    EXPECT_EQ(opened, 2);
+    EXPECT_EQ(context.idle_captures(), 0u);
+  }
+  EXPECT_EQ(context.idle_captures(), 2u);
+  ScreenshotScheduler::Frame frame;
+  ASSERT_TRUE(context.NewSource()(CaptureTarget(), &frame));
+  EXPECT_EQ(opened, 2);
+
+  // Nothing sized for the old screen is kept.
+  context.UpdateScreenSize(2, 2);
+  EXPECT_EQ(context.idle_captures(), 1u);
+  context.UpdateScreenSize(4, 2);
+  EXPECT_EQ(context.idle_captures(), 0u);
+  frame = ScreenshotScheduler::Frame();
+  EXPECT_EQ(context.idle_captures(), 0u);
+  ASSERT_TRUE(source(CaptureTarget(), &frame));
+  EXPECT_EQ(opened, 3);
+}
+
+TEST(CaptureContext, RecyclesBuffersThatFit) {
+  CaptureContext context(nullptr, kMaxIdleCaptures, 2);
+  std::vector<uint8_t> small(100);
+  std::vector<uint8_t> large(1000);
+  const uint8_t* small_data = small.data();
+  const uint8_t* large_data = large.data();
+  context.ReleaseBuffer(std::move(large));
+  context.ReleaseBuffer(std::move(small));
+  EXPECT_EQ(context.idle_buffers(), 2u);
+
+  // The smallest that fits, emptied.
+  std::vector<uint8_t> buffer = context.AcquireBuffer(50);
+  EXPECT_EQ(buffer.data(), small_data);
+  EXPECT_TRUE(buffer.empty());
+  std::vector<uint8_t> fresh = context.AcquireBuffer(2000);
+  EXPECT_GE(fresh.capacity(), 2000u);
+  EXPECT_EQ(context.idle_buffers(), 1u);
+  buffer = context.AcquireBuffer(500);
+  EXPECT_EQ(buffer.data(), large_data);
+
+  // When full, the smallest buffer gives way to a larger one.
+  context.ReleaseBuffer(std::vector<uint8_t>(10));
+  context.ReleaseBuffer(std::vector<uint8_t>(20));
+  context.ReleaseBuffer(std::move(fresh));
+  EXPECT_EQ(context.idle_buffers(), 2u);
+  EXPECT_GE(context.AcquireBuffer(1500).capacity(), 2000u);
+  context.Invalidate();
+  EXPECT_EQ(context.idle_buffers(), 0u);
+}
+
+// A dbus-daemon of its own, so the test neither needs nor disturbs the
+// desktop's session bus.
+class PrivateBus {
+ public:
+  PrivateBus() {
+    FILE* output = popen(
+        "dbus-daemon --session --fork --print-address=1 --print-pid=1 "
+        "2>/dev/null",
+        "r");
+    if (output == nullptr) {
+      return;
+    }
+    char address[512] = {};
+    char pid[32] = {};
+    if (fgets(address, sizeof(address), output) != nullptr &&
+        fgets(pid, sizeof(pid), output) != nullptr) {
+      address_ = g_strstrip(address);
+      pid_ = atoi(pid);
+    }
+    pclose(output);
+  }
+
+  ~PrivateBus() {
+    if (pid_ > 0) {
+      kill(pid_, SIGTERM);
+    }
+  }
+
+  bool running() const { return pid_ > 0; }
+
+  GDBusConnection* Connect() const {
+    return g_dbus_connection_new_for_address_sync(
+        address_.c_str(),
+        static_cast<GDBusConnectionFlags>(
+            G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+            G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION),
+        nullptr, nullptr, nullptr);
+  }
+
+ private:
+  std::string address_;
+  pid_t pid_ = 0;
+};
+
+// Exports one read-only property under a well-known name on a connection of
+// its own, the way an MPRIS player or the session manager does.
+class PropertyService {
+ public:
+  PropertyService(const PrivateBus& bus,
+                  const char* path,
+                  const char* interface,
+                  const char* property,
+                  GVariant* value)
+      : connection_(bus.Connect()),
+        path_(path),
+        interface_(interface),
+        property_(property),
+        value_(g_variant_ref_sink(value)) {
+    const std::string xml = std::string("<node><interface name='") +
+                            interface + "'><property name='" + property +
+                            "' type='" + g_variant_get_type_string(value) +
+                            "' access='read'/></interface></node>";
+    node_ = g_dbus_node_info_new_for_xml(xml.c_str(), nullptr);
+    static const GDBusInterfaceVTable vtable = {nullptr, GetProperty, nullptr,
+                                                {}};
+    registration_ = g_dbus_connection_register_object(
+        connection_, path,
+        g_dbus_node_info_lookup_interface(node_, interface), &vtable, this,
+        nullptr, nullptr);
+  }
+
+  ~PropertyService() {
+    g_dbus_connection_unregister_object(connection_, registration_);
+    g_dbus_connection_close_sync(connection_, nullptr, nullptr);
+    g_object_unref(connection_);
+    g_dbus_node_info_unref(node_);
+    g_variant_unref(value_);
+  }
+
+  void RequestName(const char* name) {
+    GVariant* reply = g_dbus_connection_call_sync(
+        connection_, "org.freedesktop.DBus", "/org/freedesktop/DBus",
+        "org.freedesktop.DBus", "RequestName", g_variant_new("(su)", name, 0),
+        nullptr, G_DBUS_CALL_FLAGS_NONE, -1, nullptr, nullptr);
+    ASSERT_NE(reply, nullptr);
+    g_variant_unref(reply);
+  }
+
+  // Sets the property and announces it with PropertiesChanged.
+  void Set(GVariant* value) {
+    g_variant_unref(value_);
+    value_ = g_variant_ref_sink(value);
+    GVariantBuilder* changed = g_variant_builder_new(G_VARIANT_TYPE("a{sv}"));
+    g_variant_builder_add(changed, "{sv}", property_.c_str(), value_);
+    g_dbus_connection_emit_signal(
+        connection_, nullptr, path_.c_str(), "org.freedesktop.DBus.Properties",
+        "PropertiesChanged",
+        g_variant_new("(sa{sv}as)", interface_.c_str(), changed, nullptr),
+        nullptr);
+    g_variant_builder_unref(changed);
+    g_dbus_connection_flush_sync(connection_, nullptr, nullptr);
+  }
+
+ private:
+  static GVariant* GetProperty(GDBusConnection* connection,
+                               const gchar* sender,
+                               const gchar* path,
+                               const gchar* interface,
+                               const gchar* property,
+                               GError** error,
+                               gpointer user_data) {
+    return g_variant_ref(static_cast<PropertyService*>(user_data)->value_);
+  }
+
+  GDBusConnection* connection_;
+  std::string path_;
+  std::string interface_;
+  std::string property_;
+  GVariant* value_;
+  GDBusNodeInfo* node_ = nullptr;
+  guint registration_ = 0;
+};
+
+TEST(MediaSessionMonitor, FollowsPlayersAndInhibitors) {
+  PrivateBus bus;
+  if (!bus.running()) {
+    GTEST_SKIP() << "No dbus-daemon";
+  }
+  constexpr char kPlayerPath[] = "/org/mpris/MediaPlayer2";
+  constexpr char kPlayerInterface[] = "org.mpris.MediaPlayer2.Player";
+  auto player = std::make_unique<PropertyService>(
+      bus, kPlayerPath, kPlayerInterface, "PlaybackStatus",
+      g_variant_new_string("Playing"));
+  player->RequestName("org.mpris.MediaPlayer2.TestPlayer.instance1");
+
+  std::vector<bool> states;
+  MediaSessionMonitor monitor(
+      [&states](bool active) { states.push_back(active); });
+  monitor.set_ignored_players({"testplayer"});
+  GDBusConnection* connection = bus.Connect();
+  ASSERT_TRUE(monitor.Start(connection));
+  g_object_unref(connection);
+
+  // The player that was already there is found, but ignored.
+  ASSERT_TRUE(RunMainContextUntil(
+      [&] { return !monitor.GetPlayingPlayers().empty(); }, 5000));
+  EXPECT_EQ(monitor.GetPlayingPlayers(),
+            std::vector<std::string>(
+                {"org.mpris.MediaPlayer2.TestPlayer.instance1"}));
+  EXPECT_TRUE(states.empty());
+  monitor.set_ignored_players({});
+  ASSERT_EQ(states, std::vector<bool>({true}));
+
+  player->Set(g_variant_new_string("Paused"));
+  ASSERT_TRUE(RunMainContextUntil([&] { return states.size() == 2; }, 5000));
+  EXPECT_FALSE(states.back());
+
+  // A player that appears later, and then goes away while playing.
+  PropertyService late(bus, kPlayerPath, kPlayerInterface, "PlaybackStatus",
+                       g_variant_new_string("Stopped"));
+  late.RequestName("org.mpris.MediaPlayer2.late");
+  late.Set(g_variant_new_string("Playing"));
+  ASSERT_TRUE(RunMainContextUntil([&] { return states.size() == 3; }, 5000));
+  EXPECT_TRUE(states.back());
+  player.reset();
+  RunMainContextUntil([] { return false; }, 100);
+  EXPECT_EQ(monitor.GetPlayingPlayers(),
+            std::vector<std::string>({"org.mpris.MediaPlayer2.late"}));
+  late.Set(g_variant_new_string("Paused"));
+  ASSERT_TRUE(RunMainContextUntil([&] { return states.size() == 4; }, 5000));
+  EXPECT_FALSE(states.back());
+
+  // An idle inhibitor, as a video player holds through the session manager.
+  PropertyService session(bus, "/org/gnome/SessionManager",
+                          "org.gnome.SessionManager", "InhibitedActions",
+                          g_variant_new_uint32(0));
+  session.RequestName("org.gnome.SessionManager");
+  session.Set(g_variant_new_uint32(MediaSessionMonitor::kInhibitIdle | 4));
+  ASSERT_TRUE(RunMainContextUntil([&] { return states.size() == 5; }, 5000));
+  EXPECT_TRUE(states.back());
+  EXPECT_TRUE(monitor.inhibited());
+  session.Set(g_variant_new_uint32(4));
+  ASSERT_TRUE(RunMainContextUntil([&] { return states.size() == 6; }, 5000));
+  EXPECT_FALSE(states.back());
+
+  monitor.Stop();
+  EXPECT_FALSE(monitor.is_running());
+}
+
+#ifdef WINDOW_FOCUS_HAVE_PULSEAUDIO_SIMPLE
+// Blocking access to the session's PulseAudio server for test setup.
+class PulseControl {
+ public:
+  PulseControl() : mainloop_(pa_mainloop_new()) {
+    context_ =
+        pa_context_new(pa_mainloop_get_api(mainloop_), "window_focus_test");
+    if (pa_context_connect(context_, nullptr, PA_CONTEXT_NOAUTOSPAWN,
+                           nullptr) < 0) {
+      return;
+    }
+    while (true) {
+      const pa_context_state_t state = pa_context_get_state(context_);
+      if (state == PA_CONTEXT_READY) {
+        connected_ = true;
+        return;
+      }
+      if (state == PA_CONTEXT_FAILED || state == PA_CONTEXT_TERMINATED ||
+          pa_mainloop_iterate(mainloop_, 1, nullptr) < 0) {
+        return;
+      }
+    }
+  }
+
+  ~PulseControl() {
+    pa_context_disconnect(context_);
+    pa_context_unref(context_);
+    pa_mainloop_free(mainloop_);
+  }
+
+  bool connected() const { return connected_; }
+
+  std::string DefaultSink() {
+    std::string sink;
+    Wait(pa_context_get_server_info(
+        context_,
+        [](pa_context*, const pa_server_info* info, void* user_data) {
+          if (info != nullptr && info->default_sink_name != nullptr) {
+            *static_cast<std::string*>(user_data) = info->default_sink_name;
+          }
+        },
+        &sink));
+    return sink;
+  }
+
+  uint32_t LoadModule(const char* name, const char* arguments) {
+    uint32_t index = PA_INVALID_INDEX;
+    Wait(pa_context_load_module(
+        context_, name, arguments,
+        [](pa_context*, uint32_t result, void* user_data) {
+          *static_cast<uint32_t*>(user_data) = result;
+        },
+        &index));
+    return index;
+  }
+
+  void UnloadModule(uint32_t index) {
+    Wait(pa_context_unload_module(context_, index, nullptr, nullptr));
+  }
+
+  void SetDefaultSink(const std::string& sink) {
+    Wait(pa_context_set_default_sink(context_, sink.c_str(), nullptr,
+                                     nullptr));
+  }
+
+ private:
+  void Wait(pa_operation* operation) {
+    if (operation == nullptr) {
+      return;
+    }
+    while (pa_operation_get_state(operation) == PA_OPERATION_RUNNING &&
+           pa_mainloop_iterate(mainloop_, 1, nullptr) >= 0) {
+    }
+    pa_operation_unref(operation);
+  }
+
+  pa_mainloop* mainloop_;
+  pa_context* context_ = nullptr;
+  bool connected_ = false;
+};
+
+// Plays 100 ms of a 440 Hz tone, or silence when |amplitude| is 0.
+void PlayBlock(pa_simple* playback, float amplitude, int block) {
+  constexpr int kRate = 48000;
+  std::vector<float> samples(kRate / 10);
+  for (size_t i = 0; i < samples.size(); i++) {
+    const double t =
+        static_cast<double>(block * samples.size() + i) / kRate;
+    samples[i] = amplitude * static_cast<float>(std::sin(2 * M_PI * 440 * t));
+  }
+  pa_simple_write(playback, samples.data(), samples.size() * sizeof(float),
+                  nullptr);
+}
+
+TEST(PulseAudioMonitor, FollowsDefaultSinkAndDetectsTone) {
+  PulseControl control;
+  if (!control.connected()) {
+    GTEST_SKIP() << "No PulseAudio or PipeWire server";
+  }
+  const std::string sink = "window_focus_test_" + std::to_string(getpid());
+  const uint32_t module = control.LoadModule(
+      "module-null-sink", ("sink_name=" + sink).c_str());
+  ASSERT_NE(module, PA_INVALID_INDEX);
+  const std::string previous_sink = control.DefaultSink();
+
+  std::atomic<int> activity{0};
+  PulseAudioMonitor monitor([&activity]() { activity++; });
+  monitor.set_threshold(0.05f);
+  ASSERT_TRUE(monitor.Start());
+
+  // Becoming the default sink moves the meter over.
+  control.SetDefaultSink(sink);
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (monitor.source_name() != sink + ".monitor" &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(monitor.source_name(), sink + ".monitor");
+
+  pa_sample_spec spec = {};
+  spec.format = PA_SAMPLE_FLOAT32NE;
+  spec.rate = 48000;
+  spec.channels = 1;
+  pa_simple* playback =
+      pa_simple_new(nullptr, "window_focus_test", PA_STREAM_PLAYBACK,
+                    sink.c_str(), "tone", &spec, nullptr, nullptr, nullptr);
+  ASSERT_NE(playback, nullptr);
+
+  for (int block = 0; block < 5; block++) {
+    PlayBlock(playback, 0.0f, block);
+  }
+  pa_simple_drain(playback, nullptr);
+  EXPECT_EQ(activity.load(), 0);
+
+  for (int block = 0; block < 20 && activity.load() == 0; block++) {
+    PlayBlock(playback, 0.5f, block);
+  }
+  EXPECT_GT(activity.load(), 0);
+  EXPECT_TRUE(monitor.level().playing);
+
+  pa_simple_free(playback);
+  monitor.Stop();
+  if (!previous_sink.empty()) {
+    control.SetDefaultSink(previous_sink);
+  }
+  control.UnloadModule(module);
+}
+
+TEST(PulseAudioMonitor, AttributesAudioToApplications) {
+  PulseControl control;
+  if (!control.connected()) {
+    GTEST_SKIP() << "No PulseAudio or PipeWire server";
+  }
+  const std::string sink = "window_focus_apps_" + std::to_string(getpid());
+  const uint32_t module = control.LoadModule(
+      "module-null-sink", ("sink_name=" + sink).c_str());
+  ASSERT_NE(module, PA_INVALID_INDEX);
+  const std::string previous_sink = control.DefaultSink();
+  control.SetDefaultSink(sink);
+
+  std::atomic<int> activity{0};
+  PulseAudioMonitor monitor([&activity]() { activity++; });
+  monitor.set_threshold(0.05f);
+  monitor.set_application_policy(
+      [](const PulseAudioMonitor::Application& app) {
+        return app.name != "window_focus_test";
+      });
+  ASSERT_TRUE(monitor.Start());
+
+  pa_sample_spec spec = {};
+  spec.format = PA_SAMPLE_FLOAT32NE;
+  spec.rate = 48000;
+  spec.channels = 1;
+  pa_simple* playback =
+      pa_simple_new(nullptr, "window_focus_test", PA_STREAM_PLAYBACK,
+                    sink.c_str(), "tone", &spec, nullptr, nullptr, nullptr);
+  ASSERT_NE(playback, nullptr);
+
+  // Long enough for the detector to report playback.
+  for (int block = 0; block < 20; block++) {
+    PlayBlock(playback, 0.5f, block);
+  }
+  // Other applications may be playing elsewhere on a desktop.
+  auto find_test_app = [&monitor](PulseAudioMonitor::Application* found) {
+    for (const auto& app : monitor.GetApplications()) {
+      if (app.name == "window_focus_test") {
+        *found = app;
+        return true;
+      }
+    }
+    return false;
+  };
+  PulseAudioMonitor::Application app;
+  ASSERT_TRUE(find_test_app(&app));
+  EXPECT_EQ(app.pid, getpid());
+  EXPECT_TRUE(app.active);
+  EXPECT_GT(app.peak, 0.05f);
+  EXPECT_TRUE(monitor.level().playing);
+  // The policy rejects the only application playing.
+  EXPECT_EQ(activity.load(), 0);
+
+  monitor.set_application_policy(nullptr);
+  for (int block = 20; block < 25; block++) {
+    PlayBlock(playback, 0.5f, block);
+  }
+  EXPECT_GT(activity.load(), 0);
+
+  pa_simple_free(playback);
+  // The stream's removal is delivered as a subscription event.
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (find_test_app(&app) &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_FALSE(find_test_app(&app));
+
+  monitor.Stop();
+  if (!previous_sink.empty()) {
+    control.SetDefaultSink(previous_sink);
+  }
+  control.UnloadModule(module);
+}
+#endif  // WINDOW_FOCUS_HAVE_PULSEAUDIO_SIMPLE
+
 }  // namespace test
 }  // namespace window_focus
@@ -0,0 +1,267 @@
+#include "wayland_idle_monitor.h"
+
+#include <glib-unix.h>
+#include <wayland-client.h>
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#ifdef WINDOW_FOCUS_HAVE_EXT_IDLE_NOTIFY
+#include "ext-idle-notify-v1-client-protocol.h"
+#endif
+#ifdef WINDOW_FOCUS_HAVE_KDE_IDLE
+#include "kde-idle-client-protocol.h"
+#endif
+
+namespace window_focus {
+
+WaylandIdleMonitor::WaylandIdleMonitor(Callback on_idle, Callback on_resumed)
+    : on_idle_(std::move(on_idle)), on_resumed_(std::move(on_resumed)) {}
+
+WaylandIdleMonitor::~WaylandIdleMonitor() {
+  Stop();
+}
+
+bool WaylandIdleMonitor::Start(const char* display_name, uint32_t timeout_ms) {
+  static const wl_registry_listener registry_listener = {
+      OnRegistryGlobal,
+      OnRegistryGlobalRemove,
+  };
+
+  Stop();
+  timeout_ms_ = timeout_ms;
+
+  display_ = wl_display_connect(display_name);
+  if (display_ == nullptr) {
+    return false;
+  }
+
+  registry_ = wl_display_get_registry(display_);
+  wl_registry_add_listener(registry_, &registry_listener, this);
+  if (wl_display_roundtrip(display_) < 0 || !CreateNotification()) {
+    Stop();
+    return false;
+  }
+
+  fd_source_id_ = g_unix_fd_add(
+      wl_display_get_fd(display_),
+      static_cast<GIOCondition>(G_IO_IN | G_IO_ERR | G_IO_HUP),
+      OnDisplayEvent, this);
+  wl_display_flush(display_);
+  return true;
+}
+
+void WaylandIdleMonitor::Stop() {
+  if (fd_source_id_ != 0) {
+    g_source_remove(fd_source_id_);
+    fd_source_id_ = 0;
+  }
+
+  DestroyNotification();
+
+#ifdef WINDOW_FOCUS_HAVE_EXT_IDLE_NOTIFY
+  if (notifier_ != nullptr) {
+    ext_idle_notifier_v1_destroy(notifier_);
+    notifier_ = nullptr;
+  }
+#endif
+#ifdef WINDOW_FOCUS_HAVE_KDE_IDLE
+  if (kde_idle_ != nullptr) {
+    org_kde_kwin_idle_destroy(kde_idle_);
+    kde_idle_ = nullptr;
+  }
+#endif
+  if (seat_ != nullptr) {
+    wl_seat_destroy(seat_);
+    seat_ = nullptr;
+  }
+  if (registry_ != nullptr) {
+    wl_registry_destroy(registry_);
+    registry_ = nullptr;
+  }
+  if (display_ != nullptr) {
+    wl_display_disconnect(display_);
+    display_ = nullptr;
+  }
+}
+
+void WaylandIdleMonitor::SetTimeout(uint32_t timeout_ms) {
+  timeout_ms_ = timeout_ms;
+  if (display_ == nullptr) {
+    return;
+  }
+  DestroyNotification();
+  CreateNotification();
+  wl_display_flush(display_);
+}
+
+const char* WaylandIdleMonitor::protocol_name() const {
+  if (notification_ != nullptr) {
+    return "ext-idle-notify-v1";
+  }
+  if (kde_timeout_ != nullptr) {
+    return "org_kde_kwin_idle";
+  }
+  return "none";
+}
+
+bool WaylandIdleMonitor::CreateNotification() {
+  if (seat_ == nullptr) {
+    return false;
+  }
+
+#ifdef WINDOW_FOCUS_HAVE_EXT_IDLE_NOTIFY
+  if (notifier_ != nullptr) {
+    static const ext_idle_notification_v1_listener listener = {
+        OnIdled,
+        OnResumed,
+    };
+#ifdef EXT_IDLE_NOTIFIER_V1_GET_INPUT_IDLE_NOTIFICATION_SINCE_VERSION
+    // Version 2 can ignore idle inhibitors, which is what we want: a video
+    // player inhibiting the screensaver is not user input.
+    if (notifier_version_ >=
+        EXT_IDLE_NOTIFIER_V1_GET_INPUT_IDLE_NOTIFICATION_SINCE_VERSION) {
+      notification_ = ext_idle_notifier_v1_get_input_idle_notification(
+          notifier_, timeout_ms_, seat_);
+    } else {
+      notification_ = ext_idle_notifier_v1_get_idle_notification(
+          notifier_, timeout_ms_, seat_);
+    }
+#else
+    notification_ = ext_idle_notifier_v1_get_idle_notification(
+        notifier_, timeout_ms_, seat_);
+#endif
+    ext_idle_notification_v1_add_listener(notification_, &listener, this);
+    return true;
+  }
+#endif
+
+#ifdef WINDOW_FOCUS_HAVE_KDE_IDLE
+  if (kde_idle_ != nullptr) {
+    static const org_kde_kwin_idle_timeout_listener listener = {
+        OnKdeIdle,
+        OnKdeResumed,
+    };
+    kde_timeout_ =
+        org_kde_kwin_idle_get_idle_timeout(kde_idle_, seat_, timeout_ms_);
+    org_kde_kwin_idle_timeout_add_listener(kde_timeout_, &listener, this);
+    return true;
+  }
+#endif
+
+  return false;
+}
+
+void WaylandIdleMonitor::DestroyNotification() {
+#ifdef WINDOW_FOCUS_HAVE_EXT_IDLE_NOTIFY
+  if (notification_ != nullptr) {
+    ext_idle_notification_v1_destroy(notification_);
+    notification_ = nullptr;
+  }
+#endif
+#ifdef WINDOW_FOCUS_HAVE_KDE_IDLE
+  if (kde_timeout_ != nullptr) {
+    org_kde_kwin_idle_timeout_release(kde_timeout_);
+    kde_timeout_ = nullptr;
+  }
+#endif
+}
+
+// static
+void WaylandIdleMonitor::OnRegistryGlobal(void* data, wl_registry* registry,
+                                          uint32_t name,
+                                          const char* interface,
+                                          uint32_t version) {
+  auto* self = static_cast<WaylandIdleMonitor*>(data);
+
+  if (strcmp(interface, wl_seat_interface.name) == 0) {
+    // Idle time is tracked per seat; the first one is the user's.
+    if (self->seat_ == nullptr) {
+      self->seat_ = static_cast<wl_seat*>(
+          wl_registry_bind(registry, name, &wl_seat_interface, 1));
+    }
+    return;
+  }
+
+#ifdef WINDOW_FOCUS_HAVE_EXT_IDLE_NOTIFY
+  if (strcmp(interface, ext_idle_notifier_v1_interface.name) == 0) {
+    self->notifier_version_ = std::min(
+        version,
+        static_cast<uint32_t>(ext_idle_notifier_v1_interface.version));
+    self->notifier_ = static_cast<ext_idle_notifier_v1*>(
+        wl_registry_bind(registry, name, &ext_idle_notifier_v1_interface,
+                         self->notifier_version_));
+    return;
+  }
+#endif
+
+#ifdef WINDOW_FOCUS_HAVE_KDE_IDLE
+  if (strcmp(interface, org_kde_kwin_idle_interface.name) == 0) {
+    self->kde_idle_ = static_cast<org_kde_kwin_idle*>(
+        wl_registry_bind(registry, name, &org_kde_kwin_idle_interface, 1));
+    return;
+  }
+#endif
+}
+
+// static
+void WaylandIdleMonitor::OnRegistryGlobalRemove(void* data,
+                                                wl_registry* registry,
+                                                uint32_t name) {}
+
+// static
+void WaylandIdleMonitor::OnIdled(void* data,
+                                 ext_idle_notification_v1* notification) {
+  auto* self = static_cast<WaylandIdleMonitor*>(data);
+  if (self->on_idle_) {
+    self->on_idle_();
+  }
+}
+
+// static
+void WaylandIdleMonitor::OnResumed(void* data,
+                                   ext_idle_notification_v1* notification) {
+  auto* self = static_cast<WaylandIdleMonitor*>(data);
+  if (self->on_resumed_) {
+    self->on_resumed_();
+  }
+}
+
+// static
+void WaylandIdleMonitor::OnKdeIdle(void* data,
+                                   org_kde_kwin_idle_timeout* timeout) {
+  auto* self = static_cast<WaylandIdleMonitor*>(data);
+  if (self->on_idle_) {
+    self->on_idle_();
+  }
+}
+
+// static
+void WaylandIdleMonitor::OnKdeResumed(void* data,
+                                      org_kde_kwin_idle_timeout* timeout) {
+  auto* self = static_cast<WaylandIdleMonitor*>(data);
+  if (self->on_resumed_) {
+    self->on_resumed_();
+  }
+}
+
+// static
+gboolean WaylandIdleMonitor::OnDisplayEvent(gint fd, GIOCondition condition,
+                                            gpointer user_data) {
+  auto* self = static_cast<WaylandIdleMonitor*>(user_data);
+
+  if ((condition & (G_IO_ERR | G_IO_HUP)) != 0 ||
+      wl_display_dispatch(self->display_) < 0) {
+    // The compositor went away. Returning G_SOURCE_REMOVE drops the source,
+    // so make sure Stop() does not remove it a second time.
+    self->fd_source_id_ = 0;
+    self->Stop();
+    return G_SOURCE_REMOVE;
+  }
+
+  wl_display_flush(self->display_);
+  return G_SOURCE_CONTINUE;
+}
+
+}  // namespace window_focus
@@ -0,0 +1,83 @@
+#ifndef FLUTTER_PLUGIN_WINDOW_FOCUS_WAYLAND_IDLE_MONITOR_H_
+#define FLUTTER_PLUGIN_WINDOW_FOCUS_WAYLAND_IDLE_MONITOR_H_
+
+#include <glib.h>
+
+#include <cstdint>
+#include <functional>
+
+struct wl_display;
+struct wl_registry;
+struct wl_seat;
+struct ext_idle_notifier_v1;
+struct ext_idle_notification_v1;
+struct org_kde_kwin_idle;
+struct org_kde_kwin_idle_timeout;
+
+namespace window_focus {
+
+// Idle detection for Wayland sessions, where global input hooks are not
+// available. The compositor is asked to notify us after |timeout| of seat
+// inactivity through ext-idle-notify-v1, or through the older KDE
+// org_kde_kwin_idle protocol when the former is not advertised.
+//
+// The monitor owns a private wl_display connection whose fd is dispatched
+// from the GLib main context, so callbacks run on the main thread and no
+// polling is involved.
+class WaylandIdleMonitor {
+ public:
+  using Callback = std::function<void()>;
+
+  WaylandIdleMonitor(Callback on_idle, Callback on_resumed);
+  ~WaylandIdleMonitor();
+
+  WaylandIdleMonitor(const WaylandIdleMonitor&) = delete;
+  WaylandIdleMonitor& operator=(const WaylandIdleMonitor&) = delete;
+
+  // Connects to |display_name| (nullptr means $WAYLAND_DISPLAY) and requests
+  // idle notifications. Returns false when there is no Wayland compositor or
+  // it supports neither idle protocol.
+  bool Start(const char* display_name, uint32_t timeout_ms);
+  void Stop();
+
+  // Re-arms the notification with a new timeout.
+  void SetTimeout(uint32_t timeout_ms);
+
+  bool is_running() const { return display_ != nullptr; }
+  // Name of the protocol in use, for debug output.
+  const char* protocol_name() const;
+
+ private:
+  static void OnRegistryGlobal(void* data, wl_registry* registry,
+                               uint32_t name, const char* interface,
+                               uint32_t version);
+  static void OnRegistryGlobalRemove(void* data, wl_registry* registry,
+                                     uint32_t name);
+  static void OnIdled(void* data, ext_idle_notification_v1* notification);
+  static void OnResumed(void* data, ext_idle_notification_v1* notification);
+  static void OnKdeIdle(void* data, org_kde_kwin_idle_timeout* timeout);
+  static void OnKdeResumed(void* data, org_kde_kwin_idle_timeout* timeout);
+  static gboolean OnDisplayEvent(gint fd, GIOCondition condition,
+                                 gpointer user_data);
+
+  bool CreateNotification();
+  void DestroyNotification();
+
+  Callback on_idle_;
+  Callback on_resumed_;
+  uint32_t timeout_ms_ = 0;
+
+  wl_display* display_ = nullptr;
+  wl_registry* registry_ = nullptr;
+  wl_seat* seat_ = nullptr;
+  ext_idle_notifier_v1* notifier_ = nullptr;
+  uint32_t notifier_version_ = 0;
+  ext_idle_notification_v1* notification_ = nullptr;
+  org_kde_kwin_idle* kde_idle_ = nullptr;
+  org_kde_kwin_idle_timeout* kde_timeout_ = nullptr;
+  guint fd_source_id_ = 0;
+};
+
+}  // namespace window_focus
+
+#endif  // FLUTTER_PLUGIN_WINDOW_FOCUS_WAYLAND_IDLE_MONITOR_H_
@@ -4,20 +4,1694 @@
 #include <gtk/gtk.h>
 #include <sys/utsname.h>
 
+#include <array>
+#include <cerrno>
+#include <chrono>
 #include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
 
+#include "activity_tracker.h"
+#include "capture_context.h"
+#include "capture_target.h"
+#include "evdev_gamepad_monitor.h"
+#include "hidraw_monitor.h"
+#include "media_session_monitor.h"
+#include "pixel_format.h"
+#include "screen_delta.h"
+#include "screenshot_encoder.h"
+#include "screenshot_ring.h"
+#include "screenshot_scheduler.h"
+#include "screenshot_worker_pool.h"
 #include "window_focus_plugin_private.h"
 
+#ifdef WINDOW_FOCUS_HAVE_PULSEAUDIO
+#include "pulse_audio_monitor.h"
+#endif
+#ifdef WINDOW_FOCUS_HAVE_WAYLAND
+#include "wayland_idle_monitor.h"
+#endif
+#ifdef WINDOW_FOCUS_HAVE_XINPUT2
+#include "xinput2_monitor.h"
+#endif
+#ifdef WINDOW_FOCUS_HAVE_XSHM
+#include "xshm_capture.h"
+#endif
+
 #define WINDOW_FOCUS_PLUGIN(obj) \
   (G_TYPE_CHECK_INSTANCE_CAST((obj), window_focus_plugin_get_type(), \
                               WindowFocusPlugin))
 
 struct _WindowFocusPlugin {
   GObject parent_instance;
+
+  // A weak pointer: the channel's method call handler owns the plugin, and
+  // the engine owns the channel, so a strong reference here would keep both
+  // alive forever and dispose would never run.
+  FlMethodChannel* channel;
+
+  window_focus::ActivityTracker* activity_tracker;
+#ifdef WINDOW_FOCUS_HAVE_WAYLAND
+  window_focus::WaylandIdleMonitor* wayland_idle_monitor;
+#endif
+#ifdef WINDOW_FOCUS_HAVE_XINPUT2
+  window_focus::XInput2Monitor* xinput2_monitor;
+#endif
+  // Only exists while HID monitoring is enabled.
+  window_focus::HidrawMonitor* hidraw_monitor;
+  // Only exists while controller monitoring is enabled.
+  window_focus::EvdevGamepadMonitor* gamepad_monitor;
+#ifdef WINDOW_FOCUS_HAVE_PULSEAUDIO
+  // Only exists while audio monitoring is enabled.
+  window_focus::PulseAudioMonitor* audio_monitor;
+#endif
+  // Only exists while audio monitoring is enabled.
+  window_focus::MediaSessionMonitor* media_monitor;
+#ifdef WINDOW_FOCUS_HAVE_XSHM
+  // The X11 connections, shared segments and buffers every screenshot
+  // borrows. Created by the first screenshot and kept.
+  window_focus::CaptureContext* capture_context;
+  // Only exists once startScreenshotSchedule was called. Captures on its own
+  // thread.
+  window_focus::ScreenshotScheduler* screenshot_scheduler;
+  // Only exists once startScreenshotRing was called, likewise with a thread
+  // of its own.
+  window_focus::ScreenshotRing* screenshot_ring;
+  // Takes takeScreenshot, takeScreenshotRaw and takeScreenshotDelta off the
+  // main thread. Created by the first of them.
+  window_focus::ScreenshotWorkerPool* screenshot_workers;
+  // What takeScreenshotDelta diffs against, used by one worker at a time.
+  // Created by the first takeScreenshotDelta.
+  window_focus::ScreenshotWorkerPool::DeltaStream* delta_stream;
+#endif
+
+  gboolean enable_debug;
+  // Whether onDeviceChange events are sent to Dart.
+  gboolean device_change_events;
+
+  // Monitoring switches sent by the Dart side. They are kept so that every
+  // backend sees the same configuration the Windows plugin would.
+  gboolean monitor_keyboard;
+  gboolean monitor_controllers;
+  gboolean monitor_audio;
+  gboolean monitor_hid_devices;
+  double audio_threshold;
+  double hid_axis_deadzone;
+  // Per-axis overrides from setControllerAxisFilter, indexed by ABS_* code,
+  // kept for controller monitors started later.
+  std::array<window_focus::EvdevAxisFilter::AxisSettings, ABS_CNT>*
+      controller_axis_settings;
+  // Applications whose audio never counts as activity, matched against the
+  // process binary or application name. Null-terminated, may be null.
+  gchar** audio_ignored_apps;
 };
 
 G_DEFINE_TYPE(WindowFocusPlugin, window_focus_plugin, g_object_get_type())
 
+// Sends an event to the Dart side. Must be called on the main thread.
+static void window_focus_plugin_invoke(WindowFocusPlugin* self,
+                                       const gchar* method,
+                                       const gchar* message) {
+  if (self->channel == nullptr) {
+    return;
+  }
+  g_autoptr(FlValue) args = fl_value_new_string(message);
+  fl_method_channel_invoke_method(self->channel, method, args, nullptr,
+                                  nullptr, nullptr);
+}
+
+static void window_focus_plugin_on_activity_changed(WindowFocusPlugin* self,
+                                                    bool active) {
+#ifdef WINDOW_FOCUS_HAVE_XSHM
+  if (self->screenshot_scheduler != nullptr) {
+    self->screenshot_scheduler->set_user_active(active);
+  }
+#endif
+  if (self->enable_debug) {
+    std::cout << "[WindowFocus] User is "
+              << (active ? "active" : "inactive") << std::endl;
+  }
+  if (active) {
+    window_focus_plugin_invoke(self, "onUserActive", "User is active");
+  } else {
+    window_focus_plugin_invoke(self, "onUserInactivity", "User is inactive");
+  }
+}
+
+// Picks the idle backend for the current session.
+static void window_focus_plugin_start_monitoring(WindowFocusPlugin* self) {
+#ifdef WINDOW_FOCUS_HAVE_WAYLAND
+  if (g_getenv("WAYLAND_DISPLAY") != nullptr) {
+    window_focus::ActivityTracker* tracker = self->activity_tracker;
+    self->wayland_idle_monitor = new window_focus::WaylandIdleMonitor(
+        [tracker]() { tracker->SetInputIdle(true); },
+        [tracker]() { tracker->SetInputIdle(false); });
+    if (self->wayland_idle_monitor->Start(
+            nullptr, tracker->inactivity_threshold())) {
+      tracker->SetInputIdleSource(true);
+      std::cout << "[WindowFocus] Wayland idle monitoring via "
+                << self->wayland_idle_monitor->protocol_name() << std::endl;
+    } else {
+      std::cerr << "[WindowFocus] Compositor supports neither "
+                << "ext-idle-notify-v1 nor org_kde_kwin_idle" << std::endl;
+      delete self->wayland_idle_monitor;
+      self->wayland_idle_monitor = nullptr;
+    }
+  }
+#endif
+
+#ifdef WINDOW_FOCUS_HAVE_XINPUT2
+  // Under XWayland raw events only cover X clients, so this is the fallback
+  // for Wayland compositors without an idle protocol.
+  gboolean have_input_idle_source = FALSE;
+#ifdef WINDOW_FOCUS_HAVE_WAYLAND
+  have_input_idle_source = self->wayland_idle_monitor != nullptr;
+#endif
+  if (!have_input_idle_source && g_getenv("DISPLAY") != nullptr) {
+    window_focus::ActivityTracker* tracker = self->activity_tracker;
+    self->xinput2_monitor = new window_focus::XInput2Monitor(
+        [tracker]() { tracker->RecordActivity(); });
+    self->xinput2_monitor->set_monitor_keyboard(self->monitor_keyboard);
+    self->xinput2_monitor->set_debug(self->enable_debug);
+    if (self->xinput2_monitor->Start(nullptr)) {
+      std::cout << "[WindowFocus] X11 input monitoring via XInput2 raw events"
+                << std::endl;
+    } else {
+      delete self->xinput2_monitor;
+      self->xinput2_monitor = nullptr;
+    }
+  }
+#endif
+}
+
+// A hotplug event reported on a backend thread, delivered on the main thread.
+struct DeviceChangeEvent {
+  WindowFocusPlugin* plugin;
+  bool added;
+  std::string source;
+  window_focus::InputDeviceInfo info;
+};
+
+static gboolean window_focus_plugin_dispatch_device_change(gpointer user_data) {
+  DeviceChangeEvent* event = static_cast<DeviceChangeEvent*>(user_data);
+  WindowFocusPlugin* self = event->plugin;
+  if (!self->device_change_events || self->channel == nullptr) {
+    return G_SOURCE_REMOVE;
+  }
+
+  g_autoptr(FlValue) args = fl_value_new_map();
+  fl_value_set_string_take(args, "action",
+                           fl_value_new_string(event->added ? "added"
+                                                            : "removed"));
+  fl_value_set_string_take(args, "source",
+                           fl_value_new_string(event->source.c_str()));
+  fl_value_set_string_take(args, "path",
+                           fl_value_new_string(event->info.path.c_str()));
+  fl_value_set_string_take(args, "vendorId",
+                           fl_value_new_int(event->info.vendor_id));
+  fl_value_set_string_take(args, "productId",
+                           fl_value_new_int(event->info.product_id));
+  fl_value_set_string_take(args, "usagePage",
+                           fl_value_new_int(event->info.usage_page));
+  fl_value_set_string_take(args, "usage", fl_value_new_int(event->info.usage));
+  fl_method_channel_invoke_method(self->channel, "onDeviceChange", args,
+                                  nullptr, nullptr, nullptr);
+  return G_SOURCE_REMOVE;
+}
+
+static void device_change_event_free(gpointer user_data) {
+  DeviceChangeEvent* event = static_cast<DeviceChangeEvent*>(user_data);
+  g_object_unref(event->plugin);
+  delete event;
+}
+
+// Thread-safe; the event holds a reference to the plugin until delivered.
+static void window_focus_plugin_post_device_change(
+    WindowFocusPlugin* self, const char* source, bool added,
+    const window_focus::InputDeviceInfo& info) {
+  DeviceChangeEvent* event = new DeviceChangeEvent{
+      WINDOW_FOCUS_PLUGIN(g_object_ref(self)), added, source, info};
+  g_main_context_invoke_full(nullptr, G_PRIORITY_DEFAULT,
+                             window_focus_plugin_dispatch_device_change, event,
+                             device_change_event_free);
+}
+
+static void window_focus_plugin_start_hid_monitoring(WindowFocusPlugin* self) {
+  window_focus::ActivityTracker* tracker = self->activity_tracker;
+  self->hidraw_monitor = new window_focus::HidrawMonitor(
+      [tracker]() { tracker->RecordActivity(); });
+  self->hidraw_monitor->set_debug(self->enable_debug);
+  self->hidraw_monitor->set_axis_deadzone(self->hid_axis_deadzone);
+  self->hidraw_monitor->set_device_change_callback(
+      [self](bool added,
+             const window_focus::HidrawMonitor::DeviceInfo& info) {
+        window_focus_plugin_post_device_change(self, "hid", added, info);
+      });
+  if (!self->hidraw_monitor->Start()) {
+    delete self->hidraw_monitor;
+    self->hidraw_monitor = nullptr;
+  }
+}
+
+static void window_focus_plugin_stop_hid_monitoring(WindowFocusPlugin* self) {
+  delete self->hidraw_monitor;
+  self->hidraw_monitor = nullptr;
+}
+
+static void window_focus_plugin_start_controller_monitoring(
+    WindowFocusPlugin* self) {
+  window_focus::ActivityTracker* tracker = self->activity_tracker;
+  self->gamepad_monitor = new window_focus::EvdevGamepadMonitor(
+      [tracker]() { tracker->RecordActivity(); });
+  self->gamepad_monitor->set_debug(self->enable_debug);
+  self->gamepad_monitor->set_axis_deadzone(self->hid_axis_deadzone);
+  for (uint16_t code = 0; code < ABS_CNT; code++) {
+    self->gamepad_monitor->set_axis_settings(
+        code, (*self->controller_axis_settings)[code]);
+  }
+  self->gamepad_monitor->set_device_change_callback(
+      [self](bool added, const window_focus::InputDeviceInfo& info) {
+        window_focus_plugin_post_device_change(self, "evdev", added, info);
+      });
+  if (!self->gamepad_monitor->Start()) {
+    delete self->gamepad_monitor;
+    self->gamepad_monitor = nullptr;
+  }
+}
+
+static void window_focus_plugin_stop_controller_monitoring(
+    WindowFocusPlugin* self) {
+  delete self->gamepad_monitor;
+  self->gamepad_monitor = nullptr;
+}
+
+// Installs the ignored applications as the audio monitor's policy and the
+// media monitor's ignored players.
+static void window_focus_plugin_apply_audio_policy(WindowFocusPlugin* self) {
+  std::vector<std::string> ignored;
+  if (self->audio_ignored_apps != nullptr) {
+    for (gchar** app = self->audio_ignored_apps; *app != nullptr; app++) {
+      ignored.emplace_back(*app);
+    }
+  }
+  if (self->media_monitor != nullptr) {
+    self->media_monitor->set_ignored_players(ignored);
+  }
+#ifdef WINDOW_FOCUS_HAVE_PULSEAUDIO
+  if (self->audio_monitor == nullptr) {
+    return;
+  }
+  if (ignored.empty()) {
+    self->audio_monitor->set_application_policy(nullptr);
+    return;
+  }
+  self->audio_monitor->set_application_policy(
+      [ignored](const window_focus::PulseAudioMonitor::Application& app) {
+        for (const std::string& name : ignored) {
+          if (g_ascii_strcasecmp(name.c_str(), app.binary.c_str()) == 0 ||
+              g_ascii_strcasecmp(name.c_str(), app.name.c_str()) == 0) {
+            return false;
+          }
+        }
+        return true;
+      });
+#endif
+}
+
+// Called on the main thread when an idle inhibitor or a playing player
+// appears or goes away.
+static void window_focus_plugin_on_media_changed(WindowFocusPlugin* self,
+                                                 bool active) {
+  self->activity_tracker->SetMediaActive(active);
+#ifdef WINDOW_FOCUS_HAVE_PULSEAUDIO
+  // Nothing to meter while the session already says media is playing.
+  if (self->audio_monitor != nullptr) {
+    self->audio_monitor->SetSuspended(active);
+  }
+#endif
+}
+
+static void window_focus_plugin_start_audio_monitoring(WindowFocusPlugin* self) {
+#ifdef WINDOW_FOCUS_HAVE_PULSEAUDIO
+  window_focus::ActivityTracker* tracker = self->activity_tracker;
+  self->audio_monitor = new window_focus::PulseAudioMonitor(
+      [tracker]() { tracker->RecordActivity(); });
+  self->audio_monitor->set_debug(self->enable_debug);
+  self->audio_monitor->set_threshold(
+      static_cast<float>(self->audio_threshold));
+  if (!self->audio_monitor->Start()) {
+    delete self->audio_monitor;
+    self->audio_monitor = nullptr;
+  }
+#else
+  std::cerr << "[WindowFocus] Built without PulseAudio, audio activity is "
+            << "not detected" << std::endl;
+#endif
+
+  self->media_monitor = new window_focus::MediaSessionMonitor(
+      [self](bool active) {
+        window_focus_plugin_on_media_changed(self, active);
+      });
+  self->media_monitor->set_debug(self->enable_debug);
+  window_focus_plugin_apply_audio_policy(self);
+  if (!self->media_monitor->Start()) {
+    delete self->media_monitor;
+    self->media_monitor = nullptr;
+  }
+}
+
+static void window_focus_plugin_stop_audio_monitoring(WindowFocusPlugin* self) {
+  if (self->media_monitor != nullptr) {
+    delete self->media_monitor;
+    self->media_monitor = nullptr;
+    self->activity_tracker->SetMediaActive(false);
+  }
+#ifdef WINDOW_FOCUS_HAVE_PULSEAUDIO
+  delete self->audio_monitor;
+  self->audio_monitor = nullptr;
+#endif
+}
+
+// Returns the value stored under |key| in a map argument, or nullptr.
+static FlValue* lookup_argument(FlMethodCall* method_call, const gchar* key) {
+  FlValue* args = fl_method_call_get_args(method_call);
+  if (args == nullptr || fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return nullptr;
+  }
+  return fl_value_lookup_string(args, key);
+}
+
+// Reads a bool argument; returns FALSE if it is missing or of another type.
+static gboolean get_bool_argument(FlMethodCall* method_call, const gchar* key,
+                                  gboolean* out) {
+  FlValue* value = lookup_argument(method_call, key);
+  if (value == nullptr || fl_value_get_type(value) != FL_VALUE_TYPE_BOOL) {
+    return FALSE;
+  }
+  *out = fl_value_get_bool(value);
+  return TRUE;
+}
+
+static FlMethodResponse* invalid_bool_argument(const gchar* key) {
+  g_autofree gchar* message = g_strdup_printf("Expected a bool for '%s'.", key);
+  return FL_METHOD_RESPONSE(
+      fl_method_error_response_new("Invalid argument", message, nullptr));
+}
+
+static FlMethodResponse* set_monitoring_flag(FlMethodCall* method_call,
+                                             const gchar* name,
+                                             gboolean* flag) {
+  if (!get_bool_argument(method_call, "enabled", flag)) {
+    return invalid_bool_argument("enabled");
+  }
+  std::cout << "[WindowFocus] " << name << " monitoring set to "
+            << (*flag ? "true" : "false") << std::endl;
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+static FlMethodResponse* set_inactivity_timeout(WindowFocusPlugin* self,
+                                                FlMethodCall* method_call) {
+  FlValue* value = lookup_argument(method_call, "inactivityTimeOut");
+  if (value == nullptr || fl_value_get_type(value) != FL_VALUE_TYPE_INT) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "Invalid argument", "Expected an integer argument.", nullptr));
+  }
+
+  int threshold = static_cast<int>(fl_value_get_int(value));
+  self->activity_tracker->SetInactivityThreshold(threshold);
+#ifdef WINDOW_FOCUS_HAVE_WAYLAND
+  if (self->wayland_idle_monitor != nullptr) {
+    // The re-armed notification starts from a busy seat, so mirror that in
+    // the tracker instead of waiting for a resume that will never come.
+    self->wayland_idle_monitor->SetTimeout(threshold);
+    self->activity_tracker->SetInputIdle(false);
+  }
+#endif
+  std::cout << "Updated inactivityThreshold_ to " << threshold << std::endl;
+
+  g_autoptr(FlValue) result = fl_value_new_int(threshold);
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+static void append_input_devices(
+    FlValue* devices, const gchar* source,
+    const std::vector<window_focus::InputDeviceInfo>& infos) {
+  for (const auto& info : infos) {
+    FlValue* device = fl_value_new_map();
+    fl_value_set_string_take(device, "source", fl_value_new_string(source));
+    fl_value_set_string_take(device, "name",
+                             fl_value_new_string(info.name.c_str()));
+    fl_value_set_string_take(device, "path",
+                             fl_value_new_string(info.path.c_str()));
+    fl_value_set_string_take(device, "vendorId",
+                             fl_value_new_int(info.vendor_id));
+    fl_value_set_string_take(device, "productId",
+                             fl_value_new_int(info.product_id));
+    fl_value_set_string_take(device, "usagePage",
+                             fl_value_new_int(info.usage_page));
+    fl_value_set_string_take(device, "usage", fl_value_new_int(info.usage));
+    fl_value_set_string_take(device, "lastActivity",
+                             fl_value_new_int(info.last_activity_ms));
+    fl_value_set_string_take(
+        device, "eventCount",
+        fl_value_new_int(static_cast<int64_t>(info.event_count)));
+    fl_value_append_take(devices, device);
+  }
+}
+
+// Lists the monitored devices with their activity counters.
+static FlMethodResponse* get_input_devices(WindowFocusPlugin* self) {
+  g_autoptr(FlValue) devices = fl_value_new_list();
+  if (self->hidraw_monitor != nullptr) {
+    append_input_devices(devices, "hid", self->hidraw_monitor->GetDevices());
+  }
+  if (self->gamepad_monitor != nullptr) {
+    append_input_devices(devices, "evdev",
+                         self->gamepad_monitor->GetDevices());
+  }
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(devices));
+}
+
+// Reports the level of the last detector window; all zero while audio
+// monitoring is disabled.
+static FlMethodResponse* get_audio_level(WindowFocusPlugin* self) {
+  g_autoptr(FlValue) result = fl_value_new_map();
+  double rms = 0.0;
+  double peak = 0.0;
+  bool playing = false;
+#ifdef WINDOW_FOCUS_HAVE_PULSEAUDIO
+  if (self->audio_monitor != nullptr) {
+    const window_focus::PulseAudioMonitor::Level level =
+        self->audio_monitor->level();
+    rms = level.rms;
+    peak = level.peak;
+    playing = level.playing;
+  }
+#endif
+  fl_value_set_string_take(result, "rms", fl_value_new_float(rms));
+  fl_value_set_string_take(result, "peak", fl_value_new_float(peak));
+  fl_value_set_string_take(result, "playing", fl_value_new_bool(playing));
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+// Lists the applications playing audio and whether each is audible.
+static FlMethodResponse* get_audio_applications(WindowFocusPlugin* self) {
+  g_autoptr(FlValue) applications = fl_value_new_list();
+#ifdef WINDOW_FOCUS_HAVE_PULSEAUDIO
+  if (self->audio_monitor != nullptr) {
+    for (const auto& app : self->audio_monitor->GetApplications()) {
+      FlValue* entry = fl_value_new_map();
+      fl_value_set_string_take(entry, "pid", fl_value_new_int(app.pid));
+      fl_value_set_string_take(entry, "name",
+                               fl_value_new_string(app.name.c_str()));
+      fl_value_set_string_take(entry, "binary",
+                               fl_value_new_string(app.binary.c_str()));
+      fl_value_set_string_take(entry, "peak", fl_value_new_float(app.peak));
+      fl_value_set_string_take(entry, "active",
+                               fl_value_new_bool(app.active));
+      fl_value_append_take(applications, entry);
+    }
+  }
+#endif
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(applications));
+}
+
+static FlMethodResponse* set_audio_ignored_apps(WindowFocusPlugin* self,
+                                                FlMethodCall* method_call) {
+  FlValue* value = lookup_argument(method_call, "apps");
+  if (value == nullptr || fl_value_get_type(value) != FL_VALUE_TYPE_LIST) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "Invalid argument", "Expected a list of strings for 'apps'.",
+        nullptr));
+  }
+  const size_t count = fl_value_get_length(value);
+  for (size_t i = 0; i < count; i++) {
+    if (fl_value_get_type(fl_value_get_list_value(value, i)) !=
+        FL_VALUE_TYPE_STRING) {
+      return FL_METHOD_RESPONSE(fl_method_error_response_new(
+          "Invalid argument", "Expected a list of strings for 'apps'.",
+          nullptr));
+    }
+  }
+
+  g_strfreev(self->audio_ignored_apps);
+  self->audio_ignored_apps = g_new0(gchar*, count + 1);
+  for (size_t i = 0; i < count; i++) {
+    self->audio_ignored_apps[i] =
+        g_strdup(fl_value_get_string(fl_value_get_list_value(value, i)));
+  }
+  window_focus_plugin_apply_audio_policy(self);
+  std::cout << "[WindowFocus] Ignoring audio from " << count
+            << " applications" << std::endl;
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+// Reads an optional fraction in [0, 1) for |key|; null or absent gives -1,
+// the filter's default. Returns false for anything else.
+static bool get_axis_fraction(FlMethodCall* method_call,
+                              const gchar* key,
+                              double* fraction) {
+  FlValue* value = lookup_argument(method_call, key);
+  if (value == nullptr || fl_value_get_type(value) == FL_VALUE_TYPE_NULL) {
+    *fraction = -1.0;
+    return true;
+  }
+  if (fl_value_get_type(value) != FL_VALUE_TYPE_FLOAT ||
+      fl_value_get_float(value) < 0.0 || fl_value_get_float(value) >= 1.0) {
+    return false;
+  }
+  *fraction = fl_value_get_float(value);
+  return true;
+}
+
+static FlMethodResponse* set_controller_axis_filter(
+    WindowFocusPlugin* self,
+    FlMethodCall* method_call) {
+  FlValue* axis = lookup_argument(method_call, "axis");
+  uint16_t code = 0;
+  if (axis == nullptr || fl_value_get_type(axis) != FL_VALUE_TYPE_STRING ||
+      !window_focus::EvdevAxisFromName(fl_value_get_string(axis), &code)) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "Invalid argument",
+        "Expected one of x, y, z, rx, ry, rz, throttle, rudder, wheel, gas "
+        "or brake for 'axis'.",
+        nullptr));
+  }
+  window_focus::EvdevAxisFilter::AxisSettings settings;
+  if (!get_axis_fraction(method_call, "deadzone", &settings.deadzone) ||
+      !get_axis_fraction(method_call, "hysteresis", &settings.hysteresis)) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "Invalid argument",
+        "Expected null or a double in [0, 1) for 'deadzone' and "
+        "'hysteresis'.",
+        nullptr));
+  }
+
+  (*self->controller_axis_settings)[code] = settings;
+  if (self->gamepad_monitor != nullptr) {
+    self->gamepad_monitor->set_axis_settings(code, settings);
+  }
+  std::cout << "[WindowFocus] Controller axis " << fl_value_get_string(axis)
+            << " filter set to deadzone " << settings.deadzone
+            << ", hysteresis " << settings.hysteresis << std::endl;
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+}
+
+// Reads an optional integer argument in [min_value, max_value].
+static FlMethodResponse* get_int_argument(FlMethodCall* method_call,
+                                          const gchar* key,
+                                          int min_value,
+                                          int max_value,
+                                          int* out) {
+  FlValue* value = lookup_argument(method_call, key);
+  if (value == nullptr || fl_value_get_type(value) == FL_VALUE_TYPE_NULL) {
+    return nullptr;
+  }
+  if (fl_value_get_type(value) != FL_VALUE_TYPE_INT ||
+      fl_value_get_int(value) < min_value ||
+      fl_value_get_int(value) > max_value) {
+    g_autofree gchar* message = g_strdup_printf(
+        "Expected an integer in [%d, %d] for '%s'.", min_value, max_value,
+        key);
+    return FL_METHOD_RESPONSE(
+        fl_method_error_response_new("Invalid argument", message, nullptr));
+  }
+  *out = static_cast<int>(fl_value_get_int(value));
+  return nullptr;
+}
+
+#ifdef WINDOW_FOCUS_HAVE_XSHM
+// A frame source for the capture context, with a connection of its own
+// that is opened on first use. The context lends it to one thread at a time.
+static window_focus::ScreenshotScheduler::FrameSource
+window_focus_plugin_new_capture_source(window_focus::CaptureContext* context,
+                                       gboolean debug) {
+  std::shared_ptr<window_focus::XShmCapture> capture =
+      std::make_shared<window_focus::XShmCapture>();
+  return [capture, context, debug](
+             const window_focus::CaptureTarget& target,
+             window_focus::ScreenshotScheduler::Frame* frame) {
+    if (!capture->is_open()) {
+      capture->set_debug(debug);
+      if (!capture->Open(nullptr)) {
+        return false;
+      }
+    }
+    window_focus::XShmCapture::Frame captured;
+    const bool ok = capture->Capture(target, &captured);
+    context->UpdateScreenSize(capture->screen_width(),
+                              capture->screen_height());
+    if (!ok) {
+      return false;
+    }
+    frame->data = captured.data;
+    frame->width = captured.width;
+    frame->height = captured.height;
+    frame->stride = captured.stride;
+    return true;
+  };
+}
+
+// The capture context, created on first use.
+static window_focus::CaptureContext* window_focus_plugin_get_capture_context(
+    WindowFocusPlugin* self) {
+  if (self->capture_context == nullptr) {
+    // Sources are only opened once the context exists.
+    const gboolean debug = self->enable_debug;
+    self->capture_context = new window_focus::CaptureContext([self, debug]() {
+      return window_focus_plugin_new_capture_source(self->capture_context,
+                                                    debug);
+    });
+  }
+  return self->capture_context;
+}
+
+// The monitors, as listed through a connection of their own.
+struct MonitorListing {
+  using Callback =
+      std::function<void(WindowFocusPlugin* self, const MonitorListing&)>;
+
+  gboolean debug;
+  Callback done;
+  // Filled in on the worker thread; |ok| is false without an X server.
+  bool ok = false;
+  std::vector<window_focus::XShmCapture::Monitor> monitors;
+  double scale = 1.0;
+};
+
+static void window_focus_plugin_list_monitors_in_thread(
+    GTask* task,
+    gpointer /*source_object*/,
+    gpointer task_data,
+    GCancellable* /*cancellable*/) {
+  MonitorListing* listing = static_cast<MonitorListing*>(task_data);
+  window_focus::XShmCapture capture;
+  capture.set_debug(listing->debug);
+  if (capture.Open(nullptr)) {
+    listing->monitors = capture.ListMonitors();
+    listing->scale = capture.scale();
+    listing->ok = true;
+  }
+  g_task_return_boolean(task, listing->ok);
+}
+
+static void window_focus_plugin_monitors_listed(GObject* source_object,
+                                                GAsyncResult* result,
+                                                gpointer /*user_data*/) {
+  MonitorListing* listing =
+      static_cast<MonitorListing*>(g_task_get_task_data(G_TASK(result)));
+  listing->done(WINDOW_FOCUS_PLUGIN(source_object), *listing);
+}
+
+static void monitor_listing_free(gpointer data) {
+  delete static_cast<MonitorListing*>(data);
+}
+
+// Lists the monitors on a GIO worker thread, since opening an X connection
+// can block the platform thread, and calls |done| back on the main thread.
+// The task holds a reference to the plugin until then.
+static void window_focus_plugin_list_monitors(WindowFocusPlugin* self,
+                                              MonitorListing::Callback done) {
+  MonitorListing* listing = new MonitorListing{self->enable_debug,
+                                               std::move(done)};
+  GTask* task = g_task_new(self, nullptr, window_focus_plugin_monitors_listed,
+                           nullptr);
+  g_task_set_task_data(task, listing, monitor_listing_free);
+  g_task_run_in_thread(task, window_focus_plugin_list_monitors_in_thread);
+  g_object_unref(task);
+}
+
+// Describes each monitor; ids are what the monitor argument of the
+// screenshot methods takes.
+static FlMethodResponse* monitors_response(const MonitorListing& listing) {
+  if (!listing.ok) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "SCREENSHOT_ERROR", "Failed to connect to the X server", nullptr));
+  }
+  g_autoptr(FlValue) result = fl_value_new_list();
+  const double scale = listing.scale;
+  for (size_t i = 0; i < listing.monitors.size(); i++) {
+    const window_focus::XShmCapture::Monitor& monitor = listing.monitors[i];
+    g_autoptr(FlValue) value = fl_value_new_map();
+    fl_value_set_string_take(value, "id", fl_value_new_int(i));
+    fl_value_set_string_take(value, "name",
+                             fl_value_new_string(monitor.name.c_str()));
+    fl_value_set_string_take(value, "x", fl_value_new_int(monitor.x));
+    fl_value_set_string_take(value, "y", fl_value_new_int(monitor.y));
+    fl_value_set_string_take(value, "width", fl_value_new_int(monitor.width));
+    fl_value_set_string_take(value, "height",
+                             fl_value_new_int(monitor.height));
+    fl_value_set_string_take(value, "scale", fl_value_new_float(scale));
+    fl_value_set_string_take(value, "primary",
+                             fl_value_new_bool(monitor.primary));
+    fl_value_append(result, value);
+  }
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+#endif
+
+// Returns null when the monitors are being listed, which answers
+// |method_call| once done.
+static FlMethodResponse* get_monitors(WindowFocusPlugin* self,
+                                      FlMethodCall* method_call) {
+#ifdef WINDOW_FOCUS_HAVE_XSHM
+  FlMethodCall* call = FL_METHOD_CALL(g_object_ref(method_call));
+  window_focus_plugin_list_monitors(
+      self, [call](WindowFocusPlugin*, const MonitorListing& listing) {
+        g_autoptr(FlMethodResponse) response = monitors_response(listing);
+        fl_method_call_respond(call, response, nullptr);
+        g_object_unref(call);
+      });
+  return nullptr;
+#else
+  g_autoptr(FlValue) result = fl_value_new_list();
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+#endif
+}
+
+// Reads the optional "region" argument, a map of integer "x", "y", "width"
+// and "height" in root window coordinates.
+static FlMethodResponse* get_region_argument(
+    FlMethodCall* method_call,
+    window_focus::CaptureTarget* target) {
+  FlValue* region = lookup_argument(method_call, "region");
+  if (region == nullptr || fl_value_get_type(region) == FL_VALUE_TYPE_NULL) {
+    return nullptr;
+  }
+  const gchar* keys[] = {"x", "y", "width", "height"};
+  gint64 fields[G_N_ELEMENTS(keys)] = {};
+  bool valid = fl_value_get_type(region) == FL_VALUE_TYPE_MAP;
+  for (size_t i = 0; valid && i < G_N_ELEMENTS(keys); i++) {
+    FlValue* value = fl_value_lookup_string(region, keys[i]);
+    const gint64 min_value = i < 2 ? G_MININT : 1;
+    valid = value != nullptr && fl_value_get_type(value) == FL_VALUE_TYPE_INT &&
+            fl_value_get_int(value) >= min_value &&
+            fl_value_get_int(value) <= G_MAXINT;
+    if (valid) {
+      fields[i] = fl_value_get_int(value);
+    }
+  }
+  // The right and bottom edges must fit in an int too.
+  if (!valid || fields[0] + fields[2] > G_MAXINT ||
+      fields[1] + fields[3] > G_MAXINT) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "Invalid argument",
+        "Expected a map of integer 'x', 'y' and positive 'width' and "
+        "'height' for 'region'.",
+        nullptr));
+  }
+  target->x = static_cast<int>(fields[0]);
+  target->y = static_cast<int>(fields[1]);
+  target->width = static_cast<int>(fields[2]);
+  target->height = static_cast<int>(fields[3]);
+  return nullptr;
+}
+
+// Reads the optional "activeWindowOnly", "window", "clientAreaOnly",
+// "region" and "monitor" arguments of the screenshot methods. At most one of
+// the active window, a window, a region and a monitor can be asked for.
+static FlMethodResponse* get_capture_target(
+    FlMethodCall* method_call,
+    window_focus::CaptureTarget* target) {
+  gboolean active_window_only = FALSE;
+  get_bool_argument(method_call, "activeWindowOnly", &active_window_only);
+  target->active_window_only = active_window_only;
+  FlValue* window = lookup_argument(method_call, "window");
+  if (window != nullptr && fl_value_get_type(window) != FL_VALUE_TYPE_NULL) {
+    if (fl_value_get_type(window) != FL_VALUE_TYPE_INT ||
+        fl_value_get_int(window) <= 0) {
+      return FL_METHOD_RESPONSE(fl_method_error_response_new(
+          "Invalid argument", "Expected a window id for 'window'.", nullptr));
+    }
+    target->window = static_cast<unsigned long>(fl_value_get_int(window));
+  }
+  gboolean client_area_only = FALSE;
+  get_bool_argument(method_call, "clientAreaOnly", &client_area_only);
+  target->client_area_only = client_area_only;
+  FlMethodResponse* error = get_region_argument(method_call, target);
+  if (error != nullptr) {
+    return error;
+  }
+  target->monitor = -1;
+  error = get_int_argument(method_call, "monitor", 0, G_MAXINT,
+                           &target->monitor);
+  if (error != nullptr) {
+    return error;
+  }
+  const int targets = (target->active_window_only ? 1 : 0) +
+                      (target->window != 0 ? 1 : 0) +
+                      (target->has_region() ? 1 : 0) +
+                      (target->monitor >= 0 ? 1 : 0);
+  if (targets > 1) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "Invalid argument",
+        "Only one of 'activeWindowOnly', 'window', 'region' and 'monitor' "
+        "can be given.",
+        nullptr));
+  }
+  if (target->client_area_only && !target->active_window_only &&
+      target->window == 0) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "Invalid argument",
+        "'clientAreaOnly' needs 'activeWindowOnly' or 'window'.", nullptr));
+  }
+  return nullptr;
+}
+
+// Reads the optional "format" and "quality" arguments of takeScreenshot.
+// Returns an error response for unknown formats, formats this build has no
+// encoder for, and qualities outside 1 to 100.
+static FlMethodResponse* get_screenshot_encoding(
+    FlMethodCall* method_call,
+    const window_focus::ScreenshotEncoder** encoder,
+    int* quality) {
+  *encoder = &window_focus::ScreenshotEncoders().front();
+  FlValue* format = lookup_argument(method_call, "format");
+  if (format != nullptr) {
+    if (fl_value_get_type(format) != FL_VALUE_TYPE_STRING) {
+      return FL_METHOD_RESPONSE(fl_method_error_response_new(
+          "Invalid argument", "Expected a string for 'format'.", nullptr));
+    }
+    *encoder = window_focus::FindScreenshotEncoder(fl_value_get_string(format));
+    if (*encoder == nullptr) {
+      g_autofree gchar* message = g_strdup_printf(
+          "Screenshot format '%s' is not supported by this build.",
+          fl_value_get_string(format));
+      return FL_METHOD_RESPONSE(
+          fl_method_error_response_new("Invalid argument", message, nullptr));
+    }
+  }
+  *quality = window_focus::kDefaultScreenshotQuality;
+  FlValue* quality_value = lookup_argument(method_call, "quality");
+  if (quality_value != nullptr) {
+    if (fl_value_get_type(quality_value) != FL_VALUE_TYPE_INT ||
+        fl_value_get_int(quality_value) < 1 ||
+        fl_value_get_int(quality_value) > 100) {
+      return FL_METHOD_RESPONSE(fl_method_error_response_new(
+          "Invalid argument", "Expected an integer in [1, 100] for 'quality'.",
+          nullptr));
+    }
+    *quality = static_cast<int>(fl_value_get_int(quality_value));
+  }
+  return nullptr;
+}
+
+// Reads the optional "maxWidth" and "maxHeight" arguments of the screenshot
+// methods; 0 stands for no limit.
+static FlMethodResponse* get_screenshot_size_limit(FlMethodCall* method_call,
+                                                   int* max_width,
+                                                   int* max_height) {
+  const gchar* keys[] = {"maxWidth", "maxHeight"};
+  int* limits[] = {max_width, max_height};
+  for (int i = 0; i < 2; i++) {
+    *limits[i] = 0;
+    FlValue* value = lookup_argument(method_call, keys[i]);
+    if (value == nullptr || fl_value_get_type(value) == FL_VALUE_TYPE_NULL) {
+      continue;
+    }
+    if (fl_value_get_type(value) != FL_VALUE_TYPE_INT ||
+        fl_value_get_int(value) < 1 || fl_value_get_int(value) > G_MAXINT) {
+      g_autofree gchar* message =
+          g_strdup_printf("Expected a positive integer for '%s'.", keys[i]);
+      return FL_METHOD_RESPONSE(
+          fl_method_error_response_new("Invalid argument", message, nullptr));
+    }
+    *limits[i] = static_cast<int>(fl_value_get_int(value));
+  }
+  return nullptr;
+}
+
+#ifdef WINDOW_FOCUS_HAVE_XSHM
+// Whether the running ring captures what a screenshot call asks for, so its
+// newest frame can answer it.
+static bool ring_matches(WindowFocusPlugin* self,
+                         const window_focus::CaptureTarget& target,
+                         int max_width,
+                         int max_height) {
+  if (self->screenshot_ring == nullptr ||
+      !self->screenshot_ring->is_running()) {
+    return false;
+  }
+  const window_focus::ScreenshotRing::Options& options =
+      self->screenshot_ring->options();
+  window_focus::CaptureTarget captured;
+  captured.active_window_only = options.active_window_only;
+  return target == captured && options.max_width == max_width &&
+         options.max_height == max_height;
+}
+
+// Answers takeScreenshot from the newest frame of the running ring, without
+// capturing, when the ring stores the requested format. Frames of a raw ring
+// are left to a worker, since encoding them would block the platform
+// thread. Returns null when the ring cannot answer.
+static FlMethodResponse* take_screenshot_from_ring(
+    WindowFocusPlugin* self,
+    const window_focus::CaptureTarget& target,
+    const window_focus::ScreenshotEncoder* encoder,
+    int quality,
+    int max_width,
+    int max_height) {
+  if (!ring_matches(self, target, max_width, max_height)) {
+    return nullptr;
+  }
+  const window_focus::ScreenshotRing::Options& options =
+      self->screenshot_ring->options();
+  if (options.encoder != encoder ||
+      (encoder->lossy && options.quality != quality)) {
+    return nullptr;
+  }
+  g_autoptr(FlValue) result = nullptr;
+  window_focus::FrameRing::Frame newest;
+  if (self->screenshot_ring->ReadRecent(
+          1, [&](const window_focus::FrameRing::Frame& frame,
+                 const uint8_t* data) {
+            newest = frame;
+            result = fl_value_new_uint8_list(data, frame.size);
+          }) == 0) {
+    return nullptr;
+  }
+  if (self->enable_debug) {
+    std::cout << "[WindowFocus] Screenshot " << newest.width << "x"
+              << newest.height << " taken from the ring, "
+              << g_get_real_time() / 1000 - newest.timestamp_ms << " ms old"
+              << std::endl;
+  }
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+// Answers takeScreenshotRaw from the newest frame of a running raw ring.
+// Returns null when the ring cannot answer.
+static FlMethodResponse* take_screenshot_raw_from_ring(
+    WindowFocusPlugin* self,
+    const window_focus::CaptureTarget& target,
+    window_focus::PixelFormat format,
+    int max_width,
+    int max_height) {
+  if (!ring_matches(self, target, max_width, max_height) ||
+      self->screenshot_ring->options().encoder != nullptr) {
+    return nullptr;
+  }
+  g_autoptr(FlValue) result = nullptr;
+  self->screenshot_ring->ReadRecent(
+      1, [&](const window_focus::FrameRing::Frame& frame,
+             const uint8_t* data) {
+        result = fl_value_new_map();
+        fl_value_set_string_take(result, "width",
+                                 fl_value_new_int(frame.width));
+        fl_value_set_string_take(result, "height",
+                                 fl_value_new_int(frame.height));
+        fl_value_set_string_take(result, "stride",
+                                 fl_value_new_int(frame.width * 4));
+        fl_value_set_string_take(
+            result, "format",
+            fl_value_new_string(window_focus::PixelFormatName(format)));
+        if (format == window_focus::PixelFormat::kBgra) {
+          fl_value_set_string_take(result, "pixels",
+                                   fl_value_new_uint8_list(data, frame.size));
+        } else {
+          std::vector<uint8_t> pixels(frame.size);
+          window_focus::ConvertBgrxPixels(data, pixels.data(), frame.size / 4,
+                                          format);
+          fl_value_set_string_take(
+              result, "pixels",
+              fl_value_new_uint8_list(pixels.data(), pixels.size()));
+        }
+      });
+  if (result == nullptr) {
+    return nullptr;
+  }
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+// A takeScreenshot, takeScreenshotRaw or takeScreenshotDelta answered on a
+// worker, delivered on the main thread.
+struct ScreenshotReply {
+  // Referenced, so that the capture context outlives the reply.
+  WindowFocusPlugin* plugin;
+  FlMethodCall* method_call;
+  // Whether takeScreenshotRaw asked, for pixels in |format|.
+  bool raw;
+  window_focus::PixelFormat format;
+  // Whether takeScreenshotDelta asked.
+  bool delta;
+  window_focus::ScreenshotWorkerPool::Result result;
+};
+
+static gboolean window_focus_plugin_dispatch_screenshot_reply(
+    gpointer user_data) {
+  ScreenshotReply* reply = static_cast<ScreenshotReply*>(user_data);
+  window_focus::ScreenshotWorkerPool::Result& result = reply->result;
+  g_autoptr(FlMethodResponse) response = nullptr;
+  if (result.cancelled) {
+    response = FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "SCREENSHOT_CANCELLED", "Screenshot cancelled", nullptr));
+  } else if (!result.error.empty()) {
+    response = FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "SCREENSHOT_ERROR", result.error.c_str(), nullptr));
+  } else if (reply->delta) {
+    const window_focus::ScreenDelta& delta = result.delta;
+    g_autoptr(FlValue) value = fl_value_new_map();
+    fl_value_set_string_take(value, "width", fl_value_new_int(delta.width));
+    fl_value_set_string_take(value, "height", fl_value_new_int(delta.height));
+    fl_value_set_string_take(value, "tileSize",
+                             fl_value_new_int(delta.tile_size));
+    fl_value_set_string_take(value, "sequence",
+                             fl_value_new_int(delta.sequence));
+    fl_value_set_string_take(value, "keyframe",
+                             fl_value_new_bool(delta.keyframe));
+    fl_value_set_string_take(
+        value, "tiles",
+        fl_value_new_int32_list(delta.tiles.data(), delta.tiles.size()));
+    fl_value_set_string_take(value, "compression",
+                             fl_value_new_string(delta.compression));
+    fl_value_set_string_take(
+        value, "data",
+        fl_value_new_uint8_list(delta.data.data(), delta.data.size()));
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(value));
+  } else if (reply->raw) {
+    g_autoptr(FlValue) value = fl_value_new_map();
+    fl_value_set_string_take(value, "width", fl_value_new_int(result.width));
+    fl_value_set_string_take(value, "height",
+                             fl_value_new_int(result.height));
+    fl_value_set_string_take(value, "stride",
+                             fl_value_new_int(result.stride));
+    fl_value_set_string_take(
+        value, "format",
+        fl_value_new_string(window_focus::PixelFormatName(reply->format)));
+    fl_value_set_string_take(
+        value, "pixels",
+        fl_value_new_uint8_list(result.data.data(), result.data.size()));
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(value));
+  } else {
+    g_autoptr(FlValue) value =
+        fl_value_new_uint8_list(result.data.data(), result.data.size());
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(value));
+  }
+  fl_method_call_respond(reply->method_call, response, nullptr);
+  // The response holds a copy of the bytes.
+  if (reply->plugin->capture_context != nullptr) {
+    reply->plugin->capture_context->ReleaseBuffer(std::move(result.data));
+  }
+  return G_SOURCE_REMOVE;
+}
+
+static void screenshot_reply_free(gpointer user_data) {
+  ScreenshotReply* reply = static_cast<ScreenshotReply*>(user_data);
+  g_object_unref(reply->method_call);
+  g_object_unref(reply->plugin);
+  delete reply;
+}
+
+// The screenshot workers, started on first use.
+static window_focus::ScreenshotWorkerPool*
+window_focus_plugin_get_screenshot_workers(WindowFocusPlugin* self) {
+  if (self->screenshot_workers == nullptr) {
+    window_focus::CaptureContext* context =
+        window_focus_plugin_get_capture_context(self);
+    self->screenshot_workers = new window_focus::ScreenshotWorkerPool(
+        [context]() { return context->NewSource(); },
+        window_focus::kScreenshotWorkers, window_focus::kMaxQueuedScreenshots,
+        context);
+    self->screenshot_workers->set_debug(self->enable_debug);
+  }
+  return self->screenshot_workers;
+}
+
+// Hands |request| to the worker pool, which answers |method_call| from the
+// main thread. Returns null when queued, or an error when the queue is full.
+static FlMethodResponse* submit_screenshot(
+    WindowFocusPlugin* self,
+    FlMethodCall* method_call,
+    const window_focus::ScreenshotWorkerPool::Request& request) {
+  window_focus::ScreenshotWorkerPool* workers =
+      window_focus_plugin_get_screenshot_workers(self);
+  // Held by the reply until it is delivered.
+  FlMethodCall* call = FL_METHOD_CALL(g_object_ref(method_call));
+  const bool delta = request.delta_stream != nullptr;
+  const bool raw = request.encoder == nullptr && !delta;
+  const window_focus::PixelFormat format = request.pixel_format;
+  WindowFocusPlugin* plugin = WINDOW_FOCUS_PLUGIN(g_object_ref(self));
+  if (!workers->Submit(
+          request, [plugin, call, raw, format, delta](
+                       window_focus::ScreenshotWorkerPool::Result result) {
+            ScreenshotReply* reply = new ScreenshotReply{
+                plugin, call, raw, format, delta, std::move(result)};
+            g_main_context_invoke_full(
+                nullptr, G_PRIORITY_DEFAULT,
+                window_focus_plugin_dispatch_screenshot_reply, reply,
+                screenshot_reply_free);
+          })) {
+    g_object_unref(call);
+    g_object_unref(plugin);
+    g_autofree gchar* message = g_strdup_printf(
+        "Too many screenshots pending, at most %d are queued.",
+        window_focus::kMaxQueuedScreenshots);
+    return FL_METHOD_RESPONSE(
+        fl_method_error_response_new("SCREENSHOT_BUSY", message, nullptr));
+  }
+  return nullptr;
+}
+#endif
+
+// Returns null when the screenshot was handed to a worker, which answers
+// |method_call| itself.
+static FlMethodResponse* take_screenshot(WindowFocusPlugin* self,
+                                         FlMethodCall* method_call) {
+  window_focus::CaptureTarget target;
+  FlMethodResponse* error = get_capture_target(method_call, &target);
+  if (error != nullptr) {
+    return error;
+  }
+  const window_focus::ScreenshotEncoder* encoder = nullptr;
+  int quality = 0;
+  error = get_screenshot_encoding(method_call, &encoder, &quality);
+  if (error != nullptr) {
+    return error;
+  }
+  int max_width = 0;
+  int max_height = 0;
+  error = get_screenshot_size_limit(method_call, &max_width, &max_height);
+  if (error != nullptr) {
+    return error;
+  }
+#ifdef WINDOW_FOCUS_HAVE_XSHM
+  error = take_screenshot_from_ring(self, target, encoder, quality, max_width,
+                                    max_height);
+  if (error != nullptr) {
+    return error;
+  }
+  window_focus::ScreenshotWorkerPool::Request request;
+  static_cast<window_focus::CaptureTarget&>(request.target) = target;
+  request.target.max_width = max_width;
+  request.target.max_height = max_height;
+  request.encoder = encoder;
+  request.quality = quality;
+  return submit_screenshot(self, method_call, request);
+#else
+  return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "SCREENSHOT_ERROR", "Built without X11 screen capture", nullptr));
+#endif
+}
+
+// Lists the formats takeScreenshot accepts in this build.
+static FlMethodResponse* get_screenshot_formats() {
+  g_autoptr(FlValue) result = fl_value_new_list();
+  for (const window_focus::ScreenshotEncoder& encoder :
+       window_focus::ScreenshotEncoders()) {
+    fl_value_append_take(result, fl_value_new_string(encoder.name));
+  }
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+// Returns the pixels without encoding them, converted to |format|. Like
+// takeScreenshot, returns null when a worker answers.
+static FlMethodResponse* take_screenshot_raw(WindowFocusPlugin* self,
+                                             FlMethodCall* method_call) {
+  window_focus::CaptureTarget target;
+  FlMethodResponse* error = get_capture_target(method_call, &target);
+  if (error != nullptr) {
+    return error;
+  }
+  window_focus::PixelFormat format = window_focus::PixelFormat::kBgra;
+  FlValue* format_value = lookup_argument(method_call, "format");
+  if (format_value != nullptr &&
+      (fl_value_get_type(format_value) != FL_VALUE_TYPE_STRING ||
+       !window_focus::ParsePixelFormat(fl_value_get_string(format_value),
+                                       &format))) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "Invalid argument", "Expected 'bgra' or 'rgba' for 'format'.",
+        nullptr));
+  }
+  int max_width = 0;
+  int max_height = 0;
+  error = get_screenshot_size_limit(method_call, &max_width, &max_height);
+  if (error != nullptr) {
+    return error;
+  }
+#ifdef WINDOW_FOCUS_HAVE_XSHM
+  error = take_screenshot_raw_from_ring(self, target, format, max_width,
+                                        max_height);
+  if (error != nullptr) {
+    return error;
+  }
+  window_focus::ScreenshotWorkerPool::Request request;
+  static_cast<window_focus::CaptureTarget&>(request.target) = target;
+  request.target.max_width = max_width;
+  request.target.max_height = max_height;
+  request.pixel_format = format;
+  return submit_screenshot(self, method_call, request);
+#else
+  return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "SCREENSHOT_ERROR", "Built without X11 screen capture", nullptr));
+#endif
+}
+
+#ifdef WINDOW_FOCUS_HAVE_XSHM
+// A takeMonitorScreenshots in progress: one worker request per monitor,
+// answered on the main thread once the last of them completes.
+struct MonitorScreenshots {
+  ~MonitorScreenshots() {
+    g_object_unref(method_call);
+    g_object_unref(plugin);
+  }
+
+  // Referenced, so that the capture context outlives the reply.
+  WindowFocusPlugin* plugin;
+  FlMethodCall* method_call;
+  std::mutex mutex;
+  size_t pending;
+  // By monitor id.
+  std::vector<window_focus::ScreenshotWorkerPool::Result> results;
+  // Some monitors were not queued because the pool was full.
+  bool busy = false;
+};
+
+static gboolean window_focus_plugin_dispatch_monitor_screenshots(
+    gpointer user_data) {
+  MonitorScreenshots* screenshots =
+      static_cast<std::shared_ptr<MonitorScreenshots>*>(user_data)->get();
+  // One failed monitor fails the call; the rest would be misleading.
+  g_autoptr(FlMethodResponse) response = nullptr;
+  for (const window_focus::ScreenshotWorkerPool::Result& result :
+       screenshots->results) {
+    if (result.cancelled) {
+      response = FL_METHOD_RESPONSE(fl_method_error_response_new(
+          "SCREENSHOT_CANCELLED", "Screenshot cancelled", nullptr));
+      break;
+    }
+  }
+  if (response == nullptr && screenshots->busy) {
+    g_autofree gchar* message = g_strdup_printf(
+        "Too many screenshots pending, at most %d are queued.",
+        window_focus::kMaxQueuedScreenshots);
+    response = FL_METHOD_RESPONSE(
+        fl_method_error_response_new("SCREENSHOT_BUSY", message, nullptr));
+  }
+  for (const window_focus::ScreenshotWorkerPool::Result& result :
+       screenshots->results) {
+    if (response == nullptr && !result.error.empty()) {
+      response = FL_METHOD_RESPONSE(fl_method_error_response_new(
+          "SCREENSHOT_ERROR", result.error.c_str(), nullptr));
+    }
+  }
+  if (response == nullptr) {
+    g_autoptr(FlValue) value = fl_value_new_map();
+    for (size_t i = 0; i < screenshots->results.size(); i++) {
+      const std::vector<uint8_t>& data = screenshots->results[i].data;
+      fl_value_set_take(value, fl_value_new_int(i),
+                        fl_value_new_uint8_list(data.data(), data.size()));
+    }
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(value));
+  }
+  fl_method_call_respond(screenshots->method_call, response, nullptr);
+  window_focus::CaptureContext* context =
+      screenshots->plugin->capture_context;
+  for (window_focus::ScreenshotWorkerPool::Result& result :
+       screenshots->results) {
+    if (context != nullptr) {
+      context->ReleaseBuffer(std::move(result.data));
+    }
+  }
+  return G_SOURCE_REMOVE;
+}
+
+static void monitor_screenshots_free(gpointer user_data) {
+  delete static_cast<std::shared_ptr<MonitorScreenshots>*>(user_data);
+}
+
+// Records that one monitor is done, and answers once all are.
+static void window_focus_plugin_complete_monitor_screenshot(
+    const std::shared_ptr<MonitorScreenshots>& screenshots,
+    size_t index,
+    window_focus::ScreenshotWorkerPool::Result* result) {
+  {
+    std::lock_guard<std::mutex> lock(screenshots->mutex);
+    if (result != nullptr) {
+      screenshots->results[index] = std::move(*result);
+    } else {
+      screenshots->busy = true;
+    }
+    if (--screenshots->pending > 0) {
+      return;
+    }
+  }
+  g_main_context_invoke_full(
+      nullptr, G_PRIORITY_DEFAULT,
+      window_focus_plugin_dispatch_monitor_screenshots,
+      new std::shared_ptr<MonitorScreenshots>(screenshots),
+      monitor_screenshots_free);
+}
+
+// Queues |request| for each of |count| monitors; the last one to complete
+// answers |method_call|.
+static void window_focus_plugin_submit_monitor_screenshots(
+    WindowFocusPlugin* self,
+    FlMethodCall* method_call,
+    window_focus::ScreenshotWorkerPool::Request request,
+    size_t count) {
+  window_focus::ScreenshotWorkerPool* workers =
+      window_focus_plugin_get_screenshot_workers(self);
+  std::shared_ptr<MonitorScreenshots> screenshots(new MonitorScreenshots{
+      WINDOW_FOCUS_PLUGIN(g_object_ref(self)),
+      FL_METHOD_CALL(g_object_ref(method_call))});
+  screenshots->pending = count;
+  screenshots->results.resize(count);
+  for (size_t i = 0; i < count; i++) {
+    request.target.monitor = static_cast<int>(i);
+    auto done = [screenshots, i](
+                    window_focus::ScreenshotWorkerPool::Result result) {
+      window_focus_plugin_complete_monitor_screenshot(screenshots, i, &result);
+    };
+    if (!workers->Submit(request, done)) {
+      window_focus_plugin_complete_monitor_screenshot(screenshots, i, nullptr);
+    }
+  }
+}
+#endif
+
+// Captures every monitor, each on a worker of its own, and returns the
+// encoded screenshots by monitor id. Returns null when the call is answered
+// later, once the monitors are listed and captured.
+static FlMethodResponse* take_monitor_screenshots(WindowFocusPlugin* self,
+                                                  FlMethodCall* method_call) {
+  const window_focus::ScreenshotEncoder* encoder = nullptr;
+  int quality = 0;
+  FlMethodResponse* error =
+      get_screenshot_encoding(method_call, &encoder, &quality);
+  if (error != nullptr) {
+    return error;
+  }
+  int max_width = 0;
+  int max_height = 0;
+  error = get_screenshot_size_limit(method_call, &max_width, &max_height);
+  if (error != nullptr) {
+    return error;
+  }
+#ifdef WINDOW_FOCUS_HAVE_XSHM
+  FlMethodCall* call = FL_METHOD_CALL(g_object_ref(method_call));
+  window_focus::ScreenshotWorkerPool::Request request;
+  request.target.max_width = max_width;
+  request.target.max_height = max_height;
+  request.encoder = encoder;
+  request.quality = quality;
+  window_focus_plugin_list_monitors(
+      self, [call, request](WindowFocusPlugin* self,
+                            const MonitorListing& listing) {
+        if (!listing.ok || listing.monitors.empty()) {
+          g_autoptr(FlMethodResponse) response =
+              FL_METHOD_RESPONSE(fl_method_error_response_new(
+                  "SCREENSHOT_ERROR", "Failed to take screenshot", nullptr));
+          fl_method_call_respond(call, response, nullptr);
+        } else {
+          window_focus_plugin_submit_monitor_screenshots(
+              self, call, request, listing.monitors.size());
+        }
+        g_object_unref(call);
+      });
+  return nullptr;
+#else
+  return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "SCREENSHOT_ERROR", "Built without X11 screen capture", nullptr));
+#endif
+}
+
+// Returns the tiles that changed since the previous takeScreenshotDelta,
+// see ScreenDeltaEncoder. Like takeScreenshot, returns null when a worker
+// answers.
+static FlMethodResponse* take_screenshot_delta(WindowFocusPlugin* self,
+                                               FlMethodCall* method_call) {
+  gboolean active_window_only = FALSE;
+  get_bool_argument(method_call, "activeWindowOnly", &active_window_only);
+  gboolean force_keyframe = FALSE;
+  get_bool_argument(method_call, "keyframe", &force_keyframe);
+  int tile_size = window_focus::kDefaultDeltaTileSize;
+  FlMethodResponse* error = get_int_argument(
+      method_call, "tileSize", window_focus::kMinDeltaTileSize,
+      window_focus::kMaxDeltaTileSize, &tile_size);
+  if (error != nullptr) {
+    return error;
+  }
+  int keyframe_interval = window_focus::kDefaultDeltaKeyframeInterval;
+  error = get_int_argument(method_call, "keyframeInterval", 0, G_MAXINT,
+                           &keyframe_interval);
+  if (error != nullptr) {
+    return error;
+  }
+  int max_width = 0;
+  int max_height = 0;
+  error = get_screenshot_size_limit(method_call, &max_width, &max_height);
+  if (error != nullptr) {
+    return error;
+  }
+#ifdef WINDOW_FOCUS_HAVE_XSHM
+  if (self->delta_stream == nullptr) {
+    self->delta_stream = new window_focus::ScreenshotWorkerPool::DeltaStream();
+  }
+  window_focus::ScreenshotWorkerPool::Request request;
+  request.target.active_window_only = active_window_only;
+  request.target.max_width = max_width;
+  request.target.max_height = max_height;
+  request.delta_stream = self->delta_stream;
+  request.tile_size = tile_size;
+  request.keyframe_interval = keyframe_interval;
+  request.force_keyframe = force_keyframe;
+  return submit_screenshot(self, method_call, request);
+#else
+  return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "SCREENSHOT_ERROR", "Built without X11 screen capture", nullptr));
+#endif
+}
+
+#ifdef WINDOW_FOCUS_HAVE_XSHM
+// A scheduled screenshot reported on the scheduler thread, delivered on the
+// main thread.
+struct ScheduledScreenshotEvent {
+  WindowFocusPlugin* plugin;
+  window_focus::ScreenshotScheduler::Result result;
+};
+
+static gboolean window_focus_plugin_dispatch_scheduled_screenshot(
+    gpointer user_data) {
+  ScheduledScreenshotEvent* event =
+      static_cast<ScheduledScreenshotEvent*>(user_data);
+  WindowFocusPlugin* self = event->plugin;
+  if (self->channel == nullptr) {
+    return G_SOURCE_REMOVE;
+  }
+
+  const window_focus::ScreenshotScheduler::Result& result = event->result;
+  g_autoptr(FlValue) args = fl_value_new_map();
+  if (!result.error.empty()) {
+    fl_value_set_string_take(args, "error",
+                             fl_value_new_string(result.error.c_str()));
+  } else {
+    fl_value_set_string_take(args, "path",
+                             fl_value_new_string(result.path.c_str()));
+    fl_value_set_string_take(args, "format",
+                             fl_value_new_string(result.format));
+    fl_value_set_string_take(args, "width", fl_value_new_int(result.width));
+    fl_value_set_string_take(args, "height", fl_value_new_int(result.height));
+    fl_value_set_string_take(
+        args, "size", fl_value_new_int(static_cast<int64_t>(result.size)));
+  }
+  fl_value_set_string_take(args, "timestamp",
+                           fl_value_new_int(result.timestamp_ms));
+  fl_value_set_string_take(args, "skippedIdle",
+                           fl_value_new_int(result.skipped_idle));
+  fl_value_set_string_take(args, "skippedUnchanged",
+                           fl_value_new_int(result.skipped_unchanged));
+  fl_method_channel_invoke_method(self->channel, "onScheduledScreenshot", args,
+                                  nullptr, nullptr, nullptr);
+  return G_SOURCE_REMOVE;
+}
+
+static void scheduled_screenshot_event_free(gpointer user_data) {
+  ScheduledScreenshotEvent* event =
+      static_cast<ScheduledScreenshotEvent*>(user_data);
+  g_object_unref(event->plugin);
+  delete event;
+}
+#endif
+
+// Starts writing screenshots to a directory on a native thread, see
+// ScreenshotScheduler. Only paths and sizes are sent to Dart, through
+// onScheduledScreenshot.
+static FlMethodResponse* start_screenshot_schedule(WindowFocusPlugin* self,
+                                                   FlMethodCall* method_call) {
+  FlValue* interval = lookup_argument(method_call, "interval");
+  if (interval == nullptr || fl_value_get_type(interval) != FL_VALUE_TYPE_INT ||
+      fl_value_get_int(interval) < 100 ||
+      fl_value_get_int(interval) > G_MAXINT) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "Invalid argument",
+        "Expected at least 100 milliseconds for 'interval'.", nullptr));
+  }
+  FlValue* directory = lookup_argument(method_call, "directory");
+  if (directory == nullptr ||
+      fl_value_get_type(directory) != FL_VALUE_TYPE_STRING ||
+      fl_value_get_string(directory)[0] == '\0') {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "Invalid argument", "Expected a path for 'directory'.", nullptr));
+  }
+  window_focus::ScreenshotScheduler::Options options;
+  options.interval = std::chrono::milliseconds(fl_value_get_int(interval));
+  options.directory = fl_value_get_string(directory);
+  FlMethodResponse* error = get_screenshot_encoding(
+      method_call, &options.encoder, &options.quality);
+  if (error != nullptr) {
+    return error;
+  }
+  error = get_screenshot_size_limit(method_call, &options.max_width,
+                                    &options.max_height);
+  if (error != nullptr) {
+    return error;
+  }
+  gboolean value = FALSE;
+  get_bool_argument(method_call, "activeWindowOnly", &value);
+  options.active_window_only = value;
+  value = TRUE;
+  get_bool_argument(method_call, "skipWhenIdle", &value);
+  options.skip_when_idle = value;
+  value = TRUE;
+  get_bool_argument(method_call, "skipUnchanged", &value);
+  options.skip_unchanged = value;
+  if (g_mkdir_with_parents(options.directory.c_str(), 0755) != 0) {
+    g_autofree gchar* message =
+        g_strdup_printf("Cannot create %s: %s", options.directory.c_str(),
+                        g_strerror(errno));
+    return FL_METHOD_RESPONSE(
+        fl_method_error_response_new("SCREENSHOT_ERROR", message, nullptr));
+  }
+#ifdef WINDOW_FOCUS_HAVE_XSHM
+  if (self->screenshot_scheduler == nullptr) {
+    self->screenshot_scheduler = new window_focus::ScreenshotScheduler(
+        window_focus_plugin_get_capture_context(self)->NewSource(),
+        [self](const window_focus::ScreenshotScheduler::Result& result) {
+          ScheduledScreenshotEvent* event = new ScheduledScreenshotEvent{
+              WINDOW_FOCUS_PLUGIN(g_object_ref(self)), result};
+          g_main_context_invoke_full(
+              nullptr, G_PRIORITY_DEFAULT,
+              window_focus_plugin_dispatch_scheduled_screenshot, event,
+              scheduled_screenshot_event_free);
+        });
+  }
+  self->screenshot_scheduler->set_debug(self->enable_debug);
+  self->screenshot_scheduler->set_user_active(
+      self->activity_tracker->user_is_active());
+  self->screenshot_scheduler->Start(options);
+  std::cout << "[WindowFocus] Saving a " << options.encoder->name
+            << " screenshot every " << options.interval.count()
+            << " ms to " << options.directory << std::endl;
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+#else
+  return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "SCREENSHOT_ERROR", "Built without X11 screen capture", nullptr));
+#endif
+}
+
+// Starts capturing into a ScreenshotRing, which takeScreenshot and
+// takeScreenshotRaw then answer from and getRecentFrames reads.
+static FlMethodResponse* start_screenshot_ring(WindowFocusPlugin* self,
+                                               FlMethodCall* method_call) {
+  window_focus::ScreenshotRing::Options options;
+  int interval = static_cast<int>(options.interval.count());
+  FlMethodResponse* error =
+      get_int_argument(method_call, "interval", 100, G_MAXINT, &interval);
+  if (error != nullptr) {
+    return error;
+  }
+  options.interval = std::chrono::milliseconds(interval);
+  int frames = window_focus::kDefaultRingFrames;
+  error = get_int_argument(method_call, "frames", 1, 1000, &frames);
+  if (error != nullptr) {
+    return error;
+  }
+  options.frames = frames;
+  int max_bytes = static_cast<int>(window_focus::kDefaultRingBytes);
+  error = get_int_argument(method_call, "maxBytes", 1 << 20, G_MAXINT,
+                           &max_bytes);
+  if (error != nullptr) {
+    return error;
+  }
+  options.max_bytes = max_bytes;
+  gboolean raw = FALSE;
+  get_bool_argument(method_call, "raw", &raw);
+  if (!raw) {
+    error = get_screenshot_encoding(method_call, &options.encoder,
+                                    &options.quality);
+    if (error != nullptr) {
+      return error;
+    }
+  }
+  error = get_screenshot_size_limit(method_call, &options.max_width,
+                                    &options.max_height);
+  if (error != nullptr) {
+    return error;
+  }
+  gboolean active_window_only = FALSE;
+  get_bool_argument(method_call, "activeWindowOnly", &active_window_only);
+  options.active_window_only = active_window_only;
+#ifdef WINDOW_FOCUS_HAVE_XSHM
+  if (self->screenshot_ring == nullptr) {
+    self->screenshot_ring = new window_focus::ScreenshotRing(
+        window_focus_plugin_get_capture_context(self)->NewSource());
+  }
+  self->screenshot_ring->set_debug(self->enable_debug);
+  self->screenshot_ring->Start(options);
+  std::cout << "[WindowFocus] Keeping up to " << options.frames << " "
+            << (options.encoder != nullptr ? options.encoder->name : "raw")
+            << " screenshots in " << options.max_bytes << " bytes, one every "
+            << options.interval.count() << " ms" << std::endl;
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+#else
+  return FL_METHOD_RESPONSE(fl_method_error_response_new(
+      "SCREENSHOT_ERROR", "Built without X11 screen capture", nullptr));
+#endif
+}
+
+// Lists up to "count" frames of the ring, newest first; none when it is not
+// running.
+static FlMethodResponse* get_recent_frames(WindowFocusPlugin* self,
+                                           FlMethodCall* method_call) {
+  int count = 1;
+  FlMethodResponse* error =
+      get_int_argument(method_call, "count", 1, G_MAXINT, &count);
+  if (error != nullptr) {
+    return error;
+  }
+  g_autoptr(FlValue) result = fl_value_new_list();
+#ifdef WINDOW_FOCUS_HAVE_XSHM
+  if (self->screenshot_ring != nullptr && self->screenshot_ring->is_running()) {
+    const window_focus::ScreenshotEncoder* encoder =
+        self->screenshot_ring->options().encoder;
+    self->screenshot_ring->ReadRecent(
+        count, [&](const window_focus::FrameRing::Frame& frame,
+                   const uint8_t* data) {
+          FlValue* map = fl_value_new_map();
+          fl_value_set_string_take(map, "timestamp",
+                                   fl_value_new_int(frame.timestamp_ms));
+          fl_value_set_string_take(map, "width", fl_value_new_int(frame.width));
+          fl_value_set_string_take(map, "height",
+                                   fl_value_new_int(frame.height));
+          fl_value_set_string_take(
+              map, "format",
+              fl_value_new_string(encoder != nullptr ? encoder->name : "bgra"));
+          if (encoder == nullptr) {
+            fl_value_set_string_take(map, "stride",
+                                     fl_value_new_int(frame.width * 4));
+          }
+          fl_value_set_string_take(map, "data",
+                                   fl_value_new_uint8_list(data, frame.size));
+          fl_value_append_take(result, map);
+        });
+  }
+#endif
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
 // Called when a method call is received from Flutter.
 static void window_focus_plugin_handle_method_call(
     WindowFocusPlugin* self,
@@ -28,6 +1702,188 @@ static void window_focus_plugin_handle_method_call(
 
   if (strcmp(method, "getPlatformVersion") == 0) {
     response = get_platform_version();
+  } else if (strcmp(method, "setDebugMode") == 0) {
+    if (get_bool_argument(method_call, "debug", &self->enable_debug)) {
+#ifdef WINDOW_FOCUS_HAVE_XINPUT2
+      if (self->xinput2_monitor != nullptr) {
+        self->xinput2_monitor->set_debug(self->enable_debug);
+      }
+#endif
+      if (self->hidraw_monitor != nullptr) {
+        self->hidraw_monitor->set_debug(self->enable_debug);
+      }
+      if (self->gamepad_monitor != nullptr) {
+        self->gamepad_monitor->set_debug(self->enable_debug);
+      }
+#ifdef WINDOW_FOCUS_HAVE_PULSEAUDIO
+      if (self->audio_monitor != nullptr) {
+        self->audio_monitor->set_debug(self->enable_debug);
+      }
+#endif
+      if (self->media_monitor != nullptr) {
+        self->media_monitor->set_debug(self->enable_debug);
+      }
+#ifdef WINDOW_FOCUS_HAVE_XSHM
+      if (self->screenshot_ring != nullptr) {
+        self->screenshot_ring->set_debug(self->enable_debug);
+      }
+      if (self->screenshot_workers != nullptr) {
+        self->screenshot_workers->set_debug(self->enable_debug);
+      }
+#endif
+      std::cout << "[WindowFocus] C++: enableDebug_ set to "
+                << (self->enable_debug ? "true" : "false") << std::endl;
+      response = FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+    } else {
+      response = invalid_bool_argument("debug");
+    }
+  } else if (strcmp(method, "setInactivityTimeOut") == 0) {
+    response = set_inactivity_timeout(self, method_call);
+  } else if (strcmp(method, "getIdleThreshold") == 0) {
+    g_autoptr(FlValue) result =
+        fl_value_new_int(self->activity_tracker->inactivity_threshold());
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  } else if (strcmp(method, "setKeyboardMonitoring") == 0) {
+    response = set_monitoring_flag(method_call, "Keyboard",
+                                   &self->monitor_keyboard);
+#ifdef WINDOW_FOCUS_HAVE_XINPUT2
+    if (self->xinput2_monitor != nullptr) {
+      self->xinput2_monitor->set_monitor_keyboard(self->monitor_keyboard);
+    }
+#endif
+  } else if (strcmp(method, "setControllerMonitoring") == 0) {
+    gboolean was_enabled = self->monitor_controllers;
+    response = set_monitoring_flag(method_call, "Controller",
+                                   &self->monitor_controllers);
+    if (self->monitor_controllers && !was_enabled) {
+      window_focus_plugin_start_controller_monitoring(self);
+    } else if (!self->monitor_controllers && was_enabled) {
+      window_focus_plugin_stop_controller_monitoring(self);
+    }
+  } else if (strcmp(method, "setAudioMonitoring") == 0) {
+    gboolean was_enabled = self->monitor_audio;
+    response = set_monitoring_flag(method_call, "Audio",
+                                   &self->monitor_audio);
+    if (self->monitor_audio && !was_enabled) {
+      window_focus_plugin_start_audio_monitoring(self);
+    } else if (!self->monitor_audio && was_enabled) {
+      window_focus_plugin_stop_audio_monitoring(self);
+    }
+  } else if (strcmp(method, "setHIDMonitoring") == 0) {
+    gboolean was_enabled = self->monitor_hid_devices;
+    response = set_monitoring_flag(method_call, "HID device",
+                                   &self->monitor_hid_devices);
+    if (self->monitor_hid_devices && !was_enabled) {
+      window_focus_plugin_start_hid_monitoring(self);
+    } else if (!self->monitor_hid_devices && was_enabled) {
+      window_focus_plugin_stop_hid_monitoring(self);
+    }
+  } else if (strcmp(method, "setHIDAxisDeadzone") == 0) {
+    FlValue* value = lookup_argument(method_call, "deadzone");
+    if (value != nullptr && fl_value_get_type(value) == FL_VALUE_TYPE_FLOAT &&
+        fl_value_get_float(value) >= 0.0 && fl_value_get_float(value) < 1.0) {
+      self->hid_axis_deadzone = fl_value_get_float(value);
+      if (self->hidraw_monitor != nullptr) {
+        self->hidraw_monitor->set_axis_deadzone(self->hid_axis_deadzone);
+      }
+      if (self->gamepad_monitor != nullptr) {
+        self->gamepad_monitor->set_axis_deadzone(self->hid_axis_deadzone);
+      }
+      std::cout << "[WindowFocus] HID axis deadzone set to "
+                << self->hid_axis_deadzone << std::endl;
+      response = FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+    } else {
+      response = FL_METHOD_RESPONSE(fl_method_error_response_new(
+          "Invalid argument", "Expected a double in [0, 1) for 'deadzone'.",
+          nullptr));
+    }
+  } else if (strcmp(method, "setControllerAxisFilter") == 0) {
+    response = set_controller_axis_filter(self, method_call);
+  } else if (strcmp(method, "getInputDevices") == 0) {
+    response = get_input_devices(self);
+  } else if (strcmp(method, "setDeviceChangeEvents") == 0) {
+    response = set_monitoring_flag(method_call, "Device change event",
+                                   &self->device_change_events);
+  } else if (strcmp(method, "getAudioLevel") == 0) {
+    response = get_audio_level(self);
+  } else if (strcmp(method, "getAudioApplications") == 0) {
+    response = get_audio_applications(self);
+  } else if (strcmp(method, "setAudioIgnoredApps") == 0) {
+    response = set_audio_ignored_apps(self, method_call);
+  } else if (strcmp(method, "takeScreenshot") == 0) {
+    response = take_screenshot(self, method_call);
+    if (response == nullptr) {
+      // A screenshot worker answers.
+      return;
+    }
+  } else if (strcmp(method, "getMonitors") == 0) {
+    response = get_monitors(self, method_call);
+    if (response == nullptr) {
+      return;
+    }
+  } else if (strcmp(method, "takeMonitorScreenshots") == 0) {
+    response = take_monitor_screenshots(self, method_call);
+    if (response == nullptr) {
+      return;
+    }
+  } else if (strcmp(method, "getScreenshotFormats") == 0) {
+    response = get_screenshot_formats();
+  } else if (strcmp(method, "takeScreenshotRaw") == 0) {
+    response = take_screenshot_raw(self, method_call);
+    if (response == nullptr) {
+      return;
+    }
+  } else if (strcmp(method, "cancelScreenshots") == 0) {
+    int64_t cancelled = 0;
+#ifdef WINDOW_FOCUS_HAVE_XSHM
+    if (self->screenshot_workers != nullptr) {
+      cancelled = self->screenshot_workers->CancelAll();
+    }
+#endif
+    g_autoptr(FlValue) result = fl_value_new_int(cancelled);
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  } else if (strcmp(method, "takeScreenshotDelta") == 0) {
+    response = take_screenshot_delta(self, method_call);
+    if (response == nullptr) {
+      return;
+    }
+  } else if (strcmp(method, "startScreenshotSchedule") == 0) {
+    response = start_screenshot_schedule(self, method_call);
+  } else if (strcmp(method, "stopScreenshotSchedule") == 0) {
+#ifdef WINDOW_FOCUS_HAVE_XSHM
+    if (self->screenshot_scheduler != nullptr) {
+      self->screenshot_scheduler->Stop();
+    }
+#endif
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+  } else if (strcmp(method, "startScreenshotRing") == 0) {
+    response = start_screenshot_ring(self, method_call);
+  } else if (strcmp(method, "stopScreenshotRing") == 0) {
+#ifdef WINDOW_FOCUS_HAVE_XSHM
+    if (self->screenshot_ring != nullptr) {
+      self->screenshot_ring->Stop();
+    }
+#endif
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+  } else if (strcmp(method, "getRecentFrames") == 0) {
+    response = get_recent_frames(self, method_call);
+  } else if (strcmp(method, "setAudioThreshold") == 0) {
+    FlValue* value = lookup_argument(method_call, "threshold");
+    if (value != nullptr && fl_value_get_type(value) == FL_VALUE_TYPE_FLOAT) {
+      self->audio_threshold = fl_value_get_float(value);
+#ifdef WINDOW_FOCUS_HAVE_PULSEAUDIO
+      if (self->audio_monitor != nullptr) {
+        self->audio_monitor->set_threshold(
+            static_cast<float>(self->audio_threshold));
+      }
+#endif
+      std::cout << "[WindowFocus] Audio threshold set to "
+                << self->audio_threshold << std::endl;
+      response = FL_METHOD_RESPONSE(fl_method_success_response_new(nullptr));
+    } else {
+      response = FL_METHOD_RESPONSE(fl_method_error_response_new(
+          "Invalid argument", "Expected a double for 'threshold'.", nullptr));
+    }
   } else {
     response = FL_METHOD_RESPONSE(fl_method_not_implemented_response_new());
   }
@@ -44,6 +1900,44 @@ FlMethodResponse* get_platform_version() {
 }
 
 static void window_focus_plugin_dispose(GObject* object) {
+  WindowFocusPlugin* self = WINDOW_FOCUS_PLUGIN(object);
+
+  // Backends report into the tracker, so they go first.
+  window_focus_plugin_stop_hid_monitoring(self);
+  window_focus_plugin_stop_controller_monitoring(self);
+  window_focus_plugin_stop_audio_monitoring(self);
+#ifdef WINDOW_FOCUS_HAVE_XINPUT2
+  delete self->xinput2_monitor;
+  self->xinput2_monitor = nullptr;
+#endif
+#ifdef WINDOW_FOCUS_HAVE_WAYLAND
+  delete self->wayland_idle_monitor;
+  self->wayland_idle_monitor = nullptr;
+#endif
+#ifdef WINDOW_FOCUS_HAVE_XSHM
+  delete self->screenshot_scheduler;
+  self->screenshot_scheduler = nullptr;
+  delete self->screenshot_ring;
+  self->screenshot_ring = nullptr;
+  // Answers the screenshots still pending as cancelled.
+  delete self->screenshot_workers;
+  self->screenshot_workers = nullptr;
+  delete self->delta_stream;
+  self->delta_stream = nullptr;
+  delete self->capture_context;
+  self->capture_context = nullptr;
+#endif
+  delete self->activity_tracker;
+  self->activity_tracker = nullptr;
+  g_clear_pointer(&self->audio_ignored_apps, g_strfreev);
+  delete self->controller_axis_settings;
+  self->controller_axis_settings = nullptr;
+  if (self->channel != nullptr) {
+    g_object_remove_weak_pointer(G_OBJECT(self->channel),
+                                 reinterpret_cast<gpointer*>(&self->channel));
+    self->channel = nullptr;
+  }
+
   G_OBJECT_CLASS(window_focus_plugin_parent_class)->dispose(object);
 }
 
@@ -51,7 +1945,16 @@ static void window_focus_plugin_class_init(WindowFocusPluginClass* klass) {
   G_OBJECT_CLASS(klass)->dispose = window_focus_plugin_dispose;
 }
 
-static void window_focus_plugin_init(WindowFocusPlugin* self) {}
+static void window_focus_plugin_init(WindowFocusPlugin* self) {
+  self->monitor_keyboard = TRUE;
+  self->audio_threshold = 0.01;
+  self->controller_axis_settings =
+      new std::array<window_focus::EvdevAxisFilter::AxisSettings, ABS_CNT>();
+  self->activity_tracker = new window_focus::ActivityTracker(
+      [self](bool active) {
+        window_focus_plugin_on_activity_changed(self, active);
+      });
+}
 
 static void method_call_cb(FlMethodChannel* channel, FlMethodCall* method_call,
                            gpointer user_data) {
@@ -66,11 +1969,17 @@ void window_focus_plugin_register_with_registrar(FlPluginRegistrar* registrar) {
   g_autoptr(FlStandardMethodCodec) codec = fl_standard_method_codec_new();
   g_autoptr(FlMethodChannel) channel =
       fl_method_channel_new(fl_plugin_registrar_get_messenger(registrar),
-                            "window_focus",
+                            "expert.kotelnikoff/window_focus",
                             FL_METHOD_CODEC(codec));
+  // The handler keeps the plugin alive until the engine closes the channel.
   fl_method_channel_set_method_call_handler(channel, method_call_cb,
                                             g_object_ref(plugin),
                                             g_object_unref);
+  plugin->channel = channel;
+  g_object_add_weak_pointer(G_OBJECT(channel),
+                            reinterpret_cast<gpointer*>(&plugin->channel));
+
+  window_focus_plugin_start_monitoring(plugin);
 
   g_object_unref(plugin);
 }
@@ -0,0 +1,178 @@
+#include "xinput2_monitor.h"
+
+#include <X11/Xlib.h>
+#include <X11/extensions/XInput2.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <iostream>
+#include <utility>
+
+namespace window_focus {
+
+constexpr std::chrono::milliseconds XInput2Monitor::kCoalesceWindow;
+
+XInput2Monitor::XInput2Monitor(ActivityCallback on_activity)
+    : on_activity_(std::move(on_activity)) {}
+
+XInput2Monitor::~XInput2Monitor() {
+  Stop();
+}
+
+bool XInput2Monitor::Start(const char* display_name) {
+  Stop();
+
+  display_ = XOpenDisplay(display_name);
+  if (display_ == nullptr) {
+    return false;
+  }
+
+  // Before XI 2.1 raw events stop while another client grabs the device,
+  // which games and drag operations do, so activity there would be missed.
+  // Ask for 2.2; the server answers with the version it speaks.
+  int first_event = 0;
+  int first_error = 0;
+  int major = 2;
+  int minor = 2;
+  if (!XQueryExtension(display_, "XInputExtension", &xi_opcode_, &first_event,
+                       &first_error) ||
+      XIQueryVersion(display_, &major, &minor) != Success ||
+      major < 2 || (major == 2 && minor < 1)) {
+    std::cerr << "[WindowFocus] XInput 2.1 is not available" << std::endl;
+    XCloseDisplay(display_);
+    display_ = nullptr;
+    return false;
+  }
+
+  // Raw events are only delivered to the root window, from every device.
+  unsigned char mask_bits[XIMaskLen(XI_LASTEVENT)] = {0};
+  XISetMask(mask_bits, XI_RawMotion);
+  XISetMask(mask_bits, XI_RawButtonPress);
+  XISetMask(mask_bits, XI_RawKeyPress);
+  XIEventMask mask;
+  mask.deviceid = XIAllMasterDevices;
+  mask.mask_len = sizeof(mask_bits);
+  mask.mask = mask_bits;
+  XISelectEvents(display_, DefaultRootWindow(display_), &mask, 1);
+  XFlush(display_);
+
+  wake_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (wake_fd_ < 0) {
+    XCloseDisplay(display_);
+    display_ = nullptr;
+    return false;
+  }
+
+  thread_ = std::thread(&XInput2Monitor::Run, this);
+  return true;
+}
+
+void XInput2Monitor::Stop() {
+  if (thread_.joinable()) {
+    uint64_t one = 1;
+    if (write(wake_fd_, &one, sizeof(one)) < 0 && debug_) {
+      std::cerr << "[WindowFocus] Failed to wake XInput2 reactor" << std::endl;
+    }
+    thread_.join();
+  }
+  if (wake_fd_ >= 0) {
+    close(wake_fd_);
+    wake_fd_ = -1;
+  }
+  if (display_ != nullptr) {
+    XCloseDisplay(display_);
+    display_ = nullptr;
+  }
+}
+
+void XInput2Monitor::Run() {
+  using Clock = std::chrono::steady_clock;
+
+  const int x_fd = ConnectionNumber(display_);
+  bool cooling_down = false;
+  Clock::time_point cooldown_end;
+
+  while (true) {
+    pollfd fds[2] = {{wake_fd_, POLLIN, 0}, {x_fd, POLLIN, 0}};
+    nfds_t nfds = 2;
+    int timeout_ms = -1;
+
+    // After reporting activity, leave further events queued in the socket
+    // until the coalescing window ends and then drain them in one batch.
+    if (cooling_down) {
+      auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+          cooldown_end - Clock::now());
+      if (remaining.count() > 0) {
+        nfds = 1;
+        timeout_ms = static_cast<int>(remaining.count());
+      } else {
+        cooling_down = false;
+      }
+    }
+
+    int ready = poll(fds, nfds, timeout_ms);
+    if (ready < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    if (fds[0].revents != 0) {
+      break;  // Stop() was called.
+    }
+    if (nfds == 1) {
+      continue;  // Coalescing window elapsed.
+    }
+    if ((fds[1].revents & (POLLERR | POLLHUP)) != 0) {
+      std::cerr << "[WindowFocus] Lost XInput2 connection" << std::endl;
+      break;
+    }
+
+    if (DrainEvents()) {
+      on_activity_();
+      cooling_down = true;
+      cooldown_end = Clock::now() + kCoalesceWindow;
+    }
+  }
+}
+
+bool XInput2Monitor::DrainEvents() {
+  bool input_detected = false;
+  int events = 0;
+
+  while (XPending(display_) > 0) {
+    XEvent event;
+    XNextEvent(display_, &event);
+    // The event type is known from the cookie header alone, so the payload is
+    // never fetched with XGetEventData; Xlib frees it on the next event.
+    if (event.type != GenericEvent || event.xcookie.extension != xi_opcode_) {
+      continue;
+    }
+    switch (event.xcookie.evtype) {
+      case XI_RawKeyPress:
+        if (monitor_keyboard_) {
+          input_detected = true;
+          events++;
+        }
+        break;
+      case XI_RawMotion:
+      case XI_RawButtonPress:
+        input_detected = true;
+        events++;
+        break;
+      default:
+        break;
+    }
+  }
+
+  if (input_detected && debug_) {
+    std::cout << "[WindowFocus] XInput2 activity (" << events
+              << " raw events coalesced)" << std::endl;
+  }
+  return input_detected;
+}
+
+}  // namespace window_focus
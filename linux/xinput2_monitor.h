@@ -0,0 +1,62 @@
+#ifndef FLUTTER_PLUGIN_WINDOW_FOCUS_XINPUT2_MONITOR_H_
+#define FLUTTER_PLUGIN_WINDOW_FOCUS_XINPUT2_MONITOR_H_
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
+
+typedef struct _XDisplay Display;
+
+namespace window_focus {
+
+// Event-driven pointer and keyboard activity for X11 sessions.
+//
+// Instead of comparing cursor positions on a timer, the monitor selects
+// XI_RawMotion, XI_RawButtonPress and XI_RawKeyPress on the root window of a
+// private X connection. Raw events are delivered for relative motion with a
+// locked cursor, wheel scrolls and clicks alike. A reactor thread drains them
+// and reports at most one activity update per coalescing window, so a
+// 1000 Hz mouse costs ten wakeups a second rather than a thousand.
+class XInput2Monitor {
+ public:
+  using ActivityCallback = std::function<void()>;
+
+  // |on_activity| is invoked on the reactor thread.
+  explicit XInput2Monitor(ActivityCallback on_activity);
+  ~XInput2Monitor();
+
+  XInput2Monitor(const XInput2Monitor&) = delete;
+  XInput2Monitor& operator=(const XInput2Monitor&) = delete;
+
+  // Opens |display_name| (nullptr means $DISPLAY), selects raw events and
+  // starts the reactor thread. Returns false if XInput 2.1, the first
+  // version that delivers raw events during grabs, is unavailable.
+  bool Start(const char* display_name);
+  void Stop();
+
+  bool is_running() const { return display_ != nullptr; }
+
+  void set_monitor_keyboard(bool enabled) { monitor_keyboard_ = enabled; }
+  void set_debug(bool enabled) { debug_ = enabled; }
+
+  // Upper bound on how often activity is reported while input keeps coming.
+  static constexpr std::chrono::milliseconds kCoalesceWindow{100};
+
+ private:
+  void Run();
+  // Drains queued X events; returns true if any of them was user input.
+  bool DrainEvents();
+
+  ActivityCallback on_activity_;
+  Display* display_ = nullptr;
+  int xi_opcode_ = 0;
+  int wake_fd_ = -1;
+  std::thread thread_;
+  std::atomic<bool> monitor_keyboard_{true};
+  std::atomic<bool> debug_{false};
+};
+
+}  // namespace window_focus
+
+#endif  // FLUTTER_PLUGIN_WINDOW_FOCUS_XINPUT2_MONITOR_H_
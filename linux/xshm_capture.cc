@@ -0,0 +1,513 @@
+#include "xshm_capture.h"
+
+#include <X11/Xatom.h>
+#include <X11/Xlib.h>
+#include <X11/Xresource.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#ifdef WINDOW_FOCUS_HAVE_XRANDR
+#include <X11/extensions/Xrandr.h>
+#endif
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <unordered_map>
+
+namespace window_focus {
+
+struct XShmCapture::Segment {
+  // XShmCreateImage keeps a pointer to this in the image.
+  XShmSegmentInfo info = {};
+  bool attached = false;
+};
+
+namespace {
+
+// Records X errors on one connection for the lifetime of the trap instead
+// of handing them to Xlib's default handler, which exits the process.
+//
+// The error handler is process-wide and captures run on several threads,
+// so it is installed once and never swapped: it looks the connection up in
+// a table of trapped displays and hands errors on other connections to the
+// handler it replaced. Traps on the same display may nest.
+class ErrorTrap {
+ public:
+  explicit ErrorTrap(Display* display) : display_(display) {
+    std::call_once(install_once_,
+                   []() { previous_ = XSetErrorHandler(Handle); });
+    // Earlier requests' errors belong to whoever sent them.
+    XSync(display_, False);
+    std::lock_guard<std::mutex> lock(mutex_);
+    Trap& trap = traps_[display_];
+    if (trap.depth++ == 0) {
+      trap.failed = false;
+    }
+  }
+
+  ~ErrorTrap() {
+    XSync(display_, False);
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = traps_.find(display_);
+    if (--it->second.depth == 0) {
+      traps_.erase(it);
+    }
+  }
+
+  ErrorTrap(const ErrorTrap&) = delete;
+  ErrorTrap& operator=(const ErrorTrap&) = delete;
+
+  // Waits until the server has handled everything sent so far.
+  bool Failed() {
+    XSync(display_, False);
+    std::lock_guard<std::mutex> lock(mutex_);
+    return traps_[display_].failed;
+  }
+
+ private:
+  struct Trap {
+    int depth = 0;
+    bool failed = false;
+  };
+
+  // Runs on the thread that reads the connection's replies, which for a
+  // trapped display is the one inside a trap; the mutex is never held
+  // across Xlib calls.
+  static int Handle(Display* display, XErrorEvent* event) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = traps_.find(display);
+      if (it != traps_.end()) {
+        it->second.failed = true;
+        return 0;
+      }
+    }
+    return previous_ != nullptr ? previous_(display, event) : 0;
+  }
+
+  static std::once_flag install_once_;
+  static XErrorHandler previous_;
+  static std::mutex mutex_;
+  static std::unordered_map<Display*, Trap> traps_;
+
+  Display* display_;
+};
+
+std::once_flag ErrorTrap::install_once_;
+XErrorHandler ErrorTrap::previous_ = nullptr;
+std::mutex ErrorTrap::mutex_;
+std::unordered_map<Display*, ErrorTrap::Trap> ErrorTrap::traps_;
+
+constexpr int kBytesPerPixel = 4;
+
+}  // namespace
+
+XShmCapture::XShmCapture() = default;
+
+XShmCapture::~XShmCapture() {
+  Close();
+}
+
+bool XShmCapture::Open(const char* display_name) {
+  Close();
+
+  display_ = XOpenDisplay(display_name);
+  if (display_ == nullptr) {
+    return false;
+  }
+
+  const int screen = DefaultScreen(display_);
+  const Visual* visual = DefaultVisual(display_, screen);
+  const int depth = DefaultDepth(display_, screen);
+  if ((depth != 24 && depth != 32) || visual->red_mask != 0xFF0000 ||
+      visual->green_mask != 0x00FF00 || visual->blue_mask != 0x0000FF ||
+      ImageByteOrder(display_) != LSBFirst) {
+    std::cerr << "[WindowFocus] Screen capture needs a 24-bit BGRX visual, "
+              << "the screen has depth " << depth << std::endl;
+    Close();
+    return false;
+  }
+
+  root_ = RootWindow(display_, screen);
+  net_active_window_ = XInternAtom(display_, "_NET_ACTIVE_WINDOW", False);
+  has_shm_ = XShmQueryExtension(display_);
+#ifdef WINDOW_FOCUS_HAVE_XRANDR
+  int event_base = 0;
+  int error_base = 0;
+  int major = 0;
+  int minor = 0;
+  // XRRGetMonitors is 1.5.
+  has_randr_ = XRRQueryExtension(display_, &event_base, &error_base) &&
+               XRRQueryVersion(display_, &major, &minor) &&
+               (major > 1 || (major == 1 && minor >= 5));
+#endif
+  if (debug_) {
+    std::cout << "[WindowFocus] Screen capture on " << DisplayString(display_)
+              << (has_shm_ ? " through MIT-SHM" : " through XGetImage")
+              << (has_randr_ ? " with XRandR monitors" : "") << std::endl;
+  }
+  return true;
+}
+
+void XShmCapture::Close() {
+  if (display_ == nullptr) {
+    return;
+  }
+  DestroyImage();
+  XCloseDisplay(display_);
+  display_ = nullptr;
+  has_shm_ = false;
+  has_randr_ = false;
+}
+
+bool XShmCapture::Capture(bool active_window_only, Frame* frame) {
+  CaptureTarget target;
+  target.active_window_only = active_window_only;
+  return Capture(target, frame);
+}
+
+bool XShmCapture::Capture(const CaptureTarget& target, Frame* frame) {
+  if (display_ == nullptr) {
+    return false;
+  }
+
+  XWindowAttributes screen;
+  if (!XGetWindowAttributes(display_, root_, &screen)) {
+    return false;
+  }
+  screen_width_ = screen.width;
+  screen_height_ = screen.height;
+  const bool shared =
+      has_shm_ && EnsureSharedImage(screen.width, screen.height);
+
+  // Windows may be destroyed at any point, and the screen resized.
+  ErrorTrap trap(display_);
+  int x = 0;
+  int y = 0;
+  int width = screen.width;
+  int height = screen.height;
+  bool clip = false;
+  // Falls back to the whole screen rather than failing.
+  bool fallback = false;
+  if (target.active_window_only) {
+    const Window active = GetActiveWindow();
+    clip = active != None && GetWindowBounds(active, target.client_area_only,
+                                             &x, &y, &width, &height);
+    fallback = true;
+  } else if (target.window != 0) {
+    if (!GetWindowBounds(target.window, target.client_area_only, &x, &y,
+                         &width, &height)) {
+      return false;
+    }
+    clip = true;
+  } else if (target.has_region()) {
+    x = target.x;
+    y = target.y;
+    width = target.width;
+    height = target.height;
+    clip = true;
+  } else if (target.monitor >= 0) {
+    const std::vector<Monitor> monitors = ListMonitors();
+    if (target.monitor >= static_cast<int>(monitors.size())) {
+      if (debug_) {
+        std::cerr << "[WindowFocus] No monitor " << target.monitor << ", "
+                  << monitors.size() << " connected" << std::endl;
+      }
+      return false;
+    }
+    const Monitor& monitor = monitors[target.monitor];
+    x = monitor.x;
+    y = monitor.y;
+    width = monitor.width;
+    height = monitor.height;
+    clip = true;
+  }
+  if (clip) {
+    // The server rejects requests that reach outside the root window.
+    const int left = std::max(x, 0);
+    const int top = std::max(y, 0);
+    // In 64 bits, so a region reaching past G_MAXINT cannot wrap around.
+    width = static_cast<int>(
+        std::min<int64_t>(static_cast<int64_t>(x) + width, screen.width) -
+        left);
+    height = static_cast<int>(
+        std::min<int64_t>(static_cast<int64_t>(y) + height, screen.height) -
+        top);
+    x = left;
+    y = top;
+    if (width <= 0 || height <= 0) {
+      if (!fallback) {
+        return false;
+      }
+      // The active window is entirely off screen.
+      x = 0;
+      y = 0;
+      width = screen.width;
+      height = screen.height;
+    }
+  }
+
+  if (shared) {
+    // A smaller region goes to the start of the segment with rows of its own
+    // width, which is how the server lays out the reply.
+    const int full_width = image_->width;
+    const int full_height = image_->height;
+    const int full_stride = image_->bytes_per_line;
+    image_->width = width;
+    image_->height = height;
+    image_->bytes_per_line = width * kBytesPerPixel;
+    const bool captured =
+        XShmGetImage(display_, root_, image_, x, y, AllPlanes) &&
+        !trap.Failed();
+    image_->width = full_width;
+    image_->height = full_height;
+    image_->bytes_per_line = full_stride;
+    if (!captured) {
+      return false;
+    }
+    frame->data = reinterpret_cast<uint8_t*>(image_->data);
+    frame->width = width;
+    frame->height = height;
+    frame->stride = width * kBytesPerPixel;
+    return true;
+  }
+
+  DestroyImage();
+  image_ = XGetImage(display_, root_, x, y, width, height, AllPlanes,
+                     ZPixmap);
+  if (image_ == nullptr || trap.Failed() ||
+      image_->bits_per_pixel != kBytesPerPixel * 8) {
+    DestroyImage();
+    return false;
+  }
+  frame->data = reinterpret_cast<uint8_t*>(image_->data);
+  frame->width = width;
+  frame->height = height;
+  frame->stride = image_->bytes_per_line;
+  return true;
+}
+
+std::vector<XShmCapture::Monitor> XShmCapture::ListMonitors() {
+  std::vector<Monitor> monitors;
+  if (display_ == nullptr) {
+    return monitors;
+  }
+#ifdef WINDOW_FOCUS_HAVE_XRANDR
+  if (has_randr_) {
+    int count = 0;
+    XRRMonitorInfo* infos = XRRGetMonitors(display_, root_, True, &count);
+    for (int i = 0; i < count; i++) {
+      Monitor monitor;
+      char* name = infos[i].name != None
+                       ? XGetAtomName(display_, infos[i].name)
+                       : nullptr;
+      if (name != nullptr) {
+        monitor.name = name;
+        XFree(name);
+      }
+      monitor.x = infos[i].x;
+      monitor.y = infos[i].y;
+      monitor.width = infos[i].width;
+      monitor.height = infos[i].height;
+      monitor.primary = infos[i].primary;
+      monitors.push_back(monitor);
+    }
+    if (infos != nullptr) {
+      XRRFreeMonitors(infos);
+    }
+    if (!monitors.empty()) {
+      return monitors;
+    }
+  }
+#endif
+  // Headless servers and old ones report no monitors.
+  Monitor screen;
+  screen.name = "default";
+  screen.width = DisplayWidth(display_, DefaultScreen(display_));
+  screen.height = DisplayHeight(display_, DefaultScreen(display_));
+  screen.primary = true;
+  monitors.push_back(screen);
+  return monitors;
+}
+
+double XShmCapture::scale() {
+  if (display_ == nullptr) {
+    return 1.0;
+  }
+  // Set by desktops that scale, for Xft and the toolkits that follow it.
+  const char* resources = XResourceManagerString(display_);
+  if (resources == nullptr) {
+    return 1.0;
+  }
+  XrmInitialize();
+  XrmDatabase database = XrmGetStringDatabase(resources);
+  if (database == nullptr) {
+    return 1.0;
+  }
+  double scale = 1.0;
+  char* type = nullptr;
+  XrmValue value;
+  if (XrmGetResource(database, "Xft.dpi", "Xft.Dpi", &type, &value) &&
+      value.addr != nullptr) {
+    const double dpi = std::strtod(value.addr, nullptr);
+    if (dpi > 0) {
+      scale = dpi / 96.0;
+    }
+  }
+  XrmDestroyDatabase(database);
+  return scale;
+}
+
+bool XShmCapture::EnsureSharedImage(int width, int height) {
+  if (segment_ != nullptr && image_->width == width &&
+      image_->height == height) {
+    return true;
+  }
+  DestroyImage();
+
+  const int screen = DefaultScreen(display_);
+  segment_.reset(new Segment());
+  image_ = XShmCreateImage(display_, DefaultVisual(display_, screen),
+                           DefaultDepth(display_, screen), ZPixmap, nullptr,
+                           &segment_->info, width, height);
+  if (image_ == nullptr || image_->bits_per_pixel != kBytesPerPixel * 8) {
+    DestroyImage();
+    has_shm_ = false;
+    return false;
+  }
+
+  XShmSegmentInfo& info = segment_->info;
+  info.shmid = shmget(IPC_PRIVATE, image_->bytes_per_line * image_->height,
+                      IPC_CREAT | 0600);
+  if (info.shmid < 0) {
+    DestroyImage();
+    has_shm_ = false;
+    return false;
+  }
+  info.shmaddr = static_cast<char*>(shmat(info.shmid, nullptr, 0));
+  // Removed now so the segment cannot outlive the process; it stays until
+  // both sides have detached.
+  shmctl(info.shmid, IPC_RMID, nullptr);
+  if (info.shmaddr == reinterpret_cast<char*>(-1)) {
+    info.shmaddr = nullptr;
+    DestroyImage();
+    has_shm_ = false;
+    return false;
+  }
+  image_->data = info.shmaddr;
+  info.readOnly = False;
+
+  // Attaching fails on servers that cannot reach the segment, such as an
+  // X server in another container or on another machine.
+  ErrorTrap trap(display_);
+  segment_->attached = XShmAttach(display_, &info) && !trap.Failed();
+  if (!segment_->attached) {
+    std::cerr << "[WindowFocus] MIT-SHM attach failed, capturing through "
+              << "XGetImage" << std::endl;
+    DestroyImage();
+    has_shm_ = false;
+    return false;
+  }
+  if (debug_) {
+    std::cout << "[WindowFocus] Screen capture segment " << width << "x"
+              << height << " (" << info.shmid << ")" << std::endl;
+  }
+  return true;
+}
+
+void XShmCapture::DestroyImage() {
+  if (segment_ != nullptr) {
+    XShmSegmentInfo& info = segment_->info;
+    if (segment_->attached) {
+      XShmDetach(display_, &info);
+      XSync(display_, False);
+    }
+    if (info.shmaddr != nullptr) {
+      shmdt(info.shmaddr);
+    }
+    if (image_ != nullptr) {
+      // The pixels were the segment, which XDestroyImage must not free.
+      image_->data = nullptr;
+    }
+    segment_.reset();
+  }
+  if (image_ != nullptr) {
+    XDestroyImage(image_);
+    image_ = nullptr;
+  }
+}
+
+unsigned long XShmCapture::GetActiveWindow() {
+  Atom type = None;
+  int format = 0;
+  unsigned long count = 0;
+  unsigned long remaining = 0;
+  unsigned char* data = nullptr;
+  if (XGetWindowProperty(display_, root_, net_active_window_, 0, 1, False,
+                         XA_WINDOW, &type, &format, &count, &remaining,
+                         &data) != Success) {
+    return None;
+  }
+  Window window = None;
+  if (type == XA_WINDOW && format == 32 && count == 1) {
+    window = *reinterpret_cast<Window*>(data);
+  }
+  if (data != nullptr) {
+    XFree(data);
+  }
+  return window;
+}
+
+bool XShmCapture::GetWindowBounds(unsigned long window,
+                                  bool client_area_only,
+                                  int* x,
+                                  int* y,
+                                  int* width,
+                                  int* height) {
+  // Window managers reparent clients into a frame; like GetWindowRect on
+  // Windows, the capture includes it unless only the client area is asked
+  // for.
+  while (!client_area_only) {
+    Window root = None;
+    Window parent = None;
+    Window* children = nullptr;
+    unsigned int child_count = 0;
+    if (!XQueryTree(display_, window, &root, &parent, &children,
+                    &child_count)) {
+      return false;
+    }
+    if (children != nullptr) {
+      XFree(children);
+    }
+    if (parent == root_ || parent == None) {
+      break;
+    }
+    window = parent;
+  }
+
+  XWindowAttributes attributes;
+  Window child = None;
+  if (!XGetWindowAttributes(display_, window, &attributes) ||
+      attributes.map_state != IsViewable) {
+    return false;
+  }
+  const int border = client_area_only ? 0 : attributes.border_width;
+  if (!XTranslateCoordinates(display_, window, root_, -border, -border, x, y,
+                             &child)) {
+    return false;
+  }
+  *width = attributes.width + 2 * border;
+  *height = attributes.height + 2 * border;
+  if (debug_) {
+    std::cout << "[WindowFocus] Capturing window 0x" << std::hex << window
+              << std::dec << " at " << *x << "," << *y << " " << *width << "x"
+              << *height << std::endl;
+  }
+  return true;
+}
+
+}  // namespace window_focus
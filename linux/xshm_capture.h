@@ -0,0 +1,127 @@
+#ifndef FLUTTER_PLUGIN_WINDOW_FOCUS_XSHM_CAPTURE_H_
+#define FLUTTER_PLUGIN_WINDOW_FOCUS_XSHM_CAPTURE_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "capture_target.h"
+
+typedef struct _XDisplay Display;
+typedef struct _XImage XImage;
+
+namespace window_focus {
+
+// Screen capture for X11 sessions through the MIT-SHM extension.
+//
+// The X server writes pixels straight into a shared memory segment that is
+// attached once and reused by every capture, so a frame costs one
+// XShmGetImage round trip and no allocation or copy on either side. The
+// segment is sized for the screen and only recreated when the screen size
+// changes. Displays without MIT-SHM (remote connections) fall back to
+// XGetImage.
+//
+// Monitors come from XRandR 1.5 when the build and the server have it, and
+// are otherwise the whole screen as one.
+//
+// Frames are 32-bit BGRX: how 24 and 32 bit TrueColor visuals lay out
+// pixels on little-endian machines. The fourth byte is padding.
+//
+// Not thread-safe; one capture at a time.
+class XShmCapture {
+ public:
+  // A captured image. Points into the shared segment and stays valid until
+  // the next Capture() or Close(). Callers may convert it in place.
+  struct Frame {
+    uint8_t* data = nullptr;
+    int width = 0;
+    int height = 0;
+    // Bytes per row.
+    int stride = 0;
+  };
+
+  // A monitor in root window coordinates.
+  struct Monitor {
+    std::string name;
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+    bool primary = false;
+  };
+
+  XShmCapture();
+  ~XShmCapture();
+
+  XShmCapture(const XShmCapture&) = delete;
+  XShmCapture& operator=(const XShmCapture&) = delete;
+
+  // Opens a private connection to |display_name| (nullptr means $DISPLAY).
+  // Returns false without an X server or when the default visual does not
+  // store pixels as BGRX.
+  bool Open(const char* display_name);
+  void Close();
+
+  bool is_open() const { return display_ != nullptr; }
+  // False when frames come through XGetImage instead of shared memory.
+  bool uses_shm() const { return has_shm_; }
+
+  // Captures the whole screen, or with |active_window_only| the window in
+  // _NET_ACTIVE_WINDOW including its window manager frame, clipped to the
+  // screen. Falls back to the whole screen when no window is active.
+  bool Capture(bool active_window_only, Frame* frame);
+  // Captures |target|, clipped to the screen. Fails for windows that do
+  // not exist, regions entirely off screen and monitors ListMonitors does
+  // not report. Windows are captured as they appear on screen, including
+  // whatever covers them.
+  bool Capture(const CaptureTarget& target, Frame* frame);
+
+  // The active monitors in the order XRandR reports them, which is the
+  // order CaptureTarget::monitor indexes.
+  std::vector<Monitor> ListMonitors();
+  // Ratio of the Xft.dpi resource to 96, or 1 when it is not set. X11 has
+  // one for the whole screen rather than one per monitor.
+  double scale();
+
+  // Size of the screen as of the last Capture.
+  int screen_width() const { return screen_width_; }
+  int screen_height() const { return screen_height_; }
+
+  void set_debug(bool enabled) { debug_ = enabled; }
+
+ private:
+  struct Segment;
+
+  // Makes sure a shared image of |width| x |height| is attached.
+  bool EnsureSharedImage(int width, int height);
+  void DestroyImage();
+  // The window in _NET_ACTIVE_WINDOW, or 0.
+  unsigned long GetActiveWindow();
+  // Root coordinates of |window|'s top-level frame, or with
+  // |client_area_only| of the window itself without its border.
+  bool GetWindowBounds(unsigned long window,
+                       bool client_area_only,
+                       int* x,
+                       int* y,
+                       int* width,
+                       int* height);
+
+  Display* display_ = nullptr;
+  unsigned long root_ = 0;
+  unsigned long net_active_window_ = 0;
+  bool has_shm_ = false;
+  bool has_randr_ = false;
+  int screen_width_ = 0;
+  int screen_height_ = 0;
+
+  // The shared image, or the last XGetImage result without MIT-SHM.
+  XImage* image_ = nullptr;
+  std::unique_ptr<Segment> segment_;
+
+  bool debug_ = false;
+};
+
+}  // namespace window_focus
+
+#endif  // FLUTTER_PLUGIN_WINDOW_FOCUS_XSHM_CAPTURE_H_
@@ -18,8 +18,9 @@ public class WindowFocusPlugin: NSObject, FlutterPlugin {
         let instance = WindowFocusPlugin()
         registrar.addMethodCallDelegate(instance, channel: channel)
 
-        instance.windowFocusObserver = WindowFocusObserver { (appName, windowTitle) in
-            channel.invokeMethod("onFocusChange", arguments: ["appName": appName, "windowTitle": windowTitle]) { (result) in
+        instance.windowFocusObserver = WindowFocusObserver { (appName, windowTitle, windowID) in
+            // windowId is what takeScreenshot's "window" argument takes.
+            channel.invokeMethod("onFocusChange", arguments: ["appName": appName, "windowTitle": windowTitle, "windowId": Int(windowID)]) { (result) in
             }
         }
         instance.idleTracker = IdleTracker(channel: channel)
@@ -101,12 +102,94 @@ public class WindowFocusPlugin: NSObject, FlutterPlugin {
             }
             
         case "takeScreenshot":
-            if let args = call.arguments as? [String: Any],
-            let activeWindowOnly = args["activeWindowOnly"] as? Bool {
-                takeScreenshot(activeWindowOnly: activeWindowOnly, result: result)
-            } else {
-                takeScreenshot(activeWindowOnly: false, result: result)
+            let args = call.arguments as? [String: Any]
+            let activeWindowOnly = args?["activeWindowOnly"] as? Bool ?? false
+            let format = args?["format"] as? String ?? "png"
+            let quality = args?["quality"] as? Int ?? 90
+            guard let fileType = WindowFocusPlugin.screenshotFormats[format] else {
+                result(FlutterError(code: "Invalid argument", message: "Screenshot format '\(format)' is not supported on macOS", details: nil))
+                return
+            }
+            guard (1...100).contains(quality) else {
+                result(FlutterError(code: "Invalid argument", message: "Expected an integer in [1, 100] for 'quality'", details: nil))
+                return
+            }
+            let maxWidth = args?["maxWidth"] as? Int
+            let maxHeight = args?["maxHeight"] as? Int
+            guard (maxWidth ?? 1) > 0 && (maxHeight ?? 1) > 0 else {
+                result(FlutterError(code: "Invalid argument", message: "Expected a positive integer for 'maxWidth' and 'maxHeight'", details: nil))
+                return
+            }
+            let monitor = args?["monitor"] as? Int
+            guard (monitor ?? 0) >= 0 else {
+                result(FlutterError(code: "Invalid argument", message: "Expected a monitor id for 'monitor'", details: nil))
+                return
+            }
+            let window = args?["window"] as? Int
+            guard (window ?? 1) > 0 && (window ?? 1) <= Int(UInt32.max) else {
+                result(FlutterError(code: "Invalid argument", message: "Expected a window id for 'window'", details: nil))
+                return
+            }
+            var region: CGRect?
+            if let value = args?["region"], !(value is NSNull) {
+                guard let map = value as? [String: Any],
+                      let x = map["x"] as? Int, let y = map["y"] as? Int,
+                      let width = map["width"] as? Int, let height = map["height"] as? Int,
+                      width > 0 && height > 0 else {
+                    result(FlutterError(code: "Invalid argument", message: "Expected a map of integer 'x', 'y' and positive 'width' and 'height' for 'region'", details: nil))
+                    return
+                }
+                region = CGRect(x: x, y: y, width: width, height: height)
+            }
+            let clientAreaOnly = args?["clientAreaOnly"] as? Bool ?? false
+            let targets = [activeWindowOnly, window != nil, region != nil, monitor != nil].filter { $0 }.count
+            guard targets <= 1 else {
+                result(FlutterError(code: "Invalid argument", message: "Only one of 'activeWindowOnly', 'window', 'region' and 'monitor' can be given", details: nil))
+                return
+            }
+            guard !clientAreaOnly || activeWindowOnly || window != nil else {
+                result(FlutterError(code: "Invalid argument", message: "'clientAreaOnly' needs 'activeWindowOnly' or 'window'", details: nil))
+                return
             }
+            takeScreenshot(activeWindowOnly: activeWindowOnly, window: window.map { CGWindowID($0) }, clientAreaOnly: clientAreaOnly, region: region, monitor: monitor, fileType: fileType, quality: quality, maxWidth: maxWidth ?? 0, maxHeight: maxHeight ?? 0, result: result)
+
+        case "getMonitors":
+            result(WindowFocusPlugin.monitorDisplays().enumerated().map { index, display -> [String: Any] in
+                let bounds = CGDisplayBounds(display.id)
+                return [
+                    "id": index,
+                    "name": display.name,
+                    "x": Int(bounds.origin.x),
+                    "y": Int(bounds.origin.y),
+                    "width": Int(bounds.width),
+                    "height": Int(bounds.height),
+                    "scale": Double(display.scale),
+                    "primary": CGDisplayIsMain(display.id) != 0,
+                ]
+            })
+
+        case "takeMonitorScreenshots":
+            let args = call.arguments as? [String: Any]
+            let format = args?["format"] as? String ?? "png"
+            let quality = args?["quality"] as? Int ?? 90
+            guard let fileType = WindowFocusPlugin.screenshotFormats[format] else {
+                result(FlutterError(code: "Invalid argument", message: "Screenshot format '\(format)' is not supported on macOS", details: nil))
+                return
+            }
+            guard (1...100).contains(quality) else {
+                result(FlutterError(code: "Invalid argument", message: "Expected an integer in [1, 100] for 'quality'", details: nil))
+                return
+            }
+            let maxWidth = args?["maxWidth"] as? Int
+            let maxHeight = args?["maxHeight"] as? Int
+            guard (maxWidth ?? 1) > 0 && (maxHeight ?? 1) > 0 else {
+                result(FlutterError(code: "Invalid argument", message: "Expected a positive integer for 'maxWidth' and 'maxHeight'", details: nil))
+                return
+            }
+            takeMonitorScreenshots(fileType: fileType, quality: quality, maxWidth: maxWidth ?? 0, maxHeight: maxHeight ?? 0, result: result)
+
+        case "getScreenshotFormats":
+            result(["png", "jpeg"])
             
         case "checkScreenRecordingPermission":
             result(checkScreenRecordingPermission())
@@ -187,11 +270,119 @@ public class WindowFocusPlugin: NSObject, FlutterPlugin {
         }
     }
 
-    private func takeScreenshot(activeWindowOnly: Bool, result: @escaping FlutterResult) {
-        let displayID = CGMainDisplayID()
-        var image: CGImage?
+    // Formats takeScreenshot can return, encoded by NSBitmapImageRep.
+    private static let screenshotFormats: [String: NSBitmapImageRep.FileType] = [
+        "png": .png,
+        "jpeg": .jpeg,
+    ]
+
+    // Shrinks |image| to fit in maxWidth x maxHeight (0 for no limit) with its
+    // aspect ratio kept, averaging with Core Graphics' high quality filter.
+    private static func fitScreenshot(_ image: CGImage, maxWidth: Int, maxHeight: Int) -> CGImage {
+        var scale = 1.0
+        if maxWidth > 0 && image.width > maxWidth {
+            scale = min(scale, Double(maxWidth) / Double(image.width))
+        }
+        if maxHeight > 0 && image.height > maxHeight {
+            scale = min(scale, Double(maxHeight) / Double(image.height))
+        }
+        if scale >= 1.0 {
+            return image
+        }
+        let width = max(1, Int((Double(image.width) * scale).rounded()))
+        let height = max(1, Int((Double(image.height) * scale).rounded()))
+        guard let context = CGContext(data: nil, width: width, height: height, bitsPerComponent: 8, bytesPerRow: 0,
+                                      space: CGColorSpaceCreateDeviceRGB(),
+                                      bitmapInfo: CGImageAlphaInfo.noneSkipFirst.rawValue | CGBitmapInfo.byteOrder32Little.rawValue) else {
+            return image
+        }
+        context.interpolationQuality = .high
+        context.draw(image, in: CGRect(x: 0, y: 0, width: width, height: height))
+        return context.makeImage() ?? image
+    }
 
-        if activeWindowOnly {
+    // The displays getMonitors lists, in NSScreen order: the one with the
+    // menu bar first.
+    private static func monitorDisplays() -> [(id: CGDirectDisplayID, name: String, scale: CGFloat)] {
+        return NSScreen.screens.enumerated().compactMap { index, screen in
+            guard let number = screen.deviceDescription[NSDeviceDescriptionKey("NSScreenNumber")] as? NSNumber else {
+                return nil
+            }
+            var name = "Display \(index + 1)"
+            if #available(macOS 10.15, *) {
+                name = screen.localizedName
+            }
+            return (id: CGDirectDisplayID(number.uint32Value), name: name, scale: screen.backingScaleFactor)
+        }
+    }
+
+    // Encodes |image| shrunk to the size limit, or returns nil.
+    private static func encodeScreenshot(_ image: CGImage, fileType: NSBitmapImageRep.FileType, quality: Int, maxWidth: Int, maxHeight: Int) -> Data? {
+        let bitmapRep = NSBitmapImageRep(cgImage: fitScreenshot(image, maxWidth: maxWidth, maxHeight: maxHeight))
+        let properties: [NSBitmapImageRep.PropertyKey: Any] =
+            fileType == .jpeg ? [.compressionFactor: Double(quality) / 100.0] : [:]
+        return bitmapRep.representation(using: fileType, properties: properties)
+    }
+
+    // Captures and encodes every display concurrently, off the main thread,
+    // and answers with the screenshots by monitor id.
+    private func takeMonitorScreenshots(fileType: NSBitmapImageRep.FileType, quality: Int, maxWidth: Int, maxHeight: Int, result: @escaping FlutterResult) {
+        let displays = WindowFocusPlugin.monitorDisplays()
+        DispatchQueue.global(qos: .userInitiated).async {
+            var screenshots = [Data?](repeating: nil, count: displays.count)
+            let lock = NSLock()
+            DispatchQueue.concurrentPerform(iterations: displays.count) { index in
+                guard let image = CGDisplayCreateImage(displays[index].id) else {
+                    return
+                }
+                let data = WindowFocusPlugin.encodeScreenshot(image, fileType: fileType, quality: quality, maxWidth: maxWidth, maxHeight: maxHeight)
+                lock.lock()
+                screenshots[index] = data
+                lock.unlock()
+            }
+            DispatchQueue.main.async {
+                var reply: [Int: FlutterStandardTypedData] = [:]
+                for (index, data) in screenshots.enumerated() {
+                    guard let data = data else {
+                        result(FlutterError(code: "SCREENSHOT_ERROR", message: "Failed to capture monitor \(index)", details: nil))
+                        return
+                    }
+                    reply[index] = FlutterStandardTypedData(bytes: data)
+                }
+                result(reply)
+            }
+        }
+    }
+
+    private func takeScreenshot(activeWindowOnly: Bool, window: CGWindowID?, clientAreaOnly: Bool, region: CGRect?, monitor: Int?, fileType: NSBitmapImageRep.FileType, quality: Int, maxWidth: Int, maxHeight: Int, result: @escaping FlutterResult) {
+        var displayID = CGMainDisplayID()
+        if let monitor = monitor {
+            let displays = WindowFocusPlugin.monitorDisplays()
+            guard monitor < displays.count else {
+                result(FlutterError(code: "SCREENSHOT_ERROR", message: "No monitor \(monitor)", details: nil))
+                return
+            }
+            displayID = displays[monitor].id
+        }
+        var image: CGImage?
+        // Without framing, the window's shadow and title bar are left out.
+        let windowImageOptions: CGWindowImageOption = clientAreaOnly ? [.boundsIgnoreFraming, .bestResolution] : .bestResolution
+
+        if let window = window {
+            // Only that window's pixels are composited, whatever covers it.
+            guard let windowImage = CGWindowListCreateImage(.null, .optionIncludingWindow, window, windowImageOptions) else {
+                result(FlutterError(code: "SCREENSHOT_ERROR", message: "No window \(window)", details: nil))
+                return
+            }
+            image = windowImage
+        } else if let region = region {
+            // In global display coordinates, like getMonitors.
+            guard let regionImage = CGWindowListCreateImage(region, .optionOnScreenOnly, kCGNullWindowID, .bestResolution) else {
+                result(FlutterError(code: "SCREENSHOT_ERROR", message: "Failed to capture region", details: nil))
+                return
+            }
+            image = regionImage
+        } else if activeWindowOnly {
             let activeApp = NSWorkspace.shared.frontmostApplication
             let activePID = activeApp?.processIdentifier
             let activeName = activeApp?.localizedName ?? "Unknown"
@@ -210,7 +401,7 @@ public class WindowFocusPlugin: NSObject, FlutterPlugin {
                             print("[WindowFocus] Potential window: \(windowName), ID: \(windowID), Layer: \(windowLayer), Bounds: \(windowBounds)")
                             
                             if windowLayer == 0 {
-                                image = CGWindowListCreateImage(.null, .optionIncludingWindow, windowID, .bestResolution)
+                                image = CGWindowListCreateImage(.null, .optionIncludingWindow, windowID, windowImageOptions)
                                 if image != nil {
                                     print("[WindowFocus] Successfully captured active app window ID: \(windowID)")
                                     break
@@ -229,7 +420,7 @@ public class WindowFocusPlugin: NSObject, FlutterPlugin {
                         if windowLayer == 0 {
                             if let windowID = info[kCGWindowNumber as String] as? CGWindowID {
                                 print("[WindowFocus] Capturing top-most window ID: \(windowID)")
-                                image = CGWindowListCreateImage(.null, .optionIncludingWindow, windowID, .bestResolution)
+                                image = CGWindowListCreateImage(.null, .optionIncludingWindow, windowID, windowImageOptions)
                                 if image != nil { break }
                             }
                         }
@@ -248,9 +439,8 @@ public class WindowFocusPlugin: NSObject, FlutterPlugin {
             return
         }
 
-        let bitmapRep = NSBitmapImageRep(cgImage: cgImage)
-        guard let imageData = bitmapRep.representation(using: .png, properties: [:]) else {
-            result(FlutterError(code: "CONVERSION_ERROR", message: "Failed to convert image to PNG", details: nil))
+        guard let imageData = WindowFocusPlugin.encodeScreenshot(cgImage, fileType: fileType, quality: quality, maxWidth: maxWidth, maxHeight: maxHeight) else {
+            result(FlutterError(code: "CONVERSION_ERROR", message: "Failed to encode screenshot", details: nil))
             return
         }
 
@@ -261,9 +451,9 @@ public class WindowFocusPlugin: NSObject, FlutterPlugin {
 class WindowFocusObserver {
     private var focusedAppPID: pid_t = -1
     internal var focusedWindowID: CGWindowID = 0
-    private let sendMessage: (String, String) -> Void
+    private let sendMessage: (String, String, CGWindowID) -> Void
 
-    init(sendMessage: @escaping (String, String) -> Void) {
+    init(sendMessage: @escaping (String, String, CGWindowID) -> Void) {
         self.sendMessage = sendMessage
 
         NSWorkspace.shared.notificationCenter.addObserver(self, selector: #selector(focusedAppChanged(_:)), name: NSWorkspace.didActivateApplicationNotification, object: nil)
@@ -288,8 +478,8 @@ class WindowFocusObserver {
             let windowTitle = getActiveWindowTitle(for: pid)
             lastWindowTitle = windowTitle
             
-            sendMessage(appName, windowTitle)
             updateFocusedWindowID()
+            sendMessage(appName, windowTitle, focusedWindowID)
         }
     }
 
@@ -299,7 +489,8 @@ class WindowFocusObserver {
         let currentTitle = getActiveWindowTitle(for: focusedAppPID)
         if currentTitle != lastWindowTitle {
             lastWindowTitle = currentTitle
-            sendMessage(lastAppName, currentTitle)
+            updateFocusedWindowID()
+            sendMessage(lastAppName, currentTitle, focusedWindowID)
         }
     }
 
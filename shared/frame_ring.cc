@@ -0,0 +1,64 @@
+#include "frame_ring.h"
+
+#include <algorithm>
+
+namespace window_focus {
+
+FrameRing::FrameRing(size_t max_frames, size_t max_bytes)
+    : capacity_(max_bytes),
+      buffer_(new uint8_t[max_bytes]),
+      slots_(std::max<size_t>(max_frames, 1)) {}
+
+uint8_t* FrameRing::Reserve(size_t size) {
+  if (size > capacity_) {
+    return nullptr;
+  }
+  size_t offset = write_offset_;
+  if (offset + size > capacity_) {
+    // Frames past the newest one were written before the last wrap and are
+    // older than everything at the start of the buffer.
+    while (count_ > 0 && slot(count_ - 1).offset >= write_offset_) {
+      EvictOldest();
+    }
+    offset = 0;
+  }
+  // What follows the write position is stored oldest first.
+  while (count_ > 0 && slot(count_ - 1).offset < offset + size &&
+         offset < slot(count_ - 1).offset + slot(count_ - 1).frame.size) {
+    EvictOldest();
+  }
+  if (count_ == slots_.size()) {
+    EvictOldest();
+  }
+  reserved_offset_ = offset;
+  reserved_size_ = size;
+  return buffer_.get() + offset;
+}
+
+void FrameRing::Commit(const Frame& frame) {
+  Slot& slot = slots_[(first_ + count_) % slots_.size()];
+  slot.frame = frame;
+  slot.frame.size = reserved_size_;
+  slot.offset = reserved_offset_;
+  count_++;
+  write_offset_ = reserved_offset_ + reserved_size_;
+}
+
+const FrameRing::Frame& FrameRing::frame(size_t index) const {
+  return slot(index).frame;
+}
+
+const uint8_t* FrameRing::data(size_t index) const {
+  return buffer_.get() + slot(index).offset;
+}
+
+const FrameRing::Slot& FrameRing::slot(size_t index) const {
+  return slots_[(first_ + count_ - 1 - index) % slots_.size()];
+}
+
+void FrameRing::EvictOldest() {
+  first_ = (first_ + 1) % slots_.size();
+  count_--;
+}
+
+}  // namespace window_focus
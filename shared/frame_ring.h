@@ -0,0 +1,78 @@
+#ifndef FLUTTER_PLUGIN_WINDOW_FOCUS_FRAME_RING_H_
+#define FLUTTER_PLUGIN_WINDOW_FOCUS_FRAME_RING_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace window_focus {
+
+// Frames takeScreenshot's ring keeps when not told otherwise.
+constexpr int kDefaultRingFrames = 10;
+// Memory the ring's frames may use when not told otherwise.
+constexpr size_t kDefaultRingBytes = 64 << 20;
+
+// The last few frames, stored back to back in one buffer allocated up front.
+//
+// A new frame evicts the oldest ones until it fits after the newest, wrapping
+// to the start of the buffer when it does not fit before the end, and until
+// there are fewer than |max_frames|. Memory therefore never exceeds
+// |max_bytes| however well the frames compress.
+//
+// Not thread-safe.
+class FrameRing {
+ public:
+  struct Frame {
+    int64_t timestamp_ms = 0;
+    int width = 0;
+    int height = 0;
+    size_t size = 0;
+  };
+
+  FrameRing(size_t max_frames, size_t max_bytes);
+
+  FrameRing(const FrameRing&) = delete;
+  FrameRing& operator=(const FrameRing&) = delete;
+
+  // Evicts frames until |size| bytes fit and returns where to write them,
+  // or null when |size| is larger than the whole buffer. The bytes become
+  // the newest frame with Commit; until then no stored frame uses them.
+  uint8_t* Reserve(size_t size);
+  // Stores the last reserved bytes as a frame described by |frame|.
+  void Commit(const Frame& frame);
+
+  // Number of frames stored.
+  size_t size() const { return count_; }
+  // |index| 0 is the newest frame.
+  const Frame& frame(size_t index) const;
+  const uint8_t* data(size_t index) const;
+
+  size_t max_frames() const { return slots_.size(); }
+  size_t max_bytes() const { return capacity_; }
+
+ private:
+  struct Slot {
+    Frame frame;
+    size_t offset = 0;
+  };
+
+  const Slot& slot(size_t index) const;
+  void EvictOldest();
+
+  const size_t capacity_;
+  // Not value-initialized, so pages are only committed once written.
+  std::unique_ptr<uint8_t[]> buffer_;
+  std::vector<Slot> slots_;
+  // Index in |slots_| of the oldest frame.
+  size_t first_ = 0;
+  size_t count_ = 0;
+  // End of the newest frame.
+  size_t write_offset_ = 0;
+  size_t reserved_offset_ = 0;
+  size_t reserved_size_ = 0;
+};
+
+}  // namespace window_focus
+
+#endif  // FLUTTER_PLUGIN_WINDOW_FOCUS_FRAME_RING_H_
@@ -0,0 +1,316 @@
+#include "image_scaler.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "simd.h"
+
+namespace window_focus {
+
+namespace {
+
+// Weights are fixed point and sum to exactly 1 << kWeightBits per output
+// pixel, which keeps them in 16-bit lanes.
+constexpr int kWeightBits = 14;
+// Fraction bits kept in the 16-bit results of the vertical pass: a channel
+// is at most 255 << 7, which still fits a signed 16-bit lane.
+constexpr int kColumnBits = 7;
+constexpr int kVerticalShift = kWeightBits - kColumnBits;
+constexpr int kHorizontalShift = kWeightBits + kColumnBits;
+constexpr uint32_t kOpaque = 0xFF000000;
+
+// The source pixels each output pixel along one axis averages. Tap counts
+// are rounded up to even with a zero weight, so the SSE2 kernels can always
+// take two taps at a time; the extra tap may lie one past the source.
+struct AreaFilter {
+  std::vector<int> first;
+  std::vector<int> count;
+  // Offset of each output pixel's weights in |weights|.
+  std::vector<size_t> offset;
+  std::vector<int16_t> weights;
+};
+
+// Output pixel |o| covers source coordinates [o * src / dst, (o + 1) * src /
+// dst). Everything is scaled by |dst| to stay in integers.
+AreaFilter MakeAreaFilter(int src, int dst) {
+  AreaFilter filter;
+  filter.first.resize(dst);
+  filter.count.resize(dst);
+  filter.offset.resize(dst);
+  for (int o = 0; o < dst; o++) {
+    const int64_t begin = static_cast<int64_t>(o) * src;
+    const int64_t end = begin + src;
+    const int first = static_cast<int>(begin / dst);
+    const int last = static_cast<int>((end - 1) / dst);
+    filter.first[o] = first;
+    filter.offset[o] = filter.weights.size();
+
+    int sum = 0;
+    size_t largest = filter.weights.size();
+    int largest_weight = -1;
+    for (int i = first; i <= last; i++) {
+      const int64_t overlap = std::min<int64_t>(end, (i + 1) * int64_t{dst}) -
+                              std::max<int64_t>(begin, i * int64_t{dst});
+      const int weight = static_cast<int>(
+          ((overlap << kWeightBits) + src / 2) / src);
+      if (weight > largest_weight) {
+        largest = filter.weights.size();
+        largest_weight = weight;
+      }
+      filter.weights.push_back(static_cast<int16_t>(weight));
+      sum += weight;
+    }
+    // Rounding can leave the sum a little off, which would tint flat areas.
+    filter.weights[largest] =
+        static_cast<int16_t>(filter.weights[largest] + (1 << kWeightBits) - sum);
+    if ((last - first + 1) % 2 != 0) {
+      filter.weights.push_back(0);
+    }
+    filter.count[o] =
+        static_cast<int>(filter.weights.size() - filter.offset[o]);
+  }
+  return filter;
+}
+
+#if defined(WINDOW_FOCUS_SSE2)
+// Two consecutive weights in the 16-bit halves of every 32-bit lane, as
+// _mm_madd_epi16 wants them next to the interleaved values of two taps.
+__m128i WeightPair(const int16_t* weights) {
+  int32_t pair;
+  memcpy(&pair, weights, sizeof(pair));
+  return _mm_set1_epi32(pair);
+}
+#endif
+
+// Weighted sum of |count| rows into 16-bit values with kColumnBits fraction
+// bits, |bytes| bytes per row.
+void FilterColumns(const uint8_t* const* rows,
+                   const int16_t* weights,
+                   int count,
+                   size_t bytes,
+                   uint16_t* out) {
+  size_t i = 0;
+#if defined(WINDOW_FOCUS_SSE2)
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i round = _mm_set1_epi32(1 << (kVerticalShift - 1));
+  for (; i + 16 <= bytes; i += 16) {
+    __m128i sums[4] = {zero, zero, zero, zero};
+    for (int t = 0; t < count; t += 2) {
+      const __m128i a =
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[t] + i));
+      // The padding tap is zero either way; skip loading it.
+      const __m128i b =
+          weights[t + 1] == 0
+              ? zero
+              : _mm_loadu_si128(
+                    reinterpret_cast<const __m128i*>(rows[t + 1] + i));
+      const __m128i w = WeightPair(weights + t);
+      // Bytes of the two rows interleaved, then widened.
+      const __m128i low = _mm_unpacklo_epi8(a, b);
+      const __m128i high = _mm_unpackhi_epi8(a, b);
+      sums[0] = _mm_add_epi32(
+          sums[0], _mm_madd_epi16(_mm_unpacklo_epi8(low, zero), w));
+      sums[1] = _mm_add_epi32(
+          sums[1], _mm_madd_epi16(_mm_unpackhi_epi8(low, zero), w));
+      sums[2] = _mm_add_epi32(
+          sums[2], _mm_madd_epi16(_mm_unpacklo_epi8(high, zero), w));
+      sums[3] = _mm_add_epi32(
+          sums[3], _mm_madd_epi16(_mm_unpackhi_epi8(high, zero), w));
+    }
+    for (int k = 0; k < 4; k++) {
+      sums[k] = _mm_srli_epi32(_mm_add_epi32(sums[k], round), kVerticalShift);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+                     _mm_packs_epi32(sums[0], sums[1]));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 8),
+                     _mm_packs_epi32(sums[2], sums[3]));
+  }
+#elif defined(WINDOW_FOCUS_NEON)
+  for (; i + 16 <= bytes; i += 16) {
+    uint32x4_t sums[4] = {vdupq_n_u32(0), vdupq_n_u32(0), vdupq_n_u32(0),
+                          vdupq_n_u32(0)};
+    for (int t = 0; t < count; t++) {
+      const uint8x16_t v = vld1q_u8(rows[t] + i);
+      const uint16x8_t low = vmovl_u8(vget_low_u8(v));
+      const uint16x8_t high = vmovl_u8(vget_high_u8(v));
+      const uint16_t w = static_cast<uint16_t>(weights[t]);
+      sums[0] = vmlal_n_u16(sums[0], vget_low_u16(low), w);
+      sums[1] = vmlal_n_u16(sums[1], vget_high_u16(low), w);
+      sums[2] = vmlal_n_u16(sums[2], vget_low_u16(high), w);
+      sums[3] = vmlal_n_u16(sums[3], vget_high_u16(high), w);
+    }
+    vst1q_u16(out + i, vcombine_u16(vrshrn_n_u32(sums[0], kVerticalShift),
+                                    vrshrn_n_u32(sums[1], kVerticalShift)));
+    vst1q_u16(out + i + 8,
+              vcombine_u16(vrshrn_n_u32(sums[2], kVerticalShift),
+                           vrshrn_n_u32(sums[3], kVerticalShift)));
+  }
+#endif
+  for (; i < bytes; i++) {
+    uint32_t sum = 0;
+    for (int t = 0; t < count; t++) {
+      sum += static_cast<uint32_t>(rows[t][i]) *
+             static_cast<uint32_t>(weights[t]);
+    }
+    out[i] = static_cast<uint16_t>((sum + (1 << (kVerticalShift - 1))) >>
+                                   kVerticalShift);
+  }
+}
+
+// Averages one output pixel's columns into four 32-bit channels, still
+// scaled by 1 << kHorizontalShift.
+#if defined(WINDOW_FOCUS_SSE2)
+__m128i SumPixel(const uint16_t* pixels, const int16_t* weights, int count) {
+  __m128i sum = _mm_setzero_si128();
+  for (int t = 0; t < count; t += 2) {
+    const __m128i a =
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(pixels + 4 * t));
+    const __m128i b =
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(pixels + 4 * t + 4));
+    sum = _mm_add_epi32(
+        sum, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), WeightPair(weights + t)));
+  }
+  return _mm_srli_epi32(
+      _mm_add_epi32(sum, _mm_set1_epi32(1 << (kHorizontalShift - 1))),
+      kHorizontalShift);
+}
+#endif
+
+// Averages the filtered columns along the row into |filter.first.size()|
+// output pixels, swapping red and blue when |swap|. |columns| has room for
+// one pixel past the row.
+void FilterRow(const uint16_t* columns,
+               const AreaFilter& filter,
+               bool swap,
+               uint8_t* dst) {
+  const int width = static_cast<int>(filter.first.size());
+  int o = 0;
+#if defined(WINDOW_FOCUS_SSE2)
+  const __m128i opaque = _mm_set1_epi32(static_cast<int>(kOpaque));
+  const __m128i green = _mm_set1_epi32(0x0000FF00);
+  const __m128i low = _mm_set1_epi32(0x000000FF);
+  for (; o + 4 <= width; o += 4) {
+    __m128i sums[4];
+    for (int k = 0; k < 4; k++) {
+      sums[k] = SumPixel(columns + 4 * static_cast<size_t>(filter.first[o + k]),
+                         filter.weights.data() + filter.offset[o + k],
+                         filter.count[o + k]);
+    }
+    __m128i v = _mm_packus_epi16(_mm_packs_epi32(sums[0], sums[1]),
+                                 _mm_packs_epi32(sums[2], sums[3]));
+    if (swap) {
+      // As in ConvertBgrxPixels.
+      v = _mm_or_si128(
+          _mm_and_si128(v, green),
+          _mm_or_si128(_mm_and_si128(_mm_srli_epi32(v, 16), low),
+                       _mm_slli_epi32(_mm_and_si128(v, low), 16)));
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4 * static_cast<size_t>(o)),
+                     _mm_or_si128(v, opaque));
+  }
+#endif
+  for (; o < width; o++) {
+    const uint16_t* pixels = columns + 4 * static_cast<size_t>(filter.first[o]);
+    const int16_t* weights = filter.weights.data() + filter.offset[o];
+    const int count = filter.count[o];
+    uint32_t pixel;
+#if defined(WINDOW_FOCUS_SSE2)
+    const __m128i words = _mm_packs_epi32(SumPixel(pixels, weights, count),
+                                          _mm_setzero_si128());
+    pixel = static_cast<uint32_t>(
+        _mm_cvtsi128_si32(_mm_packus_epi16(words, words)));
+#elif defined(WINDOW_FOCUS_NEON)
+    uint32x4_t sum = vdupq_n_u32(0);
+    for (int t = 0; t < count; t++) {
+      sum = vmlal_n_u16(sum, vld1_u16(pixels + 4 * t),
+                        static_cast<uint16_t>(weights[t]));
+    }
+    const uint16x4_t words = vmovn_u32(vrshrq_n_u32(sum, kHorizontalShift));
+    pixel = vget_lane_u32(
+        vreinterpret_u32_u8(vmovn_u16(vcombine_u16(words, words))), 0);
+#else
+    uint8_t bytes[4];
+    for (int c = 0; c < 4; c++) {
+      uint32_t sum = 0;
+      for (int t = 0; t < count; t++) {
+        sum += static_cast<uint32_t>(pixels[4 * t + c]) *
+               static_cast<uint32_t>(weights[t]);
+      }
+      bytes[c] = static_cast<uint8_t>((sum + (1 << (kHorizontalShift - 1))) >>
+                                      kHorizontalShift);
+    }
+    memcpy(&pixel, bytes, sizeof(pixel));
+#endif
+    if (swap) {
+      pixel = (pixel & 0x0000FF00) | (pixel >> 16 & 0xFF) |
+              (pixel & 0xFF) << 16;
+    }
+    pixel |= kOpaque;
+    memcpy(dst + 4 * static_cast<size_t>(o), &pixel, sizeof(pixel));
+  }
+}
+
+}  // namespace
+
+bool FitImageSize(int width,
+                  int height,
+                  int max_width,
+                  int max_height,
+                  int* fitted_width,
+                  int* fitted_height) {
+  *fitted_width = width;
+  *fitted_height = height;
+  const bool too_wide = max_width > 0 && width > max_width;
+  const bool too_tall = max_height > 0 && height > max_height;
+  if (!too_wide && !too_tall) {
+    return false;
+  }
+  // Whichever limit shrinks the image more decides the scale.
+  if (too_wide && (!too_tall || static_cast<int64_t>(max_width) * height <=
+                                    static_cast<int64_t>(max_height) * width)) {
+    *fitted_width = max_width;
+    *fitted_height = static_cast<int>(
+        (static_cast<int64_t>(height) * max_width + width / 2) / width);
+  } else {
+    *fitted_height = max_height;
+    *fitted_width = static_cast<int>(
+        (static_cast<int64_t>(width) * max_height + height / 2) / height);
+  }
+  *fitted_width = std::max(*fitted_width, 1);
+  *fitted_height = std::max(*fitted_height, 1);
+  return true;
+}
+
+void DownscaleBgrxPixels(const uint8_t* src,
+                         int src_width,
+                         int src_height,
+                         int src_stride,
+                         uint8_t* dst,
+                         int dst_width,
+                         int dst_height,
+                         int dst_stride,
+                         PixelFormat format) {
+  const AreaFilter horizontal = MakeAreaFilter(src_width, dst_width);
+  const AreaFilter vertical = MakeAreaFilter(src_height, dst_height);
+  const size_t row_bytes = static_cast<size_t>(src_width) * 4;
+  // One spare pixel for the zero-weight tap past the last column.
+  std::vector<uint16_t> columns(row_bytes + 4, 0);
+  std::vector<const uint8_t*> rows;
+  const bool swap = format == PixelFormat::kRgba;
+  // Each output row reads its source rows once, while they are in cache.
+  for (int y = 0; y < dst_height; y++) {
+    rows.clear();
+    for (int t = 0; t < vertical.count[y]; t++) {
+      // The zero-weight tap may lie past the last row.
+      const int row = std::min(vertical.first[y] + t, src_height - 1);
+      rows.push_back(src + static_cast<size_t>(row) * src_stride);
+    }
+    FilterColumns(rows.data(), vertical.weights.data() + vertical.offset[y],
+                  vertical.count[y], row_bytes, columns.data());
+    FilterRow(columns.data(), horizontal, swap,
+              dst + static_cast<size_t>(y) * dst_stride);
+  }
+}
+
+}  // namespace window_focus
@@ -0,0 +1,38 @@
+#ifndef FLUTTER_PLUGIN_WINDOW_FOCUS_IMAGE_SCALER_H_
+#define FLUTTER_PLUGIN_WINDOW_FOCUS_IMAGE_SCALER_H_
+
+#include <cstdint>
+
+#include "pixel_format.h"
+
+namespace window_focus {
+
+// Size of a |width| x |height| image shrunk to fit in |max_width| x
+// |max_height| with its aspect ratio kept, each side at least one pixel. A
+// limit of 0 or less means no limit. Images are never enlarged; returns
+// false when the image already fits.
+bool FitImageSize(int width,
+                  int height,
+                  int max_width,
+                  int max_height,
+                  int* fitted_width,
+                  int* fitted_height);
+
+// Shrinks BGRX pixels to |dst_width| x |dst_height| (no larger than the
+// source) by area averaging: every output pixel is the mean of the source
+// area it covers, with partly covered pixels weighted by their coverage.
+// The result is written as opaque |format| pixels in the same pass. Uses
+// SSE2 or NEON; every path gives the same bytes.
+void DownscaleBgrxPixels(const uint8_t* src,
+                         int src_width,
+                         int src_height,
+                         int src_stride,
+                         uint8_t* dst,
+                         int dst_width,
+                         int dst_height,
+                         int dst_stride,
+                         PixelFormat format);
+
+}  // namespace window_focus
+
+#endif  // FLUTTER_PLUGIN_WINDOW_FOCUS_IMAGE_SCALER_H_
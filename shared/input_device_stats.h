@@ -0,0 +1,47 @@
+#ifndef FLUTTER_PLUGIN_WINDOW_FOCUS_INPUT_DEVICE_STATS_H_
+#define FLUTTER_PLUGIN_WINDOW_FOCUS_INPUT_DEVICE_STATS_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace window_focus {
+
+// A monitored device as reported to device change callbacks and by the
+// Linux backends' GetDevices().
+struct InputDeviceInfo {
+  std::string path;
+  std::string name;
+  uint16_t vendor_id = 0;
+  uint16_t product_id = 0;
+  uint16_t usage_page = 0;
+  uint16_t usage = 0;
+  // Activity counters, only filled in by GetDevices().
+  int64_t last_activity_ms = 0;
+  uint64_t event_count = 0;
+};
+
+// Activity counters of one monitored input device, reported by
+// getInputDevices. Backends update them on their monitoring threads with
+// relaxed atomics; readers only need each value to be untorn, not ordered
+// with anything else.
+struct InputDeviceStats {
+  // Wall clock time of the last input in milliseconds since the Unix epoch,
+  // 0 before the first one.
+  std::atomic<int64_t> last_activity_ms{0};
+  std::atomic<uint64_t> event_count{0};
+
+  void RecordInput() {
+    const int64_t now_ms =
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch())
+            .count();
+    event_count.fetch_add(1, std::memory_order_relaxed);
+    last_activity_ms.store(now_ms, std::memory_order_relaxed);
+  }
+};
+
+}  // namespace window_focus
+
+#endif  // FLUTTER_PLUGIN_WINDOW_FOCUS_INPUT_DEVICE_STATS_H_
@@ -0,0 +1,158 @@
+#include "pixel_format.h"
+
+#include <cstring>
+
+#include "simd.h"
+
+#if defined(WINDOW_FOCUS_SSE2) && defined(__GNUC__)
+#include <immintrin.h>
+// AVX2 is not part of the x86-64 baseline; it is picked at run time where
+// the compiler can target single functions at it.
+#define WINDOW_FOCUS_PIXEL_AVX2 1
+#endif
+
+namespace window_focus {
+
+namespace {
+
+constexpr uint32_t kOpaque = 0xFF000000;
+
+// Pixels are handled as little-endian words: blue in bits 0-7, red in bits
+// 16-23.
+void ConvertScalar(const uint8_t* src,
+                   uint8_t* dst,
+                   size_t count,
+                   bool swap) {
+  for (size_t i = 0; i < count; i++) {
+    uint32_t pixel;
+    memcpy(&pixel, src + 4 * i, sizeof(pixel));
+    if (swap) {
+      pixel = (pixel & 0x0000FF00) | (pixel >> 16 & 0xFF) |
+              (pixel & 0xFF) << 16;
+    }
+    pixel |= kOpaque;
+    memcpy(dst + 4 * i, &pixel, sizeof(pixel));
+  }
+}
+
+#if defined(WINDOW_FOCUS_SSE2)
+void ConvertSse(const uint8_t* src, uint8_t* dst, size_t count, bool swap) {
+  const __m128i opaque = _mm_set1_epi32(static_cast<int>(kOpaque));
+  const __m128i green = _mm_set1_epi32(0x0000FF00);
+  const __m128i low = _mm_set1_epi32(0x000000FF);
+  size_t i = 0;
+  if (swap) {
+    // SSE2 has no byte shuffle; red and blue trade places with shifts.
+    for (; i + 4 <= count; i += 4) {
+      const __m128i v =
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 4 * i));
+      const __m128i swapped = _mm_or_si128(
+          _mm_and_si128(v, green),
+          _mm_or_si128(_mm_and_si128(_mm_srli_epi32(v, 16), low),
+                       _mm_slli_epi32(_mm_and_si128(v, low), 16)));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4 * i),
+                       _mm_or_si128(swapped, opaque));
+    }
+  } else {
+    for (; i + 4 <= count; i += 4) {
+      const __m128i v =
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 4 * i));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4 * i),
+                       _mm_or_si128(v, opaque));
+    }
+  }
+  ConvertScalar(src + 4 * i, dst + 4 * i, count - i, swap);
+}
+#endif
+
+#if defined(WINDOW_FOCUS_PIXEL_AVX2)
+__attribute__((target("avx2"))) void ConvertAvx2(const uint8_t* src,
+                                                 uint8_t* dst,
+                                                 size_t count,
+                                                 bool swap) {
+  const __m256i opaque = _mm256_set1_epi32(static_cast<int>(kOpaque));
+  // Per 128-bit lane: bytes 2, 1, 0, 3 of each pixel, or unchanged.
+  const __m256i order =
+      swap ? _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13,
+                              12, 15, 2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11,
+                              14, 13, 12, 15)
+           : _mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13,
+                              14, 15, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11,
+                              12, 13, 14, 15);
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    const __m256i a =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 4 * i));
+    const __m256i b =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 4 * i + 32));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 4 * i),
+                        _mm256_or_si256(_mm256_shuffle_epi8(a, order), opaque));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 4 * i + 32),
+                        _mm256_or_si256(_mm256_shuffle_epi8(b, order), opaque));
+  }
+  ConvertSse(src + 4 * i, dst + 4 * i, count - i, swap);
+}
+#endif
+
+#if defined(WINDOW_FOCUS_NEON)
+void ConvertNeon(const uint8_t* src, uint8_t* dst, size_t count, bool swap) {
+  const uint8x16_t opaque = vdupq_n_u8(0xFF);
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    uint8x16x4_t v = vld4q_u8(src + 4 * i);
+    if (swap) {
+      const uint8x16_t blue = v.val[0];
+      v.val[0] = v.val[2];
+      v.val[2] = blue;
+    }
+    v.val[3] = opaque;
+    vst4q_u8(dst + 4 * i, v);
+  }
+  ConvertScalar(src + 4 * i, dst + 4 * i, count - i, swap);
+}
+#endif
+
+using ConvertFunction = void (*)(const uint8_t*, uint8_t*, size_t, bool);
+
+ConvertFunction SelectConvert() {
+#if defined(WINDOW_FOCUS_PIXEL_AVX2)
+  if (__builtin_cpu_supports("avx2")) {
+    return ConvertAvx2;
+  }
+#endif
+#if defined(WINDOW_FOCUS_SSE2)
+  return ConvertSse;
+#elif defined(WINDOW_FOCUS_NEON)
+  return ConvertNeon;
+#else
+  return ConvertScalar;
+#endif
+}
+
+}  // namespace
+
+const char* PixelFormatName(PixelFormat format) {
+  return format == PixelFormat::kRgba ? "rgba" : "bgra";
+}
+
+bool ParsePixelFormat(const char* name, PixelFormat* format) {
+  if (strcmp(name, "bgra") == 0) {
+    *format = PixelFormat::kBgra;
+    return true;
+  }
+  if (strcmp(name, "rgba") == 0) {
+    *format = PixelFormat::kRgba;
+    return true;
+  }
+  return false;
+}
+
+void ConvertBgrxPixels(const uint8_t* src,
+                       uint8_t* dst,
+                       size_t count,
+                       PixelFormat format) {
+  static const ConvertFunction convert = SelectConvert();
+  convert(src, dst, count, format == PixelFormat::kRgba);
+}
+
+}  // namespace window_focus
@@ -0,0 +1,30 @@
+#ifndef FLUTTER_PLUGIN_WINDOW_FOCUS_PIXEL_FORMAT_H_
+#define FLUTTER_PLUGIN_WINDOW_FOCUS_PIXEL_FORMAT_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace window_focus {
+
+// Byte order of opaque 32-bit pixels handed to Dart.
+enum class PixelFormat {
+  kBgra,
+  kRgba,
+};
+
+// "bgra" or "rgba", as used on the method channel.
+const char* PixelFormatName(PixelFormat format);
+// Returns false for names other than those above.
+bool ParsePixelFormat(const char* name, PixelFormat* format);
+
+// Converts |count| BGRX pixels, whose fourth byte is padding, to opaque
+// |format| pixels. |src| and |dst| may be the same buffer. Uses SSE2, AVX2
+// when the CPU has it, or NEON.
+void ConvertBgrxPixels(const uint8_t* src,
+                       uint8_t* dst,
+                       size_t count,
+                       PixelFormat format);
+
+}  // namespace window_focus
+
+#endif  // FLUTTER_PLUGIN_WINDOW_FOCUS_PIXEL_FORMAT_H_
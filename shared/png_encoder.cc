@@ -0,0 +1,643 @@
+#include "png_encoder.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "simd.h"
+
+namespace window_focus {
+
+namespace {
+
+constexpr int kBytesPerPixel = 4;
+
+// Large captures are deflated pigz-style: the image is cut into strips of
+// rows that are filtered and compressed independently on several threads,
+// each strip's deflate stream primed with the last 32 KiB of the strip
+// before it so matches still reach across the seam. Strips end on a byte
+// boundary (Z_SYNC_FLUSH) and are concatenated into one zlib stream whose
+// Adler-32 is combined from theirs. Strip boundaries depend only on the
+// image size, so the file is the same whatever the number of threads.
+
+// Screen content is mostly flat areas and repeated glyphs, which level 3
+// compresses within a few percent of level 6 in half the time.
+constexpr int kPngCompressionLevel = 3;
+// Filtered bytes per strip. Smaller strips spread better over threads but
+// lose a little compression at every seam.
+constexpr size_t kPngStripBytes = 512 * 1024;
+// Deflate's window, and so the most a dictionary can help.
+constexpr size_t kDeflateWindow = 32 * 1024;
+// Zero bytes before each row buffer, so the left neighbours of the first
+// pixel read as zero as the filters require.
+constexpr size_t kPngRowPadding = 16;
+
+enum PngFilter : uint8_t {
+  kPngFilterNone = 0,
+  kPngFilterSub = 1,
+  kPngFilterUp = 2,
+  kPngFilterAverage = 3,
+  kPngFilterPaeth = 4,
+};
+constexpr int kPngFilterCount = 5;
+
+void AppendBigEndian(uint32_t value, std::vector<uint8_t>* output) {
+  output->push_back(static_cast<uint8_t>(value >> 24));
+  output->push_back(static_cast<uint8_t>(value >> 16));
+  output->push_back(static_cast<uint8_t>(value >> 8));
+  output->push_back(static_cast<uint8_t>(value));
+}
+
+void WriteBigEndian(uint32_t value, uint8_t* out) {
+  out[0] = static_cast<uint8_t>(value >> 24);
+  out[1] = static_cast<uint8_t>(value >> 16);
+  out[2] = static_cast<uint8_t>(value >> 8);
+  out[3] = static_cast<uint8_t>(value);
+}
+
+// Appends a chunk whose data has already been written after an 8 byte
+// placeholder at |start|, filling in its length and appending its CRC.
+void FinishPngChunk(size_t start, std::vector<uint8_t>* output) {
+  uint8_t* chunk = output->data() + start;
+  const size_t length = output->size() - start - 8;
+  WriteBigEndian(static_cast<uint32_t>(length), chunk);
+  const uLong crc = crc32(crc32(0, nullptr, 0), chunk + 4,
+                          static_cast<uInt>(length + 4));
+  AppendBigEndian(static_cast<uint32_t>(crc), output);
+}
+
+size_t BeginPngChunk(const char* type, std::vector<uint8_t>* output) {
+  const size_t start = output->size();
+  output->insert(output->end(), 4, 0);
+  output->insert(output->end(), type, type + 4);
+  return start;
+}
+
+// The filter kernels take a row |x| and the row above |b|, both preceded by
+// at least three readable bytes (zeros for the first pixel), write the
+// filtered row to |out| and return its cost: the sum of the filtered bytes
+// read as signed values, the usual estimate of how well a row compresses.
+// The Paeth predictor picks whichever of left (a), above (b) and upper left
+// (c) is closest to a + b - c.
+
+inline uint8_t PaethPredictor(int a, int b, int c) {
+  const int pa = std::abs(b - c);
+  const int pb = std::abs(a - c);
+  const int pc = std::abs(a + b - 2 * c);
+  if (pa <= pb && pa <= pc) {
+    return static_cast<uint8_t>(a);
+  }
+  return static_cast<uint8_t>(pb <= pc ? b : c);
+}
+
+inline uint32_t SignedMagnitude(uint8_t value) {
+  return static_cast<uint32_t>(std::abs(static_cast<int8_t>(value)));
+}
+
+#if defined(WINDOW_FOCUS_SSE2)
+// |v| of each byte read as signed, summed into the two 64-bit lanes.
+inline __m128i SumSignedMagnitudes(__m128i v, __m128i sum) {
+  const __m128i magnitude =
+      _mm_min_epu8(v, _mm_sub_epi8(_mm_setzero_si128(), v));
+  return _mm_add_epi64(sum, _mm_sad_epu8(magnitude, _mm_setzero_si128()));
+}
+
+inline uint32_t HorizontalSum(__m128i sum) {
+  return static_cast<uint32_t>(_mm_cvtsi128_si32(sum) +
+                               _mm_cvtsi128_si32(_mm_srli_si128(sum, 8)));
+}
+
+inline __m128i Abs16(__m128i v) {
+  return _mm_max_epi16(v, _mm_sub_epi16(_mm_setzero_si128(), v));
+}
+
+// Paeth predictions for eight pixels' bytes widened to 16 bits.
+inline __m128i PaethPredict16(__m128i a, __m128i b, __m128i c) {
+  const __m128i pa = Abs16(_mm_sub_epi16(b, c));
+  const __m128i pb = Abs16(_mm_sub_epi16(a, c));
+  const __m128i pc = Abs16(_mm_sub_epi16(_mm_add_epi16(a, b),
+                                         _mm_add_epi16(c, c)));
+  const __m128i not_a =
+      _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+  const __m128i not_b = _mm_cmpgt_epi16(pb, pc);
+  const __m128i b_or_c =
+      _mm_or_si128(_mm_andnot_si128(not_b, b), _mm_and_si128(not_b, c));
+  return _mm_or_si128(_mm_andnot_si128(not_a, a),
+                      _mm_and_si128(not_a, b_or_c));
+}
+#elif defined(WINDOW_FOCUS_NEON)
+inline uint32x4_t SumSignedMagnitudes(uint8x16_t v, uint32x4_t sum) {
+  const uint8x16_t magnitude =
+      vreinterpretq_u8_s8(vabsq_s8(vreinterpretq_s8_u8(v)));
+  return vpadalq_u16(sum, vpaddlq_u8(magnitude));
+}
+
+inline uint32_t HorizontalSum(uint32x4_t sum) {
+#if defined(WINDOW_FOCUS_NEON_A64)
+  return vaddvq_u32(sum);
+#else
+  const uint32x2_t pair = vadd_u32(vget_low_u32(sum), vget_high_u32(sum));
+  return vget_lane_u32(vpadd_u32(pair, pair), 0);
+#endif
+}
+
+inline int16x8_t PaethPredict16(int16x8_t a, int16x8_t b, int16x8_t c) {
+  const int16x8_t pa = vabdq_s16(b, c);
+  const int16x8_t pb = vabdq_s16(a, c);
+  const int16x8_t pc = vabsq_s16(vsubq_s16(vaddq_s16(a, b), vaddq_s16(c, c)));
+  const uint16x8_t use_a = vandq_u16(vcleq_s16(pa, pb), vcleq_s16(pa, pc));
+  const uint16x8_t use_b = vcleq_s16(pb, pc);
+  return vbslq_s16(use_a, a, vbslq_s16(use_b, b, c));
+}
+#endif
+
+uint32_t FilterNone(const uint8_t* x, const uint8_t* /*b*/, size_t length,
+                    uint8_t* out) {
+  std::memcpy(out, x, length);
+  size_t i = 0;
+  uint32_t cost = 0;
+#if defined(WINDOW_FOCUS_SSE2)
+  __m128i sum = _mm_setzero_si128();
+  for (; i + 16 <= length; i += 16) {
+    sum = SumSignedMagnitudes(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i)), sum);
+  }
+  cost = HorizontalSum(sum);
+#elif defined(WINDOW_FOCUS_NEON)
+  uint32x4_t sum = vdupq_n_u32(0);
+  for (; i + 16 <= length; i += 16) {
+    sum = SumSignedMagnitudes(vld1q_u8(x + i), sum);
+  }
+  cost = HorizontalSum(sum);
+#endif
+  for (; i < length; i++) {
+    cost += SignedMagnitude(x[i]);
+  }
+  return cost;
+}
+
+uint32_t FilterSub(const uint8_t* x, const uint8_t* /*b*/, size_t length,
+                   uint8_t* out) {
+  size_t i = 0;
+  uint32_t cost = 0;
+#if defined(WINDOW_FOCUS_SSE2)
+  __m128i sum = _mm_setzero_si128();
+  for (; i + 16 <= length; i += 16) {
+    const __m128i v = _mm_sub_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i)),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i - 3)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), v);
+    sum = SumSignedMagnitudes(v, sum);
+  }
+  cost = HorizontalSum(sum);
+#elif defined(WINDOW_FOCUS_NEON)
+  uint32x4_t sum = vdupq_n_u32(0);
+  for (; i + 16 <= length; i += 16) {
+    const uint8x16_t v = vsubq_u8(vld1q_u8(x + i), vld1q_u8(x + i - 3));
+    vst1q_u8(out + i, v);
+    sum = SumSignedMagnitudes(v, sum);
+  }
+  cost = HorizontalSum(sum);
+#endif
+  for (; i < length; i++) {
+    out[i] = static_cast<uint8_t>(x[i] - x[i - 3]);
+    cost += SignedMagnitude(out[i]);
+  }
+  return cost;
+}
+
+uint32_t FilterUp(const uint8_t* x, const uint8_t* b, size_t length,
+                  uint8_t* out) {
+  size_t i = 0;
+  uint32_t cost = 0;
+#if defined(WINDOW_FOCUS_SSE2)
+  __m128i sum = _mm_setzero_si128();
+  for (; i + 16 <= length; i += 16) {
+    const __m128i v = _mm_sub_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i)),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), v);
+    sum = SumSignedMagnitudes(v, sum);
+  }
+  cost = HorizontalSum(sum);
+#elif defined(WINDOW_FOCUS_NEON)
+  uint32x4_t sum = vdupq_n_u32(0);
+  for (; i + 16 <= length; i += 16) {
+    const uint8x16_t v = vsubq_u8(vld1q_u8(x + i), vld1q_u8(b + i));
+    vst1q_u8(out + i, v);
+    sum = SumSignedMagnitudes(v, sum);
+  }
+  cost = HorizontalSum(sum);
+#endif
+  for (; i < length; i++) {
+    out[i] = static_cast<uint8_t>(x[i] - b[i]);
+    cost += SignedMagnitude(out[i]);
+  }
+  return cost;
+}
+
+uint32_t FilterAverage(const uint8_t* x, const uint8_t* b, size_t length,
+                       uint8_t* out) {
+  size_t i = 0;
+  uint32_t cost = 0;
+#if defined(WINDOW_FOCUS_SSE2)
+  __m128i sum = _mm_setzero_si128();
+  const __m128i one = _mm_set1_epi8(1);
+  for (; i + 16 <= length; i += 16) {
+    const __m128i left =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i - 3));
+    const __m128i above =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+    // _mm_avg_epu8 rounds up; the filter rounds down.
+    const __m128i average =
+        _mm_sub_epi8(_mm_avg_epu8(left, above),
+                     _mm_and_si128(_mm_xor_si128(left, above), one));
+    const __m128i v = _mm_sub_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i)), average);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), v);
+    sum = SumSignedMagnitudes(v, sum);
+  }
+  cost = HorizontalSum(sum);
+#elif defined(WINDOW_FOCUS_NEON)
+  uint32x4_t sum = vdupq_n_u32(0);
+  for (; i + 16 <= length; i += 16) {
+    const uint8x16_t average = vhaddq_u8(vld1q_u8(x + i - 3), vld1q_u8(b + i));
+    const uint8x16_t v = vsubq_u8(vld1q_u8(x + i), average);
+    vst1q_u8(out + i, v);
+    sum = SumSignedMagnitudes(v, sum);
+  }
+  cost = HorizontalSum(sum);
+#endif
+  for (; i < length; i++) {
+    out[i] = static_cast<uint8_t>(x[i] - ((x[i - 3] + b[i]) >> 1));
+    cost += SignedMagnitude(out[i]);
+  }
+  return cost;
+}
+
+uint32_t FilterPaeth(const uint8_t* x, const uint8_t* b, size_t length,
+                     uint8_t* out) {
+  size_t i = 0;
+  uint32_t cost = 0;
+#if defined(WINDOW_FOCUS_SSE2)
+  __m128i sum = _mm_setzero_si128();
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= length; i += 16) {
+    const __m128i left =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i - 3));
+    const __m128i above =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+    const __m128i upper_left =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i - 3));
+    const __m128i low = PaethPredict16(_mm_unpacklo_epi8(left, zero),
+                                       _mm_unpacklo_epi8(above, zero),
+                                       _mm_unpacklo_epi8(upper_left, zero));
+    const __m128i high = PaethPredict16(_mm_unpackhi_epi8(left, zero),
+                                        _mm_unpackhi_epi8(above, zero),
+                                        _mm_unpackhi_epi8(upper_left, zero));
+    const __m128i v = _mm_sub_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i)),
+        _mm_packus_epi16(low, high));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), v);
+    sum = SumSignedMagnitudes(v, sum);
+  }
+  cost = HorizontalSum(sum);
+#elif defined(WINDOW_FOCUS_NEON)
+  uint32x4_t sum = vdupq_n_u32(0);
+  for (; i + 16 <= length; i += 16) {
+    const uint8x16_t left = vld1q_u8(x + i - 3);
+    const uint8x16_t above = vld1q_u8(b + i);
+    const uint8x16_t upper_left = vld1q_u8(b + i - 3);
+    const int16x8_t low = PaethPredict16(
+        vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(left))),
+        vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(above))),
+        vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(upper_left))));
+    const int16x8_t high = PaethPredict16(
+        vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(left))),
+        vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(above))),
+        vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(upper_left))));
+    const uint8x16_t prediction =
+        vcombine_u8(vqmovun_s16(low), vqmovun_s16(high));
+    const uint8x16_t v = vsubq_u8(vld1q_u8(x + i), prediction);
+    vst1q_u8(out + i, v);
+    sum = SumSignedMagnitudes(v, sum);
+  }
+  cost = HorizontalSum(sum);
+#endif
+  for (; i < length; i++) {
+    out[i] = static_cast<uint8_t>(x[i] -
+                                  PaethPredictor(x[i - 3], b[i], b[i - 3]));
+    cost += SignedMagnitude(out[i]);
+  }
+  return cost;
+}
+
+using PngFilterKernel = uint32_t (*)(const uint8_t* x,
+                                     const uint8_t* b,
+                                     size_t length,
+                                     uint8_t* out);
+constexpr PngFilterKernel kPngFilterKernels[kPngFilterCount] = {
+    FilterNone, FilterSub, FilterUp, FilterAverage, FilterPaeth};
+
+// Converts one BGRX row to RGB.
+void PackRgbRow(const uint8_t* src, int width, uint8_t* rgb) {
+  for (int x = 0; x < width; x++) {
+    rgb[3 * x] = src[kBytesPerPixel * x + 2];
+    rgb[3 * x + 1] = src[kBytesPerPixel * x + 1];
+    rgb[3 * x + 2] = src[kBytesPerPixel * x];
+  }
+}
+
+// Filters rows of one image, keeping the RGB of the previous row.
+class PngRowFilter {
+ public:
+  PngRowFilter(const uint8_t* pixels, int width, int stride)
+      : pixels_(pixels),
+        width_(width),
+        stride_(stride),
+        row_bytes_(static_cast<size_t>(width) * 3),
+        rows_(2 * (kPngRowPadding + row_bytes_), 0),
+        filtered_(kPngFilterCount * (row_bytes_ + 1)),
+        above_(rows_.data() + kPngRowPadding),
+        current_(above_ + row_bytes_ + kPngRowPadding) {}
+
+  size_t row_bytes() const { return row_bytes_; }
+
+  // Filters row |y| with whichever filter costs least and returns the filter
+  // byte followed by the row. The rows must come in order, but the first
+  // may be any row.
+  const uint8_t* Filter(int y) {
+    if (y == next_row_) {
+      std::swap(above_, current_);
+    } else if (y == 0) {
+      std::fill(above_, above_ + row_bytes_, 0);
+    } else {
+      PackRgbRow(pixels_ + static_cast<size_t>(y - 1) * stride_, width_,
+                 above_);
+    }
+    PackRgbRow(pixels_ + static_cast<size_t>(y) * stride_, width_, current_);
+    next_row_ = y + 1;
+
+    const uint8_t* best = nullptr;
+    uint32_t best_cost = 0;
+    for (int filter = 0; filter < kPngFilterCount; filter++) {
+      uint8_t* out = filtered_.data() + filter * (row_bytes_ + 1);
+      out[0] = static_cast<uint8_t>(filter);
+      const uint32_t cost =
+          kPngFilterKernels[filter](current_, above_, row_bytes_, out + 1);
+      if (best == nullptr || cost < best_cost) {
+        best = out;
+        best_cost = cost;
+      }
+    }
+    return best;
+  }
+
+ private:
+  const uint8_t* pixels_;
+  const int width_;
+  const int stride_;
+  const size_t row_bytes_;
+  // The previous and current rows as RGB, each after kPngRowPadding zeros.
+  std::vector<uint8_t> rows_;
+  // A filter byte and the filtered row for each filter.
+  std::vector<uint8_t> filtered_;
+  uint8_t* above_;
+  uint8_t* current_;
+  int next_row_ = -1;
+};
+
+// One strip's raw deflate output and the Adler-32 of its input.
+struct PngStrip {
+  int first_row = 0;
+  int end_row = 0;
+  std::vector<uint8_t> deflated;
+  uLong adler = 0;
+  size_t length = 0;
+  bool ok = false;
+};
+
+void DeflatePngStrip(const uint8_t* pixels,
+                     int width,
+                     int stride,
+                     bool last,
+                     PngStrip* strip) {
+  z_stream stream = {};
+  // Raw deflate; the zlib wrapper is written once for the whole image.
+  if (deflateInit2(&stream, kPngCompressionLevel, Z_DEFLATED, -15, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    return;
+  }
+  PngRowFilter filter(pixels, width, stride);
+  const size_t row_size = filter.row_bytes() + 1;
+
+  if (strip->first_row > 0) {
+    // The end of the previous strip, filtered the same way it was there.
+    const int rows = static_cast<int>(std::min<size_t>(
+        (kDeflateWindow + row_size - 1) / row_size, strip->first_row));
+    std::vector<uint8_t> dictionary;
+    dictionary.reserve(rows * row_size);
+    for (int y = strip->first_row - rows; y < strip->first_row; y++) {
+      const uint8_t* row = filter.Filter(y);
+      dictionary.insert(dictionary.end(), row, row + row_size);
+    }
+    const size_t size = std::min(dictionary.size(), kDeflateWindow);
+    deflateSetDictionary(&stream, dictionary.data() + dictionary.size() - size,
+                         static_cast<uInt>(size));
+  }
+
+  strip->length = row_size * (strip->end_row - strip->first_row);
+  // A sync flush adds an empty stored block after the bound's worst case.
+  strip->deflated.resize(
+      deflateBound(&stream, static_cast<uLong>(strip->length)) + 16);
+  stream.next_out = strip->deflated.data();
+  stream.avail_out = static_cast<uInt>(strip->deflated.size());
+  strip->adler = adler32(0, nullptr, 0);
+
+  bool ok = true;
+  for (int y = strip->first_row; y < strip->end_row && ok; y++) {
+    const uint8_t* row = filter.Filter(y);
+    strip->adler = adler32(strip->adler, row, static_cast<uInt>(row_size));
+    stream.next_in = const_cast<Bytef*>(row);
+    stream.avail_in = static_cast<uInt>(row_size);
+    ok = deflate(&stream, Z_NO_FLUSH) == Z_OK && stream.avail_in == 0;
+  }
+  if (ok) {
+    // Only the last strip ends the deflate stream; the others end on a byte
+    // boundary so the next can simply follow.
+    const int result = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+    ok = last ? result == Z_STREAM_END : result == Z_OK;
+  }
+  strip->deflated.resize(stream.total_out);
+  deflateEnd(&stream);
+  strip->ok = ok;
+}
+
+// Helper threads shared by every EncodePng call, one fewer than there are
+// cores. The thread that calls EncodePng always deflates strips too, so
+// encodes running at the same time, one per screenshot worker, share the
+// cores instead of each starting a thread per core. Created on first use
+// and leaked, so that nothing is joined at exit.
+class StripPool {
+ public:
+  static StripPool& Get() {
+    static StripPool* pool = new StripPool(
+        std::max(1u, std::thread::hardware_concurrency()) - 1);
+    return *pool;
+  }
+
+  size_t size() const { return size_; }
+
+  void Post(std::function<void()> job) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      jobs_.push_back(std::move(job));
+    }
+    wake_.notify_one();
+  }
+
+ private:
+  explicit StripPool(size_t size) : size_(size) {
+    for (size_t i = 0; i < size; i++) {
+      std::thread(&StripPool::Run, this).detach();
+    }
+  }
+
+  void Run() {
+    while (true) {
+      std::function<void()> job;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        wake_.wait(lock, [this]() { return !jobs_.empty(); });
+        job = std::move(jobs_.front());
+        jobs_.pop_front();
+      }
+      job();
+    }
+  }
+
+  const size_t size_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::deque<std::function<void()>> jobs_;
+};
+
+// Runs task(0) to task(count - 1) on the calling thread and up to
+// |threads| - 1 helpers of the StripPool, and returns once all ran.
+void RunParallel(size_t count,
+                 int threads,
+                 const std::function<void(size_t)>& task) {
+  if (count == 0) {
+    return;
+  }
+  // Helpers that only get to the batch after the caller returned find no
+  // tasks left and never touch |task|.
+  struct Batch {
+    std::atomic<size_t> next{0};
+    size_t count = 0;
+    std::mutex mutex;
+    std::condition_variable done;
+    size_t finished = 0;
+  };
+  auto batch = std::make_shared<Batch>();
+  batch->count = count;
+  auto work = [batch, &task]() {
+    size_t finished = 0;
+    for (size_t i = batch->next++; i < batch->count; i = batch->next++) {
+      task(i);
+      finished++;
+    }
+    if (finished > 0) {
+      std::lock_guard<std::mutex> lock(batch->mutex);
+      batch->finished += finished;
+      if (batch->finished == batch->count) {
+        batch->done.notify_all();
+      }
+    }
+  };
+
+  StripPool& pool = StripPool::Get();
+  const size_t helpers =
+      std::min(std::min<size_t>(count, std::max(threads, 1)) - 1,
+               pool.size());
+  for (size_t i = 0; i < helpers; i++) {
+    pool.Post(work);
+  }
+  work();
+  std::unique_lock<std::mutex> lock(batch->mutex);
+  batch->done.wait(lock, [&batch]() {
+    return batch->finished == batch->count;
+  });
+}
+
+}  // namespace
+
+bool EncodePng(const uint8_t* pixels,
+               int width,
+               int height,
+               int stride,
+               int threads,
+               std::vector<uint8_t>* output) {
+  if (threads <= 0) {
+    threads = static_cast<int>(std::thread::hardware_concurrency());
+  }
+  const size_t row_size = static_cast<size_t>(width) * 3 + 1;
+  const int strip_rows = static_cast<int>(std::max<size_t>(
+      1, (kPngStripBytes + row_size - 1) / row_size));
+  std::vector<PngStrip> strips((height + strip_rows - 1) / strip_rows);
+  for (size_t i = 0; i < strips.size(); i++) {
+    strips[i].first_row = static_cast<int>(i) * strip_rows;
+    strips[i].end_row = std::min(height, strips[i].first_row + strip_rows);
+  }
+  RunParallel(strips.size(), threads, [&](size_t i) {
+    DeflatePngStrip(pixels, width, stride, i + 1 == strips.size(),
+                    &strips[i]);
+  });
+
+  output->clear();
+  static const uint8_t kSignature[] = {0x89, 'P',  'N',  'G',
+                                       '\r', '\n', 0x1A, '\n'};
+  output->insert(output->end(), kSignature, kSignature + sizeof(kSignature));
+
+  size_t chunk = BeginPngChunk("IHDR", output);
+  AppendBigEndian(static_cast<uint32_t>(width), output);
+  AppendBigEndian(static_cast<uint32_t>(height), output);
+  // 8 bits per channel, RGB, deflate, adaptive filtering, no interlacing.
+  const uint8_t kHeader[] = {8, 2, 0, 0, 0};
+  output->insert(output->end(), kHeader, kHeader + sizeof(kHeader));
+  FinishPngChunk(chunk, output);
+
+  // One IDAT chunk holding a zlib stream: the header for a 32 KiB window at
+  // a fast level, the strips, and the Adler-32 of all filtered rows.
+  chunk = BeginPngChunk("IDAT", output);
+  output->push_back(0x78);
+  output->push_back(0x5E);
+  uLong adler = adler32(0, nullptr, 0);
+  for (const PngStrip& strip : strips) {
+    if (!strip.ok) {
+      output->clear();
+      return false;
+    }
+    output->insert(output->end(), strip.deflated.begin(), strip.deflated.end());
+    adler = adler32_combine(adler, strip.adler,
+                            static_cast<z_off_t>(strip.length));
+  }
+  AppendBigEndian(static_cast<uint32_t>(adler), output);
+  FinishPngChunk(chunk, output);
+
+  chunk = BeginPngChunk("IEND", output);
+  FinishPngChunk(chunk, output);
+  return true;
+}
+
+}  // namespace window_focus
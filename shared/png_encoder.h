@@ -0,0 +1,23 @@
+#ifndef FLUTTER_PLUGIN_WINDOW_FOCUS_PNG_ENCODER_H_
+#define FLUTTER_PLUGIN_WINDOW_FOCUS_PNG_ENCODER_H_
+
+#include <cstdint>
+#include <vector>
+
+namespace window_focus {
+
+// Encodes top-down rows of BGRX pixels, whose fourth byte is ignored, as an
+// 8-bit RGB PNG with zlib on up to |threads| threads, or one per core when
+// |threads| is 0: the calling thread and helpers from a pool shared by all
+// encodes, so concurrent calls do not oversubscribe the cores. The file does
+// not depend on the number of threads.
+bool EncodePng(const uint8_t* pixels,
+               int width,
+               int height,
+               int stride,
+               int threads,
+               std::vector<uint8_t>* output);
+
+}  // namespace window_focus
+
+#endif  // FLUTTER_PLUGIN_WINDOW_FOCUS_PNG_ENCODER_H_
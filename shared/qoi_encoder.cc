@@ -0,0 +1,111 @@
+#include "qoi_encoder.h"
+
+#include <cstring>
+
+namespace window_focus {
+
+namespace {
+
+constexpr int kBytesPerPixel = 4;
+
+constexpr uint8_t kQoiOpIndex = 0x00;
+constexpr uint8_t kQoiOpDiff = 0x40;
+constexpr uint8_t kQoiOpLuma = 0x80;
+constexpr uint8_t kQoiOpRun = 0xC0;
+constexpr uint8_t kQoiOpRgb = 0xFE;
+constexpr int kQoiMaxRun = 62;
+constexpr uint8_t kQoiEnd[] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+// Pixels are handled as little-endian BGRA words with the alpha forced to
+// 0xFF, so equal colors compare equal whatever the padding byte holds.
+inline uint32_t QoiHash(uint32_t bgra) {
+  const uint32_t b = bgra & 0xFF;
+  const uint32_t g = (bgra >> 8) & 0xFF;
+  const uint32_t r = (bgra >> 16) & 0xFF;
+  return (r * 3 + g * 5 + b * 7 + 0xFF * 11) % 64;
+}
+
+void WriteBigEndian(uint32_t value, uint8_t* out) {
+  out[0] = static_cast<uint8_t>(value >> 24);
+  out[1] = static_cast<uint8_t>(value >> 16);
+  out[2] = static_cast<uint8_t>(value >> 8);
+  out[3] = static_cast<uint8_t>(value);
+}
+
+}  // namespace
+
+bool EncodeQoi(const uint8_t* pixels,
+               int width,
+               int height,
+               int stride,
+               std::vector<uint8_t>* output) {
+  // Worst case: a QOI_OP_RGB per pixel.
+  output->resize(14 + static_cast<size_t>(width) * height * 4 +
+                 sizeof(kQoiEnd));
+  uint8_t* out = output->data();
+  std::memcpy(out, "qoif", 4);
+  WriteBigEndian(static_cast<uint32_t>(width), out + 4);
+  WriteBigEndian(static_cast<uint32_t>(height), out + 8);
+  out[12] = 3;
+  out[13] = 0;
+  out += 14;
+
+  uint32_t index[64] = {};
+  uint32_t previous = 0xFF000000;
+  int run = 0;
+  for (int y = 0; y < height; y++) {
+    const uint8_t* row = pixels + static_cast<size_t>(y) * stride;
+    for (int x = 0; x < width; x++) {
+      uint32_t pixel;
+      std::memcpy(&pixel, row + kBytesPerPixel * x, sizeof(pixel));
+      pixel |= 0xFF000000;
+      if (pixel == previous) {
+        if (++run == kQoiMaxRun) {
+          *out++ = static_cast<uint8_t>(kQoiOpRun | (run - 1));
+          run = 0;
+        }
+        continue;
+      }
+      if (run > 0) {
+        *out++ = static_cast<uint8_t>(kQoiOpRun | (run - 1));
+        run = 0;
+      }
+
+      const uint32_t hash = QoiHash(pixel);
+      if (index[hash] == pixel) {
+        *out++ = static_cast<uint8_t>(kQoiOpIndex | hash);
+      } else {
+        index[hash] = pixel;
+        const int8_t dr = static_cast<int8_t>((pixel >> 16) - (previous >> 16));
+        const int8_t dg = static_cast<int8_t>((pixel >> 8) - (previous >> 8));
+        const int8_t db = static_cast<int8_t>(pixel - previous);
+        const int dr_dg = dr - dg;
+        const int db_dg = db - dg;
+        if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 &&
+            db <= 1) {
+          *out++ = static_cast<uint8_t>(kQoiOpDiff | (dr + 2) << 4 |
+                                        (dg + 2) << 2 | (db + 2));
+        } else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 &&
+                   db_dg >= -8 && db_dg <= 7) {
+          *out++ = static_cast<uint8_t>(kQoiOpLuma | (dg + 32));
+          *out++ = static_cast<uint8_t>((dr_dg + 8) << 4 | (db_dg + 8));
+        } else {
+          *out++ = kQoiOpRgb;
+          *out++ = static_cast<uint8_t>(pixel >> 16);
+          *out++ = static_cast<uint8_t>(pixel >> 8);
+          *out++ = static_cast<uint8_t>(pixel);
+        }
+      }
+      previous = pixel;
+    }
+  }
+  if (run > 0) {
+    *out++ = static_cast<uint8_t>(kQoiOpRun | (run - 1));
+  }
+  std::memcpy(out, kQoiEnd, sizeof(kQoiEnd));
+  out += sizeof(kQoiEnd);
+  output->resize(out - output->data());
+  return true;
+}
+
+}  // namespace window_focus
@@ -0,0 +1,21 @@
+#ifndef FLUTTER_PLUGIN_WINDOW_FOCUS_QOI_ENCODER_H_
+#define FLUTTER_PLUGIN_WINDOW_FOCUS_QOI_ENCODER_H_
+
+#include <cstdint>
+#include <vector>
+
+namespace window_focus {
+
+// Encodes top-down rows of BGRX pixels, whose fourth byte is ignored, as a
+// three channel sRGB QOI ("Quite OK Image", qoiformat.org): a single pass
+// with a 64 entry color cache, run lengths and small deltas. It encodes
+// several times faster than PNG at a comparable size for screen content.
+bool EncodeQoi(const uint8_t* pixels,
+               int width,
+               int height,
+               int stride,
+               std::vector<uint8_t>* output);
+
+}  // namespace window_focus
+
+#endif  // FLUTTER_PLUGIN_WINDOW_FOCUS_QOI_ENCODER_H_
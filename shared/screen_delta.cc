@@ -0,0 +1,344 @@
+#include "screen_delta.h"
+
+#ifdef WINDOW_FOCUS_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+
+#include "simd.h"
+
+namespace window_focus {
+
+namespace {
+
+#ifdef WINDOW_FOCUS_HAVE_ZLIB
+// Fast rather than small: deltas are usually a few tiles, and keyframes
+// should not stall the capture.
+constexpr int kDeltaCompressionLevel = 1;
+#endif
+
+// Keys for the 16-byte chunks of a tile row, in the style of XXH3's secret.
+// Rows use them offset by a multiple of kRowStep, so moving content within
+// a tile changes its hash.
+alignas(16) const uint64_t kChunkKeys[16][2] = {
+    {0x2CB0F69F4ABEA221ULL, 0x9417034723148989ULL},
+    {0xDD555950609DFE03ULL, 0xDBAFB150DEB12800ULL},
+    {0x7E789B2E6C442CB6ULL, 0xF41E5636C7E4F8C4ULL},
+    {0x0959D150F8FBA7E4ULL, 0xA97316F13CDB9EEAULL},
+    {0x74CD8258F9520068ULL, 0x55C74A62E116868BULL},
+    {0xD2F4C799A2023CBDULL, 0xDF98CB79A37B51B9ULL},
+    {0x396F5885524F3905ULL, 0xAF1D56386CA3B276ULL},
+    {0xA9FFBE6B5104E85AULL, 0x6BD0C51B9FD533B3ULL},
+    {0x980CE91C50AB4B56ULL, 0x28AC395780FE62C5ULL},
+    {0x768912E3A6BCEDC7ULL, 0x50B3E8C9332C7C88ULL},
+    {0xCE3BBFE520BD47DAULL, 0xCBA6C8E8E0BB7C4FULL},
+    {0xBF194DB8434A346DULL, 0x7D8F2A7B60416D7FULL},
+    {0x0849D1F6E0E10A5EULL, 0x7654B590D064E22FULL},
+    {0x16D1DA9507DF3AF2ULL, 0xF63AEF1089EA30E4ULL},
+    {0x9ADE6673CC6C522BULL, 0x4C75BC274E37087CULL},
+    {0xD35E12B49F51F27BULL, 0x22DDF2FFCEE481EAULL},
+};
+constexpr uint64_t kRowStep[2] = {0x9E3779B97F4A7C15ULL,
+                                  0xC2B2AE3D27D4EB4FULL};
+// Clears the padding byte of each pixel.
+constexpr uint64_t kColorMask = 0x00FFFFFF00FFFFFFULL;
+
+uint64_t Mix(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDULL;
+  h ^= h >> 33;
+  h *= 0xC4CEB9FE1A85EC53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+uint64_t RotateLeft(uint64_t value, int bits) {
+  return (value << bits) | (value >> (64 - bits));
+}
+
+// Hash of a |width| x |height| tile. Each 16 bytes are XORed with a key and
+// their 32-bit halves multiplied, and the products and the data itself are
+// summed into two 64-bit lanes, as XXH3 accumulates stripes.
+uint64_t HashTile(const uint8_t* pixels, int stride, int width, int height) {
+  const size_t row_bytes = static_cast<size_t>(width) * 4;
+  uint64_t lanes[2];
+#if defined(WINDOW_FOCUS_SSE2)
+  const size_t whole = row_bytes & ~size_t{15};
+  const __m128i mask = _mm_set1_epi64x(static_cast<int64_t>(kColorMask));
+  const __m128i step = _mm_set_epi64x(static_cast<int64_t>(kRowStep[1]),
+                                      static_cast<int64_t>(kRowStep[0]));
+  __m128i acc = _mm_setzero_si128();
+  __m128i offset = _mm_setzero_si128();
+  for (int y = 0; y < height; y++) {
+    const uint8_t* row = pixels + static_cast<size_t>(y) * stride;
+    for (size_t i = 0; i < row_bytes; i += 16) {
+      __m128i data;
+      if (i < whole) {
+        data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+      } else {
+        alignas(16) uint8_t tail[16] = {};
+        memcpy(tail, row + i, row_bytes - i);
+        data = _mm_load_si128(reinterpret_cast<const __m128i*>(tail));
+      }
+      data = _mm_and_si128(data, mask);
+      const __m128i key = _mm_add_epi64(
+          _mm_load_si128(
+              reinterpret_cast<const __m128i*>(kChunkKeys[(i / 16) & 15])),
+          offset);
+      const __m128i mixed = _mm_xor_si128(data, key);
+      acc = _mm_add_epi64(
+          acc, _mm_add_epi64(
+                   _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2)),
+                   _mm_mul_epu32(mixed, _mm_srli_epi64(mixed, 32))));
+    }
+    offset = _mm_add_epi64(offset, step);
+  }
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc);
+#elif defined(WINDOW_FOCUS_NEON)
+  const size_t whole = row_bytes & ~size_t{15};
+  const uint64x2_t mask = vdupq_n_u64(kColorMask);
+  const uint64x2_t step = vld1q_u64(kRowStep);
+  uint64x2_t acc = vdupq_n_u64(0);
+  uint64x2_t offset = vdupq_n_u64(0);
+  for (int y = 0; y < height; y++) {
+    const uint8_t* row = pixels + static_cast<size_t>(y) * stride;
+    for (size_t i = 0; i < row_bytes; i += 16) {
+      uint64x2_t data;
+      if (i < whole) {
+        data = vreinterpretq_u64_u8(vld1q_u8(row + i));
+      } else {
+        uint8_t tail[16] = {};
+        memcpy(tail, row + i, row_bytes - i);
+        data = vreinterpretq_u64_u8(vld1q_u8(tail));
+      }
+      data = vandq_u64(data, mask);
+      const uint64x2_t key =
+          vaddq_u64(vld1q_u64(kChunkKeys[(i / 16) & 15]), offset);
+      const uint64x2_t mixed = veorq_u64(data, key);
+      acc = vaddq_u64(
+          acc, vaddq_u64(vextq_u64(data, data, 1),
+                         vmull_u32(vmovn_u64(mixed), vshrn_n_u64(mixed, 32))));
+    }
+    offset = vaddq_u64(offset, step);
+  }
+  vst1q_u64(lanes, acc);
+#else
+  lanes[0] = 0;
+  lanes[1] = 0;
+  uint64_t offset[2] = {0, 0};
+  for (int y = 0; y < height; y++) {
+    const uint8_t* row = pixels + static_cast<size_t>(y) * stride;
+    for (size_t i = 0; i < row_bytes; i += 16) {
+      uint8_t chunk[16] = {};
+      memcpy(chunk, row + i, std::min<size_t>(16, row_bytes - i));
+      uint64_t data[2];
+      memcpy(data, chunk, sizeof(data));
+      for (int l = 0; l < 2; l++) {
+        data[l] &= kColorMask;
+      }
+      for (int l = 0; l < 2; l++) {
+        const uint64_t mixed =
+            data[l] ^ (kChunkKeys[(i / 16) & 15][l] + offset[l]);
+        lanes[l] += data[l ^ 1] + (mixed & 0xFFFFFFFF) * (mixed >> 32);
+      }
+    }
+    offset[0] += kRowStep[0];
+    offset[1] += kRowStep[1];
+  }
+#endif
+  const uint64_t size = static_cast<uint64_t>(width) << 32 |
+                        static_cast<uint32_t>(height);
+  return Mix(lanes[0] ^ RotateLeft(lanes[1], 29) ^ Mix(size));
+}
+
+int TileCount(int length, int tile_size) {
+  return (length + tile_size - 1) / tile_size;
+}
+
+// Appends tile |index| as 24-bit BGR rows.
+void AppendTile(const uint8_t* pixels,
+                int width,
+                int height,
+                int stride,
+                int tile_size,
+                int index,
+                std::vector<uint8_t>* output) {
+  const int columns = TileCount(width, tile_size);
+  const int x0 = (index % columns) * tile_size;
+  const int y0 = (index / columns) * tile_size;
+  const int tile_width = std::min(tile_size, width - x0);
+  const int tile_height = std::min(tile_size, height - y0);
+  size_t out = output->size();
+  output->resize(out + static_cast<size_t>(tile_width) * tile_height * 3);
+  uint8_t* bgr = output->data();
+  for (int y = y0; y < y0 + tile_height; y++) {
+    const uint8_t* row = pixels + static_cast<size_t>(y) * stride + x0 * 4;
+    for (int x = 0; x < tile_width; x++) {
+      bgr[out++] = row[4 * x];
+      bgr[out++] = row[4 * x + 1];
+      bgr[out++] = row[4 * x + 2];
+    }
+  }
+}
+
+}  // namespace
+
+void HashFrameTiles(const uint8_t* pixels,
+                    int width,
+                    int height,
+                    int stride,
+                    int tile_size,
+                    std::vector<uint64_t>* hashes) {
+  const int columns = TileCount(width, tile_size);
+  const int rows = TileCount(height, tile_size);
+  hashes->resize(static_cast<size_t>(columns) * rows);
+  for (int ty = 0; ty < rows; ty++) {
+    const int y0 = ty * tile_size;
+    const int tile_height = std::min(tile_size, height - y0);
+    for (int tx = 0; tx < columns; tx++) {
+      const int x0 = tx * tile_size;
+      (*hashes)[static_cast<size_t>(ty) * columns + tx] =
+          HashTile(pixels + static_cast<size_t>(y0) * stride + x0 * 4, stride,
+                   std::min(tile_size, width - x0), tile_height);
+    }
+  }
+}
+
+uint64_t HashFramePixels(const uint8_t* pixels,
+                         int width,
+                         int height,
+                         int stride) {
+  return HashTile(pixels, stride, width, height);
+}
+
+ScreenDeltaEncoder::ScreenDeltaEncoder(int tile_size, int keyframe_interval)
+    : tile_size_(tile_size), keyframe_interval_(keyframe_interval) {}
+
+bool ScreenDeltaEncoder::Encode(const uint8_t* pixels,
+                                int width,
+                                int height,
+                                int stride,
+                                bool force_keyframe,
+                                ScreenDelta* delta) {
+  HashFrameTiles(pixels, width, height, stride, tile_size_, &new_hashes_);
+  const bool keyframe =
+      force_keyframe || width != width_ || height != height_ ||
+      hashes_.size() != new_hashes_.size() ||
+      (keyframe_interval_ > 0 && frames_since_keyframe_ >= keyframe_interval_);
+
+  delta->width = width;
+  delta->height = height;
+  delta->tile_size = tile_size_;
+  delta->sequence = sequence_;
+  delta->keyframe = keyframe;
+  delta->tiles.clear();
+  delta->data.clear();
+  tile_pixels_.clear();
+  for (size_t i = 0; i < new_hashes_.size(); i++) {
+    if (keyframe || new_hashes_[i] != hashes_[i]) {
+      delta->tiles.push_back(static_cast<int32_t>(i));
+      AppendTile(pixels, width, height, stride, tile_size_,
+                 static_cast<int>(i), &tile_pixels_);
+    }
+  }
+
+#ifdef WINDOW_FOCUS_HAVE_ZLIB
+  delta->compression = "zlib";
+  if (!tile_pixels_.empty()) {
+    uLongf size = compressBound(static_cast<uLong>(tile_pixels_.size()));
+    delta->data.resize(size);
+    if (compress2(delta->data.data(), &size, tile_pixels_.data(),
+                  static_cast<uLong>(tile_pixels_.size()),
+                  kDeltaCompressionLevel) != Z_OK) {
+      delta->data.clear();
+      return false;
+    }
+    delta->data.resize(size);
+  }
+#else
+  delta->compression = "none";
+  delta->data = tile_pixels_;
+#endif
+
+  // Only a delta that was produced moves the encoder on.
+  hashes_.swap(new_hashes_);
+  width_ = width;
+  height_ = height;
+  frames_since_keyframe_ = keyframe ? 1 : frames_since_keyframe_ + 1;
+  sequence_++;
+  return true;
+}
+
+bool ScreenDeltaDecoder::Apply(const ScreenDelta& delta) {
+  if (!delta.keyframe &&
+      (sequence_ < 0 || delta.sequence != sequence_ + 1 ||
+       delta.width != width_ || delta.height != height_)) {
+    return false;
+  }
+  if (delta.tile_size <= 0) {
+    return false;
+  }
+  const int columns = TileCount(delta.width, delta.tile_size);
+  const int count = columns * TileCount(delta.height, delta.tile_size);
+  size_t expected = 0;
+  for (int32_t index : delta.tiles) {
+    if (index < 0 || index >= count) {
+      return false;
+    }
+    const int tile_width = std::min(
+        delta.tile_size, delta.width - (index % columns) * delta.tile_size);
+    const int tile_height = std::min(
+        delta.tile_size, delta.height - (index / columns) * delta.tile_size);
+    expected += static_cast<size_t>(tile_width) * tile_height * 3;
+  }
+  std::vector<uint8_t> bgr;
+  if (strcmp(delta.compression, "none") == 0) {
+    if (delta.data.size() != expected) {
+      return false;
+    }
+    bgr = delta.data;
+  } else {
+#ifdef WINDOW_FOCUS_HAVE_ZLIB
+    bgr.resize(expected);
+    if (expected > 0) {
+      uLongf size = static_cast<uLongf>(expected);
+      if (uncompress(bgr.data(), &size, delta.data.data(),
+                     static_cast<uLong>(delta.data.size())) != Z_OK ||
+          size != expected) {
+        return false;
+      }
+    }
+#else
+    return false;
+#endif
+  }
+
+  if (delta.keyframe) {
+    width_ = delta.width;
+    height_ = delta.height;
+    pixels_.assign(static_cast<size_t>(width_) * height_ * 4, 0);
+  }
+  size_t in = 0;
+  for (int32_t index : delta.tiles) {
+    const int x0 = (index % columns) * delta.tile_size;
+    const int y0 = (index / columns) * delta.tile_size;
+    const int tile_width = std::min(delta.tile_size, width_ - x0);
+    const int tile_height = std::min(delta.tile_size, height_ - y0);
+    for (int y = y0; y < y0 + tile_height; y++) {
+      uint8_t* row =
+          pixels_.data() + (static_cast<size_t>(y) * width_ + x0) * 4;
+      for (int x = 0; x < tile_width; x++) {
+        row[4 * x] = bgr[in++];
+        row[4 * x + 1] = bgr[in++];
+        row[4 * x + 2] = bgr[in++];
+        row[4 * x + 3] = 0xFF;
+      }
+    }
+  }
+  sequence_ = delta.sequence;
+  return true;
+}
+
+}  // namespace window_focus
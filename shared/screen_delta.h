@@ -0,0 +1,116 @@
+#ifndef FLUTTER_PLUGIN_WINDOW_FOCUS_SCREEN_DELTA_H_
+#define FLUTTER_PLUGIN_WINDOW_FOCUS_SCREEN_DELTA_H_
+
+#include <cstdint>
+#include <vector>
+
+namespace window_focus {
+
+// Tile edge used when takeScreenshotDelta is not given one.
+constexpr int kDefaultDeltaTileSize = 64;
+// Frames between keyframes when takeScreenshotDelta is not given a count.
+constexpr int kDefaultDeltaKeyframeInterval = 300;
+// Tile edges takeScreenshotDelta accepts.
+constexpr int kMinDeltaTileSize = 8;
+constexpr int kMaxDeltaTileSize = 512;
+
+// The tiles of a frame that changed since the previous one.
+//
+// Tiles are numbered row-major; those in the last column and row may be
+// narrower or shorter than |tile_size|. |data| holds the listed tiles one
+// after another, each as top-down rows of 24-bit BGR pixels, compressed as
+// one zlib stream. A keyframe lists every tile.
+struct ScreenDelta {
+  int width = 0;
+  int height = 0;
+  int tile_size = 0;
+  // Frames encoded before this one since the encoder was created.
+  int64_t sequence = 0;
+  bool keyframe = false;
+  std::vector<int32_t> tiles;
+  // "zlib", or "none" in Windows builds without zlib, where |data| holds the
+  // tiles as they are.
+  const char* compression = "zlib";
+  std::vector<uint8_t> data;
+};
+
+// Turns a series of BGRX frames into ScreenDeltas.
+//
+// Every tile is hashed with a 64-bit SIMD hash of its pixels (the padding
+// byte is ignored) and only tiles whose hash differs from the previous
+// frame's are compressed, so an unchanged screen costs one read of the
+// frame and produces an empty delta. A frame of a new size, the first frame
+// and every |keyframe_interval|th frame (0 for none) are keyframes.
+//
+// Not thread-safe.
+class ScreenDeltaEncoder {
+ public:
+  ScreenDeltaEncoder(int tile_size, int keyframe_interval);
+
+  ScreenDeltaEncoder(const ScreenDeltaEncoder&) = delete;
+  ScreenDeltaEncoder& operator=(const ScreenDeltaEncoder&) = delete;
+
+  // |force_keyframe| sends every tile, e.g. for a receiver that lost track.
+  bool Encode(const uint8_t* pixels,
+              int width,
+              int height,
+              int stride,
+              bool force_keyframe,
+              ScreenDelta* delta);
+
+  int tile_size() const { return tile_size_; }
+  int keyframe_interval() const { return keyframe_interval_; }
+
+ private:
+  const int tile_size_;
+  const int keyframe_interval_;
+  int width_ = 0;
+  int height_ = 0;
+  int64_t sequence_ = 0;
+  int64_t frames_since_keyframe_ = 0;
+  std::vector<uint64_t> hashes_;
+  // Per-frame scratch, kept to avoid reallocating.
+  std::vector<uint64_t> new_hashes_;
+  std::vector<uint8_t> tile_pixels_;
+};
+
+// Rebuilds frames from ScreenDeltas, as the Dart ScreenshotDeltaDecoder
+// does.
+class ScreenDeltaDecoder {
+ public:
+  // Applies |delta| to the current frame. Fails, leaving the frame alone, on
+  // a delta that does not directly follow the last one applied; only a
+  // keyframe can be applied then.
+  bool Apply(const ScreenDelta& delta);
+
+  // Opaque BGRA, |width| * 4 bytes per row.
+  const std::vector<uint8_t>& pixels() const { return pixels_; }
+  int width() const { return width_; }
+  int height() const { return height_; }
+
+ private:
+  int width_ = 0;
+  int height_ = 0;
+  int64_t sequence_ = -1;
+  std::vector<uint8_t> pixels_;
+};
+
+// 64-bit hashes of the |tile_size| tiles of a BGRX frame, row-major. Uses
+// SSE2 or NEON; every path, and so both plugins, gives the same hashes.
+void HashFrameTiles(const uint8_t* pixels,
+                    int width,
+                    int height,
+                    int stride,
+                    int tile_size,
+                    std::vector<uint64_t>* hashes);
+
+// 64-bit hash of a whole BGRX frame's colors, with the same function as
+// the tiles.
+uint64_t HashFramePixels(const uint8_t* pixels,
+                         int width,
+                         int height,
+                         int stride);
+
+}  // namespace window_focus
+
+#endif  // FLUTTER_PLUGIN_WINDOW_FOCUS_SCREEN_DELTA_H_
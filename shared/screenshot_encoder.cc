@@ -0,0 +1,224 @@
+#include "screenshot_encoder.h"
+
+#include <cstring>
+#include <iostream>
+
+#include "png_encoder.h"
+#include "qoi_encoder.h"
+
+#if defined(WINDOW_FOCUS_HAVE_TURBOJPEG)
+#include <turbojpeg.h>
+#elif defined(WINDOW_FOCUS_HAVE_LIBJPEG)
+#include <csetjmp>
+#include <cstdio>
+// jpeglib.h needs size_t and FILE declared first.
+#include <jpeglib.h>
+#endif
+
+#ifdef WINDOW_FOCUS_HAVE_LIBWEBP
+#include <webp/encode.h>
+
+#include "pixel_format.h"
+#endif
+
+namespace window_focus {
+
+namespace {
+
+constexpr int kBytesPerPixel = 4;
+
+bool EncodePngDefault(const uint8_t* pixels,
+                      int width,
+                      int height,
+                      int stride,
+                      int /*quality*/,
+                      std::vector<uint8_t>* output) {
+  return EncodePng(pixels, width, height, stride, 0, output);
+}
+
+bool EncodeQoiDefault(const uint8_t* pixels,
+                      int width,
+                      int height,
+                      int stride,
+                      int /*quality*/,
+                      std::vector<uint8_t>* output) {
+  return EncodeQoi(pixels, width, height, stride, output);
+}
+
+// --- JPEG ------------------------------------------------------------------
+
+#if defined(WINDOW_FOCUS_HAVE_TURBOJPEG)
+// Baseline JPEG through TurboJPEG, which reads the BGRX rows as they are.
+// Above quality 90 chroma is kept at full resolution, since subsampling
+// smears colored text.
+bool EncodeJpeg(const uint8_t* pixels,
+                int width,
+                int height,
+                int stride,
+                int quality,
+                std::vector<uint8_t>* output) {
+  tjhandle compressor = tjInitCompress();
+  if (compressor == nullptr) {
+    return false;
+  }
+  unsigned char* buffer = nullptr;
+  unsigned long size = 0;
+  const bool ok =
+      tjCompress2(compressor, pixels, width, stride, height, TJPF_BGRX,
+                  &buffer, &size, quality > 90 ? TJSAMP_444 : TJSAMP_420,
+                  quality, 0) == 0;
+  if (ok) {
+    output->assign(buffer, buffer + size);
+  } else {
+    std::cerr << "[WindowFocus] JPEG encoding failed: "
+              << tjGetErrorStr2(compressor) << std::endl;
+  }
+  tjFree(buffer);
+  tjDestroy(compressor);
+  return ok;
+}
+#elif defined(WINDOW_FOCUS_HAVE_LIBJPEG)
+// libjpeg's default error handler exits the process.
+struct JpegErrorManager {
+  jpeg_error_mgr base;
+  jmp_buf jump;
+};
+
+void OnJpegError(j_common_ptr info) {
+  char message[JMSG_LENGTH_MAX];
+  info->err->format_message(info, message);
+  std::cerr << "[WindowFocus] JPEG encoding failed: " << message << std::endl;
+  longjmp(reinterpret_cast<JpegErrorManager*>(info->err)->jump, 1);
+}
+
+// Baseline JPEG. Above quality 90 chroma is kept at full resolution, since
+// subsampling smears colored text.
+bool EncodeJpeg(const uint8_t* pixels,
+                int width,
+                int height,
+                int stride,
+                int quality,
+                std::vector<uint8_t>* output) {
+  jpeg_compress_struct info;
+  JpegErrorManager error;
+  info.err = jpeg_std_error(&error.base);
+  error.base.error_exit = OnJpegError;
+  unsigned char* buffer = nullptr;
+  unsigned long size = 0;
+#ifndef JCS_EXTENSIONS
+  // Plain libjpeg only takes RGB. Allocated before setjmp so a failure
+  // still frees it.
+  std::vector<uint8_t> rgb(static_cast<size_t>(width) * 3);
+#endif
+
+  if (setjmp(error.jump)) {
+    jpeg_destroy_compress(&info);
+    free(buffer);
+    return false;
+  }
+  jpeg_create_compress(&info);
+  jpeg_mem_dest(&info, &buffer, &size);
+  info.image_width = static_cast<JDIMENSION>(width);
+  info.image_height = static_cast<JDIMENSION>(height);
+#ifdef JCS_EXTENSIONS
+  // libjpeg-turbo reads the BGRX rows as they are.
+  info.input_components = kBytesPerPixel;
+  info.in_color_space = JCS_EXT_BGRX;
+#else
+  info.input_components = 3;
+  info.in_color_space = JCS_RGB;
+#endif
+  jpeg_set_defaults(&info);
+  jpeg_set_quality(&info, quality, TRUE);
+  if (quality > 90) {
+    info.comp_info[0].h_samp_factor = 1;
+    info.comp_info[0].v_samp_factor = 1;
+  }
+  jpeg_start_compress(&info, TRUE);
+  while (info.next_scanline < info.image_height) {
+    const uint8_t* src =
+        pixels + static_cast<size_t>(info.next_scanline) * stride;
+#ifdef JCS_EXTENSIONS
+    JSAMPROW row = const_cast<JSAMPROW>(src);
+#else
+    for (int x = 0; x < width; x++) {
+      rgb[3 * x] = src[kBytesPerPixel * x + 2];
+      rgb[3 * x + 1] = src[kBytesPerPixel * x + 1];
+      rgb[3 * x + 2] = src[kBytesPerPixel * x];
+    }
+    JSAMPROW row = rgb.data();
+#endif
+    jpeg_write_scanlines(&info, &row, 1);
+  }
+  jpeg_finish_compress(&info);
+  jpeg_destroy_compress(&info);
+
+  output->assign(buffer, buffer + size);
+  free(buffer);
+  return true;
+}
+#endif  // WINDOW_FOCUS_HAVE_TURBOJPEG || WINDOW_FOCUS_HAVE_LIBJPEG
+
+// --- WebP ------------------------------------------------------------------
+
+#ifdef WINDOW_FOCUS_HAVE_LIBWEBP
+// Lossy WebP through libwebp's one-call API.
+bool EncodeWebp(const uint8_t* pixels,
+                int width,
+                int height,
+                int stride,
+                int quality,
+                std::vector<uint8_t>* output) {
+  if (width > WEBP_MAX_DIMENSION || height > WEBP_MAX_DIMENSION) {
+    std::cerr << "[WindowFocus] " << width << "x" << height
+              << " is too large for WebP" << std::endl;
+    return false;
+  }
+  // The padding byte would be read as alpha, so the pixels are made opaque
+  // in a copy; the frame itself is left alone.
+  const int bgra_stride = width * kBytesPerPixel;
+  std::vector<uint8_t> bgra(static_cast<size_t>(bgra_stride) * height);
+  for (int y = 0; y < height; y++) {
+    ConvertBgrxPixels(pixels + static_cast<size_t>(y) * stride,
+                      bgra.data() + static_cast<size_t>(y) * bgra_stride,
+                      width, PixelFormat::kBgra);
+  }
+  uint8_t* encoded = nullptr;
+  const size_t size =
+      WebPEncodeBGRA(bgra.data(), width, height, bgra_stride,
+                     static_cast<float>(quality), &encoded);
+  if (size == 0) {
+    return false;
+  }
+  output->assign(encoded, encoded + size);
+  WebPFree(encoded);
+  return true;
+}
+#endif  // WINDOW_FOCUS_HAVE_LIBWEBP
+
+}  // namespace
+
+const std::vector<ScreenshotEncoder>& ScreenshotEncoders() {
+  static const std::vector<ScreenshotEncoder> encoders = {
+      {"png", false, EncodePngDefault},
+#if defined(WINDOW_FOCUS_HAVE_TURBOJPEG) || defined(WINDOW_FOCUS_HAVE_LIBJPEG)
+      {"jpeg", true, EncodeJpeg},
+#endif
+#ifdef WINDOW_FOCUS_HAVE_LIBWEBP
+      {"webp", true, EncodeWebp},
+#endif
+      {"qoi", false, EncodeQoiDefault},
+  };
+  return encoders;
+}
+
+const ScreenshotEncoder* FindScreenshotEncoder(const char* name) {
+  for (const ScreenshotEncoder& encoder : ScreenshotEncoders()) {
+    if (strcmp(encoder.name, name) == 0) {
+      return &encoder;
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace window_focus
\ No newline at end of file
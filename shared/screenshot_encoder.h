@@ -0,0 +1,39 @@
+#ifndef FLUTTER_PLUGIN_WINDOW_FOCUS_SCREENSHOT_ENCODER_H_
+#define FLUTTER_PLUGIN_WINDOW_FOCUS_SCREENSHOT_ENCODER_H_
+
+#include <cstdint>
+#include <vector>
+
+namespace window_focus {
+
+// Quality used when takeScreenshot is not given one, for lossy formats.
+constexpr int kDefaultScreenshotQuality = 90;
+
+// An image format takeScreenshot can return.
+//
+// Encoders take top-down rows of 32-bit BGRX pixels, the fourth byte being
+// padding, and produce opaque images. PNG and QOI are always available; JPEG
+// only when TurboJPEG (libjpeg-turbo) or libjpeg, and WebP only when libwebp
+// were found at build time.
+struct ScreenshotEncoder {
+  // Name on the method channel: "png", "jpeg", "webp" or "qoi".
+  const char* name;
+  // Whether |quality| (1 to 100) has any effect.
+  bool lossy;
+  bool (*encode)(const uint8_t* pixels,
+                 int width,
+                 int height,
+                 int stride,
+                 int quality,
+                 std::vector<uint8_t>* output);
+};
+
+// The encoders compiled into this build, PNG first.
+const std::vector<ScreenshotEncoder>& ScreenshotEncoders();
+
+// Returns null for unknown formats and those not compiled in.
+const ScreenshotEncoder* FindScreenshotEncoder(const char* name);
+
+}  // namespace window_focus
+
+#endif  // FLUTTER_PLUGIN_WINDOW_FOCUS_SCREENSHOT_ENCODER_H_
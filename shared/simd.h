@@ -0,0 +1,21 @@
+#ifndef FLUTTER_PLUGIN_WINDOW_FOCUS_SIMD_H_
+#define FLUTTER_PLUGIN_WINDOW_FOCUS_SIMD_H_
+
+// The vector instructions the shared image code may use, named the same way
+// for GCC, Clang and MSVC: WINDOW_FOCUS_SSE2 on x86 (always on x86-64),
+// WINDOW_FOCUS_NEON on ARM. Without either the scalar loops are used.
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define WINDOW_FOCUS_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define WINDOW_FOCUS_NEON 1
+#include <arm_neon.h>
+#endif
+
+// 64-bit ARM, where NEON has across-vector adds.
+#if defined(WINDOW_FOCUS_NEON) && (defined(__aarch64__) || defined(_M_ARM64))
+#define WINDOW_FOCUS_NEON_A64 1
+#endif
+
+#endif  // FLUTTER_PLUGIN_WINDOW_FOCUS_SIMD_H_
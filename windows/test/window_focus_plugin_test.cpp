@@ -4,9 +4,20 @@
 #include <gtest/gtest.h>
 #include <windows.h>
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <future>
+#include <iostream>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <utility>
 #include <variant>
+#include <vector>
 
 #include "window_focus_plugin.h"
 
@@ -20,6 +31,74 @@ using flutter::EncodableValue;
 using flutter::MethodCall;
 using flutter::MethodResultFunctions;
 
+// Calls |method| with |arguments| and returns the reply, or null on error.
+// Screenshots are answered on a worker thread, so this waits for the reply.
+std::unique_ptr<EncodableValue> Call(WindowFocusPlugin& plugin,
+                                     const std::string& method,
+                                     EncodableMap arguments) {
+  auto reply = std::make_shared<std::promise<std::unique_ptr<EncodableValue>>>();
+  std::future<std::unique_ptr<EncodableValue>> future = reply->get_future();
+  plugin.HandleMethodCall(
+      MethodCall(method, std::make_unique<EncodableValue>(std::move(arguments))),
+      std::make_unique<MethodResultFunctions<>>(
+          [reply](const EncodableValue* result) {
+            reply->set_value(std::make_unique<EncodableValue>(*result));
+          },
+          [reply](const std::string&, const std::string&, const EncodableValue*) {
+            reply->set_value(nullptr);
+          },
+          [reply]() { reply->set_value(nullptr); }));
+  if (future.wait_for(std::chrono::seconds(10)) != std::future_status::ready) {
+    ADD_FAILURE() << method << " did not reply";
+    return nullptr;
+  }
+  return future.get();
+}
+
+// Calls |method|, which replies with nothing, and returns whether it succeeded.
+bool CallSucceeds(WindowFocusPlugin& plugin,
+                  const std::string& method,
+                  EncodableMap arguments) {
+  bool succeeded = false;
+  plugin.HandleMethodCall(
+      MethodCall(method, std::make_unique<EncodableValue>(std::move(arguments))),
+      std::make_unique<MethodResultFunctions<>>(
+          [&succeeded](const EncodableValue*) { succeeded = true; }, nullptr,
+          nullptr));
+  return succeeded;
+}
+
+// Error codes of replies that may arrive on other threads, "" for success.
+class Replies {
+ public:
+  std::unique_ptr<MethodResultFunctions<>> Result() {
+    return std::make_unique<MethodResultFunctions<>>(
+        [this](const EncodableValue*) { Add(""); },
+        [this](const std::string& code, const std::string&,
+               const EncodableValue*) { Add(code); },
+        [this]() { Add("not implemented"); });
+  }
+
+  // Waits for |count| replies and returns their codes.
+  std::vector<std::string> WaitFor(size_t count) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait_for(lock, std::chrono::seconds(10),
+                      [&]() { return codes_.size() >= count; });
+    return codes_;
+  }
+
+ private:
+  void Add(const std::string& code) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    codes_.push_back(code);
+    changed_.notify_all();
+  }
+
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::vector<std::string> codes_;
+};
+
 }  // namespace
 
 TEST(WindowFocusPlugin, GetPlatformVersion) {
@@ -39,5 +118,489 @@ TEST(WindowFocusPlugin, GetPlatformVersion) {
   EXPECT_TRUE(result_string.rfind("Windows ", 0) == 0);
 }
 
+TEST(WindowFocusPlugin, RawScreenshotSkipsEncoding) {
+  WindowFocusPlugin plugin;
+  auto reply = Call(plugin, "takeScreenshotRaw",
+                    {{EncodableValue("format"), EncodableValue("rgba")}});
+  if (reply == nullptr) {
+    GTEST_SKIP() << "No desktop to capture";
+  }
+  const auto& map = std::get<EncodableMap>(*reply);
+  const int width = std::get<int32_t>(map.at(EncodableValue("width")));
+  const int height = std::get<int32_t>(map.at(EncodableValue("height")));
+  const int stride = std::get<int32_t>(map.at(EncodableValue("stride")));
+  const auto& pixels =
+      std::get<std::vector<uint8_t>>(map.at(EncodableValue("pixels")));
+  EXPECT_EQ(std::get<std::string>(map.at(EncodableValue("format"))), "rgba");
+  EXPECT_EQ(stride, width * 4);
+  ASSERT_EQ(pixels.size(), static_cast<size_t>(stride) * height);
+  for (size_t i = 3; i < pixels.size(); i += 4) {
+    ASSERT_EQ(pixels[i], 0xFF) << "pixel " << i / 4 << " is not opaque";
+  }
+
+  // End-to-end latency through the method channel, PNG against raw.
+  constexpr int kRuns = 5;
+  auto time = [&plugin](const std::string& method) {
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kRuns; i++) {
+      EXPECT_NE(Call(plugin, method, {}), nullptr);
+    }
+    const std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count() / kRuns;
+  };
+  const double png = time("takeScreenshot");
+  const double raw = time("takeScreenshotRaw");
+  std::cout << "[Screenshot] " << width << "x" << height << ": PNG " << png
+            << " ms, raw " << raw << " ms" << std::endl;
+}
+
+TEST(WindowFocusPlugin, ScreenshotFormats) {
+  WindowFocusPlugin plugin;
+  auto formats = Call(plugin, "getScreenshotFormats", {});
+  ASSERT_NE(formats, nullptr);
+  std::vector<std::string> names;
+  for (const auto& name : std::get<flutter::EncodableList>(*formats)) {
+    names.push_back(std::get<std::string>(name));
+  }
+  ASSERT_GE(names.size(), 3u);
+  EXPECT_EQ(names[0], "png");
+  EXPECT_EQ(Call(plugin, "takeScreenshot",
+                 {{EncodableValue("format"), EncodableValue("bmp")}}),
+            nullptr);
+  EXPECT_EQ(Call(plugin, "takeScreenshot",
+                 {{EncodableValue("format"), EncodableValue("jpeg")},
+                  {EncodableValue("quality"), EncodableValue(101)}}),
+            nullptr);
+  if (Call(plugin, "takeScreenshotRaw", {}) == nullptr) {
+    GTEST_SKIP() << "No desktop to capture";
+  }
+
+  // Capture and encode time and size of the current desktop per format.
+  const std::vector<std::pair<std::string, std::string>> magic = {
+      {"png", "\x89PNG"}, {"jpeg", "\xFF\xD8\xFF"}, {"webp", "RIFF"}, {"qoi", "qoif"}};
+  for (const auto& name : names) {
+    for (int quality : {50, 90}) {
+      const auto start = std::chrono::steady_clock::now();
+      auto reply = Call(plugin, "takeScreenshot",
+                        {{EncodableValue("format"), EncodableValue(name)},
+                         {EncodableValue("quality"), EncodableValue(quality)}});
+      const std::chrono::duration<double, std::milli> elapsed =
+          std::chrono::steady_clock::now() - start;
+      ASSERT_NE(reply, nullptr) << name;
+      const auto& bytes = std::get<std::vector<uint8_t>>(*reply);
+      for (const auto& [format, prefix] : magic) {
+        if (format == name) {
+          ASSERT_GE(bytes.size(), prefix.size());
+          EXPECT_TRUE(std::equal(prefix.begin(), prefix.end(), bytes.begin(),
+                                 [](char a, uint8_t b) { return static_cast<uint8_t>(a) == b; }))
+              << name << " has the wrong signature";
+        }
+      }
+      std::cout << "[Screenshot] " << name << " q" << quality << ": "
+                << elapsed.count() << " ms, " << bytes.size() / 1024 << " KiB" << std::endl;
+    }
+  }
+}
+
+TEST(WindowFocusPlugin, ScreenshotThumbnails) {
+  WindowFocusPlugin plugin;
+  EXPECT_EQ(Call(plugin, "takeScreenshotRaw",
+                 {{EncodableValue("maxWidth"), EncodableValue(0)}}),
+            nullptr);
+  auto full = Call(plugin, "takeScreenshotRaw", {});
+  if (full == nullptr) {
+    GTEST_SKIP() << "No desktop to capture";
+  }
+  const auto& fullMap = std::get<EncodableMap>(*full);
+  const int fullWidth = std::get<int32_t>(fullMap.at(EncodableValue("width")));
+  const int fullHeight = std::get<int32_t>(fullMap.at(EncodableValue("height")));
+
+  auto reply = Call(plugin, "takeScreenshotRaw",
+                    {{EncodableValue("format"), EncodableValue("rgba")},
+                     {EncodableValue("maxWidth"), EncodableValue(64)},
+                     {EncodableValue("maxHeight"), EncodableValue(64)}});
+  ASSERT_NE(reply, nullptr);
+  const auto& map = std::get<EncodableMap>(*reply);
+  const int width = std::get<int32_t>(map.at(EncodableValue("width")));
+  const int height = std::get<int32_t>(map.at(EncodableValue("height")));
+  const auto& pixels =
+      std::get<std::vector<uint8_t>>(map.at(EncodableValue("pixels")));
+  EXPECT_LE(width, 64);
+  EXPECT_LE(height, 64);
+  EXPECT_TRUE(width == (std::min)(fullWidth, 64) || height == (std::min)(fullHeight, 64));
+  ASSERT_EQ(pixels.size(), static_cast<size_t>(width) * height * 4);
+  for (size_t i = 3; i < pixels.size(); i += 4) {
+    ASSERT_EQ(pixels[i], 0xFF);
+  }
+
+  // A 640 pixel wide preview against the full frame, per format.
+  for (const char* format : {"png", "jpeg"}) {
+    for (int maxWidth : {0, 640}) {
+      EncodableMap arguments = {{EncodableValue("format"), EncodableValue(format)}};
+      if (maxWidth > 0) {
+        arguments[EncodableValue("maxWidth")] = EncodableValue(maxWidth);
+      }
+      const auto start = std::chrono::steady_clock::now();
+      auto encoded = Call(plugin, "takeScreenshot", arguments);
+      const std::chrono::duration<double, std::milli> elapsed =
+          std::chrono::steady_clock::now() - start;
+      ASSERT_NE(encoded, nullptr) << format;
+      std::cout << "[Screenshot] " << format << (maxWidth > 0 ? " 640 wide: " : " full: ")
+                << elapsed.count() << " ms, "
+                << std::get<std::vector<uint8_t>>(*encoded).size() / 1024 << " KiB"
+                << std::endl;
+    }
+  }
+}
+
+TEST(WindowFocusPlugin, ScreenshotDeltas) {
+  WindowFocusPlugin plugin;
+  EXPECT_EQ(Call(plugin, "takeScreenshotDelta",
+                 {{EncodableValue("tileSize"), EncodableValue(4)}}),
+            nullptr);
+  auto first = Call(plugin, "takeScreenshotDelta",
+                    {{EncodableValue("tileSize"), EncodableValue(32)}});
+  if (first == nullptr) {
+    GTEST_SKIP() << "No desktop to capture";
+  }
+  const auto& keyframe = std::get<EncodableMap>(*first);
+  const int width = std::get<int32_t>(keyframe.at(EncodableValue("width")));
+  const int height = std::get<int32_t>(keyframe.at(EncodableValue("height")));
+  EXPECT_TRUE(std::get<bool>(keyframe.at(EncodableValue("keyframe"))));
+  EXPECT_EQ(std::get<std::vector<int32_t>>(keyframe.at(EncodableValue("tiles"))).size(),
+            static_cast<size_t>((width + 31) / 32) * ((height + 31) / 32));
+
+  // Later frames carry only what changed, often nothing on a test machine.
+  for (int i = 1; i <= 3; i++) {
+    const auto start = std::chrono::steady_clock::now();
+    auto reply = Call(plugin, "takeScreenshotDelta",
+                      {{EncodableValue("tileSize"), EncodableValue(32)}});
+    const std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    ASSERT_NE(reply, nullptr);
+    const auto& delta = std::get<EncodableMap>(*reply);
+    EXPECT_EQ(std::get<int64_t>(delta.at(EncodableValue("sequence"))), i);
+    EXPECT_FALSE(std::get<bool>(delta.at(EncodableValue("keyframe"))));
+    std::cout << "[Screenshot] delta " << i << ": "
+              << std::get<std::vector<int32_t>>(delta.at(EncodableValue("tiles"))).size()
+              << " tiles, "
+              << std::get<std::vector<uint8_t>>(delta.at(EncodableValue("data"))).size()
+              << " bytes, " << elapsed.count() << " ms" << std::endl;
+  }
+
+  // A new tile size starts a new series.
+  auto reply = Call(plugin, "takeScreenshotDelta", {});
+  ASSERT_NE(reply, nullptr);
+  const auto& restarted = std::get<EncodableMap>(*reply);
+  EXPECT_EQ(std::get<int32_t>(restarted.at(EncodableValue("tileSize"))), 64);
+  EXPECT_EQ(std::get<int64_t>(restarted.at(EncodableValue("sequence"))), 0);
+  EXPECT_TRUE(std::get<bool>(restarted.at(EncodableValue("keyframe"))));
+}
+
+TEST(WindowFocusPlugin, ScreenshotSchedule) {
+  WindowFocusPlugin plugin;
+  const std::filesystem::path directory =
+      std::filesystem::temp_directory_path() / "window_focus_schedule_test";
+  std::filesystem::remove_all(directory);
+  EXPECT_FALSE(CallSucceeds(plugin, "startScreenshotSchedule",
+                            {{EncodableValue("interval"), EncodableValue(10)},
+                             {EncodableValue("directory"),
+                              EncodableValue(directory.u8string())}}));
+  EXPECT_FALSE(CallSucceeds(plugin, "startScreenshotSchedule",
+                            {{EncodableValue("interval"), EncodableValue(100)}}));
+
+  ASSERT_TRUE(CallSucceeds(plugin, "startScreenshotSchedule",
+                           {{EncodableValue("interval"), EncodableValue(100)},
+                            {EncodableValue("directory"),
+                             EncodableValue(directory.u8string())},
+                            {EncodableValue("maxWidth"), EncodableValue(320)},
+                            {EncodableValue("skipWhenIdle"), EncodableValue(false)},
+                            {EncodableValue("skipUnchanged"), EncodableValue(false)}}));
+  std::vector<std::filesystem::path> files;
+  for (int i = 0; i < 50 && files.size() < 2; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    files.clear();
+    for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+      if (entry.path().extension() == ".png") {
+        files.push_back(entry.path());
+      }
+    }
+  }
+  EXPECT_TRUE(CallSucceeds(plugin, "stopScreenshotSchedule", {}));
+  if (files.empty()) {
+    std::filesystem::remove_all(directory);
+    GTEST_SKIP() << "No desktop to capture";
+  }
+  EXPECT_GE(files.size(), 2u);
+  for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+    EXPECT_NE(entry.path().extension(), ".part") << entry.path();
+    EXPECT_GT(std::filesystem::file_size(entry.path()), 0u);
+  }
+  std::filesystem::remove_all(directory);
+}
+
+TEST(WindowFocusPlugin, ScreenshotRing) {
+  WindowFocusPlugin plugin;
+  EXPECT_FALSE(CallSucceeds(plugin, "startScreenshotRing",
+                            {{EncodableValue("frames"), EncodableValue(0)}}));
+  ASSERT_TRUE(CallSucceeds(plugin, "startScreenshotRing",
+                           {{EncodableValue("interval"), EncodableValue(100)},
+                            {EncodableValue("frames"), EncodableValue(3)},
+                            {EncodableValue("format"), EncodableValue("qoi")},
+                            {EncodableValue("maxWidth"), EncodableValue(320)}}));
+  flutter::EncodableList frames;
+  for (int i = 0; i < 50 && frames.size() < 3; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    auto reply = Call(plugin, "getRecentFrames", {{EncodableValue("count"), EncodableValue(10)}});
+    ASSERT_NE(reply, nullptr);
+    frames = std::get<flutter::EncodableList>(*reply);
+  }
+  if (frames.empty()) {
+    EXPECT_TRUE(CallSucceeds(plugin, "stopScreenshotRing", {}));
+    GTEST_SKIP() << "No desktop to capture";
+  }
+  // No more than three frames, newest first.
+  ASSERT_EQ(frames.size(), 3u);
+  int64_t previous = INT64_MAX;
+  for (const EncodableValue& value : frames) {
+    const auto& frame = std::get<EncodableMap>(value);
+    EXPECT_EQ(std::get<std::string>(frame.at(EncodableValue("format"))), "qoi");
+    EXPECT_LE(std::get<int32_t>(frame.at(EncodableValue("width"))), 320);
+    const int64_t timestamp = std::get<int64_t>(frame.at(EncodableValue("timestamp")));
+    EXPECT_LE(timestamp, previous);
+    previous = timestamp;
+  }
+
+  // A matching takeScreenshot returns a stored frame without capturing.
+  const auto start = std::chrono::steady_clock::now();
+  auto reply = Call(plugin, "takeScreenshot",
+                    {{EncodableValue("format"), EncodableValue("qoi")},
+                     {EncodableValue("maxWidth"), EncodableValue(320)}});
+  const std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  ASSERT_NE(reply, nullptr);
+  const std::vector<uint8_t> qoi = std::get<std::vector<uint8_t>>(*reply);
+  reply = Call(plugin, "getRecentFrames", {{EncodableValue("count"), EncodableValue(3)}});
+  ASSERT_NE(reply, nullptr);
+  frames = std::get<flutter::EncodableList>(*reply);
+  EXPECT_TRUE(std::any_of(frames.begin(), frames.end(), [&qoi](const EncodableValue& value) {
+    const auto& frame = std::get<EncodableMap>(value);
+    return std::get<std::vector<uint8_t>>(frame.at(EncodableValue("data"))) == qoi;
+  }));
+  std::cout << "[Screenshot] ring frame in " << elapsed.count() << " ms" << std::endl;
+
+  EXPECT_TRUE(CallSucceeds(plugin, "stopScreenshotRing", {}));
+  reply = Call(plugin, "getRecentFrames", {});
+  ASSERT_NE(reply, nullptr);
+  EXPECT_TRUE(std::get<flutter::EncodableList>(*reply).empty());
+}
+
+TEST(WindowFocusPlugin, ScreenshotWorkers) {
+  WindowFocusPlugin plugin;
+  if (Call(plugin, "takeScreenshotRaw", {}) == nullptr) {
+    GTEST_SKIP() << "No desktop to capture";
+  }
+
+  // HandleMethodCall returns before the screenshots are taken; requests for
+  // one target share a capture, and distinct targets beyond the queue limit
+  // are refused.
+  Replies replies;
+  constexpr int kRequests = 16;
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kRequests; i++) {
+    plugin.HandleMethodCall(
+        MethodCall("takeScreenshot",
+                   std::make_unique<EncodableValue>(EncodableMap{
+                       {EncodableValue("format"), EncodableValue("qoi")},
+                       {EncodableValue("maxWidth"), EncodableValue(100 + i % 12)}})),
+        replies.Result());
+  }
+  const std::chrono::duration<double, std::milli> submitted =
+      std::chrono::steady_clock::now() - start;
+  std::vector<std::string> codes = replies.WaitFor(kRequests);
+  ASSERT_EQ(codes.size(), static_cast<size_t>(kRequests));
+  const auto busy = std::count(codes.begin(), codes.end(), "SCREENSHOT_BUSY");
+  EXPECT_EQ(std::count(codes.begin(), codes.end(), "") + busy, kRequests);
+  std::cout << "[Screenshot] " << kRequests << " requests submitted in "
+            << submitted.count() << " ms, " << busy << " refused" << std::endl;
+
+  // Cancelling answers every request not answered yet.
+  Replies cancelled;
+  for (int i = 0; i < 4; i++) {
+    plugin.HandleMethodCall(
+        MethodCall("takeScreenshotRaw",
+                   std::make_unique<EncodableValue>(EncodableMap{
+                       {EncodableValue("maxWidth"), EncodableValue(100 + i)}})),
+        cancelled.Result());
+  }
+  auto reply = Call(plugin, "cancelScreenshots", {});
+  ASSERT_NE(reply, nullptr);
+  const int64_t count = std::get<int64_t>(*reply);
+  codes = cancelled.WaitFor(4);
+  ASSERT_EQ(codes.size(), 4u);
+  EXPECT_EQ(std::count(codes.begin(), codes.end(), "SCREENSHOT_CANCELLED"), count);
+  EXPECT_EQ(std::count(codes.begin(), codes.end(), "") + count, 4);
+}
+
+TEST(WindowFocusPlugin, MonitorScreenshots) {
+  WindowFocusPlugin plugin;
+  auto reply = Call(plugin, "getMonitors", {});
+  ASSERT_NE(reply, nullptr);
+  const auto& monitors = std::get<EncodableList>(*reply);
+  if (monitors.empty()) {
+    GTEST_SKIP() << "No monitors";
+  }
+  int primaries = 0;
+  for (const EncodableValue& value : monitors) {
+    const auto& monitor = std::get<EncodableMap>(value);
+    EXPECT_GT(std::get<int>(monitor.at(EncodableValue("width"))), 0);
+    EXPECT_GT(std::get<int>(monitor.at(EncodableValue("height"))), 0);
+    EXPECT_GE(std::get<double>(monitor.at(EncodableValue("scale"))), 1.0);
+    primaries += std::get<bool>(monitor.at(EncodableValue("primary"))) ? 1 : 0;
+  }
+  EXPECT_EQ(primaries, 1);
+
+  // One monitor is captured at its own size.
+  const auto& last = std::get<EncodableMap>(monitors.back());
+  const int id = std::get<int>(last.at(EncodableValue("id")));
+  reply = Call(plugin, "takeScreenshotRaw", {{EncodableValue("monitor"), EncodableValue(id)}});
+  ASSERT_NE(reply, nullptr);
+  const auto& raw = std::get<EncodableMap>(*reply);
+  EXPECT_EQ(std::get<int>(raw.at(EncodableValue("width"))),
+            std::get<int>(last.at(EncodableValue("width"))));
+  EXPECT_EQ(std::get<int>(raw.at(EncodableValue("height"))),
+            std::get<int>(last.at(EncodableValue("height"))));
+  EXPECT_EQ(Call(plugin, "takeScreenshotRaw",
+                 {{EncodableValue("monitor"), EncodableValue(static_cast<int>(monitors.size()))}}),
+            nullptr);
+
+  // Every monitor at once, by id.
+  reply = Call(plugin, "takeMonitorScreenshots",
+               {{EncodableValue("format"), EncodableValue("qoi")},
+                {EncodableValue("maxWidth"), EncodableValue(320)}});
+  ASSERT_NE(reply, nullptr);
+  const auto& screenshots = std::get<EncodableMap>(*reply);
+  ASSERT_EQ(screenshots.size(), monitors.size());
+  for (const auto& entry : screenshots) {
+    EXPECT_FALSE(std::get<std::vector<uint8_t>>(entry.second).empty());
+  }
+}
+
+TEST(WindowFocusPlugin, RegionAndWindowScreenshots) {
+  WindowFocusPlugin plugin;
+  const int left = GetSystemMetrics(SM_XVIRTUALSCREEN);
+  const int top = GetSystemMetrics(SM_YVIRTUALSCREEN);
+  const EncodableMap region = {{EncodableValue("x"), EncodableValue(left + 8)},
+                               {EncodableValue("y"), EncodableValue(top + 4)},
+                               {EncodableValue("width"), EncodableValue(40)},
+                               {EncodableValue("height"), EncodableValue(30)}};
+  auto reply =
+      Call(plugin, "takeScreenshotRaw", {{EncodableValue("region"), EncodableValue(region)}});
+  ASSERT_NE(reply, nullptr);
+  const auto& raw = std::get<EncodableMap>(*reply);
+  EXPECT_EQ(std::get<int>(raw.at(EncodableValue("width"))), 40);
+  EXPECT_EQ(std::get<int>(raw.at(EncodableValue("height"))), 30);
+  // One target at a time.
+  EXPECT_EQ(Call(plugin, "takeScreenshotRaw",
+                 {{EncodableValue("region"), EncodableValue(region)},
+                  {EncodableValue("monitor"), EncodableValue(0)}}),
+            nullptr);
+
+  // A bordered window, with and without its frame.
+  HWND window = CreateWindowExW(WS_EX_TOPMOST, L"STATIC", L"", WS_POPUP | WS_VISIBLE | WS_BORDER,
+                                left + 10, top + 10, 64, 48, nullptr, nullptr,
+                                GetModuleHandle(nullptr), nullptr);
+  ASSERT_NE(window, nullptr);
+  RECT client;
+  ASSERT_TRUE(GetClientRect(window, &client));
+  const EncodableValue id(static_cast<int64_t>(reinterpret_cast<intptr_t>(window)));
+  reply = Call(plugin, "takeScreenshotRaw", {{EncodableValue("window"), id}});
+  ASSERT_NE(reply, nullptr);
+  EXPECT_EQ(std::get<int>(std::get<EncodableMap>(*reply).at(EncodableValue("width"))), 64);
+  reply = Call(plugin, "takeScreenshotRaw",
+               {{EncodableValue("window"), id},
+                {EncodableValue("clientAreaOnly"), EncodableValue(true)}});
+  ASSERT_NE(reply, nullptr);
+  EXPECT_EQ(std::get<int>(std::get<EncodableMap>(*reply).at(EncodableValue("width"))),
+            client.right);
+  EXPECT_EQ(std::get<int>(std::get<EncodableMap>(*reply).at(EncodableValue("height"))),
+            client.bottom);
+  DestroyWindow(window);
+  EXPECT_EQ(Call(plugin, "takeScreenshotRaw", {{EncodableValue("window"), id}}), nullptr);
+}
+
+TEST(CaptureContext, RecyclesSurfacesBuffersAndEncoders) {
+  CaptureContext context;
+  ASSERT_TRUE(context.StartGdiplus());
+  CLSID png;
+  CLSID again;
+  ASSERT_TRUE(context.FindEncoder(L"image/png", &png));
+  ASSERT_TRUE(context.FindEncoder(L"image/png", &again));
+  EXPECT_TRUE(IsEqualCLSID(png, again));
+  EXPECT_FALSE(context.FindEncoder(L"image/none", &again));
+
+  // A surface of the same size comes back with the same memory.
+  uint8_t* first = nullptr;
+  uint8_t* second = nullptr;
+  {
+    auto surface = context.AcquireSurface(64, 32);
+    auto other = context.AcquireSurface(64, 32);
+    ASSERT_NE(surface, nullptr);
+    ASSERT_NE(other, nullptr);
+    first = surface->bits;
+    second = other->bits;
+    EXPECT_NE(first, second);
+  }
+  EXPECT_EQ(context.IdleSurfaces(), 2u);
+  auto surface = context.AcquireSurface(64, 32);
+  ASSERT_NE(surface, nullptr);
+  EXPECT_TRUE(surface->bits == first || surface->bits == second);
+  EXPECT_EQ(context.IdleSurfaces(), 1u);
+
+  std::vector<uint8_t> buffer(1000);
+  const uint8_t* data = buffer.data();
+  context.ReleaseBuffer(std::move(buffer));
+  buffer = context.AcquireBuffer(500);
+  EXPECT_EQ(buffer.data(), data);
+  EXPECT_TRUE(buffer.empty());
+  EXPECT_EQ(context.IdleBuffers(), 0u);
+}
+
+TEST(InputDeviceStats, RecordInputUpdatesTheCounters) {
+  InputDeviceStats stats;
+  EXPECT_EQ(stats.event_count.load(), 0u);
+  EXPECT_EQ(stats.last_activity_ms.load(), 0);
+
+  const int64_t beforeMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+  stats.RecordInput();
+  stats.RecordInput();
+  EXPECT_EQ(stats.event_count.load(), 2u);
+  EXPECT_GE(stats.last_activity_ms.load(), beforeMs);
+}
+
+TEST(HIDReportFilter, FirstReportIsTheBaseline) {
+  HIDAxisField axis;
+  axis.reportId = 1;
+  axis.bitOffset = 16;
+  axis.bitSize = 8;
+  axis.logicalMin = 0;
+  axis.logicalMax = 255;
+  HIDReportFilter filter(5, {axis}, 0.05);
+
+  // Report 1: buttons, a centred stick, a battery level and a sensor reading.
+  const auto now = std::chrono::steady_clock::now();
+  BYTE report[5] = {0x01, 0x00, 0x80, 0x5C, 0x17};
+  EXPECT_FALSE(filter.Update(report, sizeof(report), now));
+  EXPECT_FALSE(filter.Update(report, sizeof(report), now));
+
+  // Compared with the first report from then on.
+  report[1] = 0x01;
+  EXPECT_TRUE(filter.Update(report, sizeof(report), now));
+  report[2] = 0xF0;
+  EXPECT_TRUE(filter.Update(report, sizeof(report), now));
+}
+
 }  // namespace test
 }  // namespace window_focus
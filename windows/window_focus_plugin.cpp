@@ -27,18 +27,37 @@
 #include <sstream>
 #include <vector>
 #include <algorithm>
+#include <cwctype>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
 #include <gdiplus.h>
+#include <ShellScalingApi.h>
 #include <setupapi.h>
 #include <hidclass.h>
 #include <functiondiscoverykeys_devpkey.h>
+#include <audiopolicy.h>
 #include <mutex>
 #include <atomic>
 #include <condition_variable>
+#include <filesystem>
+#include <iterator>
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <emmintrin.h>
+#elif defined(_M_ARM64)
+#include <arm_neon.h>
+#endif
+
+#include "image_scaler.h"
+#include "pixel_format.h"
+#include "screenshot_encoder.h"
 
 #pragma comment(lib, "gdiplus.lib")
 #pragma comment(lib, "XInput.lib")
 #pragma comment(lib, "setupapi.lib")
 #pragma comment(lib, "hid.lib")
+#pragma comment(lib, "cfgmgr32.lib")
 
 namespace window_focus {
 
@@ -126,65 +145,6 @@ private:
     HDC hdc_;
 };
 
-class CompatibleDc {
-public:
-    CompatibleDc(HDC hdc) : hdc_(nullptr) {
-        hdc_ = CreateCompatibleDC(hdc);
-    }
-    ~CompatibleDc() {
-        if (hdc_) {
-            DeleteDC(hdc_);
-        }
-    }
-    HDC Get() const { return hdc_; }
-    operator bool() const { return hdc_ != nullptr; }
-
-    CompatibleDc(const CompatibleDc&) = delete;
-    CompatibleDc& operator=(const CompatibleDc&) = delete;
-
-private:
-    HDC hdc_;
-};
-
-class BitmapHandle {
-public:
-    BitmapHandle(HBITMAP bmp) : bmp_(bmp) {}
-    ~BitmapHandle() {
-        if (bmp_) {
-            DeleteObject(bmp_);
-        }
-    }
-    HBITMAP Get() const { return bmp_; }
-    operator bool() const { return bmp_ != nullptr; }
-
-    BitmapHandle(const BitmapHandle&) = delete;
-    BitmapHandle& operator=(const BitmapHandle&) = delete;
-
-private:
-    HBITMAP bmp_;
-};
-
-class SelectedObject {
-public:
-    SelectedObject(HDC hdc, HGDIOBJ obj) : hdc_(hdc), old_(nullptr) {
-        if (hdc && obj) {
-            old_ = SelectObject(hdc, obj);
-        }
-    }
-    ~SelectedObject() {
-        if (hdc_ && old_) {
-            SelectObject(hdc_, old_);
-        }
-    }
-
-    SelectedObject(const SelectedObject&) = delete;
-    SelectedObject& operator=(const SelectedObject&) = delete;
-
-private:
-    HDC hdc_;
-    HGDIOBJ old_;
-};
-
 // =====================================================================
 // SEH-isolated helper functions
 // =====================================================================
@@ -234,6 +194,15 @@ static bool GetHIDAttributesSEH(HANDLE deviceHandle, HIDD_ATTRIBUTES* attributes
     }
 }
 
+static bool GetHIDProductStringSEH(HANDLE deviceHandle, WCHAR* buffer, ULONG bufferBytes) {
+    __try {
+        return HidD_GetProductString(deviceHandle, buffer, bufferBytes) ? true : false;
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER) {
+        return false;
+    }
+}
+
 static bool GetHIDPreparsedDataSEH(HANDLE deviceHandle, PHIDP_PREPARSED_DATA* preparsedData) {
     __try {
         return HidD_GetPreparsedData(deviceHandle, preparsedData) ? true : false;
@@ -252,54 +221,580 @@ static bool GetHIDCapsSEH(PHIDP_PREPARSED_DATA preparsedData, HIDP_CAPS* caps) {
     }
 }
 
-static bool GetAudioPeakValueSEH(float* peakValue, bool* comErrorOut) {
-    IMMDeviceEnumerator* deviceEnumerator = nullptr;
-    IMMDevice* defaultDevice = nullptr;
-    IAudioMeterInformation* meterInfo = nullptr;
-    bool success = false;
+static bool GetHIDValueCapsSEH(PHIDP_PREPARSED_DATA preparsedData,
+                               HIDP_VALUE_CAPS* valueCaps, USHORT* count) {
+    __try {
+        return (HidP_GetValueCaps(HidP_Input, valueCaps, count, preparsedData) == HIDP_STATUS_SUCCESS);
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER) {
+        return false;
+    }
+}
+
+static bool SetHIDUsageValueSEH(PHIDP_PREPARSED_DATA preparsedData, const HIDP_VALUE_CAPS* cap,
+                                USAGE usage, ULONG value, BYTE* report, ULONG reportLength) {
+    __try {
+        return (HidP_SetUsageValue(HidP_Input, cap->UsagePage, cap->LinkCollection, usage, value,
+                                   preparsedData, reinterpret_cast<PCHAR>(report),
+                                   reportLength) == HIDP_STATUS_SUCCESS);
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER) {
+        return false;
+    }
+}
+
+// Finds the absolute value fields (sticks, triggers, wheels) of the input
+// reports. HidP does not expose bit offsets, so each field is located by
+// writing an all-ones value into a zeroed report and looking for the bits
+// that were set.
+static void CollectHIDAxes(PHIDP_PREPARSED_DATA preparsedData, const HIDP_CAPS& caps,
+                           std::vector<HIDAxisField>* axes) {
+    if (caps.NumberInputValueCaps == 0 || caps.InputReportByteLength < 2) {
+        return;
+    }
+
+    USHORT count = caps.NumberInputValueCaps;
+    std::vector<HIDP_VALUE_CAPS> valueCaps(count);
+    if (!GetHIDValueCapsSEH(preparsedData, valueCaps.data(), &count)) {
+        return;
+    }
+
+    std::vector<BYTE> probe(caps.InputReportByteLength);
+    for (USHORT c = 0; c < count; c++) {
+        const HIDP_VALUE_CAPS& cap = valueCaps[c];
+        if (!cap.IsAbsolute || cap.BitSize < 2 || cap.BitSize > 32) {
+            continue;
+        }
+
+        const ULONG allOnes = cap.BitSize == 32 ? 0xFFFFFFFFUL : ((1UL << cap.BitSize) - 1);
+        LONG logicalMin = cap.LogicalMin;
+        LONG logicalMax = cap.LogicalMax;
+        // Many devices encode 0..255 as a one byte 0xFF, which reads as -1.
+        if (logicalMax < logicalMin) {
+            logicalMax = static_cast<LONG>(static_cast<ULONG>(logicalMax) & allOnes);
+        }
+        if (static_cast<LONGLONG>(logicalMax) - logicalMin <= 1) {
+            continue;
+        }
+
+        const USAGE firstUsage = cap.IsRange ? cap.Range.UsageMin : cap.NotRange.Usage;
+        const USAGE lastUsage = cap.IsRange ? cap.Range.UsageMax : cap.NotRange.Usage;
+        for (ULONG usage = firstUsage; usage <= lastUsage; usage++) {
+            std::fill(probe.begin(), probe.end(), static_cast<BYTE>(0));
+            probe[0] = cap.ReportID;
+            if (!SetHIDUsageValueSEH(preparsedData, &cap, static_cast<USAGE>(usage), allOnes,
+                                     probe.data(), static_cast<ULONG>(probe.size()))) {
+                continue;
+            }
+            for (ULONG bit = 8; bit < probe.size() * 8; bit++) {
+                if ((probe[bit / 8] >> (bit % 8)) & 1) {
+                    HIDAxisField field;
+                    field.reportId = cap.ReportID;
+                    field.bitOffset = bit;
+                    field.bitSize = cap.BitSize;
+                    field.logicalMin = logicalMin;
+                    field.logicalMax = logicalMax;
+                    axes->push_back(field);
+                    break;
+                }
+            }
+        }
+    }
+}
+
+// Reads the attributes and top-level capabilities of an open HID interface.
+static bool QueryHIDDeviceInfo(HANDLE deviceHandle, HIDDeviceInfo* info) {
+    HIDD_ATTRIBUTES attributes;
+    attributes.Size = sizeof(HIDD_ATTRIBUTES);
+    if (!GetHIDAttributesSEH(deviceHandle, &attributes)) {
+        return false;
+    }
+
+    PHIDP_PREPARSED_DATA preparsedData = nullptr;
+    if (!GetHIDPreparsedDataSEH(deviceHandle, &preparsedData)) {
+        return false;
+    }
+
+    HIDP_CAPS caps;
+    ZeroMemory(&caps, sizeof(caps));
+    bool success = GetHIDCapsSEH(preparsedData, &caps);
+    if (success) {
+        CollectHIDAxes(preparsedData, caps, &info->axes);
+    }
+    if (preparsedData) {
+        HidD_FreePreparsedData(preparsedData);
+    }
+    if (!success) {
+        return false;
+    }
+
+    info->vendorId = attributes.VendorID;
+    info->productId = attributes.ProductID;
+    info->usagePage = caps.UsagePage;
+    info->usage = caps.Usage;
+    info->inputReportByteLength = caps.InputReportByteLength;
+
+    // Optional; some devices stall or fail string requests.
+    WCHAR productName[128] = {};
+    if (GetHIDProductStringSEH(deviceHandle, productName, sizeof(productName) - sizeof(WCHAR))) {
+        info->productName = productName;
+    }
+    return true;
+}
+
+// Returns why a HID interface is not monitored, or nullptr if it is.
+static const char* GetHIDSkipReason(const HIDDeviceInfo& info) {
+    if (info.usagePage == 0x0B || info.usagePage == 0x0C) return "audio";
+    if (info.usagePage == 0x01 && info.usage == 0x06) return "keyboard";
+    if (info.usagePage == 0x01 && info.usage == 0x02) return "mouse";
+    if (info.inputReportByteLength == 0) return "no input";
+    return nullptr;
+}
+
+// SetupAPI and CM notifications spell the same interface path with
+// different casing, so paths are compared lowercased.
+static std::wstring NormalizeHIDDevicePath(const std::wstring& devicePath) {
+    std::wstring normalized = devicePath;
+    std::transform(normalized.begin(), normalized.end(), normalized.begin(), ::towlower);
+    return normalized;
+}
+
+// Pixel conversion, thumbnails and the screenshot encoders are shared with
+// the Linux plugin (see ../shared); the functions below adapt them to
+// RawScreenshot.
+
+// Makes |count| 32-bit DIB pixels (BGRX, alpha undefined) opaque BGRA in
+// place, or RGBA with |swapRedBlue|.
+static void ConvertScreenshotPixels(BYTE* pixels, size_t count, bool swapRedBlue) {
+    ConvertBgrxPixels(pixels, pixels, count, swapRedBlue ? PixelFormat::kRgba : PixelFormat::kBgra);
+}
+
+// Shrinks captured BGRX |pixels| to |scaled|'s width and height by area
+// averaging, as opaque BGRA or RGBA pixels written into its buffer.
+static void DownscaleScreenshot(const uint8_t* pixels, int sourceWidth, int sourceHeight,
+                                int sourceStride, bool rgba, RawScreenshot* scaled) {
+    scaled->stride = scaled->width * 4;
+    scaled->format = rgba ? "rgba" : "bgra";
+    scaled->pixels.resize(static_cast<size_t>(scaled->stride) * scaled->height);
+    DownscaleBgrxPixels(pixels, sourceWidth, sourceHeight, sourceStride, scaled->pixels.data(),
+                        scaled->width, scaled->height, scaled->stride,
+                        rgba ? PixelFormat::kRgba : PixelFormat::kBgra);
+}
+
+// The formats takeScreenshot can return, in the order getScreenshotFormats
+// lists them: the shared encoders, plus JPEG through GDI+ when libjpeg-turbo
+// is missing. GDI+ encoders have no encode function and save the captured
+// bitmap instead.
+static const std::vector<ScreenshotEncoder>& PluginScreenshotEncoders() {
+    static const std::vector<ScreenshotEncoder> encoders = [] {
+        std::vector<ScreenshotEncoder> list = ScreenshotEncoders();
+#ifndef WINDOW_FOCUS_HAVE_TURBOJPEG
+        list.insert(list.begin() + 1, ScreenshotEncoder{"jpeg", true, nullptr});
+#endif
+        return list;
+    }();
+    return encoders;
+}
+
+static const ScreenshotEncoder* FindScreenshotEncoder(const std::string& name) {
+    for (const ScreenshotEncoder& encoder : PluginScreenshotEncoders()) {
+        if (name == encoder.name) {
+            return &encoder;
+        }
+    }
+    return nullptr;
+}
+
+// Reads the optional "maxWidth" and "maxHeight" arguments of the screenshot
+// methods into |limits| (0 for no limit). Returns the error message for an
+// invalid value, or an empty string.
+static std::string ReadScreenshotSizeLimit(const flutter::EncodableMap& args, int limits[2]) {
+    static const char* const kKeys[] = {"maxWidth", "maxHeight"};
+    for (int i = 0; i < 2; i++) {
+        limits[i] = 0;
+        auto it = args.find(flutter::EncodableValue(kKeys[i]));
+        if (it == args.end() || it->second.IsNull()) {
+            continue;
+        }
+        if (!std::holds_alternative<int>(it->second) || std::get<int>(it->second) < 1) {
+            return std::string("Expected a positive integer for '") + kKeys[i] + "'.";
+        }
+        limits[i] = std::get<int>(it->second);
+    }
+    return std::string();
+}
+
+// Reads the optional "activeWindowOnly" and "monitor" arguments of the
+// screenshot methods into |target|. Returns the error message for an invalid
+// value, or an empty string.
+// Reads an integer argument, which the codec sends as 32 or 64 bits depending
+// on its size.
+static bool ReadInteger(const flutter::EncodableValue& value, int64_t* out) {
+    if (std::holds_alternative<int32_t>(value)) {
+        *out = std::get<int32_t>(value);
+        return true;
+    }
+    if (std::holds_alternative<int64_t>(value)) {
+        *out = std::get<int64_t>(value);
+        return true;
+    }
+    return false;
+}
+
+// Reads the optional "region" argument, a map of integer "x", "y", "width" and
+// "height" in virtual screen pixels.
+static bool ReadRegion(const flutter::EncodableValue& value, RECT* region) {
+    const auto* map = std::get_if<flutter::EncodableMap>(&value);
+    if (map == nullptr) return false;
+    int64_t fields[4] = {};
+    const char* keys[] = {"x", "y", "width", "height"};
+    for (int i = 0; i < 4; i++) {
+        auto it = map->find(flutter::EncodableValue(keys[i]));
+        if (it == map->end() || !ReadInteger(it->second, &fields[i]) ||
+            fields[i] < (i < 2 ? INT_MIN : 1) || fields[i] > INT_MAX) {
+            return false;
+        }
+    }
+    if (fields[0] + fields[2] > INT_MAX || fields[1] + fields[3] > INT_MAX) return false;
+    *region = RECT{static_cast<LONG>(fields[0]), static_cast<LONG>(fields[1]),
+                   static_cast<LONG>(fields[0] + fields[2]),
+                   static_cast<LONG>(fields[1] + fields[3])};
+    return true;
+}
+
+// Reads the optional "activeWindowOnly", "window", "clientAreaOnly", "region"
+// and "monitor" arguments of the screenshot methods. At most one of the
+// foreground window, a window, a region and a monitor can be asked for.
+// Returns an error message, or an empty string.
+static std::string ReadCaptureTarget(const flutter::EncodableMap& args, CaptureTarget* target) {
+    auto it = args.find(flutter::EncodableValue("activeWindowOnly"));
+    if (it != args.end() && std::holds_alternative<bool>(it->second)) {
+        target->activeWindowOnly = std::get<bool>(it->second);
+    }
+    it = args.find(flutter::EncodableValue("window"));
+    if (it != args.end() && !it->second.IsNull()) {
+        if (!ReadInteger(it->second, &target->window) || target->window <= 0) {
+            return "Expected a window id for 'window'.";
+        }
+    }
+    it = args.find(flutter::EncodableValue("clientAreaOnly"));
+    if (it != args.end() && std::holds_alternative<bool>(it->second)) {
+        target->clientAreaOnly = std::get<bool>(it->second);
+    }
+    it = args.find(flutter::EncodableValue("region"));
+    if (it != args.end() && !it->second.IsNull() && !ReadRegion(it->second, &target->region)) {
+        return "Expected a map of integer 'x', 'y' and positive 'width' and 'height' for "
+               "'region'.";
+    }
+    it = args.find(flutter::EncodableValue("monitor"));
+    if (it != args.end() && !it->second.IsNull()) {
+        if (!std::holds_alternative<int>(it->second) || std::get<int>(it->second) < 0) {
+            return "Expected a monitor id for 'monitor'.";
+        }
+        target->monitor = std::get<int>(it->second);
+    }
+    const int targets = (target->activeWindowOnly ? 1 : 0) + (target->window != 0 ? 1 : 0) +
+                        (target->HasRegion() ? 1 : 0) + (target->monitor >= 0 ? 1 : 0);
+    if (targets > 1) {
+        return "Only one of 'activeWindowOnly', 'window', 'region' and 'monitor' can be given.";
+    }
+    if (target->clientAreaOnly && !target->activeWindowOnly && target->window == 0) {
+        return "'clientAreaOnly' needs 'activeWindowOnly' or 'window'.";
+    }
+    return std::string();
+}
+
+// Answers takeMonitorScreenshots once each monitor's request is answered:
+// with the screenshots by monitor id, or with the most telling error among
+// them. Each part takes one request's result.
+class MonitorScreenshotCollector
+    : public std::enable_shared_from_this<MonitorScreenshotCollector> {
+public:
+    MonitorScreenshotCollector(
+        size_t count, std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result)
+        : pending_(count), result_(std::move(result)) {}
+
+    std::shared_ptr<flutter::MethodResult<flutter::EncodableValue>> Part(int monitor) {
+        return std::make_shared<PartResult>(shared_from_this(), monitor);
+    }
+
+private:
+    class PartResult : public flutter::MethodResult<flutter::EncodableValue> {
+    public:
+        PartResult(std::shared_ptr<MonitorScreenshotCollector> collector, int monitor)
+            : collector_(std::move(collector)), monitor_(monitor) {}
+
+    protected:
+        void SuccessInternal(const flutter::EncodableValue* result) override {
+            collector_->Complete(monitor_, result, std::string(), std::string());
+        }
+        void ErrorInternal(const std::string& code, const std::string& message,
+                           const flutter::EncodableValue* /*details*/) override {
+            collector_->Complete(monitor_, nullptr, code, message);
+        }
+        void NotImplementedInternal() override {
+            collector_->Complete(monitor_, nullptr, "SCREENSHOT_ERROR", "Not implemented");
+        }
+
+    private:
+        std::shared_ptr<MonitorScreenshotCollector> collector_;
+        int monitor_;
+    };
+
+    // Cancelled calls were cancelled on purpose, and a full queue says more
+    // than a failed capture.
+    static int ErrorRank(const std::string& code) {
+        if (code == "SCREENSHOT_CANCELLED") return 3;
+        if (code == "SCREENSHOT_BUSY") return 2;
+        return 1;
+    }
+
+    void Complete(int monitor, const flutter::EncodableValue* value, const std::string& code,
+                  const std::string& message) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!code.empty()) {
+            if (errorCode_.empty() || ErrorRank(code) > ErrorRank(errorCode_)) {
+                errorCode_ = code;
+                errorMessage_ = message;
+            }
+        } else if (value != nullptr) {
+            screenshots_[flutter::EncodableValue(monitor)] = *value;
+        }
+        if (--pending_ > 0) {
+            return;
+        }
+        if (!errorCode_.empty()) {
+            result_->Error(errorCode_, errorMessage_);
+        } else {
+            result_->Success(flutter::EncodableValue(std::move(screenshots_)));
+        }
+    }
+
+    std::mutex mutex_;
+    size_t pending_;
+    std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result_;
+    flutter::EncodableMap screenshots_;
+    std::string errorCode_;
+    std::string errorMessage_;
+};
+
+// The takeScreenshotRaw reply for |screenshot|.
+static flutter::EncodableValue RawScreenshotReply(RawScreenshot screenshot) {
+    flutter::EncodableMap reply;
+    reply[flutter::EncodableValue("width")] = flutter::EncodableValue(screenshot.width);
+    reply[flutter::EncodableValue("height")] = flutter::EncodableValue(screenshot.height);
+    reply[flutter::EncodableValue("stride")] = flutter::EncodableValue(screenshot.stride);
+    reply[flutter::EncodableValue("format")] =
+        flutter::EncodableValue(std::string(screenshot.format));
+    reply[flutter::EncodableValue("pixels")] =
+        flutter::EncodableValue(std::move(screenshot.pixels));
+    return flutter::EncodableValue(std::move(reply));
+}
+
+// The takeScreenshotDelta reply for |delta|.
+static flutter::EncodableValue ScreenshotDeltaReply(ScreenDelta delta) {
+    flutter::EncodableMap reply;
+    reply[flutter::EncodableValue("width")] = flutter::EncodableValue(delta.width);
+    reply[flutter::EncodableValue("height")] = flutter::EncodableValue(delta.height);
+    reply[flutter::EncodableValue("tileSize")] = flutter::EncodableValue(delta.tile_size);
+    reply[flutter::EncodableValue("sequence")] = flutter::EncodableValue(delta.sequence);
+    reply[flutter::EncodableValue("keyframe")] = flutter::EncodableValue(delta.keyframe);
+    reply[flutter::EncodableValue("tiles")] = flutter::EncodableValue(std::move(delta.tiles));
+    reply[flutter::EncodableValue("compression")] =
+        flutter::EncodableValue(std::string(delta.compression));
+    reply[flutter::EncodableValue("data")] = flutter::EncodableValue(std::move(delta.data));
+    return flutter::EncodableValue(std::move(reply));
+}
+
+// Whether |a| and |b| are answered with the same bytes from the same capture.
+static bool SameScreenshotOutput(const ScreenshotRequest& a, const ScreenshotRequest& b) {
+    if (a.raw != b.raw) {
+        return false;
+    }
+    if (a.raw) {
+        return a.rgba == b.rgba;
+    }
+    const ScreenshotEncoder* encoder = FindScreenshotEncoder(a.format);
+    return a.format == b.format && (encoder == nullptr || !encoder->lossy ||
+                                    a.quality == b.quality);
+}
+
+// Returns whether (a ^ b) & mask has any bit set.
+static bool MaskedBytesDiffer(const BYTE* a, const BYTE* b, const BYTE* mask, size_t length) {
+    size_t i = 0;
+#if defined(_M_X64) || defined(_M_IX86)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= length; i += 16) {
+        __m128i diff = _mm_xor_si128(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+        diff = _mm_and_si128(diff, _mm_loadu_si128(reinterpret_cast<const __m128i*>(mask + i)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(diff, zero)) != 0xFFFF) {
+            return true;
+        }
+    }
+#elif defined(_M_ARM64)
+    for (; i + 16 <= length; i += 16) {
+        uint8x16_t diff = vandq_u8(veorq_u8(vld1q_u8(a + i), vld1q_u8(b + i)), vld1q_u8(mask + i));
+        if (vmaxvq_u8(diff) != 0) {
+            return true;
+        }
+    }
+#endif
+    for (; i < length; i++) {
+        if (((a[i] ^ b[i]) & mask[i]) != 0) {
+            return true;
+        }
+    }
+    return false;
+}
 
-    *peakValue = 0.0f;
-    *comErrorOut = false;
+// Reads a little-endian bit field, sign extended when |isSigned|.
+static LONG ExtractHIDField(const BYTE* report, ULONG bitOffset, ULONG bitSize, bool isSigned) {
+    ULONG value = 0;
+    for (ULONG i = 0; i < bitSize; i++) {
+        const ULONG bit = bitOffset + i;
+        value |= static_cast<ULONG>((report[bit / 8] >> (bit % 8)) & 1) << i;
+    }
+    if (isSigned && bitSize < 32 && (value & (1UL << (bitSize - 1))) != 0) {
+        value |= ~((1UL << bitSize) - 1);
+    }
+    return static_cast<LONG>(value);
+}
 
+static bool CreateAudioEnumeratorSEH(IMMDeviceEnumerator** enumerator, bool* comErrorOut) {
     __try {
         HRESULT hr = CoCreateInstance(
             __uuidof(MMDeviceEnumerator),
             nullptr,
             CLSCTX_ALL,
             __uuidof(IMMDeviceEnumerator),
-            (void**)&deviceEnumerator
+            (void**)enumerator
         );
+        return SUCCEEDED(hr) && *enumerator != nullptr;
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER) {
+        *comErrorOut = true;
+        return false;
+    }
+}
 
-        if (SUCCEEDED(hr) && deviceEnumerator) {
-            hr = deviceEnumerator->GetDefaultAudioEndpoint(
-                eRender, eConsole, &defaultDevice
-            );
-        }
+static bool SetAudioNotificationClientSEH(IMMDeviceEnumerator* enumerator,
+                                          IMMNotificationClient* client, bool registerClient) {
+    __try {
+        HRESULT hr = registerClient
+            ? enumerator->RegisterEndpointNotificationCallback(client)
+            : enumerator->UnregisterEndpointNotificationCallback(client);
+        return SUCCEEDED(hr);
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER) {
+        return false;
+    }
+}
 
-        if (SUCCEEDED(hr) && defaultDevice) {
-            hr = defaultDevice->Activate(
+static bool ActivateDefaultAudioMeterSEH(IMMDeviceEnumerator* enumerator, IMMDevice** device,
+                                         IAudioMeterInformation** meter, bool* comErrorOut) {
+    __try {
+        HRESULT hr = enumerator->GetDefaultAudioEndpoint(eRender, eConsole, device);
+        if (SUCCEEDED(hr) && *device) {
+            hr = (*device)->Activate(
                 __uuidof(IAudioMeterInformation),
                 CLSCTX_ALL,
                 nullptr,
-                (void**)&meterInfo
+                (void**)meter
             );
         }
+        return SUCCEEDED(hr) && *meter != nullptr;
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER) {
+        *comErrorOut = true;
+        return false;
+    }
+}
 
-        if (SUCCEEDED(hr) && meterInfo) {
-            hr = meterInfo->GetPeakValue(peakValue);
-            success = SUCCEEDED(hr);
-        }
+static bool GetAudioPeakValueSEH(IAudioMeterInformation* meter, float* peakValue, bool* comErrorOut) {
+    __try {
+        return SUCCEEDED(meter->GetPeakValue(peakValue));
     }
     __except (EXCEPTION_EXECUTE_HANDLER) {
-        success = false;
         *comErrorOut = true;
+        return false;
     }
+}
 
-    __try { if (meterInfo) meterInfo->Release(); } __except(EXCEPTION_EXECUTE_HANDLER) {}
-    __try { if (defaultDevice) defaultDevice->Release(); } __except(EXCEPTION_EXECUTE_HANDLER) {}
-    __try { if (deviceEnumerator) deviceEnumerator->Release(); } __except(EXCEPTION_EXECUTE_HANDLER) {}
+static void ReleaseComObjectSEH(IUnknown* object) {
+    __try {
+        if (object) object->Release();
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER) {
+    }
+}
 
-    return success;
+// Lists the audio sessions on the default output with the process that owns
+// each and its current peak. Sessions shared by several processes report
+// process 0. Returns false if the sessions could not be enumerated.
+static bool GetAudioSessionPeaksSEH(DWORD* processIds, float* peaks, UINT capacity,
+                                    UINT* countOut, bool* comErrorOut) {
+    *countOut = 0;
+    IMMDeviceEnumerator* enumerator = nullptr;
+    IMMDevice* device = nullptr;
+    IAudioSessionManager2* manager = nullptr;
+    IAudioSessionEnumerator* sessions = nullptr;
+    HRESULT hr = E_FAIL;
+    __try {
+        hr = CoCreateInstance(__uuidof(MMDeviceEnumerator), nullptr, CLSCTX_ALL,
+                              __uuidof(IMMDeviceEnumerator), (void**)&enumerator);
+        if (SUCCEEDED(hr)) {
+            hr = enumerator->GetDefaultAudioEndpoint(eRender, eConsole, &device);
+        }
+        if (SUCCEEDED(hr)) {
+            hr = device->Activate(__uuidof(IAudioSessionManager2), CLSCTX_ALL, nullptr,
+                                  (void**)&manager);
+        }
+        if (SUCCEEDED(hr)) {
+            hr = manager->GetSessionEnumerator(&sessions);
+        }
+        int sessionCount = 0;
+        if (SUCCEEDED(hr)) {
+            hr = sessions->GetCount(&sessionCount);
+        }
+        for (int i = 0; SUCCEEDED(hr) && i < sessionCount && *countOut < capacity; i++) {
+            IAudioSessionControl* control = nullptr;
+            if (FAILED(sessions->GetSession(i, &control)) || control == nullptr) {
+                continue;
+            }
+            IAudioSessionControl2* control2 = nullptr;
+            IAudioMeterInformation* meter = nullptr;
+            DWORD processId = 0;
+            float peak = 0.0f;
+            if (SUCCEEDED(control->QueryInterface(__uuidof(IAudioSessionControl2),
+                                                  (void**)&control2))) {
+                // AUDCLNT_S_NO_SINGLE_PROCESS leaves the process ID at 0.
+                if (control2->GetProcessId(&processId) != S_OK) {
+                    processId = 0;
+                }
+                control2->Release();
+            }
+            if (SUCCEEDED(control->QueryInterface(__uuidof(IAudioMeterInformation),
+                                                  (void**)&meter))) {
+                meter->GetPeakValue(&peak);
+                meter->Release();
+            }
+            control->Release();
+            processIds[*countOut] = processId;
+            peaks[*countOut] = peak;
+            (*countOut)++;
+        }
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER) {
+        *comErrorOut = true;
+        hr = E_FAIL;
+    }
+    ReleaseComObjectSEH(sessions);
+    ReleaseComObjectSEH(manager);
+    ReleaseComObjectSEH(device);
+    ReleaseComObjectSEH(enumerator);
+    return SUCCEEDED(hr);
 }
 
 static DWORD XInputGetStateSEH(DWORD dwUserIndex, XINPUT_STATE* pState, bool* exceptionOccurred) {
@@ -339,12 +834,16 @@ static bool CloseHandleSEH(HANDLE handle) {
     }
 }
 
-static bool CancelIoSEH(HANDLE handle) {
+// Cancels the read in flight on |overlapped| and waits until it has finished,
+// so its buffer and OVERLAPPED can be reused or freed.
+static void CancelOverlappedReadSEH(HANDLE handle, OVERLAPPED* overlapped) {
     __try {
-        return CancelIo(handle) ? true : false;
+        if (CancelIoEx(handle, overlapped) || GetLastError() != ERROR_NOT_FOUND) {
+            DWORD bytesRead = 0;
+            GetOverlappedResult(handle, overlapped, &bytesRead, TRUE);
+        }
     }
     __except (EXCEPTION_EXECUTE_HANDLER) {
-        return false;
     }
 }
 
@@ -646,6 +1145,10 @@ WindowFocusPlugin::~WindowFocusPlugin() {
         shutdownCv_.notify_all();
     }
 
+    StopScreenshotSchedule();
+    StopScreenshotRing();
+    StopScreenshotWorkers();
+
     // 4. Join all threads - guaranteed no use-after-free
     {
         std::lock_guard<std::mutex> lock(threadsMutex_);
@@ -657,7 +1160,13 @@ WindowFocusPlugin::~WindowFocusPlugin() {
         threads_.clear();
     }
 
-    // 5. Close HID devices
+    // 5. Wait for HID enumeration, then close HID devices
+    {
+        std::lock_guard<std::mutex> lock(hidEnumerationMutex_);
+        if (hidEnumerationThread_.joinable()) {
+            hidEnumerationThread_.join();
+        }
+    }
     CloseHIDDevices();
 
     // 6. Nullify channel under lock
@@ -728,6 +1237,16 @@ void WindowFocusPlugin::HandleMethodCall(
         return;
     }
 
+    if (method_name == "getAudioLevel") {
+        // The endpoint meter only reports a peak, so there is no RMS here.
+        const float peak = lastAudioPeak_.load();
+        flutter::EncodableMap level;
+        level[flutter::EncodableValue("peak")] = flutter::EncodableValue(static_cast<double>(peak));
+        level[flutter::EncodableValue("playing")] = flutter::EncodableValue(monitorAudio_.load() && peak > audioThreshold_);
+        result->Success(flutter::EncodableValue(level));
+        return;
+    }
+
     if (method_name == "setAudioThreshold") {
         if (const auto* args = std::get_if<flutter::EncodableMap>(method_call.arguments())) {
             auto it = args->find(flutter::EncodableValue("threshold"));
@@ -751,11 +1270,15 @@ void WindowFocusPlugin::HandleMethodCall(
                 if (std::holds_alternative<bool>(it->second)) {
                     bool newValue = std::get<bool>(it->second);
                     if (newValue && !monitorHIDDevices_) {
-                        InitializeHIDDevices();
+                        // Register before enumerating so a device plugged in
+                        // between the two is not missed.
+                        monitorHIDDevices_ = true;
+                        RegisterHIDNotifications();
+                        StartHIDEnumeration();
                     } else if (!newValue && monitorHIDDevices_) {
+                        monitorHIDDevices_ = false;
                         CloseHIDDevices();
                     }
-                    monitorHIDDevices_ = newValue;
                     std::cout << "[WindowFocus] HID device monitoring set to "
                               << (monitorHIDDevices_ ? "true" : "false") << std::endl;
                     result->Success();
@@ -767,19 +1290,55 @@ void WindowFocusPlugin::HandleMethodCall(
         return;
     }
 
-    if (method_name == "setKeyboardMonitoring") {
+    if (method_name == "setHIDAxisDeadzone") {
+        if (const auto* args = std::get_if<flutter::EncodableMap>(method_call.arguments())) {
+            auto it = args->find(flutter::EncodableValue("deadzone"));
+            if (it != args->end()) {
+                if (std::holds_alternative<double>(it->second)) {
+                    double deadzone = std::get<double>(it->second);
+                    if (deadzone >= 0.0 && deadzone < 1.0) {
+                        hidAxisDeadzone_ = deadzone;
+                        std::cout << "[WindowFocus] HID axis deadzone set to " << deadzone << std::endl;
+                        result->Success();
+                        return;
+                    }
+                }
+            }
+        }
+        result->Error("Invalid argument", "Expected a double in [0, 1) for 'deadzone'.");
+        return;
+    }
+
+    if (method_name == "setDeviceChangeEvents") {
         if (const auto* args = std::get_if<flutter::EncodableMap>(method_call.arguments())) {
             auto it = args->find(flutter::EncodableValue("enabled"));
             if (it != args->end()) {
                 if (std::holds_alternative<bool>(it->second)) {
-                    monitorKeyboard_ = std::get<bool>(it->second);
-                    std::cout << "[WindowFocus] Keyboard monitoring set to "
-                              << (monitorKeyboard_ ? "true" : "false") << std::endl;
-
-                    if (monitorKeyboard_ && !keyboardHook_) {
-                        HINSTANCE hInstance = GetModuleHandle(nullptr);
-                        keyboardHook_ = SetWindowsHookEx(WH_KEYBOARD_LL, KeyboardProc, hInstance, 0);
-                        if (!keyboardHook_) {
+                    deviceChangeEvents_ = std::get<bool>(it->second);
+                    std::cout << "[WindowFocus] Device change events set to "
+                              << (deviceChangeEvents_ ? "true" : "false") << std::endl;
+                    result->Success();
+                    return;
+                }
+            }
+        }
+        result->Error("Invalid argument", "Expected a bool for 'enabled'.");
+        return;
+    }
+
+    if (method_name == "setKeyboardMonitoring") {
+        if (const auto* args = std::get_if<flutter::EncodableMap>(method_call.arguments())) {
+            auto it = args->find(flutter::EncodableValue("enabled"));
+            if (it != args->end()) {
+                if (std::holds_alternative<bool>(it->second)) {
+                    monitorKeyboard_ = std::get<bool>(it->second);
+                    std::cout << "[WindowFocus] Keyboard monitoring set to "
+                              << (monitorKeyboard_ ? "true" : "false") << std::endl;
+
+                    if (monitorKeyboard_ && !keyboardHook_) {
+                        HINSTANCE hInstance = GetModuleHandle(nullptr);
+                        keyboardHook_ = SetWindowsHookEx(WH_KEYBOARD_LL, KeyboardProc, hInstance, 0);
+                        if (!keyboardHook_) {
                             std::cerr << "[WindowFocus] Failed to install keyboard hook: "
                                       << GetLastError() << std::endl;
                         }
@@ -814,27 +1373,415 @@ void WindowFocusPlugin::HandleMethodCall(
         result->Success(flutter::EncodableValue("Windows: example"));
     } else if (method_name == "getIdleThreshold") {
         result->Success(flutter::EncodableValue(inactivityThreshold_));
+    } else if (method_name == "getInputDevices") {
+        result->Success(flutter::EncodableValue(GetInputDevices()));
     } else if (method_name == "takeScreenshot") {
+        CaptureTarget target;
+        std::string format = "png";
+        int quality = kDefaultScreenshotQuality;
+        int sizeLimit[2] = {0, 0};
+        if (const auto* args = std::get_if<flutter::EncodableMap>(method_call.arguments())) {
+            const std::string targetError = ReadCaptureTarget(*args, &target);
+            if (!targetError.empty()) {
+                result->Error("Invalid argument", targetError);
+                return;
+            }
+            auto it = args->find(flutter::EncodableValue("format"));
+            if (it != args->end() && !it->second.IsNull()) {
+                if (!std::holds_alternative<std::string>(it->second)) {
+                    result->Error("Invalid argument", "Expected a string for 'format'.");
+                    return;
+                }
+                format = std::get<std::string>(it->second);
+                if (FindScreenshotEncoder(format) == nullptr) {
+                    result->Error("Invalid argument",
+                                  "Screenshot format '" + format + "' is not supported by this build.");
+                    return;
+                }
+            }
+            it = args->find(flutter::EncodableValue("quality"));
+            if (it != args->end() && !it->second.IsNull()) {
+                if (!std::holds_alternative<int>(it->second) || std::get<int>(it->second) < 1 ||
+                    std::get<int>(it->second) > 100) {
+                    result->Error("Invalid argument", "Expected an integer in [1, 100] for 'quality'.");
+                    return;
+                }
+                quality = std::get<int>(it->second);
+            }
+            const std::string limitError = ReadScreenshotSizeLimit(*args, sizeLimit);
+            if (!limitError.empty()) {
+                result->Error("Invalid argument", limitError);
+                return;
+            }
+        }
+        try {
+            auto screenshot = TakeScreenshotFromRing(target, format, quality, sizeLimit[0],
+                                                     sizeLimit[1]);
+            if (screenshot.has_value()) {
+                result->Success(flutter::EncodableValue(std::move(*screenshot)));
+                return;
+            }
+            ScreenshotRequest request;
+            request.target = target;
+            request.maxWidth = sizeLimit[0];
+            request.maxHeight = sizeLimit[1];
+            request.format = format;
+            request.quality = quality;
+            request.result = std::move(result);
+            if (!SubmitScreenshot(request)) {
+                request.result->Error("SCREENSHOT_BUSY",
+                                      "Too many screenshots pending, at most " +
+                                          std::to_string(kMaxQueuedScreenshots) +
+                                          " are queued.");
+            }
+        } catch (const std::exception& e) {
+            result->Error("SCREENSHOT_ERROR",
+                         std::string("Exception taking screenshot: ") + e.what());
+        } catch (...) {
+            result->Error("SCREENSHOT_ERROR", "Unknown exception taking screenshot");
+        }
+    } else if (method_name == "getMonitors") {
+        flutter::EncodableList monitors;
+        const std::vector<MonitorInfo> list = ListMonitors();
+        for (size_t i = 0; i < list.size(); i++) {
+            const MonitorInfo& monitor = list[i];
+            const RECT& bounds = monitor.bounds;
+            monitors.push_back(flutter::EncodableValue(flutter::EncodableMap{
+                {flutter::EncodableValue("id"), flutter::EncodableValue(static_cast<int>(i))},
+                {flutter::EncodableValue("name"), flutter::EncodableValue(monitor.name)},
+                {flutter::EncodableValue("x"), flutter::EncodableValue(static_cast<int>(bounds.left))},
+                {flutter::EncodableValue("y"), flutter::EncodableValue(static_cast<int>(bounds.top))},
+                {flutter::EncodableValue("width"),
+                 flutter::EncodableValue(static_cast<int>(bounds.right - bounds.left))},
+                {flutter::EncodableValue("height"),
+                 flutter::EncodableValue(static_cast<int>(bounds.bottom - bounds.top))},
+                {flutter::EncodableValue("scale"), flutter::EncodableValue(monitor.scale)},
+                {flutter::EncodableValue("primary"), flutter::EncodableValue(monitor.primary)},
+            }));
+        }
+        result->Success(flutter::EncodableValue(std::move(monitors)));
+    } else if (method_name == "takeMonitorScreenshots") {
+        std::string format = "png";
+        int quality = kDefaultScreenshotQuality;
+        int sizeLimit[2] = {0, 0};
+        if (const auto* args = std::get_if<flutter::EncodableMap>(method_call.arguments())) {
+            auto it = args->find(flutter::EncodableValue("format"));
+            if (it != args->end() && !it->second.IsNull()) {
+                if (!std::holds_alternative<std::string>(it->second)) {
+                    result->Error("Invalid argument", "Expected a string for 'format'.");
+                    return;
+                }
+                format = std::get<std::string>(it->second);
+                if (FindScreenshotEncoder(format) == nullptr) {
+                    result->Error("Invalid argument",
+                                  "Screenshot format '" + format + "' is not supported by this build.");
+                    return;
+                }
+            }
+            it = args->find(flutter::EncodableValue("quality"));
+            if (it != args->end() && !it->second.IsNull()) {
+                if (!std::holds_alternative<int>(it->second) || std::get<int>(it->second) < 1 ||
+                    std::get<int>(it->second) > 100) {
+                    result->Error("Invalid argument", "Expected an integer in [1, 100] for 'quality'.");
+                    return;
+                }
+                quality = std::get<int>(it->second);
+            }
+            const std::string limitError = ReadScreenshotSizeLimit(*args, sizeLimit);
+            if (!limitError.empty()) {
+                result->Error("Invalid argument", limitError);
+                return;
+            }
+        }
+        TakeMonitorScreenshots(format, quality, sizeLimit[0], sizeLimit[1], std::move(result));
+    } else if (method_name == "getScreenshotFormats") {
+        flutter::EncodableList formats;
+        for (const ScreenshotEncoder& encoder : PluginScreenshotEncoders()) {
+            formats.push_back(flutter::EncodableValue(std::string(encoder.name)));
+        }
+        result->Success(flutter::EncodableValue(std::move(formats)));
+    } else if (method_name == "takeScreenshotRaw") {
+        CaptureTarget target;
+        bool rgba = false;
+        int sizeLimit[2] = {0, 0};
+        if (const auto* args = std::get_if<flutter::EncodableMap>(method_call.arguments())) {
+            const std::string targetError = ReadCaptureTarget(*args, &target);
+            if (!targetError.empty()) {
+                result->Error("Invalid argument", targetError);
+                return;
+            }
+            auto it = args->find(flutter::EncodableValue("format"));
+            if (it != args->end() && std::holds_alternative<std::string>(it->second)) {
+                const std::string& format = std::get<std::string>(it->second);
+                if (format != "bgra" && format != "rgba") {
+                    result->Error("Invalid argument", "Expected 'bgra' or 'rgba' for 'format'.");
+                    return;
+                }
+                rgba = format == "rgba";
+            }
+            const std::string limitError = ReadScreenshotSizeLimit(*args, sizeLimit);
+            if (!limitError.empty()) {
+                result->Error("Invalid argument", limitError);
+                return;
+            }
+        }
+        try {
+            auto screenshot = TakeScreenshotRawFromRing(target, rgba, sizeLimit[0], sizeLimit[1]);
+            if (screenshot.has_value()) {
+                result->Success(RawScreenshotReply(std::move(*screenshot)));
+                return;
+            }
+            ScreenshotRequest request;
+            request.target = target;
+            request.maxWidth = sizeLimit[0];
+            request.maxHeight = sizeLimit[1];
+            request.raw = true;
+            request.rgba = rgba;
+            request.result = std::move(result);
+            if (!SubmitScreenshot(request)) {
+                request.result->Error("SCREENSHOT_BUSY",
+                                      "Too many screenshots pending, at most " +
+                                          std::to_string(kMaxQueuedScreenshots) +
+                                          " are queued.");
+            }
+        } catch (const std::exception& e) {
+            result->Error("SCREENSHOT_ERROR",
+                         std::string("Exception taking screenshot: ") + e.what());
+        } catch (...) {
+            result->Error("SCREENSHOT_ERROR", "Unknown exception taking screenshot");
+        }
+    } else if (method_name == "takeScreenshotDelta") {
         bool activeWindowOnly = false;
+        bool keyframe = false;
+        int tileSize = kDefaultDeltaTileSize;
+        int keyframeInterval = kDefaultDeltaKeyframeInterval;
+        int sizeLimit[2] = {0, 0};
         if (const auto* args = std::get_if<flutter::EncodableMap>(method_call.arguments())) {
             auto it = args->find(flutter::EncodableValue("activeWindowOnly"));
             if (it != args->end() && std::holds_alternative<bool>(it->second)) {
                 activeWindowOnly = std::get<bool>(it->second);
             }
+            it = args->find(flutter::EncodableValue("keyframe"));
+            if (it != args->end() && std::holds_alternative<bool>(it->second)) {
+                keyframe = std::get<bool>(it->second);
+            }
+            it = args->find(flutter::EncodableValue("tileSize"));
+            if (it != args->end() && !it->second.IsNull()) {
+                if (!std::holds_alternative<int>(it->second) ||
+                    std::get<int>(it->second) < kMinDeltaTileSize ||
+                    std::get<int>(it->second) > kMaxDeltaTileSize) {
+                    result->Error("Invalid argument",
+                                  "Expected an integer in [" + std::to_string(kMinDeltaTileSize) +
+                                      ", " + std::to_string(kMaxDeltaTileSize) +
+                                      "] for 'tileSize'.");
+                    return;
+                }
+                tileSize = std::get<int>(it->second);
+            }
+            it = args->find(flutter::EncodableValue("keyframeInterval"));
+            if (it != args->end() && !it->second.IsNull()) {
+                if (!std::holds_alternative<int>(it->second) || std::get<int>(it->second) < 0) {
+                    result->Error("Invalid argument",
+                                  "Expected a non-negative integer for 'keyframeInterval'.");
+                    return;
+                }
+                keyframeInterval = std::get<int>(it->second);
+            }
+            const std::string limitError = ReadScreenshotSizeLimit(*args, sizeLimit);
+            if (!limitError.empty()) {
+                result->Error("Invalid argument", limitError);
+                return;
+            }
         }
         try {
-            auto screenshot = TakeScreenshot(activeWindowOnly);
-            if (screenshot.has_value()) {
-                result->Success(flutter::EncodableValue(screenshot.value()));
-            } else {
-                result->Error("SCREENSHOT_ERROR", "Failed to take screenshot");
+            ScreenshotRequest request;
+            request.target.activeWindowOnly = activeWindowOnly;
+            request.maxWidth = sizeLimit[0];
+            request.maxHeight = sizeLimit[1];
+            request.delta = ScreenshotDeltaOptions{tileSize, keyframeInterval, keyframe};
+            request.result = std::move(result);
+            if (!SubmitScreenshot(request)) {
+                request.result->Error("SCREENSHOT_BUSY",
+                                      "Too many screenshots pending, at most " +
+                                          std::to_string(kMaxQueuedScreenshots) +
+                                          " are queued.");
             }
         } catch (const std::exception& e) {
             result->Error("SCREENSHOT_ERROR",
-                         std::string("Exception taking screenshot: ") + e.what());
+                         std::string("Exception taking screenshot delta: ") + e.what());
         } catch (...) {
-            result->Error("SCREENSHOT_ERROR", "Unknown exception taking screenshot");
+            result->Error("SCREENSHOT_ERROR", "Unknown exception taking screenshot delta");
+        }
+    } else if (method_name == "startScreenshotSchedule") {
+        const auto* args = std::get_if<flutter::EncodableMap>(method_call.arguments());
+        if (!args) {
+            result->Error("Invalid argument", "Expected a map of arguments.");
+            return;
+        }
+        ScreenshotScheduleOptions options;
+        auto it = args->find(flutter::EncodableValue("interval"));
+        if (it == args->end() || !std::holds_alternative<int>(it->second) ||
+            std::get<int>(it->second) < 100) {
+            result->Error("Invalid argument", "Expected at least 100 milliseconds for 'interval'.");
+            return;
+        }
+        options.interval = std::chrono::milliseconds(std::get<int>(it->second));
+        it = args->find(flutter::EncodableValue("directory"));
+        if (it == args->end() || !std::holds_alternative<std::string>(it->second) ||
+            std::get<std::string>(it->second).empty()) {
+            result->Error("Invalid argument", "Expected a path for 'directory'.");
+            return;
+        }
+        options.directory = std::get<std::string>(it->second);
+        it = args->find(flutter::EncodableValue("format"));
+        if (it != args->end() && std::holds_alternative<std::string>(it->second)) {
+            options.format = std::get<std::string>(it->second);
+            if (FindScreenshotEncoder(options.format) == nullptr) {
+                result->Error("Invalid argument",
+                              "Screenshot format '" + options.format + "' is not supported by this build.");
+                return;
+            }
+        }
+        it = args->find(flutter::EncodableValue("quality"));
+        if (it != args->end() && !it->second.IsNull()) {
+            if (!std::holds_alternative<int>(it->second) || std::get<int>(it->second) < 1 ||
+                std::get<int>(it->second) > 100) {
+                result->Error("Invalid argument", "Expected an integer in [1, 100] for 'quality'.");
+                return;
+            }
+            options.quality = std::get<int>(it->second);
+        }
+        int sizeLimit[2] = {0, 0};
+        const std::string limitError = ReadScreenshotSizeLimit(*args, sizeLimit);
+        if (!limitError.empty()) {
+            result->Error("Invalid argument", limitError);
+            return;
+        }
+        options.maxWidth = sizeLimit[0];
+        options.maxHeight = sizeLimit[1];
+        const std::pair<const char*, bool*> flags[] = {
+            {"activeWindowOnly", &options.activeWindowOnly},
+            {"skipWhenIdle", &options.skipWhenIdle},
+            {"skipUnchanged", &options.skipUnchanged},
+        };
+        for (const auto& [key, flag] : flags) {
+            it = args->find(flutter::EncodableValue(key));
+            if (it != args->end() && std::holds_alternative<bool>(it->second)) {
+                *flag = std::get<bool>(it->second);
+            }
+        }
+        std::error_code error;
+        std::filesystem::create_directories(std::filesystem::u8path(options.directory), error);
+        if (error) {
+            result->Error("SCREENSHOT_ERROR", "Cannot create " + options.directory + ": " + error.message());
+            return;
+        }
+        StartScreenshotSchedule(options);
+        if (enableDebug_) {
+            std::cout << "[WindowFocus] Saving a " << options.format << " screenshot every "
+                      << options.interval.count() << " ms to " << options.directory << std::endl;
+        }
+        result->Success();
+    } else if (method_name == "stopScreenshotSchedule") {
+        StopScreenshotSchedule();
+        result->Success();
+    } else if (method_name == "startScreenshotRing") {
+        const auto* args = std::get_if<flutter::EncodableMap>(method_call.arguments());
+        if (!args) {
+            result->Error("Invalid argument", "Expected a map of arguments.");
+            return;
+        }
+        ScreenshotRingOptions options;
+        struct IntArgument {
+            const char* key;
+            int minValue;
+            int maxValue;
+            int value;
+        };
+        IntArgument ints[] = {
+            {"interval", 100, INT_MAX, static_cast<int>(options.interval.count())},
+            {"frames", 1, 1000, kDefaultRingFrames},
+            {"maxBytes", 1 << 20, INT_MAX, static_cast<int>(kDefaultRingBytes)},
+        };
+        for (IntArgument& argument : ints) {
+            auto it = args->find(flutter::EncodableValue(argument.key));
+            if (it == args->end() || it->second.IsNull()) {
+                continue;
+            }
+            if (!std::holds_alternative<int>(it->second) ||
+                std::get<int>(it->second) < argument.minValue ||
+                std::get<int>(it->second) > argument.maxValue) {
+                result->Error("Invalid argument", "Expected an integer in [" +
+                                                      std::to_string(argument.minValue) + ", " +
+                                                      std::to_string(argument.maxValue) +
+                                                      "] for '" + argument.key + "'.");
+                return;
+            }
+            argument.value = std::get<int>(it->second);
+        }
+        options.interval = std::chrono::milliseconds(ints[0].value);
+        options.frames = static_cast<size_t>(ints[1].value);
+        options.maxBytes = static_cast<size_t>(ints[2].value);
+        auto it = args->find(flutter::EncodableValue("raw"));
+        if (it != args->end() && std::holds_alternative<bool>(it->second)) {
+            options.raw = std::get<bool>(it->second);
+        }
+        it = args->find(flutter::EncodableValue("format"));
+        if (it != args->end() && std::holds_alternative<std::string>(it->second)) {
+            options.format = std::get<std::string>(it->second);
+        }
+        if (!options.raw && FindScreenshotEncoder(options.format) == nullptr) {
+            result->Error("Invalid argument",
+                          "Screenshot format '" + options.format + "' is not supported by this build.");
+            return;
+        }
+        it = args->find(flutter::EncodableValue("quality"));
+        if (it != args->end() && !it->second.IsNull()) {
+            if (!std::holds_alternative<int>(it->second) || std::get<int>(it->second) < 1 ||
+                std::get<int>(it->second) > 100) {
+                result->Error("Invalid argument", "Expected an integer in [1, 100] for 'quality'.");
+                return;
+            }
+            options.quality = std::get<int>(it->second);
         }
+        int sizeLimit[2] = {0, 0};
+        const std::string limitError = ReadScreenshotSizeLimit(*args, sizeLimit);
+        if (!limitError.empty()) {
+            result->Error("Invalid argument", limitError);
+            return;
+        }
+        options.maxWidth = sizeLimit[0];
+        options.maxHeight = sizeLimit[1];
+        it = args->find(flutter::EncodableValue("activeWindowOnly"));
+        if (it != args->end() && std::holds_alternative<bool>(it->second)) {
+            options.activeWindowOnly = std::get<bool>(it->second);
+        }
+        StartScreenshotRing(options);
+        if (enableDebug_) {
+            std::cout << "[WindowFocus] Keeping up to " << options.frames << " "
+                      << (options.raw ? std::string("raw") : options.format)
+                      << " screenshots in " << options.maxBytes << " bytes, one every "
+                      << options.interval.count() << " ms" << std::endl;
+        }
+        result->Success();
+    } else if (method_name == "stopScreenshotRing") {
+        StopScreenshotRing();
+        result->Success();
+    } else if (method_name == "cancelScreenshots") {
+        result->Success(flutter::EncodableValue(static_cast<int64_t>(CancelScreenshots())));
+    } else if (method_name == "getRecentFrames") {
+        int count = 1;
+        if (const auto* args = std::get_if<flutter::EncodableMap>(method_call.arguments())) {
+            auto it = args->find(flutter::EncodableValue("count"));
+            if (it != args->end() && !it->second.IsNull()) {
+                if (!std::holds_alternative<int>(it->second) || std::get<int>(it->second) < 1) {
+                    result->Error("Invalid argument", "Expected a positive integer for 'count'.");
+                    return;
+                }
+                count = std::get<int>(it->second);
+            }
+        }
+        result->Success(flutter::EncodableValue(GetRecentFrames(static_cast<size_t>(count))));
     } else if (method_name == "checkScreenRecordingPermission") {
         result->Success(flutter::EncodableValue(true));
     } else if (method_name == "requestScreenRecordingPermission") {
@@ -906,6 +1853,7 @@ bool WindowFocusPlugin::CheckControllerInput() {
             continue;
         }
 
+        controllerConnected_[i].store(result == ERROR_SUCCESS, std::memory_order_relaxed);
         if (result == ERROR_SUCCESS) {
             if (state.dwPacketNumber != lastControllerStates_[i].dwPacketNumber) {
                 if (enableDebug_) {
@@ -913,6 +1861,7 @@ bool WindowFocusPlugin::CheckControllerInput() {
                 }
                 inputDetected = true;
                 lastControllerStates_[i] = state;
+                controllerStats_[i].RecordInput();
             }
         }
     }
@@ -1032,6 +1981,9 @@ bool WindowFocusPlugin::CheckKeyboardInput() {
 
 bool WindowFocusPlugin::CheckSystemAudio() {
     if (!monitorAudio_ || isShuttingDown_) {
+        // Nothing to notify about while audio is not monitored.
+        audioPeakMeter_.reset();
+        lastAudioPeak_ = 0.0f;
         return false;
     }
 
@@ -1040,9 +1992,13 @@ bool WindowFocusPlugin::CheckSystemAudio() {
         return false;
     }
 
+    if (!audioPeakMeter_) {
+        audioPeakMeter_ = std::make_unique<AudioPeakMeter>();
+    }
     float peakValue = 0.0f;
     bool comError = false;
-    bool success = GetAudioPeakValueSEH(&peakValue, &comError);
+    bool success = audioPeakMeter_->ReadPeak(&peakValue, &comError);
+    lastAudioPeak_ = success ? peakValue : 0.0f;
 
     if (comError && enableDebug_) {
         std::cerr << "[WindowFocus] Exception in CheckSystemAudio" << std::endl;
@@ -1058,19 +2014,314 @@ bool WindowFocusPlugin::CheckSystemAudio() {
     return false;
 }
 
-void WindowFocusPlugin::InitializeHIDDevices() {
-    std::lock_guard<std::mutex> lock(hidDevicesMutex_);
+bool WindowFocusPlugin::IsAppAudioActive(DWORD processId, const std::string& appName) {
+    constexpr UINT kMaxSessions = 64;
+    DWORD processIds[kMaxSessions];
+    float peaks[kMaxSessions];
+    UINT count = 0;
+    bool comError = false;
+    if (!GetAudioSessionPeaksSEH(processIds, peaks, kMaxSessions, &count, &comError)) {
+        if (comError && enableDebug_) {
+            std::cerr << "[WindowFocus] Exception enumerating audio sessions" << std::endl;
+        }
+        return false;
+    }
 
-    for (HANDLE handle : hidDeviceHandles_) {
-        if (handle != INVALID_HANDLE_VALUE && handle != nullptr) {
-            CancelIoSEH(handle);
-            CloseHandleSEH(handle);
+    for (UINT i = 0; i < count; i++) {
+        if (peaks[i] <= audioThreshold_ || processIds[i] == 0) {
+            continue;
+        }
+        // Browsers and Electron apps play audio from a helper process with
+        // the same executable as the window.
+        if (processIds[i] == processId || GetProcessName(processIds[i]) == appName) {
+            return true;
         }
     }
-    hidDeviceHandles_.clear();
-    lastHIDStates_.clear();
+    return false;
+}
 
-    if (isShuttingDown_) return;
+// =====================================================================
+// Audio peak meter
+// =====================================================================
+
+AudioPeakMeter::~AudioPeakMeter() {
+    Close();
+}
+
+bool AudioPeakMeter::ReadPeak(float* peak, bool* comError) {
+    *peak = 0.0f;
+    *comError = false;
+
+    // Cleared before acquiring, so a change while that runs is not lost.
+    if (stale_.exchange(false) && !Acquire(comError)) {
+        // Without notifications nothing would tell us when to try again.
+        if (!registered_) {
+            stale_ = true;
+        }
+        return false;
+    }
+    if (meter_ == nullptr) {
+        return false;
+    }
+    if (!GetAudioPeakValueSEH(meter_, peak, comError)) {
+        // AUDCLNT_E_DEVICE_INVALIDATED and the like.
+        stale_ = true;
+        return false;
+    }
+    return true;
+}
+
+bool AudioPeakMeter::Acquire(bool* comError) {
+    if (enumerator_ == nullptr) {
+        if (!CreateAudioEnumeratorSEH(&enumerator_, comError)) {
+            enumerator_ = nullptr;
+            return false;
+        }
+        registered_ = SetAudioNotificationClientSEH(enumerator_, this, true);
+    }
+    ReleaseEndpoint();
+    if (!ActivateDefaultAudioMeterSEH(enumerator_, &device_, &meter_, comError)) {
+        ReleaseEndpoint();
+        return false;
+    }
+    return true;
+}
+
+void AudioPeakMeter::ReleaseEndpoint() {
+    ReleaseComObjectSEH(meter_);
+    meter_ = nullptr;
+    ReleaseComObjectSEH(device_);
+    device_ = nullptr;
+}
+
+void AudioPeakMeter::Close() {
+    ReleaseEndpoint();
+    if (enumerator_ != nullptr) {
+        if (registered_) {
+            SetAudioNotificationClientSEH(enumerator_, this, false);
+            registered_ = false;
+        }
+        ReleaseComObjectSEH(enumerator_);
+        enumerator_ = nullptr;
+    }
+    stale_ = true;
+}
+
+ULONG AudioPeakMeter::AddRef() {
+    return ++refCount_;
+}
+
+ULONG AudioPeakMeter::Release() {
+    return --refCount_;
+}
+
+HRESULT AudioPeakMeter::QueryInterface(REFIID riid, void** object) {
+    if (riid == __uuidof(IUnknown) || riid == __uuidof(IMMNotificationClient)) {
+        *object = static_cast<IMMNotificationClient*>(this);
+        AddRef();
+        return S_OK;
+    }
+    *object = nullptr;
+    return E_NOINTERFACE;
+}
+
+HRESULT AudioPeakMeter::OnDefaultDeviceChanged(EDataFlow flow, ERole role, LPCWSTR) {
+    if (flow == eRender && role == eConsole) {
+        stale_ = true;
+    }
+    return S_OK;
+}
+
+HRESULT AudioPeakMeter::OnDeviceStateChanged(LPCWSTR, DWORD) {
+    stale_ = true;
+    return S_OK;
+}
+
+HRESULT AudioPeakMeter::OnDeviceAdded(LPCWSTR) {
+    return S_OK;
+}
+
+HRESULT AudioPeakMeter::OnDeviceRemoved(LPCWSTR) {
+    stale_ = true;
+    return S_OK;
+}
+
+HRESULT AudioPeakMeter::OnPropertyValueChanged(LPCWSTR, const PROPERTYKEY) {
+    return S_OK;
+}
+
+// =====================================================================
+// HID report slab
+// =====================================================================
+
+void HIDReportSlab::Layout(const std::vector<DWORD>& reportLengths) {
+    offsets_.resize(reportLengths.size());
+    slotLines_.resize(reportLengths.size());
+    size_t totalLines = 0;
+    for (size_t i = 0; i < reportLengths.size(); i++) {
+        offsets_[i] = totalLines;
+        slotLines_[i] = (std::max<size_t>)(1, (reportLengths[i] + kCacheLineSize - 1) / kCacheLineSize);
+        totalLines += 2 * slotLines_[i];
+    }
+    lines_.assign(totalLines, CacheLine{});
+}
+
+void HIDReportSlab::Clear() {
+    std::vector<CacheLine>().swap(lines_);
+    offsets_.clear();
+    slotLines_.clear();
+}
+
+// =====================================================================
+// HID report filtering
+// =====================================================================
+
+// A bit is noise if it toggled in at least a quarter of the calibration
+// reports. Sensors and counters toggle far more often than buttons.
+static constexpr int kJitterToggleDivisor = 4;
+// Learned axis noise never widens a deadzone beyond this fraction of the
+// range, so a wheel turned during calibration stays usable.
+static constexpr double kMaxLearnedDeadzone = 0.1;
+
+HIDReportFilter::HIDReportFilter(size_t reportLength, std::vector<HIDAxisField> axes, double deadzone)
+    : reportLength_(reportLength), axes_(std::move(axes)), deadzone_(deadzone) {}
+
+HIDReportFilter::ReportState& HIDReportFilter::StateFor(BYTE reportId) {
+    for (auto& state : reports_) {
+        if (state.reportId == reportId) {
+            return state;
+        }
+    }
+
+    ReportState state;
+    state.reportId = reportId;
+    state.lastReport.assign(reportLength_, 0);
+    state.mask.assign(reportLength_, 0xFF);
+    state.toggleCounts.assign(reportLength_ * 8, 0);
+    // Byte 0 is the report ID.
+    state.mask[0] = 0;
+    for (const auto& field : axes_) {
+        if (field.reportId != reportId || field.bitOffset + field.bitSize > reportLength_ * 8) {
+            continue;
+        }
+        AxisState axis;
+        axis.field = field;
+        UpdateAxisDeadzone(axis, true);
+        state.axes.push_back(axis);
+        for (ULONG bit = field.bitOffset; bit < field.bitOffset + field.bitSize; bit++) {
+            state.mask[bit / 8] &= static_cast<BYTE>(~(1u << (bit % 8)));
+        }
+    }
+    reports_.push_back(std::move(state));
+    return reports_.back();
+}
+
+bool HIDReportFilter::Update(const BYTE* report, size_t length,
+                             std::chrono::steady_clock::time_point now) {
+    if (length == 0) return false;
+    length = (std::min)(length, reportLength_);
+    ReportState& state = StateFor(report[0]);
+
+    if (!state.hasReport) {
+        // Nothing to compare with yet: centred sticks, sensors and battery
+        // levels of a device that was just opened are not input.
+        state.hasReport = true;
+        state.calibrationStart = now;
+        for (auto& axis : state.axes) {
+            if (axis.field.bitOffset + axis.field.bitSize > length * 8) continue;
+            axis.reference = axis.previous = ExtractHIDField(
+                report, axis.field.bitOffset, axis.field.bitSize, axis.field.logicalMin < 0);
+        }
+        std::copy(report, report + length, state.lastReport.begin());
+        return false;
+    }
+
+    if (state.calibrating) {
+        state.calibrationReports++;
+        for (size_t i = 0; i < length; i++) {
+            BYTE changed = (report[i] ^ state.lastReport[i]) & state.mask[i];
+            for (int bit = 0; changed != 0; bit++, changed >>= 1) {
+                if (changed & 1) {
+                    state.toggleCounts[i * 8 + bit]++;
+                }
+            }
+        }
+        for (auto& axis : state.axes) {
+            if (axis.field.bitOffset + axis.field.bitSize > length * 8) continue;
+            LONG value = ExtractHIDField(report, axis.field.bitOffset, axis.field.bitSize,
+                                         axis.field.logicalMin < 0);
+            if (value != axis.previous) {
+                axis.noise = (std::max)(axis.noise,
+                                        std::llabs(static_cast<LONGLONG>(value) - axis.previous));
+                axis.changes++;
+            }
+        }
+        if (now - state.calibrationStart >= kCalibrationPeriod) {
+            FinishCalibration(state);
+        }
+    }
+
+    bool changed = MaskedBytesDiffer(report, state.lastReport.data(), state.mask.data(), length);
+
+    for (auto& axis : state.axes) {
+        if (axis.field.bitOffset + axis.field.bitSize > length * 8) continue;
+        LONG value = ExtractHIDField(report, axis.field.bitOffset, axis.field.bitSize,
+                                     axis.field.logicalMin < 0);
+        axis.previous = value;
+        if (std::llabs(static_cast<LONGLONG>(value) - axis.reference) > axis.deadzone) {
+            axis.reference = value;
+            changed = true;
+        }
+    }
+
+    std::copy(report, report + length, state.lastReport.begin());
+    return changed;
+}
+
+void HIDReportFilter::SetDeadzone(double deadzone) {
+    deadzone_ = deadzone;
+    for (auto& state : reports_) {
+        for (auto& axis : state.axes) {
+            UpdateAxisDeadzone(axis, state.calibrating);
+        }
+    }
+}
+
+void HIDReportFilter::FinishCalibration(ReportState& state) {
+    state.calibrating = false;
+
+    // A device that stayed quiet has nothing to mask.
+    const bool enoughData = state.calibrationReports >= kMinCalibrationReports;
+    const int threshold = state.calibrationReports / kJitterToggleDivisor;
+    if (enoughData) {
+        for (size_t bit = 0; bit < state.toggleCounts.size(); bit++) {
+            if (state.toggleCounts[bit] > 0 && state.toggleCounts[bit] >= threshold) {
+                state.mask[bit / 8] &= static_cast<BYTE>(~(1u << (bit % 8)));
+            }
+        }
+    }
+    for (auto& axis : state.axes) {
+        if (!enoughData || axis.changes < threshold) {
+            axis.noise = 0;
+        }
+        UpdateAxisDeadzone(axis, false);
+    }
+
+    std::vector<uint16_t>().swap(state.toggleCounts);
+}
+
+void HIDReportFilter::UpdateAxisDeadzone(AxisState& axis, bool calibrating) const {
+    const double range = static_cast<double>(axis.field.logicalMax) - axis.field.logicalMin;
+    const LONGLONG configured = static_cast<LONGLONG>(range * deadzone_);
+    // Twice the observed step, so noise that wanders both ways stays inside.
+    const LONGLONG learned = (std::min)(static_cast<LONGLONG>(range * kMaxLearnedDeadzone),
+                                        calibrating ? 0 : axis.noise * 2);
+    axis.deadzone = (std::max)(configured, learned);
+}
+
+// Lists the device paths of every present HID interface.
+static std::vector<std::wstring> EnumerateHIDDevicePaths(bool debug) {
+    std::vector<std::wstring> devicePaths;
 
     GUID hidGuid;
     HidD_GetHidGuid(&hidGuid);
@@ -1083,18 +2334,18 @@ void WindowFocusPlugin::InitializeHIDDevices() {
     );
 
     if (deviceInfoSet == INVALID_HANDLE_VALUE) {
-        if (enableDebug_) {
+        if (debug) {
             std::cerr << "[WindowFocus] Failed to get HID device info set: "
                       << GetLastError() << std::endl;
         }
-        return;
+        return devicePaths;
     }
 
     SP_DEVICE_INTERFACE_DATA deviceInterfaceData;
     deviceInterfaceData.cbSize = sizeof(SP_DEVICE_INTERFACE_DATA);
 
     DWORD memberIndex = 0;
-    while (!isShuttingDown_ && SetupDiEnumDeviceInterfaces(
+    while (SetupDiEnumDeviceInterfaces(
         deviceInfoSet,
         nullptr,
         &hidGuid,
@@ -1116,7 +2367,7 @@ void WindowFocusPlugin::InitializeHIDDevices() {
         PSP_DEVICE_INTERFACE_DETAIL_DATA detailData =
             (PSP_DEVICE_INTERFACE_DETAIL_DATA)malloc(requiredSize);
         if (!detailData) {
-            if (enableDebug_) {
+            if (debug) {
                 std::cerr << "[WindowFocus] Failed to allocate memory for HID device detail" << std::endl;
             }
             continue;
@@ -1132,78 +2383,375 @@ void WindowFocusPlugin::InitializeHIDDevices() {
             nullptr,
             nullptr
         )) {
-            HANDLE deviceHandle = CreateHIDDeviceHandleSEH(detailData->DevicePath);
-
-            if (deviceHandle != INVALID_HANDLE_VALUE) {
-                HIDD_ATTRIBUTES attributes;
-                attributes.Size = sizeof(HIDD_ATTRIBUTES);
-
-                if (GetHIDAttributesSEH(deviceHandle, &attributes)) {
-                    PHIDP_PREPARSED_DATA preparsedData = nullptr;
-
-                    if (GetHIDPreparsedDataSEH(deviceHandle, &preparsedData)) {
-                        HIDP_CAPS caps;
-                        ZeroMemory(&caps, sizeof(caps));
-
-                        if (GetHIDCapsSEH(preparsedData, &caps)) {
-                            bool isAudioDevice = (caps.UsagePage == 0x0B || caps.UsagePage == 0x0C);
-                            bool isKeyboard = (caps.UsagePage == 0x01 && caps.Usage == 0x06);
-                            bool isMouse = (caps.UsagePage == 0x01 && caps.Usage == 0x02);
-
-                            if (!isAudioDevice && !isKeyboard && !isMouse && caps.InputReportByteLength > 0) {
-                                hidDeviceHandles_.push_back(deviceHandle);
-                                lastHIDStates_.push_back(std::vector<BYTE>(caps.InputReportByteLength, 0));
-
-                                if (enableDebug_) {
-                                    std::cout << "[WindowFocus] HID device added: VID="
-                                              << std::hex << attributes.VendorID
-                                              << " PID=" << attributes.ProductID
-                                              << std::dec
-                                              << " UsagePage=0x" << std::hex << caps.UsagePage
-                                              << " Usage=0x" << caps.Usage << std::dec << std::endl;
-                                }
-                            } else {
-                                if (enableDebug_) {
-                                    const char* reason = isAudioDevice ? "audio" :
-                                                        isKeyboard ? "keyboard" :
-                                                        isMouse ? "mouse" : "no input";
-                                    std::cout << "[WindowFocus] Skipping HID device (" << reason << "): VID="
-                                              << std::hex << attributes.VendorID
-                                              << " PID=" << attributes.ProductID
-                                              << " UsagePage=0x" << caps.UsagePage
-                                              << " Usage=0x" << caps.Usage << std::dec << std::endl;
-                                }
-                                CloseHandleSEH(deviceHandle);
-                            }
-                        } else {
-                            CloseHandleSEH(deviceHandle);
-                        }
-                        if (preparsedData) {
-                            HidD_FreePreparsedData(preparsedData);
-                        }
-                    } else {
-                        CloseHandleSEH(deviceHandle);
-                    }
-                } else {
-                    CloseHandleSEH(deviceHandle);
-                }
-            }
+            devicePaths.push_back(detailData->DevicePath);
         }
 
         free(detailData);
     }
 
     SetupDiDestroyDeviceInfoList(deviceInfoSet);
-
-    if (enableDebug_) {
-        std::cout << "[WindowFocus] Initialized " << hidDeviceHandles_.size() << " HID devices" << std::endl;
-    }
+    return devicePaths;
 }
 
-bool WindowFocusPlugin::CheckHIDDevices() {
-    if (!monitorHIDDevices_ || isShuttingDown_) {
-        return false;
-    }
+// Opening a HID interface can block for tens of milliseconds (Bluetooth
+// devices, hubs waking up), so enumeration probes several at once.
+static constexpr size_t kMaxHIDProbeThreads = 8;
+
+// Opens every present HID interface that is not monitored yet. Interfaces are
+// probed in parallel and each one joins monitoring as soon as it has been
+// validated. Runs on a background thread, never the platform thread.
+void WindowFocusPlugin::InitializeHIDDevices() {
+    if (isShuttingDown_ || !monitorHIDDevices_) return;
+
+    const auto enumerationStart = std::chrono::steady_clock::now();
+    const std::vector<std::wstring> devicePaths = EnumerateHIDDevicePaths(enableDebug_);
+
+    std::atomic<size_t> nextDevice{0};
+    auto probeDevices = [this, &devicePaths, &nextDevice]() {
+        while (!isShuttingDown_ && monitorHIDDevices_) {
+            const size_t index = nextDevice++;
+            if (index >= devicePaths.size()) break;
+            // Devices that are already open are skipped, so this only picks
+            // up what is new since the last enumeration.
+            AddHIDDevice(devicePaths[index], std::chrono::steady_clock::time_point(), nullptr);
+        }
+    };
+
+    const size_t workerCount = (std::min)({devicePaths.size(), kMaxHIDProbeThreads,
+        static_cast<size_t>((std::max)(1u, std::thread::hardware_concurrency()))});
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < workerCount; i++) {
+        workers.emplace_back(probeDevices);
+    }
+    probeDevices();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    if (enableDebug_) {
+        size_t deviceCount = 0;
+        {
+            std::lock_guard<std::mutex> lock(hidDevicesMutex_);
+            deviceCount = hidDeviceHandles_.size();
+        }
+        auto elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - enumerationStart).count();
+        std::cout << "[WindowFocus] Initialized " << deviceCount << " HID devices from "
+                  << devicePaths.size() << " interfaces in " << elapsedMs << " ms ("
+                  << workerCount << " probe threads)" << std::endl;
+    }
+}
+
+// Runs InitializeHIDDevices on a background thread so setHIDMonitoring
+// returns at once. A request made while a pass is running makes that pass
+// repeat instead of starting a second one.
+void WindowFocusPlugin::StartHIDEnumeration() {
+    hidEnumerationRequested_ = true;
+    if (hidEnumerationRunning_.exchange(true)) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(hidEnumerationMutex_);
+    if (hidEnumerationThread_.joinable()) {
+        // The previous thread has finished its last pass.
+        hidEnumerationThread_.join();
+    }
+    hidEnumerationThread_ = std::thread([this]() {
+        while (true) {
+            hidEnumerationRequested_ = false;
+            InitializeHIDDevices();
+            hidEnumerationRunning_ = false;
+            if (isShuttingDown_ || !hidEnumerationRequested_ || hidEnumerationRunning_.exchange(true)) {
+                break;
+            }
+        }
+    });
+}
+
+// Opens and probes one HID interface, then adds it to the monitored set.
+// hidDevicesMutex_ is only held for the lookups and the insert, not while the
+// device is opened and queried, so several devices can be probed at once.
+// |arrivalTime| is set for hotplugged devices so the delay until their first
+// detected input can be measured. Returns true if the device was added, and
+// its capabilities in |addedInfo| when that is not null.
+bool WindowFocusPlugin::AddHIDDevice(const std::wstring& devicePath,
+                                     std::chrono::steady_clock::time_point arrivalTime,
+                                     HIDDeviceInfo* addedInfo) {
+    const auto probeStart = std::chrono::steady_clock::now();
+    const std::wstring key = NormalizeHIDDevicePath(devicePath);
+
+    HIDDeviceInfo info;
+    bool cached = false;
+    {
+        std::lock_guard<std::mutex> lock(hidDevicesMutex_);
+        if (std::find(hidDevicePaths_.begin(), hidDevicePaths_.end(), key) != hidDevicePaths_.end()) {
+            return false;
+        }
+
+        // Keyboards, mice and audio interfaces seen before are not even opened.
+        auto it = hidDeviceCache_.find(key);
+        if (it != hidDeviceCache_.end()) {
+            if (GetHIDSkipReason(it->second) != nullptr) {
+                return false;
+            }
+            info = it->second;
+            cached = true;
+        }
+    }
+
+    HANDLE deviceHandle = CreateHIDDeviceHandleSEH(devicePath.c_str());
+    if (deviceHandle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    if (!cached) {
+        if (!QueryHIDDeviceInfo(deviceHandle, &info)) {
+            CloseHandleSEH(deviceHandle);
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(hidDevicesMutex_);
+        hidDeviceCache_[key] = info;
+    }
+
+    const auto probeUs = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - probeStart).count();
+
+    if (const char* reason = GetHIDSkipReason(info)) {
+        if (enableDebug_) {
+            std::cout << "[WindowFocus] Skipping HID device (" << reason << "): VID="
+                      << std::hex << info.vendorId
+                      << " PID=" << info.productId
+                      << " UsagePage=0x" << info.usagePage
+                      << " Usage=0x" << info.usage << std::dec
+                      << " (probed in " << probeUs << " us)" << std::endl;
+        }
+        CloseHandleSEH(deviceHandle);
+        return false;
+    }
+
+    HANDLE readEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    if (readEvent == nullptr) {
+        if (enableDebug_) {
+            std::cerr << "[WindowFocus] Failed to create read event for HID device: "
+                      << GetLastError() << std::endl;
+        }
+        CloseHandleSEH(deviceHandle);
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(hidDevicesMutex_);
+
+        // Monitoring may have been switched off, or a hotplug notification
+        // may have added the same device, while this one was being probed.
+        if (isShuttingDown_ || !monitorHIDDevices_ ||
+            std::find(hidDevicePaths_.begin(), hidDevicePaths_.end(), key) != hidDevicePaths_.end()) {
+            CloseHandleSEH(readEvent);
+            CloseHandleSEH(deviceHandle);
+            return false;
+        }
+
+        // Growing the arrays moves the OVERLAPPED structures of reads in flight.
+        CancelPendingHIDReads();
+
+        HIDReadContext context;
+        context.overlapped.hEvent = readEvent;
+
+        hidDeviceHandles_.push_back(deviceHandle);
+        hidReportLengths_.push_back(info.inputReportByteLength);
+        hidReadContexts_.push_back(context);
+        hidReportFilters_.emplace_back(info.inputReportByteLength, info.axes, hidAxisDeadzone_.load());
+        hidDeviceStats_.push_back(std::make_shared<InputDeviceStats>());
+        hidReportSlabStale_ = true;
+        hidDevicePaths_.push_back(key);
+        hidDeviceArrivals_.push_back(arrivalTime);
+    }
+
+    if (enableDebug_) {
+        std::cout << "[WindowFocus] HID device added: VID="
+                  << std::hex << info.vendorId
+                  << " PID=" << info.productId
+                  << std::dec
+                  << " UsagePage=0x" << std::hex << info.usagePage
+                  << " Usage=0x" << info.usage << std::dec
+                  << (cached ? " (cached" : " (")
+                  << (cached ? ", " : "") << "probed in " << probeUs << " us)" << std::endl;
+    }
+    if (addedInfo != nullptr) {
+        *addedInfo = info;
+    }
+    return true;
+}
+
+void WindowFocusPlugin::RemoveHIDDevice(const std::wstring& devicePath) {
+    std::lock_guard<std::mutex> lock(hidDevicesMutex_);
+
+    const std::wstring key = NormalizeHIDDevicePath(devicePath);
+    auto it = std::find(hidDevicePaths_.begin(), hidDevicePaths_.end(), key);
+    if (it != hidDevicePaths_.end()) {
+        EraseHIDDeviceAt(static_cast<size_t>(it - hidDevicePaths_.begin()));
+    }
+}
+
+// Closes the device at |index| and drops it from every parallel vector.
+// The caller holds hidDevicesMutex_.
+void WindowFocusPlugin::EraseHIDDeviceAt(size_t index) {
+    // Erasing moves the contexts after |index|.
+    CancelPendingHIDReads();
+
+    HANDLE handle = hidDeviceHandles_[index];
+    if (handle != INVALID_HANDLE_VALUE && handle != nullptr) {
+        CloseHandleSEH(handle);
+    }
+    CloseHandleSEH(hidReadContexts_[index].overlapped.hEvent);
+    hidDeviceHandles_.erase(hidDeviceHandles_.begin() + index);
+    hidReportLengths_.erase(hidReportLengths_.begin() + index);
+    hidReadContexts_.erase(hidReadContexts_.begin() + index);
+    hidReportFilters_.erase(hidReportFilters_.begin() + index);
+    hidDeviceStats_.erase(hidDeviceStats_.begin() + index);
+    hidReportSlabStale_ = true;
+    hidDevicePaths_.erase(hidDevicePaths_.begin() + index);
+    hidDeviceArrivals_.erase(hidDeviceArrivals_.begin() + index);
+
+    if (enableDebug_) {
+        std::cout << "[WindowFocus] Removed HID device at index " << index << std::endl;
+    }
+}
+
+// Queues an overlapped read into the device's active slab slot. A read that
+// completes immediately is still collected through the OVERLAPPED, so the
+// caller treats both outcomes alike. The caller holds hidDevicesMutex_.
+bool WindowFocusPlugin::StartHIDRead(size_t index, DWORD* errorCode) {
+    HIDReadContext& context = hidReadContexts_[index];
+    DWORD bytesRead = 0;
+    if (ReadHIDDeviceSEH(hidDeviceHandles_[index],
+                         hidReportSlab_.Slot(index, context.activeHalf),
+                         hidReportLengths_[index], &context.overlapped,
+                         &bytesRead, errorCode) ||
+        *errorCode == ERROR_IO_PENDING) {
+        context.pending = true;
+        *errorCode = ERROR_SUCCESS;
+        return true;
+    }
+    return false;
+}
+
+// Waits for every read in flight to stop. Needed before the device arrays or
+// the slab are resized. The caller holds hidDevicesMutex_.
+void WindowFocusPlugin::CancelPendingHIDReads() {
+    for (size_t i = 0; i < hidReadContexts_.size(); i++) {
+        HIDReadContext& context = hidReadContexts_[i];
+        if (context.pending) {
+            CancelOverlappedReadSEH(hidDeviceHandles_[i], &context.overlapped);
+            context.pending = false;
+        }
+    }
+}
+
+void WindowFocusPlugin::SendHIDDeviceChange(const char* action,
+                                            const std::wstring& devicePath,
+                                            const HIDDeviceInfo& info) {
+    if (!deviceChangeEvents_) return;
+
+    flutter::EncodableMap data;
+    data[flutter::EncodableValue("action")] = flutter::EncodableValue(action);
+    data[flutter::EncodableValue("source")] = flutter::EncodableValue("hid");
+    data[flutter::EncodableValue("path")] =
+        flutter::EncodableValue(ConvertWStringToUTF8(devicePath));
+    data[flutter::EncodableValue("vendorId")] = flutter::EncodableValue(static_cast<int>(info.vendorId));
+    data[flutter::EncodableValue("productId")] = flutter::EncodableValue(static_cast<int>(info.productId));
+    data[flutter::EncodableValue("usagePage")] = flutter::EncodableValue(static_cast<int>(info.usagePage));
+    data[flutter::EncodableValue("usage")] = flutter::EncodableValue(static_cast<int>(info.usage));
+    SafeInvokeMethodWithMap("onDeviceChange", data);
+}
+
+void WindowFocusPlugin::RegisterHIDNotifications() {
+    if (hidNotification_ != nullptr) return;
+
+    CM_NOTIFY_FILTER filter;
+    ZeroMemory(&filter, sizeof(filter));
+    filter.cbSize = sizeof(filter);
+    filter.FilterType = CM_NOTIFY_FILTER_TYPE_DEVICEINTERFACE;
+    HidD_GetHidGuid(&filter.u.DeviceInterface.ClassGuid);
+
+    HCMNOTIFICATION notification = nullptr;
+    CONFIGRET cr = CM_Register_Notification(&filter, this, HIDNotificationCallback, &notification);
+    if (cr != CR_SUCCESS) {
+        std::cerr << "[WindowFocus] HID hotplug notifications unavailable (CONFIGRET "
+                  << cr << "), falling back to periodic enumeration" << std::endl;
+        return;
+    }
+    hidNotification_ = notification;
+}
+
+void WindowFocusPlugin::UnregisterHIDNotifications() {
+    // Waits for callbacks in flight, so this must not run under
+    // hidDevicesMutex_.
+    HCMNOTIFICATION notification = hidNotification_.exchange(nullptr);
+    if (notification != nullptr) {
+        CM_Unregister_Notification(notification);
+    }
+}
+
+// Runs on a system thread pool thread.
+DWORD CALLBACK WindowFocusPlugin::HIDNotificationCallback(
+    HCMNOTIFICATION /*notification*/, PVOID context, CM_NOTIFY_ACTION action,
+    PCM_NOTIFY_EVENT_DATA eventData, DWORD /*eventDataSize*/) {
+    auto* self = static_cast<WindowFocusPlugin*>(context);
+    if (self == nullptr || eventData == nullptr ||
+        eventData->FilterType != CM_NOTIFY_FILTER_TYPE_DEVICEINTERFACE ||
+        self->isShuttingDown_ || !self->monitorHIDDevices_) {
+        return ERROR_SUCCESS;
+    }
+
+    const std::wstring devicePath = eventData->u.DeviceInterface.SymbolicLink;
+    const std::wstring key = NormalizeHIDDevicePath(devicePath);
+
+    if (action == CM_NOTIFY_ACTION_DEVICEINTERFACEARRIVAL) {
+        const auto arrival = std::chrono::steady_clock::now();
+        HIDDeviceInfo info;
+        if (self->AddHIDDevice(devicePath, arrival, &info)) {
+            if (self->enableDebug_) {
+                auto openUs = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - arrival).count();
+                std::cout << "[WindowFocus] HID device opened " << openUs
+                          << " us after arrival notification" << std::endl;
+            }
+            self->SendHIDDeviceChange("added", devicePath, info);
+        }
+    } else if (action == CM_NOTIFY_ACTION_DEVICEINTERFACEREMOVAL) {
+        bool wasMonitored = false;
+        HIDDeviceInfo info;
+        {
+            std::lock_guard<std::mutex> lock(self->hidDevicesMutex_);
+            wasMonitored = std::find(self->hidDevicePaths_.begin(), self->hidDevicePaths_.end(), key) !=
+                           self->hidDevicePaths_.end();
+            auto cached = self->hidDeviceCache_.find(key);
+            if (cached != self->hidDeviceCache_.end()) {
+                info = cached->second;
+            }
+        }
+        self->RemoveHIDDevice(devicePath);
+        if (wasMonitored) {
+            self->SendHIDDeviceChange("removed", devicePath, info);
+        }
+    }
+
+    return ERROR_SUCCESS;
+}
+
+// Reports drained from one device per poll. The HID class driver buffers 32
+// input reports by default, so this empties the queue of a 1 kHz device.
+static constexpr int kMaxHIDReportsPerPoll = 64;
+
+// Each device keeps one overlapped read queued into its slab slot between
+// polls. A poll collects completed reads without waiting, queues the next
+// read into the other slot and filters the completed report. Nothing here
+// allocates once the devices are open.
+bool WindowFocusPlugin::CheckHIDDevices() {
+    if (!monitorHIDDevices_ || isShuttingDown_) {
+        return false;
+    }
 
     std::lock_guard<std::mutex> lock(hidDevicesMutex_);
 
@@ -1211,6 +2759,15 @@ bool WindowFocusPlugin::CheckHIDDevices() {
         return false;
     }
 
+    if (hidReportSlabStale_) {
+        // Add and erase cancelled every pending read, so nothing points
+        // into the old layout.
+        hidReportSlab_.Layout(hidReportLengths_);
+        hidReportSlabStale_ = false;
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    const double deadzone = hidAxisDeadzone_.load();
     bool inputDetected = false;
     std::vector<size_t> invalidDevices;
 
@@ -1224,114 +2781,91 @@ bool WindowFocusPlugin::CheckHIDDevices() {
             continue;
         }
 
-        std::vector<BYTE>& lastState = lastHIDStates_[i];
-
-        if (lastState.empty()) {
+        if (hidReportLengths_[i] == 0) {
             continue;
         }
 
-        std::vector<BYTE> buffer(lastState.size(), 0);
+        HIDReportFilter& filter = hidReportFilters_[i];
+        if (filter.Deadzone() != deadzone) {
+            filter.SetDeadzone(deadzone);
+        }
 
-        OVERLAPPED overlapped = {0};
-        overlapped.hEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+        HIDReadContext& context = hidReadContexts_[i];
+        bool deviceInput = false;
+        DWORD errorCode = ERROR_SUCCESS;
 
-        if (overlapped.hEvent == nullptr) {
-            if (enableDebug_) {
-                std::cerr << "[WindowFocus] Failed to create event for HID device " << i
-                          << ": " << GetLastError() << std::endl;
-            }
-            continue;
+        if (!context.pending) {
+            StartHIDRead(i, &errorCode);
         }
 
-        DWORD bytesRead = 0;
-        DWORD bufferSize = static_cast<DWORD>(buffer.size());
-        DWORD errorCode = 0;
+        for (int reports = 0; context.pending && reports < kMaxHIDReportsPerPoll; reports++) {
+            if (!HasOverlappedIoCompleted(&context.overlapped)) {
+                break;
+            }
 
-        bool readSucceeded = ReadHIDDeviceSEH(
-            deviceHandle, buffer.data(), bufferSize,
-            &overlapped, &bytesRead, &errorCode);
+            DWORD bytesRead = 0;
+            context.pending = false;
+            if (!GetOverlappedResultSEH(deviceHandle, &context.overlapped, &bytesRead, &errorCode)) {
+                break;
+            }
 
-        if (readSucceeded) {
-            if (bytesRead > 0 && buffer != lastState) {
-                inputDetected = true;
-                lastState = buffer;
+            const BYTE* report = hidReportSlab_.Slot(i, context.activeHalf);
+            context.activeHalf ^= 1;
+            // The next read fills the other slot while this report is
+            // filtered.
+            StartHIDRead(i, &errorCode);
 
-                if (enableDebug_) {
-                    std::cout << "[WindowFocus] HID device " << i << " input detected" << std::endl;
-                }
+            if (bytesRead > 0 && filter.Update(report, bytesRead, now)) {
+                deviceInput = true;
+                hidDeviceStats_[i]->RecordInput();
             }
-        } else if (errorCode == ERROR_IO_PENDING) {
-            DWORD waitResult = WaitForSingleObject(overlapped.hEvent, 10);
-            if (waitResult == WAIT_OBJECT_0) {
-                DWORD overlappedError = 0;
-                if (GetOverlappedResultSEH(deviceHandle, &overlapped, &bytesRead, &overlappedError)) {
-                    if (bytesRead > 0 && buffer != lastState) {
-                        inputDetected = true;
-                        lastState = buffer;
+        }
 
-                        if (enableDebug_) {
-                            std::cout << "[WindowFocus] HID device " << i
-                                      << " input detected (overlapped)" << std::endl;
-                        }
-                    }
-                } else if (overlappedError == ERROR_INVALID_HANDLE ||
-                           overlappedError == ERROR_DEVICE_NOT_CONNECTED) {
-                    invalidDevices.push_back(i);
-                }
-            } else if (waitResult == WAIT_TIMEOUT) {
-                CancelIoSEH(deviceHandle);
-            } else if (waitResult == WAIT_FAILED) {
-                DWORD waitError = GetLastError();
-                if (enableDebug_) {
-                    std::cout << "[WindowFocus] HID device " << i
-                              << " wait failed: " << waitError << std::endl;
-                }
-                if (waitError == ERROR_INVALID_HANDLE) {
-                    invalidDevices.push_back(i);
-                }
-            }
-        } else if (errorCode == ERROR_DEVICE_NOT_CONNECTED ||
-                   errorCode == ERROR_GEN_FAILURE ||
-                   errorCode == ERROR_INVALID_HANDLE ||
-                   errorCode == ERROR_BAD_DEVICE) {
+        if (errorCode == ERROR_DEVICE_NOT_CONNECTED ||
+            errorCode == ERROR_GEN_FAILURE ||
+            errorCode == ERROR_INVALID_HANDLE ||
+            errorCode == ERROR_BAD_DEVICE) {
             if (enableDebug_) {
                 std::cout << "[WindowFocus] HID device " << i
                           << " disconnected or invalid (error: " << errorCode << ")" << std::endl;
             }
             invalidDevices.push_back(i);
-        } else if (errorCode != ERROR_SUCCESS) {
+            continue;
+        } else if (errorCode != ERROR_SUCCESS && errorCode != ERROR_OPERATION_ABORTED) {
             if (enableDebug_) {
                 std::cerr << "[WindowFocus] Error reading HID device " << i
                           << " (code: 0x" << std::hex << errorCode << std::dec << ")" << std::endl;
             }
             invalidDevices.push_back(i);
+            continue;
         }
 
-        CloseHandleSEH(overlapped.hEvent);
+        if (deviceInput) {
+            inputDetected = true;
+
+            if (enableDebug_) {
+                std::cout << "[WindowFocus] HID device " << i << " input detected" << std::endl;
+            }
 
-        if (inputDetected) {
-            break;
+            // Only reached for input, so the latency ends at a person's first
+            // action rather than the device's first report.
+            auto& arrival = hidDeviceArrivals_[i];
+            if (arrival != std::chrono::steady_clock::time_point()) {
+                if (enableDebug_) {
+                    auto latencyMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        now - arrival).count();
+                    std::cout << "[WindowFocus] HID device " << i << " first input detected "
+                              << latencyMs << " ms after arrival" << std::endl;
+                }
+                arrival = std::chrono::steady_clock::time_point();
+            }
         }
     }
 
     if (!invalidDevices.empty()) {
-        std::sort(invalidDevices.begin(), invalidDevices.end());
-        invalidDevices.erase(std::unique(invalidDevices.begin(), invalidDevices.end()), invalidDevices.end());
-
         for (auto it = invalidDevices.rbegin(); it != invalidDevices.rend(); ++it) {
-            size_t idx = *it;
-            if (idx < hidDeviceHandles_.size()) {
-                HANDLE handle = hidDeviceHandles_[idx];
-                if (handle != INVALID_HANDLE_VALUE && handle != nullptr) {
-                    CancelIoSEH(handle);
-                    CloseHandleSEH(handle);
-                }
-                hidDeviceHandles_.erase(hidDeviceHandles_.begin() + idx);
-                lastHIDStates_.erase(lastHIDStates_.begin() + idx);
-
-                if (enableDebug_) {
-                    std::cout << "[WindowFocus] Removed invalid HID device at index " << idx << std::endl;
-                }
+            if (*it < hidDeviceHandles_.size()) {
+                EraseHIDDeviceAt(*it);
             }
         }
     }
@@ -1339,17 +2873,90 @@ bool WindowFocusPlugin::CheckHIDDevices() {
     return inputDetected;
 }
 
+// Lists the monitored HID devices and connected XInput controllers with their
+// activity counters. The device list is copied under hidDevicesMutex_; the
+// counters are read afterwards, so a poll in progress is never waited on
+// for longer than the copy.
+flutter::EncodableList WindowFocusPlugin::GetInputDevices() {
+    struct Entry {
+        std::wstring path;
+        HIDDeviceInfo info;
+        std::shared_ptr<InputDeviceStats> stats;
+    };
+    std::vector<Entry> entries;
+    {
+        std::lock_guard<std::mutex> lock(hidDevicesMutex_);
+        entries.reserve(hidDevicePaths_.size());
+        for (size_t i = 0; i < hidDevicePaths_.size(); i++) {
+            Entry entry;
+            entry.path = hidDevicePaths_[i];
+            auto cached = hidDeviceCache_.find(entry.path);
+            if (cached != hidDeviceCache_.end()) {
+                entry.info = cached->second;
+            }
+            entry.stats = hidDeviceStats_[i];
+            entries.push_back(std::move(entry));
+        }
+    }
+
+    auto makeDevice = [](const char* source, const std::string& name, const std::string& path,
+                         USHORT vendorId, USHORT productId, USHORT usagePage, USHORT usage,
+                         const InputDeviceStats& stats) {
+        flutter::EncodableMap device;
+        device[flutter::EncodableValue("source")] = flutter::EncodableValue(source);
+        device[flutter::EncodableValue("name")] = flutter::EncodableValue(name);
+        device[flutter::EncodableValue("path")] = flutter::EncodableValue(path);
+        device[flutter::EncodableValue("vendorId")] = flutter::EncodableValue(static_cast<int>(vendorId));
+        device[flutter::EncodableValue("productId")] = flutter::EncodableValue(static_cast<int>(productId));
+        device[flutter::EncodableValue("usagePage")] = flutter::EncodableValue(static_cast<int>(usagePage));
+        device[flutter::EncodableValue("usage")] = flutter::EncodableValue(static_cast<int>(usage));
+        device[flutter::EncodableValue("lastActivity")] =
+            flutter::EncodableValue(stats.last_activity_ms.load(std::memory_order_relaxed));
+        device[flutter::EncodableValue("eventCount")] = flutter::EncodableValue(
+            static_cast<int64_t>(stats.event_count.load(std::memory_order_relaxed)));
+        return flutter::EncodableValue(device);
+    };
+
+    flutter::EncodableList devices;
+    for (const auto& entry : entries) {
+        devices.push_back(makeDevice("hid", ConvertWStringToUTF8(entry.info.productName),
+                                     ConvertWStringToUTF8(entry.path), entry.info.vendorId,
+                                     entry.info.productId, entry.info.usagePage, entry.info.usage,
+                                     *entry.stats));
+    }
+    if (monitorControllers_) {
+        for (DWORD i = 0; i < XUSER_MAX_COUNT; i++) {
+            if (!controllerConnected_[i].load(std::memory_order_relaxed)) continue;
+            // XInput reports neither IDs nor names; usage is Game Pad.
+            devices.push_back(makeDevice("xinput", "XInput controller " + std::to_string(i), "",
+                                         0, 0, 0x01, 0x05, controllerStats_[i]));
+        }
+    }
+    return devices;
+}
+
 void WindowFocusPlugin::CloseHIDDevices() {
+    UnregisterHIDNotifications();
+
     std::lock_guard<std::mutex> lock(hidDevicesMutex_);
 
-    for (HANDLE handle : hidDeviceHandles_) {
+    CancelPendingHIDReads();
+    for (size_t i = 0; i < hidDeviceHandles_.size(); i++) {
+        HANDLE handle = hidDeviceHandles_[i];
         if (handle != INVALID_HANDLE_VALUE && handle != nullptr) {
-            CancelIoSEH(handle);
             CloseHandleSEH(handle);
         }
+        CloseHandleSEH(hidReadContexts_[i].overlapped.hEvent);
     }
     hidDeviceHandles_.clear();
-    lastHIDStates_.clear();
+    hidReportLengths_.clear();
+    hidReadContexts_.clear();
+    hidReportFilters_.clear();
+    hidDeviceStats_.clear();
+    hidReportSlab_.Clear();
+    hidReportSlabStale_ = false;
+    hidDevicePaths_.clear();
+    hidDeviceArrivals_.clear();
 
     if (enableDebug_) {
         std::cout << "[WindowFocus] Closed all HID devices" << std::endl;
@@ -1358,7 +2965,7 @@ void WindowFocusPlugin::CloseHIDDevices() {
 
 void WindowFocusPlugin::MonitorAllInputDevices() {
     if (monitorHIDDevices_) {
-        InitializeHIDDevices();
+        StartHIDEnumeration();
     }
 
     std::lock_guard<std::mutex> lock(threadsMutex_);
@@ -1406,21 +3013,16 @@ void WindowFocusPlugin::MonitorAllInputDevices() {
                 }
             }
 
-            if (monitorHIDDevices_ && !isShuttingDown_) {
+            // Hotplug notifications keep the device list current. Without
+            // them, re-enumerate periodically; already open devices are kept.
+            if (monitorHIDDevices_ && hidNotification_ == nullptr && !isShuttingDown_) {
                 auto now = std::chrono::steady_clock::now();
                 if (now - lastHIDReinit > hidReinitInterval) {
                     lastHIDReinit = now;
-                    bool needsReinit = false;
-                    {
-                        std::lock_guard<std::mutex> lock(hidDevicesMutex_);
-                        needsReinit = hidDeviceHandles_.empty();
-                    }
-                    if (needsReinit && !isShuttingDown_) {
-                        if (enableDebug_) {
-                            std::cout << "[WindowFocus] Re-initializing HID devices (all disconnected)" << std::endl;
-                        }
-                        InitializeHIDDevices();
+                    if (enableDebug_) {
+                        std::cout << "[WindowFocus] Re-enumerating HID devices" << std::endl;
                     }
+                    StartHIDEnumeration();
                 }
             }
 
@@ -1433,6 +3035,9 @@ void WindowFocusPlugin::MonitorAllInputDevices() {
                 }
             }
         }
+
+        // Released on the thread that created it, while COM is initialized.
+        audioPeakMeter_.reset();
     });
 }
 
@@ -1474,6 +3079,8 @@ void WindowFocusPlugin::CheckForInactivity() {
 void WindowFocusPlugin::StartFocusListener() {
     std::lock_guard<std::mutex> lock(threadsMutex_);
     threads_.emplace_back([this]() {
+        // For the audio sessions in the focus event.
+        ComInitializer comInit;
         HWND last_focused = nullptr;
         while (!isShuttingDown_) {
             try {
@@ -1501,6 +3108,16 @@ void WindowFocusPlugin::StartFocusListener() {
                         data[flutter::EncodableValue("title")] = flutter::EncodableValue(utf8_output);
                         data[flutter::EncodableValue("appName")] = flutter::EncodableValue(appName);
                         data[flutter::EncodableValue("windowTitle")] = flutter::EncodableValue(utf8_windowTitle);
+                        // What takeScreenshot's "window" argument takes.
+                        data[flutter::EncodableValue("windowId")] = flutter::EncodableValue(
+                            static_cast<int64_t>(reinterpret_cast<intptr_t>(current_focused)));
+
+                        DWORD processId = 0;
+                        GetWindowThreadProcessId(current_focused, &processId);
+                        if (monitorAudio_ && comInit.IsInitialized() && processId != 0) {
+                            data[flutter::EncodableValue("audioActive")] =
+                                flutter::EncodableValue(IsAppAudioActive(processId, appName));
+                        }
 
                         SafeInvokeMethodWithMap("onFocusChange", data);
                     }
@@ -1527,63 +3144,284 @@ void WindowFocusPlugin::StartFocusListener() {
     });
 }
 
-int GetEncoderClsid(const WCHAR* format, CLSID* pClsid) {
-    UINT num = 0;
-    UINT size = 0;
-    Gdiplus::GetImageEncodersSize(&num, &size);
-    if (size == 0) return -1;
-    Gdiplus::ImageCodecInfo* pImageCodecInfo = (Gdiplus::ImageCodecInfo*)(malloc(size));
-    if (pImageCodecInfo == NULL) return -1;
-    Gdiplus::GetImageEncoders(num, size, pImageCodecInfo);
-    for (UINT j = 0; j < num; ++j) {
-        if (wcscmp(pImageCodecInfo[j].MimeType, format) == 0) {
-            *pClsid = pImageCodecInfo[j].Clsid;
-            free(pImageCodecInfo);
-            return j;
+CaptureContext::Surface::~Surface() {
+    if (dc != nullptr) {
+        if (previous != nullptr) {
+            SelectObject(dc, previous);
         }
+        DeleteDC(dc);
+    }
+    if (bitmap != nullptr) {
+        DeleteObject(bitmap);
     }
-    free(pImageCodecInfo);
-    return -1;
 }
 
-std::optional<std::vector<uint8_t>> WindowFocusPlugin::TakeScreenshot(bool activeWindowOnly) {
-    // RAII GDI+ initialization
-    GdiplusInitializer gdipInit;
-    if (!gdipInit.IsInitialized()) {
-        if (enableDebug_) {
-            std::cerr << "[WindowFocus] GDI+ startup failed" << std::endl;
+CaptureContext::CaptureContext() = default;
+
+CaptureContext::~CaptureContext() {
+    // Surfaces are plain GDI and may go after GDI+.
+    gdiplus_.reset();
+}
+
+bool CaptureContext::StartGdiplus() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!gdiplus_) {
+        auto gdiplus = std::make_unique<GdiplusInitializer>();
+        if (!gdiplus->IsInitialized()) {
+            return false;
         }
-        return std::nullopt;
+        gdiplus_ = std::move(gdiplus);
     }
+    return true;
+}
 
-    HWND hwnd = activeWindowOnly ? GetForegroundWindow() : GetDesktopWindow();
-    if (hwnd == NULL) hwnd = GetDesktopWindow();
+bool CaptureContext::FindEncoder(const WCHAR* mimeType, CLSID* clsid) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (encoders_.empty()) {
+        // Every encoder is listed at once; there are only a handful.
+        UINT count = 0;
+        UINT size = 0;
+        Gdiplus::GetImageEncodersSize(&count, &size);
+        if (size == 0) {
+            return false;
+        }
+        std::vector<uint8_t> buffer(size);
+        auto* codecs = reinterpret_cast<Gdiplus::ImageCodecInfo*>(buffer.data());
+        if (Gdiplus::GetImageEncoders(count, size, codecs) != Gdiplus::Ok) {
+            return false;
+        }
+        for (UINT i = 0; i < count; i++) {
+            encoders_[codecs[i].MimeType] = codecs[i].Clsid;
+        }
+    }
+    auto it = encoders_.find(mimeType);
+    if (it == encoders_.end()) {
+        return false;
+    }
+    *clsid = it->second;
+    return true;
+}
 
-    // RAII DC handles
-    DcHandle hdcScreen(NULL);
-    DcHandle hdcWindow(hwnd);
+std::shared_ptr<CaptureContext::Surface> CaptureContext::AcquireSurface(int width, int height) {
+    std::unique_ptr<Surface> surface;
+    std::vector<std::unique_ptr<Surface>> dropped;
+    uint64_t generation = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        CheckDisplaysLocked(&dropped);
+        generation = generation_;
+        auto it = std::find_if(idleSurfaces_.begin(), idleSurfaces_.end(),
+                               [&](const std::unique_ptr<Surface>& idle) {
+                                   return idle->width == width && idle->height == height;
+                               });
+        if (it != idleSurfaces_.end()) {
+            surface = std::move(*it);
+            idleSurfaces_.erase(it);
+        }
+    }
+    if (!surface) {
+        surface = std::make_unique<Surface>();
+        surface->width = width;
+        surface->height = height;
+        surface->generation = generation;
+        surface->dc = CreateCompatibleDC(NULL);
+        BITMAPINFO info = {};
+        info.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+        info.bmiHeader.biWidth = width;
+        // Negative height selects top-down rows.
+        info.bmiHeader.biHeight = -height;
+        info.bmiHeader.biPlanes = 1;
+        info.bmiHeader.biBitCount = 32;
+        info.bmiHeader.biCompression = BI_RGB;
+        void* bits = nullptr;
+        surface->bitmap = CreateDIBSection(surface->dc, &info, DIB_RGB_COLORS, &bits, NULL, 0);
+        if (surface->dc == nullptr || surface->bitmap == nullptr) {
+            return nullptr;
+        }
+        surface->bits = static_cast<uint8_t*>(bits);
+        surface->previous = SelectObject(surface->dc, surface->bitmap);
+    }
+    return std::shared_ptr<Surface>(surface.release(),
+                                    [this](Surface* returned) { Return(returned); });
+}
 
-    if (!hdcScreen || !hdcWindow) {
-        if (enableDebug_) {
-            std::cerr << "[WindowFocus] Failed to get device contexts" << std::endl;
+void CaptureContext::Return(Surface* surface) {
+    std::unique_ptr<Surface> owned(surface);
+    std::vector<std::unique_ptr<Surface>> dropped;
+    std::lock_guard<std::mutex> lock(mutex_);
+    CheckDisplaysLocked(&dropped);
+    if (owned->generation != generation_) {
+        return;
+    }
+    if (idleSurfaces_.size() >= kMaxIdleCaptureSurfaces) {
+        // The oldest is the least likely to be asked for again.
+        dropped.push_back(std::move(idleSurfaces_.front()));
+        idleSurfaces_.erase(idleSurfaces_.begin());
+    }
+    idleSurfaces_.push_back(std::move(owned));
+}
+
+std::vector<uint8_t> CaptureContext::AcquireBuffer(size_t capacity) {
+    std::vector<uint8_t> buffer;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto best = idleBuffers_.end();
+        for (auto it = idleBuffers_.begin(); it != idleBuffers_.end(); ++it) {
+            if (it->capacity() >= capacity &&
+                (best == idleBuffers_.end() || it->capacity() < best->capacity())) {
+                best = it;
+            }
+        }
+        if (best != idleBuffers_.end()) {
+            buffer = std::move(*best);
+            idleBuffers_.erase(best);
         }
-        return std::nullopt;
     }
+    buffer.clear();
+    buffer.reserve(capacity);
+    return buffer;
+}
 
-    CompatibleDc hdcMemDC(hdcWindow.Get());
-    if (!hdcMemDC) {
-        if (enableDebug_) {
-            std::cerr << "[WindowFocus] Failed to create compatible DC" << std::endl;
+void CaptureContext::ReleaseBuffer(std::vector<uint8_t> buffer) {
+    if (buffer.capacity() == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (idleBuffers_.size() >= kMaxIdleScreenshotBuffers) {
+        // The smallest is the least likely to fit the next frame.
+        auto smallest = std::min_element(
+            idleBuffers_.begin(), idleBuffers_.end(),
+            [](const std::vector<uint8_t>& a, const std::vector<uint8_t>& b) {
+                return a.capacity() < b.capacity();
+            });
+        if (smallest->capacity() >= buffer.capacity()) {
+            return;
         }
-        return std::nullopt;
+        idleBuffers_.erase(smallest);
     }
+    idleBuffers_.push_back(std::move(buffer));
+}
 
+size_t CaptureContext::IdleSurfaces() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return idleSurfaces_.size();
+}
+
+size_t CaptureContext::IdleBuffers() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return idleBuffers_.size();
+}
+
+void CaptureContext::CheckDisplaysLocked(std::vector<std::unique_ptr<Surface>>* dropped) {
+    RECT displays;
+    displays.left = GetSystemMetrics(SM_XVIRTUALSCREEN);
+    displays.top = GetSystemMetrics(SM_YVIRTUALSCREEN);
+    displays.right = displays.left + GetSystemMetrics(SM_CXVIRTUALSCREEN);
+    displays.bottom = displays.top + GetSystemMetrics(SM_CYVIRTUALSCREEN);
+    if (EqualRect(&displays, &displays_)) {
+        return;
+    }
+    const bool first = IsRectEmpty(&displays_);
+    displays_ = displays;
+    if (first) {
+        return;
+    }
+    generation_++;
+    std::move(idleSurfaces_.begin(), idleSurfaces_.end(), std::back_inserter(*dropped));
+    idleSurfaces_.clear();
+    idleBuffers_.clear();
+}
+
+static BOOL CALLBACK AddMonitorInfo(HMONITOR monitor, HDC /*dc*/, LPRECT /*rect*/,
+                                    LPARAM data) {
+    MONITORINFOEXW info = {};
+    info.cbSize = sizeof(info);
+    if (!GetMonitorInfoW(monitor, &info)) {
+        return TRUE;
+    }
+    MonitorInfo entry;
+    entry.name = ConvertWStringToUTF8(info.szDevice);
+    entry.bounds = info.rcMonitor;
+    entry.primary = (info.dwFlags & MONITORINFOF_PRIMARY) != 0;
+    UINT dpiX = 0;
+    UINT dpiY = 0;
+    if (SUCCEEDED(GetDpiForMonitor(monitor, MDT_EFFECTIVE_DPI, &dpiX, &dpiY)) && dpiX > 0) {
+        entry.scale = dpiX / 96.0;
+    }
+    reinterpret_cast<std::vector<MonitorInfo>*>(data)->push_back(std::move(entry));
+    return TRUE;
+}
+
+// static
+std::vector<MonitorInfo> WindowFocusPlugin::ListMonitors() {
+    std::vector<MonitorInfo> monitors;
+    EnumDisplayMonitors(NULL, NULL, AddMonitorInfo, reinterpret_cast<LPARAM>(&monitors));
+    return monitors;
+}
+
+// Copies the foreground window, one monitor, or the primary monitor's
+// desktop into a surface of the capture context. Returns null on failure.
+std::shared_ptr<CaptureContext::Surface> WindowFocusPlugin::CaptureScreen(
+    const CaptureTarget& target) {
     RECT rc;
-    if (!GetWindowRect(hwnd, &rc)) {
+    if (target.activeWindowOnly || target.window != 0) {
+        HWND hwnd = target.activeWindowOnly ? GetForegroundWindow()
+                                            : reinterpret_cast<HWND>(target.window);
+        if (hwnd == NULL && target.activeWindowOnly) hwnd = GetDesktopWindow();
+        if (!IsWindow(hwnd)) {
+            if (enableDebug_) {
+                std::cerr << "[WindowFocus] No window " << target.window << std::endl;
+            }
+            return nullptr;
+        }
+
+        bool found = false;
+        if (target.clientAreaOnly) {
+            // The client rect is relative to itself; its corners map to the screen.
+            POINT topLeft = {0, 0};
+            found = GetClientRect(hwnd, &rc) && ClientToScreen(hwnd, &topLeft);
+            OffsetRect(&rc, topLeft.x, topLeft.y);
+        } else {
+            found = GetWindowRect(hwnd, &rc) != FALSE;
+        }
+        if (!found) {
+            if (enableDebug_) {
+                std::cerr << "[WindowFocus] GetWindowRect failed: " << GetLastError() << std::endl;
+            }
+            return nullptr;
+        }
+    } else if (target.HasRegion()) {
+        // The screen DC covers the virtual screen; nothing outside it can be
+        // copied.
+        const RECT screen = {GetSystemMetrics(SM_XVIRTUALSCREEN),
+                             GetSystemMetrics(SM_YVIRTUALSCREEN),
+                             GetSystemMetrics(SM_XVIRTUALSCREEN) +
+                                 GetSystemMetrics(SM_CXVIRTUALSCREEN),
+                             GetSystemMetrics(SM_YVIRTUALSCREEN) +
+                                 GetSystemMetrics(SM_CYVIRTUALSCREEN)};
+        if (!IntersectRect(&rc, &target.region, &screen)) {
+            if (enableDebug_) {
+                std::cerr << "[WindowFocus] Region is off screen" << std::endl;
+            }
+            return nullptr;
+        }
+    } else if (target.monitor >= 0) {
+        // Monitors are in virtual screen coordinates, which the screen DC
+        // uses as well.
+        const std::vector<MonitorInfo> monitors = ListMonitors();
+        if (target.monitor >= static_cast<int>(monitors.size())) {
+            if (enableDebug_) {
+                std::cerr << "[WindowFocus] No monitor " << target.monitor << ", "
+                          << monitors.size() << " attached" << std::endl;
+            }
+            return nullptr;
+        }
+        rc = monitors[target.monitor].bounds;
+    } else if (!GetWindowRect(GetDesktopWindow(), &rc)) {
         if (enableDebug_) {
             std::cerr << "[WindowFocus] GetWindowRect failed: " << GetLastError() << std::endl;
         }
-        return std::nullopt;
+        return nullptr;
     }
 
     int width = rc.right - rc.left;
@@ -1594,32 +3432,54 @@ std::optional<std::vector<uint8_t>> WindowFocusPlugin::TakeScreenshot(bool activ
             std::cerr << "[WindowFocus] Invalid window dimensions: "
                       << width << "x" << height << std::endl;
         }
-        return std::nullopt;
+        return nullptr;
     }
 
-    // RAII bitmap handle
-    BitmapHandle hbmScreen(CreateCompatibleBitmap(hdcWindow.Get(), width, height));
-    if (!hbmScreen) {
+    // RAII DC handle
+    DcHandle hdcScreen(NULL);
+    if (!hdcScreen) {
         if (enableDebug_) {
-            std::cerr << "[WindowFocus] CreateCompatibleBitmap failed: "
-                      << GetLastError() << std::endl;
+            std::cerr << "[WindowFocus] Failed to get device contexts" << std::endl;
         }
-        return std::nullopt;
+        return nullptr;
     }
 
-    // RAII select object (auto-restores old bitmap)
-    SelectedObject selectedBitmap(hdcMemDC.Get(), hbmScreen.Get());
+    std::shared_ptr<CaptureContext::Surface> surface =
+        captureContext_.AcquireSurface(width, height);
+    if (!surface) {
+        if (enableDebug_) {
+            std::cerr << "[WindowFocus] CreateDIBSection failed: " << GetLastError() << std::endl;
+        }
+        return nullptr;
+    }
 
-    if (!BitBlt(hdcMemDC.Get(), 0, 0, width, height,
-                hdcScreen.Get(), rc.left, rc.top, SRCCOPY)) {
+    if (!BitBlt(surface->dc, 0, 0, width, height, hdcScreen.Get(), rc.left, rc.top, SRCCOPY)) {
         if (enableDebug_) {
             std::cerr << "[WindowFocus] BitBlt failed: " << GetLastError() << std::endl;
         }
+        return nullptr;
+    }
+    // GDI may batch the copy; the bits are read directly next.
+    GdiFlush();
+    return surface;
+}
+
+// Saves |pixels| with the GDI+ encoder for |mimeType|, passing |quality| on
+// when it is not 0. GDI+ and the encoder are set up once, by the capture
+// context.
+std::optional<std::vector<uint8_t>> WindowFocusPlugin::EncodeScreenshotWithGdiplus(
+    const RawScreenshot& pixels, const WCHAR* mimeType, int quality) {
+    if (!captureContext_.StartGdiplus()) {
+        if (enableDebug_) {
+            std::cerr << "[WindowFocus] GDI+ startup failed" << std::endl;
+        }
         return std::nullopt;
     }
 
-    // Create GDI+ bitmap from HBITMAP
-    Gdiplus::Bitmap* bitmap = new Gdiplus::Bitmap(hbmScreen.Get(), NULL);
+    // Create GDI+ bitmap around the pixels without copying them
+    Gdiplus::Bitmap* bitmap =
+        new Gdiplus::Bitmap(pixels.width, pixels.height, pixels.stride, PixelFormat32bppRGB,
+                            const_cast<BYTE*>(pixels.pixels.data()));
     if (!bitmap || bitmap->GetLastStatus() != Gdiplus::Ok) {
         if (enableDebug_) {
             std::cerr << "[WindowFocus] Bitmap creation failed";
@@ -1632,7 +3492,7 @@ std::optional<std::vector<uint8_t>> WindowFocusPlugin::TakeScreenshot(bool activ
         return std::nullopt;
     }
 
-    // Create stream for PNG encoding
+    // Create stream for encoding
     IStream* stream = NULL;
     HRESULT hr = CreateStreamOnHGlobal(NULL, TRUE, &stream);
     if (FAILED(hr) || !stream) {
@@ -1644,19 +3504,28 @@ std::optional<std::vector<uint8_t>> WindowFocusPlugin::TakeScreenshot(bool activ
         return std::nullopt;
     }
 
-    // Find PNG encoder
-    CLSID pngClsid;
-    if (GetEncoderClsid(L"image/png", &pngClsid) < 0) {
+    // Find the encoder
+    CLSID encoderClsid;
+    if (!captureContext_.FindEncoder(mimeType, &encoderClsid)) {
         if (enableDebug_) {
-            std::cerr << "[WindowFocus] PNG encoder not found" << std::endl;
+            std::wcerr << L"[WindowFocus] GDI+ encoder not found for " << mimeType << std::endl;
         }
         stream->Release();
         delete bitmap;
         return std::nullopt;
     }
 
-    // Save bitmap to stream as PNG
-    Gdiplus::Status gdipStatus = bitmap->Save(stream, &pngClsid, NULL);
+    Gdiplus::EncoderParameters parameters;
+    ULONG qualityValue = static_cast<ULONG>(quality);
+    parameters.Count = 1;
+    parameters.Parameter[0].Guid = Gdiplus::EncoderQuality;
+    parameters.Parameter[0].Type = Gdiplus::EncoderParameterValueTypeLong;
+    parameters.Parameter[0].NumberOfValues = 1;
+    parameters.Parameter[0].Value = &qualityValue;
+
+    // Save bitmap to stream
+    Gdiplus::Status gdipStatus =
+        bitmap->Save(stream, &encoderClsid, quality > 0 ? &parameters : NULL);
     if (gdipStatus != Gdiplus::Ok) {
         if (enableDebug_) {
             std::cerr << "[WindowFocus] Bitmap Save failed: " << gdipStatus << std::endl;
@@ -1689,7 +3558,7 @@ std::optional<std::vector<uint8_t>> WindowFocusPlugin::TakeScreenshot(bool activ
         return std::nullopt;
     }
 
-    // Read PNG data from stream
+    // Read the encoded data from stream
     std::vector<uint8_t> data(fileSize);
     LARGE_INTEGER liZero = { 0 };
     hr = stream->Seek(liZero, STREAM_SEEK_SET, NULL);
@@ -1729,4 +3598,728 @@ std::optional<std::vector<uint8_t>> WindowFocusPlugin::TakeScreenshot(bool activ
     return std::nullopt;
 }
 
+// The pixels are in a buffer of the capture context, which callers done
+// with them may give back.
+std::optional<RawScreenshot> WindowFocusPlugin::TakeScreenshotRaw(const CaptureTarget& target,
+                                                                  bool rgba, int maxWidth,
+                                                                  int maxHeight) {
+    std::shared_ptr<CaptureContext::Surface> surface = CaptureScreen(target);
+    if (!surface) {
+        return std::nullopt;
+    }
+
+    RawScreenshot screenshot;
+    int width = 0;
+    int height = 0;
+    if (FitImageSize(surface->width, surface->height, maxWidth, maxHeight, &width, &height)) {
+        // Converted while it is averaged.
+        const auto start = std::chrono::steady_clock::now();
+        screenshot.width = width;
+        screenshot.height = height;
+        screenshot.pixels = captureContext_.AcquireBuffer(static_cast<size_t>(width) * height * 4);
+        DownscaleScreenshot(surface->bits, surface->width, surface->height, surface->width * 4,
+                            rgba, &screenshot);
+        if (enableDebug_) {
+            const std::chrono::duration<double, std::milli> elapsed =
+                std::chrono::steady_clock::now() - start;
+            std::cout << "[WindowFocus] Screenshot scaled from " << surface->width << "x"
+                      << surface->height << " to " << width << "x" << height << " in "
+                      << elapsed.count() << " ms" << std::endl;
+        }
+        return screenshot;
+    }
+
+    // 32-bit rows need no padding, so the surface is copied as one block.
+    screenshot.width = surface->width;
+    screenshot.height = surface->height;
+    screenshot.stride = surface->width * 4;
+    const size_t size = static_cast<size_t>(screenshot.stride) * screenshot.height;
+    screenshot.pixels = captureContext_.AcquireBuffer(size);
+    screenshot.pixels.assign(surface->bits, surface->bits + size);
+    ConvertScreenshotPixels(screenshot.pixels.data(),
+                            static_cast<size_t>(screenshot.width) * screenshot.height, rgba);
+    screenshot.format = rgba ? "rgba" : "bgra";
+    return screenshot;
+}
+
+void WindowFocusPlugin::StartScreenshotSchedule(const ScreenshotScheduleOptions& options) {
+    StopScreenshotSchedule();
+    screenshotScheduleStopping_ = false;
+    screenshotScheduleThread_ =
+        std::thread(&WindowFocusPlugin::RunScreenshotSchedule, this, options);
+}
+
+void WindowFocusPlugin::StopScreenshotSchedule() {
+    if (!screenshotScheduleThread_.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(screenshotScheduleMutex_);
+        screenshotScheduleStopping_ = true;
+    }
+    screenshotScheduleCv_.notify_all();
+    screenshotScheduleThread_.join();
+}
+
+// Writes |data| under a temporary name and renames it to |path|, so a
+// watcher never sees a partial file.
+static bool WriteScreenshotFile(const std::filesystem::path& path,
+                                const std::vector<uint8_t>& data, std::string* error) {
+    std::filesystem::path partial = path;
+    partial += L".part";
+    HANDLE file = CreateFileW(partial.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        *error = "Cannot create " + partial.u8string() + ": error " + std::to_string(GetLastError());
+        return false;
+    }
+    DWORD written = 0;
+    const bool ok = WriteFile(file, data.data(), static_cast<DWORD>(data.size()), &written, NULL) &&
+                    written == data.size();
+    const DWORD writeError = GetLastError();
+    CloseHandle(file);
+    if (!ok) {
+        *error = "Cannot write " + partial.u8string() + ": error " + std::to_string(writeError);
+        DeleteFileW(partial.c_str());
+        return false;
+    }
+    if (!MoveFileExW(partial.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+        *error = "Cannot rename " + partial.u8string() + ": error " + std::to_string(GetLastError());
+        DeleteFileW(partial.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Takes a screenshot every |options.interval| until StopScreenshotSchedule.
+// Ticks are skipped without capturing while the user is inactive, and after
+// capturing when the frame hashes the same as the last one saved. Ticks that
+// fall behind are dropped rather than bunched up.
+void WindowFocusPlugin::RunScreenshotSchedule(ScreenshotScheduleOptions options) {
+    const ScreenshotEncoder* encoder = FindScreenshotEncoder(options.format);
+    const std::filesystem::path directory = std::filesystem::u8path(options.directory);
+    const auto interval = (std::max)(options.interval, std::chrono::milliseconds(1));
+    bool haveHash = false;
+    uint64_t lastHash = 0;
+    int skippedIdle = 0;
+    int skippedUnchanged = 0;
+
+    auto next = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(screenshotScheduleMutex_);
+    while (!screenshotScheduleCv_.wait_until(lock, next,
+                                             [this]() { return screenshotScheduleStopping_; })) {
+        lock.unlock();
+        next += interval;
+        const auto now = std::chrono::steady_clock::now();
+        if (next < now) {
+            next += (now - next) / interval * interval + interval;
+        }
+
+        if (isShuttingDown_ || (options.skipWhenIdle && !userIsActive_)) {
+            skippedIdle++;
+            lock.lock();
+            continue;
+        }
+        const auto start = std::chrono::steady_clock::now();
+        const int64_t timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                      std::chrono::system_clock::now().time_since_epoch())
+                                      .count();
+        SYSTEMTIME local;
+        GetLocalTime(&local);
+        flutter::EncodableMap data;
+        std::string error;
+        try {
+            auto screenshot = TakeScreenshotRaw(CaptureTarget{options.activeWindowOnly}, false,
+                                                options.maxWidth, options.maxHeight);
+            if (!screenshot.has_value()) {
+                error = "Failed to take screenshot";
+            } else {
+                bool unchanged = false;
+                if (options.skipUnchanged) {
+                    const uint64_t hash = HashFramePixels(screenshot->pixels.data(),
+                                                          screenshot->width, screenshot->height,
+                                                          screenshot->stride);
+                    unchanged = haveHash && hash == lastHash;
+                    // Remembered before encoding: a frame that fails to save
+                    // is not retried every tick.
+                    haveHash = true;
+                    lastHash = hash;
+                }
+                if (unchanged) {
+                    skippedUnchanged++;
+                    lock.lock();
+                    continue;
+                }
+                std::optional<std::vector<uint8_t>> encoded =
+                    EncodeRawScreenshot(*screenshot, options.format, options.quality);
+                captureContext_.ReleaseBuffer(std::move(screenshot->pixels));
+                if (!encoded.has_value()) {
+                    error = "Failed to encode screenshot";
+                } else {
+                    wchar_t name[64];
+                    swprintf(name, 64, L"screenshot_%04u%02u%02u_%02u%02u%02u_%03u.",
+                             local.wYear, local.wMonth, local.wDay, local.wHour, local.wMinute,
+                             local.wSecond, local.wMilliseconds);
+                    std::filesystem::path path = directory / name;
+                    path += std::filesystem::u8path(encoder->name);
+                    if (WriteScreenshotFile(path, *encoded, &error)) {
+                        data[flutter::EncodableValue("path")] = flutter::EncodableValue(path.u8string());
+                        data[flutter::EncodableValue("format")] =
+                            flutter::EncodableValue(std::string(encoder->name));
+                        data[flutter::EncodableValue("width")] = flutter::EncodableValue(screenshot->width);
+                        data[flutter::EncodableValue("height")] =
+                            flutter::EncodableValue(screenshot->height);
+                        data[flutter::EncodableValue("size")] =
+                            flutter::EncodableValue(static_cast<int64_t>(encoded->size()));
+                    }
+                }
+            }
+        } catch (const std::exception& e) {
+            error = std::string("Exception taking scheduled screenshot: ") + e.what();
+        }
+
+        if (!error.empty()) {
+            data.clear();
+            data[flutter::EncodableValue("error")] = flutter::EncodableValue(error);
+        }
+        data[flutter::EncodableValue("timestamp")] = flutter::EncodableValue(timestamp);
+        data[flutter::EncodableValue("skippedIdle")] = flutter::EncodableValue(skippedIdle);
+        data[flutter::EncodableValue("skippedUnchanged")] = flutter::EncodableValue(skippedUnchanged);
+        if (enableDebug_) {
+            const std::chrono::duration<double, std::milli> elapsed =
+                std::chrono::steady_clock::now() - start;
+            if (error.empty()) {
+                std::cout << "[WindowFocus] Scheduled screenshot saved in " << elapsed.count()
+                          << " ms, " << skippedIdle << " idle and " << skippedUnchanged
+                          << " unchanged ticks skipped" << std::endl;
+            } else {
+                std::cerr << "[WindowFocus] Scheduled screenshot failed: " << error << std::endl;
+            }
+        }
+        skippedIdle = 0;
+        skippedUnchanged = 0;
+        SafeInvokeMethodWithMap("onScheduledScreenshot", data);
+        lock.lock();
+    }
+}
+
+std::optional<std::vector<uint8_t>> WindowFocusPlugin::EncodeRawScreenshot(
+    const RawScreenshot& screenshot, const std::string& format, int quality) {
+    const ScreenshotEncoder* encoder = FindScreenshotEncoder(format);
+    if (encoder == nullptr) {
+        return std::nullopt;
+    }
+    if (encoder->encode == nullptr) {
+        // Only JPEG falls back to GDI+.
+        return EncodeScreenshotWithGdiplus(screenshot, L"image/jpeg", quality);
+    }
+    std::vector<uint8_t> output;
+    if (!encoder->encode(screenshot.pixels.data(), screenshot.width, screenshot.height,
+                         screenshot.stride, quality, &output)) {
+        return std::nullopt;
+    }
+    return output;
+}
+
+void WindowFocusPlugin::StartScreenshotRing(const ScreenshotRingOptions& options) {
+    StopScreenshotRing();
+    ringOptions_ = options;
+    {
+        std::lock_guard<std::mutex> lock(ringMutex_);
+        ringStopping_ = false;
+        ring_ = std::make_unique<FrameRing>(options.frames, options.maxBytes);
+    }
+    ringThread_ = std::thread(&WindowFocusPlugin::RunScreenshotRing, this);
+}
+
+void WindowFocusPlugin::StopScreenshotRing() {
+    if (!ringThread_.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(ringMutex_);
+        ringStopping_ = true;
+    }
+    ringCv_.notify_all();
+    ringThread_.join();
+    std::lock_guard<std::mutex> lock(ringMutex_);
+    ring_.reset();
+}
+
+void WindowFocusPlugin::RunScreenshotRing() {
+    const auto interval = (std::max)(ringOptions_.interval, std::chrono::milliseconds(1));
+    auto next = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(ringMutex_);
+    while (!ringCv_.wait_until(lock, next, [this]() { return ringStopping_; })) {
+        lock.unlock();
+        if (!isShuttingDown_) {
+            try {
+                CaptureRingFrame();
+            } catch (const std::exception& e) {
+                if (enableDebug_) {
+                    std::cerr << "[WindowFocus] Exception capturing ring frame: " << e.what()
+                              << std::endl;
+                }
+            }
+        }
+        lock.lock();
+        next += interval;
+        const auto now = std::chrono::steady_clock::now();
+        if (next < now) {
+            next += (now - next) / interval * interval + interval;
+        }
+    }
+}
+
+// Only the ring thread reserves and writes, and readers never see a reserved
+// region, so frames are copied in without holding the lock.
+void WindowFocusPlugin::CaptureRingFrame() {
+    const auto start = std::chrono::steady_clock::now();
+    FrameRing::Frame frame;
+    frame.timestamp_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                            std::chrono::system_clock::now().time_since_epoch())
+                            .count();
+    auto screenshot = TakeScreenshotRaw(CaptureTarget{ringOptions_.activeWindowOnly}, false,
+                                        ringOptions_.maxWidth, ringOptions_.maxHeight);
+    if (!screenshot.has_value()) {
+        return;
+    }
+    frame.width = screenshot->width;
+    frame.height = screenshot->height;
+    std::optional<std::vector<uint8_t>> encoded;
+    if (!ringOptions_.raw) {
+        encoded = EncodeRawScreenshot(*screenshot, ringOptions_.format, ringOptions_.quality);
+        if (!encoded.has_value()) {
+            if (enableDebug_) {
+                std::cerr << "[WindowFocus] Ring failed to encode screenshot" << std::endl;
+            }
+            return;
+        }
+    }
+    const std::vector<uint8_t>& bytes = ringOptions_.raw ? screenshot->pixels : *encoded;
+    uint8_t* destination = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(ringMutex_);
+        destination = ring_->Reserve(bytes.size());
+    }
+    if (destination == nullptr) {
+        if (enableDebug_) {
+            std::cerr << "[WindowFocus] Ring frame of " << bytes.size()
+                      << " bytes does not fit in " << ring_->max_bytes() << std::endl;
+        }
+        return;
+    }
+    memcpy(destination, bytes.data(), bytes.size());
+    captureContext_.ReleaseBuffer(std::move(screenshot->pixels));
+    size_t frames = 0;
+    {
+        std::lock_guard<std::mutex> lock(ringMutex_);
+        ring_->Commit(frame);
+        frames = ring_->size();
+    }
+    if (enableDebug_) {
+        const std::chrono::duration<double, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+        std::cout << "[WindowFocus] Ring frame " << frame.width << "x" << frame.height
+                  << " stored in " << elapsed.count() << " ms, " << frames << " frames kept"
+                  << std::endl;
+    }
+}
+
+std::optional<std::vector<uint8_t>> WindowFocusPlugin::TakeScreenshotFromRing(
+    const CaptureTarget& target, const std::string& format, int quality, int maxWidth,
+    int maxHeight) {
+    const ScreenshotEncoder* encoder = FindScreenshotEncoder(format);
+    // Frames of a raw ring would have to be encoded on the platform thread;
+    // those requests go to a worker instead.
+    if (!ringThread_.joinable() || encoder == nullptr || ringOptions_.raw ||
+        CaptureTarget{ringOptions_.activeWindowOnly} != target ||
+        ringOptions_.maxWidth != maxWidth ||
+        ringOptions_.maxHeight != maxHeight || ringOptions_.format != format ||
+        (encoder->lossy && ringOptions_.quality != quality)) {
+        return std::nullopt;
+    }
+    std::vector<uint8_t> encoded;
+    int64_t timestampMs = 0;
+    {
+        std::lock_guard<std::mutex> lock(ringMutex_);
+        if (ring_ == nullptr || ring_->size() == 0) {
+            return std::nullopt;
+        }
+        const FrameRing::Frame& frame = ring_->frame(0);
+        const uint8_t* data = ring_->data(0);
+        timestampMs = frame.timestamp_ms;
+        encoded.assign(data, data + frame.size);
+    }
+    if (enableDebug_) {
+        const int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                std::chrono::system_clock::now().time_since_epoch())
+                                .count();
+        std::cout << "[WindowFocus] " << format << " screenshot taken from the ring, "
+                  << now - timestampMs << " ms old" << std::endl;
+    }
+    return encoded;
+}
+
+std::optional<RawScreenshot> WindowFocusPlugin::TakeScreenshotRawFromRing(
+    const CaptureTarget& target, bool rgba, int maxWidth, int maxHeight) {
+    if (!ringThread_.joinable() || !ringOptions_.raw ||
+        CaptureTarget{ringOptions_.activeWindowOnly} != target ||
+        ringOptions_.maxWidth != maxWidth ||
+        ringOptions_.maxHeight != maxHeight) {
+        return std::nullopt;
+    }
+    RawScreenshot screenshot;
+    {
+        std::lock_guard<std::mutex> lock(ringMutex_);
+        if (ring_ == nullptr || ring_->size() == 0) {
+            return std::nullopt;
+        }
+        const FrameRing::Frame& frame = ring_->frame(0);
+        const uint8_t* data = ring_->data(0);
+        screenshot.width = frame.width;
+        screenshot.height = frame.height;
+        screenshot.stride = frame.width * 4;
+        screenshot.pixels.assign(data, data + frame.size);
+    }
+    if (rgba) {
+        ConvertScreenshotPixels(screenshot.pixels.data(), screenshot.pixels.size() / 4, true);
+        screenshot.format = "rgba";
+    }
+    return screenshot;
+}
+
+flutter::EncodableList WindowFocusPlugin::GetRecentFrames(size_t count) {
+    flutter::EncodableList frames;
+    if (!ringThread_.joinable()) {
+        return frames;
+    }
+    const std::string format = ringOptions_.raw ? "bgra" : ringOptions_.format;
+    std::lock_guard<std::mutex> lock(ringMutex_);
+    if (ring_ == nullptr) {
+        return frames;
+    }
+    count = (std::min)(count, ring_->size());
+    for (size_t i = 0; i < count; i++) {
+        const FrameRing::Frame& frame = ring_->frame(i);
+        const uint8_t* data = ring_->data(i);
+        flutter::EncodableMap map;
+        map[flutter::EncodableValue("timestamp")] = flutter::EncodableValue(frame.timestamp_ms);
+        map[flutter::EncodableValue("width")] = flutter::EncodableValue(frame.width);
+        map[flutter::EncodableValue("height")] = flutter::EncodableValue(frame.height);
+        map[flutter::EncodableValue("format")] = flutter::EncodableValue(format);
+        if (ringOptions_.raw) {
+            map[flutter::EncodableValue("stride")] = flutter::EncodableValue(frame.width * 4);
+        }
+        map[flutter::EncodableValue("data")] =
+            flutter::EncodableValue(std::vector<uint8_t>(data, data + frame.size));
+        frames.push_back(flutter::EncodableValue(std::move(map)));
+    }
+    return frames;
+}
+
+
+bool WindowFocusPlugin::SubmitScreenshot(ScreenshotRequest request) {
+    std::lock_guard<std::mutex> lock(screenshotQueueMutex_);
+    if (screenshotWorkersStopping_) {
+        return false;
+    }
+    if (screenshotWorkers_.empty()) {
+        for (int i = 0; i < kScreenshotWorkers; i++) {
+            screenshotWorkers_.emplace_back(&WindowFocusPlugin::RunScreenshotWorker, this);
+        }
+    }
+    // Deltas never share a capture.
+    auto sameTarget = [&request](const ScreenshotJob& job) {
+        return !request.delta.has_value() && !job.delta.has_value() &&
+               job.target == request.target && job.maxWidth == request.maxWidth &&
+               job.maxHeight == request.maxHeight;
+    };
+    for (ScreenshotJob* job : screenshotsCapturing_) {
+        if (sameTarget(*job)) {
+            job->requests.push_back(std::move(request));
+            return true;
+        }
+    }
+    for (const auto& job : screenshotQueue_) {
+        if (sameTarget(*job)) {
+            job->requests.push_back(std::move(request));
+            return true;
+        }
+    }
+    if (screenshotQueue_.size() >= kMaxQueuedScreenshots) {
+        return false;
+    }
+    auto job = std::make_unique<ScreenshotJob>();
+    job->target = request.target;
+    job->maxWidth = request.maxWidth;
+    job->maxHeight = request.maxHeight;
+    job->delta = request.delta;
+    job->requests.push_back(std::move(request));
+    screenshotQueue_.push_back(std::move(job));
+    screenshotQueueCv_.notify_one();
+    return true;
+}
+
+// Each monitor is a job of its own, so the workers capture and encode them
+// in parallel.
+void WindowFocusPlugin::TakeMonitorScreenshots(
+    const std::string& format, int quality, int maxWidth, int maxHeight,
+    std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result) {
+    const size_t count = ListMonitors().size();
+    if (count == 0) {
+        result->Error("SCREENSHOT_ERROR", "Failed to take screenshot");
+        return;
+    }
+    auto collector = std::make_shared<MonitorScreenshotCollector>(count, std::move(result));
+    for (size_t i = 0; i < count; i++) {
+        ScreenshotRequest request;
+        request.target.monitor = static_cast<int>(i);
+        request.maxWidth = maxWidth;
+        request.maxHeight = maxHeight;
+        request.format = format;
+        request.quality = quality;
+        request.result = collector->Part(static_cast<int>(i));
+        if (!SubmitScreenshot(request)) {
+            request.result->Error("SCREENSHOT_BUSY",
+                                  "Too many screenshots pending, at most " +
+                                      std::to_string(kMaxQueuedScreenshots) + " are queued.");
+        }
+    }
+}
+
+// Captures already running finish, but only answer requests made after the
+// cancel.
+size_t WindowFocusPlugin::CancelScreenshots() {
+    std::vector<ScreenshotRequest> cancelled;
+    {
+        std::lock_guard<std::mutex> lock(screenshotQueueMutex_);
+        for (const auto& job : screenshotQueue_) {
+            std::move(job->requests.begin(), job->requests.end(), std::back_inserter(cancelled));
+        }
+        screenshotQueue_.clear();
+        for (ScreenshotJob* job : screenshotsCapturing_) {
+            std::move(job->requests.begin(), job->requests.end(), std::back_inserter(cancelled));
+            job->requests.clear();
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(channelMutex_);
+        for (ScreenshotRequest& request : cancelled) {
+            request.result->Error("SCREENSHOT_CANCELLED", "Screenshot cancelled");
+        }
+    }
+    if (enableDebug_ && !cancelled.empty()) {
+        std::cout << "[WindowFocus] Cancelled " << cancelled.size() << " screenshot requests"
+                  << std::endl;
+    }
+    return cancelled.size();
+}
+
+void WindowFocusPlugin::StopScreenshotWorkers() {
+    {
+        std::lock_guard<std::mutex> lock(screenshotQueueMutex_);
+        screenshotWorkersStopping_ = true;
+    }
+    screenshotQueueCv_.notify_all();
+    CancelScreenshots();
+    for (std::thread& worker : screenshotWorkers_) {
+        worker.join();
+    }
+    screenshotWorkers_.clear();
+}
+
+void WindowFocusPlugin::RunScreenshotWorker() {
+    std::unique_lock<std::mutex> lock(screenshotQueueMutex_);
+    while (true) {
+        // The first job that can start: deltas wait for the one running, so
+        // deltaEncoder_ sees the frames in the order they were requested.
+        auto next = screenshotQueue_.end();
+        screenshotQueueCv_.wait(lock, [this, &next]() {
+            if (screenshotWorkersStopping_) {
+                return true;
+            }
+            next = std::find_if(screenshotQueue_.begin(), screenshotQueue_.end(),
+                                [this](const std::unique_ptr<ScreenshotJob>& job) {
+                                    return !job->delta.has_value() || !screenshotDeltaRunning_;
+                                });
+            return next != screenshotQueue_.end();
+        });
+        if (screenshotWorkersStopping_) {
+            return;
+        }
+        std::unique_ptr<ScreenshotJob> job = std::move(*next);
+        screenshotQueue_.erase(next);
+        screenshotsCapturing_.push_back(job.get());
+        const bool delta = job->delta.has_value();
+        screenshotDeltaRunning_ = screenshotDeltaRunning_ || delta;
+        lock.unlock();
+        if (delta) {
+            AnswerScreenshotDelta(job.get());
+        } else {
+            AnswerScreenshotJob(job.get());
+        }
+        lock.lock();
+        if (delta) {
+            screenshotDeltaRunning_ = false;
+            // The next delta may be waiting for this one.
+            screenshotQueueCv_.notify_all();
+        }
+    }
+}
+
+// Answered before the next delta can start, so the replies keep the order
+// of their sequence numbers.
+void WindowFocusPlugin::AnswerScreenshotDelta(ScreenshotJob* job) {
+    const auto start = std::chrono::steady_clock::now();
+    std::optional<RawScreenshot> frame;
+    std::string error = "Failed to take screenshot delta";
+    try {
+        frame = TakeScreenshotRaw(job->target, false, job->maxWidth, job->maxHeight);
+    } catch (const std::exception& e) {
+        error = std::string("Exception taking screenshot delta: ") + e.what();
+    } catch (...) {
+        error = "Unknown exception taking screenshot delta";
+    }
+
+    std::vector<ScreenshotRequest> requests;
+    {
+        std::lock_guard<std::mutex> lock(screenshotQueueMutex_);
+        screenshotsCapturing_.erase(
+            std::find(screenshotsCapturing_.begin(), screenshotsCapturing_.end(), job));
+        requests.swap(job->requests);
+    }
+    // A cancelled delta is not encoded, so the sequence has no gap.
+    if (requests.empty()) {
+        if (frame.has_value()) {
+            captureContext_.ReleaseBuffer(std::move(frame->pixels));
+        }
+        return;
+    }
+
+    const auto captured = std::chrono::steady_clock::now();
+    std::optional<ScreenDelta> delta;
+    if (frame.has_value()) {
+        const ScreenshotDeltaOptions& options = *job->delta;
+        if (!deltaEncoder_ || deltaEncoder_->tile_size() != options.tileSize ||
+            deltaEncoder_->keyframe_interval() != options.keyframeInterval) {
+            deltaEncoder_ = std::make_unique<ScreenDeltaEncoder>(options.tileSize,
+                                                                 options.keyframeInterval);
+        }
+        delta.emplace();
+        if (!deltaEncoder_->Encode(frame->pixels.data(), frame->width, frame->height,
+                                   frame->stride, options.keyframe, &*delta)) {
+            delta.reset();
+        }
+        captureContext_.ReleaseBuffer(std::move(frame->pixels));
+    }
+    if (enableDebug_ && delta.has_value()) {
+        const std::chrono::duration<double, std::milli> captureTime = captured - start;
+        const std::chrono::duration<double, std::milli> encodeTime =
+            std::chrono::steady_clock::now() - captured;
+        std::cout << "[WindowFocus] Screenshot delta " << delta->sequence << ": "
+                  << delta->tiles.size() << " tiles" << (delta->keyframe ? " (keyframe)" : "")
+                  << ", capture " << captureTime.count() << " ms, encode " << encodeTime.count()
+                  << " ms, " << delta->data.size() << " bytes" << std::endl;
+    }
+
+    std::lock_guard<std::mutex> lock(channelMutex_);
+    for (ScreenshotRequest& request : requests) {
+        if (delta.has_value()) {
+            request.result->Success(ScreenshotDeltaReply(std::move(*delta)));
+        } else {
+            request.result->Error("SCREENSHOT_ERROR", error);
+        }
+    }
+}
+
+// Captures once for every request of |job|, and encodes once for each
+// distinct format among them.
+void WindowFocusPlugin::AnswerScreenshotJob(ScreenshotJob* job) {
+    const auto start = std::chrono::steady_clock::now();
+    std::optional<RawScreenshot> screenshot;
+    std::string error = "Failed to take screenshot";
+    try {
+        screenshot = TakeScreenshotRaw(job->target, false, job->maxWidth, job->maxHeight);
+    } catch (const std::exception& e) {
+        error = std::string("Exception taking screenshot: ") + e.what();
+    } catch (...) {
+        error = "Unknown exception taking screenshot";
+    }
+
+    // Requests arriving from now on need a capture of their own.
+    std::vector<ScreenshotRequest> requests;
+    {
+        std::lock_guard<std::mutex> lock(screenshotQueueMutex_);
+        screenshotsCapturing_.erase(
+            std::find(screenshotsCapturing_.begin(), screenshotsCapturing_.end(), job));
+        requests.swap(job->requests);
+    }
+    if (requests.empty()) {
+        return;
+    }
+    if (!screenshot.has_value()) {
+        std::lock_guard<std::mutex> lock(channelMutex_);
+        for (ScreenshotRequest& request : requests) {
+            request.result->Error("SCREENSHOT_ERROR", error);
+        }
+        return;
+    }
+
+    const auto captured = std::chrono::steady_clock::now();
+    std::vector<std::optional<flutter::EncodableValue>> replies(requests.size());
+    int encodes = 0;
+    for (size_t i = 0; i < requests.size(); i++) {
+        const ScreenshotRequest& request = requests[i];
+        size_t same = 0;
+        while (same < i && !SameScreenshotOutput(requests[same], request)) {
+            same++;
+        }
+        if (same < i) {
+            replies[i] = replies[same];
+            continue;
+        }
+        encodes++;
+        try {
+            if (request.raw) {
+                RawScreenshot pixels = *screenshot;
+                if (request.rgba) {
+                    ConvertScreenshotPixels(pixels.pixels.data(), pixels.pixels.size() / 4, true);
+                    pixels.format = "rgba";
+                }
+                replies[i] = RawScreenshotReply(std::move(pixels));
+            } else {
+                auto encoded = EncodeRawScreenshot(*screenshot, request.format, request.quality);
+                if (encoded.has_value()) {
+                    replies[i] = flutter::EncodableValue(std::move(*encoded));
+                }
+            }
+        } catch (const std::exception& e) {
+            if (enableDebug_) {
+                std::cerr << "[WindowFocus] Exception encoding screenshot: " << e.what()
+                          << std::endl;
+            }
+        }
+    }
+    if (enableDebug_) {
+        const std::chrono::duration<double, std::milli> capture = captured - start;
+        const std::chrono::duration<double, std::milli> encode =
+            std::chrono::steady_clock::now() - captured;
+        std::cout << "[WindowFocus] Screenshot " << screenshot->width << "x"
+                  << screenshot->height << " for " << requests.size() << " requests: capture "
+                  << capture.count() << " ms, " << encodes << " encodes " << encode.count()
+                  << " ms" << std::endl;
+    }
+    captureContext_.ReleaseBuffer(std::move(screenshot->pixels));
+
+    std::lock_guard<std::mutex> lock(channelMutex_);
+    for (size_t i = 0; i < requests.size(); i++) {
+        if (replies[i].has_value()) {
+            requests[i].result->Success(*replies[i]);
+        } else {
+            requests[i].result->Error("SCREENSHOT_ERROR", "Failed to encode screenshot");
+        }
+    }
+}
+
 }  // namespace window_focus
\ No newline at end of file
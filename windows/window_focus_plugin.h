@@ -11,20 +11,382 @@
 #include <endpointvolume.h>
 #include <mmdeviceapi.h>
 #include <hidsdi.h>
+#include <cfgmgr32.h>
 
 #include <memory>
 #include <string>
 #include <optional>
 #include <vector>
+#include <deque>
 #include <chrono>
 #include <mutex>
 #include <atomic>
 #include <condition_variable>
 #include <thread>
 #include <functional>
+#include <unordered_map>
+
+#include "frame_ring.h"
+#include "input_device_stats.h"
+#include "screen_delta.h"
+#include "screenshot_encoder.h"
 
 namespace window_focus {
 
+// An absolute input value such as a stick, trigger or wheel. The offset is
+// into the input report buffer, report ID byte included.
+struct HIDAxisField {
+  UCHAR reportId = 0;
+  ULONG bitOffset = 0;
+  ULONG bitSize = 0;
+  LONG logicalMin = 0;
+  LONG logicalMax = 0;
+};
+
+// What InitializeHIDDevices learned about one HID interface. Cached by device
+// path so a reconnecting device does not need its preparsed data again.
+struct HIDDeviceInfo {
+  USHORT vendorId = 0;
+  USHORT productId = 0;
+  USHORT usagePage = 0;
+  USHORT usage = 0;
+  USHORT inputReportByteLength = 0;
+  std::vector<HIDAxisField> axes;
+  std::wstring productName;
+};
+
+// Decides whether a HID input report reflects user input.
+//
+// Controllers like the DualSense stream gyro, accelerometer, battery and
+// timestamp fields in every report, even untouched. For a short calibration
+// period after a report ID is first seen, the filter counts which bits toggle
+// on their own and afterwards masks them out of the comparison. Axes are
+// compared against a deadzone instead of bitwise.
+class HIDReportFilter {
+ public:
+  static constexpr std::chrono::milliseconds kCalibrationPeriod{2000};
+  // Below this many reports there is not enough data to call a bit noisy.
+  static constexpr int kMinCalibrationReports = 8;
+
+  // |deadzone| is a fraction of each axis range, 0 to disable.
+  HIDReportFilter(size_t reportLength, std::vector<HIDAxisField> axes, double deadzone);
+
+  // Compares |report| with the previous report carrying the same report ID.
+  // The first report of each ID only sets the baseline and returns false.
+  bool Update(const BYTE* report, size_t length, std::chrono::steady_clock::time_point now);
+  void SetDeadzone(double deadzone);
+
+  double Deadzone() const { return deadzone_; }
+
+ private:
+  struct AxisState {
+    HIDAxisField field;
+    // Value at the last change that counted as input.
+    LONG reference = 0;
+    LONG previous = 0;
+    LONGLONG deadzone = 0;
+    LONGLONG noise = 0;
+    int changes = 0;
+  };
+
+  struct ReportState {
+    BYTE reportId = 0;
+    std::vector<BYTE> lastReport;
+    // 1 bits take part in the bitwise comparison.
+    std::vector<BYTE> mask;
+    std::vector<AxisState> axes;
+    bool hasReport = false;
+    bool calibrating = true;
+    std::chrono::steady_clock::time_point calibrationStart;
+    int calibrationReports = 0;
+    std::vector<uint16_t> toggleCounts;
+  };
+
+  ReportState& StateFor(BYTE reportId);
+  void FinishCalibration(ReportState& state);
+  void UpdateAxisDeadzone(AxisState& axis, bool calibrating) const;
+
+  size_t reportLength_;
+  std::vector<HIDAxisField> axes_;
+  double deadzone_;
+  std::vector<ReportState> reports_;
+};
+
+// Input report storage for every open HID device in one contiguous block.
+// Each device gets two cache-line aligned slots: the overlapped read in
+// flight fills one while the other holds the report being filtered.
+class HIDReportSlab {
+ public:
+  static constexpr size_t kCacheLineSize = 64;
+
+  // Lays out two slots for each entry of |reportLengths|. Earlier slot
+  // pointers become invalid, so no read may be pending when this is called.
+  void Layout(const std::vector<DWORD>& reportLengths);
+  void Clear();
+
+  BYTE* Slot(size_t device, int half) {
+    return lines_[offsets_[device] + half * slotLines_[device]].bytes;
+  }
+
+ private:
+  struct alignas(kCacheLineSize) CacheLine {
+    BYTE bytes[kCacheLineSize];
+  };
+
+  std::vector<CacheLine> lines_;
+  // Per device: first line of slot 0, and lines per slot.
+  std::vector<size_t> offsets_;
+  std::vector<size_t> slotLines_;
+};
+
+// Overlapped read state of one open HID device. Created with the device and
+// reused for every read, so polling never creates events.
+struct HIDReadContext {
+  OVERLAPPED overlapped = {};
+  // Slab slot the read in flight writes to.
+  int activeHalf = 0;
+  bool pending = false;
+};
+
+// Peak meter of the default render endpoint, kept alive between polls.
+// The enumerator, endpoint and IAudioMeterInformation are acquired once on
+// the monitoring thread and reading a peak is a single COM call. Endpoint
+// notifications mark them stale when the default device changes or an
+// endpoint goes away, and the next read acquires the new one.
+//
+// The owner controls the lifetime: the enumerator only holds references
+// between registration and Close(), so Release() never deletes.
+class AudioPeakMeter : public IMMNotificationClient {
+ public:
+  AudioPeakMeter() = default;
+  ~AudioPeakMeter();
+
+  AudioPeakMeter(const AudioPeakMeter&) = delete;
+  AudioPeakMeter& operator=(const AudioPeakMeter&) = delete;
+
+  // Monitoring thread only, with COM initialized. Returns false if there is
+  // no endpoint or the read failed; |comError| is set if a COM call raised.
+  bool ReadPeak(float* peak, bool* comError);
+  // Unregisters the notification client and releases the endpoint.
+  void Close();
+
+  // IUnknown
+  ULONG STDMETHODCALLTYPE AddRef() override;
+  ULONG STDMETHODCALLTYPE Release() override;
+  HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** object) override;
+
+  // IMMNotificationClient; called on system threads.
+  HRESULT STDMETHODCALLTYPE OnDefaultDeviceChanged(EDataFlow flow, ERole role,
+                                                   LPCWSTR deviceId) override;
+  HRESULT STDMETHODCALLTYPE OnDeviceStateChanged(LPCWSTR deviceId, DWORD newState) override;
+  HRESULT STDMETHODCALLTYPE OnDeviceAdded(LPCWSTR deviceId) override;
+  HRESULT STDMETHODCALLTYPE OnDeviceRemoved(LPCWSTR deviceId) override;
+  HRESULT STDMETHODCALLTYPE OnPropertyValueChanged(LPCWSTR deviceId,
+                                                   const PROPERTYKEY key) override;
+
+ private:
+  bool Acquire(bool* comError);
+  void ReleaseEndpoint();
+
+  IMMDeviceEnumerator* enumerator_ = nullptr;
+  IMMDevice* device_ = nullptr;
+  IAudioMeterInformation* meter_ = nullptr;
+  bool registered_ = false;
+  std::atomic<bool> stale_{true};
+  std::atomic<ULONG> refCount_{1};
+};
+
+// Uncompressed screenshot: top-down rows of opaque 32-bit pixels.
+struct RawScreenshot {
+  int width = 0;
+  int height = 0;
+  // Bytes per row.
+  int stride = 0;
+  // "bgra" or "rgba".
+  const char* format = "bgra";
+  std::vector<uint8_t> pixels;
+};
+
+class GdiplusInitializer;
+
+// Idle capture surfaces and pixel buffers the capture context keeps.
+constexpr size_t kMaxIdleCaptureSurfaces = 2;
+constexpr size_t kMaxIdleScreenshotBuffers = 4;
+
+// What screenshots keep between calls: GDI+, started once, the CLSIDs of
+// its encoders, and the surfaces and buffers frames are captured and scaled
+// into.
+//
+// A surface is a memory DC with a DIB section selected into it, so BitBlt
+// writes straight into memory the pixels are read from. Released surfaces
+// are handed out again for captures of the same size, and released buffers
+// for requests that fit in them. Both are dropped when the virtual screen
+// moves or changes size.
+//
+// Thread-safe; a surface is used by one thread at a time.
+class CaptureContext {
+ public:
+  struct Surface {
+    ~Surface();
+
+    HDC dc = nullptr;
+    HBITMAP bitmap = nullptr;
+    HGDIOBJ previous = nullptr;
+    // Top-down BGRX rows of |width| * 4 bytes.
+    uint8_t* bits = nullptr;
+    int width = 0;
+    int height = 0;
+    // Surfaces from before the displays changed are not reused.
+    uint64_t generation = 0;
+  };
+
+  CaptureContext();
+  // Shuts GDI+ down, so no GDI+ object may outlive the context.
+  ~CaptureContext();
+
+  CaptureContext(const CaptureContext&) = delete;
+  CaptureContext& operator=(const CaptureContext&) = delete;
+
+  // Starts GDI+ on first use. Returns false when it cannot be started.
+  bool StartGdiplus();
+  // The encoder GDI+ has for |mimeType|, looked up once.
+  bool FindEncoder(const WCHAR* mimeType, CLSID* clsid);
+
+  // A surface of |width| x |height| that comes back to the context when
+  // dropped, or null when none can be created.
+  std::shared_ptr<Surface> AcquireSurface(int width, int height);
+
+  // An empty buffer with room for at least |capacity| bytes, reusing the
+  // smallest released one that has it.
+  std::vector<uint8_t> AcquireBuffer(size_t capacity);
+  // Keeps |buffer|'s memory for a later AcquireBuffer.
+  void ReleaseBuffer(std::vector<uint8_t> buffer);
+
+  size_t IdleSurfaces() const;
+  size_t IdleBuffers() const;
+
+ private:
+  // Moves what was kept for the old displays to |dropped| when the virtual
+  // screen changed. Called with |mutex_| held.
+  void CheckDisplaysLocked(std::vector<std::unique_ptr<Surface>>* dropped);
+  void Return(Surface* surface);
+
+  mutable std::mutex mutex_;
+  std::unique_ptr<GdiplusInitializer> gdiplus_;
+  std::unordered_map<std::wstring, CLSID> encoders_;
+  std::vector<std::unique_ptr<Surface>> idleSurfaces_;
+  std::vector<std::vector<uint8_t>> idleBuffers_;
+  RECT displays_ = {};
+  uint64_t generation_ = 0;
+};
+
+// Options of startScreenshotSchedule.
+struct ScreenshotScheduleOptions {
+  std::chrono::milliseconds interval{60000};
+  // UTF-8.
+  std::string directory;
+  std::string format = "png";
+  int quality = kDefaultScreenshotQuality;
+  bool activeWindowOnly = false;
+  int maxWidth = 0;
+  int maxHeight = 0;
+  // Skip ticks while the user is inactive.
+  bool skipWhenIdle = true;
+  // Skip frames that hash the same as the last one saved.
+  bool skipUnchanged = true;
+};
+
+// Options of startScreenshotRing.
+struct ScreenshotRingOptions {
+  std::chrono::milliseconds interval{1000};
+  size_t frames = kDefaultRingFrames;
+  size_t maxBytes = kDefaultRingBytes;
+  // Store opaque BGRA pixels instead of |format|.
+  bool raw = false;
+  std::string format = "qoi";
+  int quality = kDefaultScreenshotQuality;
+  bool activeWindowOnly = false;
+  int maxWidth = 0;
+  int maxHeight = 0;
+};
+
+// Workers takeScreenshot, takeScreenshotRaw and takeScreenshotDelta run on.
+constexpr int kScreenshotWorkers = 2;
+// Captures that may wait for a worker before a screenshot is refused.
+constexpr size_t kMaxQueuedScreenshots = 8;
+
+// What a screenshot captures: the desktop, unless narrowed down to the
+// foreground window, a window, a region or one monitor, which take precedence
+// in that order. Only those pixels are copied from the screen.
+struct CaptureTarget {
+  bool activeWindowOnly = false;
+  // A window by HWND value, as onFocusChange reports it, or 0.
+  int64_t window = 0;
+  // For the active window or |window|: its client area, without the frame.
+  bool clientAreaOnly = false;
+  // A rectangle in virtual screen pixels; empty for none.
+  RECT region = {};
+  // Index in the getMonitors list, or -1.
+  int monitor = -1;
+
+  bool HasRegion() const {
+    return region.right > region.left && region.bottom > region.top;
+  }
+  bool operator==(const CaptureTarget& other) const {
+    return activeWindowOnly == other.activeWindowOnly && window == other.window &&
+           clientAreaOnly == other.clientAreaOnly && region.left == other.region.left &&
+           region.top == other.region.top && region.right == other.region.right &&
+           region.bottom == other.region.bottom && monitor == other.monitor;
+  }
+  bool operator!=(const CaptureTarget& other) const { return !(*this == other); }
+};
+
+// A display monitor as getMonitors reports it, in virtual screen pixels.
+struct MonitorInfo {
+  // UTF-8 device name, such as \\.\DISPLAY1.
+  std::string name;
+  RECT bounds = {};
+  // Effective DPI over 96.
+  double scale = 1.0;
+  bool primary = false;
+};
+
+// What takeScreenshotDelta asks for besides its capture target.
+struct ScreenshotDeltaOptions {
+  int tileSize = kDefaultDeltaTileSize;
+  int keyframeInterval = kDefaultDeltaKeyframeInterval;
+  bool keyframe = false;
+};
+
+// A takeScreenshot, takeScreenshotRaw or takeScreenshotDelta call waiting
+// for a worker.
+struct ScreenshotRequest {
+  CaptureTarget target;
+  int maxWidth = 0;
+  int maxHeight = 0;
+  // takeScreenshotRaw, for BGRA or RGBA pixels; otherwise encoded as
+  // |format|.
+  bool raw = false;
+  bool rgba = false;
+  std::string format = "png";
+  int quality = kDefaultScreenshotQuality;
+  // Set for takeScreenshotDelta, answered with the tiles changed since the
+  // previous delta.
+  std::optional<ScreenshotDeltaOptions> delta;
+  std::shared_ptr<flutter::MethodResult<flutter::EncodableValue>> result;
+};
+
+// Requests for the same target, answered from one capture. A delta request
+// is a job of its own.
+struct ScreenshotJob {
+  CaptureTarget target;
+  int maxWidth = 0;
+  int maxHeight = 0;
+  // Copied from the delta request, which a cancel may take away.
+  std::optional<ScreenshotDeltaOptions> delta;
+  std::vector<ScreenshotRequest> requests;
+};
+
 class WindowFocusPlugin : public flutter::Plugin {
  public:
   static void RegisterWithRegistrar(flutter::PluginRegistrarWindows* registrar);
@@ -59,14 +421,86 @@ class WindowFocusPlugin : public flutter::Plugin {
   bool CheckRawInput();
   bool CheckKeyboardInput();
   bool CheckSystemAudio();
+  // Whether |appName| (process |processId|) is playing audio above the
+  // threshold. Needs COM on the calling thread.
+  bool IsAppAudioActive(DWORD processId, const std::string& appName);
 
   // HID device management
   void InitializeHIDDevices();
   bool CheckHIDDevices();
   void CloseHIDDevices();
+  void StartHIDEnumeration();
+  bool AddHIDDevice(const std::wstring& devicePath,
+                    std::chrono::steady_clock::time_point arrivalTime,
+                    HIDDeviceInfo* addedInfo);
+  void RemoveHIDDevice(const std::wstring& devicePath);
+  void EraseHIDDeviceAt(size_t index);
+  bool StartHIDRead(size_t index, DWORD* errorCode);
+  void CancelPendingHIDReads();
+  void SendHIDDeviceChange(const char* action, const std::wstring& devicePath,
+                           const HIDDeviceInfo& info);
+
+  // HID hotplug notifications
+  void RegisterHIDNotifications();
+  void UnregisterHIDNotifications();
+  static DWORD CALLBACK HIDNotificationCallback(
+      HCMNOTIFICATION notification, PVOID context, CM_NOTIFY_ACTION action,
+      PCM_NOTIFY_EVENT_DATA eventData, DWORD eventDataSize);
+
+  // Device inventory
+  flutter::EncodableList GetInputDevices();
 
   // Screenshot
-  std::optional<std::vector<uint8_t>> TakeScreenshot(bool activeWindowOnly);
+  std::optional<std::vector<uint8_t>> EncodeScreenshotWithGdiplus(
+      const RawScreenshot& pixels, const WCHAR* mimeType, int quality);
+  // |maxWidth| and |maxHeight| shrink the capture to fit; 0 means no limit.
+  std::optional<RawScreenshot> TakeScreenshotRaw(const CaptureTarget& target, bool rgba,
+                                                 int maxWidth = 0,
+                                                 int maxHeight = 0);
+  std::shared_ptr<CaptureContext::Surface> CaptureScreen(const CaptureTarget& target);
+  // The attached monitors, in the order EnumDisplayMonitors reports them.
+  static std::vector<MonitorInfo> ListMonitors();
+
+  // Screenshot schedule: captures, encodes and writes files on a thread of
+  // its own and reports the paths through onScheduledScreenshot.
+  void StartScreenshotSchedule(const ScreenshotScheduleOptions& options);
+  void StopScreenshotSchedule();
+  void RunScreenshotSchedule(ScreenshotScheduleOptions options);
+
+  // Screenshot ring: captures at a low rate on a thread of its own into a
+  // FrameRing that takeScreenshot, takeScreenshotRaw and getRecentFrames
+  // read.
+  void StartScreenshotRing(const ScreenshotRingOptions& options);
+  void StopScreenshotRing();
+  void RunScreenshotRing();
+  void CaptureRingFrame();
+  // The newest ring frame, when the running ring captures what is asked for
+  // and stores it in |format|.
+  std::optional<std::vector<uint8_t>> TakeScreenshotFromRing(const CaptureTarget& target,
+                                                             const std::string& format,
+                                                             int quality, int maxWidth,
+                                                             int maxHeight);
+  std::optional<RawScreenshot> TakeScreenshotRawFromRing(const CaptureTarget& target, bool rgba,
+                                                         int maxWidth, int maxHeight);
+  flutter::EncodableList GetRecentFrames(size_t count);
+
+  // Screenshot workers: take takeScreenshot, takeScreenshotRaw and
+  // takeScreenshotDelta off the platform thread and complete their results.
+  // Requests for a target that is queued or being captured share that
+  // capture. Deltas run one at a time, in the order they were requested.
+  bool SubmitScreenshot(ScreenshotRequest request);
+  // takeMonitorScreenshots: one request per monitor, answered together.
+  void TakeMonitorScreenshots(const std::string& format, int quality, int maxWidth,
+                              int maxHeight,
+                              std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result);
+  size_t CancelScreenshots();
+  void StopScreenshotWorkers();
+  void RunScreenshotWorker();
+  void AnswerScreenshotJob(ScreenshotJob* job);
+  void AnswerScreenshotDelta(ScreenshotJob* job);
+  std::optional<std::vector<uint8_t>> EncodeRawScreenshot(const RawScreenshot& screenshot,
+                                                          const std::string& format,
+                                                          int quality);
 
   // Safe Flutter method invocation
   void SafeInvokeMethod(const std::string& methodName, const std::string& message);
@@ -103,16 +537,88 @@ class WindowFocusPlugin : public flutter::Plugin {
   // Controller monitoring
   std::atomic<bool> monitorControllers_{false};
   XINPUT_STATE lastControllerStates_[XUSER_MAX_COUNT];
+  std::atomic<bool> controllerConnected_[XUSER_MAX_COUNT]{};
+  InputDeviceStats controllerStats_[XUSER_MAX_COUNT];
 
   // Audio monitoring
   std::atomic<bool> monitorAudio_{false};
   float audioThreshold_ = 0.01f;
+  // Last peak read by the monitoring thread, reported by getAudioLevel.
+  std::atomic<float> lastAudioPeak_{0.0f};
+  // Monitoring thread only.
+  std::unique_ptr<AudioPeakMeter> audioPeakMeter_;
 
   // HID device monitoring
   std::atomic<bool> monitorHIDDevices_{false};
+  // Per-device state is kept as parallel arrays indexed like
+  // hidDeviceHandles_, so the polling loop walks contiguous memory.
   std::vector<HANDLE> hidDeviceHandles_;
-  std::vector<std::vector<BYTE>> lastHIDStates_;
+  std::vector<DWORD> hidReportLengths_;
+  std::vector<HIDReadContext> hidReadContexts_;
+  std::vector<HIDReportFilter> hidReportFilters_;
+  // Shared with getInputDevices, which reads them outside the lock.
+  std::vector<std::shared_ptr<InputDeviceStats>> hidDeviceStats_;
+  HIDReportSlab hidReportSlab_;
+  // Set when devices were added or removed; the slab is laid out again
+  // before the next poll.
+  bool hidReportSlabStale_ = false;
+  // Normalized device paths.
+  std::vector<std::wstring> hidDevicePaths_;
+  // Arrival time of hotplugged devices until their first input is seen: a
+  // report the filter counts, not the baseline report every device sends
+  // once it is opened. Default-constructed for devices present at startup.
+  std::vector<std::chrono::steady_clock::time_point> hidDeviceArrivals_;
+  std::unordered_map<std::wstring, HIDDeviceInfo> hidDeviceCache_;
   std::mutex hidDevicesMutex_;
+  std::atomic<HCMNOTIFICATION> hidNotification_{nullptr};
+
+  // Background HID enumeration started by setHIDMonitoring
+  std::thread hidEnumerationThread_;
+  std::mutex hidEnumerationMutex_;
+  std::atomic<bool> hidEnumerationRunning_{false};
+  std::atomic<bool> hidEnumerationRequested_{false};
+
+  // Fraction of each analog axis range ignored as noise
+  std::atomic<double> hidAxisDeadzone_{0.0};
+
+  // Device change events
+  std::atomic<bool> deviceChangeEvents_{false};
+
+  // GDI+, encoders, capture surfaces and buffers shared by every screenshot.
+  // Outlives the threads that use it, which are joined by the destructor.
+  CaptureContext captureContext_;
+
+  // State of takeScreenshotDelta, replaced when its tile size or keyframe
+  // interval changes. Used by the one worker running a delta.
+  std::unique_ptr<ScreenDeltaEncoder> deltaEncoder_;
+
+  // Screenshot schedule, started and stopped on the platform thread.
+  std::thread screenshotScheduleThread_;
+  std::mutex screenshotScheduleMutex_;
+  std::condition_variable screenshotScheduleCv_;
+  bool screenshotScheduleStopping_ = false;
+
+  // Screenshot ring. The thread and |ringOptions_| are only changed on the
+  // platform thread while the ring thread is stopped; |ringMutex_| guards
+  // the stored frames and |ringStopping_|.
+  std::thread ringThread_;
+  std::mutex ringMutex_;
+  std::condition_variable ringCv_;
+  bool ringStopping_ = false;
+  ScreenshotRingOptions ringOptions_;
+  std::unique_ptr<FrameRing> ring_;
+
+  // Screenshot workers, started by the first screenshot. |screenshotQueueMutex_|
+  // guards the queue, the jobs being captured and their requests.
+  std::vector<std::thread> screenshotWorkers_;
+  std::mutex screenshotQueueMutex_;
+  std::condition_variable screenshotQueueCv_;
+  bool screenshotWorkersStopping_ = false;
+  std::deque<std::unique_ptr<ScreenshotJob>> screenshotQueue_;
+  // Jobs whose capture is running; requests can still join them.
+  std::vector<ScreenshotJob*> screenshotsCapturing_;
+  // Whether a worker is running a delta job.
+  bool screenshotDeltaRunning_ = false;
 
   // Flutter channel mutex
   std::mutex channelMutex_;